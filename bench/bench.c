@@ -0,0 +1,145 @@
+#include "bench.h"
+
+#include <cc_metric.h>
+#include <time/cc_timer.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_BATCH_MAX (1ULL << 30)
+
+static uint64_t bench_time_ns = BENCH_TIME * 1000000ULL;
+static const char *bench_filter = NULL;
+
+static void
+_usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t ms] [-f filter]\n"
+            "  -t ms      time spent on each case, default %d\n"
+            "  -f filter  only run cases whose suite/case/param contains "
+            "filter\n", prog, BENCH_TIME);
+}
+
+bool
+bench_match(const char *suite, const char *name, const char *param)
+{
+    char id[256];
+
+    if (bench_filter == NULL) {
+        return true;
+    }
+
+    snprintf(id, sizeof(id), "%s/%s/%s", suite, name, param);
+    return strstr(id, bench_filter) != NULL;
+}
+
+uint64_t
+bench_time(void)
+{
+    return bench_time_ns;
+}
+
+void
+bench_report(const char *suite, const char *name, const char *param,
+        uint64_t nop, double ns, struct metric *m)
+{
+    printf("{\"suite\":\"%s\",\"case\":\"%s\",\"param\":\"%s\","
+            "\"nop\":%"PRIu64",\"ns_op\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+            "\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}\n", suite, name, param,
+            nop, nop == 0 ? 0.0 : ns / nop,
+            metric_histogram_percentile(m, 50) / 1000.0,
+            metric_histogram_percentile(m, 90) / 1000.0,
+            metric_histogram_percentile(m, 99) / 1000.0,
+            metric_histogram_percentile(m, 99.9) / 1000.0,
+            m->histo == NULL ? 0.0 : m->histo->max / 1000.0);
+    fflush(stdout);
+}
+
+static double
+_time_batch(bench_fn fn, void *arg, uint64_t nop)
+{
+    struct duration d;
+
+    duration_start(&d);
+    fn(arg, nop);
+    duration_stop(&d);
+
+    return duration_ns(&d);
+}
+
+void
+bench_run(const char *suite, const char *name, const char *param,
+        bench_fn fn, void *arg)
+{
+    /* per op cost is recorded in ps, as the histogram has integer values */
+    struct metric m = { .type = METRIC_HISTOGRAM };
+    uint64_t batch = 1, nop = 0;
+    double ns, total = 0.0;
+
+    if (!bench_match(suite, name, param)) {
+        return;
+    }
+
+    /* calibrate, then warm up for a tenth of the time */
+    while ((ns = _time_batch(fn, arg, batch)) < BENCH_BATCH_NS &&
+            batch < BENCH_BATCH_MAX) {
+        batch *= 2;
+    }
+    while (total < bench_time_ns / 10) {
+        total += _time_batch(fn, arg, batch);
+    }
+
+    total = 0.0;
+    while (total < bench_time_ns) {
+        ns = _time_batch(fn, arg, batch);
+        metric_histogram_record(&m, (uint64_t)(ns * 1000.0 / batch));
+        total += ns;
+        nop += batch;
+    }
+
+    bench_report(suite, name, param, nop, total, &m);
+    metric_free(&m, 1);
+}
+
+int
+main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "t:f:h")) != -1) {
+        switch (c) {
+        case 't':
+            bench_time_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+            if (bench_time_ns == 0) {
+                _usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'f':
+            bench_filter = optarg;
+            break;
+
+        case 'h':
+            _usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            _usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_ring_array();
+    bench_rbuf();
+    bench_pool();
+    bench_buf();
+    bench_bstring();
+    bench_hash();
+    bench_wheel();
+
+    return EXIT_SUCCESS;
+}
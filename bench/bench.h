@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ * A minimal microbenchmark harness.
+ *
+ * A case is a function doing nop operations of whatever it measures.
+ * bench_run calibrates a batch size so that one batch takes about
+ * BENCH_BATCH_NS, warms up, then times batches for the configured duration
+ * and prints one JSON object per line to stdout:
+ *
+ *   {"suite":"hash","case":"murmur3","param":"64","nop":1234567,
+ *    "ns_op":12.345,"p50":12.250,"p90":12.750,"p99":14.000,"p999":30.000,
+ *    "max":120.500}
+ *
+ * ns_op is the mean over all operations; the percentiles and max are over the
+ * per-operation cost of each batch, also in ns, so they show jitter between
+ * batches rather than the latency of a single operation.
+ */
+
+#include <cc_metric.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BENCH_TIME      200         /* in ms, per case */
+#define BENCH_BATCH_NS  20000       /* target time of a timed batch */
+
+typedef void (*bench_fn)(void *arg, uint64_t nop);
+
+/* whether suite/case/param matches the -f filter, to skip expensive setup */
+bool bench_match(const char *suite, const char *name, const char *param);
+
+/* time fn, skipping it if it does not match the filter */
+void bench_run(const char *suite, const char *name, const char *param,
+        bench_fn fn, void *arg);
+
+/*
+ * for cases timing themselves: the time to spend on each case, in ns, and
+ * reporting nop operations that took ns altogether, with the per-op cost of
+ * each timed batch recorded in m in ps
+ */
+uint64_t bench_time(void);
+void bench_report(const char *suite, const char *name, const char *param,
+        uint64_t nop, double ns, struct metric *m);
+
+/* keep the compiler from optimizing away a value that is never used */
+static inline void
+bench_keep(uint64_t val)
+{
+    __asm__ __volatile__("" : : "r"(val) : "memory");
+}
+
+/* suites */
+void bench_ring_array(void);
+void bench_rbuf(void);
+void bench_pool(void);
+void bench_buf(void);
+void bench_bstring(void);
+void bench_hash(void);
+void bench_wheel(void);
@@ -0,0 +1,59 @@
+#include "bench.h"
+
+#include <cc_bstring.h>
+#include <cc_mm.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE   "bstring"
+#define MAX_LEN 4096
+
+struct pair {
+    struct bstring  s1;
+    struct bstring  s2;
+};
+
+static void
+_compare(void *arg, uint64_t nop)
+{
+    struct pair *p = arg;
+    uint64_t i;
+    int r = 0;
+
+    for (i = 0; i < nop; i++) {
+        r += bstring_compare(&p->s1, &p->s2);
+    }
+    bench_keep((uint64_t)r);
+}
+
+void
+bench_bstring(void)
+{
+    static const uint32_t lens[] = { 8, 32, 256, MAX_LEN };
+    struct pair p;
+    char *d1, *d2, param[32];
+    size_t i;
+
+    /* separate buffers, so the comparison cannot stop at equal pointers */
+    d1 = cc_alloc(MAX_LEN);
+    d2 = cc_alloc(MAX_LEN);
+    memset(d1, 'x', MAX_LEN);
+    memset(d2, 'x', MAX_LEN);
+    p.s1.data = d1;
+    p.s2.data = d2;
+
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        p.s1.len = p.s2.len = lens[i];
+        snprintf(param, sizeof(param), "%"PRIu32"B", lens[i]);
+        d2[lens[i] - 1] = 'x';
+        bench_run(SUITE, "compare_equal", param, _compare, &p);
+        d2[lens[i] - 1] = 'y';
+        bench_run(SUITE, "compare_last", param, _compare, &p);
+        d2[lens[i] - 1] = 'x';
+    }
+
+    cc_free(d1);
+    cc_free(d2);
+}
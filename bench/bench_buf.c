@@ -0,0 +1,76 @@
+#include "bench.h"
+
+#include <buffer/cc_buf.h>
+#include <buffer/cc_dbuf.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE   "buf"
+#define MAX_IO  4096
+#define NDOUBLE 4           /* 16KiB to 256KiB with the default sizes */
+
+struct bufio {
+    struct buf  *buf;
+    uint32_t    n;
+    char        data[MAX_IO];
+};
+
+static void
+_write_read(void *arg, uint64_t nop)
+{
+    struct bufio *b = arg;
+    uint64_t i;
+
+    for (i = 0; i < nop; i++) {
+        buf_write(b->buf, b->data, b->n);
+        buf_read(b->data, b->buf, b->n);
+        buf_reset(b->buf);
+    }
+    bench_keep(b->data[0]);
+}
+
+/* one op is one double, with the shrink back after every NDOUBLE included */
+static void
+_double(void *arg, uint64_t nop)
+{
+    struct bufio *b = arg;
+    uint64_t i;
+
+    for (i = 0; i < nop; i += NDOUBLE) {
+        dbuf_double(&b->buf);
+        dbuf_double(&b->buf);
+        dbuf_double(&b->buf);
+        dbuf_double(&b->buf);
+        dbuf_shrink(&b->buf);
+    }
+}
+
+void
+bench_buf(void)
+{
+    static const uint32_t sizes[] = { 16, 256, MAX_IO };
+    struct bufio b;
+    char param[32];
+    size_t i;
+
+    memset(b.data, 'x', sizeof(b.data));
+    buf_setup(NULL, NULL);
+    dbuf_setup(NULL, NULL);
+
+    b.buf = buf_borrow();
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        b.n = sizes[i];
+        snprintf(param, sizeof(param), "%"PRIu32"B", b.n);
+        bench_run(SUITE, "write_read", param, _write_read, &b);
+    }
+
+    /* doubles go through the size class pools, then realloc beyond them */
+    snprintf(param, sizeof(param), "x%d", NDOUBLE);
+    bench_run(SUITE, "dbuf_double", param, _double, &b);
+    buf_return(&b.buf);
+
+    dbuf_teardown();
+    buf_teardown();
+}
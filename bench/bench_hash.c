@@ -0,0 +1,51 @@
+#include "bench.h"
+
+#include <hash/cc_hash.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE   "hash"
+#define MAX_LEN 4096
+
+struct key {
+    hash_fn     fn;
+    size_t      len;
+    uint8_t     data[MAX_LEN];
+};
+
+static void
+_hash(void *arg, uint64_t nop)
+{
+    struct key *k = arg;
+    uint64_t i, h = 0;
+
+    /* feed each digest into the next seed, so calls cannot overlap */
+    for (i = 0; i < nop; i++) {
+        h = k->fn(k->data, k->len, h);
+    }
+    bench_keep(h);
+}
+
+void
+bench_hash(void)
+{
+    static const size_t lens[] = { 8, 16, 32, 64, 256, 1024, MAX_LEN };
+    static struct key k;
+    char param[32];
+    hash_type_e t;
+    size_t i;
+
+    for (i = 0; i < MAX_LEN; i++) {
+        k.data[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    for (t = HASH_MURMUR3; t < HASH_SENTINEL; t++) {
+        k.fn = hash_get(t);
+        for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            k.len = lens[i];
+            snprintf(param, sizeof(param), "%zuB", k.len);
+            bench_run(SUITE, hash_name(t), param, _hash, &k);
+        }
+    }
+}
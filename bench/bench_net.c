@@ -0,0 +1,827 @@
+/*
+ * End-to-end network benchmark over loopback.
+ *
+ * A server process accepts connections on 127.0.0.1 and serves them from
+ * its own event base, while the client process drives nconn connections in a
+ * closed loop, each keeping depth requests outstanding. Two workloads:
+ * - echo: the server writes back every byte it reads;
+ * - reqrep: for every complete request of size bytes, the server writes a
+ *   response of rsize bytes.
+ * Both ends use buf_sock, with either the chained (buf_tcp_readv and
+ * buf_tcp_writev) or the doubling (dbuf_tcp_read and buf_tcp_write) buffer
+ * paths, readiness-based IO on whichever event backend the library was built
+ * with, or completion-based IO (buf_tcp_*_submit) on io_uring. With -z, conns
+ * enable MSG_ZEROCOPY, which buf_tcp_write uses for large writes.
+ *
+ * After a warm-up, requests are timed from when they are queued on the client
+ * until their response is complete, and the run prints one JSON object to
+ * stdout with the configuration, throughput and latency percentiles in ns.
+ */
+
+#include <buffer/cc_buf.h>
+#include <buffer/cc_dbuf.h>
+#include <cc_debug.h>
+#include <cc_event.h>
+#include <cc_metric.h>
+#include <cc_mm.h>
+#include <cc_option.h>
+#include <channel/cc_tcp.h>
+#include <stream/cc_sockio.h>
+#include <time/cc_timer.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef CC_IO_URING
+#define NET_BACKEND     "io_uring"
+#elif defined(OS_DARWIN)
+#define NET_BACKEND     "kqueue"
+#else
+#define NET_BACKEND     "epoll"
+#endif
+
+#define NET_NCONN       16
+#define NET_DEPTH       1
+#define NET_SIZE        64
+#define NET_TIME        2000    /* in ms */
+#define NET_WARMUP      200     /* in ms */
+#define NET_NEVENT      1024
+#define NET_MAX_SIZE    (1024 * 1024)
+#define NET_DRAIN       1000    /* in ms, to wait for outstanding requests */
+
+enum workload { ECHO, REQREP };
+
+struct config {
+    enum workload   workload;
+    bool            chain;      /* chained instead of doubling buffers */
+    bool            completion; /* completion-based IO */
+    bool            zerocopy;
+    uint32_t        nconn;
+    uint32_t        depth;
+    uint32_t        size;       /* request */
+    uint32_t        rsize;      /* response */
+    uint32_t        time;
+    uint32_t        warmup;
+};
+
+struct conn {
+    struct buf_sock *s;
+    struct end      *end;
+    bool            closed;
+    bool            wwant;      /* readiness: write interest registered */
+    bool            rpend;      /* completion: recv in flight */
+    bool            wpend;      /* completion: send in flight */
+    uint32_t        part;       /* bytes of the request/response in progress */
+
+    /* client only */
+    uint64_t        *ts;        /* ring of depth request timestamps, in ns */
+    uint32_t        head;
+    uint32_t        nout;       /* # outstanding requests */
+    uint32_t        nwant;      /* # requests waiting for room in wbuf */
+};
+
+/* either end of the connections, each driven by one thread */
+struct end {
+    struct event_base   *evb;
+    struct conn         *conn;  /* conn[] */
+    uint32_t            nconn;
+    uint32_t            maxconn;
+    bool                client;
+    struct tcp_conn     *listen;
+};
+
+static struct config cfg = {
+    ECHO, true, false, false,
+    NET_NCONN, NET_DEPTH, NET_SIZE, NET_SIZE, NET_TIME, NET_WARMUP
+};
+
+static char *payload;
+static bool running;            /* client keeps sending requests */
+static bool measuring;          /* client records requests */
+static struct metric latency = { .type = METRIC_HISTOGRAM };
+static uint64_t nresp;          /* measured responses */
+static struct duration since;   /* the client started */
+
+static void _progress(struct conn *c);
+
+static uint64_t
+_now(void)
+{
+    struct duration d;
+
+    duration_snapshot(&d, &since);
+    return (uint64_t)duration_ns(&d);
+}
+
+/*
+ * input and output across rbuf/wbuf and, in chain mode, rchain/wchain
+ */
+static uint32_t
+_input(struct conn *c)
+{
+    return buf_rsize(c->s->rbuf) + buf_chain_rsize(&c->s->rchain);
+}
+
+/* copy n bytes of input to output if out is set, and drop them from input */
+static void
+_consume(struct conn *c, uint32_t n, struct conn *out)
+{
+    struct buf_sock *s = c->s;
+    struct buf *b;
+    uint32_t len, left = n;
+
+    if (out != NULL) {
+        len = MIN(left, buf_rsize(s->rbuf));
+        if (cfg.chain) {
+            buf_sock_write(out->s, s->rbuf->rpos, len);
+        } else {
+            buf_write(out->s->wbuf, s->rbuf->rpos, len);
+        }
+        left -= len;
+        STAILQ_FOREACH(b, &s->rchain, next) {
+            if (left == 0) {
+                break;
+            }
+            len = MIN(left, buf_rsize(b));
+            buf_sock_write(out->s, b->rpos, len);
+            left -= len;
+        }
+        left = n;
+    }
+
+    len = MIN(left, buf_rsize(s->rbuf));
+    s->rbuf->rpos += len;
+    if (left > len) {
+        buf_chain_consume(&s->rchain, left - len);
+    }
+    if (buf_rsize(s->rbuf) == 0 && STAILQ_EMPTY(&s->rchain) && !c->rpend) {
+        buf_reset(s->rbuf);
+    }
+}
+
+/* room for writing at least need bytes, growing wbuf in dbuf mode if we can */
+static uint32_t
+_room(struct conn *c, uint32_t need)
+{
+    struct buf_sock *s = c->s;
+
+    if (cfg.chain) {
+        if (buf_rsize(s->wbuf) == 0 && STAILQ_EMPTY(&s->wchain)) {
+            buf_reset(s->wbuf);
+        }
+        return UINT32_MAX;
+    }
+
+    /* a buf being sent, or referenced by the kernel, must stay in place */
+    if (buf_wsize(s->wbuf) < need && !c->wpend && !buf_sock_wbuf_pinned(s)) {
+        buf_lshift(s->wbuf);
+        while (buf_wsize(s->wbuf) < need && dbuf_double(&s->wbuf) == CC_OK);
+    }
+
+    return buf_wsize(s->wbuf);
+}
+
+static void
+_output(struct conn *c, char *src, uint32_t n)
+{
+    if (cfg.chain) {
+        buf_sock_write(c->s, src, n);
+    } else {
+        buf_write(c->s->wbuf, src, n);
+    }
+}
+
+/*
+ * workloads
+ */
+static void
+_serve(struct conn *c)
+{
+    uint32_t n, avail;
+
+    while ((avail = _input(c)) > 0) {
+        if (cfg.workload == ECHO) {
+            n = MIN(avail, _room(c, avail));
+            if (n == 0) {
+                return;
+            }
+            _consume(c, n, c);
+            continue;
+        }
+
+        n = MIN(avail, cfg.size - c->part);
+        if (c->part + n == cfg.size && _room(c, cfg.rsize) < cfg.rsize) {
+            return;
+        }
+        _consume(c, n, NULL);
+        c->part += n;
+        if (c->part == cfg.size) {
+            _output(c, payload, cfg.rsize);
+            c->part = 0;
+        }
+    }
+}
+
+static void
+_request(struct conn *c)
+{
+    while (c->nwant > 0 && _room(c, cfg.size) >= cfg.size) {
+        _output(c, payload, cfg.size);
+        c->ts[(c->head + c->nout) % cfg.depth] = _now();
+        c->nout++;
+        c->nwant--;
+    }
+}
+
+static void
+_receive(struct conn *c)
+{
+    uint32_t n, avail;
+    uint64_t now;
+
+    while ((avail = _input(c)) > 0) {
+        n = MIN(avail, cfg.rsize - c->part);
+        _consume(c, n, NULL);
+        c->part += n;
+        if (c->part < cfg.rsize) {
+            continue;
+        }
+
+        c->part = 0;
+        ASSERT(c->nout > 0);
+        now = _now();
+        if (measuring) {
+            metric_histogram_record(&latency, now - c->ts[c->head]);
+            nresp++;
+        }
+        c->head = (c->head + 1) % cfg.depth;
+        c->nout--;
+        if (running) {
+            c->nwant++;
+        }
+    }
+    _request(c);
+}
+
+/*
+ * connection handling
+ */
+static void
+_close(struct conn *c)
+{
+    if (c->closed) {
+        return;
+    }
+
+    event_del(c->end->evb, c->s->ch->sd);
+    tcp_close(c->s->ch);
+    c->closed = true;
+}
+
+static void
+_want_write(struct conn *c, bool want)
+{
+    if (want && !c->wwant) {
+        event_add_write(c->end->evb, c->s->ch->sd, c);
+    } else if (!want && c->wwant) {
+        event_del_write(c->end->evb, c->s->ch->sd);
+    }
+    c->wwant = want;
+}
+
+/* readiness-based IO: read what is there, make progress, write what we can */
+static void
+_readiness(struct conn *c, uint32_t events)
+{
+    rstatus_i status;
+
+    if (events & (EVENT_READ | EVENT_ERR)) {
+        status = cfg.chain ? buf_tcp_readv(c->s) : dbuf_tcp_read(c->s);
+        if (status == CC_ERDHUP || status == CC_ERROR) {
+            _close(c);
+            return;
+        }
+    }
+
+    _progress(c);
+
+    status = cfg.chain ? buf_tcp_writev(c->s) : buf_tcp_write(c->s);
+    if (status == CC_ERROR) {
+        _close(c);
+        return;
+    }
+    _want_write(c, status == CC_ERETRY || status == CC_EAGAIN);
+
+    /* sending may have made room for output waiting on it */
+    if (!c->wwant && _input(c) > 0) {
+        _progress(c);
+        if (buf_rsize(c->s->wbuf) > 0) {
+            _want_write(c, true);
+        }
+    }
+}
+
+static void
+_submit(struct conn *c)
+{
+    struct buf *rbuf = c->s->rbuf;
+
+    if (c->closed) {
+        return;
+    }
+
+    if (!c->wpend && buf_rsize(c->s->wbuf) > 0) {
+        c->wpend = buf_tcp_write_submit(c->s, c->end->evb) == CC_OK;
+    }
+    if (!c->rpend) {
+        if (buf_wsize(rbuf) == 0) {
+            buf_lshift(rbuf);
+        }
+        if (buf_wsize(rbuf) == 0) {
+            dbuf_double(&c->s->rbuf);
+        }
+        c->rpend = buf_tcp_read_submit(c->s, c->end->evb) == CC_OK;
+    }
+}
+
+/* completion-based IO: apply the result, make progress, post the next IOs */
+static void
+_io(void *data, uint32_t type, int res)
+{
+    struct conn *c = ((struct buf_sock *)data)->data;
+    rstatus_i status;
+
+    if (c->closed) {
+        return;
+    }
+
+    if (type == EVENT_READ) {
+        c->rpend = false;
+        status = buf_tcp_read_complete(c->s, res);
+    } else {
+        c->wpend = false;
+        status = buf_tcp_write_complete(c->s, res);
+    }
+    if (status == CC_ERDHUP || status == CC_ERROR) {
+        _close(c);
+        return;
+    }
+
+    _progress(c);
+    _submit(c);
+}
+
+static void
+_progress(struct conn *c)
+{
+    if (c->end->client) {
+        _receive(c);
+    } else {
+        _serve(c);
+    }
+}
+
+static struct conn *
+_conn_add(struct end *e, struct buf_sock *s)
+{
+    struct conn *c;
+
+    ASSERT(e->nconn < e->maxconn);
+
+    c = &e->conn[e->nconn++];
+    memset(c, 0, sizeof(*c));
+    c->s = s;
+    c->end = e;
+    s->data = c;
+    if (e->client) {
+        c->ts = cc_alloc(cfg.depth * sizeof(uint64_t));
+        c->nwant = cfg.depth;
+    }
+
+    if (cfg.completion) {
+        _submit(c);
+    } else {
+        event_add_read(e->evb, s->ch->sd, c);
+    }
+
+    return c;
+}
+
+
+static struct end server, client;
+
+static void
+_accept(void)
+{
+    struct buf_sock *s;
+
+    while (server.nconn < server.maxconn && (s = buf_sock_borrow()) != NULL) {
+        if (!tcp_accept(server.listen, s->ch)) {
+            buf_sock_return(&s);
+            return;
+        }
+        _conn_add(&server, s);
+    }
+    tcp_reject_all(server.listen);
+}
+
+static void
+_event(void *data, uint32_t events)
+{
+    struct conn *c = data;
+
+    if (data == &server) {
+        _accept();
+    } else if (!c->closed) {
+        _readiness(c, events);
+    }
+}
+
+static rstatus_i
+_end_create(struct end *e, bool is_client)
+{
+    e->client = is_client;
+    e->maxconn = cfg.nconn;
+    e->conn = cc_alloc(cfg.nconn * sizeof(struct conn));
+    e->evb = event_base_create(NET_NEVENT, _event);
+    if (e->conn == NULL || e->evb == NULL) {
+        return CC_ENOMEM;
+    }
+    event_base_set_lazy(e->evb, true);
+    if (cfg.completion) {
+        event_base_set_io_cb(e->evb, _io);
+    }
+
+    return CC_OK;
+}
+
+/* closing everything before the event base is gone, destroying after it */
+static void
+_end_destroy(struct end *e)
+{
+    uint32_t i;
+
+    if (e->evb == NULL) {
+        cc_free(e->conn);
+        return;
+    }
+
+    for (i = 0; i < e->nconn; i++) {
+        _close(&e->conn[i]);
+    }
+    if (e->listen != NULL) {
+        event_del(e->evb, e->listen->sd);
+        tcp_close(e->listen);
+        tcp_conn_destroy(&e->listen);
+    }
+    event_base_destroy(&e->evb);
+    for (i = 0; i < e->nconn; i++) {
+        cc_free(e->conn[i].ts);
+        buf_sock_return(&e->conn[i].s);
+    }
+    cc_free(e->conn);
+}
+
+/* the server is done once all client conns have come and gone */
+static bool
+_served(void)
+{
+    uint32_t i;
+
+    if (server.nconn < cfg.nconn) {
+        return false;
+    }
+    for (i = 0; i < server.nconn; i++) {
+        if (!server.conn[i].closed) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int
+_serve_all(void)
+{
+    if (_end_create(&server, false) != CC_OK) {
+        return EXIT_FAILURE;
+    }
+    event_add_read(server.evb, server.listen->sd, &server);
+    while (!_served()) {
+        event_wait(server.evb, 10);
+    }
+    _end_destroy(&server);
+
+    return EXIT_SUCCESS;
+}
+
+static bool
+_drained(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < client.nconn; i++) {
+        if (!client.conn[i].closed && client.conn[i].nout > 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+_report(double ms)
+{
+    printf("{\"backend\":\"%s\",\"io\":\"%s\",\"workload\":\"%s\","
+            "\"buffer\":\"%s\",\"zerocopy\":%s,\"conns\":%"PRIu32","
+            "\"depth\":%"PRIu32",\"size\":%"PRIu32",\"rsize\":%"PRIu32","
+            "\"time_ms\":%.1f,\"nreq\":%"PRIu64",\"req_s\":%.1f,"
+            "\"mb_s\":%.3f,\"mean\":%.1f,\"p50\":%"PRIu64",\"p90\":%"PRIu64","
+            "\"p99\":%"PRIu64",\"p999\":%"PRIu64",\"max\":%"PRIu64"}\n",
+            NET_BACKEND, cfg.completion ? "completion" : "readiness",
+            cfg.workload == ECHO ? "echo" : "reqrep",
+            cfg.chain ? "chain" : "dbuf", cfg.zerocopy ? "true" : "false",
+            cfg.nconn, cfg.depth, cfg.size, cfg.rsize, ms, nresp,
+            nresp * 1000.0 / ms,
+            (double)nresp * (cfg.size + cfg.rsize) / ms / 1000.0,
+            nresp == 0 ? 0.0 : (double)latency.histo->sum / nresp,
+            metric_histogram_percentile(&latency, 50),
+            metric_histogram_percentile(&latency, 90),
+            metric_histogram_percentile(&latency, 99),
+            metric_histogram_percentile(&latency, 99.9),
+            nresp == 0 ? 0 : latency.histo->max);
+}
+
+static rstatus_i
+_listen(uint16_t *port)
+{
+    struct addrinfo hints, *ai;
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    struct tcp_conn *lc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo("127.0.0.1", "0", &hints, &ai) != 0) {
+        return CC_ERROR;
+    }
+    lc = tcp_conn_create();
+    if (lc == NULL || !tcp_listen(ai, lc)) {
+        tcp_conn_destroy(&lc);
+        freeaddrinfo(ai);
+        return CC_ERROR;
+    }
+    freeaddrinfo(ai);
+    if (getsockname(lc->sd, (struct sockaddr *)&sin, &len) < 0) {
+        tcp_close(lc);
+        tcp_conn_destroy(&lc);
+        return CC_ERROR;
+    }
+
+    server.listen = lc;
+    *port = ntohs(sin.sin_port);
+
+    return CC_OK;
+}
+
+static rstatus_i
+_run(uint16_t port)
+{
+    struct addrinfo hints, *ai;
+    struct buf_sock *s;
+    uint64_t start, end;
+    char serv[8];
+    uint32_t i;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(serv, sizeof(serv), "%"PRIu16, port);
+    if (getaddrinfo("127.0.0.1", serv, &hints, &ai) != 0) {
+        return CC_ERROR;
+    }
+    for (i = 0; i < cfg.nconn; i++) {
+        s = buf_sock_borrow();
+        if (s == NULL || !tcp_connect(ai, s->ch)) {
+            buf_sock_return(&s);
+            freeaddrinfo(ai);
+            return CC_ERROR;
+        }
+        _conn_add(&client, s);
+    }
+    freeaddrinfo(ai);
+
+    /* requests go out with the writes following the first wakeup */
+    duration_start(&since);
+    running = true;
+    for (i = 0; i < client.nconn; i++) {
+        _request(&client.conn[i]);
+        if (cfg.completion) {
+            _submit(&client.conn[i]);
+        } else {
+            _want_write(&client.conn[i], true);
+        }
+    }
+
+    while (_now() < cfg.warmup * 1000000ULL) {
+        event_wait(client.evb, 1);
+    }
+    measuring = true;
+    start = _now();
+    while ((end = _now()) < start + cfg.time * 1000000ULL) {
+        event_wait(client.evb, 1);
+    }
+    measuring = false;
+    running = false;
+
+    while (!_drained() && _now() < end + NET_DRAIN * 1000000ULL) {
+        event_wait(client.evb, 1);
+    }
+    _report((end - start) / 1000000.0);
+
+    return CC_OK;
+}
+
+static void
+_usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-m echo|reqrep] [-b chain|dbuf] [-a] [-z] "
+            "[-c conns] [-d depth] [-s size] [-r rsize] [-t ms] [-w ms]\n"
+            "  -m  workload, default echo\n"
+            "  -b  buffer path, default chain\n"
+            "  -a  completion-based IO, io_uring only, with dbuf\n"
+            "  -z  MSG_ZEROCOPY for large writes, with dbuf\n"
+            "  -c  # connections, default %d\n"
+            "  -d  # requests outstanding per connection, default %d\n"
+            "  -s  request size, default %d\n"
+            "  -r  response size for reqrep, default the request size\n"
+            "  -t  measured time in ms, default %d\n"
+            "  -w  warm-up time in ms, default %d\n", prog,
+            NET_NCONN, NET_DEPTH, NET_SIZE, NET_TIME, NET_WARMUP);
+}
+
+static uint32_t
+_uint(const char *arg, uint32_t min, uint32_t max)
+{
+    unsigned long val = strtoul(arg, NULL, 10);
+
+    return (val < min || val > max) ? 0 : (uint32_t)val;
+}
+
+int
+main(int argc, char **argv)
+{
+    tcp_options_st toptions = { TCP_OPTION(OPTION_INIT) };
+    bool rsize = false;
+    rstatus_i status;
+    uint16_t port;
+    pid_t pid = -1;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:b:azc:d:s:r:t:w:h")) != -1) {
+        switch (c) {
+        case 'm':
+            if (strcmp(optarg, "echo") == 0) {
+                cfg.workload = ECHO;
+            } else if (strcmp(optarg, "reqrep") == 0) {
+                cfg.workload = REQREP;
+            } else {
+                c = '?';
+            }
+            break;
+
+        case 'b':
+            if (strcmp(optarg, "chain") == 0) {
+                cfg.chain = true;
+            } else if (strcmp(optarg, "dbuf") == 0) {
+                cfg.chain = false;
+            } else {
+                c = '?';
+            }
+            break;
+
+        case 'a':
+            cfg.completion = true;
+            break;
+
+        case 'z':
+            cfg.zerocopy = true;
+            break;
+
+        case 'c':
+            c = (cfg.nconn = _uint(optarg, 1, 65536)) == 0 ? '?' : c;
+            break;
+
+        case 'd':
+            c = (cfg.depth = _uint(optarg, 1, 65536)) == 0 ? '?' : c;
+            break;
+
+        case 's':
+            c = (cfg.size = _uint(optarg, 1, NET_MAX_SIZE)) == 0 ? '?' : c;
+            break;
+
+        case 'r':
+            c = (cfg.rsize = _uint(optarg, 1, NET_MAX_SIZE)) == 0 ? '?' : c;
+            rsize = true;
+            break;
+
+        case 't':
+            c = (cfg.time = _uint(optarg, 1, UINT32_MAX)) == 0 ? '?' : c;
+            break;
+
+        case 'w':
+            cfg.warmup = _uint(optarg, 0, UINT32_MAX);
+            break;
+
+        case 'h':
+            _usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            c = '?';
+            break;
+        }
+        if (c == '?') {
+            _usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!rsize || cfg.workload == ECHO) {
+        cfg.rsize = cfg.size;
+    }
+#ifndef CC_IO_URING
+    if (cfg.completion) {
+        fprintf(stderr, "completion-based IO needs the io_uring backend\n");
+        return EXIT_FAILURE;
+    }
+#endif
+    if (cfg.chain && (cfg.completion || cfg.zerocopy)) {
+        fprintf(stderr, "-a and -z only work with -b dbuf\n");
+        return EXIT_FAILURE;
+    }
+
+    option_load_default((struct option *)&toptions,
+            OPTION_CARDINALITY(tcp_options_st));
+    toptions.tcp_zerocopy.val.vbool = cfg.zerocopy;
+    buf_setup(NULL, NULL);
+    dbuf_setup(NULL, NULL);
+    event_setup(NULL);
+    tcp_setup(&toptions, NULL);
+    sockio_setup(NULL, NULL);
+
+    payload = cc_alloc(MAX(cfg.size, cfg.rsize));
+    memset(payload, 'x', MAX(cfg.size, cfg.rsize));
+
+    /*
+     * the server runs in a child process: the buf and buf_sock pools are not
+     * thread safe, and a separate process keeps the two ends from sharing
+     * anything but the loopback device
+     */
+    status = _listen(&port);
+    if (status == CC_OK) {
+        pid = fork();
+        if (pid == 0) {
+            exit(_serve_all());
+        }
+        /* the parent keeps port, but not the listener */
+        tcp_close(server.listen);
+        tcp_conn_destroy(&server.listen);
+        status = pid < 0 ? CC_ERROR : _end_create(&client, true);
+    }
+    if (status == CC_OK) {
+        status = _run(port);
+    }
+    if (status != CC_OK) {
+        fprintf(stderr, "benchmark setup failed: %s\n", strerror(errno));
+    }
+
+    _end_destroy(&client);
+    if (pid > 0) {
+        if (status != CC_OK) {
+            kill(pid, SIGTERM);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    cc_free(payload);
+    metric_free(&latency, 1);
+
+    sockio_teardown();
+    tcp_teardown();
+    event_teardown();
+    dbuf_teardown();
+    buf_teardown();
+
+    return status == CC_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+#include "bench.h"
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_pool.h>
+
+#include <stdlib.h>
+
+#define SUITE   "pool"
+#define NOBJ    1024
+#define NBURST  64
+
+struct obj {
+    STAILQ_ENTRY(obj)   next;
+    char                data[48];
+};
+
+FREEPOOL(obj_pool, objq, obj);
+static struct obj_pool objp;
+
+FREEPOOL_SHARDED(obj_spool, objsq, obj);
+static struct obj_spool objsp;
+static __thread struct obj_spool_local objsp_local;
+
+static struct obj *
+_obj_create(void)
+{
+    return cc_alloc(sizeof(struct obj));
+}
+
+static void
+_obj_destroy(struct obj **o)
+{
+    cc_free(*o);
+    *o = NULL;
+}
+
+static void
+_borrow_return(void *arg, uint64_t nop)
+{
+    struct obj *o;
+    uint64_t i;
+
+    (void)arg;
+
+    for (i = 0; i < nop; i++) {
+        FREEPOOL_BORROW(o, &objp, next, _obj_create);
+        FREEPOOL_RETURN(o, &objp, next);
+    }
+}
+
+static void
+_borrow_return_burst(void *arg, uint64_t nop)
+{
+    struct obj *o[NBURST];
+    uint64_t i;
+    int j;
+
+    (void)arg;
+
+    for (i = 0; i < nop; i += NBURST) {
+        for (j = 0; j < NBURST; j++) {
+            FREEPOOL_BORROW(o[j], &objp, next, _obj_create);
+        }
+        for (j = 0; j < NBURST; j++) {
+            FREEPOOL_RETURN(o[j], &objp, next);
+        }
+    }
+}
+
+static void
+_sharded_borrow_return(void *arg, uint64_t nop)
+{
+    struct obj *o;
+    uint64_t i;
+
+    (void)arg;
+
+    for (i = 0; i < nop; i++) {
+        FREEPOOL_SHARDED_BORROW(o, &objsp, &objsp_local, next, _obj_create);
+        FREEPOOL_SHARDED_RETURN(o, &objsp, &objsp_local, next);
+    }
+}
+
+/* twice the batch size, so every burst goes through the depot */
+static void
+_sharded_borrow_return_burst(void *arg, uint64_t nop)
+{
+    struct obj *o[NBURST];
+    uint64_t i;
+    int j;
+
+    (void)arg;
+
+    for (i = 0; i < nop; i += NBURST) {
+        for (j = 0; j < NBURST; j++) {
+            FREEPOOL_SHARDED_BORROW(o[j], &objsp, &objsp_local, next,
+                    _obj_create);
+        }
+        for (j = 0; j < NBURST; j++) {
+            FREEPOOL_SHARDED_RETURN(o[j], &objsp, &objsp_local, next);
+        }
+    }
+}
+
+void
+bench_pool(void)
+{
+    struct obj *o, *to;
+
+    FREEPOOL_CREATE(&objp, NOBJ);
+    FREEPOOL_PREALLOC(o, &objp, NOBJ, next, _obj_create);
+    bench_run(SUITE, "borrow_return", "freepool", _borrow_return, NULL);
+    bench_run(SUITE, "borrow_return_burst64", "freepool",
+            _borrow_return_burst, NULL);
+    FREEPOOL_DESTROY(o, to, &objp, next, _obj_destroy);
+
+    FREEPOOL_SHARDED_CREATE(&objsp, NOBJ, 0);
+    FREEPOOL_SHARDED_PREALLOC(o, &objsp, NOBJ, next, _obj_create);
+    bench_run(SUITE, "borrow_return", "sharded", _sharded_borrow_return,
+            NULL);
+    bench_run(SUITE, "borrow_return_burst64", "sharded",
+            _sharded_borrow_return_burst, NULL);
+    FREEPOOL_SHARDED_DRAIN(&objsp, &objsp_local, next);
+    FREEPOOL_SHARDED_DESTROY(o, to, &objsp, next, _obj_destroy);
+}
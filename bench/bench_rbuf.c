@@ -0,0 +1,51 @@
+#include "bench.h"
+
+#include <cc_rbuf.h>
+#include <cc_util.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE   "rbuf"
+#define CAP     (64 * KiB)
+#define MAX_IO  4096
+
+struct ring {
+    struct rbuf *buf;
+    size_t      n;
+    char        data[MAX_IO];
+};
+
+static void
+_write_read(void *arg, uint64_t nop)
+{
+    struct ring *r = arg;
+    uint64_t i;
+
+    for (i = 0; i < nop; i++) {
+        rbuf_write(r->buf, r->data, r->n);
+        rbuf_read(r->data, r->buf, r->n);
+    }
+    bench_keep(r->data[0]);
+}
+
+void
+bench_rbuf(void)
+{
+    static const size_t sizes[] = { 16, 256, MAX_IO };
+    struct ring r;
+    char param[32];
+    size_t i;
+
+    memset(r.data, 'x', sizeof(r.data));
+    rbuf_setup(NULL);
+    /* odd sized writes keep moving where the ring wraps */
+    r.buf = rbuf_create(CAP - 1);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        r.n = sizes[i];
+        snprintf(param, sizeof(param), "%zuB", r.n);
+        bench_run(SUITE, "write_read", param, _write_read, &r);
+    }
+    rbuf_destroy(&r.buf);
+    rbuf_teardown();
+}
@@ -0,0 +1,135 @@
+#include "bench.h"
+
+#include <cc_ring_array.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE   "ring_array"
+#define CAP     1024
+#define NBATCH  32
+#define ELEM    64
+#define NSPIN   1024        /* failed tries before yielding the cpu */
+
+struct ring {
+    struct ring_array   *arr;
+    bool                stop;   /* atomic */
+};
+
+static void
+_push_pop(void *arg, uint64_t nop)
+{
+    struct ring *r = arg;
+    uint8_t elem[ELEM] = { 0 };
+    uint64_t i;
+
+    for (i = 0; i < nop; i++) {
+        ring_array_push(elem, r->arr);
+        ring_array_pop(elem, r->arr);
+    }
+    bench_keep(elem[0]);
+}
+
+static void
+_push_pop_n(void *arg, uint64_t nop)
+{
+    struct ring *r = arg;
+    uint8_t elem[NBATCH * ELEM] = { 0 };
+    uint64_t i;
+
+    for (i = 0; i < nop; i += NBATCH) {
+        ring_array_push_n(elem, NBATCH, r->arr);
+        ring_array_pop_n(elem, NBATCH, r->arr);
+    }
+    bench_keep(elem[0]);
+}
+
+static void
+_backoff(uint32_t *nfail)
+{
+    if (++*nfail == NSPIN) {
+        *nfail = 0;
+        sched_yield();
+    }
+}
+
+/* keeps the array as full as it can until told to stop */
+static void *
+_producer(void *arg)
+{
+    struct ring *r = arg;
+    uint8_t elem[ELEM] = { 0 };
+    uint32_t nfail = 0;
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+        if (ring_array_push(elem, r->arr) != CC_OK) {
+            _backoff(&nfail);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+_pop(void *arg, uint64_t nop)
+{
+    struct ring *r = arg;
+    uint8_t elem[ELEM];
+    uint32_t nfail = 0;
+    uint64_t i;
+
+    for (i = 0; i < nop; i++) {
+        while (ring_array_pop(elem, r->arr) != CC_OK) {
+            _backoff(&nfail);
+        }
+    }
+    bench_keep(elem[0]);
+}
+
+static void
+_run(const char *name, size_t elem_size, bool mpmc, uint32_t nproducer,
+        bench_fn fn)
+{
+    pthread_t tid[4];
+    struct ring r = { NULL, false };
+    char param[32];
+    uint32_t i;
+
+    snprintf(param, sizeof(param), "%s/%zuB", mpmc ? "mpmc" : "spsc",
+            elem_size);
+    if (!bench_match(SUITE, name, param)) {
+        return;
+    }
+
+    r.arr = mpmc ? ring_array_create_mpmc(elem_size, CAP) :
+            ring_array_create(elem_size, CAP);
+    for (i = 0; i < nproducer; i++) {
+        pthread_create(&tid[i], NULL, _producer, &r);
+    }
+
+    bench_run(SUITE, name, param, fn, &r);
+
+    __atomic_store_n(&r.stop, true, __ATOMIC_RELAXED);
+    for (i = 0; i < nproducer; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    ring_array_destroy(&r.arr);
+}
+
+void
+bench_ring_array(void)
+{
+    _run("push_pop", 8, false, 0, _push_pop);
+    _run("push_pop", ELEM, false, 0, _push_pop);
+    _run("push_pop", 8, true, 0, _push_pop);
+    _run("push_pop", ELEM, true, 0, _push_pop);
+    _run("push_pop_n32", 8, false, 0, _push_pop_n);
+    _run("push_pop_n32", 8, true, 0, _push_pop_n);
+
+    /* cross thread, timing the consumer */
+    _run("1p1c", 8, false, 1, _pop);
+    _run("1p1c", 8, true, 1, _pop);
+    _run("4p1c", 8, true, 4, _pop);
+}
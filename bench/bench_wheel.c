@@ -0,0 +1,322 @@
+#include "bench.h"
+
+#include <cc_mm.h>
+#include <cc_util.h>
+#include <time/cc_wheel.h>
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * A wheel loaded with nevent timeouts of 1ms ticks, whose delays follow one of
+ * a few distributions:
+ * - fixed:   request timeouts, 1s plus up to 10ms of jitter, so expiries come
+ *            in bursts
+ * - uniform: anything from 1ms to 60s
+ * - exp:     exponential with a mean of 1s (capped at 60s), mostly short with
+ *            a long tail, like a mix of request and idle timeouts
+ * Every event that fires inserts itself again with a new delay, keeping the
+ * load constant, so execute includes one insert per event processed.
+ *
+ * Inserts are timed while filling the wheel; remove, reschedule and touch on
+ * random events of the loaded wheel, batches of NBATCH at a time; execute and
+ * next_ns once per tick, with the clock of the wheel advanced one tick per
+ * call instead of waiting for it.
+ */
+
+#define SUITE       "wheel"
+#define TICK_NS     1000000ULL
+#define MAX_DELAY   60000       /* in ticks */
+#define NBATCH      1024
+
+#define FLAT_CAP    65536       /* one level covering MAX_DELAY */
+#define LEVEL_CAP   256
+#define LEVEL_N     3
+
+typedef uint64_t (*delay_fn)(void);
+
+static struct timing_wheel *tw;
+static struct timeout_event **ev;
+static delay_fn delay;
+static uint64_t rnd = 88172645463325252ULL;
+
+static uint64_t
+_rand(void)
+{
+    /* xorshift64 */
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 7;
+    rnd ^= rnd << 17;
+
+    return rnd;
+}
+
+static uint64_t
+_fixed(void)
+{
+    return 1000 + _rand() % 10;
+}
+
+static uint64_t
+_uniform(void)
+{
+    return 1 + _rand() % MAX_DELAY;
+}
+
+static uint64_t
+_exp(void)
+{
+    double u = (double)(_rand() >> 11) / (double)(1ULL << 53);
+    double d = -1000.0 * log(1.0 - u);
+
+    return d < 1.0 ? 1 : (d > MAX_DELAY ? MAX_DELAY : (uint64_t)d);
+}
+
+static void
+_delay(struct timeout *t)
+{
+    timeout_set_ns(t, delay() * TICK_NS);
+}
+
+static void
+_fire(void *arg)
+{
+    struct timeout_event **e = arg;
+    struct timeout t;
+
+    _delay(&t);
+    *e = timing_wheel_insert(tw, &t, false, _fire, e);
+}
+
+static void
+_pick(uint32_t *idx, uint32_t nevent)
+{
+    uint32_t i;
+
+    for (i = 0; i < NBATCH; i++) {
+        idx[i] = (uint32_t)(_rand() % nevent);
+    }
+}
+
+static void
+_record(struct metric *m, struct duration *d, uint64_t nop, double *total)
+{
+    duration_stop(d);
+    metric_histogram_record(m, (uint64_t)(duration_ns(d) * 1000.0 / nop));
+    *total += duration_ns(d);
+}
+
+static void
+_fill(const char *param, uint32_t nevent)
+{
+    struct metric m = { .type = METRIC_HISTOGRAM };
+    struct timeout t[NBATCH];
+    struct duration d;
+    double total = 0.0;
+    uint32_t i, j, n;
+
+    for (i = 0; i < nevent; i += n) {
+        n = MIN(NBATCH, nevent - i);
+        for (j = 0; j < n; j++) {
+            _delay(&t[j]);
+        }
+        duration_start(&d);
+        for (j = 0; j < n; j++) {
+            ev[i + j] = timing_wheel_insert(tw, &t[j], false, _fire,
+                    &ev[i + j]);
+        }
+        _record(&m, &d, n, &total);
+    }
+
+    if (bench_match(SUITE, "insert", param)) {
+        bench_report(SUITE, "insert", param, nevent, total, &m);
+    }
+    metric_free(&m, 1);
+}
+
+/* remove a batch, then put it back untimed */
+static void
+_remove(const char *param, uint32_t nevent)
+{
+    struct metric m = { .type = METRIC_HISTOGRAM };
+    struct timeout t;
+    struct duration d;
+    uint32_t idx[NBATCH], i;
+    uint64_t nop = 0;
+    double total = 0.0;
+
+    while (total < bench_time()) {
+        _pick(idx, nevent);
+        duration_start(&d);
+        for (i = 0; i < NBATCH; i++) {
+            if (ev[idx[i]] != NULL) {
+                timing_wheel_remove(tw, &ev[idx[i]]);
+            }
+        }
+        _record(&m, &d, NBATCH, &total);
+        nop += NBATCH;
+        for (i = 0; i < NBATCH; i++) {
+            if (ev[idx[i]] == NULL) {
+                _delay(&t);
+                ev[idx[i]] = timing_wheel_insert(tw, &t, false, _fire,
+                        &ev[idx[i]]);
+            }
+        }
+    }
+
+    bench_report(SUITE, "remove", param, nop, total, &m);
+    metric_free(&m, 1);
+}
+
+static void
+_reschedule(const char *param, uint32_t nevent, bool touch)
+{
+    struct metric m = { .type = METRIC_HISTOGRAM };
+    struct timeout t[NBATCH];
+    struct duration d;
+    uint32_t idx[NBATCH], i;
+    uint64_t nop = 0;
+    double total = 0.0;
+
+    while (total < bench_time()) {
+        _pick(idx, nevent);
+        for (i = 0; i < NBATCH; i++) {
+            _delay(&t[i]);
+        }
+        duration_start(&d);
+        if (touch) {
+            for (i = 0; i < NBATCH; i++) {
+                timing_wheel_touch(tw, ev[idx[i]]);
+            }
+        } else {
+            for (i = 0; i < NBATCH; i++) {
+                timing_wheel_reschedule(tw, ev[idx[i]], &t[i]);
+            }
+        }
+        _record(&m, &d, NBATCH, &total);
+        nop += NBATCH;
+    }
+
+    bench_report(SUITE, touch ? "touch" : "reschedule", param, nop, total, &m);
+    metric_free(&m, 1);
+}
+
+static void
+_execute(const char *param)
+{
+    struct metric m = { .type = METRIC_HISTOGRAM };
+    struct metric mn = { .type = METRIC_HISTOGRAM };
+    struct duration d;
+    uint64_t nop = 0;
+    double total = 0.0, total_next = 0.0;
+    int64_t next = 0;
+
+    tw->max_ntick = 1;
+    timing_wheel_start(tw);
+    while (total < bench_time()) {
+        /* make the next tick due right away */
+        timeout_add_ns(&tw->due, 0);
+        duration_start(&d);
+        timing_wheel_execute(tw);
+        _record(&m, &d, 1, &total);
+
+        duration_start(&d);
+        next += timing_wheel_next_ns(tw);
+        _record(&mn, &d, 1, &total_next);
+        nop++;
+    }
+    timing_wheel_stop(tw);
+    bench_keep((uint64_t)next);
+
+    if (bench_match(SUITE, "execute", param)) {
+        bench_report(SUITE, "execute", param, nop, total, &m);
+    }
+    if (bench_match(SUITE, "next_ns", param)) {
+        bench_report(SUITE, "next_ns", param, nop, total_next, &mn);
+    }
+    metric_free(&m, 1);
+    metric_free(&mn, 1);
+}
+
+static bool
+_match(const char *param)
+{
+    static const char *ops[] = {
+        "insert", "remove", "reschedule", "touch", "execute", "next_ns"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (bench_match(SUITE, ops[i], param)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+_run(const char *wheel, const char *dist, uint32_t nevent)
+{
+    struct timeout tick;
+    char param[64];
+
+    snprintf(param, sizeof(param), "%s/%s/%"PRIu32"M", wheel, dist,
+            nevent / 1000000);
+    if (!_match(param)) {
+        return;
+    }
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = strcmp(wheel, "flat") == 0 ? timing_wheel_create(&tick, FLAT_CAP, 0)
+            : timing_wheel_create_levels(&tick, LEVEL_CAP, 0, LEVEL_N);
+    ev = cc_alloc(nevent * sizeof(*ev));
+    if (tw == NULL || ev == NULL) {
+        fprintf(stderr, "%s: out of memory for %"PRIu32" events\n", param,
+                nevent);
+        timing_wheel_destroy(&tw);
+        cc_free(ev);
+        return;
+    }
+
+    _fill(param, nevent);
+    if (bench_match(SUITE, "remove", param)) {
+        _remove(param, nevent);
+    }
+    if (bench_match(SUITE, "reschedule", param)) {
+        _reschedule(param, nevent, false);
+    }
+    if (bench_match(SUITE, "touch", param)) {
+        _reschedule(param, nevent, true);
+    }
+    if (bench_match(SUITE, "execute", param) ||
+            bench_match(SUITE, "next_ns", param)) {
+        _execute(param);
+    }
+
+    timing_wheel_destroy(&tw);
+    cc_free(ev);
+}
+
+void
+bench_wheel(void)
+{
+    static const struct {
+        const char  *name;
+        delay_fn    fn;
+    } dists[] = { { "fixed", _fixed }, { "uniform", _uniform }, { "exp", _exp } };
+    static const uint32_t loads[] = { 1000000, 10000000 };
+    size_t i, j;
+
+    timing_wheel_setup(NULL);
+    for (i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+        for (j = 0; j < sizeof(dists) / sizeof(dists[0]); j++) {
+            delay = dists[j].fn;
+            _run("flat", dists[j].name, loads[i]);
+            _run("levels", dists[j].name, loads[i]);
+        }
+    }
+    timing_wheel_teardown();
+}
@@ -30,6 +30,7 @@ extern "C" {
 #include <cc_define.h>
 #include <cc_metric.h>
 #include <cc_option.h>
+#include <cc_print.h>
 #include <cc_queue.h>
 #include <cc_util.h>
 
@@ -40,7 +41,12 @@ extern "C" {
 /*          name            type                default             description */
 #define BUF_OPTION(ACTION)                                                                       \
     ACTION( buf_init_size,  OPTION_TYPE_UINT,   BUF_DEFAULT_SIZE,   "init buf size incl header" )\
-    ACTION( buf_poolsize,   OPTION_TYPE_UINT,   BUF_POOLSIZE,       "buf pool size"             )
+    ACTION( buf_poolsize,   OPTION_TYPE_UINT,   BUF_POOLSIZE,       "buf pool size"             )\
+    ACTION( buf_nclass,     OPTION_TYPE_UINT,   BUF_NCLASS,         "# of pooled size classes"  )\
+    ACTION( buf_poolslab,   OPTION_TYPE_BOOL,   BUF_POOLSLAB,       "prealloc pool in one mmap" )\
+    ACTION( buf_pool_low,   OPTION_TYPE_UINT,   BUF_POOL_LOW,       "free bufs kept by trim"    )\
+    ACTION( buf_pool_high,  OPTION_TYPE_UINT,   BUF_POOL_HIGH,      "max free bufs per class"   )\
+    ACTION( buf_memory_max, OPTION_TYPE_UINT,   BUF_MEMORY_MAX,     "max bytes in bufs, 0: any" )
 
 typedef struct {
     BUF_OPTION(OPTION_DECLARE)
@@ -56,28 +62,74 @@ typedef struct {
     ACTION( buf_borrow,       METRIC_COUNTER, "# buf borrows"                          )\
     ACTION( buf_borrow_ex,    METRIC_COUNTER, "# buf borrow exceptions"                )\
     ACTION( buf_return,       METRIC_COUNTER, "# buf returns"                          )\
-    ACTION( buf_memory,       METRIC_GAUGE,   "memory alloc'd to buf including header" )
+    ACTION( buf_memory,       METRIC_GAUGE,   "memory alloc'd to buf including header" )\
+    ACTION( buf_memory_ex,    METRIC_COUNTER, "# buf create over buf_memory_max"       )\
+    ACTION( buf_trim,         METRIC_COUNTER, "# free buf destroyed by trim"           )
 
 typedef struct {
     BUF_METRIC(METRIC_DECLARE)
 } buf_metrics_st;
 
+/*
+ * The header takes exactly one cache line, cursors first, and bufs are placed
+ * on cache line boundaries: heap bufs are allocated BUF_ALIGN bytes larger and
+ * start at the first aligned address in there (shift bytes in), slab bufs get
+ * aligned slots. So the payload at begin is always cache line aligned, and
+ * parsers can use aligned vector loads on it.
+ */
+#define BUF_ALIGN          CC_CACHELINE_SIZE
+
 struct buf {
-    STAILQ_ENTRY(buf) next;     /* next buf in pool */
     char              *rpos;    /* read marker */
     char              *wpos;    /* write marker */
     char              *end;     /* end of buffer */
+    STAILQ_ENTRY(buf) next;     /* next buf in pool or chain */
+    uint8_t           cid;      /* class of the pool it was borrowed from */
+    uint8_t           shift;    /* offset into its allocation, 0 in slab */
     bool              free;     /* is this buf free? */
+    char              _pad[BUF_ALIGN - 4 * sizeof(char *) - 3];
     char              begin[1]; /* beginning of buffer */
 };
 
 #define BUF_HDR_SIZE       offsetof(struct buf, begin)
 #define BUF_DEFAULT_SIZE   16 * KiB
 #define BUF_POOLSIZE       0    /* unlimited */
+/*
+ * With buf_poolslab, a preallocated (buf_poolsize > 0) pool is carved out of a
+ * single mmap'd slab instead of one cc_alloc per buf: startup is fast, bufs
+ * are dense in memory, and the region is hugepage-backed when cc_mm is set
+ * up to do so. Slab bufs are never realloc'd, dbuf copies them instead.
+ */
+#define BUF_POOLSLAB       false
+
+/*
+ * Size classes: class i holds bufs of buf_init_size << i bytes, each with its
+ * own pool of up to buf_poolsize bufs. buf_borrow always hands out the base
+ * class; dbuf moves buffers between classes instead of reallocating, and
+ * buf_return parks a buf in the class of its current size. Picking a small
+ * buf_init_size (e.g. 4KiB) keeps idle connections cheap, while large ones
+ * grow through pooled classes.
+ */
+#define BUF_NCLASS         4    /* e.g. 16K, 32K, 64K, 128K */
+#define BUF_NCLASS_MAX     16
+#define BUF_CLASS_NONE     UINT8_MAX
+
+/*
+ * Memory pressure: pools keep what they borrowed at peak unless trimmed, see
+ * cc_pool.h. buf_trim trims every class down towards buf_pool_low free bufs
+ * and buf_pool_high caps the free bufs of a class at any time. With
+ * buf_memory_max, bufs are not created beyond that many bytes in total: free
+ * bufs of other classes are destroyed to make room first, and if that is not
+ * enough borrow (or dbuf growth) fails right away and counts buf_memory_ex.
+ */
+#define BUF_POOL_LOW       0
+#define BUF_POOL_HIGH      0    /* unlimited */
+#define BUF_MEMORY_MAX     0    /* unlimited */
 
 STAILQ_HEAD(buf_sqh, buf); /* corresponding header type for the STAILQ */
 
 extern uint32_t buf_init_size;
+extern uint32_t buf_nclass;
 extern buf_metrics_st *buf_metrics;
 
 #define BUF_INIT_SIZE (16 * KiB)
@@ -93,6 +145,16 @@ extern buf_metrics_st *buf_metrics;
 void buf_setup(buf_options_st *options, buf_metrics_st *metrics);
 void buf_teardown(void);
 
+/*
+ * option_apply_fn for option_reload_file, with the buf options as arg, to be
+ * called from the thread that uses the pools. A new buf_init_size drains the
+ * free pools and sizes every class after it, while bufs still in use are
+ * destroyed when returned; it is refused with buf_poolslab. The watermarks
+ * and buf_memory_max change right away, other buf options need a restart.
+ * dbuf keeps the max size it computed at setup.
+ */
+rstatus_i buf_apply(struct option *opt, option_val_u old, void *arg);
+
 /* Obtain/return a buffer from the pool */
 struct buf *buf_borrow(void);
 void buf_return(struct buf **buf);
@@ -101,6 +163,35 @@ void buf_return(struct buf **buf);
 struct buf *buf_create(void);
 void buf_destroy(struct buf **buf);
 
+/*
+ * Destroy free bufs left idle since the last call, see cc_pool.h; a
+ * timeout_cb_fn, e.g. to put on a timing wheel as a recurring timeout
+ */
+void buf_trim(void *arg);
+/*
+ * Account for a buf going from osize to nsize bytes outside of the pools, e.g.
+ * realloc'd by dbuf; CC_ENOMEM if growing it would exceed buf_memory_max.
+ * Creating a buf is a charge from 0, destroying one from its size to 0.
+ */
+rstatus_i buf_memory_charge(uint32_t osize, uint32_t nsize);
+
+/* Is there a size class for bufs of total size `size'? */
+bool buf_class_has(uint32_t size);
+/*
+ * Move content of buf into one of size nsize, taken from the pool of that size
+ * class if there is one, recycling the old one
+ */
+rstatus_i buf_class_resize(struct buf **buf, uint32_t nsize);
+/* Was buf carved out of the preallocated slab (thus cannot be realloc'd)? */
+bool buf_in_slab(const struct buf *buf);
+/*
+ * Reallocate a heap buf to total size nsize, keeping it aligned; contents up
+ * to the smaller size are kept but markers are left to the caller. The
+ * buf_memory gauge follows, buf_memory_charge is up to the caller. Returns
+ * NULL if that fails, buf is still valid then.
+ */
+struct buf *buf_realloc(struct buf *buf, uint32_t nsize);
+
 /* Size of data that has yet to be read */
 static inline uint32_t
 buf_rsize(const struct buf *buf)
@@ -184,6 +275,54 @@ buf_write(struct buf *dst, char *src, uint32_t count)
     return len;
 }
 
+/*
+ * Append builders: format values straight into the buffer without going
+ * through vsnprintf. Each writes all or nothing, and returns the number of
+ * bytes written, i.e. 0 if there isn't enough room left.
+ */
+static inline uint32_t
+buf_append(struct buf *buf, const char *src, uint32_t count)
+{
+    if (count > buf_wsize(buf)) {
+        return 0;
+    }
+
+    cc_memcpy(buf->wpos, src, count);
+    buf->wpos += count;
+
+    return count;
+}
+
+static inline uint32_t
+buf_append_uint64(struct buf *buf, uint64_t n)
+{
+    size_t len = cc_print_uint64(buf->wpos, buf_wsize(buf), n);
+
+    buf->wpos += len;
+
+    return (uint32_t)len;
+}
+
+static inline uint32_t
+buf_append_int64(struct buf *buf, int64_t n)
+{
+    size_t len = cc_print_int64(buf->wpos, buf_wsize(buf), n);
+
+    buf->wpos += len;
+
+    return (uint32_t)len;
+}
+
+static inline uint32_t
+buf_append_double(struct buf *buf, double n)
+{
+    size_t len = cc_print_double(buf->wpos, buf_wsize(buf), n);
+
+    buf->wpos += len;
+
+    return (uint32_t)len;
+}
+
 static inline void
 buf_lshift(struct buf *buf)
 {
@@ -214,6 +353,21 @@ buf_rshift(struct buf *buf)
     buf->wpos = buf->end;
 }
 
+/*
+ * buffer chain: a buf_sqh of bufs borrowed from the pool, so data larger than
+ * a single buf is held at the pooled size instead of being grown and copied.
+ * Data is read from the head and appended to the tail.
+ */
+
+/* Size of data that has yet to be read across all bufs in chain */
+uint32_t buf_chain_rsize(const struct buf_sqh *chain);
+/* append count bytes, borrowing bufs as needed; return # bytes written */
+uint32_t buf_chain_write(struct buf_sqh *chain, char *src, uint32_t count);
+/* mark count bytes as read, returning bufs that become empty to the pool */
+void buf_chain_consume(struct buf_sqh *chain, uint32_t count);
+/* return all bufs in chain to the pool */
+void buf_chain_return(struct buf_sqh *chain);
+
 #ifdef __cplusplus
 }
 #endif
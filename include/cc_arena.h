@@ -0,0 +1,74 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * An arena (region) allocator: memory is handed out by bumping a pointer
+ * through large chunks and is never freed individually. Instead, the whole
+ * arena is rewound with arena_reset, which keeps regular chunks around for
+ * reuse and frees chunks that were allocated for oversized requests. This
+ * suits scratch data with a common lifetime, e.g. everything allocated while
+ * parsing one request.
+ *
+ * An arena is not thread-safe.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_util.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_CHUNK_SIZE (64 * KiB)      /* default chunk size incl header */
+#define ARENA_ALIGN      (2 * sizeof(void *))
+
+struct arena_chunk {
+    struct arena_chunk  *next;
+    char                *pos;           /* next free byte */
+    char                *end;           /* end of chunk */
+    char                data[];
+};
+
+struct arena {
+    struct arena_chunk  *head;          /* regular chunks */
+    struct arena_chunk  *curr;          /* chunk being allocated from */
+    struct arena_chunk  *large;         /* chunks for oversized requests */
+    size_t              chunk_size;     /* size of regular chunks */
+    size_t              nbyte;          /* # bytes handed out since reset */
+    uint32_t            nchunk;         /* # chunks allocated */
+};
+
+/* chunk_size of 0 means ARENA_CHUNK_SIZE */
+struct arena *arena_create(size_t chunk_size);
+void arena_destroy(struct arena **arena);
+
+/* allocate size bytes aligned to ARENA_ALIGN, NULL if out of memory */
+void *arena_alloc(struct arena *arena, size_t size);
+/* like arena_alloc, also zeroes the memory */
+void *arena_zalloc(struct arena *arena, size_t size);
+/* release everything allocated from arena at once */
+void arena_reset(struct arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
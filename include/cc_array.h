@@ -23,6 +23,7 @@ extern "C" {
 
 #include <cc_define.h>
 #include <cc_debug.h>
+#include <cc_mm.h>
 #include <cc_option.h>
 
 #include <stdint.h>
@@ -138,6 +139,248 @@ uint32_t array_each(struct array *arr, array_each_fn func, void *arg, err_i *err
 void array_setup(array_options_st *options);
 void array_teardown(void);
 
+/*
+ * Typed array: TYPED_ARRAY(name, type) declares `struct name' holding a
+ * growable array of `type', and static inline name_* functions to go with it,
+ * so element access compiles to plain pointer arithmetic. Capacity doubles
+ * whenever it runs out. TYPED_ARRAY_SORT(name, type, less) adds name_sort(),
+ * an introsort with `less(const type *, const type *)' inlined into it.
+ *
+ *   TYPED_ARRAY(u64_array, uint64_t)
+ *   TYPED_ARRAY_SORT(u64_array, uint64_t, u64_less)
+ *
+ *   struct u64_array a;
+ *   u64_array_init(&a, 0);
+ *   u64_array_append(&a, 42);
+ *   u64_array_sort(&a);
+ *   u64_array_deinit(&a);
+ *
+ * Pointers to elements are invalidated by anything that may grow the array.
+ */
+#define TYPED_ARRAY_NALLOC  8   /* capacity allocated on first growth */
+#define TYPED_ARRAY_ISORT   16  /* ranges this short are insertion sorted */
+
+#define TYPED_ARRAY(name, type)                                             \
+struct name {                                                               \
+    type            *data;                                                  \
+    uint32_t        nelem;                                                  \
+    uint32_t        nalloc;                                                 \
+};                                                                          \
+                                                                            \
+static inline rstatus_i                                                     \
+name##_reserve(struct name *arr, uint32_t nalloc)                           \
+{                                                                           \
+    uint32_t n = arr->nalloc > 0 ? arr->nalloc : TYPED_ARRAY_NALLOC;        \
+    type *data;                                                             \
+                                                                            \
+    if (nalloc <= arr->nalloc) {                                            \
+        return CC_OK;                                                       \
+    }                                                                       \
+    while (n < nalloc) {                                                    \
+        n = n > UINT32_MAX / 2 ? nalloc : n * 2;                            \
+    }                                                                       \
+    if ((size_t)n > SIZE_MAX / sizeof(type)) {                              \
+        return CC_ENOMEM;                                                   \
+    }                                                                       \
+    data = cc_realloc(arr->data, (size_t)n * sizeof(type));                 \
+    if (data == NULL) {                                                     \
+        return CC_ENOMEM;                                                   \
+    }                                                                       \
+    arr->data = data;                                                       \
+    arr->nalloc = n;                                                        \
+                                                                            \
+    return CC_OK;                                                           \
+}                                                                           \
+                                                                            \
+static inline rstatus_i                                                     \
+name##_init(struct name *arr, uint32_t nalloc)                              \
+{                                                                           \
+    arr->data = NULL;                                                       \
+    arr->nelem = 0;                                                         \
+    arr->nalloc = 0;                                                        \
+                                                                            \
+    return name##_reserve(arr, nalloc);                                     \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_deinit(struct name *arr)                                             \
+{                                                                           \
+    cc_free(arr->data);                                                     \
+    arr->data = NULL;                                                       \
+    arr->nelem = 0;                                                         \
+    arr->nalloc = 0;                                                        \
+}                                                                           \
+                                                                            \
+static inline uint32_t                                                      \
+name##_nelem(const struct name *arr)                                        \
+{                                                                           \
+    return arr->nelem;                                                      \
+}                                                                           \
+                                                                            \
+static inline type *                                                        \
+name##_get(const struct name *arr, uint32_t idx)                            \
+{                                                                           \
+    ASSERT(idx < arr->nelem);                                               \
+                                                                            \
+    return &arr->data[idx];                                                 \
+}                                                                           \
+                                                                            \
+/* room for one more element at the end, NULL if out of memory */          \
+static inline type *                                                        \
+name##_push(struct name *arr)                                               \
+{                                                                           \
+    if (arr->nelem == arr->nalloc &&                                        \
+            name##_reserve(arr, arr->nelem + 1) != CC_OK) {                 \
+        return NULL;                                                        \
+    }                                                                       \
+                                                                            \
+    return &arr->data[arr->nelem++];                                        \
+}                                                                           \
+                                                                            \
+static inline rstatus_i                                                     \
+name##_append(struct name *arr, type elem)                                  \
+{                                                                           \
+    type *p = name##_push(arr);                                             \
+                                                                            \
+    if (p == NULL) {                                                        \
+        return CC_ENOMEM;                                                   \
+    }                                                                       \
+    *p = elem;                                                              \
+                                                                            \
+    return CC_OK;                                                           \
+}                                                                           \
+                                                                            \
+static inline type *                                                        \
+name##_pop(struct name *arr)                                                \
+{                                                                           \
+    ASSERT(arr->nelem > 0);                                                 \
+                                                                            \
+    return &arr->data[--arr->nelem];                                        \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_clear(struct name *arr)                                              \
+{                                                                           \
+    arr->nelem = 0;                                                         \
+}
+
+#define TYPED_ARRAY_FOREACH(var, arr)                                       \
+    for ((var) = (arr)->data; (var) < (arr)->data + (arr)->nelem; (var)++)
+
+#define TYPED_ARRAY_SORT(name, type, less)                                  \
+static inline void                                                          \
+name##_swap_(type *a, type *b)                                              \
+{                                                                           \
+    type t = *a;                                                            \
+    *a = *b;                                                                \
+    *b = t;                                                                 \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_isort_(type *d, uint32_t n)                                          \
+{                                                                           \
+    uint32_t i, j;                                                          \
+    type t;                                                                 \
+                                                                            \
+    for (i = 1; i < n; i++) {                                               \
+        t = d[i];                                                           \
+        for (j = i; j > 0 && less(&t, &d[j - 1]); j--) {                    \
+            d[j] = d[j - 1];                                                \
+        }                                                                   \
+        d[j] = t;                                                           \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_sift_(type *d, uint32_t i, uint32_t n)                               \
+{                                                                           \
+    uint32_t c;                                                             \
+                                                                            \
+    while ((c = 2 * i + 1) < n) {                                           \
+        if (c + 1 < n && less(&d[c], &d[c + 1])) {                          \
+            c++;                                                            \
+        }                                                                   \
+        if (!less(&d[i], &d[c])) {                                          \
+            return;                                                         \
+        }                                                                   \
+        name##_swap_(&d[i], &d[c]);                                         \
+        i = c;                                                              \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_hsort_(type *d, uint32_t n)                                          \
+{                                                                           \
+    uint32_t i;                                                             \
+                                                                            \
+    for (i = n / 2; i > 0; i--) {                                           \
+        name##_sift_(d, i - 1, n);                                          \
+    }                                                                       \
+    for (i = n - 1; i > 0; i--) {                                           \
+        name##_swap_(&d[0], &d[i]);                                         \
+        name##_sift_(d, 0, i);                                              \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+/* quicksort the larger side in a loop, heapsort if it degenerates */       \
+static void                                                                 \
+name##_qsort_(type *d, uint32_t n, uint32_t depth)                          \
+{                                                                           \
+    uint32_t i, j;                                                          \
+    type p;                                                                 \
+                                                                            \
+    while (n > TYPED_ARRAY_ISORT) {                                         \
+        if (depth-- == 0) {                                                 \
+            name##_hsort_(d, n);                                            \
+            return;                                                         \
+        }                                                                   \
+        /* median of 3, which also bounds both scans below */               \
+        if (less(&d[n / 2], &d[0])) {                                       \
+            name##_swap_(&d[n / 2], &d[0]);                                 \
+        }                                                                   \
+        if (less(&d[n - 1], &d[n / 2])) {                                   \
+            name##_swap_(&d[n - 1], &d[n / 2]);                             \
+            if (less(&d[n / 2], &d[0])) {                                   \
+                name##_swap_(&d[n / 2], &d[0]);                             \
+            }                                                               \
+        }                                                                   \
+        p = d[n / 2];                                                       \
+        for (i = 0, j = n - 1; ; i++, j--) {                                \
+            while (less(&d[i], &p)) {                                       \
+                i++;                                                        \
+            }                                                               \
+            while (less(&p, &d[j])) {                                       \
+                j--;                                                        \
+            }                                                               \
+            if (i >= j) {                                                   \
+                break;                                                      \
+            }                                                               \
+            name##_swap_(&d[i], &d[j]);                                     \
+        }                                                                   \
+        /* [0, j] <= p <= [j + 1, n) */                                     \
+        if (j + 1 < n - j - 1) {                                            \
+            name##_qsort_(d, j + 1, depth);                                 \
+            d += j + 1;                                                     \
+            n -= j + 1;                                                     \
+        } else {                                                            \
+            name##_qsort_(d + j + 1, n - j - 1, depth);                     \
+            n = j + 1;                                                      \
+        }                                                                   \
+    }                                                                       \
+    name##_isort_(d, n);                                                    \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_sort(struct name *arr)                                               \
+{                                                                           \
+    uint32_t depth = 0, n;                                                  \
+                                                                            \
+    for (n = arr->nelem; n > 1; n >>= 1) {                                  \
+        depth += 2;                                                         \
+    }                                                                       \
+    name##_qsort_(arr->data, arr->nelem, depth);                            \
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,9 +55,72 @@ rstatus_i bstring_duplicate(struct bstring *dst, const struct bstring *src);
 rstatus_i bstring_copy(struct bstring *dst, const char *src, uint32_t srclen);
 int bstring_compare(const struct bstring *s1, const struct bstring *s2);
 
+/*
+ * Vectorized helpers for parsing: these use SSE2, or AVX2 when the CPU has it
+ * (picked at runtime on first use), and word-at-a-time code elsewhere.
+ *
+ * bstring_equal rejects on length and first bytes before comparing the rest.
+ * bstring_casecmp compares ASCII case-insensitively, ordering like
+ * bstring_compare. The find functions return the index of the first match at
+ * or after off, or str->len if there is none.
+ */
+#define BSTRING_FIND_NSET 16 /* max # bytes in a bstring_find_any set */
+
+bool bstring_equal(const struct bstring *s1, const struct bstring *s2);
+int bstring_casecmp(const struct bstring *s1, const struct bstring *s2);
+uint32_t bstring_find(const struct bstring *str, uint32_t off, char c);
+uint32_t bstring_find_any(const struct bstring *str, uint32_t off,
+        const char *set, uint32_t nset);
+uint32_t bstring_find_crlf(const struct bstring *str, uint32_t off);
+
 struct bstring *bstring_alloc(uint32_t size);
 void bstring_free(struct bstring **bstring);
 
+/*
+ * Small-string-optimized byte string: payloads of up to BSTRING_SSO_MAX bytes
+ * are stored in the struct itself, only longer ones go to the heap. A view
+ * (bstring_sso_view) points into the struct for short strings, so it is only
+ * valid as long as the bstring_sso is neither modified nor moved.
+ */
+#define BSTRING_SSO_MAX 23
+
+struct bstring_sso {
+    uint32_t len;
+    union {
+        char buf[BSTRING_SSO_MAX + 1];  /* len <= BSTRING_SSO_MAX */
+        char *ptr;                      /* len > BSTRING_SSO_MAX */
+    };
+};
+
+static inline bool
+bstring_sso_inline(const struct bstring_sso *str)
+{
+    return str->len <= BSTRING_SSO_MAX;
+}
+
+static inline char *
+bstring_sso_data(struct bstring_sso *str)
+{
+    return bstring_sso_inline(str) ? str->buf : str->ptr;
+}
+
+static inline struct bstring
+bstring_sso_view(struct bstring_sso *str)
+{
+    return (struct bstring){ str->len, bstring_sso_data(str) };
+}
+
+void bstring_sso_init(struct bstring_sso *str);
+void bstring_sso_deinit(struct bstring_sso *str);
+/* dst must be empty (init'ed or deinit'ed), srclen may be 0 */
+rstatus_i bstring_sso_copy(struct bstring_sso *dst, const char *src,
+        uint32_t srclen);
+rstatus_i bstring_sso_from_bstring(struct bstring_sso *dst,
+        const struct bstring *src);
+/* heap-allocated copy as a regular bstring, dst must be empty */
+rstatus_i bstring_sso_to_bstring(struct bstring *dst,
+        const struct bstring_sso *src);
+
 /* efficient implementation of string comparion of short strings */
 #define str2cmp(m, c0, c1)                                                     \
     (m[0] == c0 && m[1] == c1)
@@ -168,8 +231,15 @@ void bstring_free(struct bstring **bstring);
     bcmp((char *)(_s1), (char *)(_s2), (size_t)(_n))
 
 
-/* bstring to uint conversion */
+/*
+ * bstring to int conversion: decimal digits only (plus an optional sign for
+ * atoi64), nothing else. Returns CC_ERROR on empty or invalid input, and if
+ * the value doesn't fit (or is above max for the bounded version).
+ */
 rstatus_i bstring_atou64(uint64_t *u64, struct bstring *str);
+rstatus_i bstring_atou64_bounded(uint64_t *u64, struct bstring *str,
+        uint64_t max);
+rstatus_i bstring_atoi64(int64_t *i64, struct bstring *str);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,76 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CPU topology and thread affinity.
+ *
+ * cpu_setup takes a snapshot of the cpus the process may run on (its affinity
+ * mask at the time), with the core, package and NUMA node of each as found in
+ * sysfs, so a per-core event loop can be pinned with cpu_pin and allocate its
+ * pools on the node it runs on, e.g. with cc_mmap_ext(size, huge, node) or
+ * MM_NUMA_LOCAL. The snapshot is read-only afterwards, and safe to use from
+ * any thread.
+ *
+ * Pinning and topology only work on Linux. Elsewhere all online cpus are on
+ * node 0, cpu_current returns -1 and pinning returns CC_ERROR.
+ */
+
+#include <cc_define.h>
+
+#include <stdint.h>
+
+#define CPU_MAX             1024    /* highest cpu number supported, plus 1 */
+#define CPU_UNKNOWN         -1
+
+struct cpu_info {
+    int     cpu;        /* as numbered by the kernel */
+    int     core;       /* physical core, CPU_UNKNOWN if unknown */
+    int     package;    /* socket, CPU_UNKNOWN if unknown */
+    int     node;       /* NUMA node, 0 if unknown */
+};
+
+void cpu_setup(void);
+void cpu_teardown(void);
+
+/* # cpus the process may run on, and the i-th of them (i < cpu_count) */
+uint32_t cpu_count(void);
+const struct cpu_info *cpu_get(uint32_t i);
+/* # NUMA nodes, as highest node of any usable cpu plus 1 */
+uint32_t cpu_nnode(void);
+
+/* NUMA node of cpu, 0 if unknown; works before setup too */
+int cpu_node(int cpu);
+/* the cpu the calling thread is running on, CPU_UNKNOWN if unknown */
+int cpu_current(void);
+
+/*
+ * restrict the calling thread to one cpu, all usable cpus of a node, or all
+ * usable cpus again; CC_EINVAL if that leaves no cpu to run on
+ */
+rstatus_i cpu_pin(int cpu);
+rstatus_i cpu_pin_node(int node);
+rstatus_i cpu_unpin(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -30,12 +30,14 @@ extern "C" {
 #define DEBUG_LOG_LEVEL 4       /* default log level */
 #define DEBUG_LOG_FILE  NULL    /* default log file */
 #define DEBUG_LOG_NBUF  0       /* default log buf size */
+#define DEBUG_LOG_DEFER false   /* default: format messages when logged */
 
 /*          name             type              default           description */
 #define DEBUG_OPTION(ACTION)                                                            \
     ACTION( debug_log_level, OPTION_TYPE_UINT, DEBUG_LOG_LEVEL,  "debug log level"     )\
     ACTION( debug_log_file,  OPTION_TYPE_STR,  DEBUG_LOG_FILE,   "debug log file"      )\
-    ACTION( debug_log_nbuf,  OPTION_TYPE_UINT, DEBUG_LOG_NBUF,   "debug log buf size"  )
+    ACTION( debug_log_nbuf,  OPTION_TYPE_UINT, DEBUG_LOG_NBUF,   "debug log buf size"  )\
+    ACTION( debug_log_defer, OPTION_TYPE_BOOL, DEBUG_LOG_DEFER,  "format log on flush" )
 
 typedef struct {
     DEBUG_OPTION(OPTION_DECLARE)
@@ -86,6 +88,13 @@ void debug_assert(const char *cond, const char *file, int line, int panic);
 rstatus_i debug_setup(debug_options_st *options);
 void debug_teardown(void);
 
+/*
+ * option_apply_fn for option_reload_file, with the debug options as arg:
+ * debug_log_level changes right away, the other debug options are reverted
+ * since they need a restart, and options of other modules are left alone
+ */
+rstatus_i debug_apply(struct option *opt, option_val_u old, void *arg);
+
 /**
  **********************************************
  * Debug logging
@@ -217,6 +226,13 @@ extern struct debug_logger *dlog;
 
 #endif
 
+/*
+ * With debug_log_defer set (and a log buffer), _log only copies the format
+ * string pointer, the source location and the arguments into the buffer, and
+ * messages are formatted when the buffer is flushed. All standard conversions
+ * except %n and wide characters/strings are supported; arguments that do not
+ * fit in LOG_MAX_LEN are dropped and the rest of the format is logged as-is.
+ */
 void _log(struct debug_logger *dl, const char *file, int line, int level, const char *fmt, ...);
 void _log_hexdump(struct debug_logger *dl, int level, char *data, int datalen);
 
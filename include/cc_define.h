@@ -31,6 +31,14 @@ extern "C" {
 # define CC_STATS 1
 #endif
 
+#ifdef HAVE_TRACE
+# define CC_TRACE 1
+#endif
+
+#ifdef HAVE_USDT
+# define CC_USDT 1
+#endif
+
 #ifdef HAVE_LOGGING
 # define CC_LOGGING 1
 #endif
@@ -51,10 +59,22 @@ extern "C" {
 # define CC_ACCEPT4 1
 #endif
 
+#ifdef HAVE_IO_URING
+# define CC_IO_URING 1
+#endif
+
 #ifdef HAVE_DEBUG_MM
 #define CC_DEBUG_MM 1
 #endif
 
+#ifdef HAVE_MM_ACCOUNT
+#define CC_MM_ACCOUNT 1
+#endif
+
+#ifdef HAVE_JEMALLOC
+#define CC_JEMALLOC 1
+#endif
+
 #define CC_OK        0
 #define CC_ERROR    -1
 
@@ -25,17 +25,29 @@ extern "C" {
 #include <cc_metric.h>
 
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define EVENT_READ  0x0000ff
 #define EVENT_WRITE 0x00ff00
 #define EVENT_ERR   0xff0000
 
+/* registration flags */
+#define EVENT_EDGE      0x1 /* edge-triggered: report only new readiness */
+#define EVENT_ONESHOT   0x2 /* disable after one event, add again to re-arm */
+#define EVENT_EXCLUSIVE 0x4 /* wake only one of the event bases sharing fd */
+
 /*          name                type            description */
 #define EVENT_METRIC(ACTION)                                            \
     ACTION( event_total,        METRIC_COUNTER, "# events returned"    )\
     ACTION( event_loop,         METRIC_COUNTER, "# event loop returns" )\
     ACTION( event_read,         METRIC_COUNTER, "# reads registered"   )\
-    ACTION( event_write,        METRIC_COUNTER, "# writes registered"  )
+    ACTION( event_write,        METRIC_COUNTER, "# writes registered"  )\
+    ACTION( event_change,       METRIC_COUNTER, "# changes applied"    )\
+    ACTION( event_change_skip,  METRIC_COUNTER, "# no-op changes"      )\
+    ACTION( event_spin_hit,     METRIC_COUNTER, "# waits hit spinning" )\
+    ACTION( event_spin_sleep,   METRIC_COUNTER, "# spins then blocked" )\
+    ACTION( event_dispatch_ns,  METRIC_HISTOGRAM, "callback ns per loop" )
 
 typedef struct {
     EVENT_METRIC(METRIC_DECLARE)
@@ -43,6 +55,16 @@ typedef struct {
 
 typedef void (*event_cb_fn)(void *, uint32_t);  /* event callback */
 
+/* one ready fd, as handed to a batch callback */
+struct event_ready {
+    void        *data;          /* data given when the fd was added */
+    uint32_t    events;         /* EVENT_READ|EVENT_WRITE|EVENT_ERR */
+};
+/* batch callback: all events of one wakeup, and their # */
+typedef void (*event_batch_cb_fn)(struct event_ready *, int);
+/* I/O completion callback: data, EVENT_READ or EVENT_WRITE, bytes or -errno */
+typedef void (*event_io_cb_fn)(void *, uint32_t, int);
+
 struct event_base;
 
 void event_setup(event_metrics_st *metrics);
@@ -67,9 +89,101 @@ int event_add_read(struct event_base *evb, int fd, void *data);
 int event_add_write(struct event_base *evb, int fd, void *data);
 int event_del(struct event_base *evb, int fd);
 
+/**
+ * Same as event_add_read/event_add_write, with registration flags:
+ * - EVENT_EDGE maps to EPOLLET/EV_CLEAR;
+ * - EVENT_ONESHOT maps to EPOLLONESHOT/EV_DISPATCH, and adding the same type
+ *   of event again re-arms the fd;
+ * - EVENT_EXCLUSIVE maps to EPOLLEXCLUSIVE, which avoids thundering herd
+ *   wakeups when several event bases wait on one listening socket. It cannot
+ *   be combined with EVENT_ONESHOT, and is ignored by kqueue and io_uring.
+ * Passing 0 is equivalent to calling the functions above.
+ */
+int event_add_read_flags(struct event_base *evb, int fd, void *data, uint32_t flags);
+int event_add_write_flags(struct event_base *evb, int fd, void *data, uint32_t flags);
+
+/**
+ * Lazy interest changes: once enabled on an event base (right after creating
+ * it), adds and deletes are recorded and applied in one go right before
+ * event_wait waits, so a connection switching between read and write interest
+ * during one loop iteration costs at most one change, or none if it ends up
+ * where it started. On epoll the two types then add up instead of the second
+ * add being ignored, and each fd costs at most one epoll_ctl per iteration;
+ * kqueue sends all changes as the changelist of the kevent call that waits.
+ * io_uring always works this way and ignores the setting.
+ *
+ * On epoll event_del still applies right away, as the fd is usually closed
+ * next (kqueue keeps changes in order, so queueing the delete is safe). An fd
+ * must be deleted before it is closed, or a later fd with the same number may
+ * inherit its stale state. Errors in lazy changes are logged, not returned.
+ *
+ * event_del_read/event_del_write drop one type of interest. Without lazy mode
+ * epoll only ever registers one type per fd, and they remove the fd as
+ * event_del does.
+ */
+void event_base_set_lazy(struct event_base *evb, bool lazy);
+int event_del_read(struct event_base *evb, int fd);
+int event_del_write(struct event_base *evb, int fd);
+
+/**
+ * Spinning trades CPU for latency: with a budget set, event_wait with a
+ * non-zero timeout keeps polling with a zero timeout for up to spin_us
+ * microseconds before it blocks for what is left of the timeout, so events
+ * arriving shortly after the previous batch are picked up without a sleep and
+ * the wakeup that follows it. event_spin_hit counts waits that found events
+ * while spinning, event_spin_sleep those that ran out of budget. 0 (the
+ * default) blocks right away.
+ *
+ * Busy polling goes one step further and has the kernel poll the NIC queues
+ * of the sockets an epoll base waits on, for up to usec microseconds and
+ * budget packets per poll (0: kernel default); prefer also asks the kernel to
+ * defer softirq processing to these polls. It needs Linux 6.9 and NAPI
+ * capable devices; other backends and kernels return -1. Busy polling of
+ * individual sockets, independent of the event backend, is tcp_set_busy_poll.
+ */
+void event_base_set_spin(struct event_base *evb, uint32_t spin_us);
+int event_base_set_busy_poll(struct event_base *evb, uint32_t usec, uint16_t budget, bool prefer);
+
+/**
+ * Batch dispatch: with a batch callback set, event_wait translates all events
+ * of a wakeup first and calls it once with the whole array instead of calling
+ * the event callback for each, so the application can pipeline work over the
+ * batch. The array belongs to the event base and is only valid during the
+ * call. The data of the first EVENT_PREFETCH entries is prefetched before the
+ * call; callbacks are expected to keep it going by calling event_prefetch on
+ * entry i + EVENT_PREFETCH while working on entry i. kqueue reports read and
+ * write on the same fd as two entries, and io_uring still reports recv/send
+ * completions to the I/O callback as they are reaped. Passing NULL goes back
+ * to the event callback. Returns -1 if the array cannot be allocated.
+ *
+ * In per event mode, event_wait itself prefetches the data EVENT_PREFETCH
+ * events ahead of the one it calls back for.
+ */
+#define EVENT_PREFETCH  4
+
+int event_base_set_batch_cb(struct event_base *evb, event_batch_cb_fn cb);
+
+static inline void
+event_prefetch(const struct event_ready *ev)
+{
+    __builtin_prefetch(ev->data);
+}
+
 /* event wait */
 int event_wait(struct event_base *evb, int timeout);
 
+/* completion-based I/O */
+/**
+ * Only the io_uring backend supports these, other backends return -1.
+ * A recv/send is queued and submitted with the next event_wait, which then
+ * reports its completion via the I/O callback instead of the event callback.
+ * At most one recv and one send can be in flight per fd, and buf must remain
+ * valid until completion; event_del cancels whatever is still in flight.
+ */
+void event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb);
+int event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, void *data);
+int event_send(struct event_base *evb, int fd, const void *buf, size_t nbyte, void *data);
+
 #ifdef __cplusplus
 }
 #endif
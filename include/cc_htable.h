@@ -0,0 +1,151 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open-addressing hash table keyed by bstring.
+ *
+ * Slots are grouped HTABLE_GROUP at a time, and each slot has a control byte
+ * holding either 7 bits of its key's hash or an EMPTY/DELETED marker. A lookup
+ * compares the control bytes of a whole group at once (with SSE2 where
+ * available) and only touches a slot when those bits match, so a probe costs
+ * one or two cache lines in the common case.
+ *
+ * Growing the table never rehashes everything at once: a new table is
+ * allocated and the old one is moved over htable_migrate_step groups on each
+ * put/delete, while lookups consult both. Migration can also be driven off the
+ * write path, e.g. by a recurring timing wheel event:
+ *
+ *   timing_wheel_insert(tw, &delay, true, htable_migrate_tick, ht);
+ *
+ * which moves htable_migrate_tick groups each time it fires. Should the new
+ * table fill up before migration is done, the rest is migrated synchronously.
+ *
+ * Keys are stored by reference, the memory they point to must outlive the
+ * entry. Values must not be NULL.
+ */
+
+#include <cc_bstring.h>
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <hash/cc_hash.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HTABLE_GROUP        16  /* slots per probe group */
+#define HTABLE_MIGRATE_STEP 2   /* old groups moved on each put/delete */
+#define HTABLE_MIGRATE_TICK 64  /* old groups moved by htable_migrate_tick */
+
+/*          name                    type                default                 description */
+#define HTABLE_OPTION(ACTION)                                                                                       \
+    ACTION( htable_migrate_step,    OPTION_TYPE_UINT,   HTABLE_MIGRATE_STEP,    "groups migrated per put/delete"   )\
+    ACTION( htable_migrate_tick,    OPTION_TYPE_UINT,   HTABLE_MIGRATE_TICK,    "groups migrated per tick"         )
+
+typedef struct {
+    HTABLE_OPTION(OPTION_DECLARE)
+} htable_options_st;
+
+/*          name                        type            description */
+#define HTABLE_METRIC(ACTION)                                                               \
+    ACTION( htable_curr,                METRIC_GAUGE,   "# tables allocated"               )\
+    ACTION( htable_create,              METRIC_COUNTER, "# tables created"                 )\
+    ACTION( htable_create_ex,           METRIC_COUNTER, "# table create errors"            )\
+    ACTION( htable_destroy,             METRIC_COUNTER, "# tables destroyed"               )\
+    ACTION( htable_resize,              METRIC_COUNTER, "# resizes to a larger table"      )\
+    ACTION( htable_rehash,              METRIC_COUNTER, "# same-size rehashes"             )\
+    ACTION( htable_resize_ex,           METRIC_COUNTER, "# resizes failed"                 )\
+    ACTION( htable_migrating,           METRIC_GAUGE,   "# tables being migrated"          )\
+    ACTION( htable_migrate_pending,     METRIC_GAUGE,   "# groups left to migrate"         )\
+    ACTION( htable_migrate_group,       METRIC_COUNTER, "# groups migrated"                )\
+    ACTION( htable_migrate_entry,       METRIC_COUNTER, "# entries migrated"               )\
+    ACTION( htable_migrate_sync,        METRIC_COUNTER, "# migrations finished in one go"  )
+
+typedef struct {
+    HTABLE_METRIC(METRIC_DECLARE)
+} htable_metrics_st;
+
+typedef void (*htable_each_fn)(const struct bstring *key, void *val, void *arg);
+
+struct htable_slot {
+    struct bstring  key;
+    void            *val;
+    uint64_t        hash;
+};
+
+struct htable_tab {
+    uint8_t             *ctrl;      /* one control byte per slot */
+    struct htable_slot  *slot;
+    uint32_t            ngroup;     /* power of 2 */
+    uint32_t            nentry;
+    uint32_t            growth;     /* # empty slots left to fill before resize */
+};
+
+struct htable {
+    struct htable_tab   cur;
+    struct htable_tab   old;        /* being migrated into cur if ctrl != NULL */
+    uint32_t            migrate;    /* next group of old to migrate */
+    hash_fn             hash;
+    uint64_t            seed;
+};
+
+void htable_setup(htable_options_st *options, htable_metrics_st *metrics);
+void htable_teardown(void);
+
+/* sized to hold at least nentry entries without resizing, hash NULL: wyhash */
+struct htable *htable_create(uint32_t nentry, hash_fn hash);
+void htable_destroy(struct htable **ht);
+
+/* return the value stored under key, or NULL if there is none */
+void *htable_get(struct htable *ht, const struct bstring *key);
+/* insert or replace; CC_ENOMEM if the table is full and cannot grow */
+rstatus_i htable_put(struct htable *ht, const struct bstring *key, void *val);
+/* remove key and return its value, or NULL if there is none */
+void *htable_delete(struct htable *ht, const struct bstring *key);
+
+/*
+ * move up to ngroup groups of an ongoing migration into the current table,
+ * returns the number of groups left to migrate (0 if none)
+ */
+uint32_t htable_migrate(struct htable *ht, uint32_t ngroup);
+/* timeout_cb_fn compatible, arg is the table */
+void htable_migrate_tick(void *ht);
+
+/* fn must not modify the table */
+void htable_foreach(struct htable *ht, htable_each_fn fn, void *arg);
+
+static inline uint32_t
+htable_nentry(const struct htable *ht)
+{
+    return ht->cur.nentry + ht->old.nentry;
+}
+
+static inline bool
+htable_migrating(const struct htable *ht)
+{
+    return ht->old.ctrl != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,18 +23,55 @@ extern "C" {
 
 #include <cc_define.h>
 #include <cc_metric.h>
+#include <cc_queue.h>
 #include <cc_util.h>
 
 #include <stdbool.h>
 
 #define LOG_MAX_LEN 2560 /* max length of log message to STDOUT/STDERR */
 
+struct log_tbuf;
+
+/*
+ * Turns a deferred record of len bytes into at most size bytes of text at buf,
+ * returning the number of bytes written, see log_set_render.
+ */
+typedef size_t (*log_render_fn)(char *buf, size_t size, const void *rec,
+        uint32_t len);
+
 struct logger {
     char *name;                 /* log file name */
     int  fd;                    /* log file descriptor */
     struct rbuf *buf;           /* ring buffer for pauseless logging */
+    STAILQ_ENTRY(logger) next;  /* next logger drained by the flusher */
+    bool async;                 /* drained by the flusher thread */
+    bool dirty;                 /* written since the last fdatasync */
+    log_render_fn render;       /* formats deferred records on flush */
+    /* multi-writer loggers only, see log_create_mt */
+    bool mt;
+    bool ordered;               /* merge records by timestamp on flush */
+    uint32_t tbuf_cap;          /* capacity of each per-thread buffer */
+    uint64_t id;                /* tells apart loggers reusing an address */
+    struct log_tbuf *tbuf;      /* per-thread buffers, newest first */
+    uint8_t *merge;             /* staging area of ordered/render flushes */
+    uint32_t mcap;
+    uint32_t mlen;              /* bytes held back in merge, not yet written */
+    /* O_DIRECT loggers only, see log_create_direct */
+    bool direct;                /* file is currently open with O_DIRECT */
+    uint8_t *dbuf;              /* aligned staging area of direct writes */
+    uint32_t dcap;
+    uint32_t dlen;              /* bytes held back in dbuf until a full block */
+    /* memory-mapped loggers only, see log_create_mmap */
+    uint8_t *map;               /* current segment of the file */
+    size_t map_seg;             /* segment size */
+    uint64_t map_off;           /* file offset of the current segment */
+    size_t map_pos;             /* write offset within the current segment */
 };
 
+#define LOG_FLUSH_INTVL_MS  100 /* default interval of the flusher thread */
+#define LOG_FSYNC_MS        0   /* default: leave writeback to the OS */
+#define LOG_DIRECT_ALIGN    4096 /* block size of O_DIRECT writes */
+
 /*          name            type            description */
 #define LOG_METRIC(ACTION)                                                      \
     ACTION( log_create,     METRIC_COUNTER, "# loggers created"                )\
@@ -49,7 +86,8 @@ struct logger {
     ACTION( log_skip,       METRIC_COUNTER, "# messages not completely logged" )\
     ACTION( log_skip_byte,  METRIC_COUNTER, "# bytes unable to be logged"      )\
     ACTION( log_flush,      METRIC_COUNTER, "# log flushes to disk"            )\
-    ACTION( log_flush_ex,   METRIC_COUNTER, "# errors flushing to disk"        )
+    ACTION( log_flush_ex,   METRIC_COUNTER, "# errors flushing to disk"        )\
+    ACTION( log_flush_ns,   METRIC_HISTOGRAM, "log flush latency in ns"        )
 
 typedef struct {
     LOG_METRIC(METRIC_DECLARE)
@@ -74,6 +112,42 @@ struct logger *log_create(char *filename, uint32_t buf_cap);
 
 void log_destroy(struct logger **logger);
 
+/**
+ * Create a logger that any number of threads may write to without locking:
+ * each writer thread gets its own ring buffer of buf_cap bytes, registered
+ * with the logger on its first log_write, and log_flush (usually called by
+ * the flusher thread) drains all of them. A thread's messages stay in order;
+ * with ordered, every message is also stamped with a monotonic timestamp and
+ * each flush merges the messages it finds across threads by timestamp.
+ * Buffers live as long as the logger, even if their thread exits earlier. A
+ * single message cannot be larger than buf_cap.
+ */
+struct logger *log_create_mt(char *filename, uint32_t buf_cap, bool ordered);
+
+/**
+ * Create a logger writing its file with O_DIRECT, for high-volume logs that
+ * should not fill the page cache: each flush writes out whole blocks of
+ * LOG_DIRECT_ALIGN bytes and holds back the trailing partial block until the
+ * next one, so a message may only reach the file a flush later. log_reopen and
+ * log_destroy write out what is held back through the page cache. If the file
+ * system does not support O_DIRECT or the file size is not block aligned, the
+ * logger silently falls back to regular writes. Needs a file and a buffer.
+ */
+struct logger *log_create_direct(char *filename, uint32_t buf_cap);
+
+/**
+ * Create a logger that copies messages straight into a shared memory mapping
+ * of the file instead of calling write(): the file grows by preallocated
+ * segments of seg_size bytes (rounded up to the page size), and the mapping
+ * moves on to the next segment when the current one fills up. Messages are
+ * visible to other processes mapping or reading the file as soon as
+ * log_write returns, so log_flush has nothing to do; a reader tailing the
+ * file should stop at the first NUL byte. log_reopen moves to a mapping of the
+ * fresh file, and both it and log_destroy trim the preallocated tail off the
+ * file they leave. A single message cannot be larger than seg_size.
+ */
+struct logger *log_create_mmap(char *filename, size_t seg_size);
+
 /**
  * Reopen the log file. Optional argument target - if left NULL, log_reopen
  * will simply reopen the log file. If specified, log_reopen will rename the
@@ -84,10 +158,48 @@ rstatus_i log_reopen(struct logger *logger, char *target);
 /* _log_write returns true if msg written, false if skipped or failed */
 bool log_write(struct logger *logger, char *buf, uint32_t len);
 
+/**
+ * Zero-copy writes: log_reserve returns a pointer to len contiguous bytes in
+ * the buffer of a plain buffered logger for the caller to write a message
+ * into, log_commit then publishes the first len of them. Returns NULL if the
+ * logger does not support it or the free space is not contiguous (e.g. when
+ * it wraps around), in which case the caller falls back to log_write.
+ */
+char *log_reserve(struct logger *logger, uint32_t len);
+void log_commit(struct logger *logger, uint32_t len);
+
 void _log_fd(int fd, const char *fmt, ...);
 
+/**
+ * Deferred formatting: once a render function is set, log_write_deferred
+ * copies a caller-defined binary record into the buffer and leaves turning it
+ * into text to render, which runs when the buffer is flushed (usually on the
+ * flusher thread). Plain log_write keeps working on such a logger, records and
+ * messages come out in the order they were written. Loggers without a buffer
+ * render on the spot. The render function must be set before anything is
+ * written, and is not supported by multi-writer or direct loggers. A record
+ * cannot be larger than LOG_MAX_LEN, nor render to more than that. Output the
+ * file does not take in full is held back and written first on next flush.
+ */
+rstatus_i log_set_render(struct logger *logger, log_render_fn render);
+bool log_write_deferred(struct logger *logger, const void *rec, uint32_t len);
+
 size_t log_flush(struct logger *logger);
 
+/**
+ * Background flushing: a single flusher thread drains the buffers of all
+ * loggers added to it every intvl_ms, so writers only ever copy into the
+ * ring buffer. With fsync_ms > 0, the flusher also calls fdatasync on loggers
+ * that were written to, at most once every fsync_ms. Only loggers with a
+ * buffer can be added; log_flush, log_reopen and log_destroy on them
+ * synchronize with the flusher. Loggers stay added across stop/start, and a
+ * stopped flusher drains everything once on its way out.
+ */
+rstatus_i log_flusher_start(uint32_t intvl_ms, uint32_t fsync_ms);
+void log_flusher_stop(void);
+rstatus_i log_flusher_add(struct logger *logger);
+void log_flusher_remove(struct logger *logger);
+
 #ifdef __cplusplus
 }
 #endif
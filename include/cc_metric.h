@@ -22,10 +22,85 @@ extern "C" {
 #endif
 
 #include <cc_define.h>
+#include <cc_option.h>
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+/*
+ * Sharded metrics: with metric_shard on, the *_SHARD variants of the update
+ * macros below increment a private copy of the metric array owned by the
+ * calling thread, using plain loads and stores instead of atomics, so hot
+ * counters no longer bounce between cores. A module opts in by declaring a
+ * thread-local handle named after its metrics pointer:
+ *
+ *   static foo_metrics_st *foo_metrics = NULL;
+ *   static METRIC_SHARD_DECLARE(foo_metrics);
+ *   ...
+ *   INCR_SHARD(foo_metrics, foo_event);
+ *
+ * and by calling metric_shard_release on its metrics at teardown, which folds
+ * all shards back into the base array. Shards are created on first update by
+ * each thread; release must not race with updates, i.e. worker threads should
+ * be done with the module by then. metric_print and metric_snapshot add up the
+ * base and all of its shards. UPDATE_VAL always writes the base.
+ */
+#define METRIC_SHARD false
+#define METRIC_SHM_NAME NULL /* no shared memory segment, see metric_shm_open */
+
+/*          name                type                default             description */
+#define METRIC_OPTION(ACTION)                                                                       \
+    ACTION( metric_shard,       OPTION_TYPE_BOOL,   METRIC_SHARD,       "per-thread metric shards" )\
+    ACTION( metric_shm_name,    OPTION_TYPE_STR,    METRIC_SHM_NAME,    "shm segment for metrics"  )
+
+typedef struct {
+    METRIC_OPTION(OPTION_DECLARE)
+} metric_options_st;
+
+struct metric;
+
+/* per-thread handle on the shard of one metric array */
+struct metric_shard_tl {
+    struct metric   *base;
+    struct metric   *shard;
+    uint64_t        gen;
+};
+
+/* without CC_STATS the update macros never touch the handle */
+#if defined CC_STATS && CC_STATS == 1
+#define METRIC_SHARD_DECLARE(_base) \
+    __thread struct metric_shard_tl _base##_shard
+#else
+#define METRIC_SHARD_DECLARE(_base) \
+    __thread struct metric_shard_tl _base##_shard __attribute__((unused))
+#endif
+
+extern bool metric_sharded;
+extern uint64_t metric_shard_gen;
+
+struct metric *metric_shard_acquire(struct metric_shard_tl *tl,
+        struct metric *base, unsigned int nmetric);
+
+/* the calling thread's shard of base, or base itself if sharding is off */
+static inline struct metric *
+metric_shard_local(struct metric_shard_tl *tl, struct metric *base,
+        unsigned int nmetric)
+{
+    if (!metric_sharded) {
+        return base;
+    }
+
+    if (tl->base == base &&
+            tl->gen == __atomic_load_n(&metric_shard_gen, __ATOMIC_ACQUIRE)) {
+        return tl->shard;
+    }
+
+    return metric_shard_acquire(tl, base, nmetric);
+}
+
+#define METRIC_CARDINALITY(_o) sizeof(_o) / sizeof(struct metric)
+
 #if defined CC_STATS && CC_STATS == 1
 
 #define metric_incr_n(_metric, _delta) do {                                 \
@@ -53,6 +128,47 @@ extern "C" {
 } while(0)
 #define metric_decr(_metric) metric_decr_n(_metric, 1)
 
+/* owner-only updates of a shard: readers may load concurrently, no RMW */
+#define _metric_add_local(_v, _delta)                                       \
+    __atomic_store_n(&(_v), __atomic_load_n(&(_v), __ATOMIC_RELAXED) +      \
+            (_delta), __ATOMIC_RELAXED)
+
+#define metric_incr_n_local(_metric, _delta) do {                           \
+    if ((_metric).type == METRIC_COUNTER) {                                 \
+         _metric_add_local((_metric).counter, (_delta));                    \
+    } else if ((_metric).type == METRIC_GAUGE) {                            \
+         _metric_add_local((_metric).gauge, (_delta));                      \
+    } else { /* error  */                                                   \
+    }                                                                       \
+} while(0)
+
+#define metric_decr_n_local(_metric, _delta) do {                           \
+    if ((_metric).type == METRIC_GAUGE) {                                   \
+         _metric_add_local((_metric).gauge, -(int64_t)(_delta));            \
+    } else { /* error  */                                                   \
+    }                                                                       \
+} while(0)
+
+#define _METRIC_SHARD_UPDATE(_base, _metric, _delta, _op) do {              \
+    if ((_base) != NULL) {                                                  \
+        __typeof__(_base) _s = (__typeof__(_base))metric_shard_local(       \
+                &_base##_shard, (struct metric *)(_base),                   \
+                METRIC_CARDINALITY(*(_base)));                              \
+        if (_s == (_base)) {                                                \
+            metric_##_op##_n((_s)->_metric, _delta);                        \
+        } else {                                                            \
+            metric_##_op##_n_local((_s)->_metric, _delta);                  \
+        }                                                                   \
+    }                                                                       \
+} while(0)
+
+#define INCR_N_SHARD(_base, _metric, _delta)                                \
+    _METRIC_SHARD_UPDATE(_base, _metric, _delta, incr)
+#define INCR_SHARD(_base, _metric) INCR_N_SHARD(_base, _metric, 1)
+#define DECR_N_SHARD(_base, _metric, _delta)                                \
+    _METRIC_SHARD_UPDATE(_base, _metric, _delta, decr)
+#define DECR_SHARD(_base, _metric) DECR_N_SHARD(_base, _metric, 1)
+
 #define DECR_N(_base, _metric, _delta) do {                                 \
     if ((_base) != NULL) {                                                  \
          metric_decr_n((_base)->_metric, _delta);                           \
@@ -86,6 +202,12 @@ extern "C" {
     }                                                                       \
 } while(0)
 
+#define RECORD_VAL(_base, _metric, _val) do {                               \
+    if ((_base) != NULL) {                                                  \
+         metric_histogram_record(&(_base)->_metric, (uint64_t)(_val));      \
+    }                                                                       \
+} while(0)
+
 
 #define METRIC_DECLARE(_name, _type, _description)   \
     struct metric _name;
@@ -103,6 +225,11 @@ extern "C" {
 #define DECR(_base, _metric)
 #define DECR_N(_base, _metric, _delta)
 #define UPDATE_VAL(_base, _metric, _val)
+#define RECORD_VAL(_base, _metric, _val)
+#define INCR_SHARD(_base, _metric)
+#define INCR_N_SHARD(_base, _metric, _delta)
+#define DECR_SHARD(_base, _metric)
+#define DECR_N_SHARD(_base, _metric, _delta)
 
 #define METRIC_DECLARE(_name, _type, _description)
 #define METRIC_INIT(_name, _type, _description)
@@ -110,15 +237,37 @@ extern "C" {
 
 #endif
 
-#define METRIC_CARDINALITY(_o) sizeof(_o) / sizeof(struct metric)
-
 typedef enum metric_type {
     METRIC_COUNTER, /* supports INCR/INCR_N/UPDATE_VAL */
     METRIC_GAUGE,   /* supports INCR/INCR_N/DECR/DECR_N/UPDATE_VAL */
-    METRIC_FPN      /* supports UPDATE_VAL */
+    METRIC_FPN,     /* supports UPDATE_VAL */
+    METRIC_HISTOGRAM /* supports RECORD_VAL */
 } metric_type_e;
 
-extern char *metric_type_str[3];
+extern char *metric_type_str[4];
+
+/*
+ * Histograms use log-linear buckets in the style of HdrHistogram: values below
+ * 2^HISTOGRAM_SUB_BITS get a bucket each, and every power of two above that is
+ * split into 2^HISTOGRAM_SUB_BITS linear sub-buckets, which bounds the relative
+ * error of a reported percentile to 1/2^HISTOGRAM_SUB_BITS over the whole
+ * uint64_t range with a fixed number of buckets. Recording is a handful of
+ * relaxed atomic adds, so any thread can record without locking.
+ *
+ * The buckets are allocated on the first record, as the *_METRIC tables are
+ * plain initializers; metric_free releases them. Values are unit-less, though
+ * durations are recorded in nanoseconds by convention (see duration_record).
+ */
+#define HISTOGRAM_SUB_BITS  4
+#define HISTOGRAM_NSUB      (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NBUCKET   ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_NSUB)
+
+struct histogram {
+    uint64_t    count;
+    uint64_t    sum;
+    uint64_t    max;
+    uint64_t    bucket[HISTOGRAM_NBUCKET];
+};
 
 /* Note: anonymous union does not work with older (<gcc4.7) compilers */
 /* TODO(yao): determine if we should dynamically allocate the value field
@@ -132,11 +281,115 @@ struct metric {
         uint64_t    counter;
         int64_t     gauge;
         double      fpn;
+        struct histogram *histo;
     };
 };
 
+void metric_setup(metric_options_st *options);
+void metric_teardown(void);
+
+/* zero all values; concurrent updates may be lost, see metric_epoch below */
 void metric_reset(struct metric sarr[], unsigned int nmetric);
+/* release memory held by metrics, i.e. histogram buckets */
+void metric_free(struct metric sarr[], unsigned int nmetric);
 size_t metric_print(char *buf, size_t nbuf, char *fmt, struct metric *m);
+/* copy base into dst with the values of all shards of base added in */
+void metric_snapshot(struct metric dst[], struct metric base[],
+        unsigned int nmetric);
+/* fold all shards of base back into it and free them */
+void metric_shard_release(struct metric base[], unsigned int nmetric);
+/* # shards of all bases, e.g. to check none are left behind */
+uint32_t metric_shard_count(void);
+
+/*
+ * Bulk export: modules or applications register their metric arrays, and an
+ * exporter fetches the layout (all names and value types) once, then
+ * repeatedly copies every value of every registered array into a packed
+ * uint64_t array in the same order, without formatting anything. Counters are
+ * stored as-is, gauges as int64_t and floating points as double bit patterns;
+ * a histogram takes METRIC_EXPORT_HISTOGRAM slots holding its count, p50, p90,
+ * p99, p999 and max, named like in metric_print. Sharded values are summed.
+ *
+ * The layout is a uint32_t slot count followed, for each slot, by a uint8_t
+ * metric_type_e (METRIC_COUNTER for histogram slots), a uint8_t name length
+ * and the name, unterminated. metric_export_gen changes whenever the set of
+ * registered arrays does, telling exporters to fetch the layout again.
+ */
+#define METRIC_EXPORT_NGROUP    64
+#define METRIC_EXPORT_HISTOGRAM 6
+
+rstatus_i metric_register(struct metric base[], unsigned int nmetric);
+void metric_deregister(struct metric base[]);
+uint32_t metric_export_gen(void);
+/* # of value slots across all registered arrays */
+unsigned int metric_export_nslot(void);
+/* write the layout into buf if it fits, return the size it needs */
+size_t metric_export_layout(void *buf, size_t nbuf);
+/* copy up to nslot values into val, return the # of slots written */
+unsigned int metric_export_values(uint64_t val[], unsigned int nslot);
+
+/*
+ * Shared memory export: metric_shm_open creates a POSIX shared memory segment
+ * (name as for shm_open, e.g. "/myapp.metrics") that holds the export layout
+ * and values of all registered arrays behind a struct metric_shm_hdr, so an
+ * agent in another process can mmap it read-only and scrape without talking
+ * to the server at all. metric_setup opens it if option metric_shm_name is
+ * set. metric_shm_update (a timeout_cb_fn, meant for a timing wheel) copies
+ * the current values in, and only rewrites the layout, growing the segment if
+ * needed, when metric_export_gen has changed; this takes no syscall or
+ * formatting otherwise. The segment is unlinked by metric_shm_close.
+ *
+ * Readers follow the seqlock protocol: load seq, and if it is even, copy what
+ * they need, then load seq again; the copy is consistent if both loads match.
+ * Offsets are from the start of the segment and values are laid out as in
+ * metric_export_values. A reader should check magic and version first, and
+ * remap if size has grown past its mapping.
+ */
+#define METRIC_SHM_MAGIC    0x4d534343  /* "CCSM" in little endian */
+#define METRIC_SHM_VERSION  1
+
+struct metric_shm_hdr {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    seq;        /* odd while an update is being written */
+    uint64_t    size;       /* of the segment */
+    uint64_t    update_ns;  /* wall clock of the last update */
+    uint32_t    gen;        /* metric_export_gen of the layout */
+    uint32_t    nslot;      /* # values */
+    uint32_t    layout_off; /* metric_export_layout output */
+    uint32_t    layout_len;
+    uint32_t    value_off;  /* nslot uint64_t values */
+    uint32_t    _pad;
+};
+
+rstatus_i metric_shm_open(const char *name);
+void metric_shm_close(void);
+void metric_shm_update(void *arg);
+
+/*
+ * Epochs give a reader per-interval values without resetting, or even
+ * writing to, the shared metrics: each metric_epoch_advance takes a snapshot
+ * of base (shards included) and returns its difference from the snapshot of
+ * the previous call. Counters come back as the increment over the interval,
+ * histograms as the histogram of the values recorded during the interval,
+ * while gauges and floating points keep their current value, since they are
+ * levels rather than totals. The returned array is owned by the epoch and
+ * valid until the next call; it works with metric_print like any other.
+ *
+ * metric_epoch_create starts the first interval, so resetting the metrics of
+ * one reader is simply creating a new epoch, which never loses updates.
+ */
+struct metric_epoch;
+
+struct metric_epoch *metric_epoch_create(struct metric base[],
+        unsigned int nmetric);
+void metric_epoch_destroy(struct metric_epoch **epoch);
+/* end the current interval, returning its deltas and length in ns if wanted */
+struct metric *metric_epoch_advance(struct metric_epoch *epoch, uint64_t *ns);
+
+void metric_histogram_record(struct metric *m, uint64_t val);
+/* value at percentile p (0 < p <= 100), e.g. 99.9; 0 if nothing was recorded */
+uint64_t metric_histogram_percentile(struct metric *m, double p);
 void metric_describe_all(struct metric metrics[], unsigned int nmetric);
 
 #ifdef __cplusplus
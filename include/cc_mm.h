@@ -22,8 +22,111 @@ extern "C" {
 #endif
 
 #include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <cc_util.h>
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Large mappings obtained with cc_mmap can be backed by hugepages and bound to
+ * a NUMA node to cut TLB misses and keep per-core pools local:
+ *
+ * - MM_HUGEPAGE_THP asks for transparent hugepages with madvise(MADV_HUGEPAGE);
+ * - MM_HUGEPAGE_TLB maps from the hugetlbfs pool with MAP_HUGETLB. This only
+ *   applies to sizes that are a multiple of MM_HUGEPAGE_SIZE (so cc_munmap
+ *   works unchanged), and falls back to THP when the pool is exhausted.
+ *
+ * Binding with mbind is advisory: if it fails the mapping is kept as is.
+ * MM_NUMA_LOCAL binds to the node of the cpu the caller runs on (see
+ * cc_cpu.h), which is what a pinned worker wants for its pools.
+ * Both only take effect on Linux, and only for mappings of at least
+ * mm_hugepage_min bytes; smaller ones are mapped the usual way.
+ */
+#define MM_HUGEPAGE_NONE    0
+#define MM_HUGEPAGE_THP     1
+#define MM_HUGEPAGE_TLB     2
+
+#define MM_HUGEPAGE_SIZE    (2 * MiB)
+#define MM_NUMA_ANY         -1
+#define MM_NUMA_LOCAL       -2
+#define MM_NUMA_NODE_MAX    1024
+
+/*          name                type                default             description */
+#define MM_OPTION(ACTION)                                                                               \
+    ACTION( mm_hugepage,       OPTION_TYPE_UINT,   MM_HUGEPAGE_NONE,   "0: none, 1: thp, 2: hugetlb"  )\
+    ACTION( mm_hugepage_min,   OPTION_TYPE_UINT,   MM_HUGEPAGE_SIZE,   "min mmap size to use hugepage")\
+    ACTION( mm_numa_bind,      OPTION_TYPE_BOOL,   false,              "bind mmap to a numa node"     )\
+    ACTION( mm_numa_node,      OPTION_TYPE_UINT,   0,                  "numa node to bind mmap to"    )\
+    ACTION( mm_numa_local,     OPTION_TYPE_BOOL,   false,              "bind mmap to the caller's node")\
+    ACTION( mm_arena,          OPTION_TYPE_BOOL,   false,              "per-thread allocator arenas"  )
+
+typedef struct {
+    MM_OPTION(OPTION_DECLARE)
+} mm_options_st;
+
+/*
+ * Allocator backend: cc_alloc and friends get their memory from the functions
+ * below, libc's malloc family by default. A build with HAVE_JEMALLOC uses
+ * jemalloc's mallocx/rallocx/dallocx/sdallocx instead, and with mm_arena on,
+ * gives every thread an arena of its own on its first allocation (arenas are
+ * never destroyed, so this is meant for long-lived workers). Applications can
+ * plug in any other allocator (e.g. mimalloc's mi_free_size for free_sized)
+ * with mm_allocator_set, before anything has been allocated through cc_mm, as
+ * every block has to go back to the allocator it came from.
+ *
+ * cc_free_sized takes the size the block was allocated with, which lets
+ * allocators with sized deallocation skip looking it up; free_sized may be
+ * NULL, in which case free is called.
+ */
+struct mm_allocator {
+    void *(*alloc)(size_t size);
+    void *(*realloc)(void *ptr, size_t size); /* ptr may be NULL */
+    void  (*free)(void *ptr);
+    void  (*free_sized)(void *ptr, size_t size);
+};
+
+/* NULL restores the default backend */
+void mm_allocator_set(const struct mm_allocator *allocator);
+
+/*
+ * Allocation accounting: built with HAVE_MM_ACCOUNT, every block handed out by
+ * cc_alloc and friends carries a small header pointing at its call site, i.e.
+ * the __FILE__:__LINE__ the wrappers already pass along, and each site counts
+ * allocations, frees, live and peak bytes, also rolled up by source file
+ * (module). A block freed or reallocated elsewhere is still charged to the
+ * site that allocated it. Memory from cc_alloc must then only be released with
+ * cc_free/cc_realloc, never free(). Sites beyond MM_NSITE are lumped together
+ * as "(other)". Counting costs a few atomic adds per call on counters shared
+ * by all threads using a site, so it is meant for finding what grows, not for
+ * the fastest builds. The mm_alloc* metrics below are only updated in this
+ * mode, mm_mmap_byte always is.
+ */
+#define MM_NSITE            4096
+
+/*          name            type            description */
+#define MM_METRIC(ACTION)                                                      \
+    ACTION( mm_alloc,       METRIC_COUNTER, "# allocations"                   )\
+    ACTION( mm_alloc_ex,    METRIC_COUNTER, "# allocation errors"             )\
+    ACTION( mm_free,        METRIC_COUNTER, "# frees"                         )\
+    ACTION( mm_alloc_byte,  METRIC_GAUGE,   "bytes allocated and not freed"   )\
+    ACTION( mm_mmap_byte,   METRIC_GAUGE,   "bytes mapped by cc_mmap"         )
+
+typedef struct {
+    MM_METRIC(METRIC_DECLARE)
+} mm_metrics_st;
+
+/* counts of one call site, or of one module if line is 0 */
+struct mm_stat {
+    const char  *file;      /* without directories */
+    int         line;
+    uint64_t    nalloc;
+    uint64_t    nfree;
+    int64_t     byte;       /* live */
+    int64_t     peak;       /* highest byte has been */
+};
 
 /*
  * Memory allocation and free wrappers with debugging information.
@@ -34,8 +137,10 @@ extern "C" {
  * cc_realloc
  *
  * cc_free
+ * cc_free_sized
  *
  * cc_mmap
+ * cc_mmap_ext
  * cc_munmap
  */
 #define cc_alloc(_s)                                            \
@@ -60,9 +165,17 @@ extern "C" {
     (_p) = NULL;                                                \
 } while (0)
 
+#define cc_free_sized(_p, _s) do {                              \
+    _cc_free_sized(_p, (size_t)(_s), __FILE__, __LINE__);       \
+    (_p) = NULL;                                                \
+} while (0)
+
 #define cc_mmap(_s)                                             \
     _cc_mmap((size_t)(_s), __FILE__, __LINE__)
 
+#define cc_mmap_ext(_s, _huge, _node)                           \
+    _cc_mmap_ext((size_t)(_s), _huge, _node, __FILE__, __LINE__)
+
 #define cc_munmap(_p, _s)                                       \
     _cc_munmap(_p, (size_t)(_s), __FILE__, __LINE__)
 
@@ -72,9 +185,33 @@ void * _cc_calloc(size_t nmemb, size_t size, const char *name, int line);
 void * _cc_realloc(void *ptr, size_t size, const char *name, int line);
 void * _cc_realloc_move(void *ptr, size_t size, const char *name, int line);
 void _cc_free(void *ptr, const char *name, int line);
+void _cc_free_sized(void *ptr, size_t size, const char *name, int line);
 void * _cc_mmap(size_t size, const char *name, int line);
+void * _cc_mmap_ext(size_t size, int hugepage, int node, const char *name,
+        int line);
 int _cc_munmap(void *p, size_t size, const char *name, int line);
 
+/*
+ * setup sets the hugepage and numa policy used by cc_mmap, teardown restores
+ * the default (no hugepage, no binding); cc_mmap_ext takes them explicitly,
+ * with MM_NUMA_ANY meaning no binding. mm_numa_local overrides mm_numa_node
+ */
+void mm_setup(mm_options_st *options, mm_metrics_st *metrics);
+void mm_teardown(void);
+
+/*
+ * with allocation accounting, copy the counts of up to n call sites (or
+ * modules) into st and return how many were copied, 0 without accounting.
+ * Counts are kept from the first allocation on, setup or not
+ */
+uint32_t mm_stat_snapshot(struct mm_stat *st, uint32_t n, bool module);
+/*
+ * print the counts of all sites (or modules) into buf, each as four metrics
+ * formatted with fmt like metric_print, e.g. "mm::cc_log.c:275::byte 1024";
+ * returns the # bytes written
+ */
+size_t mm_stat_print(char *buf, size_t nbuf, char *fmt, bool module);
+
 #ifdef __cplusplus
 }
 #endif
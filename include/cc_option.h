@@ -117,6 +117,26 @@ void option_describe_all(struct option options[], unsigned int nopt);
 
 rstatus_i option_load_default(struct option options[], unsigned int nopt);
 rstatus_i option_load_file(FILE *fp, struct option options[], unsigned int nopt);
+
+/*
+ * Apply a changed option while running, called by option_reload_file after
+ * the new value is published in opt->val; old is the value it replaced.
+ * Returning anything but CC_OK fails the whole reload: every option changed by
+ * it is reverted, and apply is called again for those already applied, with
+ * old being the value they are rolled back from.
+ */
+typedef rstatus_i (*option_apply_fn)(struct option *opt, option_val_u old,
+        void *arg);
+
+/*
+ * Re-read a config file over options that are in use: the file is parsed in
+ * full first (options not in it go back to their default), and only if that
+ * succeeds each option whose value changed is stored atomically and handed to
+ * apply (which may be NULL), in table order. Strings replaced are freed once apply returns, so
+ * readers on other threads must not hold on to an option_str across reloads.
+ */
+rstatus_i option_reload_file(FILE *fp, struct option options[],
+        unsigned int nopt, option_apply_fn apply, void *arg);
 void option_free(struct option options[], unsigned int nopt);
 
 #ifdef __cplusplus
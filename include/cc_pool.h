@@ -27,6 +27,18 @@ extern "C" {
 #include <inttypes.h>
 #include <stdbool.h>
 
+/*
+ * A pool only grows by itself: returned objects are kept for the next borrow.
+ * Two watermarks bound how much it keeps idle:
+ * - objects returned while nhigh are already free are destroyed instead
+ *   (FREEPOOL_RELEASE), which caps the pool right away;
+ * - nidle is the fewest objects sitting free since the last FREEPOOL_TRIM,
+ *   i.e. how many were not needed at all over that interval. Each trim
+ *   destroys half of those beyond nlow, so an excess left by a spike decays
+ *   over a few trims while a pool that is in use keeps its working set.
+ * Trims are meant to run periodically, e.g. off a timing wheel, and the
+ * period sets what counts as idle.
+ */
 #define FREEPOOL(pool, name, type)                                  \
 STAILQ_HEAD(name, type);                                            \
 struct pool {                                                       \
@@ -34,6 +46,9 @@ struct pool {                                                       \
     uint32_t        nfree;                                          \
     uint32_t        nused;                                          \
     uint32_t        nmax;                                           \
+    uint32_t        nlow;       /* # free objects trim keeps */     \
+    uint32_t        nhigh;      /* # free objects kept at most */   \
+    uint32_t        nidle;      /* min nfree since last trim */     \
     bool            initialized;                                    \
 }
 
@@ -43,9 +58,26 @@ struct pool {                                                       \
     (pool)->nmax = (max) > 0 ? (max) : UINT32_MAX;                  \
     (pool)->nfree = 0;                                              \
     (pool)->nused = 0;                                              \
+    (pool)->nlow = 0;                                               \
+    (pool)->nhigh = UINT32_MAX;                                     \
+    (pool)->nidle = 0;                                              \
     (pool)->initialized = true;                                     \
 } while (0)
 
+/* high of 0 means no limit */
+#define FREEPOOL_WATERMARK(pool, low, high) do {                    \
+    ASSERT((pool)->initialized);                                    \
+    (pool)->nlow = (low);                                           \
+    (pool)->nhigh = (high) > 0 ? (high) : UINT32_MAX;               \
+} while (0)
+
+/* called when objects are taken off freeq other than by FREEPOOL_BORROW */
+#define FREEPOOL_IDLE_UPDATE(pool) do {                             \
+    if ((pool)->nfree < (pool)->nidle) {                            \
+        (pool)->nidle = (pool)->nfree;                              \
+    }                                                               \
+} while (0)
+
 #define FREEPOOL_DESTROY(var, tvar, pool, field, destroy) do {      \
     ASSERT((pool)->initialized);                                    \
     ASSERT((pool)->nused == 0);                                     \
@@ -78,6 +110,7 @@ struct pool {                                                       \
         (var) = STAILQ_FIRST(&(pool)->freeq);                       \
         STAILQ_REMOVE_HEAD(&(pool)->freeq, field);                  \
         (pool)->nfree--;                                            \
+        FREEPOOL_IDLE_UPDATE(pool);                                 \
     } else if ((pool)->nfree + (pool)->nused < (pool)->nmax) {      \
         (var) = create();                                           \
     } else {                                                        \
@@ -96,6 +129,196 @@ struct pool {                                                       \
     (pool)->nused--;                                                \
 } while (0)
 
+/* like FREEPOOL_RETURN, but destroy var if nhigh objects are free already */
+#define FREEPOOL_RELEASE(var, pool, field, destroy) do {            \
+    ASSERT((pool)->initialized);                                    \
+    if ((pool)->nfree < (pool)->nhigh) {                            \
+        FREEPOOL_RETURN(var, pool, field);                          \
+    } else {                                                        \
+        (pool)->nused--;                                            \
+        destroy(&(var));                                            \
+    }                                                               \
+} while (0)
+
+/* destroy half of the objects idle since the last trim beyond nlow */
+#define FREEPOOL_TRIM(var, pool, field, destroy) do {               \
+    uint32_t _n = 0;                                                \
+    ASSERT((pool)->initialized);                                    \
+    if ((pool)->nidle > (pool)->nlow) {                             \
+        _n = ((pool)->nidle - (pool)->nlow + 1) / 2;                \
+    }                                                               \
+    for (; _n > 0 && !STAILQ_EMPTY(&(pool)->freeq); _n--) {         \
+        (var) = STAILQ_FIRST(&(pool)->freeq);                       \
+        STAILQ_REMOVE_HEAD(&(pool)->freeq, field);                  \
+        (pool)->nfree--;                                            \
+        destroy(&(var));                                            \
+    }                                                               \
+    (pool)->nidle = (pool)->nfree;                                  \
+} while (0)
+
+/*
+ * Sharded free pool: each thread keeps a small local cache of free objects
+ * in front of a shared depot. Borrow and return only touch the local cache on
+ * the fast path, so they need no synchronization; when the local cache runs
+ * dry or grows beyond twice the batch size, objects move between the local
+ * cache and the depot `batch' at a time under a spinlock.
+ *
+ * The local cache is declared separately, normally as a thread-local, e.g.:
+ *
+ *   FREEPOOL_SHARDED(foo_spool, fooq, foo);
+ *   static struct foo_spool foosp;
+ *   static __thread struct foo_spool_local foosp_local;
+ *
+ * A zero-initialized local cache is valid. A thread must drain its local
+ * cache back into the depot before it exits, and all local caches must be
+ * drained before the pool is destroyed.
+ *
+ * This is opt-in: the pools of ccommon modules stay on FREEPOOL, as they are
+ * used from one thread and rely on FREEPOOL_WATERMARK/TRIM, which the sharded
+ * pool does not have. It is meant for pools shared by worker threads.
+ */
+#define FREEPOOL_SHARDED_BATCH 32
+
+#define FREEPOOL_SHARDED(pool, name, type)                          \
+STAILQ_HEAD(name, type);                                            \
+struct pool##_local {                                               \
+    struct name     freeq;                                          \
+    uint32_t        nfree;                                          \
+};                                                                  \
+struct pool {                                                       \
+    struct name     depot;                                          \
+    uint32_t        ndepot;     /* # objects in depot, atomic */    \
+    uint32_t        ncreated;   /* # objects owned by pool */       \
+    uint32_t        nmax;                                           \
+    uint32_t        batch;                                          \
+    bool            lock;                                           \
+    bool            initialized;                                    \
+}
+
+#define _FREEPOOL_LOCK(pool) do {                                   \
+    while (__atomic_test_and_set(&(pool)->lock, __ATOMIC_ACQUIRE)) {\
+        while (__atomic_load_n(&(pool)->lock, __ATOMIC_RELAXED));   \
+    }                                                               \
+} while (0)
+
+#define _FREEPOOL_UNLOCK(pool)                                      \
+    __atomic_clear(&(pool)->lock, __ATOMIC_RELEASE)
+
+#define FREEPOOL_SHARDED_CREATE(pool, max, nbatch) do {             \
+    ASSERT(!(pool)->initialized);                                   \
+    STAILQ_INIT(&(pool)->depot);                                    \
+    (pool)->nmax = (max) > 0 ? (max) : UINT32_MAX;                  \
+    (pool)->batch = (nbatch) > 0 ? (nbatch) : FREEPOOL_SHARDED_BATCH;\
+    (pool)->ndepot = 0;                                             \
+    (pool)->ncreated = 0;                                           \
+    (pool)->lock = false;                                           \
+    (pool)->initialized = true;                                     \
+} while (0)
+
+#define FREEPOOL_SHARDED_DESTROY(var, tvar, pool, field, destroy) do {\
+    ASSERT((pool)->initialized);                                    \
+    ASSERT((pool)->ndepot == (pool)->ncreated);                     \
+    STAILQ_FOREACH_SAFE(var, &(pool)->depot, field, tvar) {         \
+        STAILQ_REMOVE_HEAD(&(pool)->depot, field);                  \
+        (pool)->ndepot--;                                           \
+        (pool)->ncreated--;                                         \
+        destroy(&var);                                              \
+    }                                                               \
+    (pool)->initialized = false;                                    \
+    ASSERT((pool)->ndepot == 0);                                    \
+    ASSERT(STAILQ_EMPTY(&(pool)->depot));                           \
+} while (0)
+
+#define FREEPOOL_SHARDED_PREALLOC(var, pool, size, field, create) do {\
+    ASSERT((pool)->initialized);                                    \
+    _FREEPOOL_LOCK(pool);                                           \
+    while ((pool)->ncreated < size && (pool)->ncreated < (pool)->nmax) {\
+        (var) = create();                                           \
+        if ((var) != NULL) {                                        \
+            STAILQ_INSERT_HEAD(&(pool)->depot, var, field);         \
+            __atomic_add_fetch(&(pool)->ndepot, 1, __ATOMIC_RELAXED);\
+            __atomic_add_fetch(&(pool)->ncreated, 1, __ATOMIC_RELAXED);\
+        } else {                                                    \
+            break;                                                  \
+        }                                                           \
+    }                                                               \
+    _FREEPOOL_UNLOCK(pool);                                         \
+} while (0)
+
+/* move up to one batch of objects from the depot into the local cache */
+#define _FREEPOOL_REFILL(var, pool, local, field) do {              \
+    if (__atomic_load_n(&(pool)->ndepot, __ATOMIC_RELAXED) > 0) {   \
+        _FREEPOOL_LOCK(pool);                                       \
+        while ((local)->nfree < (pool)->batch &&                    \
+                !STAILQ_EMPTY(&(pool)->depot)) {                    \
+            (var) = STAILQ_FIRST(&(pool)->depot);                   \
+            STAILQ_REMOVE_HEAD(&(pool)->depot, field);              \
+            STAILQ_INSERT_HEAD(&(local)->freeq, var, field);        \
+            (local)->nfree++;                                       \
+            __atomic_sub_fetch(&(pool)->ndepot, 1, __ATOMIC_RELAXED);\
+        }                                                           \
+        _FREEPOOL_UNLOCK(pool);                                     \
+    }                                                               \
+} while (0)
+
+/* move n objects from the local cache into the depot */
+#define _FREEPOOL_SPILL(pool, local, field, n) do {                 \
+    __typeof__((pool)->depot) _q = STAILQ_HEAD_INITIALIZER(_q);     \
+    __typeof__(STAILQ_FIRST(&_q)) _v;                               \
+    uint32_t _i, _n = (n);                                          \
+    for (_i = 0; _i < _n; _i++) {                                   \
+        _v = STAILQ_FIRST(&(local)->freeq);                         \
+        STAILQ_REMOVE_HEAD(&(local)->freeq, field);                 \
+        STAILQ_INSERT_TAIL(&_q, _v, field);                         \
+    }                                                               \
+    (local)->nfree -= _n;                                           \
+    _FREEPOOL_LOCK(pool);                                           \
+    STAILQ_CONCAT(&(pool)->depot, &_q);                             \
+    __atomic_add_fetch(&(pool)->ndepot, _n, __ATOMIC_RELAXED);      \
+    _FREEPOOL_UNLOCK(pool);                                         \
+} while (0)
+
+#define FREEPOOL_SHARDED_BORROW(var, pool, local, field, create) do {\
+    ASSERT((pool)->initialized);                                    \
+    if ((local)->nfree == 0) {                                      \
+        _FREEPOOL_REFILL(var, pool, local, field);                  \
+    }                                                               \
+    if ((local)->nfree > 0) {                                       \
+        (var) = STAILQ_FIRST(&(local)->freeq);                      \
+        STAILQ_REMOVE_HEAD(&(local)->freeq, field);                 \
+        (local)->nfree--;                                           \
+    } else if (__atomic_add_fetch(&(pool)->ncreated, 1,             \
+                __ATOMIC_RELAXED) <= (pool)->nmax) {                \
+        (var) = create();                                           \
+        if ((var) == NULL) {                                        \
+            __atomic_sub_fetch(&(pool)->ncreated, 1, __ATOMIC_RELAXED);\
+        }                                                           \
+    } else {                                                        \
+        __atomic_sub_fetch(&(pool)->ncreated, 1, __ATOMIC_RELAXED); \
+        (var) = NULL;                                               \
+    }                                                               \
+    if ((var) != NULL) {                                            \
+        STAILQ_NEXT((var), field) = NULL;                           \
+    }                                                               \
+} while (0)
+
+#define FREEPOOL_SHARDED_RETURN(var, pool, local, field) do {       \
+    ASSERT((pool)->initialized);                                    \
+    STAILQ_INSERT_HEAD(&(local)->freeq, var, field);                \
+    (local)->nfree++;                                               \
+    if ((local)->nfree >= 2 * (pool)->batch) {                      \
+        _FREEPOOL_SPILL(pool, local, field, (pool)->batch);         \
+    }                                                               \
+} while (0)
+
+/* return everything in the local cache to the depot, e.g. at thread exit */
+#define FREEPOOL_SHARDED_DRAIN(pool, local, field) do {             \
+    ASSERT((pool)->initialized);                                    \
+    if ((local)->nfree > 0) {                                       \
+        _FREEPOOL_SPILL(pool, local, field, (local)->nfree);        \
+    }                                                               \
+} while (0)
+
 #ifdef __cplusplus
 }
 #endif
@@ -49,6 +49,13 @@ size_t cc_print_int64_unsafe(char *buf, int64_t n);
 size_t cc_print_uint64(char *buf, size_t size, uint64_t n);
 size_t cc_print_int64(char *buf, size_t size, int64_t n);
 
+/*
+ * shortest string that reads back (e.g. via strtod) as the same double, or
+ * nan/inf/-inf; returns 0 if it doesn't fit in size, output is not terminated
+ */
+#define CC_DOUBLE_MAXLEN (24 + 1)
+size_t cc_print_double(char *buf, size_t size, double n);
+
 size_t _scnprintf(char *buf, size_t size, const char *fmt, ...);
 size_t _vscnprintf(char *buf, size_t size, const char *fmt, va_list args);
 
@@ -58,15 +65,15 @@ static const uint64_t BASE10[CC_UINT64_MAXLEN - 1] = {
     1000000000000000, 10000000000000000, 100000000000000000,
     1000000000000000000, 10000000000000000000ul};
 
+/*
+ * bit length * log10(2) (1233 / 4096) is the digit count, or one short of it;
+ * BASE10[0] being 0 makes the correction right for the single digit case too
+ */
 static inline size_t
 digits(uint64_t n) {
-    size_t d = 1;
-
-    while (n >= BASE10[d]) {
-        d++;
-    }
+    size_t d = ((64 - __builtin_clzll(n | 1)) * 1233) >> 12;
 
-    return d;
+    return d + (n >= BASE10[d]);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,74 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Static tracepoints (USDT) for tools like bpftrace, perf or systemtap.
+ *
+ * With HAVE_USDT (which needs sys/sdt.h, e.g. from systemtap-sdt-dev), each
+ * PROBE site compiles to a single nop plus a note in the binary telling
+ * tracers where it is and how to find its arguments, so a probe costs nothing
+ * until a tracer attaches to it. Without HAVE_USDT they compile to nothing.
+ * All probes are under the provider ccommon:
+ *
+ *   bpftrace -e 'usdt:./libccommon.so:ccommon:tcp_recv { @[arg0] = sum(arg2); }'
+ *
+ * probe            arguments
+ * buf_borrow       buf, size
+ * buf_return       buf, size
+ * dbuf_resize      buf, old size, new size
+ * tcp_accept       listening sd, accepted sd
+ * tcp_recv         sd, bytes asked for, read/readv return value
+ * tcp_send         sd, bytes asked for, write/writev/send return value
+ * event_wait_enter event base, timeout in ms
+ * event_wait_exit  event base, # events (or the return value of the syscall)
+ * wheel_execute    timing wheel, # ticks processed, ns spent
+ * log_flush        logger fd, bytes flushed
+ *
+ * Probes with the same name may be at several sites, e.g. tcp_recv is in
+ * tcp_recv, tcp_recvv and tcp_recv_pipe; tracers attach to all of them.
+ */
+
+#include <cc_define.h>
+
+#if defined CC_USDT && CC_USDT == 1
+
+#include <sys/sdt.h>
+
+#define PROBE(_name)                    DTRACE_PROBE(ccommon, _name)
+#define PROBE1(_name, _a1)              DTRACE_PROBE1(ccommon, _name, _a1)
+#define PROBE2(_name, _a1, _a2)         DTRACE_PROBE2(ccommon, _name, _a1, _a2)
+#define PROBE3(_name, _a1, _a2, _a3)                                \
+    DTRACE_PROBE3(ccommon, _name, _a1, _a2, _a3)
+
+#else
+
+#define PROBE(_name)
+#define PROBE1(_name, _a1)
+#define PROBE2(_name, _a1, _a2)
+#define PROBE3(_name, _a1, _a2, _a3)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -17,6 +17,10 @@
 
 /*
  * rbuf: a ring buffer designed for logging use (NOT THREADSAFE!)
+ *
+ * One reader and one writer may use the same rbuf from different threads:
+ * each side publishes its offset with release semantics after touching the
+ * data, and loads the other side's offset with acquire semantics.
  */
 
 #pragma once
@@ -28,6 +32,7 @@ extern "C" {
 #include <cc_metric.h>
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 /*          name            type            description */
 #define RBUF_METRIC(ACTION)                                           \
@@ -53,25 +58,25 @@ struct rbuf {
 static inline uint32_t
 get_rpos(struct rbuf *buf)
 {
-    return __atomic_load_n(&(buf->rpos), __ATOMIC_RELAXED);
+    return __atomic_load_n(&(buf->rpos), __ATOMIC_ACQUIRE);
 }
 
 static inline uint32_t
 get_wpos(struct rbuf *buf)
 {
-    return __atomic_load_n(&(buf->wpos), __ATOMIC_RELAXED);
+    return __atomic_load_n(&(buf->wpos), __ATOMIC_ACQUIRE);
 }
 
 static inline void
 set_rpos(struct rbuf *buf, uint32_t rpos)
 {
-    __atomic_store_n(&(buf->rpos), rpos, __ATOMIC_RELAXED);
+    __atomic_store_n(&(buf->rpos), rpos, __ATOMIC_RELEASE);
 }
 
 static inline void
 set_wpos(struct rbuf *buf, uint32_t wpos)
 {
-    __atomic_store_n(&(buf->wpos), wpos, __ATOMIC_RELAXED);
+    __atomic_store_n(&(buf->wpos), wpos, __ATOMIC_RELEASE);
 }
 
 /* setup/teardown */
@@ -88,8 +93,24 @@ size_t rbuf_wcap(struct rbuf *buf);
 
 /* read from rbuf into a buffer in memory */
 size_t rbuf_read(void *dst, struct rbuf *src, size_t n);
+/*
+ * describe the readable region in place as up to two iovecs (two if it wraps
+ * around), returns the number of iovecs filled; rbuf_consume then marks the
+ * first n of those bytes as read
+ */
+int rbuf_peek(struct rbuf *buf, struct iovec iov[2]);
+void rbuf_consume(struct rbuf *buf, size_t n);
 /* write from a buffer in memory to the rbuf */
 size_t rbuf_write(struct rbuf *dst, void *src, size_t n);
+/* gather-write, publishing the new write offset once at the end */
+size_t rbuf_writev(struct rbuf *dst, const struct iovec *iov, int iovcnt);
+/*
+ * zero-copy write: rbuf_reserve describes n bytes of free space in place as
+ * up to two iovecs, or returns 0 if there is not enough room; the writer fills
+ * them in and publishes the first n of those bytes with rbuf_commit
+ */
+int rbuf_reserve(struct rbuf *buf, size_t n, struct iovec iov[2]);
+void rbuf_commit(struct rbuf *buf, size_t n);
 
 #ifdef __cplusplus
 }
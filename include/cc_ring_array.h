@@ -16,12 +16,19 @@
  */
 
 /*
- * This ring array is designed specifically with communication between two
- * threads in mind, with one thread as the producer and the other thread as the
- * consumer. In other words, one thread does all of the pushing and the other
- * thread does all of the popping. Given these conditions are met, the ring
- * array can guarantee that all pushes and pops will be valid and leave the
- * array in a valid state.
+ * By default, this ring array is designed specifically with communication
+ * between two threads in mind, with one thread as the producer and the other
+ * thread as the consumer. In other words, one thread does all of the pushing
+ * and the other thread does all of the popping. Given these conditions are
+ * met, the ring array can guarantee that all pushes and pops will be valid and
+ * leave the array in a valid state.
+ *
+ * A ring array created with ring_array_create_mpmc can be pushed to and popped
+ * from by any number of threads concurrently. Each slot carries a sequence
+ * number that tells producers and consumers whether it is ready for them, so
+ * the only shared writes are a CAS on the read or write position. In this mode
+ * ring_array_full and ring_array_empty are only hints, since other threads may
+ * change the state of the array right after the check.
  */
 
 #pragma once
@@ -31,6 +38,7 @@ extern "C" {
 #endif
 
 #include <cc_define.h>
+#include <cc_util.h>
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -38,11 +46,20 @@ extern "C" {
 
 #define RING_ARRAY_DEFAULT_CAP 1024
 
+#define RING_ARRAY_SPSC 0         /* single producer, single consumer */
+#define RING_ARRAY_MPMC 1         /* multiple producers, multiple consumers */
+
 struct ring_array {
     size_t      elem_size;         /* element size */
+    size_t      slot_size;         /* slot size, including sequence if MPMC */
     uint32_t    cap;               /* total capacity */
-    uint32_t    rpos;              /* read offset */
-    uint32_t    wpos;              /* write offset */
+    uint32_t    type;              /* RING_ARRAY_SPSC or RING_ARRAY_MPMC */
+    /* rpos and wpos are written by different threads, keep them apart */
+    uint8_t     _pad0[CC_CACHELINE_SIZE];
+    uint64_t    rpos;              /* read offset */
+    uint8_t     _pad1[CC_CACHELINE_SIZE - sizeof(uint64_t)];
+    uint64_t    wpos;              /* write offset */
+    uint8_t     _pad2[CC_CACHELINE_SIZE - sizeof(uint64_t)];
     union {
         size_t  pad;               /* using a size_t member to force alignment at
                                       native word boundary */
@@ -57,6 +74,12 @@ struct ring_array {
 /* push an element into the array */
 rstatus_i ring_array_push(const void *elem, struct ring_array *arr);
 
+/*
+ * push up to n elements stored back to back at elem, return # pushed; in SPSC
+ * mode the elements are copied in at most two chunks and published at once
+ */
+uint32_t ring_array_push_n(const void *elem, uint32_t n, struct ring_array *arr);
+
 /* check if array is full */
 bool ring_array_full(const struct ring_array *arr);
 
@@ -68,6 +91,12 @@ bool ring_array_full(const struct ring_array *arr);
 /* pop an element from the array */
 rstatus_i ring_array_pop(void *elem, struct ring_array *arr);
 
+/*
+ * pop up to n elements into elem (if not NULL), return # popped; in SPSC mode
+ * the elements are copied out in at most two chunks and released at once
+ */
+uint32_t ring_array_pop_n(void *elem, uint32_t n, struct ring_array *arr);
+
 /* check if array is empty */
 bool ring_array_empty(const struct ring_array *arr);
 
@@ -79,6 +108,7 @@ void ring_array_flush(struct ring_array *arr);
  * Create/Delete *
  *****************/
 struct ring_array *ring_array_create(size_t elem_size, uint32_t cap);
+struct ring_array *ring_array_create_mpmc(size_t elem_size, uint32_t cap);
 void ring_array_destroy(struct ring_array **arr);
 
 #ifdef __cplusplus
@@ -0,0 +1,185 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A multi-threaded event loop runtime.
+ *
+ * A runtime runs nworker threads, each owning an event base, a timing wheel
+ * (with its own pool of timeout events) and a notify conn that wakes it up.
+ * Whatever is registered with a worker's event base or wheel is only touched
+ * by that worker, so the single-threaded building blocks need no locking.
+ * Other threads talk to a worker in two ways, both through MPMC ring arrays
+ * followed by a notify_send:
+ * - runtime_handoff passes a pointer, e.g. a freshly accepted connection, to
+ *   a worker, which receives it through the handoff callback and owns it
+ *   from then on;
+ * - runtime_submit queues a task. Workers run their own tasks in order
+ *   between event loop iterations, runtime_task_batch at a time, and a worker
+ *   that runs out steals queued tasks off the others. Submitting to a busy
+ *   worker also wakes up an idle one, so CPU heavy work spreads across cores
+ *   even if it all goes to one worker. Tasks must not rely on which worker
+ *   runs them.
+ *
+ * All callbacks run on the worker thread: start before its first and stop
+ * after its last loop iteration (set up and drain thread-local state there,
+ * e.g. FREEPOOL_SHARDED caches, and keep it in the worker's data), handoff
+ * for every pointer handed to it, and the event callback for any fd the
+ * application registers with the worker's event base.
+ *
+ * With runtime_pin, worker i is pinned to the (i % cpu_count)-th cpu the
+ * process may run on before its start hook, and its cpu and NUMA node are
+ * recorded in the worker for allocating its pools (see cc_cpu.h), e.g. with
+ * cc_mmap_ext(size, hugepage, w->node). cpu_setup must be called first.
+ *
+ * The buf, buf_sock and tcp_conn pools are process-wide and not thread safe
+ * (see notes/thread_safe.txt), objects from them must be borrowed and
+ * returned under a lock of the application's when several workers use them.
+ */
+
+#include <cc_cpu.h>
+#include <cc_define.h>
+#include <cc_event.h>
+#include <cc_metric.h>
+#include <cc_mm.h>
+#include <cc_option.h>
+#include <cc_ring_array.h>
+#include <channel/cc_notify.h>
+#include <time/cc_wheel.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RUNTIME_NWORKER     4
+#define RUNTIME_NEVENT      1024
+#define RUNTIME_TICK        10      /* in ms */
+#define RUNTIME_NSLOT       1024    /* timing wheel slots */
+#define RUNTIME_QUEUE       1024    /* handoff and task queue size per worker */
+#define RUNTIME_TASK_BATCH  16
+#define RUNTIME_PIN         false
+
+#define RUNTIME_ANY         UINT32_MAX
+
+/*          name                    type                default             description */
+#define RUNTIME_OPTION(ACTION)                                                                                  \
+    ACTION( runtime_nworker,        OPTION_TYPE_UINT,   RUNTIME_NWORKER,    "# worker threads"                 )\
+    ACTION( runtime_nevent,         OPTION_TYPE_UINT,   RUNTIME_NEVENT,     "max # events per worker wakeup"   )\
+    ACTION( runtime_tick,           OPTION_TYPE_UINT,   RUNTIME_TICK,       "worker timing wheel tick in ms"   )\
+    ACTION( runtime_nslot,          OPTION_TYPE_UINT,   RUNTIME_NSLOT,      "worker timing wheel slots"        )\
+    ACTION( runtime_queue,          OPTION_TYPE_UINT,   RUNTIME_QUEUE,      "handoff/task queue size"          )\
+    ACTION( runtime_task_batch,     OPTION_TYPE_UINT,   RUNTIME_TASK_BATCH, "tasks run per loop iteration"     )\
+    ACTION( runtime_pin,            OPTION_TYPE_BOOL,   RUNTIME_PIN,        "pin each worker to its own cpu"   )
+
+typedef struct {
+    RUNTIME_OPTION(OPTION_DECLARE)
+} runtime_options_st;
+
+/*          name                    type            description */
+#define RUNTIME_METRIC(ACTION)                                                      \
+    ACTION( runtime_worker,         METRIC_GAUGE,   "# worker threads running"     )\
+    ACTION( runtime_handoff,        METRIC_COUNTER, "# pointers handed off"        )\
+    ACTION( runtime_handoff_ex,     METRIC_COUNTER, "# handoffs to a full queue"   )\
+    ACTION( runtime_task,           METRIC_COUNTER, "# tasks submitted"            )\
+    ACTION( runtime_task_ex,        METRIC_COUNTER, "# tasks to a full queue"      )\
+    ACTION( runtime_task_run,       METRIC_COUNTER, "# tasks run"                  )\
+    ACTION( runtime_task_steal,     METRIC_COUNTER, "# tasks run by another worker")
+
+typedef struct {
+    RUNTIME_METRIC(METRIC_DECLARE)
+} runtime_metrics_st;
+
+struct runtime;
+struct runtime_worker;
+
+typedef void (*runtime_task_fn)(void *);
+typedef void (*runtime_worker_fn)(struct runtime_worker *);
+typedef void (*runtime_handoff_fn)(struct runtime_worker *, void *);
+
+struct runtime_task {
+    runtime_task_fn         fn;
+    void                    *arg;
+};
+
+struct runtime_worker {
+    uint32_t                id;         /* index in the runtime, from 0 */
+    struct runtime          *rt;
+    pthread_t               tid;
+    bool                    started;    /* tid is valid */
+    bool                    idle;       /* blocked or about to block, atomic */
+    int                     cpu;        /* pinned to, CPU_UNKNOWN if not */
+    int                     node;       /* NUMA node of cpu, MM_NUMA_ANY if not */
+
+    struct event_base       *evb;
+    struct timing_wheel     *tw;
+    struct notify_conn      *notify;    /* wakes up the worker */
+    struct ring_array       *handoff;   /* void * handed to the worker */
+    struct ring_array       *task;      /* struct runtime_task */
+
+    void                    *data;      /* owned by the application */
+};
+
+struct runtime {
+    struct runtime_worker   *worker;    /* worker[] */
+    uint32_t                nworker;
+    uint32_t                next;       /* round robin for RUNTIME_ANY, atomic */
+    bool                    stop;       /* atomic */
+
+    event_cb_fn             event_cb;
+    runtime_handoff_fn      handoff_cb;
+    runtime_worker_fn       start_cb;
+    runtime_worker_fn       stop_cb;
+};
+
+void runtime_setup(runtime_options_st *options, runtime_metrics_st *metrics);
+void runtime_teardown(void);
+
+/*
+ * nworker 0: runtime_nworker workers. Workers are created with their event
+ * base and wheel ready, so fds can be registered before the runtime starts.
+ */
+struct runtime *runtime_create(uint32_t nworker, event_cb_fn event_cb, runtime_handoff_fn handoff_cb);
+/* stops the runtime first if needed, drops tasks and handoffs not yet run */
+void runtime_destroy(struct runtime **rt);
+
+/* called on each worker thread, set before runtime_start */
+void runtime_set_hooks(struct runtime *rt, runtime_worker_fn start_cb, runtime_worker_fn stop_cb);
+
+/* start all worker threads, CC_ERROR (with none left running) if one fails */
+rstatus_i runtime_start(struct runtime *rt);
+/* ask all workers to exit after their current iteration, and join them */
+void runtime_stop(struct runtime *rt);
+
+/*
+ * Thread-safe. id is a worker index, or RUNTIME_ANY: round robin for
+ * handoffs; for tasks, the calling worker if there is one, else round robin.
+ * Both return CC_ENOMEM if the worker's queue is full.
+ */
+rstatus_i runtime_handoff(struct runtime *rt, uint32_t id, void *ptr);
+rstatus_i runtime_submit(struct runtime *rt, uint32_t id, runtime_task_fn fn, void *arg);
+
+/* the worker the calling thread runs, NULL if not a worker thread */
+struct runtime_worker *runtime_worker_self(void);
+
+#ifdef __cplusplus
+}
+#endif
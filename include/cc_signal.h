@@ -47,11 +47,32 @@ struct signal {
  * - SIGTTIN(debug): reload log file
  * - SIGSEGV(debug): print stacktrace before reraise segfault again
  * - SIGPIPE(channel): ignored, this prevents service from exiting when pipe closes
+ * - SIGUSR2(trace): dump trace buffers
  */
 extern struct signal signals[SIGNAL_MAX]; /* there are only 31 signals from 1 to 31 */
 
 int signal_override(int signo, char *info, int flags, uint32_t mask, sig_fn handler);
 
+/**
+ * Signals as events: rather than having handlers interrupt whatever runs and
+ * stick to async-signal-safe calls (or set a flag polled by the loop), the
+ * signals in mask (bit signo set for each) can be turned into a descriptor
+ * that becomes readable when one arrives, to add to an event base with
+ * event_add_read. When it fires, signal_fd_handle runs the handler set in
+ * signals[] for each signal received, from the loop and with nothing
+ * interrupted, and returns how many it ran (-1 on error).
+ *
+ * On Linux this is a signalfd and the signals are blocked, which only works
+ * if they are blocked in all threads: open it before creating any, threads
+ * inherit the mask. Elsewhere it is a kqueue with EVFILT_SIGNAL filters, and
+ * the signals are ignored instead. Either way, repeated signals may be
+ * coalesced. Only meant for asynchronous signals such as SIGHUP, SIGTERM or
+ * SIGUSR1/2; signal_fd_close undoes signal_fd_open.
+ */
+int signal_fd_open(uint32_t mask);
+int signal_fd_handle(int fd);
+void signal_fd_close(int fd, uint32_t mask);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,91 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * A slab allocator for objects of a single, fixed size: objects are carved
+ * out of large regions obtained with cc_mmap, so they are dense in memory and
+ * cost no per-object malloc. Freed objects go on a free list threaded through
+ * the objects themselves and are handed out again before the slab grows.
+ * Memory is only given back to the system when the slab is destroyed.
+ *
+ * A slab is not thread-safe; use one per thread or wrap it in a lock.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_util.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_REGION_SIZE (1 * MiB)       /* default region size */
+#define SLAB_ALIGN       (2 * sizeof(void *))
+#define SLAB_PAGE_SIZE   (4 * KiB)
+
+struct slab_region {
+    struct slab_region  *next;
+    size_t              size;           /* size of mapping */
+};
+
+struct slab {
+    struct slab_region  *region;        /* regions obtained with cc_mmap */
+    void                *free;          /* free list */
+    char                *pos;           /* first never used object */
+    char                *end;           /* end of objects in current region */
+    size_t              obj_size;       /* object size, after alignment */
+    size_t              region_size;
+    uint32_t            nobj;           /* # objects per region */
+    uint32_t            nregion;        /* # regions mapped */
+    uint32_t            nused;          /* # objects allocated */
+    uint32_t            nmax;           /* max # objects, 0 is unlimited */
+};
+
+/*
+ * create a slab of objects of obj_size bytes, growing by regions of
+ * region_size bytes (SLAB_REGION_SIZE if 0), up to nmax objects in total
+ * (unlimited if 0)
+ */
+struct slab *slab_create(size_t obj_size, size_t region_size, uint32_t nmax);
+void slab_destroy(struct slab **slab);
+
+/*
+ * region size that holds n objects of obj_size in a single mapping, rounded
+ * up to a multiple of MM_HUGEPAGE_SIZE once it is that large so the region
+ * can be hugepage-backed (see cc_mm.h), to whole pages otherwise
+ */
+size_t slab_region_fit(size_t obj_size, uint32_t n);
+
+/* map regions until at least n objects are available without growing */
+rstatus_i slab_reserve(struct slab *slab, uint32_t n);
+
+/* allocate an object, NULL if out of memory or at nmax */
+void *slab_alloc(struct slab *slab);
+void slab_free(struct slab *slab, void *obj);
+
+/* was obj carved out of one of the slab's regions? */
+bool slab_owns(const struct slab *slab, const void *obj);
+
+#ifdef __cplusplus
+}
+#endif
@@ -30,7 +30,8 @@
  * The most common IO pattern is reading into a contiguous and writing from a
  * vector of buffers.
  * Delimiter-based IO may be useful, but often it's sufficient to start with
- * size-based semantics.
+ * size-based semantics. Both kinds of framing on top of buffered input are in
+ * stream/cc_frame.h.
  *
  * Because a stream has all the information needed for data IO and followup
  * actions, it is likely the only data structure to pass into an async event-
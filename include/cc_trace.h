@@ -0,0 +1,140 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tracing spans for the hot path.
+ *
+ * TRACE_BEGIN and TRACE_END stamp the beginning and end of a span with a
+ * timestamp and a small event id into a ring buffer of the calling thread,
+ * created on its first record. A thread only ever writes to its own buffer,
+ * so recording takes no lock and no shared cache line, just a clock read and
+ * a 16-byte copy; when the buffer is full the record is dropped and counted.
+ * trace_dump drains the buffers of all threads as text, one record per line:
+ *
+ *   <ns since setup> <thread> B|E <event> <arg>
+ *
+ * and is also run on SIGUSR2, writing to trace_file (or stderr). Buffers live
+ * until teardown.
+ *
+ * Like metrics with CC_STATS, the macros compile to nothing unless the
+ * library is built with HAVE_TRACE; trace_record and the rest of the module
+ * are always there, and records are ignored until the module is set up.
+ *
+ * Ids below TRACE_USER are the spans of the library itself, applications can
+ * name their own with trace_name.
+ */
+
+#include <cc_define.h>
+#include <cc_option.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TRACE_NREC  4096        /* default # records buffered per thread */
+#define TRACE_FILE  NULL        /* default dump file on signal, stderr */
+
+/*          name        type              default     description */
+#define TRACE_OPTION(ACTION)                                                         \
+    ACTION( trace_nrec, OPTION_TYPE_UINT, TRACE_NREC, "# trace records per thread"  )\
+    ACTION( trace_file, OPTION_TYPE_STR,  TRACE_FILE, "file trace is dumped to"     )
+
+typedef struct {
+    TRACE_OPTION(OPTION_DECLARE)
+} trace_options_st;
+
+/*          id                   name */
+#define TRACE_EVENT(ACTION)                      \
+    ACTION( TRACE_EVENT_WAIT,    "event_wait"   )\
+    ACTION( TRACE_BUF_TCP_READ,  "buf_tcp_read" )\
+    ACTION( TRACE_BUF_TCP_WRITE, "buf_tcp_write")\
+    ACTION( TRACE_DBUF_DOUBLE,   "dbuf_double"  )\
+    ACTION( TRACE_LOG_FLUSH,     "log_flush"    )
+
+#define TRACE_EVENT_ID(_id, _name) _id,
+enum trace_event {
+    TRACE_EVENT(TRACE_EVENT_ID)
+    TRACE_USER                  /* first id free for applications */
+};
+#undef TRACE_EVENT_ID
+
+#define TRACE_NEVENT    1024    /* ids that can be named with trace_name */
+#define TRACE_SPAN_END  0x80000000U
+
+struct trace_rec {
+    uint64_t    ts;             /* raw clock, see trace_now */
+    uint32_t    id;             /* event id, with TRACE_SPAN_END on ends */
+    uint32_t    arg;            /* e.g. bytes or # events, 0 if unused */
+};
+
+#if defined CC_TRACE && CC_TRACE == 1
+
+#define TRACE_BEGIN(_id) trace_record((_id), 0)
+#define TRACE_END(_id) trace_record((_id) | TRACE_SPAN_END, 0)
+#define TRACE_END_N(_id, _arg) trace_record((_id) | TRACE_SPAN_END, (_arg))
+
+#else
+
+#define TRACE_BEGIN(_id)
+#define TRACE_END(_id)
+#define TRACE_END_N(_id, _arg)
+
+#endif
+
+rstatus_i trace_setup(trace_options_st *options);
+void trace_teardown(void);
+
+/* name an application id (TRACE_USER <= id < TRACE_NEVENT) in dumps */
+rstatus_i trace_name(uint32_t id, const char *name);
+
+/*
+ * a cheap monotonic clock: the TSC on x86, CLOCK_MONOTONIC elsewhere; dumps
+ * convert it to ns
+ */
+static inline uint64_t
+trace_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void trace_record(uint32_t id, uint32_t arg);
+
+/*
+ * write out and discard the records of all threads, returns the # records
+ * written; a dump already in progress (e.g. from the signal) makes it return 0
+ */
+size_t trace_dump(int fd);
+
+/* # records dropped because the buffer of their thread was full */
+uint64_t trace_ndrop(void);
+
+#ifdef __cplusplus
+}
+#endif
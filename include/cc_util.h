@@ -71,6 +71,7 @@ extern "C" {
 /* alignment */
 /* Make data 'd' or pointer 'p', n-byte aligned, where n is a power of 2 */
 #define CC_ALIGNMENT        sizeof(unsigned long) /* platform word */
+#define CC_CACHELINE_SIZE   64 /* assumed, to keep hot fields apart */
 #define CC_ALIGN(d, n)      ((size_t)(((d) + (n - 1)) & ~(n - 1)))
 #define CC_ALIGN_PTR(p, n)  \
     (void *) (((uintptr_t) (p) + ((uintptr_t) n - 1)) & ~((uintptr_t) n - 1))
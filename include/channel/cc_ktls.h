@@ -0,0 +1,134 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <channel/cc_tcp.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Kernel TLS for tcp_conn.
+ *
+ * The handshake is done in user space by whatever TLS library the application
+ * uses. Once it is done, ktls_enable hands the negotiated keys to the kernel
+ * (TCP_ULP "tls"), which from then on encrypts what is sent and decrypts what
+ * is received on the socket. The conn keeps being driven with tcp_send,
+ * tcp_sendv, tcp_recv and friends, and the splice based paths (tcp_send_pipe,
+ * tcp_proxy) stay zero-copy. MSG_ZEROCOPY is not supported by kernel TLS, so
+ * tcp_send_zc falls back to copying on a conn with keys for sending.
+ *
+ * Records other than application data (alerts, TLS 1.3 post-handshake
+ * messages) cannot be read with tcp_recv: it fails with c->err set to EIO when
+ * one is next in line, which is then read with ktls_recv_record. Alerts such
+ * as close_notify are sent with ktls_send_record.
+ *
+ * This is Linux only, elsewhere ktls_enable fails with ENOSYS.
+ */
+
+#define KTLS_TX_ZEROCOPY false
+#define KTLS_RX_NOPAD true
+
+#define KTLS_KEY_MAX 32 /* AES-256 and ChaCha20 */
+#define KTLS_IV_LEN  12 /* salt and explicit iv together */
+#define KTLS_SEQ_LEN 8
+
+#define KTLS_V12 0x0303
+#define KTLS_V13 0x0304
+
+/* record content types */
+#define KTLS_RECORD_ALERT       21
+#define KTLS_RECORD_HANDSHAKE   22
+#define KTLS_RECORD_DATA        23
+
+/*          name                type                default             description */
+#define KTLS_OPTION(ACTION)                                                                                     \
+    ACTION( ktls_tx_zerocopy,   OPTION_TYPE_BOOL,   KTLS_TX_ZEROCOPY,   "sendfile/splice without copy (offload)")\
+    ACTION( ktls_rx_nopad,      OPTION_TYPE_BOOL,   KTLS_RX_NOPAD,      "expect no TLS 1.3 padding on recv"     )
+
+typedef struct {
+    KTLS_OPTION(OPTION_DECLARE)
+} ktls_options_st;
+
+/*          name                type            description */
+#define KTLS_METRIC(ACTION)                                                     \
+    ACTION( ktls_enable,        METRIC_COUNTER, "# kernel tls enabled"         )\
+    ACTION( ktls_enable_ex,     METRIC_COUNTER, "# kernel tls enable ex"       )\
+    ACTION( ktls_record_recv,   METRIC_COUNTER, "# records recv'd with type"   )\
+    ACTION( ktls_record_send,   METRIC_COUNTER, "# records sent with type"     )\
+    ACTION( ktls_record_ex,     METRIC_COUNTER, "# record recv/send ex"        )
+
+typedef struct {
+    KTLS_METRIC(METRIC_DECLARE)
+} ktls_metrics_st;
+
+typedef enum ktls_cipher {
+    KTLS_AES_128_GCM,
+    KTLS_AES_256_GCM,
+    KTLS_CHACHA20_POLY1305,
+    KTLS_SENTINEL
+} ktls_cipher_e;
+
+/*
+ * the traffic secret of one direction, as derived by the handshake. For
+ * AES-GCM, iv is the 4-byte salt followed by the 8-byte explicit nonce under
+ * TLS 1.2, or the 12-byte static iv under TLS 1.3; for ChaCha20 it is always
+ * the 12-byte iv. seq is the sequence number of the next record, big endian.
+ */
+struct ktls_key {
+    uint16_t        version;            /* KTLS_V12 or KTLS_V13 */
+    ktls_cipher_e   cipher;
+    uint8_t         key[KTLS_KEY_MAX];  /* only the cipher's key size is used */
+    uint8_t         iv[KTLS_IV_LEN];
+    uint8_t         seq[KTLS_SEQ_LEN];
+};
+
+void ktls_setup(ktls_options_st *options, ktls_metrics_st *metrics);
+void ktls_teardown(void);
+
+/*
+ * install kernel TLS on an established conn with keys for sending (tx) and/or
+ * receiving (rx), either may be NULL. Nothing may be sent after the handshake
+ * before this, and anything received past the handshake must have been
+ * consumed by the TLS library. Returns CC_EINVAL for a version/cipher not
+ * supported (ChaCha20 if the kernel headers built against lack it), before
+ * touching the conn, CC_ERROR with c->err set if the kernel refused; then the
+ * conn can no longer be trusted and should be closed.
+ */
+rstatus_i ktls_enable(struct tcp_conn *c, const struct ktls_key *tx,
+        const struct ktls_key *rx);
+
+/* send buf as one or more records of the given content type */
+ssize_t ktls_send_record(struct tcp_conn *c, uint8_t type, void *buf, size_t nbyte);
+/*
+ * receive the next record, or part of it, and its content type; returns the
+ * same as tcp_recv. Data records can be read this way as well.
+ */
+ssize_t ktls_recv_record(struct tcp_conn *c, uint8_t *type, void *buf, size_t nbyte);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <channel/cc_channel.h>
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * A notification channel, for waking up the event loop of another thread.
+ *
+ * It carries no data, only "something happened": notify_send can be called
+ * from any thread, and makes notify_read_id readable until the owner calls
+ * notify_recv. Sends in between are coalesced into one wakeup and cost no
+ * syscall, so a busy producer never fills up a buffer the way a pipe_conn
+ * doorbell does. Register the read id with event_add_read like any other fd.
+ *
+ * Producers should publish their work before notify_send, and the owner should
+ * look for work after notify_recv, otherwise a wakeup can be missed.
+ *
+ * On Linux this is an eventfd, one fd; elsewhere it falls back to a pipe.
+ */
+
+/*          name                    type            description */
+#define NOTIFY_METRIC(ACTION)                                                       \
+    ACTION( notify_conn_create,     METRIC_COUNTER, "# notify conn created"        )\
+    ACTION( notify_conn_create_ex,  METRIC_COUNTER, "# notify conn create ex"      )\
+    ACTION( notify_conn_destroy,    METRIC_COUNTER, "# notify conn destroyed"      )\
+    ACTION( notify_conn_curr,       METRIC_GAUGE,   "# notify conn allocated"      )\
+    ACTION( notify_open,            METRIC_COUNTER, "# notify conn opened"         )\
+    ACTION( notify_open_ex,         METRIC_COUNTER, "# notify open exceptions"     )\
+    ACTION( notify_close,           METRIC_COUNTER, "# notify conn closed"         )\
+    ACTION( notify_send,            METRIC_COUNTER, "# notifications sent"         )\
+    ACTION( notify_send_coalesce,   METRIC_COUNTER, "# sends merged into another"  )\
+    ACTION( notify_send_ex,         METRIC_COUNTER, "# send exceptions"            )\
+    ACTION( notify_recv,            METRIC_COUNTER, "# wakeups received"           )\
+    ACTION( notify_recv_ex,         METRIC_COUNTER, "# recv exceptions"            )
+
+typedef struct {
+    NOTIFY_METRIC(METRIC_DECLARE)
+} notify_metrics_st;
+
+struct notify_conn {
+    int         fd[2];      /* read and write end, the same fd for eventfd */
+    bool        pending;    /* sent and not yet received, atomic */
+
+    unsigned    state:4;    /* channel state */
+
+    err_i       err;        /* errno */
+};
+
+void notify_setup(notify_metrics_st *metrics);
+void notify_teardown(void);
+
+/* creation/destruction */
+struct notify_conn *notify_conn_create(void);
+void notify_conn_destroy(struct notify_conn **c);
+
+void notify_conn_reset(struct notify_conn *c);
+
+/* both ends are nonblocking */
+bool notify_open(struct notify_conn *c);
+void notify_close(struct notify_conn *c);
+
+/* thread-safe, return CC_OK if wakeup is (or already was) pending */
+rstatus_i notify_send(struct notify_conn *c);
+/* clear the wakeup: CC_OK if there was one, CC_EAGAIN if none */
+rstatus_i notify_recv(struct notify_conn *c);
+
+static inline ch_id_i notify_read_id(struct notify_conn *c)
+{
+    return c->fd[0];
+}
+
+#ifdef __cplusplus
+}
+#endif
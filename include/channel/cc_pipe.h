@@ -61,6 +61,9 @@ typedef struct {
     ACTION( pipe_send,           METRIC_COUNTER, "# send attempted"              )\
     ACTION( pipe_send_ex,        METRIC_COUNTER, "# send exceptions"             )\
     ACTION( pipe_send_byte,      METRIC_COUNTER, "# bytes sent"                  )\
+    ACTION( pipe_splice,         METRIC_COUNTER, "# splice/tee attempted"        )\
+    ACTION( pipe_splice_ex,      METRIC_COUNTER, "# splice/tee exceptions"       )\
+    ACTION( pipe_splice_byte,    METRIC_COUNTER, "# bytes spliced"               )\
     ACTION( pipe_flag_ex,        METRIC_COUNTER, "# pipe flag exceptions"        )
 
 typedef struct {
@@ -115,6 +118,31 @@ void pipe_close(struct pipe_conn *c);
 ssize_t pipe_recv(struct pipe_conn *c, void *buf, size_t nbyte);
 ssize_t pipe_send(struct pipe_conn *c, void *buf, size_t nbyte);
 
+/*
+ * zero-copy transfers, Linux only (CC_ERROR with err ENOSYS elsewhere). They
+ * return like pipe_recv/pipe_send: # bytes moved, 0 on EOF, CC_EAGAIN or
+ * CC_ERROR. Whether they block follows the flags of the pipe and of fd.
+ *
+ * pipe_splice_in moves up to nbyte from fd (e.g. a socket or file) into the
+ * pipe, pipe_splice_out moves up to nbyte buffered in the pipe to fd.
+ *
+ * pipe_vmsplice maps the pages of buf into the pipe instead of copying them,
+ * so buf must not be modified until the data has been read out of the pipe.
+ *
+ * pipe_tee duplicates up to nbyte buffered in src into dst without consuming
+ * it from src.
+ */
+ssize_t pipe_splice_in(struct pipe_conn *c, int fd, size_t nbyte);
+ssize_t pipe_splice_out(struct pipe_conn *c, int fd, size_t nbyte);
+ssize_t pipe_vmsplice(struct pipe_conn *c, void *buf, size_t nbyte);
+ssize_t pipe_tee(struct pipe_conn *src, struct pipe_conn *dst, size_t nbyte);
+
+/* # bytes written into the pipe and not yet read, if only c moved them */
+static inline size_t pipe_nbuffered(struct pipe_conn *c)
+{
+    return c->send_nbyte - c->recv_nbyte;
+}
+
 static inline ch_id_i pipe_read_id(struct pipe_conn *c)
 {
     return c->fd[0];
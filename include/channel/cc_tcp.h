@@ -28,6 +28,8 @@ extern "C" {
 #include <cc_queue.h>
 #include <cc_util.h>
 #include <channel/cc_channel.h>
+#include <channel/cc_pipe.h>
+#include <time/cc_timer.h>
 
 #include <stdbool.h>
 #include <sys/socket.h>
@@ -40,11 +42,31 @@ extern "C" {
 
 #define TCP_BACKLOG  128
 #define TCP_POOLSIZE 0 /* unlimited */
+#define TCP_POOLSLAB false /* see buf_poolslab in cc_buf.h */
+#define TCP_REUSEPORT false
+#define TCP_REUSEPORT_CPU false
+#define TCP_ZEROCOPY false
+#define TCP_ZEROCOPY_MIN (16 * KiB) /* smaller sends are cheaper to copy */
+#define TCP_CONN_STATS false
+#define TCP_BUSY_POLL 0 /* no busy polling */
+#define TCP_POOL_LOW 0
+#define TCP_POOL_HIGH 0 /* unlimited, see cc_pool.h for both */
 
-/*          name            type                default         description */
-#define TCP_OPTION(ACTION)                                                                \
-    ACTION( tcp_backlog,    OPTION_TYPE_UINT,   TCP_BACKLOG,    "tcp conn backlog limit" )\
-    ACTION( tcp_poolsize,   OPTION_TYPE_UINT,   TCP_POOLSIZE,   "tcp conn pool size"     )
+#define TCP_ACCEPT_NBATCH 64 /* # sockets accepted before borrowing tcp_conn */
+
+/*          name                type                default             description */
+#define TCP_OPTION(ACTION)                                                                                      \
+    ACTION( tcp_backlog,        OPTION_TYPE_UINT,   TCP_BACKLOG,        "tcp conn backlog limit"                )\
+    ACTION( tcp_poolsize,       OPTION_TYPE_UINT,   TCP_POOLSIZE,       "tcp conn pool size"                    )\
+    ACTION( tcp_poolslab,       OPTION_TYPE_BOOL,   TCP_POOLSLAB,       "prealloc pool in one mmap"             )\
+    ACTION( tcp_reuseport,      OPTION_TYPE_BOOL,   TCP_REUSEPORT,      "listen with SO_REUSEPORT"              )\
+    ACTION( tcp_reuseport_cpu,  OPTION_TYPE_BOOL,   TCP_REUSEPORT_CPU,  "steer conns to listener of their cpu"  )\
+    ACTION( tcp_zerocopy,       OPTION_TYPE_BOOL,   TCP_ZEROCOPY,       "use MSG_ZEROCOPY for large sends"      )\
+    ACTION( tcp_zerocopy_min,   OPTION_TYPE_UINT,   TCP_ZEROCOPY_MIN,   "min send size to use zerocopy"         )\
+    ACTION( tcp_conn_stats,     OPTION_TYPE_BOOL,   TCP_CONN_STATS,     "keep per-conn stats, list live conns"  )\
+    ACTION( tcp_busy_poll,      OPTION_TYPE_UINT,   TCP_BUSY_POLL,      "SO_BUSY_POLL usec on conns, 0: off"    )\
+    ACTION( tcp_pool_low,       OPTION_TYPE_UINT,   TCP_POOL_LOW,       "free tcp conns kept by trim"           )\
+    ACTION( tcp_pool_high,      OPTION_TYPE_UINT,   TCP_POOL_HIGH,      "max free tcp conns kept"               )
 
 typedef struct {
     TCP_OPTION(OPTION_DECLARE)
@@ -72,26 +94,58 @@ typedef struct {
     ACTION( tcp_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
     ACTION( tcp_send,           METRIC_COUNTER, "# send attempted"             )\
     ACTION( tcp_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
-    ACTION( tcp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )
+    ACTION( tcp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )\
+    ACTION( tcp_send_zc,        METRIC_COUNTER, "# zerocopy send attempted"    )\
+    ACTION( tcp_send_zc_done,   METRIC_COUNTER, "# zerocopy send completed"    )\
+    ACTION( tcp_send_zc_copy,   METRIC_COUNTER, "# zerocopy send copied"       )\
+    ACTION( tcp_conn_trim,      METRIC_COUNTER, "# free tcp conn trimmed"      )
 
 typedef struct {
     TCP_METRIC(METRIC_DECLARE)
 } tcp_metrics_st;
 
-struct tcp_conn {
-    STAILQ_ENTRY(tcp_conn)  next;           /* for conn pool */
-    bool                    free;           /* in use? */
+/*
+ * per-connection stats, kept with option tcp_conn_stats and reset along with
+ * the conn. These are plain increments on fields the IO path touches anyway,
+ * and the activity timestamp is the cached now when timer_cache is on, so
+ * they are cheap enough to leave on.
+ */
+struct tcp_conn_stats {
+    uint64_t                nrecv;          /* # recv syscalls */
+    uint64_t                nsend;          /* # send syscalls */
+    uint64_t                nagain;         /* # recv/send that got EAGAIN */
+    uint64_t                npartial;       /* # sends that took less */
+    struct timeout          active;         /* data last moved (or reset) */
+};
 
-    ch_level_e              level;          /* meta or base */
-    int                     sd;             /* socket descriptor */
+struct tcp_zc_linger;
 
+/*
+ * What recv/send touch comes first, within the first cache line; state and
+ * flags are plain integers rather than bitfields so setting one is a store,
+ * not a read-modify-write of the word the other shares. Pool and list linkage
+ * and the stats, if kept, go after. Slab pools place conns on cache line
+ * boundaries.
+ */
+struct tcp_conn {
+    int                     sd;             /* socket descriptor */
+    uint8_t                 state;          /* channel state */
+    bool                    zerocopy;       /* SO_ZEROCOPY enabled? */
+    uint16_t                flags;          /* annotation fields */
+    err_i                   err;            /* errno */
+    uint32_t                zc_sent;        /* # zerocopy sends issued */
     size_t                  recv_nbyte;     /* received (read) bytes */
     size_t                  send_nbyte;     /* sent (written) bytes */
+    uint32_t                zc_done;        /* # zerocopy sends completed */
+    ch_level_e              level;          /* meta or base */
+    bool                    free;           /* in use? */
+    bool                    tracked;
+    struct tcp_zc_linger    *zc_linger;     /* zerocopy sends left at close */
 
-    unsigned                state:4;        /* channel state */
-    unsigned                flags:12;       /* annotation fields */
+    STAILQ_ENTRY(tcp_conn)  next;           /* for conn pool */
+    TAILQ_ENTRY(tcp_conn)   live;           /* on the live list if tracked */
 
-    err_i                   err;            /* errno */
+    struct tcp_conn_stats   stats;
 };
 
 STAILQ_HEAD(tcp_conn_sqh, tcp_conn); /* corresponding header type for the STAILQ */
@@ -107,6 +161,23 @@ void tcp_conn_destroy(struct tcp_conn **c); /* channel_put_fn, with deallocation
 
 struct tcp_conn *tcp_conn_borrow(void);     /* channel_get_fn, with resource pool */
 void tcp_conn_return(struct tcp_conn **c);  /* channel_put_fn, with resource pool */
+/* destroy free conns idle since the last call, a timeout_cb_fn like buf_trim */
+void tcp_conn_trim(void *arg);
+
+/*
+ * with tcp_conn_stats on, call fn on each conn created and not sitting free in
+ * the pool. fn may close and return or destroy the conn it is given, but no
+ * other one. The conn of a buf_sock is listed even while the buf_sock is in
+ * its pool; buf_sock_foreach lists buf_socks in use.
+ */
+typedef void (*tcp_conn_each_fn)(struct tcp_conn *c, void *arg);
+void tcp_conn_foreach(tcp_conn_each_fn fn, void *arg);
+
+/* ms since data last moved on c, or since it was reset */
+static inline int64_t tcp_conn_idle_ms(struct tcp_conn *c)
+{
+    return -timeout_ms(&c->stats.active);
+}
 
 static inline ch_id_i tcp_read_id(struct tcp_conn *c)
 {
@@ -121,13 +192,81 @@ static inline ch_id_i tcp_write_id(struct tcp_conn *c)
 /* basic channel maintenance */
 bool tcp_connect(struct addrinfo *ai, struct tcp_conn *c);  /* channel_open_fn, client */
 bool tcp_listen(struct addrinfo *ai, struct tcp_conn *c);   /* channel_open_fn, server */
+/*
+ * create n listeners on the same address with SO_REUSEPORT, so each worker
+ * can accept on its own socket. With tcp_reuseport_cpu, connections are
+ * steered to c[cpu % n], where cpu is the one that received the connection.
+ */
+bool tcp_listen_n(struct addrinfo *ai, struct tcp_conn **c, uint32_t n);
 void tcp_close(struct tcp_conn *c);                         /* channel_perm_fn */
 ssize_t tcp_recv(struct tcp_conn *c, void *buf, size_t nbyte); /* channel_recv_fn */
 ssize_t tcp_send(struct tcp_conn *c, void *buf, size_t nbyte); /* channel_send_fn */
 ssize_t tcp_recvv(struct tcp_conn *c, struct array *bufv, size_t nbyte);
 ssize_t tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte);
 
+/*
+ * zerocopy send: on a conn with zerocopy enabled (option tcp_zerocopy), sends
+ * of at least tcp_zerocopy_min bytes use MSG_ZEROCOPY, and the kernel keeps
+ * referencing buf after tcp_send_zc returns. The caller must not modify or
+ * free that memory until tcp_zerocopy_reap reports no pending sends. Anything
+ * else falls back to tcp_send.
+ *
+ * Completions are delivered on the socket error queue, which makes the event
+ * loop report EVENT_ERR; call tcp_zerocopy_reap before treating it as fatal.
+ */
+ssize_t tcp_send_zc(struct tcp_conn *c, void *buf, size_t nbyte);
+/*
+ * reap zerocopy completions without blocking, return # sends still pending on
+ * c; completions of closed conns and released memory (see below) are reaped as
+ * well, and with c NULL only those, returning how many of them are pending
+ */
+uint32_t tcp_zerocopy_reap(struct tcp_conn *c);
+
+static inline uint32_t tcp_zerocopy_pending(struct tcp_conn *c)
+{
+    return c->zc_sent - c->zc_done;
+}
+
+/* does memory sent with tcp_send_zc on c have to stay put? */
+static inline bool tcp_zerocopy_pinned(struct tcp_conn *c)
+{
+    return tcp_zerocopy_pending(c) > 0 || c->zc_linger != NULL;
+}
+
+/*
+ * Hand over memory pending zerocopy sends of c still read from, to be given
+ * back with release(data) once they complete (right away if they have). A
+ * conn closed with sends pending keeps its socket open, shut down, until then;
+ * an open conn stops using zerocopy. Either way c can be reset or reused.
+ */
+typedef void (*tcp_zc_release_fn)(void *data);
+void tcp_zerocopy_release(struct tcp_conn *c, tcp_zc_release_fn release,
+        void *data);
+
+/*
+ * zero-copy transfer between a socket and a pipe, with splice(2) on Linux.
+ * tcp_recv_pipe moves up to nbyte received on c into p, tcp_send_pipe sends
+ * up to nbyte buffered in p on c. Return values are the same as tcp_recv and
+ * tcp_send; these count toward both the tcp and the pipe metrics.
+ */
+ssize_t tcp_recv_pipe(struct tcp_conn *c, struct pipe_conn *p, size_t nbyte);
+ssize_t tcp_send_pipe(struct tcp_conn *c, struct pipe_conn *p, size_t nbyte);
+/*
+ * forward up to nbyte from src to dst through p without copying to user
+ * space, return # bytes sent on dst. Whatever dst does not take stays in p and
+ * goes out first on the next call, so p must be dedicated to this pair. Return
+ * 0 once src is at EOF and p is drained, CC_EAGAIN if nothing could move.
+ */
+ssize_t tcp_proxy(struct tcp_conn *src, struct tcp_conn *dst,
+        struct pipe_conn *p, size_t nbyte);
+
 bool tcp_accept(struct tcp_conn *sc, struct tcp_conn *c);   /* channel_accept_fn */
+/*
+ * accept up to n pending connections on sc into tcp_conn borrowed from the
+ * pool and stored in c[]; return # accepted. Connections that cannot get a
+ * tcp_conn are closed.
+ */
+uint32_t tcp_accept_batch(struct tcp_conn *sc, struct tcp_conn **c, uint32_t n);
 void tcp_reject(struct tcp_conn *sc);                       /* channel_reject_fn */
 void tcp_reject_all(struct tcp_conn *sc);                   /* channel_reject_fn */
 
@@ -135,7 +274,12 @@ void tcp_reject_all(struct tcp_conn *sc);                   /* channel_reject_fn
 int tcp_set_blocking(int sd);
 int tcp_set_nonblocking(int sd);
 int tcp_set_reuseaddr(int sd);
+int tcp_set_reuseport(int sd);
+int tcp_set_reuseport_cpu(int sd, uint32_t n);
+int tcp_set_zerocopy(int sd);
 int tcp_set_tcpnodelay(int sd);
+/* busy poll the device queue for up to usec when a read finds nothing */
+int tcp_set_busy_poll(int sd, uint32_t usec);
 int tcp_set_keepalive(int sd);
 int tcp_set_linger(int sd, int timeout);
 int tcp_unset_linger(int sd);
@@ -143,6 +287,7 @@ int tcp_set_sndbuf(int sd, int size);
 int tcp_set_rcvbuf(int sd, int size);
 int tcp_get_sndbuf(int sd);
 int tcp_get_rcvbuf(int sd);
+int tcp_get_nread(int sd); /* # bytes ready to be read */
 int tcp_get_soerror(int sd);
 void tcp_maximize_sndbuf(int sd);
 
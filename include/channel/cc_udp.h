@@ -0,0 +1,152 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <buffer/cc_buf.h>
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <channel/cc_channel.h>
+
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * This implements a datagram channel over UDP.
+ *
+ * Besides single datagram recv/send, which fit the channel interface for
+ * connected sockets, datagrams can be moved in batches of up to UDP_BATCH_MAX
+ * per syscall (recvmmsg/sendmmsg on Linux, a loop elsewhere), each into or out
+ * of its own buf, e.g. borrowed from the buf pool.
+ *
+ * On Linux, udp_send_gso hands the kernel one buffer to be cut into equally
+ * sized datagrams (UDP_SEGMENT), and with udp_gro a recv may return several
+ * datagrams from the same peer coalesced into one buf, with udp_msg.segsize
+ * telling where to cut them apart again.
+ */
+
+#define UDP_BATCH_MAX   64      /* max # datagrams per batched syscall */
+#define UDP_GSO_MAX     64      /* max # segments per udp_send_gso */
+#define UDP_GRO_DEFAULT false   /* not UDP_GRO, the sockopt of netinet/udp.h */
+
+/*          name            type                default          description */
+#define UDP_OPTION(ACTION)                                                               \
+    ACTION( udp_gro,        OPTION_TYPE_BOOL,   UDP_GRO_DEFAULT, "coalesce recv with GRO" )
+
+typedef struct {
+    UDP_OPTION(OPTION_DECLARE)
+} udp_options_st;
+
+/*          name                type            description */
+#define UDP_METRIC(ACTION)                                                      \
+    ACTION( udp_conn_create,    METRIC_COUNTER, "# udp conn created"           )\
+    ACTION( udp_conn_create_ex, METRIC_COUNTER, "# udp conn create exceptions" )\
+    ACTION( udp_conn_destroy,   METRIC_COUNTER, "# udp conn destroyed"         )\
+    ACTION( udp_conn_curr,      METRIC_GAUGE,   "# udp conn allocated"         )\
+    ACTION( udp_open,           METRIC_COUNTER, "# udp sockets opened"         )\
+    ACTION( udp_open_ex,        METRIC_COUNTER, "# udp open exceptions"        )\
+    ACTION( udp_close,          METRIC_COUNTER, "# udp sockets closed"         )\
+    ACTION( udp_recv,           METRIC_COUNTER, "# recv syscalls"              )\
+    ACTION( udp_recv_ex,        METRIC_COUNTER, "# recv exceptions"            )\
+    ACTION( udp_recv_dgram,     METRIC_COUNTER, "# datagrams received"         )\
+    ACTION( udp_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
+    ACTION( udp_recv_trunc,     METRIC_COUNTER, "# datagrams truncated"        )\
+    ACTION( udp_send,           METRIC_COUNTER, "# send syscalls"              )\
+    ACTION( udp_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
+    ACTION( udp_send_dgram,     METRIC_COUNTER, "# datagrams sent"             )\
+    ACTION( udp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )
+
+typedef struct {
+    UDP_METRIC(METRIC_DECLARE)
+} udp_metrics_st;
+
+struct udp_conn {
+    int                     sd;             /* socket descriptor */
+
+    size_t                  recv_nbyte;     /* received (read) bytes */
+    size_t                  send_nbyte;     /* sent (written) bytes */
+
+    unsigned                state:4;        /* channel state */
+    unsigned                flags:12;       /* annotation fields */
+
+    bool                    gro;            /* UDP_GRO enabled? */
+
+    err_i                   err;            /* errno */
+};
+
+/* one datagram in a batch */
+struct udp_msg {
+    struct buf              *buf;       /* recv: appended at wpos, send: from rpos */
+    struct sockaddr_storage addr;       /* peer */
+    socklen_t               addrlen;    /* send: 0 to use the connected peer */
+    uint16_t                segsize;    /* recv: GRO segment size, 0 if none */
+    bool                    trunc;      /* recv: datagram did not fit buf */
+};
+
+void udp_setup(udp_options_st *options, udp_metrics_st *metrics);
+void udp_teardown(void);
+
+void udp_conn_reset(struct udp_conn *c);
+
+struct udp_conn *udp_conn_create(void);     /* channel_get_fn */
+void udp_conn_destroy(struct udp_conn **c); /* channel_put_fn */
+
+static inline ch_id_i udp_read_id(struct udp_conn *c)
+{
+    return c->sd;
+}
+
+static inline ch_id_i udp_write_id(struct udp_conn *c)
+{
+    return c->sd;
+}
+
+/* socket bound to ai, to receive from/reply to anyone */
+bool udp_bind(struct addrinfo *ai, struct udp_conn *c);      /* channel_open_fn, server */
+/* socket connected to ai, to send to/receive from that peer only */
+bool udp_connect(struct addrinfo *ai, struct udp_conn *c);   /* channel_open_fn, client */
+void udp_close(struct udp_conn *c);                          /* channel_term_fn */
+
+/* one datagram on a connected socket; excess bytes of a datagram are lost */
+ssize_t udp_recv(struct udp_conn *c, void *buf, size_t nbyte); /* channel_recv_fn */
+ssize_t udp_send(struct udp_conn *c, void *buf, size_t nbyte); /* channel_send_fn */
+
+/*
+ * receive up to n (at most UDP_BATCH_MAX) datagrams into msg[], send up to n
+ * datagrams from msg[], return # datagrams moved, CC_EAGAIN or CC_ERROR.
+ * Every msg[i].buf must have room to write/data to read.
+ */
+int udp_recv_batch(struct udp_conn *c, struct udp_msg *msg, uint32_t n);
+int udp_send_batch(struct udp_conn *c, struct udp_msg *msg, uint32_t n);
+
+/*
+ * send the data in msg->buf as datagrams of segsize bytes (the last one may be
+ * shorter), at most UDP_GSO_MAX of them, with a single syscall where the
+ * kernel supports it. Return # bytes sent, CC_EAGAIN or CC_ERROR.
+ */
+ssize_t udp_send_gso(struct udp_conn *c, struct udp_msg *msg, uint16_t segsize);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,154 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <cc_queue.h>
+#include <channel/cc_channel.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * This implements the channel interface for Unix domain (stream) sockets.
+ *
+ * The address passed to uds_listen/uds_connect is the socket path as a
+ * `const char *'. Besides bytes, a connection can carry file descriptors
+ * (SCM_RIGHTS), e.g. to hand listening or accepted sockets to a new process
+ * during a hot restart.
+ */
+
+#define UDS_BACKLOG  128
+#define UDS_POOLSIZE 0 /* unlimited */
+#define UDS_NFD_MAX  16 /* max # fds passed with one message */
+
+/*          name                type                default         description */
+#define UDS_OPTION(ACTION)                                                                  \
+    ACTION( uds_backlog,        OPTION_TYPE_UINT,   UDS_BACKLOG,    "uds conn backlog limit" )\
+    ACTION( uds_poolsize,       OPTION_TYPE_UINT,   UDS_POOLSIZE,   "uds conn pool size"     )
+
+typedef struct {
+    UDS_OPTION(OPTION_DECLARE)
+} uds_options_st;
+
+/*          name                type            description */
+#define UDS_METRIC(ACTION)                                                      \
+    ACTION( uds_conn_create,    METRIC_COUNTER, "# uds connections created"    )\
+    ACTION( uds_conn_create_ex, METRIC_COUNTER, "# uds conn create exceptions" )\
+    ACTION( uds_conn_destroy,   METRIC_COUNTER, "# uds connections destroyed"  )\
+    ACTION( uds_conn_curr,      METRIC_GAUGE,   "# uds conn allocated"         )\
+    ACTION( uds_conn_borrow,    METRIC_COUNTER, "# uds connections borrowed"   )\
+    ACTION( uds_conn_borrow_ex, METRIC_COUNTER, "# uds conn borrow exceptions" )\
+    ACTION( uds_conn_return,    METRIC_COUNTER, "# uds connections returned"   )\
+    ACTION( uds_conn_active,    METRIC_GAUGE,   "# uds conn being borrowed"    )\
+    ACTION( uds_accept,         METRIC_COUNTER, "# uds connection accepts"     )\
+    ACTION( uds_accept_ex,      METRIC_COUNTER, "# uds accept exceptions"      )\
+    ACTION( uds_reject,         METRIC_COUNTER, "# uds connection rejects"     )\
+    ACTION( uds_reject_ex,      METRIC_COUNTER, "# uds reject exceptions"      )\
+    ACTION( uds_connect,        METRIC_COUNTER, "# uds connects made"          )\
+    ACTION( uds_connect_ex,     METRIC_COUNTER, "# uds connect exceptions"     )\
+    ACTION( uds_close,          METRIC_COUNTER, "# uds connection closed"      )\
+    ACTION( uds_recv,           METRIC_COUNTER, "# recv attempted"             )\
+    ACTION( uds_recv_ex,        METRIC_COUNTER, "# recv exceptions"            )\
+    ACTION( uds_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
+    ACTION( uds_recv_fd,        METRIC_COUNTER, "# fds received"               )\
+    ACTION( uds_send,           METRIC_COUNTER, "# send attempted"             )\
+    ACTION( uds_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
+    ACTION( uds_send_byte,      METRIC_COUNTER, "# bytes sent"                 )\
+    ACTION( uds_send_fd,        METRIC_COUNTER, "# fds sent"                   )
+
+typedef struct {
+    UDS_METRIC(METRIC_DECLARE)
+} uds_metrics_st;
+
+struct uds_conn {
+    STAILQ_ENTRY(uds_conn)  next;           /* for conn pool */
+    bool                    free;           /* in use? */
+
+    ch_level_e              level;          /* meta or base */
+    int                     sd;             /* socket descriptor */
+
+    size_t                  recv_nbyte;     /* received (read) bytes */
+    size_t                  send_nbyte;     /* sent (written) bytes */
+
+    unsigned                state:4;        /* channel state */
+    unsigned                flags:12;       /* annotation fields */
+
+    err_i                   err;            /* errno */
+};
+
+STAILQ_HEAD(uds_conn_sqh, uds_conn); /* corresponding header type for the STAILQ */
+
+void uds_setup(uds_options_st *options, uds_metrics_st *metrics);
+void uds_teardown(void);
+
+void uds_conn_reset(struct uds_conn *c);
+
+/* resource management */
+struct uds_conn *uds_conn_create(void);     /* channel_get_fn, with allocation */
+void uds_conn_destroy(struct uds_conn **c); /* channel_put_fn, with deallocation  */
+
+struct uds_conn *uds_conn_borrow(void);     /* channel_get_fn, with resource pool */
+void uds_conn_return(struct uds_conn **c);  /* channel_put_fn, with resource pool */
+
+static inline ch_id_i uds_read_id(struct uds_conn *c)
+{
+    return c->sd;
+}
+
+static inline ch_id_i uds_write_id(struct uds_conn *c)
+{
+    return c->sd;
+}
+
+/* basic channel maintenance */
+bool uds_connect(const char *path, struct uds_conn *c); /* channel_open_fn, client */
+/* a stale socket file at path is replaced, any other file is an error */
+bool uds_listen(const char *path, struct uds_conn *c);  /* channel_open_fn, server */
+void uds_close(struct uds_conn *c);                     /* channel_term_fn */
+ssize_t uds_recv(struct uds_conn *c, void *buf, size_t nbyte); /* channel_recv_fn */
+ssize_t uds_send(struct uds_conn *c, void *buf, size_t nbyte); /* channel_send_fn */
+
+/*
+ * send nbyte (at least 1) from buf along with nfd (at most UDS_NFD_MAX) fds;
+ * the fds arrive with the first byte of buf and stay open on this side.
+ * Returns like uds_send.
+ */
+ssize_t uds_sendfd(struct uds_conn *c, void *buf, size_t nbyte, const int *fd,
+        uint32_t nfd);
+/*
+ * receive like uds_recv, and any fds that came along into fd[]: *nfd is its
+ * capacity on the way in and the # fds received on the way out. Received fds
+ * are close-on-exec, those that do not fit are closed.
+ */
+ssize_t uds_recvfd(struct uds_conn *c, void *buf, size_t nbyte, int *fd,
+        uint32_t *nfd);
+
+bool uds_accept(struct uds_conn *sc, struct uds_conn *c);   /* channel_accept_fn */
+void uds_reject(struct uds_conn *sc);                       /* channel_reject_fn */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,84 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A common interface over the hash functions in ccommon, so that consumers
+ * take a hash_fn (or a hash_type_e from their config) instead of hardcoding
+ * one. Every function hashes len bytes at key with the given seed into 64 bits.
+ *
+ * - murmur3: the low 64 bits of hash_murmur3_128_x64, seeded with the low 32
+ *            bits of seed
+ * - xxh64:   XXH64 from xxHash, fast across all key lengths
+ * - wyhash:  wyhash (final version 4), fastest on short keys
+ * - crc32c:  CRC-32C (Castagnoli), using the SSE4.2 or ARMv8 CRC instructions
+ *            when the CPU has them; only the low 32 bits are set, and it is a
+ *            checksum rather than a well-mixed hash, fine for hash tables that
+ *            mask off low bits
+ */
+typedef uint64_t (*hash_fn)(const void *key, size_t len, uint64_t seed);
+
+typedef enum hash_type {
+    HASH_MURMUR3,
+    HASH_XXH64,
+    HASH_WYHASH,
+    HASH_CRC32C,
+    HASH_SENTINEL
+} hash_type_e;
+
+uint64_t hash_murmur3_64(const void *key, size_t len, uint64_t seed);
+uint64_t hash_xxh64(const void *key, size_t len, uint64_t seed);
+uint64_t hash_wyhash(const void *key, size_t len, uint64_t seed);
+uint64_t hash_crc32c(const void *key, size_t len, uint64_t seed);
+
+/* the hash function of a type, NULL if type is out of range */
+hash_fn hash_get(hash_type_e type);
+/* look up a type by its name above, HASH_SENTINEL if not found */
+hash_type_e hash_type(const char *name);
+const char *hash_name(hash_type_e type);
+
+/**
+ * Hash n keys of lens[i] bytes at keys[i] into out[i], giving the same digests
+ * as calling the hash of type on each key in turn. wyhash (for keys of up to 16
+ * bytes) and crc32c work on HASH_BATCH_LANES keys at a time with their
+ * dependency chains interleaved, which lets the CPU overlap the otherwise
+ * serial multiplications or crc32 instructions; the other types loop.
+ */
+#define HASH_BATCH_LANES 4
+
+void hash_batch(hash_type_e type, const void *const *keys, const size_t *lens,
+        size_t n, uint64_t seed, uint64_t *out);
+void hash_wyhash_batch(const void *const *keys, const size_t *lens, size_t n,
+        uint64_t seed, uint64_t *out);
+void hash_crc32c_batch(const void *const *keys, const size_t *lens, size_t n,
+        uint64_t seed, uint64_t *out);
+
+/* whether hash_crc32c runs on CRC instructions on this CPU */
+bool hash_crc32c_hw(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,7 +24,10 @@
  * keyword to local-scope functions according to C language spec (original code is
  * in C++), to better fit them into the scope and style of ccommon
  *
- * The actual implementation is untouched.
+ * The actual implementation is untouched. The streaming (init/update/final)
+ * variants are additions: they buffer at most one partial block, and give the
+ * same digests as the one-shot functions over the concatenated input, so keys
+ * split across buffers can be hashed in place.
  */
 
 #pragma once
@@ -33,6 +36,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -42,6 +46,42 @@ void hash_murmur3_128_x86(const void *key, int len, uint32_t seed, void *out);
 
 void hash_murmur3_128_x64(const void *key, int len, uint32_t seed, void *out);
 
+struct murmur3_32_state {
+    uint32_t h[1];
+    uint64_t len;
+    uint8_t  tail[4];
+    uint8_t  ntail;
+};
+
+struct murmur3_128_x86_state {
+    uint32_t h[4];
+    uint64_t len;
+    uint8_t  tail[16];
+    uint8_t  ntail;
+};
+
+struct murmur3_128_x64_state {
+    uint64_t h[2];
+    uint64_t len;
+    uint8_t  tail[16];
+    uint8_t  ntail;
+};
+
+void hash_murmur3_32_init(struct murmur3_32_state *st, uint32_t seed);
+void hash_murmur3_32_update(struct murmur3_32_state *st, const void *key,
+        size_t len);
+void hash_murmur3_32_final(struct murmur3_32_state *st, void *out);
+
+void hash_murmur3_128_x86_init(struct murmur3_128_x86_state *st, uint32_t seed);
+void hash_murmur3_128_x86_update(struct murmur3_128_x86_state *st,
+        const void *key, size_t len);
+void hash_murmur3_128_x86_final(struct murmur3_128_x86_state *st, void *out);
+
+void hash_murmur3_128_x64_init(struct murmur3_128_x64_state *st, uint32_t seed);
+void hash_murmur3_128_x64_update(struct murmur3_128_x64_state *st,
+        const void *key, size_t len);
+void hash_murmur3_128_x64_final(struct murmur3_128_x64_state *st, void *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,83 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+/**
+ * Framing for stream input: a frame_reader finds complete frames in a buf
+ * (or the rbuf and rchain of a buf_sock) and hands them out as bstrings that
+ * point into the buf, without copying. Frames are either terminated by a
+ * delimiter of up to FRAME_DELIM_MAX bytes (e.g. CRLF), or preceded by a
+ * 1, 2 or 4-byte big-endian length; the delimiter or prefix is not part of
+ * the frame.
+ *
+ * A reader remembers how far it has scanned since the last frame, so bytes
+ * are only looked at once however many partial reads a frame takes to
+ * arrive. The delimiter is searched for with bstring_find, which libc
+ * vectorizes. The reader must be reset (frame_reader_reset) if data is
+ * consumed from the buf other than through it.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <buffer/cc_buf.h>
+#include <cc_bstring.h>
+#include <cc_define.h>
+#include <stream/cc_sockio.h>
+
+#include <stdint.h>
+
+#define FRAME_DELIM_MAX 8
+
+enum frame_type {
+    FRAME_DELIM,
+    FRAME_LENGTH
+};
+
+struct frame_reader {
+    uint8_t     type;       /* enum frame_type */
+    uint8_t     ndelim;     /* # bytes in delim */
+    uint8_t     nprefix;    /* # bytes of the length prefix */
+    char        delim[FRAME_DELIM_MAX];
+    uint32_t    max;        /* max frame size, 0 for no limit */
+    uint32_t    scanned;    /* bytes after rpos known not to end a frame */
+};
+
+void frame_reader_delim(struct frame_reader *fr, const char *delim, uint8_t ndelim, uint32_t max);
+void frame_reader_length(struct frame_reader *fr, uint8_t nprefix, uint32_t max);
+void frame_reader_reset(struct frame_reader *fr);
+
+/*
+ * CC_OK with the next frame in *frame and buf->rpos moved past it (and its
+ * delimiter); the data stays in place until the buf is shifted, reset or
+ * returned. CC_UNFIN if the frame is not complete yet, CC_ERROR if it is
+ * longer than max.
+ */
+rstatus_i frame_read(struct frame_reader *fr, struct buf *buf, struct bstring *frame);
+
+/*
+ * the same, over rbuf followed by rchain (see buf_sock_readv): frames within
+ * rbuf are handed out as they are, and only a frame reaching into rchain is
+ * moved into rbuf first, with buf_sock_coalesce (CC_ENOMEM if that fails).
+ * Frames are valid until the next read or frame_sock_read on s.
+ */
+rstatus_i frame_sock_read(struct frame_reader *fr, struct buf_sock *s, struct bstring *frame);
+
+#ifdef __cplusplus
+}
+#endif
@@ -38,8 +38,15 @@
  */
 
 
-/* NOTE(kyang): until we figure out a common conn interface, cc_sockio and buf_sock
-   will be for TCP connections only */
+/*
+ * A buf_sock owns a tcp_conn (ch), which it drives by default. Any other
+ * stream channel (e.g. a uds_conn or pipe_conn) can be driven instead with
+ * buf_sock_set_channel, through its channel_handler_st. A handler (hdl) is
+ * called for all I/O, on ch too if no other channel is set; only without one,
+ * or with a handler made of tcp_recv and tcp_send, tcp is called directly.
+ * The features only tcp has (vectored IO, zerocopy, completion-based IO) fall
+ * back to plain recv/send, or are not available, behind any other handler.
+ */
 
 #ifdef __cplusplus
 extern "C" {
@@ -47,6 +54,7 @@ extern "C" {
 
 #include <cc_stream.h>
 
+#include <buffer/cc_buf.h>
 #include <cc_define.h>
 #include <cc_metric.h>
 
@@ -54,10 +62,21 @@ extern "C" {
 #include <stdlib.h>
 
 #define BUFSOCK_POOLSIZE 0 /* unlimited */
+#define BUFSOCK_POOLSLAB false /* see buf_poolslab in cc_buf.h */
+#define BUFSOCK_LAZY false
+#define BUFSOCK_POOL_LOW 0
+#define BUFSOCK_POOL_HIGH 0 /* unlimited, see cc_pool.h for both */
+#define BUFSOCK_READV_NBUF 16 /* max # bufs filled by one readv */
+#define BUFSOCK_DEFER false
 
 /*          name                type                default             description */
-#define SOCKIO_OPTION(ACTION)                                                             \
-    ACTION( buf_sock_poolsize,  OPTION_TYPE_UINT,   BUFSOCK_POOLSIZE,   "buf_sock limit" )
+#define SOCKIO_OPTION(ACTION)                                                                           \
+    ACTION( buf_sock_poolsize,  OPTION_TYPE_UINT,   BUFSOCK_POOLSIZE,   "buf_sock limit"               )\
+    ACTION( buf_sock_poolslab,  OPTION_TYPE_BOOL,   BUFSOCK_POOLSLAB,   "prealloc pool in one mmap"    )\
+    ACTION( buf_sock_lazy,      OPTION_TYPE_BOOL,   BUFSOCK_LAZY,       "attach bufs only when needed" )\
+    ACTION( buf_sock_pool_low,  OPTION_TYPE_UINT,   BUFSOCK_POOL_LOW,   "free buf_sock kept by trim"   )\
+    ACTION( buf_sock_pool_high, OPTION_TYPE_UINT,   BUFSOCK_POOL_HIGH,  "max free buf_sock kept"       )\
+    ACTION( buf_sock_defer,     OPTION_TYPE_BOOL,   BUFSOCK_DEFER,      "defer writes to flush"        )
 
 typedef struct {
     SOCKIO_OPTION(OPTION_DECLARE)
@@ -72,29 +91,53 @@ typedef struct {
     ACTION( buf_sock_borrow,    METRIC_COUNTER, "# buf sock borrowed"          )\
     ACTION( buf_sock_borrow_ex, METRIC_COUNTER, "# buf sock borrow exceptions" )\
     ACTION( buf_sock_return,    METRIC_COUNTER, "# buf sock returned"          )\
-    ACTION( buf_sock_active,    METRIC_GAUGE,   "# buf sock being borrowed"    )
+    ACTION( buf_sock_active,    METRIC_GAUGE,   "# buf sock being borrowed"    )\
+    ACTION( buf_sock_attach,    METRIC_COUNTER, "# lazy buf attached"          )\
+    ACTION( buf_sock_attach_ex, METRIC_COUNTER, "# lazy buf attach exceptions" )\
+    ACTION( buf_sock_detach,    METRIC_COUNTER, "# lazy buf detached"          )\
+    ACTION( buf_sock_attached,  METRIC_GAUGE,   "# lazy buf attached now"      )\
+    ACTION( buf_sock_trim,      METRIC_COUNTER, "# free buf sock trimmed"      )\
+    ACTION( buf_sock_defer,     METRIC_COUNTER, "# writes deferred"            )\
+    ACTION( buf_sock_flush,     METRIC_COUNTER, "# deferred flushes sent"      )
 
 typedef struct {
     SOCKIO_METRIC(METRIC_DECLARE)
 } sockio_metrics_st;
 
+/*
+ * Fields read on every read/write come first and fill the first cache line
+ * on 64-bit platforms (wchain starts the second one); pool linkage and the
+ * fields of the application follow. Slab pools place buf_socks on cache line
+ * boundaries.
+ */
 struct buf_sock {
+    struct buf              *rbuf;
+    struct buf              *wbuf;
+    struct tcp_conn         *ch;    /* owned, driven unless chan is set */
+    channel_p               chan;   /* set by buf_sock_set_channel */
+    channel_handler_st      *hdl;   /* use can specify per-channel action */
+    struct buf_sqh          rchain; /* data received after rbuf, see below */
+    bool                    lazy;   /* rbuf/wbuf attached only when needed */
+    bool                    free;
+    bool                    tracked;
+    bool                    dirty;  /* waiting for buf_sock_flush */
+
+    struct buf_sqh          wchain; /* data queued after wbuf, see below */
+    TAILQ_ENTRY(buf_sock)   flush;  /* dirty buf_socks */
+
     /* these fields are useful for resource managmenet */
     STAILQ_ENTRY(buf_sock)  next;
     void                    *owner;
-    bool                    free;
+    TAILQ_ENTRY(buf_sock)   live;   /* every buf_sock created */
 
     uint64_t                flag;   /* generic flag field to be used by app */
     void                    *data;  /* generic data field to be used by app */
-    channel_handler_st       *hdl;   /* use can specify per-channel action */
-
-    struct tcp_conn         *ch;
-    struct buf              *rbuf;
-    struct buf              *wbuf;
 };
 
 STAILQ_HEAD(buf_sock_sqh, buf_sock); /* corresponding header type for the STAILQ */
 
+struct event_base;
+
 void sockio_setup(sockio_options_st *options, sockio_metrics_st *metrics);
 void sockio_teardown(void);
 
@@ -106,11 +149,114 @@ void buf_sock_return(struct buf_sock **);   /* stream_put_fn */
 
 void buf_sock_reset(struct buf_sock *);
 
+/* destroy free buf_socks idle since the last call, a timeout_cb_fn like buf_trim */
+void buf_sock_trim(void *arg);
+
+/*
+ * accounting: buf_sock_foreach calls fn on each buf_sock created and not
+ * sitting free in the pool; fn may return or destroy the one it is given, but
+ * no other. buf_sock_memory is what s holds in bufs (rbuf, wbuf and chains)
+ * plus itself and its tcp_conn, whose stats (tcp_conn_stats) tell how busy
+ * the conn is; together they show which conns hold memory.
+ */
+typedef void (*buf_sock_each_fn)(struct buf_sock *s, void *arg);
+void buf_sock_foreach(buf_sock_each_fn fn, void *arg);
+size_t buf_sock_memory(const struct buf_sock *s);
+
+/*
+ * lazy mode (option buf_sock_lazy): a buf_sock starts without rbuf and wbuf,
+ * and borrows them from the buf pool when there is something to read or
+ * write. Reads give rbuf back if nothing is left in it, writes give wbuf back
+ * once it is flushed. Code that touches rbuf/wbuf directly should get them
+ * through buf_sock_rbuf/buf_sock_wbuf (NULL on OOM), and may call
+ * buf_sock_release after consuming input to give drained bufs back early.
+ */
+struct buf *buf_sock_rbuf(struct buf_sock *);
+struct buf *buf_sock_wbuf(struct buf_sock *);
+void buf_sock_release(struct buf_sock *);
+
+/*
+ * drive ch, with hdl providing at least recv and send, instead of the owned
+ * tcp_conn; ch NULL goes back to the owned conn, through hdl if not NULL.
+ * Nothing is closed, ch stays owned by the caller and is not touched by
+ * reset/return.
+ */
+void buf_sock_set_channel(struct buf_sock *, channel_p ch, channel_handler_st *hdl);
+
+rstatus_i buf_sock_read(struct buf_sock *);
+rstatus_i buf_sock_send(struct buf_sock *);
+
+rstatus_i dbuf_sock_read(struct buf_sock *); /* buf_sock_read with
+                                                doubling buffer */
+
+/* the same as the buf_sock_* functions, named after the default channel */
 rstatus_i buf_tcp_read(struct buf_sock *);
 rstatus_i buf_tcp_write(struct buf_sock *);
+rstatus_i dbuf_tcp_read(struct buf_sock *);
+
+/*
+ * chained read path: buf_tcp_readv reads into the room left in rbuf and then
+ * into a chain of pooled bufs (rchain) with readv, until the socket is
+ * drained. Bufs are borrowed only once the room at hand fills up, as many as
+ * the bytes still queued need, up to BUFSOCK_READV_NBUF. Nothing already read
+ * is copied on the way. When the parser needs a contiguous span,
+ * buf_sock_coalesce moves the first count bytes (or all there is, if less)
+ * into rbuf, resizing rbuf as a dbuf if it is too small.
+ */
+rstatus_i buf_sock_readv(struct buf_sock *);
+rstatus_i buf_tcp_readv(struct buf_sock *);
+rstatus_i buf_sock_coalesce(struct buf_sock *, uint32_t);
+
+/*
+ * chained write path: instead of growing wbuf, data beyond its capacity goes
+ * into wchain, a chain of pooled bufs (see cc_buf.h). buf_sock_write appends
+ * to wbuf and then to wchain, and buf_tcp_writev flushes wbuf followed by
+ * wchain with a single tcp_sendv, returning bufs to the pool as they empty.
+ */
+uint32_t buf_sock_write(struct buf_sock *, char *, uint32_t);
+rstatus_i buf_sock_sendv(struct buf_sock *);
+rstatus_i buf_tcp_writev(struct buf_sock *);
+
+/*
+ * deferred flush: buf_sock_defer marks s dirty instead of sending, and
+ * buf_sock_flush sends wbuf and wchain of every dirty buf_sock with one
+ * buf_sock_sendv each, so responses to pipelined requests that are written
+ * during one event loop iteration go out with one syscall (and as few packets
+ * as they fit) instead of one each. Call it once the events returned by
+ * event_wait have been processed. With option buf_sock_defer, buf_tcp_write
+ * and buf_tcp_writev defer and return CC_OK rather than sending.
+ *
+ * buf_sock_flush returns the # buf_socks flushed, and calls fn (if not NULL)
+ * with the status of each one that did not go out completely (CC_EAGAIN,
+ * CC_ERETRY or CC_ERROR), which is no longer dirty by then and may be
+ * returned or destroyed by fn, e.g. to register for write events or close.
+ * Returning, resetting or destroying a dirty buf_sock drops it unsent.
+ */
+typedef void (*buf_sock_flush_fn)(struct buf_sock *s, rstatus_i status, void *arg);
+void buf_sock_defer(struct buf_sock *);
+uint32_t buf_sock_flush(buf_sock_flush_fn fn, void *arg);
 
-rstatus_i dbuf_tcp_read(struct buf_sock *); /* buf_tcp_read with
-                                               doubling buffer */
+/*
+ * with zerocopy enabled on the conn, buf_tcp_write may leave data that
+ * has been sent still referenced by the kernel. While this returns true, the
+ * wbuf must not be reset, shifted, resized or returned; appending data
+ * within its current capacity is fine. Returning, resetting or destroying the
+ * buf_sock itself is fine too: a pinned wbuf is kept out of the pool until
+ * tcp_zerocopy_reap sees the sends complete.
+ */
+bool buf_sock_wbuf_pinned(struct buf_sock *);
+
+/*
+ * completion-based IO, for event bases that support event_recv/event_send:
+ * submit posts a recv into rbuf (or a send from wbuf) with data set to the
+ * buf_sock; complete applies the result passed to the I/O callback, and
+ * returns what buf_tcp_read (or buf_tcp_write) would have for the same result.
+ * These are for the owned tcp_conn (or another tcp_conn) only.
+ */
+rstatus_i buf_tcp_read_submit(struct buf_sock *, struct event_base *);
+rstatus_i buf_tcp_read_complete(struct buf_sock *, int);
+rstatus_i buf_tcp_write_submit(struct buf_sock *, struct event_base *);
+rstatus_i buf_tcp_write_complete(struct buf_sock *, int);
 
 #ifdef __cplusplus
 }
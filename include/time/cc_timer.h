@@ -21,10 +21,43 @@
 extern "C" {
 #endif
 
+#include <cc_metric.h>
+#include <cc_option.h>
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
 
+/*
+ * Clock used for durations and timeouts on Linux: CLOCK_MONOTONIC_RAW by
+ * default, CLOCK_MONOTONIC, or CLOCK_MONOTONIC_COARSE which is much cheaper to
+ * read but only advances every jiffy (1-4ms).
+ *
+ * With timer_cache, timeouts on a thread are computed against a per-thread
+ * cached "now" that is refreshed each time event_wait returns (or whenever
+ * timer_cache_update is called), instead of reading the clock every time.
+ * This makes timeout_add_*, timeout_ns/us/ms/sec, timeout_expired and hence
+ * the timing wheel nearly free on the request path, at the cost of being as
+ * stale as the time spent since the last refresh. Threads that never refresh
+ * keep reading the clock, and so does every thread after timer_setup or
+ * timer_teardown until it refreshes again. Durations always read the clock.
+ */
+#define TIMER_CLOCK_RAW     0
+#define TIMER_CLOCK_MONO    1
+#define TIMER_CLOCK_COARSE  2
+
+#define TIMER_CLOCK TIMER_CLOCK_RAW
+#define TIMER_CACHE false
+
+/*          name            type                default         description */
+#define TIMER_OPTION(ACTION)                                                                    \
+    ACTION( timer_clock,    OPTION_TYPE_UINT,   TIMER_CLOCK,    "0: raw, 1: monotonic, 2: coarse"  )\
+    ACTION( timer_cache,    OPTION_TYPE_BOOL,   TIMER_CACHE,    "cache now once per event loop"    )
+
+typedef struct {
+    TIMER_OPTION(OPTION_DECLARE)
+} timer_options_st;
+
 struct duration;  /* data structure to measure duration */
 
 /* we declare duration and timeout in the header so static allocation is
@@ -99,6 +132,16 @@ double duration_us(struct duration *d);
 double duration_ms(struct duration *d);
 double duration_sec(struct duration *d);
 
+/* record a stopped duration, in nanoseconds, into a METRIC_HISTOGRAM */
+static inline void
+duration_record(struct duration *d, struct metric *m)
+{
+    metric_histogram_record(m, (uint64_t)duration_ns(d));
+}
+
+#define DURATION_RECORD(_base, _metric, _d)                 \
+    RECORD_VAL(_base, _metric, duration_ns(_d))
+
 
 /*
  * Not all possible granularity can be meaningfully used for sleep or event.
@@ -151,6 +194,12 @@ int64_t timeout_sec(struct timeout *e);
 void timeout_timespec(struct timespec *ts, struct timeout *e);
 bool timeout_expired(struct timeout *e);
 
+void timer_setup(timer_options_st *options);
+void timer_teardown(void);
+
+/* refresh the cached now of the calling thread, see timer_cache above */
+void timer_cache_update(void);
+
 /* Note(yao): The return type of duration and timeout are different when
  * querying for the same quantity (esentially intervals), this is because I
  * envision them to be used differently:
@@ -43,9 +43,13 @@ extern "C" {
     ACTION( timeout_event_return,   METRIC_COUNTER, "# timeout events returned"    )\
     ACTION( timing_wheel_insert,    METRIC_COUNTER, "# tevent insertions"          )\
     ACTION( timing_wheel_remove,    METRIC_COUNTER, "# tevent removal"             )\
+    ACTION( timing_wheel_reschedule,METRIC_COUNTER, "# tevents rescheduled/touched")\
+    ACTION( timing_wheel_post,      METRIC_COUNTER, "# requests from other threads")\
+    ACTION( timing_wheel_post_ex,   METRIC_COUNTER, "# posts failed or gone stale" )\
     ACTION( timing_wheel_event,     METRIC_GAUGE,   "# tevents in timing wheels"   )\
     ACTION( timing_wheel_process,   METRIC_COUNTER, "# tevents processed"          )\
     ACTION( timing_wheel_tick,      METRIC_COUNTER, "# ticks processed"            )\
+    ACTION( timing_wheel_cascade,   METRIC_COUNTER, "# tevents moved down a level" )\
     ACTION( timing_wheel_exec,      METRIC_COUNTER, "# timing wheel executions "   )
 
 typedef struct {
@@ -99,26 +103,58 @@ typedef void (*timeout_cb_fn)(void *); /* timeout callback */
  * properly clean up all resources tied to such events.
  */
 struct timeout_event;
+struct tevent_pool;
+struct tevent_mail;
+
+/**
+ * Each wheel owns the pool its timeout events come from, and is meant to be
+ * used by a single (owner) thread, so one wheel per worker thread needs no
+ * shared timer state. Other threads talk to a wheel via its mailbox: the
+ * timing_wheel_post_* functions push a request onto a lock-free list that the
+ * owner picks up at the beginning of timing_wheel_execute. A posted removal
+ * of an event that has since fired is dropped. Posting does not wake up the
+ * owner thread; if it may be blocked in event_wait, notify it separately.
+ */
+/**
+ * A wheel can have multiple levels of `cap' slots each: a slot on level 0
+ * covers one tick, a slot on level i covers cap^i ticks, so the wheel spans
+ * cap^nlevel ticks altogether. Timeouts are inserted into the lowest level
+ * that can hold them, and every time a level wraps around, the events in the
+ * next slot of the level above are cascaded down. Insert and remove stay O(1)
+ * and long timeouts are only looked at nlevel times instead of once per
+ * rotation of a much bigger single-level wheel.
+ *
+ * timing_wheel_create creates a single-level wheel.
+ */
+#define TIMING_WHEEL_NLEVEL_MAX 8
 
 struct timing_wheel {
     /* basic properties of the timing wheel */
     struct timeout      tick;       /* tick interval */
     size_t              cap;        /* capacity as # ticks in the time wheel */
     size_t              max_ntick;  /* max # ticks to cover in one execution */
+    size_t              nlevel;     /* # levels, each with cap slots */
     /* the following is used internally */
     uint64_t            tick_ns;    /* tick in nanoseconds */
+    uint64_t            span;       /* # ticks covered by all levels */
     /* state of the wheel */
     bool                active;     /* is the wheel supposed to be turning? */
     struct timeout      due;        /* next trigger time */
     size_t              curr;       /* index of current tick */
+    uint64_t            now;        /* absolute # of current tick */
     uint64_t            nevent;     /* # of timeout_event objects in wheel */
 
     struct tevent_tqh   *table;     /* an array of header each points to a list
                                      * of timeouts expiring in the same tick.
-                                     * table should contain exactly cap entries,
+                                     * table should contain exactly cap entries
+                                     * per level, level i starting at i * cap,
                                      * each corresponding to a TALQ for the
-                                     * corresponding tick
+                                     * corresponding tick (slot on level i)
                                      */
+    uint64_t            *bitmap;    /* non-empty slots, nword words per level */
+    size_t              nword;
+    struct tevent_pool  *pool;      /* timeout events owned by this wheel */
+    struct tevent_mail  *mailbox;   /* requests posted by other threads */
     /* some metrics of the most important aspects */
     uint64_t            nprocess;   /* total # timeout events processed */
     uint64_t            nexec;      /* total # executions */
@@ -126,14 +162,38 @@ struct timing_wheel {
 };
 
 struct timing_wheel *timing_wheel_create(struct timeout *tick, size_t cap, size_t ntick);
+struct timing_wheel *timing_wheel_create_levels(struct timeout *tick, size_t cap, size_t ntick, size_t nlevel);
 void timing_wheel_destroy(struct timing_wheel **tw);
 
 struct timeout_event * timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur, timeout_cb_fn cb, void *arg);
 void timing_wheel_remove(struct timing_wheel *tw, struct timeout_event **tev);
+/*
+ * Push back a pending timeout without giving up the event:
+ * - reschedule moves it to its new slot right away, with a new delay (which
+ *   is also the new period of a recurring event);
+ * - touch only restarts its delay from the current tick, and the event is
+ *   moved lazily once its old slot comes up, so it costs next to nothing for
+ *   timeouts that are reset on every request (e.g. idle timeouts). A touched
+ *   event may cause timing_wheel_next_ns to report an earlier wakeup.
+ */
+rstatus_i timing_wheel_reschedule(struct timing_wheel *tw, struct timeout_event *tev, struct timeout *delay);
+void timing_wheel_touch(struct timing_wheel *tw, struct timeout_event *tev);
+
+/* safe to call from any thread, see above */
+rstatus_i timing_wheel_post_insert(struct timing_wheel *tw, struct timeout *delay, bool recur, timeout_cb_fn cb, void *arg);
+rstatus_i timing_wheel_post_remove(struct timing_wheel *tw, struct timeout_event *tev);
 
 void timing_wheel_start(struct timing_wheel *tw);
 void timing_wheel_stop(struct timing_wheel *tw);
 void timing_wheel_execute(struct timing_wheel *tw);
+/*
+ * time until the next tick that has something to do, in ns (or rounded up to
+ * ms), 0 if overdue and -1 if there is nothing scheduled or the wheel is
+ * stopped. Pass it to event_wait as timeout instead of waking up every tick;
+ * timing_wheel_execute skips over empty ticks in bulk.
+ */
+int64_t timing_wheel_next_ns(struct timing_wheel *tw);
+int timing_wheel_next_ms(struct timing_wheel *tw);
 void timing_wheel_flush(struct timing_wheel *tw); /* triggering all, useful for teardown */
 
 void timing_wheel_setup(timing_wheel_metrics_st *metrics);
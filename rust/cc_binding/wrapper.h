@@ -16,5 +16,6 @@
 
 #include <cc_bstring.h>
 #include <buffer/cc_buf.h>
+#include <stream/cc_sockio.h>
 #include <cc_log.h>
 #include <rust/cc_log_rs.h>
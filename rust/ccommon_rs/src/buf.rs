@@ -0,0 +1,470 @@
+//! BString is a wrapper around a foreign allocated and freed pointer to a cc_bstring.
+//! It takes care of creating and freeing the foreign pointer within the normal
+//! Rust lifetime rules. It has a companion reference object BStr, and the relation
+//! of BString to BStr is similar to the relationship between String and &str.
+//!
+//! # Safety
+//!
+//! The point of this module is to ensure safe interaction between
+//! Rust and C, and to facilitate passing BStrings between the two
+//! as the sized buffer of choice.
+//!
+//! Much like with the standard library collections (Vec, Box), one
+//! cannot simply pass their `from_raw` methods any old pointer.
+//! You must only pass pointers obtained via the `into_raw` method.
+
+//! Zero-copy access to ccommon buffers. `BufRef` and `BufSockRef` are to
+//! `struct buf` and `struct buf_sock` what `BStr` is to a cc_bstring: a view
+//! of something allocated by C, through which the readable region (rpos to
+//! wpos) is borrowed as `&[u8]` and the writable region (wpos to end) as
+//! `&mut [u8]`, so protocol code can parse and fill buffers in place.
+//!
+//! `Buf` and `BufSock` own a buf or buf_sock borrowed from its pool, and give
+//! it back when dropped, the RAII equivalent of `buf_borrow`/`buf_return` and
+//! `buf_sock_borrow`/`buf_sock_return`.
+//!
+//! Cursor updates (`consume`, `commit`, `reset`...) work on the struct fields
+//! directly rather than calling into C, so they inline like the static inline
+//! functions of cc_buf.h do for C code.
+//!
+//! # Safety
+//!
+//! The pools are not thread safe, which is why none of these types are
+//! `Send`. The `from_ptr` constructors trust the caller with the lifetime of
+//! the pointer, which must stay valid, and not be accessed from C, for as long
+//! as the reference is used.
+//!
+//! # Examples
+//!
+//! ```rust,ignore
+//! # use ccommon_rs::buf::*;
+//! let mut buf = Buf::borrow().unwrap();
+//!
+//! let n = buf.write(b"get foo\r\n");
+//! assert_eq!(&buf.as_read_slice()[..n], b"get foo\r\n");
+//! buf.consume(4);
+//! assert_eq!(buf.as_read_slice(), b"foo\r\n");
+//! // buf goes back to the pool here
+//! ```
+
+use cc_binding as bind;
+use std::cell::UnsafeCell;
+use std::cmp;
+use std::io;
+use std::mem;
+use std::ops::{Deref, DerefMut};
+use std::ptr;
+use std::slice;
+
+pub type CCbuf = bind::buf;
+pub type CCbufSock = bind::buf_sock;
+
+// same pattern as BStr, see bstring.rs
+struct Opaque(UnsafeCell<()>);
+
+/// A reference to a `struct buf`, which may be owned by C code (e.g. the
+/// rbuf of a buf_sock) or by a `Buf`.
+pub struct BufRef(Opaque);
+
+impl BufRef {
+    #[inline]
+    pub unsafe fn from_ptr<'a>(ptr: *mut CCbuf) -> &'a Self {
+        assert!(!ptr.is_null());
+        &*(ptr as *mut _)
+    }
+
+    #[inline]
+    pub unsafe fn from_ptr_mut<'a>(ptr: *mut CCbuf) -> &'a mut Self {
+        assert!(!ptr.is_null());
+        &mut *(ptr as *mut _)
+    }
+
+    #[inline]
+    pub fn as_ptr(&self) -> *mut CCbuf {
+        self as *const _ as *mut _
+    }
+
+    #[inline]
+    fn raw(&self) -> &CCbuf {
+        unsafe { &*self.as_ptr() }
+    }
+
+    #[inline]
+    fn raw_mut(&mut self) -> &mut CCbuf {
+        unsafe { &mut *self.as_ptr() }
+    }
+
+    #[inline]
+    fn begin(&self) -> *mut u8 {
+        unsafe { self.raw().begin.as_ptr() as *mut u8 }
+    }
+
+    /// # bytes that can be read, like `buf_rsize`
+    #[inline]
+    pub fn rsize(&self) -> usize {
+        self.raw().wpos as usize - self.raw().rpos as usize
+    }
+
+    /// # bytes that can be written, like `buf_wsize`
+    #[inline]
+    pub fn wsize(&self) -> usize {
+        self.raw().end as usize - self.raw().wpos as usize
+    }
+
+    /// # bytes the data portion can hold, like `buf_capacity`
+    #[inline]
+    pub fn capacity(&self) -> usize {
+        self.raw().end as usize - self.begin() as usize
+    }
+
+    /// The bytes between rpos and wpos.
+    #[inline]
+    pub fn as_read_slice(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.raw().rpos as *const u8, self.rsize()) }
+    }
+
+    /// The room between wpos and end; data written there becomes readable
+    /// once it is `commit`ted.
+    #[inline]
+    pub fn as_write_slice(&mut self) -> &mut [u8] {
+        let n = self.wsize();
+        unsafe { slice::from_raw_parts_mut(self.raw().wpos as *mut u8, n) }
+    }
+
+    /// Moves rpos past `n` bytes that have been read.
+    ///
+    /// # Panics
+    ///
+    /// If `n` is more than `rsize()`.
+    #[inline]
+    pub fn consume(&mut self, n: usize) {
+        assert!(n <= self.rsize());
+        let b = self.raw_mut();
+        b.rpos = unsafe { b.rpos.offset(n as isize) };
+    }
+
+    /// Moves wpos past `n` bytes written into `as_write_slice()`.
+    ///
+    /// # Panics
+    ///
+    /// If `n` is more than `wsize()`.
+    #[inline]
+    pub fn commit(&mut self, n: usize) {
+        assert!(n <= self.wsize());
+        let b = self.raw_mut();
+        b.wpos = unsafe { b.wpos.offset(n as isize) };
+    }
+
+    /// Copies as much of `src` as fits, returns the # bytes copied.
+    #[inline]
+    pub fn write(&mut self, src: &[u8]) -> usize {
+        let n = cmp::min(src.len(), self.wsize());
+        self.as_write_slice()[..n].copy_from_slice(&src[..n]);
+        self.commit(n);
+        n
+    }
+
+    /// Empties the buf, like `buf_reset` without touching the pool fields.
+    #[inline]
+    pub fn reset(&mut self) {
+        let begin = self.begin() as *mut _;
+        let b = self.raw_mut();
+        b.rpos = begin;
+        b.wpos = begin;
+    }
+
+    /// Moves the readable bytes to the beginning, like `buf_lshift`.
+    #[inline]
+    pub fn lshift(&mut self) {
+        let n = self.rsize();
+        let begin = self.begin();
+        let b = self.raw_mut();
+        unsafe {
+            ptr::copy(b.rpos as *const u8, begin, n);
+            b.rpos = begin as *mut _;
+            b.wpos = begin.offset(n as isize) as *mut _;
+        }
+    }
+}
+
+impl io::Read for BufRef {
+    #[inline]
+    fn read(&mut self, dst: &mut [u8]) -> io::Result<usize> {
+        let n = cmp::min(dst.len(), self.rsize());
+        dst[..n].copy_from_slice(&self.as_read_slice()[..n]);
+        self.consume(n);
+        Ok(n)
+    }
+}
+
+impl io::Write for BufRef {
+    #[inline]
+    fn write(&mut self, src: &[u8]) -> io::Result<usize> {
+        Ok(BufRef::write(self, src))
+    }
+
+    #[inline]
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+/// A buf borrowed from the buf pool, returned to it on drop.
+pub struct Buf(*mut CCbuf);
+
+impl Buf {
+    /// Borrows a buf, `None` if the pool is exhausted or out of memory.
+    /// The buf module must have been set up (`buf_setup`).
+    #[inline]
+    pub fn borrow() -> Option<Self> {
+        let p = unsafe { bind::buf_borrow() };
+
+        if p.is_null() {
+            None
+        } else {
+            Some(Buf(p))
+        }
+    }
+
+    /// Hands the buf over to C, which becomes responsible for returning it.
+    #[inline]
+    pub fn into_raw(b: Buf) -> *mut CCbuf {
+        let p = b.0;
+        mem::forget(b);
+        p
+    }
+
+    /// Takes over a buf borrowed from the pool by C.
+    #[inline]
+    pub unsafe fn from_raw(ptr: *mut CCbuf) -> Self {
+        assert!(!ptr.is_null());
+        Buf(ptr)
+    }
+}
+
+impl Drop for Buf {
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { bind::buf_return(&mut self.0) };
+    }
+}
+
+impl Deref for Buf {
+    type Target = BufRef;
+
+    #[inline]
+    fn deref(&self) -> &BufRef {
+        unsafe { BufRef::from_ptr(self.0) }
+    }
+}
+
+impl DerefMut for Buf {
+    #[inline]
+    fn deref_mut(&mut self) -> &mut BufRef {
+        unsafe { BufRef::from_ptr_mut(self.0) }
+    }
+}
+
+/// A reference to a `struct buf_sock`, e.g. one passed to a Rust handler by
+/// the event loop.
+pub struct BufSockRef(Opaque);
+
+impl BufSockRef {
+    #[inline]
+    pub unsafe fn from_ptr<'a>(ptr: *mut CCbufSock) -> &'a Self {
+        assert!(!ptr.is_null());
+        &*(ptr as *mut _)
+    }
+
+    #[inline]
+    pub unsafe fn from_ptr_mut<'a>(ptr: *mut CCbufSock) -> &'a mut Self {
+        assert!(!ptr.is_null());
+        &mut *(ptr as *mut _)
+    }
+
+    #[inline]
+    pub fn as_ptr(&self) -> *mut CCbufSock {
+        self as *const _ as *mut _
+    }
+
+    /// The rbuf, attaching one first in lazy mode (`buf_sock_rbuf`); `None`
+    /// on OOM.
+    #[inline]
+    pub fn rbuf(&mut self) -> Option<&mut BufRef> {
+        let p = unsafe { bind::buf_sock_rbuf(self.as_ptr()) };
+
+        if p.is_null() {
+            None
+        } else {
+            Some(unsafe { BufRef::from_ptr_mut(p) })
+        }
+    }
+
+    /// The wbuf, attaching one first in lazy mode (`buf_sock_wbuf`); `None`
+    /// on OOM.
+    #[inline]
+    pub fn wbuf(&mut self) -> Option<&mut BufRef> {
+        let p = unsafe { bind::buf_sock_wbuf(self.as_ptr()) };
+
+        if p.is_null() {
+            None
+        } else {
+            Some(unsafe { BufRef::from_ptr_mut(p) })
+        }
+    }
+
+    /// Both bufs at once, for handlers that parse rbuf while filling wbuf.
+    /// Nothing is attached: in lazy mode a buf not attached yet is `None`.
+    #[inline]
+    pub fn bufs(&mut self) -> (Option<&mut BufRef>, Option<&mut BufRef>) {
+        let s = unsafe { &*self.as_ptr() };
+        let (r, w) = (s.rbuf, s.wbuf);
+
+        unsafe {
+            (
+                if r.is_null() { None } else { Some(BufRef::from_ptr_mut(r)) },
+                if w.is_null() { None } else { Some(BufRef::from_ptr_mut(w)) },
+            )
+        }
+    }
+}
+
+/// A buf_sock borrowed from the buf_sock pool, returned to it on drop.
+pub struct BufSock(*mut CCbufSock);
+
+impl BufSock {
+    /// Borrows a buf_sock, `None` if the pool is exhausted or out of
+    /// memory. The sockio module must have been set up (`sockio_setup`).
+    #[inline]
+    pub fn borrow() -> Option<Self> {
+        let p = unsafe { bind::buf_sock_borrow() };
+
+        if p.is_null() {
+            None
+        } else {
+            Some(BufSock(p))
+        }
+    }
+
+    #[inline]
+    pub fn into_raw(s: BufSock) -> *mut CCbufSock {
+        let p = s.0;
+        mem::forget(s);
+        p
+    }
+
+    #[inline]
+    pub unsafe fn from_raw(ptr: *mut CCbufSock) -> Self {
+        assert!(!ptr.is_null());
+        BufSock(ptr)
+    }
+}
+
+impl Drop for BufSock {
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { bind::buf_sock_return(&mut self.0) };
+    }
+}
+
+impl Deref for BufSock {
+    type Target = BufSockRef;
+
+    #[inline]
+    fn deref(&self) -> &BufSockRef {
+        unsafe { BufSockRef::from_ptr(self.0) }
+    }
+}
+
+impl DerefMut for BufSock {
+    #[inline]
+    fn deref_mut(&mut self) -> &mut BufSockRef {
+        unsafe { BufSockRef::from_ptr_mut(self.0) }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use std::io::Read;
+
+    fn setup() {
+        unsafe {
+            bind::buf_setup(ptr::null_mut(), ptr::null_mut());
+            bind::sockio_setup(ptr::null_mut(), ptr::null_mut());
+        }
+    }
+
+    fn buf_cursors() {
+        setup();
+
+        let mut buf = Buf::borrow().unwrap();
+        let cap = buf.capacity();
+        assert_eq!(buf.rsize(), 0);
+        assert_eq!(buf.wsize(), cap);
+
+        // written in place, then made readable
+        buf.as_write_slice()[..3].copy_from_slice(b"abc");
+        assert_eq!(buf.rsize(), 0);
+        buf.commit(3);
+        assert_eq!(buf.as_read_slice(), b"abc");
+
+        buf.consume(1);
+        assert_eq!(buf.as_read_slice(), b"bc");
+        buf.lshift();
+        assert_eq!(buf.as_read_slice(), b"bc");
+        assert_eq!(buf.wsize(), cap - 2);
+
+        buf.reset();
+        assert_eq!(buf.rsize(), 0);
+        assert_eq!(buf.wsize(), cap);
+    }
+
+    fn buf_io() {
+        setup();
+
+        let mut buf = Buf::borrow().unwrap();
+        let mut dst = [0u8; 16];
+
+        assert_eq!(io::Write::write(&mut *buf, b"foo bar").unwrap(), 7);
+        assert_eq!((&mut *buf).read(&mut dst[..3]).unwrap(), 3);
+        assert_eq!(&dst[..3], b"foo");
+        assert_eq!(buf.as_read_slice(), b" bar");
+
+        // views of a buf owned by C see the same bytes
+        let p = Buf::into_raw(buf);
+        {
+            let view = unsafe { BufRef::from_ptr(p) };
+            assert_eq!(view.as_read_slice(), b" bar");
+        }
+        drop(unsafe { Buf::from_raw(p) });
+    }
+
+    fn buf_sock_bufs() {
+        setup();
+
+        let mut s = BufSock::borrow().unwrap();
+        assert_eq!(s.wbuf().unwrap().write(b"pong"), 4);
+        {
+            let (r, w) = s.bufs();
+            let (r, w) = (r.unwrap(), w.unwrap());
+            assert_eq!(r.rsize(), 0);
+            assert_eq!(w.as_read_slice(), b"pong");
+        }
+    }
+
+    rusty_fork_test! {
+        #[test]
+        fn test_buf_cursors() { buf_cursors(); }
+    }
+
+    rusty_fork_test! {
+        #[test]
+        fn test_buf_io() { buf_io(); }
+    }
+
+    rusty_fork_test! {
+        #[test]
+        fn test_buf_sock_bufs() { buf_sock_bufs(); }
+    }
+}
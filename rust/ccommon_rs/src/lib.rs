@@ -35,6 +35,7 @@ extern crate rusty_fork;
 use std::result;
 
 pub mod bstring;
+pub mod buf;
 pub mod log;
 pub mod util;
 
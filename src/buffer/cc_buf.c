@@ -20,23 +20,149 @@
 #include <cc_debug.h>
 #include <cc_mm.h>
 #include <cc_pool.h>
+#include <cc_probe.h>
+#include <cc_slab.h>
 
 
 #define BUF_MODULE_NAME "ccommon::buffer:buf"
 
+/* slab slots in whole cache lines, so every slab buf starts on one */
+#define BUF_SLOT CC_ALIGN(buf_init_size, BUF_ALIGN)
+
+_Static_assert(BUF_HDR_SIZE == BUF_ALIGN, "buf header must be a cache line");
+
 FREEPOOL(buf_pool, bufq, buf);
-static struct buf_pool bufp;
+static struct buf_pool bufp[BUF_NCLASS_MAX]; /* one pool per size class */
+static struct slab *buf_slab = NULL; /* backs the base class if poolslab */
 
 static bool buf_init = false;
 static bool bufp_init = false;
 
 uint32_t buf_init_size = BUF_INIT_SIZE;
+uint32_t buf_nclass = BUF_NCLASS;
+static uint64_t buf_memory_max = BUF_MEMORY_MAX;
+static uint64_t buf_memory_used = 0; /* bytes in bufs, see buf_memory_charge */
 buf_metrics_st *buf_metrics = NULL;
+static METRIC_SHARD_DECLARE(buf_metrics);
+
+/* size class of a buf of total size `size', or BUF_CLASS_NONE */
+static inline uint8_t
+_buf_class(uint32_t size)
+{
+    uint8_t i;
+
+    for (i = 0; i < buf_nclass; i++) {
+        if (size == buf_init_size << i) {
+            return i;
+        }
+    }
+
+    return BUF_CLASS_NONE;
+}
+
+/* destroy free bufs, largest first, until size more bytes fit under the max */
+static bool
+_buf_reclaim(uint32_t size)
+{
+    struct buf *buf;
+    int i;
+
+    for (i = buf_nclass - 1; i >= 0; i--) {
+        while (buf_memory_used + size > buf_memory_max &&
+                !STAILQ_EMPTY(&bufp[i].freeq)) {
+            buf = STAILQ_FIRST(&bufp[i].freeq);
+            STAILQ_REMOVE_HEAD(&bufp[i].freeq, next);
+            bufp[i].nfree--;
+            FREEPOOL_IDLE_UPDATE(&bufp[i]);
+            buf_destroy(&buf);
+        }
+    }
+
+    return buf_memory_used + size <= buf_memory_max;
+}
+
+rstatus_i
+buf_memory_charge(uint32_t osize, uint32_t nsize)
+{
+    if (nsize > osize && buf_memory_max > 0 &&
+            buf_memory_used + nsize - osize > buf_memory_max &&
+            !_buf_reclaim(nsize - osize)) {
+        log_debug("buf growth from %"PRIu32" to %"PRIu32" bytes denied, %"
+                PRIu64" of %"PRIu64" bytes in use", osize, nsize,
+                buf_memory_used, buf_memory_max);
+        INCR_SHARD(buf_metrics, buf_memory_ex);
+
+        return CC_ENOMEM;
+    }
+
+    buf_memory_used = buf_memory_used + nsize - osize;
+
+    return CC_OK;
+}
+
+static struct buf *
+_buf_create(uint32_t size)
+{
+    struct buf *buf = NULL;
+    char *p;
+
+    if (buf_memory_charge(0, size) != CC_OK) {
+        return NULL;
+    }
+
+    if (buf_slab != NULL && size == buf_init_size) {
+        buf = (struct buf *)slab_alloc(buf_slab);
+        if (buf != NULL) {
+            buf->shift = 0;
+        }
+    }
+    if (buf == NULL && (p = cc_alloc(size + BUF_ALIGN)) != NULL) {
+        buf = (struct buf *)CC_ALIGN_PTR(p, BUF_ALIGN);
+        buf->shift = (uint8_t)((char *)buf - p);
+    }
+
+    if (buf == NULL) {
+        buf_memory_used -= size;
+        log_info("buf creation failed due to OOM");
+        INCR_SHARD(buf_metrics, buf_create_ex);
+
+        return NULL;
+    }
+
+    buf->end = (char *)buf + size;
+    buf_reset(buf);
+    buf->cid = BUF_CLASS_NONE;
+    INCR_SHARD(buf_metrics, buf_create);
+    INCR_SHARD(buf_metrics, buf_curr);
+    INCR_N_SHARD(buf_metrics, buf_memory, size);
+
+    log_verb("created buf %p capacity %"PRIu32, buf, buf_capacity(buf));
+
+    return buf;
+}
+
+/* park a buf that is not in use in the pool of its size class, or free it */
+static void
+_buf_recycle(struct buf *buf)
+{
+    uint8_t i = _buf_class(buf_size(buf));
+
+    if (i != BUF_CLASS_NONE && bufp[i].nfree < bufp[i].nmax &&
+            bufp[i].nfree < bufp[i].nhigh) {
+        buf->free = true;
+        STAILQ_NEXT(buf, next) = NULL;
+        STAILQ_INSERT_HEAD(&bufp[i].freeq, buf, next);
+        bufp[i].nfree++;
+    } else {
+        buf_destroy(&buf);
+    }
+}
 
 static void
 buf_pool_destroy(void)
 {
     struct buf *buf, *nbuf;
+    uint8_t i;
 
     if (!bufp_init) {
         log_warn("buf pool was never created, ignoring destroy");
@@ -44,16 +170,32 @@ buf_pool_destroy(void)
         return;
     }
 
-    log_info("destroying buf pool: free %"PRIu32, bufp.nfree);
+    for (i = 0; i < buf_nclass; i++) {
+        log_info("destroying buf pool %"PRIu8": free %"PRIu32, i,
+                bufp[i].nfree);
 
-    FREEPOOL_DESTROY(buf, nbuf, &bufp, next, buf_destroy);
+        FREEPOOL_DESTROY(buf, nbuf, &bufp[i], next, buf_destroy);
+    }
+
+    if (buf_slab != NULL) {
+        if (buf_slab->nused > 0) {
+            /* unmapping would pull memory from under bufs still around */
+            log_warn("%"PRIu32" slab bufs outstanding, leaking slab",
+                    buf_slab->nused);
+            buf_slab = NULL;
+        } else {
+            slab_destroy(&buf_slab);
+        }
+    }
     bufp_init = false;
 }
 
 static void
-buf_pool_create(uint32_t max)
+buf_pool_create(uint32_t max, uint32_t nclass, bool poolslab, uint32_t low,
+        uint32_t high)
 {
     struct buf *buf;
+    uint8_t i;
 
     if (bufp_init) {
         log_warn("buf pool has already been created, re-creating");
@@ -61,9 +203,22 @@ buf_pool_create(uint32_t max)
         buf_pool_destroy();
     }
 
-    log_info("creating buf pool: max %"PRIu32, max);
+    if (nclass == 0) {
+        nclass = 1;
+    } else if (nclass > BUF_NCLASS_MAX) {
+        log_warn("buf_nclass %"PRIu32" too large, using %d", nclass,
+                BUF_NCLASS_MAX);
+        nclass = BUF_NCLASS_MAX;
+    }
+    buf_nclass = nclass;
+
+    log_info("creating buf pool: max %"PRIu32" nclass %"PRIu32" slab %d", max,
+            buf_nclass, poolslab);
 
-    FREEPOOL_CREATE(&bufp, max);
+    for (i = 0; i < buf_nclass; i++) {
+        FREEPOOL_CREATE(&bufp[i], max);
+        FREEPOOL_WATERMARK(&bufp[i], low, high);
+    }
     bufp_init = true;
 
     /**
@@ -71,10 +226,20 @@ buf_pool_create(uint32_t max)
      * whether we want an option where memory is capped but
      * not preallocated is a question for future exploration.
      * So far I see no point of that.
+     *
+     * Only the base class is preallocated, larger ones fill up as dbuf
+     * resizes buffers into them.
      */
+    if (poolslab && max > 0) {
+        buf_slab = slab_create(BUF_SLOT, slab_region_fit(BUF_SLOT, max), max);
+        if (buf_slab == NULL || slab_reserve(buf_slab, max) != CC_OK) {
+            log_crit("cannot map buf pool slab, OOM. abort");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    FREEPOOL_PREALLOC(buf, &bufp, max, next, buf_create);
-    if (bufp.nfree < max) {
+    FREEPOOL_PREALLOC(buf, &bufp[0], max, next, buf_create);
+    if (bufp[0].nfree < max) {
         log_crit("cannot preallocate buf pool, OOM. abort");
         exit(EXIT_FAILURE);
     }
@@ -85,19 +250,21 @@ buf_borrow(void)
 {
     struct buf *buf;
 
-    FREEPOOL_BORROW(buf, &bufp, next, buf_create);
+    FREEPOOL_BORROW(buf, &bufp[0], next, buf_create);
 
     if (buf == NULL) {
         log_warn("borrow buf failed, OOM or over limit");
-        INCR(buf_metrics, buf_borrow_ex);
+        INCR_SHARD(buf_metrics, buf_borrow_ex);
 
         return NULL;
     }
 
     buf_reset(buf);
-    INCR(buf_metrics, buf_borrow);
-    INCR(buf_metrics, buf_active);
+    buf->cid = 0;
+    INCR_SHARD(buf_metrics, buf_borrow);
+    INCR_SHARD(buf_metrics, buf_active);
 
+    PROBE2(buf_borrow, buf, buf_size(buf));
     log_verb("borrow buf %p", buf);
 
     return buf;
@@ -115,42 +282,31 @@ buf_return(struct buf **buf)
     ASSERT(STAILQ_NEXT(elm, next) == NULL);
     ASSERT(elm->wpos <= elm->end);
 
+    PROBE2(buf_return, elm, buf_size(elm));
     log_verb("return buf %p", elm);
 
-    elm->free = true;
-    FREEPOOL_RETURN(elm, &bufp, next);
+    /* a buf resized by dbuf goes back to the class matching its new size */
+    if (elm->cid != BUF_CLASS_NONE) {
+        bufp[elm->cid].nused--;
+        elm->cid = BUF_CLASS_NONE;
+    }
+    _buf_recycle(elm);
 
     *buf = NULL;
-    INCR(buf_metrics, buf_return);
-    DECR(buf_metrics, buf_active);
+    INCR_SHARD(buf_metrics, buf_return);
+    DECR_SHARD(buf_metrics, buf_active);
 }
 
 struct buf *
 buf_create(void)
 {
-    struct buf *buf = (struct buf *)cc_alloc(buf_init_size);
-
-    if (buf == NULL) {
-        log_info("buf creation failed due to OOM");
-        INCR(buf_metrics, buf_create_ex);
-
-        return NULL;
-    }
-
-    buf->end = (char *)buf + buf_init_size;
-    buf_reset(buf);
-    INCR(buf_metrics, buf_create);
-    INCR(buf_metrics, buf_curr);
-    INCR_N(buf_metrics, buf_memory, buf_init_size);
-
-    log_verb("created buf %p capacity %"PRIu32, buf, buf_capacity(buf));
-
-    return buf;
+    return _buf_create(buf_init_size);
 }
 
 void
 buf_destroy(struct buf **buf)
 {
+    char *p;
     uint32_t cap;
 
     if (buf == NULL || *buf == NULL) {
@@ -160,11 +316,190 @@ buf_destroy(struct buf **buf)
     cap = buf_size(*buf);
     log_verb("destroy buf %p size %"PRIu32, *buf, cap);
 
-    cc_free(*buf);
+    if (slab_owns(buf_slab, *buf)) {
+        slab_free(buf_slab, *buf);
+    } else {
+        p = (char *)*buf - (*buf)->shift;
+        cc_free_sized(p, cap + BUF_ALIGN);
+    }
     *buf = NULL;
-    INCR(buf_metrics, buf_destroy);
-    DECR(buf_metrics, buf_curr);
-    DECR_N(buf_metrics, buf_memory, cap);
+    buf_memory_used -= cap;
+    INCR_SHARD(buf_metrics, buf_destroy);
+    DECR_SHARD(buf_metrics, buf_curr);
+    DECR_N_SHARD(buf_metrics, buf_memory, cap);
+}
+
+void
+buf_trim(void *arg)
+{
+    struct buf *buf;
+    uint32_t nfree;
+    uint8_t i;
+
+    (void)arg;
+
+    if (!bufp_init) {
+        return;
+    }
+
+    for (i = 0; i < buf_nclass; i++) {
+        nfree = bufp[i].nfree;
+        FREEPOOL_TRIM(buf, &bufp[i], next, buf_destroy);
+        if (nfree > bufp[i].nfree) {
+            log_verb("trimmed %"PRIu32" free bufs of class %"PRIu8,
+                    nfree - bufp[i].nfree, i);
+            INCR_N_SHARD(buf_metrics, buf_trim, nfree - bufp[i].nfree);
+        }
+    }
+}
+
+bool
+buf_class_has(uint32_t size)
+{
+    return _buf_class(size) != BUF_CLASS_NONE;
+}
+
+bool
+buf_in_slab(const struct buf *buf)
+{
+    return slab_owns(buf_slab, buf);
+}
+
+struct buf *
+buf_realloc(struct buf *buf, uint32_t nsize)
+{
+    struct buf *nbuf;
+    uint32_t osize = buf_size(buf);
+    uint8_t shift = buf->shift;
+    char *p;
+
+    ASSERT(!buf_in_slab(buf));
+
+    p = cc_realloc((char *)buf - shift, nsize + BUF_ALIGN);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    /* a moved allocation may be aligned differently, slide contents over */
+    nbuf = (struct buf *)CC_ALIGN_PTR(p, BUF_ALIGN);
+    if ((char *)nbuf != p + shift) {
+        cc_memmove(nbuf, p + shift, MIN(osize, nsize));
+    }
+    nbuf->shift = (uint8_t)((char *)nbuf - p);
+    nbuf->end = (char *)nbuf + nsize;
+    DECR_N_SHARD(buf_metrics, buf_memory, osize);
+    INCR_N_SHARD(buf_metrics, buf_memory, nsize);
+
+    return nbuf;
+}
+
+rstatus_i
+buf_class_resize(struct buf **buf, uint32_t nsize)
+{
+    struct buf *obuf = *buf, *nbuf;
+    uint32_t roffset, woffset;
+    uint8_t i = _buf_class(nsize);
+
+    roffset = obuf->rpos - obuf->begin;
+    woffset = obuf->wpos - obuf->begin;
+    ASSERT(woffset <= nsize - BUF_HDR_SIZE);
+
+    if (i != BUF_CLASS_NONE && !STAILQ_EMPTY(&bufp[i].freeq)) {
+        nbuf = STAILQ_FIRST(&bufp[i].freeq);
+        STAILQ_REMOVE_HEAD(&bufp[i].freeq, next);
+        bufp[i].nfree--;
+        FREEPOOL_IDLE_UPDATE(&bufp[i]);
+    } else {
+        nbuf = _buf_create(nsize);
+        if (nbuf == NULL) {
+            return CC_ENOMEM;
+        }
+    }
+
+    log_verb("buf %p of size %"PRIu32" moved to %p of size %"PRIu32, obuf,
+            buf_size(obuf), nbuf, nsize);
+
+    cc_memcpy(nbuf->begin, obuf->begin, woffset);
+    STAILQ_NEXT(nbuf, next) = NULL;
+    nbuf->free = false;
+    nbuf->rpos = nbuf->begin + roffset;
+    nbuf->wpos = nbuf->begin + woffset;
+    nbuf->cid = obuf->cid; /* still accounted to the pool it came from */
+
+    _buf_recycle(obuf);
+    *buf = nbuf;
+
+    return CC_OK;
+}
+
+uint32_t
+buf_chain_rsize(const struct buf_sqh *chain)
+{
+    struct buf *buf;
+    uint32_t size = 0;
+
+    STAILQ_FOREACH(buf, chain, next) {
+        size += buf_rsize(buf);
+    }
+
+    return size;
+}
+
+uint32_t
+buf_chain_write(struct buf_sqh *chain, char *src, uint32_t count)
+{
+    struct buf *buf = STAILQ_LAST(chain, buf, next);
+    uint32_t len, written = 0;
+
+    while (written < count) {
+        if (buf == NULL || buf_wsize(buf) == 0) {
+            buf = buf_borrow();
+            if (buf == NULL) {
+                break;
+            }
+            STAILQ_INSERT_TAIL(chain, buf, next);
+        }
+
+        len = buf_write(buf, src + written, count - written);
+        written += len;
+    }
+
+    return written;
+}
+
+void
+buf_chain_consume(struct buf_sqh *chain, uint32_t count)
+{
+    struct buf *buf;
+    uint32_t len;
+
+    while ((buf = STAILQ_FIRST(chain)) != NULL) {
+        len = MIN(buf_rsize(buf), count);
+        buf->rpos += len;
+        count -= len;
+
+        if (buf_rsize(buf) > 0) {
+            break;
+        }
+
+        STAILQ_REMOVE_HEAD(chain, next);
+        STAILQ_NEXT(buf, next) = NULL;
+        buf_return(&buf);
+    }
+
+    ASSERT(count == 0);
+}
+
+void
+buf_chain_return(struct buf_sqh *chain)
+{
+    struct buf *buf;
+
+    while ((buf = STAILQ_FIRST(chain)) != NULL) {
+        STAILQ_REMOVE_HEAD(chain, next);
+        STAILQ_NEXT(buf, next) = NULL;
+        buf_return(&buf);
+    }
 }
 
 void
@@ -172,6 +507,10 @@ buf_setup(buf_options_st *options, buf_metrics_st *metrics)
 {
     log_info("setting up the %s module", BUF_MODULE_NAME);
     uint32_t max = BUF_POOLSIZE;
+    uint32_t nclass = BUF_NCLASS;
+    bool poolslab = BUF_POOLSLAB;
+    uint32_t low = BUF_POOL_LOW;
+    uint32_t high = BUF_POOL_HIGH;
 
     if (buf_init) {
         log_warn("%s was already setup, overwriting", BUF_MODULE_NAME);
@@ -182,9 +521,14 @@ buf_setup(buf_options_st *options, buf_metrics_st *metrics)
     if (options != NULL) {
         buf_init_size = option_uint(&options->buf_init_size);
         max = option_uint(&options->buf_poolsize);
+        nclass = option_uint(&options->buf_nclass);
+        poolslab = option_bool(&options->buf_poolslab);
+        low = option_uint(&options->buf_pool_low);
+        high = option_uint(&options->buf_pool_high);
+        buf_memory_max = option_uint(&options->buf_memory_max);
     }
 
-    buf_pool_create(max);
+    buf_pool_create(max, nclass, poolslab, low, high);
 
     buf_init = true;
 }
@@ -199,7 +543,68 @@ buf_teardown(void)
     }
 
     buf_pool_destroy();
+    buf_memory_max = BUF_MEMORY_MAX;
+    metric_shard_release((struct metric *)buf_metrics,
+            METRIC_CARDINALITY(*buf_metrics));
     buf_metrics = NULL;
 
     buf_init = false;
 }
+
+rstatus_i
+buf_apply(struct option *opt, option_val_u old, void *arg)
+{
+    buf_options_st *options = arg;
+    struct buf *buf;
+    uint32_t size;
+    uint8_t i;
+
+    (void)old;
+
+    if (opt == &options->buf_init_size) {
+        size = option_uint(opt);
+        /* slab slots are cut at setup, and the largest class must fit */
+        if (buf_slab != NULL || size <= BUF_HDR_SIZE ||
+                (uint64_t)size << (buf_nclass - 1) > UINT32_MAX) {
+            log_warn("buf_init_size %"PRIu32" cannot be applied live", size);
+            return CC_ERROR;
+        }
+
+        buf_init_size = size;
+        /* free bufs are of the old class sizes, bufs in use go on return */
+        for (i = 0; bufp_init && i < buf_nclass; i++) {
+            while (!STAILQ_EMPTY(&bufp[i].freeq)) {
+                buf = STAILQ_FIRST(&bufp[i].freeq);
+                STAILQ_REMOVE_HEAD(&bufp[i].freeq, next);
+                bufp[i].nfree--;
+                FREEPOOL_IDLE_UPDATE(&bufp[i]);
+                buf_destroy(&buf);
+            }
+        }
+        log_info("buf_init_size changed to %"PRIu32, buf_init_size);
+        return CC_OK;
+    }
+
+    if (opt == &options->buf_pool_low || opt == &options->buf_pool_high) {
+        for (i = 0; bufp_init && i < buf_nclass; i++) {
+            FREEPOOL_WATERMARK(&bufp[i], option_uint(&options->buf_pool_low),
+                    option_uint(&options->buf_pool_high));
+        }
+        return CC_OK;
+    }
+
+    if (opt == &options->buf_memory_max) {
+        /* bufs already over a lowered max stay until returned or trimmed */
+        buf_memory_max = option_uint(opt);
+        return CC_OK;
+    }
+
+    /* pool size, nclass and slab shape the pools made at setup */
+    if (opt >= (struct option *)options &&
+            opt < (struct option *)(options + 1)) {
+        log_warn("option '%s' needs a restart to change", opt->name);
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
@@ -3,6 +3,8 @@
 #include <cc_bstring.h>
 #include <cc_debug.h>
 #include <cc_mm.h>
+#include <cc_probe.h>
+#include <cc_trace.h>
 
 #include <stddef.h>
 
@@ -57,12 +59,22 @@ _dbuf_resize(struct buf **buf, uint32_t nsize)
         return CC_ERROR;
     }
 
+    PROBE3(dbuf_resize, *buf, buf_size(*buf), nsize);
+    if (buf_class_has(nsize) || buf_in_slab(*buf)) {
+        /* swap through the pool of that size class, slab bufs cannot realloc */
+        return buf_class_resize(buf, nsize);
+    }
+
     osize = buf_size(*buf);
     roffset = (*buf)->rpos - (*buf)->begin;
     woffset = (*buf)->wpos - (*buf)->begin;
 
-    nbuf = cc_realloc(*buf, nsize);
+    if (buf_memory_charge(osize, nsize) != CC_OK) {
+        return CC_ENOMEM;
+    }
+    nbuf = buf_realloc(*buf, nsize);
     if (nbuf == NULL) { /* realloc failed, but *buf is still valid */
+        buf_memory_charge(nsize, osize);
         return CC_ENOMEM;
     }
 
@@ -74,8 +86,6 @@ _dbuf_resize(struct buf **buf, uint32_t nsize)
     nbuf->rpos = nbuf->begin + roffset;
     nbuf->wpos = nbuf->begin + woffset;
     *buf = nbuf;
-    DECR_N(buf_metrics, buf_memory, osize);
-    INCR_N(buf_metrics, buf_memory, nsize);
 
     return CC_OK;
 }
@@ -86,7 +96,9 @@ dbuf_double(struct buf **buf)
     rstatus_i status;
     uint32_t nsize = buf_size(*buf) * 2;
 
+    TRACE_BEGIN(TRACE_DBUF_DOUBLE);
     status = _dbuf_resize(buf, nsize);
+    TRACE_END_N(TRACE_DBUF_DOUBLE, nsize);
     if (status == CC_OK) {
         INCR(dbuf_metrics, dbuf_double);
     } else {
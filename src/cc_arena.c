@@ -0,0 +1,203 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cc_arena.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <string.h>
+
+static struct arena_chunk *
+_arena_chunk_create(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = (struct arena_chunk *)cc_alloc(size);
+
+    if (chunk == NULL) {
+        log_info("arena chunk creation failed due to OOM");
+
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->pos = (char *)CC_ALIGN_PTR(chunk->data, ARENA_ALIGN);
+    chunk->end = (char *)chunk + size;
+    arena->nchunk++;
+
+    log_verb("created arena chunk %p of size %zu", chunk, size);
+
+    return chunk;
+}
+
+static void
+_arena_chunk_destroy(struct arena *arena, struct arena_chunk *chunk)
+{
+    log_verb("destroy arena chunk %p", chunk);
+
+    cc_free(chunk);
+    arena->nchunk--;
+}
+
+struct arena *
+arena_create(size_t chunk_size)
+{
+    struct arena *arena;
+
+    if (chunk_size == 0) {
+        chunk_size = ARENA_CHUNK_SIZE;
+    }
+    if (chunk_size <= sizeof(struct arena_chunk) + ARENA_ALIGN) {
+        log_error("arena chunk size %zu is too small", chunk_size);
+
+        return NULL;
+    }
+
+    arena = (struct arena *)cc_alloc(sizeof(struct arena));
+    if (arena == NULL) {
+        log_info("arena creation failed due to OOM");
+
+        return NULL;
+    }
+
+    arena->chunk_size = chunk_size;
+    arena->nbyte = 0;
+    arena->nchunk = 0;
+    arena->large = NULL;
+    arena->head = arena->curr = _arena_chunk_create(arena, chunk_size);
+    if (arena->head == NULL) {
+        cc_free(arena);
+
+        return NULL;
+    }
+
+    log_verb("created arena %p with chunk size %zu", arena, chunk_size);
+
+    return arena;
+}
+
+void
+arena_destroy(struct arena **arena)
+{
+    struct arena_chunk *chunk, *next;
+
+    if (arena == NULL || *arena == NULL) {
+        return;
+    }
+
+    log_verb("destroy arena %p", *arena);
+
+    arena_reset(*arena);
+    for (chunk = (*arena)->head; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        _arena_chunk_destroy(*arena, chunk);
+    }
+    ASSERT((*arena)->nchunk == 0);
+
+    cc_free(*arena);
+    *arena = NULL;
+}
+
+/* oversized requests get a chunk of their own, freed on reset */
+static void *
+_arena_alloc_large(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+
+    chunk = _arena_chunk_create(arena, sizeof(struct arena_chunk) +
+            ARENA_ALIGN + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    chunk->next = arena->large;
+    arena->large = chunk;
+    chunk->pos = chunk->end;
+
+    return CC_ALIGN_PTR(chunk->data, ARENA_ALIGN);
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+    char *p;
+
+    ASSERT(arena != NULL);
+
+    chunk = arena->curr;
+    size = CC_ALIGN(size, ARENA_ALIGN);
+    if (size > arena->chunk_size / 4) {
+        /* would waste too much of a regular chunk */
+        p = _arena_alloc_large(arena, size);
+        goto done;
+    }
+
+    /* move on to the next chunk, reusing chunks kept by arena_reset */
+    while ((size_t)(chunk->end - chunk->pos) < size) {
+        if (chunk->next == NULL) {
+            chunk->next = _arena_chunk_create(arena, arena->chunk_size);
+            if (chunk->next == NULL) {
+                return NULL;
+            }
+        }
+        chunk = chunk->next;
+        arena->curr = chunk;
+    }
+
+    p = chunk->pos;
+    chunk->pos += size;
+
+done:
+    if (p != NULL) {
+        arena->nbyte += size;
+    }
+
+    return p;
+}
+
+void *
+arena_zalloc(struct arena *arena, size_t size)
+{
+    void *p = arena_alloc(arena, size);
+
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+
+    return p;
+}
+
+void
+arena_reset(struct arena *arena)
+{
+    struct arena_chunk *chunk, *next;
+
+    ASSERT(arena != NULL);
+
+    for (chunk = arena->large; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        _arena_chunk_destroy(arena, chunk);
+    }
+    arena->large = NULL;
+
+    for (chunk = arena->head; chunk != NULL; chunk = chunk->next) {
+        chunk->pos = (char *)CC_ALIGN_PTR(chunk->data, ARENA_ALIGN);
+    }
+    arena->curr = arena->head;
+    arena->nbyte = 0;
+}
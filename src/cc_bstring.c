@@ -20,6 +20,10 @@
 #include <cc_debug.h>
 #include <cc_mm.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 /*
  * Byte string (struct bstring) is a sequence of unsigned char
  * The length of the string is pre-computed and explicitly available.
@@ -107,39 +111,520 @@ bstring_compare(const struct bstring *s1, const struct bstring *s2)
      * so we can use 256 to indicate a length difference in case it's useful
      */
     if (s1->len != s2->len) {
-        return s1->len - s2->len > 0 ? 256 : -256;
+        return s1->len > s2->len ? 256 : -256;
     }
 
     return cc_bcmp(s1->data, s2->data, s1->len);
 }
 
-rstatus_i
-bstring_atou64(uint64_t *u64, struct bstring *str)
+/*
+ * The primitives below work on raw bytes and come in a portable version and,
+ * on x86-64, SSE2 (always available) and AVX2 versions. The function pointers
+ * start out at stubs which pick the best version for this CPU on first call,
+ * so later calls pay no dispatch cost beyond the indirect call.
+ */
+typedef uint32_t (*find_any_fn)(const uint8_t *p, uint32_t len,
+        const uint8_t *set, uint32_t nset);
+typedef bool (*equal_fn)(const uint8_t *a, const uint8_t *b, uint32_t len);
+/* index of the first ASCII case-insensitive mismatch, len if none */
+typedef uint32_t (*casediff_fn)(const uint8_t *a, const uint8_t *b,
+        uint32_t len);
+
+#define ONES            0x0101010101010101ULL
+#define HIGHS           0x8080808080808080ULL
+#define HASZERO(_v)     (((_v) - ONES) & ~(_v) & HIGHS)
+
+static inline uint8_t
+_lower(uint8_t c)
 {
-    uint32_t offset;
-    uint8_t c;
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
 
-    *u64 = 0ULL;
+static uint32_t
+_find_any_sw(const uint8_t *p, uint32_t len, const uint8_t *set, uint32_t nset)
+{
+    uint32_t i, k;
+
+    for (i = 0; i < len; i++) {
+        for (k = 0; k < nset; k++) {
+            if (p[i] == set[k]) {
+                return i;
+            }
+        }
+    }
+
+    return len;
+}
+
+static uint32_t
+_find_any_swar(const uint8_t *p, uint32_t len, const uint8_t *set,
+        uint32_t nset)
+{
+    uint64_t w, m;
+    uint32_t i, k;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        cc_memcpy(&w, p + i, 8);
+        for (m = 0, k = 0; k < nset; k++) {
+            m |= HASZERO(w ^ (ONES * set[k]));
+        }
+        if (m != 0) {
+            return i + _find_any_sw(p + i, 8, set, nset);
+        }
+    }
+
+    return i + _find_any_sw(p + i, len - i, set, nset);
+}
+
+static bool
+_equal_sw(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    return cc_bcmp(a, b, len) == 0;
+}
+
+static uint32_t
+_casediff_sw(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len && _lower(a[i]) == _lower(b[i]); i++);
+
+    return i;
+}
+
+#if defined(__x86_64__)
+static uint32_t
+_find_any_sse2(const uint8_t *p, uint32_t len, const uint8_t *set,
+        uint32_t nset)
+{
+    __m128i c[BSTRING_FIND_NSET], v, eq;
+    uint32_t i, k, m;
+
+    for (k = 0; k < nset; k++) {
+        c[k] = _mm_set1_epi8((char)set[k]);
+    }
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        eq = _mm_cmpeq_epi8(v, c[0]);
+        for (k = 1; k < nset; k++) {
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, c[k]));
+        }
+        m = (uint32_t)_mm_movemask_epi8(eq);
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+
+    return i + _find_any_sw(p + i, len - i, set, nset);
+}
+
+/* len >= 16, the last block overlaps the one before */
+static bool
+_equal_sse2(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    __m128i x, y;
+    uint32_t i;
+
+    for (i = 0; ; i += 16) {
+        if (i + 16 > len) {
+            i = len - 16;
+        }
+        x = _mm_loadu_si128((const __m128i *)(a + i));
+        y = _mm_loadu_si128((const __m128i *)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) {
+            return false;
+        }
+        if (i + 16 == len) {
+            return true;
+        }
+    }
+}
+
+/* bytes >= 0x80 compare as negative, so they are never seen as upper case */
+static inline __m128i
+_lower_sse2(__m128i v)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static uint32_t
+_casediff_sse2(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    __m128i x, y;
+    uint32_t i, m;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        x = _lower_sse2(_mm_loadu_si128((const __m128i *)(a + i)));
+        y = _lower_sse2(_mm_loadu_si128((const __m128i *)(b + i)));
+        m = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
 
-    if (str->len == 0 || str->len >= CC_UINT64_MAXLEN) {
+    return i + _casediff_sw(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+_find_any_avx2(const uint8_t *p, uint32_t len, const uint8_t *set,
+        uint32_t nset)
+{
+    __m256i c[BSTRING_FIND_NSET], v, eq;
+    uint32_t i, k, m;
+
+    for (k = 0; k < nset; k++) {
+        c[k] = _mm256_set1_epi8((char)set[k]);
+    }
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+        eq = _mm256_cmpeq_epi8(v, c[0]);
+        for (k = 1; k < nset; k++) {
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, c[k]));
+        }
+        m = (uint32_t)_mm256_movemask_epi8(eq);
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+
+    return i + _find_any_sse2(p + i, len - i, set, nset);
+}
+
+__attribute__((target("avx2")))
+static bool
+_equal_avx2(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    __m256i x, y;
+    uint32_t i;
+
+    if (len < 32) {
+        return _equal_sse2(a, b, len);
+    }
+
+    for (i = 0; ; i += 32) {
+        if (i + 32 > len) {
+            i = len - 32;
+        }
+        x = _mm256_loadu_si256((const __m256i *)(a + i));
+        y = _mm256_loadu_si256((const __m256i *)(b + i));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) !=
+                UINT32_MAX) {
+            return false;
+        }
+        if (i + 32 == len) {
+            return true;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+_lower_avx2(__m256i v)
+{
+    __m256i upper = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+_casediff_avx2(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    __m256i x, y;
+    uint32_t i, m;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        x = _lower_avx2(_mm256_loadu_si256((const __m256i *)(a + i)));
+        y = _lower_avx2(_mm256_loadu_si256((const __m256i *)(b + i)));
+        m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (m != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+
+    return i + _casediff_sse2(a + i, b + i, len - i);
+}
+#endif
+
+static uint32_t _find_any_init(const uint8_t *p, uint32_t len,
+        const uint8_t *set, uint32_t nset);
+static bool _equal_init(const uint8_t *a, const uint8_t *b, uint32_t len);
+static uint32_t _casediff_init(const uint8_t *a, const uint8_t *b,
+        uint32_t len);
+
+static find_any_fn find_any_impl = _find_any_init;
+static equal_fn equal_impl = _equal_init;
+static casediff_fn casediff_impl = _casediff_init;
+
+#define SIMD_IMPL(_fn) __atomic_load_n(&(_fn), __ATOMIC_RELAXED)
+
+static void
+_bstring_simd_init(void)
+{
+    find_any_fn find_any = _find_any_swar;
+    equal_fn equal = _equal_sw;
+    casediff_fn casediff = _casediff_sw;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        find_any = _find_any_avx2;
+        equal = _equal_avx2;
+        casediff = _casediff_avx2;
+    } else {
+        find_any = _find_any_sse2;
+        equal = _equal_sse2;
+        casediff = _casediff_sse2;
+    }
+#endif
+
+    /* racing initializers all store the same values */
+    __atomic_store_n(&find_any_impl, find_any, __ATOMIC_RELAXED);
+    __atomic_store_n(&equal_impl, equal, __ATOMIC_RELAXED);
+    __atomic_store_n(&casediff_impl, casediff, __ATOMIC_RELAXED);
+}
+
+static uint32_t
+_find_any_init(const uint8_t *p, uint32_t len, const uint8_t *set,
+        uint32_t nset)
+{
+    _bstring_simd_init();
+
+    return SIMD_IMPL(find_any_impl)(p, len, set, nset);
+}
+
+static bool
+_equal_init(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    _bstring_simd_init();
+
+    return SIMD_IMPL(equal_impl)(a, b, len);
+}
+
+static uint32_t
+_casediff_init(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    _bstring_simd_init();
+
+    return SIMD_IMPL(casediff_impl)(a, b, len);
+}
+
+bool
+bstring_equal(const struct bstring *s1, const struct bstring *s2)
+{
+    const uint8_t *a = (const uint8_t *)s1->data;
+    const uint8_t *b = (const uint8_t *)s2->data;
+    uint32_t len = s1->len;
+    uint64_t x[2], y[2];
+
+    if (len != s2->len) {
+        return false;
+    }
+    if (len == 0 || a == b) {
+        return true;
+    }
+    if (a[0] != b[0]) {
+        return false;
+    }
+
+    /* short strings: two possibly overlapping words cover all bytes */
+    if (len < 4) {
+        return a[len / 2] == b[len / 2] && a[len - 1] == b[len - 1];
+    }
+    if (len < 8) {
+        x[0] = x[1] = y[0] = y[1] = 0;
+        cc_memcpy(x, a, 4);
+        cc_memcpy(x + 1, a + len - 4, 4);
+        cc_memcpy(y, b, 4);
+        cc_memcpy(y + 1, b + len - 4, 4);
+        return ((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0;
+    }
+    if (len <= 16) {
+        cc_memcpy(x, a, 8);
+        cc_memcpy(x + 1, a + len - 8, 8);
+        cc_memcpy(y, b, 8);
+        cc_memcpy(y + 1, b + len - 8, 8);
+        return ((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0;
+    }
+
+    return SIMD_IMPL(equal_impl)(a, b, len);
+}
+
+int
+bstring_casecmp(const struct bstring *s1, const struct bstring *s2)
+{
+    const uint8_t *a = (const uint8_t *)s1->data;
+    const uint8_t *b = (const uint8_t *)s2->data;
+    uint32_t i;
+
+    if (s1->len != s2->len) {
+        return s1->len > s2->len ? 256 : -256;
+    }
+
+    i = SIMD_IMPL(casediff_impl)(a, b, s1->len);
+    if (i == s1->len) {
+        return 0;
+    }
+
+    return (int)_lower(a[i]) - (int)_lower(b[i]);
+}
+
+uint32_t
+bstring_find(const struct bstring *str, uint32_t off, char c)
+{
+    const char *p;
+
+    ASSERT(off <= str->len);
+
+    if (off == str->len) {
+        return str->len;
+    }
+
+    /* a single byte is what memchr is for, and libc already vectorizes it */
+    p = cc_memchr(str->data + off, c, str->len - off);
+
+    return (p == NULL) ? str->len : (uint32_t)(p - str->data);
+}
+
+uint32_t
+bstring_find_any(const struct bstring *str, uint32_t off, const char *set,
+        uint32_t nset)
+{
+    ASSERT(off <= str->len);
+    ASSERT(nset > 0 && nset <= BSTRING_FIND_NSET);
+
+    return off + SIMD_IMPL(find_any_impl)((const uint8_t *)str->data + off,
+            str->len - off, (const uint8_t *)set, nset);
+}
+
+uint32_t
+bstring_find_crlf(const struct bstring *str, uint32_t off)
+{
+    uint32_t i;
+
+    for (i = off; (i = bstring_find(str, i, '\r')) + 1 < str->len; i++) {
+        if (str->data[i + 1] == '\n') {
+            return i;
+        }
+    }
+
+    return str->len;
+}
+
+/*
+ * value of the 8 ASCII digits at p, first digit most significant, or
+ * UINT64_MAX if any of them isn't a digit. This does in three multiplies what
+ * would otherwise take 8 dependent multiply-adds: it combines neighboring
+ * digits into 2-digit, then 4-digit, then the 8-digit value.
+ */
+static inline uint64_t
+_parse8(const char *p)
+{
+    uint64_t w;
+
+    cc_memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+
+    /* every byte in 0x30-0x39: high nibble is 3, and stays 3 after adding 6 */
+    if ((w & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL ||
+            ((w + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) !=
+            0x3030303030303030ULL) {
+        return UINT64_MAX;
+    }
+
+    w -= 0x3030303030303030ULL;
+    w = (w * (1 + (10 << 8))) >> 8;
+    w = ((w & 0x00ff00ff00ff00ffULL) * (1 + (100ULL << 16))) >> 16;
+    w = ((w & 0x0000ffff0000ffffULL) * (1 + (10000ULL << 32))) >> 32;
+
+    return w;
+}
+
+static rstatus_i
+_atou64(uint64_t *u64, const char *p, uint32_t len)
+{
+    uint64_t v = 0, d;
+    uint32_t i, head = len % 8;
+    uint8_t c;
+
+    if (len == 0 || len >= CC_UINT64_MAXLEN) {
         return CC_ERROR;
     }
 
-    for (offset = 0; offset < str->len; offset++) {
-        c = *(str->data + offset);
-        if (c < '0' || c > '9') {
+    /* the leading len % 8 digits can't overflow */
+    for (i = 0; i < head; i++) {
+        c = (uint8_t)(p[i] - '0');
+        if (c > 9) {
             return CC_ERROR;
         }
+        v = v * 10 + c;
+    }
 
-        // overflow check
-        if (offset == CC_UINT64_MAXLEN - 2 && *u64 == UINT64_MAX / 10 &&
-                c > UINT64_MAX % 10 + '0') {
+    for (; i < len; i += 8) {
+        d = _parse8(p + i);
+        if (d == UINT64_MAX || __builtin_mul_overflow(v, 100000000ULL, &v) ||
+                __builtin_add_overflow(v, d, &v)) {
             return CC_ERROR;
         }
+    }
+
+    *u64 = v;
 
-        *u64 = *u64 * 10ULL + (uint64_t)(c - '0');
+    return CC_OK;
+}
+
+rstatus_i
+bstring_atou64(uint64_t *u64, struct bstring *str)
+{
+    *u64 = 0ULL;
+
+    return _atou64(u64, str->data, str->len);
+}
+
+rstatus_i
+bstring_atou64_bounded(uint64_t *u64, struct bstring *str, uint64_t max)
+{
+    uint64_t v;
+
+    *u64 = 0ULL;
+
+    if (_atou64(&v, str->data, str->len) != CC_OK || v > max) {
+        return CC_ERROR;
     }
 
+    *u64 = v;
+
+    return CC_OK;
+}
+
+rstatus_i
+bstring_atoi64(int64_t *i64, struct bstring *str)
+{
+    uint64_t v;
+    bool neg = false;
+    uint32_t off = 0;
+
+    *i64 = 0;
+
+    if (str->len > 0 && (str->data[0] == '-' || str->data[0] == '+')) {
+        neg = (str->data[0] == '-');
+        off = 1;
+    }
+
+    if (_atou64(&v, str->data + off, str->len - off) != CC_OK ||
+            v > (uint64_t)INT64_MAX + neg) {
+        return CC_ERROR;
+    }
+
+    *i64 = neg ? (int64_t)(0 - v) : (int64_t)v;
+
     return CC_OK;
 }
 
@@ -174,3 +659,63 @@ bstring_free(struct bstring **ptr)
     cc_free(bs);
     *ptr = NULL;
 }
+
+void
+bstring_sso_init(struct bstring_sso *str)
+{
+    str->len = 0;
+    str->buf[0] = '\0';
+}
+
+void
+bstring_sso_deinit(struct bstring_sso *str)
+{
+    if (!bstring_sso_inline(str)) {
+        cc_free(str->ptr);
+    }
+    bstring_sso_init(str);
+}
+
+rstatus_i
+bstring_sso_copy(struct bstring_sso *dst, const char *src, uint32_t srclen)
+{
+    char *data;
+
+    ASSERT(dst->len == 0);
+    ASSERT(src != NULL || srclen == 0);
+
+    if (srclen <= BSTRING_SSO_MAX) {
+        data = dst->buf;
+    } else {
+        data = (char *)cc_alloc(srclen);
+        if (data == NULL) {
+            return CC_ENOMEM;
+        }
+        dst->ptr = data;
+    }
+
+    if (srclen > 0) {
+        cc_memcpy(data, src, srclen);
+    }
+    dst->len = srclen;
+
+    return CC_OK;
+}
+
+rstatus_i
+bstring_sso_from_bstring(struct bstring_sso *dst, const struct bstring *src)
+{
+    return bstring_sso_copy(dst, src->data, src->len);
+}
+
+rstatus_i
+bstring_sso_to_bstring(struct bstring *dst, const struct bstring_sso *src)
+{
+    if (src->len == 0) {
+        bstring_init(dst);
+        return CC_OK;
+    }
+
+    return bstring_copy(dst, bstring_sso_inline(src) ? src->buf : src->ptr,
+            src->len);
+}
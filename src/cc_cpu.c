@@ -0,0 +1,301 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_cpu.h>
+
+#include <cc_debug.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef OS_LINUX
+#include <sched.h>
+#endif
+
+#define CPU_MODULE_NAME "ccommon::cpu"
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+static bool cpu_init = false;
+static struct cpu_info cpus[CPU_MAX];
+static uint32_t ncpu = 0;
+static uint32_t nnode = 1;
+
+/* read a single integer from a sysfs file, or return CPU_UNKNOWN */
+static int
+_sysfs_int(const char *fmt, int cpu)
+{
+    char path[128];
+    FILE *f;
+    int val;
+
+    snprintf(path, sizeof(path), fmt, cpu);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return CPU_UNKNOWN;
+    }
+    if (fscanf(f, "%d", &val) != 1) {
+        val = CPU_UNKNOWN;
+    }
+    fclose(f);
+
+    return val;
+}
+
+/* each cpu directory has a nodeN link to the node it belongs to */
+static int
+_sysfs_node(int cpu)
+{
+    char path[128];
+    struct dirent *ent;
+    DIR *dir;
+    int node = 0;
+
+    snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "node", 4) == 0 &&
+                sscanf(ent->d_name + 4, "%d", &node) == 1) {
+            break;
+        }
+    }
+    closedir(dir);
+
+    return node;
+}
+
+static void
+_cpu_add(int cpu)
+{
+    struct cpu_info *c = &cpus[ncpu++];
+
+    c->cpu = cpu;
+    c->core = _sysfs_int(CPU_SYSFS "/cpu%d/topology/core_id", cpu);
+    c->package = _sysfs_int(CPU_SYSFS
+            "/cpu%d/topology/physical_package_id", cpu);
+    c->node = _sysfs_node(cpu);
+    if ((uint32_t)c->node >= nnode) {
+        nnode = (uint32_t)c->node + 1;
+    }
+}
+
+void
+cpu_setup(void)
+{
+#ifdef OS_LINUX
+    cpu_set_t set;
+#endif
+    int i;
+
+    log_info("set up the %s module", CPU_MODULE_NAME);
+
+    if (cpu_init) {
+        log_warn("%s has already been setup, overwrite", CPU_MODULE_NAME);
+    }
+
+    ncpu = 0;
+    nnode = 1;
+#ifdef OS_LINUX
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (i = 0; i < CPU_MAX && i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set)) {
+                _cpu_add(i);
+            }
+        }
+    } else {
+        log_warn("get cpu affinity failed, assuming all online cpus: %s",
+                strerror(errno));
+    }
+#endif
+    if (ncpu == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        for (i = 0; i < CPU_MAX && i < n; i++) {
+            _cpu_add(i);
+        }
+    }
+
+    log_info("%"PRIu32" usable cpus on %"PRIu32" numa nodes", ncpu, nnode);
+
+    cpu_init = true;
+}
+
+void
+cpu_teardown(void)
+{
+    log_info("tear down the %s module", CPU_MODULE_NAME);
+
+    if (!cpu_init) {
+        log_warn("%s has never been setup", CPU_MODULE_NAME);
+    }
+
+    ncpu = 0;
+    nnode = 1;
+    cpu_init = false;
+}
+
+uint32_t
+cpu_count(void)
+{
+    return ncpu;
+}
+
+const struct cpu_info *
+cpu_get(uint32_t i)
+{
+    ASSERT(i < ncpu);
+
+    return &cpus[i];
+}
+
+uint32_t
+cpu_nnode(void)
+{
+    return nnode;
+}
+
+int
+cpu_node(int cpu)
+{
+    uint32_t i;
+
+    if (cpu < 0) {
+        return 0;
+    }
+
+    for (i = 0; i < ncpu; i++) {
+        if (cpus[i].cpu == cpu) {
+            return cpus[i].node;
+        }
+    }
+
+    return _sysfs_node(cpu);
+}
+
+int
+cpu_current(void)
+{
+#ifdef OS_LINUX
+    int cpu = sched_getcpu();
+
+    return cpu < 0 ? CPU_UNKNOWN : cpu;
+#else
+    return CPU_UNKNOWN;
+#endif
+}
+
+#ifdef OS_LINUX
+static rstatus_i
+_cpu_pin_set(cpu_set_t *set)
+{
+    if (CPU_COUNT(set) == 0) {
+        return CC_EINVAL;
+    }
+
+    if (sched_setaffinity(0, sizeof(*set), set) < 0) {
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+#endif
+
+rstatus_i
+cpu_pin(int cpu)
+{
+#ifdef OS_LINUX
+    cpu_set_t set;
+    rstatus_i status;
+
+    CPU_ZERO(&set);
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+    }
+
+    status = _cpu_pin_set(&set);
+    if (status != CC_OK) {
+        log_warn("pin to cpu %d failed: %s", cpu, status == CC_EINVAL ?
+                "no such cpu" : strerror(errno));
+    }
+
+    return status;
+#else
+    log_warn("pinning to cpu %d not supported", cpu);
+    return CC_ERROR;
+#endif
+}
+
+rstatus_i
+cpu_pin_node(int node)
+{
+#ifdef OS_LINUX
+    cpu_set_t set;
+    rstatus_i status;
+    uint32_t i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < ncpu; i++) {
+        if (cpus[i].node == node) {
+            CPU_SET(cpus[i].cpu, &set);
+        }
+    }
+
+    status = _cpu_pin_set(&set);
+    if (status != CC_OK) {
+        log_warn("pin to node %d failed: %s", node, status == CC_EINVAL ?
+                "no usable cpu on node" : strerror(errno));
+    }
+
+    return status;
+#else
+    log_warn("pinning to node %d not supported", node);
+    return CC_ERROR;
+#endif
+}
+
+rstatus_i
+cpu_unpin(void)
+{
+#ifdef OS_LINUX
+    cpu_set_t set;
+    rstatus_i status;
+    uint32_t i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < ncpu; i++) {
+        CPU_SET(cpus[i].cpu, &set);
+    }
+
+    status = _cpu_pin_set(&set);
+    if (status != CC_OK) {
+        log_warn("unpin from cpu failed: %s", status == CC_EINVAL ?
+                "cpu module not set up" : strerror(errno));
+    }
+
+    return status;
+#else
+    return CC_ERROR;
+#endif
+}
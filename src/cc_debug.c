@@ -28,6 +28,7 @@
 #include <execinfo.h>
 #endif /* CC_BACKTRACE */
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -114,11 +115,432 @@ debug_log_flush(void *arg)
     log_flush(dlog->logger);
 }
 
+/*
+ * Deferred formatting: instead of the message, _log packs a record holding the
+ * format string pointer, the source location, a timestamp and the arguments,
+ * one after another in the order the format string consumes them, and
+ * _log_render formats it when the log buffer is flushed.
+ */
+struct debug_rec {
+    const char      *fmt;
+    const char      *file;
+    int64_t         time;
+    int32_t         line;
+    int32_t         level;
+};
+
+enum fmt_length {
+    FMT_LEN_NONE,
+    FMT_LEN_HH,
+    FMT_LEN_H,
+    FMT_LEN_L,
+    FMT_LEN_LL,
+    FMT_LEN_J,
+    FMT_LEN_Z,
+    FMT_LEN_T,
+    FMT_LEN_LD
+};
+
+#define FMT_SPEC_MAX 32 /* max length of a single conversion specification */
+
+struct fmt_spec {
+    int             nstar;      /* # of `*' width/precision arguments */
+    bool            star_prec;  /* precision is the last `*' argument */
+    int             prec;       /* -1 if not given as digits */
+    enum fmt_length length;
+    char            conv;
+};
+
+/* parse the conversion specification at p (a `%'), returns its end or NULL */
+static const char *
+_fmt_spec(const char *p, struct fmt_spec *s)
+{
+    s->nstar = 0;
+    s->star_prec = false;
+    s->prec = -1;
+    s->length = FMT_LEN_NONE;
+
+    for (p++; *p != '\0' && strchr("-+ #0'", *p) != NULL; p++);
+
+    if (*p == '*') {
+        s->nstar++;
+        p++;
+    } else {
+        for (; isdigit((unsigned char)*p); p++);
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->nstar++;
+            s->star_prec = true;
+            p++;
+        } else {
+            for (s->prec = 0; isdigit((unsigned char)*p); p++) {
+                s->prec = s->prec * 10 + (*p - '0');
+            }
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        s->length = (*++p == 'h') ? (p++, FMT_LEN_HH) : FMT_LEN_H;
+        break;
+    case 'l':
+        s->length = (*++p == 'l') ? (p++, FMT_LEN_LL) : FMT_LEN_L;
+        break;
+    case 'j':
+        s->length = FMT_LEN_J;
+        p++;
+        break;
+    case 'z':
+        s->length = FMT_LEN_Z;
+        p++;
+        break;
+    case 't':
+        s->length = FMT_LEN_T;
+        p++;
+        break;
+    case 'L':
+        s->length = FMT_LEN_LD;
+        p++;
+        break;
+    default:
+        break;
+    }
+
+    s->conv = *p;
+    if (*p == '\0' || strchr("diouxXcspeEfFgGaA", *p) == NULL) {
+        return NULL;
+    }
+    if ((*p == 'c' || *p == 's') && s->length != FMT_LEN_NONE) {
+        return NULL; /* wide characters are not supported */
+    }
+
+    return p + 1;
+}
+
+#define _PACK(_v) do {                                              \
+    if (len + sizeof(_v) > size) {                                  \
+        return len;                                                 \
+    }                                                               \
+    memcpy(buf + len, &(_v), sizeof(_v));                           \
+    len += sizeof(_v);                                              \
+} while (0)
+
+static size_t
+_log_pack(char *buf, size_t size, const char *file, int line, int level,
+        const char *fmt, va_list args)
+{
+    struct debug_rec rec = {fmt, file, (int64_t)time(NULL), line, level};
+    struct fmt_spec s;
+    const char *p, *str;
+    size_t len = sizeof(rec);
+    uint32_t n;
+    int star[2], i, prec;
+    int64_t vi;
+    uint64_t vu;
+    double vd;
+    long double vld;
+    void *vp;
+
+    memcpy(buf, &rec, sizeof(rec));
+
+    for (p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%')) {
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+        p = _fmt_spec(p, &s);
+        if (p == NULL) {
+            break;
+        }
+
+        for (i = 0; i < s.nstar; i++) {
+            star[i] = va_arg(args, int);
+            _PACK(star[i]);
+        }
+
+        switch (s.conv) {
+        case 'd':
+        case 'i':
+            switch (s.length) {
+            case FMT_LEN_L:
+                vi = va_arg(args, long);
+                break;
+            case FMT_LEN_LL:
+                vi = va_arg(args, long long);
+                break;
+            case FMT_LEN_J:
+                vi = va_arg(args, intmax_t);
+                break;
+            case FMT_LEN_Z:
+                vi = va_arg(args, ssize_t);
+                break;
+            case FMT_LEN_T:
+                vi = va_arg(args, ptrdiff_t);
+                break;
+            default:
+                vi = va_arg(args, int);
+                break;
+            }
+            _PACK(vi);
+            break;
+
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (s.length) {
+            case FMT_LEN_L:
+                vu = va_arg(args, unsigned long);
+                break;
+            case FMT_LEN_LL:
+                vu = va_arg(args, unsigned long long);
+                break;
+            case FMT_LEN_J:
+                vu = va_arg(args, uintmax_t);
+                break;
+            case FMT_LEN_Z:
+                vu = va_arg(args, size_t);
+                break;
+            case FMT_LEN_T:
+                vu = va_arg(args, ptrdiff_t);
+                break;
+            default:
+                vu = va_arg(args, unsigned int);
+                break;
+            }
+            _PACK(vu);
+            break;
+
+        case 'c':
+            vi = va_arg(args, int);
+            _PACK(vi);
+            break;
+
+        case 's':
+            str = va_arg(args, const char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            if (len + sizeof(n) + 1 > size) {
+                return len;
+            }
+            prec = s.star_prec ? star[s.nstar - 1] : s.prec;
+            n = strnlen(str, size - len - sizeof(n) - 1);
+            if (prec >= 0 && (uint32_t)prec < n) {
+                n = prec;
+            }
+            _PACK(n);
+            memcpy(buf + len, str, n);
+            len += n;
+            buf[len++] = '\0';
+            break;
+
+        case 'p':
+            vp = va_arg(args, void *);
+            _PACK(vp);
+            break;
+
+        default: /* floating point */
+            if (s.length == FMT_LEN_LD) {
+                vld = va_arg(args, long double);
+                _PACK(vld);
+            } else {
+                vd = va_arg(args, double);
+                _PACK(vd);
+            }
+            break;
+        }
+    }
+
+    return len;
+}
+
+#undef _PACK
+
+#define _UNPACK(_v) do {                                            \
+    if (off + sizeof(_v) > nrec) {                                  \
+        goto truncated;                                             \
+    }                                                               \
+    memcpy(&(_v), rec + off, sizeof(_v));                           \
+    off += sizeof(_v);                                              \
+} while (0)
+
+#define _EMIT(_v) do {                                              \
+    if (s.nstar == 0) {                                             \
+        len += cc_scnprintf(buf + len, lim - len, spec, _v);        \
+    } else if (s.nstar == 1) {                                      \
+        len += cc_scnprintf(buf + len, lim - len, spec, star[0], _v);\
+    } else {                                                        \
+        len += cc_scnprintf(buf + len, lim - len, spec, star[0],    \
+                star[1], _v);                                       \
+    }                                                               \
+} while (0)
+
+static size_t
+_log_render(char *buf, size_t size, const void *data, uint32_t nrec)
+{
+    const char *rec = data, *p, *q, *str;
+    char spec[FMT_SPEC_MAX], timestr[32];
+    struct debug_rec hdr;
+    struct fmt_spec s;
+    struct tm local;
+    time_t t;
+    size_t len = 0, lim = size - 1, off = sizeof(hdr), n;
+    bool literal = false;
+    uint32_t slen;
+    int star[2], i;
+    int64_t vi;
+    uint64_t vu;
+    double vd;
+    long double vld;
+    void *vp;
+
+    if (nrec < sizeof(hdr) || size == 0) {
+        return 0;
+    }
+    memcpy(&hdr, rec, sizeof(hdr));
+
+    t = (time_t)hdr.time;
+    localtime_r(&t, &local);
+    asctime_r(&local, timestr);
+    len += cc_scnprintf(buf + len, lim - len, "[%.*s][%s] %s:%d ",
+            strlen(timestr) - 1, timestr, level_str[hdr.level], hdr.file,
+            hdr.line);
+
+    for (p = hdr.fmt; *p != '\0' && len < lim;) {
+        if (literal || *p != '%') {
+            q = literal ? NULL : strchr(p, '%');
+            n = (q == NULL) ? strlen(p) : (size_t)(q - p);
+            n = MIN(n, lim - len);
+            memcpy(buf + len, p, n);
+            len += n;
+            p += n;
+            continue;
+        }
+        if (p[1] == '%') {
+            buf[len++] = '%';
+            p += 2;
+            continue;
+        }
+        q = _fmt_spec(p, &s);
+        if (q == NULL || q - p >= FMT_SPEC_MAX) {
+            goto truncated;
+        }
+        memcpy(spec, p, q - p);
+        spec[q - p] = '\0';
+
+        for (i = 0; i < s.nstar; i++) {
+            _UNPACK(star[i]);
+        }
+
+        switch (s.conv) {
+        case 'd':
+        case 'i':
+            _UNPACK(vi);
+            switch (s.length) {
+            case FMT_LEN_L:
+                _EMIT((long)vi);
+                break;
+            case FMT_LEN_LL:
+                _EMIT((long long)vi);
+                break;
+            case FMT_LEN_J:
+                _EMIT((intmax_t)vi);
+                break;
+            case FMT_LEN_Z:
+                _EMIT((ssize_t)vi);
+                break;
+            case FMT_LEN_T:
+                _EMIT((ptrdiff_t)vi);
+                break;
+            default:
+                _EMIT((int)vi);
+                break;
+            }
+            break;
+
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            _UNPACK(vu);
+            switch (s.length) {
+            case FMT_LEN_L:
+                _EMIT((unsigned long)vu);
+                break;
+            case FMT_LEN_LL:
+                _EMIT((unsigned long long)vu);
+                break;
+            case FMT_LEN_J:
+                _EMIT((uintmax_t)vu);
+                break;
+            case FMT_LEN_Z:
+                _EMIT((size_t)vu);
+                break;
+            case FMT_LEN_T:
+                _EMIT((ptrdiff_t)vu);
+                break;
+            default:
+                _EMIT((unsigned int)vu);
+                break;
+            }
+            break;
+
+        case 'c':
+            _UNPACK(vi);
+            _EMIT((int)vi);
+            break;
+
+        case 's':
+            _UNPACK(slen);
+            if (off + slen + 1 > nrec) {
+                goto truncated;
+            }
+            str = rec + off;
+            off += slen + 1;
+            _EMIT(str);
+            break;
+
+        case 'p':
+            _UNPACK(vp);
+            _EMIT(vp);
+            break;
+
+        default: /* floating point */
+            if (s.length == FMT_LEN_LD) {
+                _UNPACK(vld);
+                _EMIT(vld);
+            } else {
+                _UNPACK(vd);
+                _EMIT(vd);
+            }
+            break;
+        }
+        p = q;
+        continue;
+
+truncated:
+        /* arguments were dropped when packing, log the rest of the format */
+        literal = true;
+    }
+
+    buf[len++] = '\n';
+
+    return len;
+}
+
+#undef _UNPACK
+#undef _EMIT
+
 rstatus_i
 debug_setup(debug_options_st *options)
 {
     size_t log_nbuf = DEBUG_LOG_NBUF;
     char *filename = DEBUG_LOG_FILE;
+    bool defer = DEBUG_LOG_DEFER;
 
     /* since logs are not setup yet, we have to log to stderr */
     log_stderr("Set up the %s module", DEBUG_MODULE_NAME);
@@ -135,6 +557,7 @@ debug_setup(debug_options_st *options)
         filename = option_str(&options->debug_log_file);
         log_nbuf = option_uint(&options->debug_log_nbuf);
         dlog->level = option_uint(&options->debug_log_level);
+        defer = option_bool(&options->debug_log_defer);
     }
 
     dlog->logger = log_create(filename, log_nbuf);
@@ -143,6 +566,11 @@ debug_setup(debug_options_st *options)
         goto error;
     }
 
+    if (defer && log_set_render(dlog->logger, _log_render) != CC_OK) {
+        log_stderr("Could not set up deferred log formatting");
+        goto error;
+    }
+
     /* some adjustment on signal handling */
     if (signal_override(SIGSEGV, "printing stacktrace when segfault", 0, 0,
             _stacktrace) < 0) {
@@ -178,11 +606,34 @@ debug_teardown(void)
     debug_init = false;
 }
 
+rstatus_i
+debug_apply(struct option *opt, option_val_u old, void *arg)
+{
+    debug_options_st *options = arg;
+
+    (void)old;
+
+    if (opt == &options->debug_log_level) {
+        __atomic_store_n(&dlog->level, (int)option_uint(opt), __ATOMIC_RELAXED);
+        log_info("debug log level changed to %d", dlog->level);
+        return CC_OK;
+    }
+
+    /* the logger itself is only created at setup */
+    if (opt >= (struct option *)options &&
+            opt < (struct option *)(options + 1)) {
+        log_warn("option '%s' needs a restart to change", opt->name);
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
 void
 _log(struct debug_logger *dl, const char *file, int line, int level, const char *fmt, ...)
 {
     int len, size, errno_save;
-    char buf[LOG_MAX_LEN], *timestr;
+    char buf[LOG_MAX_LEN], *timestr, *out;
     va_list args;
     struct tm *local;
     time_t t;
@@ -192,23 +643,45 @@ _log(struct debug_logger *dl, const char *file, int line, int level, const char
     }
 
     errno_save = errno;
+
+    if (dl->logger->render != NULL) {
+        va_start(args, fmt);
+        len = _log_pack(buf, LOG_MAX_LEN, file, line, level, fmt, args);
+        va_end(args);
+
+        log_write_deferred(dl->logger, buf, len);
+
+        errno = errno_save;
+        return;
+    }
+
     len = 0;            /* length of output buffer */
     size = LOG_MAX_LEN; /* size of output buffer */
 
+    /* format in place in the log buffer if it has room, saving a copy */
+    out = log_reserve(dl->logger, size);
+    if (out == NULL) {
+        out = buf;
+    }
+
     t = time(NULL);
     local = localtime(&t);
     timestr = asctime(local);
 
-    len += cc_scnprintf(buf + len, size - len, "[%.*s][%s] %s:%d ",
+    len += cc_scnprintf(out + len, size - len, "[%.*s][%s] %s:%d ",
             strlen(timestr) - 1, timestr, level_str[level], file, line);
 
     va_start(args, fmt);
-    len += cc_vscnprintf(buf + len, size - len, fmt, args);
+    len += cc_vscnprintf(out + len, size - len, fmt, args);
     va_end(args);
 
-    buf[len++] = '\n';
+    out[len++] = '\n';
 
-    log_write(dl->logger, buf, len);
+    if (out == buf) {
+        log_write(dl->logger, buf, len);
+    } else {
+        log_commit(dl->logger, len);
+    }
 
     errno = errno_save;
 }
@@ -0,0 +1,507 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_htable.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HTABLE_MODULE_NAME "ccommon::htable"
+
+static bool htable_init = false;
+static htable_metrics_st *htable_metrics = NULL;
+static uint32_t migrate_step = HTABLE_MIGRATE_STEP;
+static uint32_t migrate_tick = HTABLE_MIGRATE_TICK;
+
+/*
+ * control bytes: a full slot holds the low 7 bits of its hash (H2), so the
+ * high bit tells free slots from full ones. The remaining hash bits (H1) pick
+ * the first group to probe, and further groups are visited in triangular
+ * order, which covers every group when ngroup is a power of 2.
+ */
+#define CTRL_EMPTY      0x80
+#define CTRL_DELETED    0xfe
+
+#define H1(_h)          ((uint32_t)((_h) >> 7))
+#define H2(_h)          ((uint8_t)((_h) & 0x7f))
+
+#define GROUP_CTRL(_t, _g) ((_t)->ctrl + (size_t)(_g) * HTABLE_GROUP)
+
+/* bitmask of the slots in group whose control byte equals b */
+static inline uint32_t
+_group_match(const uint8_t *ctrl, uint8_t b)
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b)));
+#else
+    uint32_t i, m = 0;
+
+    for (i = 0; i < HTABLE_GROUP; i++) {
+        m |= (uint32_t)(ctrl[i] == b) << i;
+    }
+
+    return m;
+#endif
+}
+
+/* bitmask of the slots in group that are empty or deleted */
+static inline uint32_t
+_group_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t i, m = 0;
+
+    for (i = 0; i < HTABLE_GROUP; i++) {
+        m |= (uint32_t)(ctrl[i] >> 7) << i;
+    }
+
+    return m;
+#endif
+}
+
+static rstatus_i
+_tab_create(struct htable_tab *tab, uint32_t ngroup)
+{
+    size_t nslot = (size_t)ngroup * HTABLE_GROUP;
+
+    tab->ctrl = cc_alloc(nslot);
+    tab->slot = cc_alloc(nslot * sizeof(struct htable_slot));
+    if (tab->ctrl == NULL || tab->slot == NULL) {
+        log_info("htable table creation failed due to OOM");
+        cc_free(tab->ctrl);
+        cc_free(tab->slot);
+        tab->ctrl = NULL;
+        tab->slot = NULL;
+
+        return CC_ENOMEM;
+    }
+
+    memset(tab->ctrl, CTRL_EMPTY, nslot);
+    tab->ngroup = ngroup;
+    tab->nentry = 0;
+    /* keep the load factor at or below 7/8 so every probe meets an empty */
+    tab->growth = nslot - nslot / 8;
+
+    return CC_OK;
+}
+
+static void
+_tab_destroy(struct htable_tab *tab)
+{
+    cc_free(tab->ctrl);
+    cc_free(tab->slot);
+    tab->ctrl = NULL;
+    tab->slot = NULL;
+    tab->ngroup = 0;
+    tab->nentry = 0;
+    tab->growth = 0;
+}
+
+static struct htable_slot *
+_tab_find(const struct htable_tab *tab, const struct bstring *key,
+        uint64_t hash)
+{
+    uint32_t mask = tab->ngroup - 1, g = H1(hash) & mask, step = 0, m;
+    const uint8_t *ctrl;
+    struct htable_slot *s;
+
+    if (tab->nentry == 0) {
+        return NULL;
+    }
+
+    for (;;) {
+        ctrl = GROUP_CTRL(tab, g);
+        for (m = _group_match(ctrl, H2(hash)); m != 0; m &= m - 1) {
+            s = &tab->slot[(size_t)g * HTABLE_GROUP + __builtin_ctz(m)];
+            if (s->hash == hash && s->key.len == key->len &&
+                    cc_bcmp(s->key.data, key->data, key->len) == 0) {
+                return s;
+            }
+        }
+        if (_group_match(ctrl, CTRL_EMPTY) != 0) {
+            return NULL;
+        }
+        g = (g + ++step) & mask;
+    }
+}
+
+/* key must not be in the table, and the table must have growth left */
+static void
+_tab_insert(struct htable_tab *tab, const struct bstring *key, void *val,
+        uint64_t hash)
+{
+    uint32_t mask = tab->ngroup - 1, g = H1(hash) & mask, step = 0, m;
+    size_t i;
+    struct htable_slot *s;
+
+    ASSERT(tab->growth > 0);
+
+    while ((m = _group_free(GROUP_CTRL(tab, g))) == 0) {
+        g = (g + ++step) & mask;
+    }
+
+    i = (size_t)g * HTABLE_GROUP + __builtin_ctz(m);
+    if (tab->ctrl[i] == CTRL_EMPTY) {
+        tab->growth--;
+    }
+    tab->ctrl[i] = H2(hash);
+    s = &tab->slot[i];
+    s->key = *key;
+    s->val = val;
+    s->hash = hash;
+    tab->nentry++;
+}
+
+static void
+_tab_erase(struct htable_tab *tab, struct htable_slot *s)
+{
+    size_t i = s - tab->slot;
+
+    /*
+     * a probe that reaches a group with an empty slot stops there anyway, so
+     * the slot can be reused outright; otherwise leave a tombstone to keep
+     * longer probe sequences going through this group
+     */
+    if (_group_match(GROUP_CTRL(tab, i / HTABLE_GROUP), CTRL_EMPTY) != 0) {
+        tab->ctrl[i] = CTRL_EMPTY;
+        tab->growth++;
+    } else {
+        tab->ctrl[i] = CTRL_DELETED;
+    }
+    tab->nentry--;
+}
+
+/* move up to n groups from the old table into the current one */
+static void
+_migrate(struct htable *ht, uint32_t n)
+{
+    struct htable_tab *old = &ht->old;
+    struct htable_slot *s;
+    size_t i;
+    uint32_t m, ngroup = 0, nentry = old->nentry;
+
+    (void)nentry; /* only read by the metrics, if compiled in */
+
+    for (; n > 0 && old->nentry > 0; n--, ht->migrate++, ngroup++) {
+        ASSERT(ht->migrate < old->ngroup);
+
+        i = (size_t)ht->migrate * HTABLE_GROUP;
+        m = ~_group_free(GROUP_CTRL(old, ht->migrate)) & 0xffff;
+        for (; m != 0; m &= m - 1) {
+            s = &old->slot[i + __builtin_ctz(m)];
+            _tab_insert(&ht->cur, &s->key, s->val, s->hash);
+            /* tombstone, so lookups still probe past a migrated group */
+            old->ctrl[i + __builtin_ctz(m)] = CTRL_DELETED;
+            old->nentry--;
+        }
+    }
+    INCR_N(htable_metrics, htable_migrate_group, ngroup);
+    INCR_N(htable_metrics, htable_migrate_entry, nentry - old->nentry);
+
+    if (old->nentry > 0) {
+        DECR_N(htable_metrics, htable_migrate_pending, ngroup);
+        return;
+    }
+
+    /* groups past the last entry need no visit */
+    log_verb("htable %p done migrating %"PRIu32" groups", ht, old->ngroup);
+    DECR_N(htable_metrics, htable_migrate_pending,
+            old->ngroup - ht->migrate + ngroup);
+    DECR(htable_metrics, htable_migrating);
+    _tab_destroy(old);
+    ht->migrate = 0;
+}
+
+static rstatus_i
+_grow(struct htable *ht)
+{
+    struct htable_tab tab;
+    uint32_t ngroup = ht->cur.ngroup;
+
+    /*
+     * only one migration at a time: finish the current one first, which put
+     * makes sure cur has room for
+     */
+    if (htable_migrating(ht)) {
+        INCR(htable_metrics, htable_migrate_sync);
+        _migrate(ht, UINT32_MAX);
+        if (ht->cur.growth > 0) {
+            return CC_OK;
+        }
+    }
+
+    /* if at least half of the used slots are tombstones, rehash at same size */
+    if (ht->cur.nentry > ngroup * (HTABLE_GROUP * 7 / 16)) {
+        if (ngroup > UINT32_MAX / (2 * HTABLE_GROUP)) {
+            INCR(htable_metrics, htable_resize_ex);
+            return CC_ENOMEM;
+        }
+        ngroup *= 2;
+    }
+
+    if (_tab_create(&tab, ngroup) != CC_OK) {
+        INCR(htable_metrics, htable_resize_ex);
+        return CC_ENOMEM;
+    }
+
+    if (ngroup > ht->cur.ngroup) {
+        INCR(htable_metrics, htable_resize);
+    } else {
+        INCR(htable_metrics, htable_rehash);
+    }
+    INCR(htable_metrics, htable_migrating);
+    INCR_N(htable_metrics, htable_migrate_pending, ht->cur.ngroup);
+
+    log_verb("htable %p resizing from %"PRIu32" to %"PRIu32" groups", ht,
+            ht->cur.ngroup, ngroup);
+
+    ht->old = ht->cur;
+    ht->cur = tab;
+    ht->migrate = 0;
+
+    return CC_OK;
+}
+
+static inline uint64_t
+_hash(const struct htable *ht, const struct bstring *key)
+{
+    return ht->hash(key->data, key->len, ht->seed);
+}
+
+void
+htable_setup(htable_options_st *options, htable_metrics_st *metrics)
+{
+    log_info("set up the %s module", HTABLE_MODULE_NAME);
+
+    if (htable_init) {
+        log_warn("%s has already been setup, overwrite", HTABLE_MODULE_NAME);
+    }
+
+    htable_metrics = metrics;
+
+    if (options != NULL) {
+        migrate_step = option_uint(&options->htable_migrate_step);
+        migrate_tick = option_uint(&options->htable_migrate_tick);
+    }
+
+    htable_init = true;
+}
+
+void
+htable_teardown(void)
+{
+    log_info("tear down the %s module", HTABLE_MODULE_NAME);
+
+    if (!htable_init) {
+        log_warn("%s has never been setup", HTABLE_MODULE_NAME);
+    }
+
+    htable_metrics = NULL;
+    migrate_step = HTABLE_MIGRATE_STEP;
+    migrate_tick = HTABLE_MIGRATE_TICK;
+    htable_init = false;
+}
+
+struct htable *
+htable_create(uint32_t nentry, hash_fn hash)
+{
+    struct htable *ht;
+    uint32_t ngroup = 1;
+
+    while ((uint64_t)ngroup * (HTABLE_GROUP - HTABLE_GROUP / 8) < nentry) {
+        ngroup *= 2;
+    }
+
+    ht = cc_alloc(sizeof(struct htable));
+    if (ht == NULL) {
+        log_info("htable creation failed due to OOM");
+        INCR(htable_metrics, htable_create_ex);
+
+        return NULL;
+    }
+
+    if (_tab_create(&ht->cur, ngroup) != CC_OK) {
+        cc_free(ht);
+        INCR(htable_metrics, htable_create_ex);
+
+        return NULL;
+    }
+
+    memset(&ht->old, 0, sizeof(ht->old));
+    ht->migrate = 0;
+    ht->hash = (hash == NULL) ? hash_wyhash : hash;
+    /* per-table seed, so tables don't share the same collisions */
+    ht->seed = (uint64_t)(uintptr_t)ht;
+
+    INCR(htable_metrics, htable_create);
+    INCR(htable_metrics, htable_curr);
+    log_verb("created htable %p with %"PRIu32" groups", ht, ngroup);
+
+    return ht;
+}
+
+void
+htable_destroy(struct htable **ht)
+{
+    if (ht == NULL || *ht == NULL) {
+        return;
+    }
+
+    log_verb("destroy htable %p", *ht);
+
+    if (htable_migrating(*ht)) {
+        DECR(htable_metrics, htable_migrating);
+        DECR_N(htable_metrics, htable_migrate_pending,
+                (*ht)->old.ngroup - (*ht)->migrate);
+    }
+    _tab_destroy(&(*ht)->cur);
+    _tab_destroy(&(*ht)->old);
+    INCR(htable_metrics, htable_destroy);
+    DECR(htable_metrics, htable_curr);
+    cc_free(*ht);
+    *ht = NULL;
+}
+
+void *
+htable_get(struct htable *ht, const struct bstring *key)
+{
+    uint64_t hash = _hash(ht, key);
+    struct htable_slot *s;
+
+    s = _tab_find(&ht->cur, key, hash);
+    if (s == NULL && htable_migrating(ht)) {
+        s = _tab_find(&ht->old, key, hash);
+    }
+
+    return (s == NULL) ? NULL : s->val;
+}
+
+rstatus_i
+htable_put(struct htable *ht, const struct bstring *key, void *val)
+{
+    uint64_t hash = _hash(ht, key);
+    struct htable_slot *s;
+
+    ASSERT(val != NULL);
+
+    if (htable_migrating(ht)) {
+        _migrate(ht, migrate_step);
+    }
+
+    s = _tab_find(&ht->cur, key, hash);
+    if (s == NULL && htable_migrating(ht)) {
+        /* replaced in place, migration moves it over later */
+        s = _tab_find(&ht->old, key, hash);
+    }
+    if (s != NULL) {
+        s->val = val;
+
+        return CC_OK;
+    }
+
+    /* while migrating, keep room in cur for what's left in old */
+    if (ht->cur.growth <= ht->old.nentry && _grow(ht) != CC_OK) {
+        log_info("htable %p is full and cannot grow", ht);
+
+        return CC_ENOMEM;
+    }
+
+    _tab_insert(&ht->cur, key, val, hash);
+
+    return CC_OK;
+}
+
+void *
+htable_delete(struct htable *ht, const struct bstring *key)
+{
+    uint64_t hash = _hash(ht, key);
+    struct htable_tab *tab = &ht->cur;
+    struct htable_slot *s;
+    void *val;
+
+    if (htable_migrating(ht)) {
+        _migrate(ht, migrate_step);
+    }
+
+    s = _tab_find(tab, key, hash);
+    if (s == NULL && htable_migrating(ht)) {
+        tab = &ht->old;
+        s = _tab_find(tab, key, hash);
+    }
+    if (s == NULL) {
+        return NULL;
+    }
+
+    val = s->val;
+    _tab_erase(tab, s);
+    if (tab == &ht->old && tab->nentry == 0) {
+        _migrate(ht, 0);
+    }
+
+    return val;
+}
+
+uint32_t
+htable_migrate(struct htable *ht, uint32_t ngroup)
+{
+    if (!htable_migrating(ht)) {
+        return 0;
+    }
+
+    _migrate(ht, ngroup);
+
+    return htable_migrating(ht) ? ht->old.ngroup - ht->migrate : 0;
+}
+
+void
+htable_migrate_tick(void *ht)
+{
+    htable_migrate(ht, migrate_tick);
+}
+
+static void
+_tab_foreach(struct htable_tab *tab, htable_each_fn fn, void *arg)
+{
+    size_t i, nslot = (size_t)tab->ngroup * HTABLE_GROUP;
+
+    for (i = 0; i < nslot; i++) {
+        if (tab->ctrl[i] < CTRL_EMPTY) {
+            fn(&tab->slot[i].key, tab->slot[i].val, arg);
+        }
+    }
+}
+
+void
+htable_foreach(struct htable *ht, htable_each_fn fn, void *arg)
+{
+    _tab_foreach(&ht->cur, fn, arg);
+    if (htable_migrating(ht)) {
+        _tab_foreach(&ht->old, fn, arg);
+    }
+}
@@ -20,17 +20,23 @@
 #include <cc_mm.h>
 #include <cc_pool.h>
 #include <cc_print.h>
+#include <cc_probe.h>
 #include <cc_rbuf.h>
+#include <cc_trace.h>
 #include <cc_util.h>
+#include <time/cc_timer.h>
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #define LOG_MODULE_NAME "ccommon::log"
@@ -38,6 +44,56 @@
 static log_metrics_st *log_metrics = NULL;
 static bool log_init = false;
 
+/* flusher thread, the lock also serializes consumers of async loggers */
+STAILQ_HEAD(logger_sqh, logger);
+static struct logger_sqh flusher_q = STAILQ_HEAD_INITIALIZER(flusher_q);
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond;
+static pthread_t flusher_tid;
+static bool flusher_running = false;
+static uint32_t flusher_intvl_ms = LOG_FLUSH_INTVL_MS;
+static uint32_t flusher_fsync_ms = LOG_FSYNC_MS;
+
+static size_t _log_flush(struct logger *logger);
+static void _log_direct_off(struct logger *logger);
+static void _log_unmap(struct logger *logger);
+
+/* message header in the buffers of ordered loggers */
+struct log_rec {
+    uint64_t            ts;
+    uint32_t            len;
+};
+
+/* message header in the buffers of loggers with a render function */
+struct log_frame {
+    uint32_t            len;
+    uint32_t            deferred;   /* payload is a record to render */
+};
+
+/* staging area for the output of flushes that render */
+#define LOG_RENDER_NBUF (8 * LOG_MAX_LEN)
+
+/* per-thread buffer of a multi-writer logger */
+struct log_tbuf {
+    struct log_tbuf     *next;
+    struct rbuf         *buf;
+    void                *owner;     /* identifies the writer thread */
+    /* flush state of ordered loggers */
+    size_t              budget;     /* bytes left to drain in this pass */
+    bool                pending;    /* hdr read, payload not yet drained */
+    struct log_rec      hdr;
+};
+
+/* a writer's cache of the buffers it owns, it is also its identity */
+#define LOG_TBUF_NCACHE 4
+static __thread struct {
+    struct logger       *logger;
+    uint64_t            id;
+    struct rbuf         *buf;
+} tbuf_cache[LOG_TBUF_NCACHE];
+static __thread unsigned int tbuf_evict = 0;
+static uint64_t logger_id = 0;
+
 /* this function is called from rust so that it can use log_setup */
 log_metrics_st *
 log_metrics_create()
@@ -114,6 +170,25 @@ log_create(char *filename, uint32_t buf_cap)
         logger->buf = NULL;
     }
 
+    logger->async = false;
+    logger->dirty = false;
+    logger->render = NULL;
+    logger->mt = false;
+    logger->ordered = false;
+    logger->tbuf_cap = 0;
+    logger->id = __atomic_add_fetch(&logger_id, 1, __ATOMIC_RELAXED);
+    logger->tbuf = NULL;
+    logger->merge = NULL;
+    logger->mcap = 0;
+    logger->mlen = 0;
+    logger->direct = false;
+    logger->dbuf = NULL;
+    logger->dcap = 0;
+    logger->dlen = 0;
+    logger->map = NULL;
+    logger->map_seg = 0;
+    logger->map_off = 0;
+    logger->map_pos = 0;
     logger->name = filename;
     if (filename != NULL) {
         logger->fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
@@ -147,7 +222,10 @@ log_destroy(struct logger **l)
     }
 
     /* flush first in case there's data left in the buffer */
+    log_flusher_remove(logger);
     log_flush(logger);
+    _log_direct_off(logger);
+    _log_unmap(logger);
 
     if (logger->fd >= 0 && logger->fd != STDERR_FILENO
         && logger->fd != STDOUT_FILENO) {
@@ -155,6 +233,17 @@ log_destroy(struct logger **l)
     }
 
     rbuf_destroy(&logger->buf);
+    while (logger->tbuf != NULL) {
+        struct log_tbuf *tbuf = logger->tbuf;
+
+        logger->tbuf = tbuf->next;
+        rbuf_destroy(&tbuf->buf);
+        cc_free(tbuf);
+    }
+    cc_free(logger->merge);
+    if (logger->dbuf != NULL) {
+        cc_munmap(logger->dbuf, logger->dcap);
+    }
 
     cc_free(logger);
     *l = NULL;
@@ -163,12 +252,410 @@ log_destroy(struct logger **l)
     DECR(log_metrics, log_curr);
 }
 
+struct logger *
+log_create_mt(char *filename, uint32_t buf_cap, bool ordered)
+{
+    struct logger *logger;
+
+    if (buf_cap == 0) {
+        log_stderr("multi-writer logger needs a buffer capacity");
+        return NULL;
+    }
+
+    logger = log_create(filename, 0);
+    if (logger == NULL) {
+        return NULL;
+    }
+
+    if (ordered) {
+        logger->merge = cc_alloc(buf_cap);
+        if (logger->merge == NULL) {
+            log_stderr("Could not create logger - merge area not allocated");
+            log_destroy(&logger);
+            return NULL;
+        }
+        logger->mcap = buf_cap;
+    }
+    logger->mt = true;
+    logger->ordered = ordered;
+    logger->tbuf_cap = buf_cap;
+
+    return logger;
+}
+
+/* switch the file to O_DIRECT, unless it cannot be written in whole blocks */
+static void
+_log_direct_on(struct logger *logger)
+{
+#ifdef O_DIRECT
+    struct stat st;
+    int flags;
+
+    flags = fcntl(logger->fd, F_GETFL);
+    if (flags >= 0 && fstat(logger->fd, &st) == 0 &&
+            st.st_size % LOG_DIRECT_ALIGN == 0 &&
+            fcntl(logger->fd, F_SETFL, flags | O_DIRECT) == 0) {
+        logger->direct = true;
+        return;
+    }
+#endif
+
+    log_stderr("logger %p cannot use direct I/O on '%s', using regular writes",
+            logger, logger->name);
+}
+
+/* write out the partial block held back, leaving the file unaligned */
+static void
+_log_direct_off(struct logger *logger)
+{
+#ifdef O_DIRECT
+    ssize_t n;
+    int flags;
+
+    if (!logger->direct) {
+        return;
+    }
+
+    logger->direct = false;
+    flags = fcntl(logger->fd, F_GETFL);
+    if (flags < 0 || fcntl(logger->fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+        INCR(log_metrics, log_flush_ex);
+        return;
+    }
+    if (logger->dlen > 0) {
+        n = write(logger->fd, logger->dbuf, logger->dlen);
+        if (n < (ssize_t)logger->dlen) {
+            INCR(log_metrics, log_flush_ex);
+        }
+        logger->dlen = 0;
+    }
+#else
+    (void)logger;
+#endif
+}
+
+struct logger *
+log_create_direct(char *filename, uint32_t buf_cap)
+{
+    struct logger *logger;
+
+    if (filename == NULL || buf_cap == 0) {
+        log_stderr("direct logger needs a file and a buffer capacity");
+        return NULL;
+    }
+
+    logger = log_create(filename, buf_cap);
+    if (logger == NULL) {
+        return NULL;
+    }
+
+    /* room for a full ring behind the largest partial block held back */
+    logger->dcap = ROUND_UP(buf_cap, LOG_DIRECT_ALIGN) + LOG_DIRECT_ALIGN;
+    logger->dbuf = cc_mmap(logger->dcap);
+    if (logger->dbuf == NULL) {
+        log_stderr("Could not create logger - direct buffer not allocated");
+        logger->dcap = 0;
+        log_destroy(&logger);
+        return NULL;
+    }
+    _log_direct_on(logger);
+
+    return logger;
+}
+
+/* map the segment of the file at off, preallocating it */
+static rstatus_i
+_log_map(struct logger *logger, uint64_t off)
+{
+    int ret;
+
+    ret = posix_fallocate(logger->fd, off, logger->map_seg);
+    if (ret != 0) {
+        log_stderr("Could not preallocate log segment at %"PRIu64": %s", off,
+                strerror(ret));
+        return CC_ERROR;
+    }
+
+    logger->map = mmap(NULL, logger->map_seg, PROT_READ | PROT_WRITE,
+            MAP_SHARED, logger->fd, off);
+    if (logger->map == MAP_FAILED) {
+        log_stderr("Could not map log segment at %"PRIu64": %s", off,
+                strerror(errno));
+        logger->map = NULL;
+        return CC_ERROR;
+    }
+    logger->map_off = off;
+    logger->map_pos = 0;
+
+    return CC_OK;
+}
+
+/* unmap the current segment, cutting the file back to what was written */
+static void
+_log_unmap(struct logger *logger)
+{
+    if (logger->map == NULL) {
+        return;
+    }
+
+    munmap(logger->map, logger->map_seg);
+    logger->map = NULL;
+    if (ftruncate(logger->fd, logger->map_off + logger->map_pos) < 0) {
+        log_stderr("Could not trim log file '%s': %s", logger->name,
+                strerror(errno));
+    }
+}
+
+/* open the file read-write and map it from where it ends */
+static rstatus_i
+_log_map_open(struct logger *logger, int flags)
+{
+    struct stat st;
+    uint64_t size;
+
+    logger->fd = open(logger->name, O_RDWR | O_CREAT | flags, 0644);
+    if (logger->fd < 0 || fstat(logger->fd, &st) < 0) {
+        return CC_ERROR;
+    }
+
+    /* mappings start at a page boundary, pick up any partial page there */
+    size = (uint64_t)st.st_size;
+    if (_log_map(logger, size - size % sysconf(_SC_PAGESIZE)) != CC_OK) {
+        return CC_ERROR;
+    }
+    logger->map_pos = size - logger->map_off;
+
+    return CC_OK;
+}
+
+struct logger *
+log_create_mmap(char *filename, size_t seg_size)
+{
+    struct logger *logger;
+
+    if (filename == NULL || seg_size == 0) {
+        log_stderr("memory-mapped logger needs a file and a segment size");
+        return NULL;
+    }
+
+    logger = log_create(filename, 0);
+    if (logger == NULL) {
+        return NULL;
+    }
+
+    close(logger->fd);
+    logger->map_seg = ROUND_UP(seg_size, (size_t)sysconf(_SC_PAGESIZE));
+    if (_log_map_open(logger, 0) != CC_OK) {
+        log_stderr("Could not create logger - cannot map file: %s",
+                strerror(errno));
+        INCR(log_metrics, log_open_ex);
+        log_destroy(&logger);
+        return NULL;
+    }
+
+    return logger;
+}
+
+static bool
+_log_write_mmap(struct logger *logger, char *buf, uint32_t len)
+{
+    size_t n;
+
+    if (len > logger->map_seg) {
+        INCR(log_metrics, log_skip);
+        INCR_N(log_metrics, log_skip_byte, len);
+        return false;
+    }
+
+    if (logger->map == NULL) {
+        INCR(log_metrics, log_write_ex);
+        return false;
+    }
+
+    /* the file is a plain byte stream, messages may straddle segments */
+    n = MIN(len, logger->map_seg - logger->map_pos);
+    cc_memcpy(logger->map + logger->map_pos, buf, n);
+    logger->map_pos += n;
+    if (logger->map_pos == logger->map_seg) {
+        munmap(logger->map, logger->map_seg);
+        logger->map = NULL;
+        if (_log_map(logger, logger->map_off + logger->map_seg) != CC_OK) {
+            /* leave the file tidy, the current offset is where it ends */
+            logger->map_off += logger->map_seg;
+            if (ftruncate(logger->fd, logger->map_off) < 0) {
+                log_stderr("Could not trim log file '%s'", logger->name);
+            }
+            INCR(log_metrics, log_write_ex);
+            return false;
+        }
+    }
+    cc_memcpy(logger->map, buf + n, len - n);
+    logger->map_pos += len - n;
+
+    INCR(log_metrics, log_write);
+    INCR_N(log_metrics, log_write_byte, len);
+
+    return true;
+}
+
+/* the buffer of the calling thread, registering one on its first write */
+static struct rbuf *
+_log_tbuf(struct logger *logger)
+{
+    struct log_tbuf *tbuf, *head;
+    unsigned int i;
+
+    for (i = 0; i < LOG_TBUF_NCACHE; i++) {
+        if (tbuf_cache[i].logger == logger && tbuf_cache[i].id == logger->id) {
+            return tbuf_cache[i].buf;
+        }
+    }
+
+    /* evicted from the cache earlier, or never written to by this thread */
+    for (tbuf = __atomic_load_n(&logger->tbuf, __ATOMIC_ACQUIRE);
+            tbuf != NULL && tbuf->owner != (void *)tbuf_cache;
+            tbuf = tbuf->next);
+    if (tbuf == NULL) {
+        tbuf = cc_zalloc(sizeof(struct log_tbuf));
+        if (tbuf == NULL) {
+            return NULL;
+        }
+        tbuf->buf = rbuf_create(logger->tbuf_cap);
+        if (tbuf->buf == NULL) {
+            cc_free(tbuf);
+            return NULL;
+        }
+        tbuf->owner = (void *)tbuf_cache;
+        head = __atomic_load_n(&logger->tbuf, __ATOMIC_RELAXED);
+        do {
+            tbuf->next = head;
+        } while (!__atomic_compare_exchange_n(&logger->tbuf, &head, tbuf, true,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    i = tbuf_evict++ % LOG_TBUF_NCACHE;
+    tbuf_cache[i].logger = logger;
+    tbuf_cache[i].id = logger->id;
+    tbuf_cache[i].buf = tbuf->buf;
+
+    return tbuf->buf;
+}
+
+static bool
+_log_write_mt(struct logger *logger, char *buf, uint32_t len)
+{
+    struct rbuf *rbuf = _log_tbuf(logger);
+    struct log_rec rec = {0, 0};
+    struct iovec iov[2];
+    struct timespec ts;
+    int iovcnt = 0;
+    size_t n = len;
+
+    if (rbuf == NULL) {
+        INCR(log_metrics, log_write_ex);
+        return false;
+    }
+
+    if (logger->ordered) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rec.ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        rec.len = len;
+        iov[iovcnt].iov_base = &rec;
+        iov[iovcnt++].iov_len = sizeof(rec);
+        n += sizeof(rec);
+    }
+    iov[iovcnt].iov_base = buf;
+    iov[iovcnt++].iov_len = len;
+
+    if (rbuf_wcap(rbuf) < n) {
+        INCR(log_metrics, log_skip);
+        INCR_N(log_metrics, log_skip_byte, len);
+        return false;
+    }
+
+    rbuf_writev(rbuf, iov, iovcnt);
+    INCR(log_metrics, log_write);
+    INCR_N(log_metrics, log_write_byte, len);
+
+    return true;
+}
+
+static bool
+_log_write_frame(struct logger *logger, const void *buf, uint32_t len,
+        bool deferred)
+{
+    struct log_frame frame = {len, deferred};
+    struct iovec iov[2];
+
+    if (len > (deferred ? LOG_MAX_LEN : LOG_RENDER_NBUF) ||
+            rbuf_wcap(logger->buf) < sizeof(frame) + len) {
+        INCR(log_metrics, log_skip);
+        INCR_N(log_metrics, log_skip_byte, len);
+        return false;
+    }
+
+    iov[0].iov_base = &frame;
+    iov[0].iov_len = sizeof(frame);
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = len;
+    rbuf_writev(logger->buf, iov, 2);
+    INCR(log_metrics, log_write);
+    INCR_N(log_metrics, log_write_byte, len);
+
+    return true;
+}
+
+rstatus_i
+log_set_render(struct logger *logger, log_render_fn render)
+{
+    if (logger->mt || logger->dbuf != NULL ||
+            (logger->buf != NULL && rbuf_rcap(logger->buf) > 0)) {
+        return CC_EINVAL;
+    }
+
+    if (logger->buf != NULL && logger->merge == NULL) {
+        logger->merge = cc_alloc(LOG_RENDER_NBUF);
+        if (logger->merge == NULL) {
+            return CC_ENOMEM;
+        }
+        logger->mcap = LOG_RENDER_NBUF;
+    }
+    logger->render = render;
+
+    return CC_OK;
+}
+
+bool
+log_write_deferred(struct logger *logger, const void *rec, uint32_t len)
+{
+    char buf[LOG_MAX_LEN];
+    size_t n;
+
+    if (logger->render == NULL) {
+        INCR(log_metrics, log_write_ex);
+        return false;
+    }
+
+    if (logger->buf != NULL) {
+        return _log_write_frame(logger, rec, len, true);
+    }
+
+    n = logger->render(buf, LOG_MAX_LEN, rec, len);
+    return log_write(logger, buf, n);
+}
+
 rstatus_i
 log_reopen(struct logger *logger, char *target)
 {
     int ret;
 
+    if (logger->async) {
+        pthread_mutex_lock(&flusher_lock);
+    }
+
     if (logger->fd != STDERR_FILENO && logger->fd != STDOUT_FILENO) {
+        _log_direct_off(logger);
+        _log_unmap(logger);
         close(logger->fd);
 
         if (target != NULL) {
@@ -179,13 +666,28 @@ log_reopen(struct logger *logger, char *target)
             }
         }
 
-        logger->fd = open(logger->name, O_WRONLY | O_TRUNC | O_CREAT, 0644);
-        if (logger->fd < 0) {
+        if (logger->map_seg > 0) {
+            ret = _log_map_open(logger, O_TRUNC);
+        } else {
+            logger->fd = open(logger->name, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+            ret = logger->fd < 0 ? CC_ERROR : CC_OK;
+        }
+        if (ret != CC_OK) {
             log_stderr("reopening log file '%s' failed, ignored: %s", logger->name,
                        strerror(errno));
             INCR(log_metrics, log_open_ex);
+            if (logger->async) {
+                pthread_mutex_unlock(&flusher_lock);
+            }
             return CC_ERROR;
         }
+        if (logger->dbuf != NULL) {
+            _log_direct_on(logger);
+        }
+    }
+
+    if (logger->async) {
+        pthread_mutex_unlock(&flusher_lock);
     }
 
     INCR(log_metrics, log_open);
@@ -196,6 +698,18 @@ log_reopen(struct logger *logger, char *target)
 bool
 log_write(struct logger *logger, char *buf, uint32_t len)
 {
+    if (logger->mt) {
+        return _log_write_mt(logger, buf, len);
+    }
+
+    if (logger->render != NULL && logger->buf != NULL) {
+        return _log_write_frame(logger, buf, len, false);
+    }
+
+    if (logger->map_seg > 0) {
+        return _log_write_mmap(logger, buf, len);
+    }
+
     if (logger->buf != NULL) {
         if (rbuf_wcap(logger->buf) >= len) {
             rbuf_write(logger->buf, buf, len);
@@ -224,6 +738,30 @@ log_write(struct logger *logger, char *buf, uint32_t len)
     return true;
 }
 
+char *
+log_reserve(struct logger *logger, uint32_t len)
+{
+    struct iovec iov[2];
+
+    if (logger->buf == NULL || logger->mt || logger->render != NULL) {
+        return NULL;
+    }
+
+    if (rbuf_reserve(logger->buf, len, iov) != 1) {
+        return NULL;
+    }
+
+    return iov[0].iov_base;
+}
+
+void
+log_commit(struct logger *logger, uint32_t len)
+{
+    rbuf_commit(logger->buf, len);
+    INCR(log_metrics, log_write);
+    INCR_N(log_metrics, log_write_byte, len);
+}
+
 void
 _log_fd(int fd, const char *fmt, ...)
 {
@@ -264,55 +802,230 @@ _log_fd(int fd, const char *fmt, ...)
 static ssize_t
 _rbuf_flush(struct rbuf *buf, int fd)
 {
-    uint32_t capacity;
+    struct iovec iov[2];
+    int iovcnt;
     ssize_t ret;
-    uint32_t rpos, wpos;
-    rpos = get_rpos(buf);
-    wpos = get_wpos(buf);
 
-    if (wpos < rpos) {
-        /* write until end, then wrap around */
-        capacity = buf->cap - rpos + 1;
-        ret = write(fd, buf->data + rpos, capacity);
+    iovcnt = rbuf_peek(buf, iov);
+    if (iovcnt == 0) {
+        return 0;
+    }
 
-        if (ret > 0) {
-            rpos += ret;
-        }
+    /* one syscall even if the readable region wraps around */
+    ret = writev(fd, iov, iovcnt);
+    if (ret > 0) {
+        rbuf_consume(buf, ret);
+    }
 
-        if (ret == capacity) {
-            /* more can be written, read from beginning of buf */
-            ssize_t ret2;
+    return ret;
+}
 
-            capacity = wpos;
-            ret2 = write(fd, buf->data, capacity);
+size_t
+log_flush(struct logger *logger)
+{
+    size_t n;
+
+    TRACE_BEGIN(TRACE_LOG_FLUSH);
+    if (!logger->async) {
+        n = _log_flush(logger);
+    } else {
+        pthread_mutex_lock(&flusher_lock);
+        n = _log_flush(logger);
+        pthread_mutex_unlock(&flusher_lock);
+    }
+    TRACE_END_N(TRACE_LOG_FLUSH, (uint32_t)n);
+    PROBE2(log_flush, logger->fd, n);
+
+    return n;
+}
+
+/* write out the staging area, holding back what the file does not take */
+static ssize_t
+_log_flush_merge(struct logger *logger)
+{
+    ssize_t n;
+
+    if (logger->mlen == 0) {
+        return 0;
+    }
+
+    n = write(logger->fd, logger->merge, logger->mlen);
+    if (n > 0) {
+        logger->mlen -= n;
+        memmove(logger->merge, logger->merge + n, logger->mlen);
+    }
+
+    return n > 0 ? n : 0;
+}
+
+/* make room for len more bytes in the staging area, false if it stays full */
+static bool
+_log_merge_fit(struct logger *logger, size_t len, ssize_t *ret)
+{
+    if (logger->mlen + len > logger->mcap) {
+        *ret += _log_flush_merge(logger);
+    }
+
+    return logger->mlen + len <= logger->mcap;
+}
+
+/**
+ * drain the per-thread buffers of an ordered logger, oldest message first.
+ * Messages are only taken out of their buffer once there is room to stage
+ * them, so nothing is lost when the file is slow to take the output.
+ */
+static ssize_t
+_log_flush_ordered(struct logger *logger, size_t *expected)
+{
+    struct log_tbuf *tbuf, *first;
+    size_t len;
+    ssize_t ret = 0;
 
-            if (ret2 >= 0) {
-                rpos = ret2;
-                ret += ret2;
+    for (tbuf = logger->tbuf; tbuf != NULL; tbuf = tbuf->next) {
+        /* the payload of a pending message was read past its header */
+        tbuf->budget = rbuf_rcap(tbuf->buf) - (tbuf->pending ?
+                tbuf->hdr.len : 0);
+    }
+    *expected += logger->mlen;
+
+    for (;;) {
+        first = NULL;
+        for (tbuf = logger->tbuf; tbuf != NULL; tbuf = tbuf->next) {
+            if (!tbuf->pending && tbuf->budget >= sizeof(tbuf->hdr)) {
+                rbuf_read(&tbuf->hdr, tbuf->buf, sizeof(tbuf->hdr));
+                tbuf->budget -= sizeof(tbuf->hdr) + tbuf->hdr.len;
+                tbuf->pending = true;
+            }
+            if (tbuf->pending && (first == NULL ||
+                        tbuf->hdr.ts < first->hdr.ts)) {
+                first = tbuf;
             }
         }
-    } else {
-        /* no wrap around */
-        capacity = wpos - rpos;
-        ret = write(fd, buf->data + rpos, capacity);
+        if (first == NULL) {
+            break;
+        }
 
-        if (ret > 0) {
-            rpos += ret;
+        len = first->hdr.len;
+        *expected += len;
+        if (!_log_merge_fit(logger, len, &ret)) {
+            return ret;
         }
+        rbuf_read(logger->merge + logger->mlen, first->buf, len);
+        logger->mlen += len;
+        first->pending = false;
+    }
+
+    return ret + _log_flush_merge(logger);
+}
+
+/* drain the per-thread buffers of a multi-writer logger one by one */
+static ssize_t
+_log_flush_mt(struct logger *logger, size_t *expected)
+{
+    struct log_tbuf *tbuf;
+    ssize_t ret = 0, n;
+
+    if (logger->ordered) {
+        return _log_flush_ordered(logger, expected);
     }
 
-    set_rpos(buf, rpos);
+    for (tbuf = logger->tbuf; tbuf != NULL; tbuf = tbuf->next) {
+        *expected += rbuf_rcap(tbuf->buf);
+        n = _rbuf_flush(tbuf->buf, logger->fd);
+        ret += n > 0 ? n : 0;
+    }
 
     return ret;
 }
 
-size_t
-log_flush(struct logger *logger)
+/* drain the buffer of a direct logger in whole blocks */
+static ssize_t
+_log_flush_direct(struct logger *logger, size_t *expected)
 {
+    size_t nblk;
+    ssize_t ret;
+
+    logger->dlen += rbuf_read(logger->dbuf + logger->dlen, logger->buf,
+            logger->dcap - logger->dlen);
+    nblk = logger->dlen / LOG_DIRECT_ALIGN * LOG_DIRECT_ALIGN;
+    *expected += nblk;
+    if (nblk == 0) {
+        return 0;
+    }
+
+    ret = write(logger->fd, logger->dbuf, nblk);
+    if (ret > 0) {
+        logger->dlen -= ret;
+        memmove(logger->dbuf, logger->dbuf + ret, logger->dlen);
+    }
+    if ((ret < 0 && errno == EINVAL) || (ret > 0 && ret % LOG_DIRECT_ALIGN)) {
+        /* the file can no longer be written in whole blocks */
+        _log_direct_off(logger);
+    }
+
+    return ret;
+}
+
+/* copy the first n readable bytes of buf into dst without consuming them */
+static void
+_log_peek(void *dst, struct rbuf *buf, size_t n)
+{
+    struct iovec iov[2];
+    size_t len = 0;
+    int i, iovcnt;
+
+    iovcnt = rbuf_peek(buf, iov);
+    for (i = 0; i < iovcnt && len < n; i++) {
+        cc_memcpy((char *)dst + len, iov[i].iov_base,
+                MIN(iov[i].iov_len, n - len));
+        len += MIN(iov[i].iov_len, n - len);
+    }
+}
+
+/**
+ * drain the buffer of a logger with a render function, rendering records.
+ * Like ordered flushes, a frame stays in the buffer until its output fits.
+ */
+static ssize_t
+_log_flush_render(struct logger *logger, size_t *expected)
+{
+    char rec[LOG_MAX_LEN];
+    struct log_frame frame;
+    size_t budget, n;
+    ssize_t ret = 0;
+
+    *expected += logger->mlen;
+    for (budget = rbuf_rcap(logger->buf); budget >= sizeof(frame);
+            budget -= sizeof(frame) + frame.len) {
+        _log_peek(&frame, logger->buf, sizeof(frame));
+        if (!_log_merge_fit(logger, frame.deferred ? LOG_MAX_LEN : frame.len,
+                    &ret)) {
+            *expected += frame.len;
+            return ret;
+        }
+        rbuf_consume(logger->buf, sizeof(frame));
+        if (frame.deferred) {
+            rbuf_read(rec, logger->buf, frame.len);
+            n = logger->render((char *)logger->merge + logger->mlen,
+                    LOG_MAX_LEN, rec, frame.len);
+        } else {
+            n = rbuf_read(logger->merge + logger->mlen, logger->buf, frame.len);
+        }
+        logger->mlen += n;
+        *expected += n;
+    }
+
+    return ret + _log_flush_merge(logger);
+}
+
+static size_t
+_log_flush(struct logger *logger)
+{
+    struct duration d;
     ssize_t n;
-    size_t buf_len;
+    size_t buf_len = 0;
 
-    if (logger->buf == NULL) {
+    if (logger->buf == NULL && !logger->mt) {
         return 0;
     }
 
@@ -322,8 +1035,23 @@ log_flush(struct logger *logger)
         return 0;
     }
 
-    buf_len = rbuf_rcap(logger->buf);
-    n = _rbuf_flush(logger->buf, logger->fd);
+    if (log_metrics != NULL) {
+        duration_start(&d);
+    }
+    if (logger->mt) {
+        n = _log_flush_mt(logger, &buf_len);
+    } else if (logger->render != NULL) {
+        n = _log_flush_render(logger, &buf_len);
+    } else if (logger->direct) {
+        n = _log_flush_direct(logger, &buf_len);
+    } else {
+        buf_len = rbuf_rcap(logger->buf);
+        n = _rbuf_flush(logger->buf, logger->fd);
+    }
+    if (log_metrics != NULL) {
+        duration_stop(&d);
+        DURATION_RECORD(log_metrics, log_flush_ns, &d);
+    }
 
     if (n < (ssize_t)buf_len) {
         INCR(log_metrics, log_flush_ex);
@@ -333,3 +1061,134 @@ log_flush(struct logger *logger)
 
     return n > 0 ? n : 0;
 }
+
+static inline uint64_t
+_flusher_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* drain all async loggers, syncing them if due; called with the lock held */
+static void
+_flusher_pass(bool sync)
+{
+    struct logger *logger;
+
+    STAILQ_FOREACH(logger, &flusher_q, next) {
+        if (_log_flush(logger) > 0) {
+            logger->dirty = true;
+        }
+        if (sync && logger->dirty) {
+            fdatasync(logger->fd);
+            logger->dirty = false;
+        }
+    }
+}
+
+static void *
+_log_flusher(void *arg)
+{
+    struct timespec ts;
+    uint64_t now, synced, deadline;
+
+    pthread_mutex_lock(&flusher_lock);
+    synced = _flusher_now_ms();
+    while (flusher_running) {
+        now = _flusher_now_ms();
+        _flusher_pass(flusher_fsync_ms > 0 && now - synced >= flusher_fsync_ms);
+        if (flusher_fsync_ms > 0 && now - synced >= flusher_fsync_ms) {
+            synced = now;
+        }
+
+        deadline = now + flusher_intvl_ms;
+        ts.tv_sec = deadline / 1000;
+        ts.tv_nsec = (deadline % 1000) * 1000000;
+        pthread_cond_timedwait(&flusher_cond, &flusher_lock, &ts);
+    }
+    _flusher_pass(flusher_fsync_ms > 0);
+    pthread_mutex_unlock(&flusher_lock);
+
+    return arg;
+}
+
+rstatus_i
+log_flusher_start(uint32_t intvl_ms, uint32_t fsync_ms)
+{
+    pthread_condattr_t attr;
+    int ret;
+
+    if (flusher_running) {
+        log_stderr("log flusher is already running");
+        return CC_ERROR;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flusher_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    flusher_intvl_ms = intvl_ms > 0 ? intvl_ms : LOG_FLUSH_INTVL_MS;
+    flusher_fsync_ms = fsync_ms;
+    flusher_running = true;
+    ret = pthread_create(&flusher_tid, NULL, _log_flusher, NULL);
+    if (ret != 0) {
+        log_stderr("create log flusher thread failed: %s", strerror(ret));
+        flusher_running = false;
+        pthread_cond_destroy(&flusher_cond);
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+void
+log_flusher_stop(void)
+{
+    if (!flusher_running) {
+        return;
+    }
+
+    pthread_mutex_lock(&flusher_lock);
+    flusher_running = false;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&flusher_lock);
+
+    pthread_join(flusher_tid, NULL);
+    pthread_cond_destroy(&flusher_cond);
+}
+
+rstatus_i
+log_flusher_add(struct logger *logger)
+{
+    if (logger->buf == NULL && !logger->mt) {
+        log_stderr("logger %p has no buffer to flush in the background",
+                logger);
+        return CC_EINVAL;
+    }
+
+    pthread_mutex_lock(&flusher_lock);
+    if (!logger->async) {
+        STAILQ_INSERT_TAIL(&flusher_q, logger, next);
+        logger->async = true;
+    }
+    pthread_mutex_unlock(&flusher_lock);
+
+    return CC_OK;
+}
+
+void
+log_flusher_remove(struct logger *logger)
+{
+    if (!logger->async) {
+        return;
+    }
+
+    pthread_mutex_lock(&flusher_lock);
+    STAILQ_REMOVE(&flusher_q, logger, logger, next);
+    logger->async = false;
+    pthread_mutex_unlock(&flusher_lock);
+}
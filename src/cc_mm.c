@@ -17,18 +17,421 @@
 
 #include <cc_mm.h>
 
+#include <cc_cpu.h>
 #include <cc_debug.h>
+#include <cc_print.h>
 
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdalign.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#if defined CC_JEMALLOC && CC_JEMALLOC == 1
+#include <jemalloc/jemalloc.h>
+#endif
+#ifdef OS_LINUX
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 /* TODO(yao): detect OS in one place and use one variable everywhere */
 #if defined(__APPLE__) && defined(__MACH__)
 #   define MAP_ANONYMOUS MAP_ANON
 #endif
 
+#define MM_MODULE_NAME "ccommon::mm"
+
+#define NODEMASK_BIT (8 * sizeof(unsigned long))
+
+static bool mm_init = false;
+static mm_metrics_st *mm_metrics = NULL;
+static int mm_hugepage = MM_HUGEPAGE_NONE;
+static size_t mm_hugepage_min = MM_HUGEPAGE_SIZE;
+static int mm_numa_node = MM_NUMA_ANY;
+
+#if defined CC_JEMALLOC && CC_JEMALLOC == 1
+
+static bool mm_arena = false;
+static __thread unsigned int mm_arena_tl = 0; /* arena index + 1, 0 if none */
+
+/* the arena of the calling thread, created on its first allocation */
+static int
+_je_flags(void)
+{
+    unsigned int arena;
+    size_t len = sizeof(arena);
+
+    if (!__atomic_load_n(&mm_arena, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    if (mm_arena_tl == 0) {
+        if (mallctl("arenas.create", &arena, &len, NULL, 0) != 0) {
+            log_warn("create jemalloc arena failed, using the default ones");
+            return 0;
+        }
+        mm_arena_tl = arena + 1;
+    }
+
+    return MALLOCX_ARENA(mm_arena_tl - 1);
+}
+
+static void *
+_je_alloc(size_t size)
+{
+    return mallocx(size, _je_flags());
+}
+
+static void *
+_je_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return mallocx(size, _je_flags());
+    }
+
+    /* rallocx keeps the arena of ptr, unless told otherwise */
+    return rallocx(ptr, size, 0);
+}
+
+static void
+_je_free(void *ptr)
+{
+    if (ptr != NULL) {
+        dallocx(ptr, 0);
+    }
+}
+
+static void
+_je_free_sized(void *ptr, size_t size)
+{
+    if (ptr != NULL) {
+        sdallocx(ptr, size, 0);
+    }
+}
+
+#define MM_DEFAULT { _je_alloc, _je_realloc, _je_free, _je_free_sized }
+
+#else
+
+#define MM_DEFAULT { malloc, realloc, free, NULL }
+
+#endif
+
+static const struct mm_allocator mm_default = MM_DEFAULT;
+static struct mm_allocator mm_be = MM_DEFAULT;
+
+void
+mm_allocator_set(const struct mm_allocator *allocator)
+{
+    if (allocator == NULL) {
+        allocator = &mm_default;
+    }
+
+    ASSERT(allocator->alloc != NULL && allocator->realloc != NULL &&
+            allocator->free != NULL);
+
+    mm_be = *allocator;
+}
+
+#if defined CC_MM_ACCOUNT && CC_MM_ACCOUNT == 1
+
+#define MM_NMODULE          256
+#define MM_STAT_NAME_LEN    256
+
+/* all atomic */
+struct mm_count {
+    uint64_t            nalloc;
+    uint64_t            nfree;
+    int64_t             byte;
+    int64_t             peak;
+};
+
+struct mm_module {
+    const char          *file;
+    struct mm_count     count;
+};
+
+/* file is published last, a site with a file set is ready to use */
+struct mm_site {
+    const char          *file;          /* __FILE__ as passed, NULL if free */
+    int                 line;
+    struct mm_module    *module;
+    struct mm_count     count;
+};
+
+/* in front of every block, padded so the block stays aligned as malloc's */
+struct mm_hdr {
+    struct mm_site      *site;
+    size_t              size;
+};
+#define MM_HDR_SIZE                                                     \
+    ((sizeof(struct mm_hdr) + alignof(max_align_t) - 1) &               \
+     ~(alignof(max_align_t) - 1))
+
+static struct mm_site mm_site[MM_NSITE];
+static struct mm_module mm_module[MM_NMODULE];
+static uint32_t mm_nmodule = 0;
+static struct mm_module mm_module_other = { "(other)", { 0, 0, 0, 0 } };
+static struct mm_site mm_site_other = { "(other)", 0, &mm_module_other,
+    { 0, 0, 0, 0 } };
+static pthread_mutex_t mm_site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *
+_basename(const char *file)
+{
+    const char *s = strrchr(file, '/');
+
+    return s == NULL ? file : s + 1;
+}
+
+static struct mm_module *
+_mm_module(const char *file)
+{
+    uint32_t i;
+
+    for (i = 0; i < mm_nmodule; i++) {
+        if (strcmp(mm_module[i].file, file) == 0) {
+            return &mm_module[i];
+        }
+    }
+    if (mm_nmodule == MM_NMODULE) {
+        return &mm_module_other;
+    }
+
+    mm_module[mm_nmodule].file = file;
+    /* readers only go as far as nmodule */
+    __atomic_store_n(&mm_nmodule, mm_nmodule + 1, __ATOMIC_RELEASE);
+
+    return &mm_module[mm_nmodule - 1];
+}
+
+static inline uint32_t
+_mm_site_hash(const char *file, int line)
+{
+    uint64_t h = (uint64_t)(uintptr_t)file ^ ((uint64_t)line << 32 | line);
+
+    return (uint32_t)((h * 0x9E3779B97F4A7C15ULL) >> 32) & (MM_NSITE - 1);
+}
+
+/* the site of file:line, added under the lock by the first caller */
+static struct mm_site *
+_mm_site(const char *file, int line)
+{
+    uint32_t h, i;
+    const char *f;
+    bool locked = false;
+
+    for (;;) {
+        for (h = _mm_site_hash(file, line), i = 0; i < MM_NSITE;
+                h = (h + 1) & (MM_NSITE - 1), i++) {
+            f = __atomic_load_n(&mm_site[h].file, __ATOMIC_ACQUIRE);
+            if (f == file && mm_site[h].line == line) {
+                if (locked) {
+                    pthread_mutex_unlock(&mm_site_lock);
+                }
+                return &mm_site[h];
+            }
+            if (f == NULL) {
+                break;
+            }
+        }
+
+        if (i == MM_NSITE) {
+            break;
+        }
+        if (locked) {
+            mm_site[h].line = line;
+            mm_site[h].module = _mm_module(_basename(file));
+            __atomic_store_n(&mm_site[h].file, file, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&mm_site_lock);
+            return &mm_site[h];
+        }
+
+        /* look again under the lock, another thread may have added it */
+        pthread_mutex_lock(&mm_site_lock);
+        locked = true;
+    }
+
+    if (locked) {
+        pthread_mutex_unlock(&mm_site_lock);
+    }
+
+    return &mm_site_other;
+}
+
+static inline void
+_mm_count_add(struct mm_count *c, size_t size)
+{
+    int64_t byte, peak;
+
+    __atomic_add_fetch(&c->nalloc, 1, __ATOMIC_RELAXED);
+    byte = __atomic_add_fetch(&c->byte, (int64_t)size, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+    while (byte > peak && !__atomic_compare_exchange_n(&c->peak, &peak, byte,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void
+_mm_count_sub(struct mm_count *c, size_t size)
+{
+    __atomic_add_fetch(&c->nfree, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&c->byte, (int64_t)size, __ATOMIC_RELAXED);
+}
+
+static void
+_mm_uncharge(struct mm_hdr *hdr)
+{
+    _mm_count_sub(&hdr->site->count, hdr->size);
+    _mm_count_sub(&hdr->site->module->count, hdr->size);
+    INCR(mm_metrics, mm_free);
+    DECR_N(mm_metrics, mm_alloc_byte, hdr->size);
+}
+
+/*
+ * charge a block just (re)allocated at name:line to its site and return the
+ * address handed out; with moved, raw holds a header already (copied over by
+ * realloc), which is uncharged first
+ */
+static void *
+_mm_track(void *raw, size_t size, bool moved, const char *name, int line)
+{
+    struct mm_hdr *hdr = raw;
+
+    if (raw == NULL) {
+        INCR(mm_metrics, mm_alloc_ex);
+        return NULL;
+    }
+
+    if (moved) {
+        _mm_uncharge(hdr);
+    }
+    hdr->site = _mm_site(name, line);
+    hdr->size = size;
+    _mm_count_add(&hdr->site->count, size);
+    _mm_count_add(&hdr->site->module->count, size);
+    INCR(mm_metrics, mm_alloc);
+    INCR_N(mm_metrics, mm_alloc_byte, size);
+
+    return (char *)raw + MM_HDR_SIZE;
+}
+
+/* the block malloc returned for ptr */
+static inline void *
+_mm_raw(void *ptr)
+{
+    return ptr == NULL ? NULL : (char *)ptr - MM_HDR_SIZE;
+}
+
+static void *
+_mm_untrack(void *ptr)
+{
+    void *raw = _mm_raw(ptr);
+
+    if (raw != NULL) {
+        _mm_uncharge(raw);
+    }
+
+    return raw;
+}
+
+#else
+
+#define MM_HDR_SIZE 0
+
+static inline void *
+_mm_track(void *raw, size_t size, bool moved, const char *name, int line)
+{
+    return raw;
+}
+
+static inline void *
+_mm_raw(void *ptr)
+{
+    return ptr;
+}
+
+static inline void *
+_mm_untrack(void *ptr)
+{
+    return ptr;
+}
+
+#endif
+
+void
+mm_setup(mm_options_st *options, mm_metrics_st *metrics)
+{
+    uint64_t node = UINT64_MAX;
+    bool arena = false;
+
+    log_info("set up the %s module", MM_MODULE_NAME);
+
+    if (mm_init) {
+        log_warn("%s has already been setup, overwrite", MM_MODULE_NAME);
+    }
+
+    mm_metrics = metrics;
+
+    mm_hugepage = MM_HUGEPAGE_NONE;
+    mm_hugepage_min = MM_HUGEPAGE_SIZE;
+    mm_numa_node = MM_NUMA_ANY;
+    if (options != NULL) {
+        mm_hugepage = (int)option_uint(&options->mm_hugepage);
+        mm_hugepage_min = option_uint(&options->mm_hugepage_min);
+        if (option_bool(&options->mm_numa_bind)) {
+            node = option_uint(&options->mm_numa_node);
+        }
+        if (option_bool(&options->mm_numa_local)) {
+            node = UINT64_MAX;
+            mm_numa_node = MM_NUMA_LOCAL;
+        }
+        arena = option_bool(&options->mm_arena);
+    }
+
+#if defined CC_JEMALLOC && CC_JEMALLOC == 1
+    __atomic_store_n(&mm_arena, arena, __ATOMIC_RELAXED);
+#else
+    if (arena) {
+        log_warn("per-thread arenas need jemalloc, ignored");
+    }
+#endif
+
+    if (mm_hugepage < MM_HUGEPAGE_NONE || mm_hugepage > MM_HUGEPAGE_TLB) {
+        log_warn("unknown hugepage mode %d, not using hugepages", mm_hugepage);
+        mm_hugepage = MM_HUGEPAGE_NONE;
+    }
+    if (node < MM_NUMA_NODE_MAX) {
+        mm_numa_node = (int)node;
+    } else if (node != UINT64_MAX) {
+        log_warn("numa node %"PRIu64" out of range, not binding", node);
+    }
+
+    mm_init = true;
+}
+
+void
+mm_teardown(void)
+{
+    log_info("tear down the %s module", MM_MODULE_NAME);
+
+    if (!mm_init) {
+        log_warn("%s has never been setup", MM_MODULE_NAME);
+    }
+
+    mm_hugepage = MM_HUGEPAGE_NONE;
+    mm_hugepage_min = MM_HUGEPAGE_SIZE;
+    mm_numa_node = MM_NUMA_ANY;
+    mm_metrics = NULL;
+#if defined CC_JEMALLOC && CC_JEMALLOC == 1
+    __atomic_store_n(&mm_arena, false, __ATOMIC_RELAXED);
+#endif
+
+    mm_init = false;
+}
+
 void *
 _cc_alloc(size_t size, const char *name, int line)
 {
@@ -39,7 +442,7 @@ _cc_alloc(size_t size, const char *name, int line)
         return NULL;
     }
 
-    p = malloc(size);
+    p = _mm_track(mm_be.alloc(size + MM_HDR_SIZE), size, false, name, line);
     if (p == NULL) {
         log_error("malloc(%zu) failed @ %s:%d", size, name, line);
     } else {
@@ -74,12 +477,16 @@ _cc_realloc(void *ptr, size_t size, const char *name, int line)
     void *p;
 
     if (size == 0) {
-        free(ptr);
+        mm_be.free(_mm_untrack(ptr));
         log_debug("realloc(0) @ %s:%d", name, line);
         return NULL;
     }
 
-    p = realloc(ptr, size);
+    /* on failure the block is left as it was, header included */
+    p = mm_be.realloc(_mm_raw(ptr), size + MM_HDR_SIZE);
+    if (p != NULL) {
+        p = _mm_track(p, size, ptr != NULL, name, line);
+    }
     if (p == NULL) {
         log_error("realloc(%zu) failed @ %s:%d", size, name, line);
     } else {
@@ -95,7 +502,7 @@ _cc_realloc_move(void *ptr, size_t size, const char *name, int line)
     void *p = NULL, *pr;
 
     if (size == 0) {
-        free(ptr);
+        mm_be.free(_mm_untrack(ptr));
         log_debug("realloc(0) @ %s:%d", name, line);
         return NULL;
     }
@@ -106,14 +513,20 @@ _cc_realloc_move(void *ptr, size_t size, const char *name, int line)
      * copy size bytes, and calling malloc before the realloc'd data is free'd
      * gives us a new address for the memory object.
      */
-    if (((pr = realloc(ptr, size)) == NULL || (p = malloc(size)) == NULL)) {
+    if (((pr = mm_be.realloc(_mm_raw(ptr), size + MM_HDR_SIZE)) == NULL ||
+                (p = mm_be.alloc(size + MM_HDR_SIZE)) == NULL)) {
         log_error("realloc(%zu) failed @ %s:%d", size, name, line);
+        /* the block is freed below either way */
+        if (pr != NULL && ptr != NULL) {
+            _mm_untrack((char *)pr + MM_HDR_SIZE);
+        }
     } else {
+        memcpy(p, pr, size + MM_HDR_SIZE);
+        p = _mm_track(p, size, ptr != NULL, name, line);
         log_vverb("realloc(%zu) at %p @ %s:%d", size, p, name, line);
-        memcpy(p, pr, size);
     }
 
-    free(pr);
+    mm_be.free(pr);
     return p;
 }
 
@@ -121,32 +534,101 @@ void
 _cc_free(void *ptr, const char *name, int line)
 {
     log_vverb("free(%p) @ %s:%d", ptr, name, line);
-    free(ptr);
+    mm_be.free(_mm_untrack(ptr));
 }
 
-void *
-_cc_mmap(size_t size, const char *name, int line)
+void
+_cc_free_sized(void *ptr, size_t size, const char *name, int line)
 {
-    void *p;
-
-    ASSERT(size != 0);
+    log_vverb("free(%p) of %zu bytes @ %s:%d", ptr, size, name, line);
+    if (mm_be.free_sized == NULL || ptr == NULL) {
+        mm_be.free(_mm_untrack(ptr));
+    } else {
+        mm_be.free_sized(_mm_untrack(ptr), size + MM_HDR_SIZE);
+    }
+}
 
+static void *
+_mmap(size_t size, int flags)
+{
     /*
      * On success, mmap() returns a pointer to the mapped area.  On error,
      * the value MAP_FAILED (that is, (void *) -1) is returned, and errno
      * is set appropriately.
      */
-    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
-            -1, 0);
-    if (p == ((void *) -1)) {
+    return mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+void *
+_cc_mmap_ext(size_t size, int hugepage, int node, const char *name, int line)
+{
+    void *p = MAP_FAILED;
+
+    ASSERT(size != 0);
+
+#ifdef OS_LINUX
+    if (hugepage == MM_HUGEPAGE_TLB) {
+        if (size % MM_HUGEPAGE_SIZE == 0) {
+            p = _mmap(size, MAP_HUGETLB);
+        }
+        if (p == MAP_FAILED) {
+            log_debug("hugetlb mmap %zu bytes @ %s:%d failed, fall back to "
+                    "thp", size, name, line);
+            hugepage = MM_HUGEPAGE_THP;
+        }
+    }
+#endif
+
+    if (p == MAP_FAILED) {
+        p = _mmap(size, 0);
+    }
+    if (p == MAP_FAILED) {
         log_error("mmap %zu bytes @ %s:%d failed: %s", size, name, line,
                 strerror(errno));
         return NULL;
     }
 
+#ifdef OS_LINUX
+    /* pages are not faulted in yet, so advice and policy apply to all */
+    if (hugepage == MM_HUGEPAGE_THP && madvise(p, size, MADV_HUGEPAGE) < 0) {
+        log_warn("madvise hugepage %zu bytes at %p @ %s:%d failed: %s", size, p,
+                name, line, strerror(errno));
+    }
+
+    if (node == MM_NUMA_LOCAL) {
+        int cpu = cpu_current();
+
+        node = cpu == CPU_UNKNOWN ? MM_NUMA_ANY : cpu_node(cpu);
+    }
+    if (node >= 0 && node < MM_NUMA_NODE_MAX) {
+        unsigned long mask[MM_NUMA_NODE_MAX / NODEMASK_BIT] = { 0 };
+
+        mask[node / NODEMASK_BIT] = 1UL << (node % NODEMASK_BIT);
+        if (syscall(SYS_mbind, p, size, MPOL_BIND, mask, MM_NUMA_NODE_MAX + 1,
+                    0) < 0) {
+            log_warn("mbind %zu bytes at %p to node %d @ %s:%d failed: %s",
+                    size, p, node, name, line, strerror(errno));
+        }
+    }
+#endif
+
+    log_vverb("mmap %zu bytes at %p @ %s:%d", size, p, name, line);
+    INCR_N(mm_metrics, mm_mmap_byte, size);
+
     return p;
 }
 
+void *
+_cc_mmap(size_t size, const char *name, int line)
+{
+    if (size < mm_hugepage_min) {
+        return _cc_mmap_ext(size, MM_HUGEPAGE_NONE, MM_NUMA_ANY, name, line);
+    }
+
+    return _cc_mmap_ext(size, mm_hugepage, mm_numa_node, name, line);
+}
+
 int
 _cc_munmap(void *p, size_t size, const char *name, int line)
 {
@@ -163,7 +645,113 @@ _cc_munmap(void *p, size_t size, const char *name, int line)
     if (status < 0) {
         log_error("munmap %p @ %s:%d failed: %s", p, name, line,
                 strerror(errno));
+    } else {
+        DECR_N(mm_metrics, mm_mmap_byte, size);
     }
 
     return status;
 }
+
+#if defined CC_MM_ACCOUNT && CC_MM_ACCOUNT == 1
+
+static void
+_mm_stat(struct mm_stat *st, const char *file, int line, struct mm_count *c)
+{
+    st->file = _basename(file);
+    st->line = line;
+    st->nalloc = __atomic_load_n(&c->nalloc, __ATOMIC_RELAXED);
+    st->nfree = __atomic_load_n(&c->nfree, __ATOMIC_RELAXED);
+    st->byte = __atomic_load_n(&c->byte, __ATOMIC_RELAXED);
+    st->peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+}
+
+uint32_t
+mm_stat_snapshot(struct mm_stat *st, uint32_t n, bool module)
+{
+    uint32_t i, nmodule, nstat = 0;
+    const char *file;
+
+    if (module) {
+        nmodule = __atomic_load_n(&mm_nmodule, __ATOMIC_ACQUIRE);
+        for (i = 0; i < nmodule && nstat < n; i++) {
+            _mm_stat(&st[nstat++], mm_module[i].file, 0, &mm_module[i].count);
+        }
+        if (__atomic_load_n(&mm_module_other.count.nalloc, __ATOMIC_RELAXED) > 0 &&
+                nstat < n) {
+            _mm_stat(&st[nstat++], mm_module_other.file, 0,
+                    &mm_module_other.count);
+        }
+
+        return nstat;
+    }
+
+    for (i = 0; i < MM_NSITE && nstat < n; i++) {
+        file = __atomic_load_n(&mm_site[i].file, __ATOMIC_ACQUIRE);
+        if (file != NULL) {
+            _mm_stat(&st[nstat++], file, mm_site[i].line, &mm_site[i].count);
+        }
+    }
+    if (__atomic_load_n(&mm_site_other.count.nalloc, __ATOMIC_RELAXED) > 0 &&
+            nstat < n) {
+        _mm_stat(&st[nstat++], mm_site_other.file, 0, &mm_site_other.count);
+    }
+
+    return nstat;
+}
+
+size_t
+mm_stat_print(char *buf, size_t nbuf, char *fmt, bool module)
+{
+    struct mm_stat *st;
+    char name[MM_STAT_NAME_LEN], val[CC_INT64_MAXLEN + 1];
+    uint32_t i, nstat;
+    size_t n = 0;
+    int len;
+
+    /* not through cc_alloc, printing should not show up in what it prints */
+    st = malloc(sizeof(struct mm_stat) * (MM_NSITE + 1));
+    if (st == NULL) {
+        return 0;
+    }
+
+    nstat = mm_stat_snapshot(st, MM_NSITE + 1, module);
+    for (i = 0; i < nstat; i++) {
+        len = st[i].line > 0 ?
+            cc_scnprintf(name, sizeof(name), "mm::%s:%d::", st[i].file,
+                    st[i].line) :
+            cc_scnprintf(name, sizeof(name), "mm::%s::", st[i].file);
+
+#define MM_STAT_PRINT(_field, _print) do {                                  \
+        cc_scnprintf(name + len, sizeof(name) - len, "%s", #_field);        \
+        val[_print(val, sizeof(val) - 1, st[i]._field)] = '\0';             \
+        n += cc_scnprintf(buf + n, nbuf - n, fmt, name, val);               \
+    } while (0)
+
+        MM_STAT_PRINT(byte, cc_print_int64);
+        MM_STAT_PRINT(peak, cc_print_int64);
+        MM_STAT_PRINT(nalloc, cc_print_uint64);
+        MM_STAT_PRINT(nfree, cc_print_uint64);
+
+#undef MM_STAT_PRINT
+    }
+
+    free(st);
+
+    return n;
+}
+
+#else
+
+uint32_t
+mm_stat_snapshot(struct mm_stat *st, uint32_t n, bool module)
+{
+    return 0;
+}
+
+size_t
+mm_stat_print(char *buf, size_t nbuf, char *fmt, bool module)
+{
+    return 0;
+}
+
+#endif
@@ -670,6 +670,114 @@ option_load_file(FILE *fp, struct option options[], unsigned int nopt)
     return CC_OK;
 }
 
+static bool
+_option_changed(struct option *opt, struct option *next)
+{
+    switch (opt->type) {
+    case OPTION_TYPE_BOOL:
+        return opt->val.vbool != next->val.vbool;
+
+    case OPTION_TYPE_UINT:
+        return opt->val.vuint != next->val.vuint;
+
+    case OPTION_TYPE_FPN:
+        return opt->val.vfpn != next->val.vfpn;
+
+    case OPTION_TYPE_STR:
+        if (opt->val.vstr == NULL || next->val.vstr == NULL) {
+            return opt->val.vstr != next->val.vstr;
+        }
+        return cc_strcmp(opt->val.vstr, next->val.vstr) != 0;
+
+    default:
+        NOT_REACHED();
+        return false;
+    }
+}
+
+/* exchange the live value of opt with the one held in its copy */
+static void
+_option_swap(struct option *opt, struct option *copy)
+{
+    option_val_u val;
+
+    __atomic_exchange(&opt->val, &copy->val, &val, __ATOMIC_ACQ_REL);
+    copy->val = val;
+}
+
+rstatus_i
+option_reload_file(FILE *fp, struct option options[], unsigned int nopt,
+        option_apply_fn apply, void *arg)
+{
+    struct option *next;
+    option_val_u old;
+    rstatus_i status = CC_OK;
+    unsigned int i;
+
+    next = cc_alloc(nopt * sizeof(struct option));
+    if (next == NULL) {
+        log_stderr("cannot reload config, OOM");
+        return CC_ENOMEM;
+    }
+
+    /* parse into a copy, so a bad file leaves the live values alone */
+    for (i = 0; i < nopt; i++) {
+        next[i] = options[i];
+        next[i].val.vstr = NULL;
+    }
+    if (option_load_default(next, nopt) != CC_OK ||
+            option_load_file(fp, next, nopt) != CC_OK) {
+        log_stderr("reload config failed, keeping the current values");
+        option_free(next, nopt);
+        cc_free(next);
+        return CC_ERROR;
+    }
+
+    for (i = 0; i < nopt; i++) {
+        if (!_option_changed(&options[i], &next[i])) {
+            continue;
+        }
+
+        /* the copy takes the old value, to be freed below */
+        old = options[i].val;
+        __atomic_store(&options[i].val, &next[i].val, __ATOMIC_RELEASE);
+        next[i].val = old;
+        if (apply != NULL && apply(&options[i], old, arg) != CC_OK) {
+            log_stderr("option '%s' could not be applied, reverting reload",
+                    options[i].name);
+            status = CC_ERROR;
+            break;
+        }
+    }
+
+    /**
+     * all or nothing: on failure every option published so far goes back,
+     * including the one rejected, and apply runs again for those it had
+     * accepted so their modules follow. Options swapped above are exactly
+     * those whose copy now differs from the live value.
+     */
+    if (status != CC_OK) {
+        _option_swap(&options[i], &next[i]);
+        while (i-- > 0) {
+            if (!_option_changed(&options[i], &next[i])) {
+                continue;
+            }
+
+            _option_swap(&options[i], &next[i]);
+            if (apply != NULL && apply(&options[i], next[i].val, arg) !=
+                    CC_OK) {
+                log_stderr("option '%s' could not be rolled back",
+                        options[i].name);
+            }
+        }
+    }
+
+    option_free(next, nopt);
+    cc_free(next);
+
+    return status;
+}
+
 void
 option_free(struct option options[], unsigned int nopt)
 {
@@ -17,25 +17,55 @@
 
 #include <cc_print.h>
 
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
 /*
  * Note: the impelmentation of cc_print_uint64_unsafe uses Facebook/folly's
  * implementation as a reference (folly/Conv.h)
  */
 
 /* use our own macro instead of llabs() to make sure it works with INT64_MIN */
-#define abs_int64(_x) ((_x) >= 0 ? (_x) : -(_x))
+#define abs_int64(_x) ((_x) >= 0 ? (uint64_t)(_x) : 0 - (uint64_t)(_x))
+
+static const char DIGITS2[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* decimals with exactly representable powers of 10, tried before vsnprintf */
+#define DOUBLE_FAST_DECIMALS 15
+#define DOUBLE_FAST_MIN      1e-4
+#define DOUBLE_EXACT_MAX     9007199254740992.0 /* 2^53 */
+
+static const double POW10[DOUBLE_FAST_DECIMALS + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15};
 
+/* writes the d digits of n backwards from buf + d, two at a time */
 static inline void
 _print_uint64(char *buf, size_t d, uint64_t n)
 {
     char *p;
+    uint32_t r;
 
     p = buf + d;
-    do {
-        p--;
-        *p = '0' + n % 10;
-        n = n / 10;
-    } while (n > 0);
+    while (n >= 100) {
+        r = (uint32_t)(n % 100);
+        n = n / 100;
+        p -= 2;
+        memcpy(p, DIGITS2 + 2 * r, 2);
+    }
+
+    if (n >= 10) {
+        memcpy(p - 2, DIGITS2 + 2 * n, 2);
+    } else {
+        *(p - 1) = '0' + (char)n;
+    }
 }
 
 size_t
@@ -95,11 +125,92 @@ cc_print_int64(char *buf, size_t size, int64_t n)
         *buf++ = '-';
     }
 
-    _print_uint64(buf, d, n);
+    _print_uint64(buf, d, ab);
 
     return d + (n < 0);
 }
 
+static inline size_t
+_print_str(char *buf, size_t size, const char *str, size_t len)
+{
+    if (size < len) {
+        return 0;
+    }
+
+    memcpy(buf, str, len);
+
+    return len;
+}
+
+size_t
+cc_print_double(char *buf, size_t size, double n)
+{
+    char tmp[CC_DOUBLE_MAXLEN + 8];
+    bool neg = signbit(n);
+    double ab = fabs(n), y;
+    uint64_t m, ip;
+    size_t d, len;
+    int k;
+
+    if (isnan(n)) {
+        return _print_str(buf, size, "nan", 3);
+    }
+    if (isinf(n)) {
+        return neg ? _print_str(buf, size, "-inf", 4) :
+            _print_str(buf, size, "inf", 3);
+    }
+
+    /*
+     * Most values we print (metrics, ratios, latencies) have few decimals:
+     * find the fewest decimals k for which the integer m nearest n * 10^k
+     * reads back as n. Both m and 10^k are exact and IEEE division rounds
+     * correctly, so m / 10^k == n means strtod of the decimal does too.
+     */
+    if (ab == 0.0 || ab >= DOUBLE_FAST_MIN) {
+        for (k = 0; k <= DOUBLE_FAST_DECIMALS; k++) {
+            y = ab * POW10[k];
+            if (y >= DOUBLE_EXACT_MAX) {
+                break;
+            }
+            m = (uint64_t)(y + 0.5);
+            if ((double)m / POW10[k] != ab) {
+                continue;
+            }
+
+            ip = (k == 0) ? m : m / BASE10[k];
+            d = digits(ip);
+            len = neg + d + (k > 0) + k;
+            if (size < len) {
+                return 0;
+            }
+            if (neg) {
+                *buf = '-';
+            }
+            _print_uint64(buf + neg, d, ip);
+            if (k > 0) {
+                buf[neg + d] = '.';
+                m -= ip * BASE10[k];
+                /* zero-pad the fraction to k digits */
+                memset(buf + neg + d + 1, '0', k);
+                _print_uint64(buf + neg + d + 1 + k - digits(m), digits(m), m);
+            }
+
+            return len;
+        }
+    }
+
+    /* large, tiny or long: search for the shortest precision that works */
+    len = 0;
+    for (k = 1; k <= 17; k++) {
+        len = (size_t)snprintf(tmp, sizeof(tmp), "%.*g", k, n);
+        if (strtod(tmp, NULL) == n) {
+            break;
+        }
+    }
+
+    return _print_str(buf, size, tmp, len);
+}
+
 size_t
 _vscnprintf(char *buf, size_t size, const char *fmt, va_list args)
 {
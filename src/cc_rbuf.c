@@ -87,8 +87,7 @@ rbuf_destroy(struct rbuf **buf)
         log_verb("Destroy ring buffer %p", *buf);
         uint32_t cap = (*buf)->cap;
 
-        cc_free(*buf);
-        *buf = NULL;
+        cc_free_sized(*buf, RBUF_HDR_SIZE + cap + 1);
         INCR(rbuf_metrics, rbuf_destroy);
         DECR(rbuf_metrics, rbuf_curr);
         DECR_N(rbuf_metrics, rbuf_byte, RBUF_HDR_SIZE + cap + 1);
@@ -222,13 +221,79 @@ rbuf_read(void *dst, struct rbuf *src, size_t n)
     return ret;
 }
 
-size_t
-rbuf_write(struct rbuf *dst, void *src, size_t n)
+int
+rbuf_peek(struct rbuf *buf, struct iovec iov[2])
 {
-    size_t capacity, ret;
     uint32_t rpos, wpos;
-    rpos = get_rpos(dst);
-    wpos = get_wpos(dst);
+    int iovcnt = 0;
+    rpos = get_rpos(buf);
+    wpos = get_wpos(buf);
+
+    if (wpos < rpos) {
+        /* until end, then wrap around */
+        if (rpos <= buf->cap) {
+            iov[iovcnt].iov_base = buf->data + rpos;
+            iov[iovcnt++].iov_len = buf->cap - rpos + 1;
+        }
+        if (wpos > 0) {
+            iov[iovcnt].iov_base = buf->data;
+            iov[iovcnt++].iov_len = wpos;
+        }
+    } else if (wpos > rpos) {
+        iov[iovcnt].iov_base = buf->data + rpos;
+        iov[iovcnt++].iov_len = wpos - rpos;
+    }
+
+    return iovcnt;
+}
+
+void
+rbuf_consume(struct rbuf *buf, size_t n)
+{
+    ASSERT(n <= rbuf_rcap(buf));
+
+    set_rpos(buf, (get_rpos(buf) + n) % (buf->cap + 1));
+}
+
+int
+rbuf_reserve(struct rbuf *buf, size_t n, struct iovec iov[2])
+{
+    uint32_t wpos;
+    size_t first;
+    int iovcnt = 0;
+
+    if (n == 0 || rbuf_wcap(buf) < n) {
+        return 0;
+    }
+
+    wpos = get_wpos(buf) % (buf->cap + 1);
+    first = _min(n, buf->cap + 1 - wpos);
+    iov[iovcnt].iov_base = buf->data + wpos;
+    iov[iovcnt++].iov_len = first;
+    if (first < n) {
+        /* wrap around */
+        iov[iovcnt].iov_base = buf->data;
+        iov[iovcnt++].iov_len = n - first;
+    }
+
+    return iovcnt;
+}
+
+void
+rbuf_commit(struct rbuf *buf, size_t n)
+{
+    ASSERT(n <= rbuf_wcap(buf));
+
+    set_wpos(buf, (get_wpos(buf) + n) % (buf->cap + 1));
+}
+
+/* copy into dst at *wpos without publishing the new write offset */
+static size_t
+_rbuf_put(struct rbuf *dst, uint32_t *wposp, uint32_t rpos, const void *src,
+        size_t n)
+{
+    size_t capacity, ret;
+    uint32_t wpos = *wposp;
 
     if (wpos < rpos) {
         /* no wrapping around */
@@ -260,6 +325,37 @@ rbuf_write(struct rbuf *dst, void *src, size_t n)
         }
     }
 
+    *wposp = wpos;
+
+    return ret;
+}
+
+size_t
+rbuf_write(struct rbuf *dst, void *src, size_t n)
+{
+    size_t ret;
+    uint32_t wpos = get_wpos(dst);
+
+    ret = _rbuf_put(dst, &wpos, get_rpos(dst), src, n);
+    set_wpos(dst, wpos);
+
+    return ret;
+}
+
+size_t
+rbuf_writev(struct rbuf *dst, const struct iovec *iov, int iovcnt)
+{
+    size_t ret = 0, n;
+    uint32_t rpos = get_rpos(dst), wpos = get_wpos(dst);
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        n = _rbuf_put(dst, &wpos, rpos, iov[i].iov_base, iov[i].iov_len);
+        ret += n;
+        if (n < iov[i].iov_len) {
+            break;
+        }
+    }
     set_wpos(dst, wpos);
 
     return ret;
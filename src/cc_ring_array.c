@@ -26,7 +26,7 @@
 #define RING_ARRAY_HDR_SIZE   offsetof(struct ring_array, data)
 
 /**
- * The total number of slots allocated is (cap + 1)
+ * In SPSC mode, the total number of slots allocated is (cap + 1)
  *
  * Each ring array should have exactly one reader and exactly one writer, as
  * far as threads are concerned (which can be the same). This allows the use of
@@ -70,8 +70,8 @@
  *
  */
 
-static inline uint32_t
-ring_array_nelem(uint32_t rpos, uint32_t wpos, uint32_t cap)
+static inline uint64_t
+ring_array_nelem(uint64_t rpos, uint64_t wpos, uint32_t cap)
 {
     if (rpos <= wpos) { /* condition 1), 2) */
         return wpos - rpos;
@@ -80,95 +80,348 @@ ring_array_nelem(uint32_t rpos, uint32_t wpos, uint32_t cap)
     }
 }
 
+static inline uint8_t *
+ring_array_slot(const struct ring_array *arr, uint64_t idx)
+{
+    return (uint8_t *)arr->data + arr->slot_size * idx;
+}
+
+/**
+ * In MPMC mode there are exactly cap slots, and rpos/wpos are 64-bit counters
+ * that never wrap in practice; the slot used by position pos is pos % cap.
+ * Each slot starts with a sequence number followed by the element:
+ *
+ * - seq == pos: the slot is free and ready to be written at position pos
+ * - seq == pos + 1: the slot holds the element written at position pos
+ *
+ * A producer claims positions by advancing wpos with a CAS, writes the
+ * elements, then sets seq to pos + 1 to publish them. A consumer claims
+ * positions by advancing rpos, copies the elements out, then sets seq to
+ * pos + cap to hand the slot to the producer one lap later.
+ */
+static inline uint64_t *
+_mpmc_seq(const struct ring_array *arr, uint64_t pos)
+{
+    return (uint64_t *)ring_array_slot(arr, pos % arr->cap);
+}
+
+/*
+ * claim up to n consecutive positions from *p, whose slots must have a
+ * sequence number of (position + off), return # of positions claimed and the
+ * first one in start
+ */
+static uint32_t
+_mpmc_claim(struct ring_array *arr, uint64_t *p, uint32_t n, uint64_t off,
+        uint64_t *start)
+{
+    uint64_t pos, seq;
+    uint32_t k;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    pos = __atomic_load_n(p, __ATOMIC_RELAXED);
+    for (;;) {
+        seq = __atomic_load_n(_mpmc_seq(arr, pos), __ATOMIC_ACQUIRE);
+        if (seq == pos + off) {
+            for (k = 1; k < n; k++) {
+                if (__atomic_load_n(_mpmc_seq(arr, pos + k), __ATOMIC_ACQUIRE)
+                        != pos + k + off) {
+                    break;
+                }
+            }
+            if (__atomic_compare_exchange_n(p, &pos, pos + k, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *start = pos;
+                return k;
+            }
+            /* pos has been refreshed by the failed CAS */
+        } else if ((int64_t)(seq - (pos + off)) < 0) {
+            /* slot not yet released by the other side: full or empty */
+            return 0;
+        } else {
+            /* another thread has claimed pos, catch up */
+            pos = __atomic_load_n(p, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static uint32_t
+_mpmc_push_n(const void *elem, uint32_t n, struct ring_array *arr)
+{
+    uint64_t pos, *seq;
+    uint32_t i, k;
+
+    k = _mpmc_claim(arr, &arr->wpos, n, 0, &pos);
+    for (i = 0; i < k; i++) {
+        seq = _mpmc_seq(arr, pos + i);
+        cc_memcpy(seq + 1, (const uint8_t *)elem + arr->elem_size * i,
+                arr->elem_size);
+        __atomic_store_n(seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+
+    return k;
+}
+
+static uint32_t
+_mpmc_pop_n(void *elem, uint32_t n, struct ring_array *arr)
+{
+    uint64_t pos, *seq;
+    uint32_t i, k;
+
+    k = _mpmc_claim(arr, &arr->rpos, n, 1, &pos);
+    for (i = 0; i < k; i++) {
+        seq = _mpmc_seq(arr, pos + i);
+        if (elem != NULL) {
+            cc_memcpy((uint8_t *)elem + arr->elem_size * i, seq + 1,
+                    arr->elem_size);
+        }
+        __atomic_store_n(seq, pos + i + arr->cap, __ATOMIC_RELEASE);
+    }
+
+    return k;
+}
+
+/* # of elements claimed by producers but not yet by consumers */
+static inline uint64_t
+_mpmc_nelem(const struct ring_array *arr)
+{
+    /* load rpos first: wpos never falls behind a previously observed rpos */
+    uint64_t rpos = __atomic_load_n(&(arr->rpos), __ATOMIC_RELAXED);
+    uint64_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_RELAXED);
+
+    return wpos - rpos;
+}
+
+/*
+ * SPSC: copy as many elements as fit in one go, which is at most two chunks
+ * (up to the end of the array, then from the beginning), and publish the new
+ * wpos once. The release store makes the elements visible to the consumer
+ * before the new wpos; the acquire load of rpos keeps us from overwriting
+ * slots the consumer is still reading.
+ */
+static uint32_t
+_spsc_push_n(const void *elem, uint32_t n, struct ring_array *arr)
+{
+    uint64_t rpos, wpos = arr->wpos, nslot = (uint64_t)arr->cap + 1;
+    uint32_t navail, first;
+
+    rpos = __atomic_load_n(&(arr->rpos), __ATOMIC_ACQUIRE);
+    navail = arr->cap - ring_array_nelem(rpos, wpos, arr->cap);
+    if (n > navail) {
+        n = navail;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    first = (nslot - wpos < n) ? nslot - wpos : n;
+    cc_memcpy(ring_array_slot(arr, wpos), elem, arr->elem_size * first);
+    if (first < n) {
+        cc_memcpy(ring_array_slot(arr, 0),
+                (const uint8_t *)elem + arr->elem_size * first,
+                arr->elem_size * (n - first));
+    }
+
+    __atomic_store_n(&(arr->wpos), (wpos + n) % nslot, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+/* SPSC: mirror of _spsc_push_n on the consumer side */
+static uint32_t
+_spsc_pop_n(void *elem, uint32_t n, struct ring_array *arr)
+{
+    uint64_t wpos, rpos = arr->rpos, nslot = (uint64_t)arr->cap + 1;
+    uint32_t navail, first;
+
+    wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_ACQUIRE);
+    navail = ring_array_nelem(rpos, wpos, arr->cap);
+    if (n > navail) {
+        n = navail;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    if (elem != NULL) {
+        first = (nslot - rpos < n) ? nslot - rpos : n;
+        cc_memcpy(elem, ring_array_slot(arr, rpos), arr->elem_size * first);
+        if (first < n) {
+            cc_memcpy((uint8_t *)elem + arr->elem_size * first,
+                    ring_array_slot(arr, 0), arr->elem_size * (n - first));
+        }
+    }
+
+    __atomic_store_n(&(arr->rpos), (rpos + n) % nslot, __ATOMIC_RELEASE);
+
+    return n;
+}
+
 rstatus_i
 ring_array_push(const void *elem, struct ring_array *arr)
 {
-    uint32_t new_wpos;
+    uint32_t n;
+
+    if (arr->type == RING_ARRAY_MPMC) {
+        n = _mpmc_push_n(elem, 1, arr);
+    } else {
+        n = _spsc_push_n(elem, 1, arr);
+    }
 
-    if (ring_array_full(arr)) {
+    if (n == 0) {
         log_debug("Could not push to ring array %p; array is full", arr);
         return CC_ERROR;
     }
 
-    cc_memcpy(arr->data + (arr->elem_size * arr->wpos), elem, arr->elem_size);
+    return CC_OK;
+}
 
-    /* update wpos atomically */
-    new_wpos = (arr->wpos + 1) % (arr->cap + 1);
-    __atomic_store_n(&(arr->wpos), new_wpos, __ATOMIC_RELAXED);
+uint32_t
+ring_array_push_n(const void *elem, uint32_t n, struct ring_array *arr)
+{
+    if (arr->type == RING_ARRAY_MPMC) {
+        return _mpmc_push_n(elem, n, arr);
+    }
 
-    return CC_OK;
+    return _spsc_push_n(elem, n, arr);
 }
 
 bool
 ring_array_full(const struct ring_array *arr)
 {
+    uint64_t rpos;
+
+    if (arr->type == RING_ARRAY_MPMC) {
+        return _mpmc_nelem(arr) >= arr->cap;
+    }
+
     /*
      * Take snapshot of rpos, since another thread might be popping. Note: other
      * members of arr do not need to be saved because we assume the other thread
      * only pops and does not push; in other words, only one thread updates
      * either rpos or wpos.
      */
-    uint32_t rpos = __atomic_load_n(&(arr->rpos), __ATOMIC_RELAXED);
+    rpos = __atomic_load_n(&(arr->rpos), __ATOMIC_ACQUIRE);
     return ring_array_nelem(rpos, arr->wpos, arr->cap) == arr->cap;
 }
 
 rstatus_i
 ring_array_pop(void *elem, struct ring_array *arr)
 {
-    uint32_t new_rpos;
+    uint32_t n;
+
+    if (arr->type == RING_ARRAY_MPMC) {
+        n = _mpmc_pop_n(elem, 1, arr);
+    } else {
+        n = _spsc_pop_n(elem, 1, arr);
+    }
 
-    if (ring_array_empty(arr)) {
+    if (n == 0) {
         log_debug("Could not pop from ring array %p; array is empty", arr);
         return CC_ERROR;
     }
 
-    if (elem != NULL) {
-        cc_memcpy(elem, arr->data + (arr->elem_size * arr->rpos), arr->elem_size);
-    }
+    return CC_OK;
+}
 
-    /* update rpos atomically */
-    new_rpos = (arr->rpos + 1) % (arr->cap + 1);
-    __atomic_store_n(&(arr->rpos), new_rpos, __ATOMIC_RELAXED);
+uint32_t
+ring_array_pop_n(void *elem, uint32_t n, struct ring_array *arr)
+{
+    if (arr->type == RING_ARRAY_MPMC) {
+        return _mpmc_pop_n(elem, n, arr);
+    }
 
-    return CC_OK;
+    return _spsc_pop_n(elem, n, arr);
 }
 
 bool
 ring_array_empty(const struct ring_array *arr)
 {
+    uint64_t wpos;
+
+    if (arr->type == RING_ARRAY_MPMC) {
+        return _mpmc_nelem(arr) == 0;
+    }
+
     /* take snapshot of wpos, since another thread might be pushing */
-    uint32_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_RELAXED);
+    wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_ACQUIRE);
     return ring_array_nelem(arr->rpos, wpos, arr->cap) == 0;
 }
 
 void
 ring_array_flush(struct ring_array *arr)
 {
-    uint32_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_RELAXED);
-    __atomic_store_n(&(arr->rpos), wpos, __ATOMIC_RELAXED);
+    uint64_t wpos;
+
+    if (arr->type == RING_ARRAY_MPMC) {
+        /* slots must be handed back one by one, discard what is published */
+        _mpmc_pop_n(NULL, arr->cap, arr);
+        return;
+    }
+
+    wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_ACQUIRE);
+    __atomic_store_n(&(arr->rpos), wpos, __ATOMIC_RELEASE);
 }
 
-struct ring_array *
-ring_array_create(size_t elem_size, uint32_t cap)
+static struct ring_array *
+_ring_array_create(size_t elem_size, uint32_t cap, uint32_t type)
 {
     struct ring_array *arr;
+    size_t slot_size;
+    uint64_t i, nslot;
+
+    if (type == RING_ARRAY_MPMC) {
+        if (cap == 0) {
+            log_error("Could not create MPMC ring array with cap 0");
+            return NULL;
+        }
+        /* keep the sequence number of every slot 8-byte aligned */
+        slot_size = sizeof(uint64_t) + CC_ALIGN(elem_size, sizeof(uint64_t));
+        nslot = cap;
+    } else {
+        /* underlying array has # items stored + 1, since full is when wpos is
+           1 element behind rpos */
+        slot_size = elem_size;
+        nslot = (uint64_t)cap + 1;
+    }
 
-    /* underlying array has # items stored + 1, since full is when wpos is 1
-       element behind wpos */
-    arr = cc_alloc(RING_ARRAY_HDR_SIZE + elem_size * (cap + 1));
+    arr = cc_alloc(RING_ARRAY_HDR_SIZE + slot_size * nslot);
 
     if (arr == NULL) {
         log_error("Could not allocate memory for ring array cap %u "
-                  "elem_size %u", cap, elem_size);
+                  "elem_size %zu", cap, elem_size);
         return NULL;
     }
 
     arr->elem_size = elem_size;
+    arr->slot_size = slot_size;
     arr->cap = cap;
+    arr->type = type;
     arr->rpos = arr->wpos = 0;
+
+    if (type == RING_ARRAY_MPMC) {
+        for (i = 0; i < nslot; i++) {
+            *_mpmc_seq(arr, i) = i;
+        }
+    }
+
     return arr;
 }
 
+struct ring_array *
+ring_array_create(size_t elem_size, uint32_t cap)
+{
+    return _ring_array_create(elem_size, cap, RING_ARRAY_SPSC);
+}
+
+struct ring_array *
+ring_array_create_mpmc(size_t elem_size, uint32_t cap)
+{
+    return _ring_array_create(elem_size, cap, RING_ARRAY_MPMC);
+}
+
 void
 ring_array_destroy(struct ring_array **arr)
 {
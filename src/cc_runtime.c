@@ -0,0 +1,500 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_runtime.h>
+
+#include <cc_debug.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#define RUNTIME_MODULE_NAME "ccommon::runtime"
+
+static bool runtime_init = false;
+static runtime_metrics_st *runtime_metrics = NULL;
+static METRIC_SHARD_DECLARE(runtime_metrics);
+static uint32_t nworker_default = RUNTIME_NWORKER;
+static uint32_t nevent = RUNTIME_NEVENT;
+static uint32_t tick_ms = RUNTIME_TICK;
+static uint32_t nslot = RUNTIME_NSLOT;
+static uint32_t queue = RUNTIME_QUEUE;
+static uint32_t task_batch = RUNTIME_TASK_BATCH;
+static bool pin = RUNTIME_PIN;
+
+static __thread struct runtime_worker *self = NULL;
+
+void
+runtime_setup(runtime_options_st *options, runtime_metrics_st *metrics)
+{
+    log_info("set up the %s module", RUNTIME_MODULE_NAME);
+
+    if (runtime_init) {
+        log_warn("%s has already been setup, overwrite", RUNTIME_MODULE_NAME);
+    }
+
+    runtime_metrics = metrics;
+
+    if (options != NULL) {
+        nworker_default = option_uint(&options->runtime_nworker);
+        nevent = option_uint(&options->runtime_nevent);
+        tick_ms = option_uint(&options->runtime_tick);
+        nslot = option_uint(&options->runtime_nslot);
+        queue = option_uint(&options->runtime_queue);
+        task_batch = option_uint(&options->runtime_task_batch);
+        pin = option_bool(&options->runtime_pin);
+    }
+
+    runtime_init = true;
+}
+
+void
+runtime_teardown(void)
+{
+    log_info("tear down the %s module", RUNTIME_MODULE_NAME);
+
+    if (!runtime_init) {
+        log_warn("%s has never been setup", RUNTIME_MODULE_NAME);
+    }
+
+    metric_shard_release((struct metric *)runtime_metrics,
+            METRIC_CARDINALITY(*runtime_metrics));
+    runtime_metrics = NULL;
+    nworker_default = RUNTIME_NWORKER;
+    nevent = RUNTIME_NEVENT;
+    tick_ms = RUNTIME_TICK;
+    nslot = RUNTIME_NSLOT;
+    queue = RUNTIME_QUEUE;
+    task_batch = RUNTIME_TASK_BATCH;
+    pin = RUNTIME_PIN;
+    runtime_init = false;
+}
+
+/* the notify conn is registered with the worker itself as data */
+static void
+_runtime_event(void *data, uint32_t events)
+{
+    struct runtime_worker *w = self;
+
+    ASSERT(w != NULL);
+
+    if (data == w) {
+        notify_recv(w->notify);
+        return;
+    }
+
+    if (w->rt->event_cb != NULL) {
+        w->rt->event_cb(data, events);
+    }
+}
+
+static void
+_runtime_worker_deinit(struct runtime_worker *w)
+{
+    if (w->tw != NULL) {
+        timing_wheel_destroy(&w->tw);
+    }
+    event_base_destroy(&w->evb);
+    if (w->notify != NULL) {
+        notify_close(w->notify);
+        notify_conn_destroy(&w->notify);
+    }
+    if (w->handoff != NULL) {
+        ring_array_destroy(&w->handoff);
+    }
+    if (w->task != NULL) {
+        ring_array_destroy(&w->task);
+    }
+}
+
+static rstatus_i
+_runtime_worker_init(struct runtime_worker *w, struct runtime *rt, uint32_t id)
+{
+    struct timeout tick;
+
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->rt = rt;
+    w->cpu = CPU_UNKNOWN;
+    w->node = MM_NUMA_ANY;
+
+    timeout_set_ms(&tick, tick_ms);
+    w->evb = event_base_create(nevent, _runtime_event);
+    w->tw = timing_wheel_create(&tick, nslot, 0);
+    w->notify = notify_conn_create();
+    w->handoff = ring_array_create_mpmc(sizeof(void *), queue);
+    w->task = ring_array_create_mpmc(sizeof(struct runtime_task), queue);
+    if (w->evb == NULL || w->tw == NULL || w->notify == NULL ||
+            w->handoff == NULL || w->task == NULL) {
+        log_error("create runtime worker %"PRIu32" failed: OOM", id);
+        goto error;
+    }
+
+    if (!notify_open(w->notify)) {
+        log_error("open notify conn for runtime worker %"PRIu32" failed", id);
+        goto error;
+    }
+    if (event_add_read(w->evb, notify_read_id(w->notify), w) < 0) {
+        log_error("register notify conn for runtime worker %"PRIu32" failed",
+                id);
+        goto error;
+    }
+
+    return CC_OK;
+
+error:
+    _runtime_worker_deinit(w);
+
+    return CC_ENOMEM;
+}
+
+struct runtime *
+runtime_create(uint32_t nworker, event_cb_fn event_cb,
+        runtime_handoff_fn handoff_cb)
+{
+    struct runtime *rt;
+    uint32_t i;
+
+    if (nworker == 0) {
+        nworker = nworker_default;
+    }
+    ASSERT(nworker > 0);
+
+    rt = cc_alloc(sizeof(*rt));
+    if (rt == NULL) {
+        return NULL;
+    }
+    rt->worker = cc_alloc(sizeof(*rt->worker) * nworker);
+    if (rt->worker == NULL) {
+        cc_free(rt);
+        return NULL;
+    }
+
+    for (i = 0; i < nworker; i++) {
+        if (_runtime_worker_init(&rt->worker[i], rt, i) != CC_OK) {
+            while (i-- > 0) {
+                _runtime_worker_deinit(&rt->worker[i]);
+            }
+            cc_free(rt->worker);
+            cc_free(rt);
+            return NULL;
+        }
+    }
+    rt->nworker = nworker;
+    rt->next = 0;
+    rt->stop = false;
+    rt->event_cb = event_cb;
+    rt->handoff_cb = handoff_cb;
+    rt->start_cb = NULL;
+    rt->stop_cb = NULL;
+
+    log_info("created runtime %p with %"PRIu32" workers", rt, nworker);
+
+    return rt;
+}
+
+void
+runtime_destroy(struct runtime **rt)
+{
+    struct runtime *r;
+    uint32_t i, n;
+
+    if (rt == NULL || *rt == NULL) {
+        return;
+    }
+
+    r = *rt;
+    runtime_stop(r);
+    for (i = 0; i < r->nworker; i++) {
+        struct runtime_worker *w = &r->worker[i];
+
+        n = ring_array_pop_n(NULL, UINT32_MAX, w->handoff);
+        n += ring_array_pop_n(NULL, UINT32_MAX, w->task);
+        if (n > 0) {
+            log_warn("runtime worker %"PRIu32" destroyed with %"PRIu32" tasks "
+                    "and handoffs pending", w->id, n);
+        }
+        _runtime_worker_deinit(w);
+    }
+    cc_free(r->worker);
+    cc_free(r);
+    *rt = NULL;
+}
+
+void
+runtime_set_hooks(struct runtime *rt, runtime_worker_fn start_cb,
+        runtime_worker_fn stop_cb)
+{
+    ASSERT(rt != NULL);
+
+    rt->start_cb = start_cb;
+    rt->stop_cb = stop_cb;
+}
+
+static void
+_runtime_handoff_drain(struct runtime_worker *w)
+{
+    void *ptr;
+
+    while (ring_array_pop(&ptr, w->handoff) == CC_OK) {
+        if (w->rt->handoff_cb != NULL) {
+            w->rt->handoff_cb(w, ptr);
+        }
+    }
+}
+
+/* take one queued task, from the worker itself first, else from the others */
+static bool
+_runtime_task_next(struct runtime_worker *w, struct runtime_task *t)
+{
+    struct runtime *rt = w->rt;
+    uint32_t i;
+
+    if (ring_array_pop(t, w->task) == CC_OK) {
+        return true;
+    }
+
+    for (i = 1; i < rt->nworker; i++) {
+        struct runtime_worker *victim = &rt->worker[(w->id + i) % rt->nworker];
+
+        if (!ring_array_empty(victim->task) &&
+                ring_array_pop(t, victim->task) == CC_OK) {
+            INCR_SHARD(runtime_metrics, runtime_task_steal);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* run up to task_batch tasks, return true if there may be more */
+static bool
+_runtime_task_run(struct runtime_worker *w)
+{
+    struct runtime_task t;
+    uint32_t i;
+
+    for (i = 0; i < task_batch; i++) {
+        if (!_runtime_task_next(w, &t)) {
+            return false;
+        }
+        t.fn(t.arg);
+        INCR_SHARD(runtime_metrics, runtime_task_run);
+    }
+
+    return true;
+}
+
+/* wake up an idle worker other than w to steal from it, if there is one */
+static void
+_runtime_wake_thief(struct runtime_worker *w)
+{
+    struct runtime *rt = w->rt;
+    uint32_t i;
+
+    for (i = 1; i < rt->nworker; i++) {
+        struct runtime_worker *thief = &rt->worker[(w->id + i) % rt->nworker];
+
+        if (__atomic_load_n(&thief->idle, __ATOMIC_SEQ_CST)) {
+            notify_send(thief->notify);
+            return;
+        }
+    }
+}
+
+static void *
+_runtime_worker(void *arg)
+{
+    struct runtime_worker *w = arg;
+    struct runtime *rt = w->rt;
+    bool busy = false;
+    int timeout;
+
+    self = w;
+    INCR(runtime_metrics, runtime_worker);
+    log_info("runtime worker %"PRIu32" started", w->id);
+
+    if (pin && cpu_count() > 0) {
+        int cpu = cpu_get(w->id % cpu_count())->cpu;
+
+        if (cpu_pin(cpu) == CC_OK) {
+            w->cpu = cpu;
+            w->node = cpu_node(cpu);
+            log_info("runtime worker %"PRIu32" pinned to cpu %d on node %d",
+                    w->id, w->cpu, w->node);
+        }
+    }
+
+    if (rt->start_cb != NULL) {
+        rt->start_cb(w);
+    }
+    timing_wheel_start(w->tw);
+
+    while (!__atomic_load_n(&rt->stop, __ATOMIC_ACQUIRE)) {
+        if (busy || !ring_array_empty(w->task)) {
+            timeout = 0;
+        } else {
+            /* submitters check idle after queueing, then look for work */
+            __atomic_store_n(&w->idle, true, __ATOMIC_SEQ_CST);
+            timeout = timing_wheel_next_ms(w->tw);
+            if (!ring_array_empty(w->task) || !ring_array_empty(w->handoff)) {
+                timeout = 0;
+            }
+        }
+        event_wait(w->evb, timeout);
+        __atomic_store_n(&w->idle, false, __ATOMIC_SEQ_CST);
+
+        timing_wheel_execute(w->tw);
+        _runtime_handoff_drain(w);
+        busy = _runtime_task_run(w);
+        if (busy && !ring_array_empty(w->task)) {
+            _runtime_wake_thief(w);
+        }
+    }
+
+    timing_wheel_stop(w->tw);
+    _runtime_handoff_drain(w);
+    if (rt->stop_cb != NULL) {
+        rt->stop_cb(w);
+    }
+
+    log_info("runtime worker %"PRIu32" stopped", w->id);
+    DECR(runtime_metrics, runtime_worker);
+    self = NULL;
+
+    return NULL;
+}
+
+rstatus_i
+runtime_start(struct runtime *rt)
+{
+    uint32_t i;
+    int ret;
+
+    ASSERT(rt != NULL);
+
+    __atomic_store_n(&rt->stop, false, __ATOMIC_RELEASE);
+    for (i = 0; i < rt->nworker; i++) {
+        struct runtime_worker *w = &rt->worker[i];
+
+        if (w->started) {
+            continue;
+        }
+        ret = pthread_create(&w->tid, NULL, _runtime_worker, w);
+        if (ret != 0) {
+            log_error("start runtime worker %"PRIu32" failed: %s", w->id,
+                    strerror(ret));
+            runtime_stop(rt);
+            return CC_ERROR;
+        }
+        w->started = true;
+    }
+
+    return CC_OK;
+}
+
+void
+runtime_stop(struct runtime *rt)
+{
+    uint32_t i;
+
+    ASSERT(rt != NULL);
+
+    __atomic_store_n(&rt->stop, true, __ATOMIC_RELEASE);
+    for (i = 0; i < rt->nworker; i++) {
+        if (rt->worker[i].started) {
+            notify_send(rt->worker[i].notify);
+        }
+    }
+    for (i = 0; i < rt->nworker; i++) {
+        struct runtime_worker *w = &rt->worker[i];
+
+        if (w->started) {
+            pthread_join(w->tid, NULL);
+            w->started = false;
+        }
+    }
+}
+
+static struct runtime_worker *
+_runtime_pick(struct runtime *rt, uint32_t id)
+{
+    if (id == RUNTIME_ANY) {
+        id = __atomic_fetch_add(&rt->next, 1, __ATOMIC_RELAXED) % rt->nworker;
+    }
+    ASSERT(id < rt->nworker);
+
+    return &rt->worker[id];
+}
+
+rstatus_i
+runtime_handoff(struct runtime *rt, uint32_t id, void *ptr)
+{
+    struct runtime_worker *w;
+
+    ASSERT(rt != NULL);
+
+    w = _runtime_pick(rt, id);
+    if (ring_array_push(&ptr, w->handoff) != CC_OK) {
+        log_debug("handoff to runtime worker %"PRIu32" failed: queue full",
+                w->id);
+        INCR_SHARD(runtime_metrics, runtime_handoff_ex);
+        return CC_ENOMEM;
+    }
+    notify_send(w->notify);
+    INCR_SHARD(runtime_metrics, runtime_handoff);
+
+    return CC_OK;
+}
+
+rstatus_i
+runtime_submit(struct runtime *rt, uint32_t id, runtime_task_fn fn, void *arg)
+{
+    struct runtime_task t = { .fn = fn, .arg = arg };
+    struct runtime_worker *w;
+
+    ASSERT(rt != NULL && fn != NULL);
+
+    if (id == RUNTIME_ANY && self != NULL && self->rt == rt) {
+        w = self;
+    } else {
+        w = _runtime_pick(rt, id);
+    }
+    if (ring_array_push(&t, w->task) != CC_OK) {
+        log_debug("submit to runtime worker %"PRIu32" failed: queue full",
+                w->id);
+        INCR_SHARD(runtime_metrics, runtime_task_ex);
+        return CC_ENOMEM;
+    }
+    INCR_SHARD(runtime_metrics, runtime_task);
+
+    if (__atomic_load_n(&w->idle, __ATOMIC_SEQ_CST)) {
+        notify_send(w->notify);
+        return CC_OK;
+    }
+
+    /* the worker is busy, let an idle one come and steal the task */
+    _runtime_wake_thief(w);
+
+    return CC_OK;
+}
+
+struct runtime_worker *
+runtime_worker_self(void)
+{
+    return self;
+}
@@ -7,6 +7,14 @@
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef OS_LINUX
+#include <sys/signalfd.h>
+#else
+#include <sys/event.h>
+#endif
+
+#define SIGNAL_FD_NREAD 16 /* # signals read from the fd at a time */
 
 struct signal signals[SIGNAL_MAX];
 
@@ -79,3 +87,199 @@ signal_override(int signo, char *info, int flags, uint32_t mask, sig_fn handler)
 
     return status;
 }
+
+static void
+_signal_set(sigset_t *set, uint32_t mask)
+{
+    int i;
+
+    sigemptyset(set);
+    for (i = SIGNAL_MIN; i < SIGNAL_MAX; ++i) {
+        if ((1U << i) & mask) {
+            sigaddset(set, i);
+        }
+    }
+}
+
+static void
+_signal_dispatch(int signo)
+{
+    sig_fn handler;
+
+    if (signo < SIGNAL_MIN || signo >= SIGNAL_MAX) {
+        return;
+    }
+
+    handler = signals[signo].handler;
+    if (handler == NULL || handler == SIG_IGN || handler == SIG_DFL) {
+        log_debug("no handler for %s, ignored", sys_signame[signo]);
+        return;
+    }
+
+    log_verb("handle %s from signal fd", sys_signame[signo]);
+    handler(signo);
+}
+
+#ifdef OS_LINUX
+
+int
+signal_fd_open(uint32_t mask)
+{
+    sigset_t set;
+    int fd;
+
+    _signal_set(&set, mask);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) < 0) {
+        log_error("block signals %#"PRIx32" failed: %s", mask, strerror(errno));
+        return -1;
+    }
+
+    fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        log_error("signalfd for signals %#"PRIx32" failed: %s", mask,
+                strerror(errno));
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+        return -1;
+    }
+
+    log_info("signals %#"PRIx32" delivered through signalfd %d", mask, fd);
+
+    return fd;
+}
+
+int
+signal_fd_handle(int fd)
+{
+    struct signalfd_siginfo si[SIGNAL_FD_NREAD];
+    ssize_t n;
+    int i, nsig = 0;
+
+    for (;;) {
+        n = read(fd, si, sizeof(si));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return nsig;
+            }
+            log_error("read signalfd %d failed: %s", fd, strerror(errno));
+            return nsig > 0 ? nsig : -1;
+        }
+
+        for (i = 0; i < n / (ssize_t)sizeof(si[0]); i++) {
+            _signal_dispatch((int)si[i].ssi_signo);
+            nsig++;
+        }
+        if ((size_t)n < sizeof(si)) {
+            return nsig;
+        }
+    }
+}
+
+void
+signal_fd_close(int fd, uint32_t mask)
+{
+    sigset_t set;
+
+    if (fd >= 0 && close(fd) < 0) {
+        log_warn("close signalfd %d failed, ignored: %s", fd, strerror(errno));
+    }
+
+    _signal_set(&set, mask);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+#else
+
+int
+signal_fd_open(uint32_t mask)
+{
+    struct kevent ev;
+    struct sigaction sa;
+    int fd, i;
+
+    fd = kqueue();
+    if (fd < 0) {
+        log_error("kqueue for signals %#"PRIx32" failed: %s", mask,
+                strerror(errno));
+        return -1;
+    }
+
+    /* kqueue still sees ignored signals, and only then nothing else runs */
+    cc_memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    for (i = SIGNAL_MIN; i < SIGNAL_MAX; ++i) {
+        if (!((1U << i) & mask)) {
+            continue;
+        }
+        EV_SET(&ev, i, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+        if (kevent(fd, &ev, 1, NULL, 0, NULL) < 0 ||
+                sigaction(i, &sa, NULL) < 0) {
+            log_error("deliver %s through kqueue failed: %s",
+                    sys_signame[i], strerror(errno));
+            signal_fd_close(fd, mask);
+            return -1;
+        }
+    }
+
+    log_info("signals %#"PRIx32" delivered through kqueue %d", mask, fd);
+
+    return fd;
+}
+
+int
+signal_fd_handle(int fd)
+{
+    struct kevent ev[SIGNAL_FD_NREAD];
+    struct timespec zero = { 0, 0 };
+    int i, n, nsig = 0;
+
+    do {
+        n = kevent(fd, NULL, 0, ev, SIGNAL_FD_NREAD, &zero);
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = SIGNAL_FD_NREAD;
+                continue;
+            }
+            log_error("kevent on signal kqueue %d failed: %s", fd,
+                    strerror(errno));
+            return nsig > 0 ? nsig : -1;
+        }
+
+        for (i = 0; i < n; i++) {
+            _signal_dispatch((int)ev[i].ident);
+            nsig++;
+        }
+    } while (n == SIGNAL_FD_NREAD);
+
+    return nsig;
+}
+
+void
+signal_fd_close(int fd, uint32_t mask)
+{
+    struct sigaction sa;
+    int i;
+
+    if (fd >= 0 && close(fd) < 0) {
+        log_warn("close signal kqueue %d failed, ignored: %s", fd,
+                strerror(errno));
+    }
+
+    /* back to what signals[] says */
+    for (i = SIGNAL_MIN; i < SIGNAL_MAX; ++i) {
+        if (!((1U << i) & mask)) {
+            continue;
+        }
+        cc_memset(&sa, 0, sizeof(sa));
+        sa.sa_flags = signals[i].flags;
+        sa.sa_handler = signals[i].handler == NULL ? SIG_DFL :
+            signals[i].handler;
+        sigemptyset(&sa.sa_mask);
+        sigaction(i, &sa, NULL);
+    }
+}
+
+#endif
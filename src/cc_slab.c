@@ -0,0 +1,234 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cc_slab.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <sys/param.h>
+
+/*
+ * objects start after the region header, on a cache line so objects sized in
+ * whole lines (e.g. bufs) stay aligned
+ */
+#define SLAB_REGION_HDR CC_ALIGN(sizeof(struct slab_region), CC_CACHELINE_SIZE)
+
+struct slab *
+slab_create(size_t obj_size, size_t region_size, uint32_t nmax)
+{
+    struct slab *slab;
+
+    if (region_size == 0) {
+        region_size = SLAB_REGION_SIZE;
+    }
+    /* a free object holds the free list link */
+    obj_size = CC_ALIGN(MAX(obj_size, sizeof(void *)), SLAB_ALIGN);
+    if (region_size < SLAB_REGION_HDR + obj_size) {
+        log_error("slab region size %zu cannot hold an object of size %zu",
+                region_size, obj_size);
+
+        return NULL;
+    }
+
+    slab = (struct slab *)cc_alloc(sizeof(struct slab));
+    if (slab == NULL) {
+        log_info("slab creation failed due to OOM");
+
+        return NULL;
+    }
+
+    slab->region = NULL;
+    slab->free = NULL;
+    slab->pos = slab->end = NULL;
+    slab->obj_size = obj_size;
+    slab->region_size = region_size;
+    slab->nobj = (region_size - SLAB_REGION_HDR) / obj_size;
+    slab->nregion = 0;
+    slab->nused = 0;
+    slab->nmax = nmax;
+
+    log_verb("created slab %p: object size %zu, %"PRIu32" per region", slab,
+            obj_size, slab->nobj);
+
+    return slab;
+}
+
+size_t
+slab_region_fit(size_t obj_size, uint32_t n)
+{
+    size_t size;
+
+    obj_size = CC_ALIGN(MAX(obj_size, sizeof(void *)), SLAB_ALIGN);
+    size = SLAB_REGION_HDR + (size_t)MAX(n, 1) * obj_size;
+
+    if (size >= MM_HUGEPAGE_SIZE) {
+        return CC_ALIGN(size, MM_HUGEPAGE_SIZE);
+    }
+
+    return CC_ALIGN(size, SLAB_PAGE_SIZE);
+}
+
+void
+slab_destroy(struct slab **slab)
+{
+    struct slab_region *region, *next;
+
+    if (slab == NULL || *slab == NULL) {
+        return;
+    }
+
+    log_verb("destroy slab %p with %"PRIu32" regions, %"PRIu32" objects in "
+            "use", *slab, (*slab)->nregion, (*slab)->nused);
+
+    for (region = (*slab)->region; region != NULL; region = next) {
+        next = region->next;
+        cc_munmap(region, region->size);
+    }
+
+    cc_free(*slab);
+    *slab = NULL;
+}
+
+/* objects never handed out, in the current region */
+static inline uint32_t
+_slab_nfresh(const struct slab *slab)
+{
+    return (uint32_t)((size_t)(slab->end - slab->pos) / slab->obj_size);
+}
+
+static rstatus_i
+_slab_grow(struct slab *slab)
+{
+    struct slab_region *region;
+    void *obj;
+
+    region = (struct slab_region *)cc_mmap(slab->region_size);
+    if (region == NULL) {
+        return CC_ENOMEM;
+    }
+
+    /* leftovers of the current region go on the free list first */
+    while (_slab_nfresh(slab) > 0) {
+        obj = slab->pos;
+        slab->pos += slab->obj_size;
+        *(void **)obj = slab->free;
+        slab->free = obj;
+    }
+
+    region->next = slab->region;
+    region->size = slab->region_size;
+    slab->region = region;
+    slab->pos = (char *)region + SLAB_REGION_HDR;
+    slab->end = slab->pos + (size_t)slab->nobj * slab->obj_size;
+    slab->nregion++;
+
+    log_verb("slab %p mapped region %p, %"PRIu32" regions", slab, region,
+            slab->nregion);
+
+    return CC_OK;
+}
+
+rstatus_i
+slab_reserve(struct slab *slab, uint32_t n)
+{
+    uint32_t navail = 0;
+    void *obj;
+
+    ASSERT(slab != NULL);
+
+    for (obj = slab->free; obj != NULL && navail < n; obj = *(void **)obj) {
+        navail++;
+    }
+    navail += _slab_nfresh(slab);
+
+    while (navail < n) {
+        if (_slab_grow(slab) != CC_OK) {
+            log_error("slab %p cannot reserve %"PRIu32" objects", slab, n);
+
+            return CC_ENOMEM;
+        }
+        navail += slab->nobj;
+    }
+
+    return CC_OK;
+}
+
+void *
+slab_alloc(struct slab *slab)
+{
+    void *obj;
+
+    ASSERT(slab != NULL);
+
+    if (slab->nmax > 0 && slab->nused >= slab->nmax) {
+        log_verb("slab %p is at its limit of %"PRIu32" objects", slab,
+                slab->nmax);
+
+        return NULL;
+    }
+
+    if (slab->free != NULL) {
+        obj = slab->free;
+        slab->free = *(void **)obj;
+    } else {
+        if (_slab_nfresh(slab) == 0 && _slab_grow(slab) != CC_OK) {
+            return NULL;
+        }
+        obj = slab->pos;
+        slab->pos += slab->obj_size;
+    }
+    slab->nused++;
+
+    return obj;
+}
+
+void
+slab_free(struct slab *slab, void *obj)
+{
+    ASSERT(slab != NULL);
+
+    if (obj == NULL) {
+        return;
+    }
+
+    ASSERT(slab->nused > 0);
+
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->nused--;
+}
+
+bool
+slab_owns(const struct slab *slab, const void *obj)
+{
+    const struct slab_region *region;
+
+    if (slab == NULL) {
+        return false;
+    }
+
+    for (region = slab->region; region != NULL; region = region->next) {
+        if ((const char *)obj >= (const char *)region &&
+                (const char *)obj < (const char *)region + region->size) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,328 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_trace.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_rbuf.h>
+#include <cc_signal.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_MODULE_NAME "ccommon::trace"
+#define TRACE_LINE_LEN    128
+#define TRACE_DUMP_LEN    4096  /* dumps are written out in chunks of this */
+
+struct trace_tbuf {
+    struct trace_tbuf   *next;
+    struct rbuf         *buf;
+    uint32_t            tid;        /* threads numbered by first record */
+    uint64_t            ndrop;      /* atomic, only written by the owner */
+};
+
+static bool trace_init = false;     /* atomic */
+static uint32_t trace_nrec = TRACE_NREC;
+static int trace_fd = STDERR_FILENO;
+static struct trace_tbuf *tbuf_list = NULL; /* newest first */
+static uint32_t trace_ntbuf = 0;
+static bool trace_dumping = false;  /* atomic */
+static const char *trace_names[TRACE_NEVENT];
+
+/* clock readings at setup to convert timestamps, see trace_now */
+static uint64_t trace_ts0;
+static struct timespec trace_mono0;
+
+/*
+ * the buffer of the calling thread; gen tells apart buffers of an earlier
+ * setup, which teardown has freed
+ */
+static uint64_t trace_gen = 0;
+static __thread struct trace_tbuf *tbuf = NULL;
+static __thread uint64_t tbuf_gen = 0;
+
+#define TRACE_EVENT_NAME(_id, _name) _name,
+static const char *trace_builtin[] = {
+    TRACE_EVENT(TRACE_EVENT_NAME)
+};
+#undef TRACE_EVENT_NAME
+
+static void
+_trace_signal(int signo)
+{
+    (void)signo;
+
+    trace_dump(trace_fd);
+}
+
+rstatus_i
+trace_setup(trace_options_st *options)
+{
+    char *filename = TRACE_FILE;
+    uint32_t i;
+
+    log_info("set up the %s module", TRACE_MODULE_NAME);
+
+    if (trace_init) {
+        log_warn("%s has already been setup, overwrite", TRACE_MODULE_NAME);
+        trace_teardown();
+    }
+
+    trace_nrec = TRACE_NREC;
+    if (options != NULL) {
+        trace_nrec = option_uint(&options->trace_nrec);
+        filename = option_str(&options->trace_file);
+    }
+    if (trace_nrec == 0) {
+        log_error("trace buffers need room for at least one record");
+        return CC_EINVAL;
+    }
+
+    trace_fd = STDERR_FILENO;
+    if (filename != NULL) {
+        trace_fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (trace_fd < 0) {
+            log_error("open trace file '%s' failed: %s", filename,
+                    strerror(errno));
+            trace_fd = STDERR_FILENO;
+            return CC_ERROR;
+        }
+    }
+
+    if (signal_override(SIGUSR2, "dump trace", 0, 0, _trace_signal) < 0) {
+        if (trace_fd != STDERR_FILENO) {
+            close(trace_fd);
+            trace_fd = STDERR_FILENO;
+        }
+        return CC_ERROR;
+    }
+
+    memset(trace_names, 0, sizeof(trace_names));
+    for (i = 0; i < TRACE_USER; i++) {
+        trace_names[i] = trace_builtin[i];
+    }
+
+    trace_ts0 = trace_now();
+    clock_gettime(CLOCK_MONOTONIC, &trace_mono0);
+    trace_ntbuf = 0;
+    trace_gen++;
+    __atomic_store_n(&trace_init, true, __ATOMIC_RELEASE);
+
+    return CC_OK;
+}
+
+/* no thread may be recording while the module is torn down */
+void
+trace_teardown(void)
+{
+    struct trace_tbuf *t;
+
+    log_info("tear down the %s module", TRACE_MODULE_NAME);
+
+    if (!trace_init) {
+        log_warn("%s has never been setup", TRACE_MODULE_NAME);
+        return;
+    }
+
+    __atomic_store_n(&trace_init, false, __ATOMIC_RELEASE);
+    while (tbuf_list != NULL) {
+        t = tbuf_list;
+        tbuf_list = t->next;
+        rbuf_destroy(&t->buf);
+        cc_free(t);
+    }
+    if (trace_fd != STDERR_FILENO) {
+        close(trace_fd);
+        trace_fd = STDERR_FILENO;
+    }
+}
+
+rstatus_i
+trace_name(uint32_t id, const char *name)
+{
+    if (id < TRACE_USER || id >= TRACE_NEVENT) {
+        return CC_EINVAL;
+    }
+
+    trace_names[id] = name;
+
+    return CC_OK;
+}
+
+/* register a buffer for the calling thread on its first record */
+static struct trace_tbuf *
+_trace_tbuf(void)
+{
+    struct trace_tbuf *t, *head;
+
+    t = cc_zalloc(sizeof(struct trace_tbuf));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->buf = rbuf_create(trace_nrec * sizeof(struct trace_rec));
+    if (t->buf == NULL) {
+        cc_free(t);
+        return NULL;
+    }
+    t->tid = __atomic_fetch_add(&trace_ntbuf, 1, __ATOMIC_RELAXED);
+
+    head = __atomic_load_n(&tbuf_list, __ATOMIC_RELAXED);
+    do {
+        t->next = head;
+    } while (!__atomic_compare_exchange_n(&tbuf_list, &head, t, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    tbuf = t;
+    tbuf_gen = trace_gen;
+
+    return t;
+}
+
+void
+trace_record(uint32_t id, uint32_t arg)
+{
+    struct trace_rec rec;
+    struct trace_tbuf *t = tbuf;
+
+    if (!__atomic_load_n(&trace_init, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (tbuf_gen != trace_gen && (t = _trace_tbuf()) == NULL) {
+        return;
+    }
+
+    /* records are only ever written whole, never wrapped around partially */
+    if (rbuf_wcap(t->buf) < sizeof(rec)) {
+        __atomic_store_n(&t->ndrop, t->ndrop + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    rec.ts = trace_now();
+    rec.id = id;
+    rec.arg = arg;
+    rbuf_write(t->buf, &rec, sizeof(rec));
+}
+
+static size_t
+_trace_format(char *line, const struct trace_rec *rec, uint32_t tid,
+        double ns_per_tick)
+{
+    uint32_t id = rec->id & ~TRACE_SPAN_END;
+    char phase = (rec->id & TRACE_SPAN_END) ? 'E' : 'B';
+    uint64_t ns = 0;
+    int len;
+
+    if (rec->ts > trace_ts0) {
+        ns = (uint64_t)((rec->ts - trace_ts0) * ns_per_tick);
+    }
+
+    if (id < TRACE_NEVENT && trace_names[id] != NULL) {
+        len = snprintf(line, TRACE_LINE_LEN, "%"PRIu64" %"PRIu32" %c %s %"
+                PRIu32"\n", ns, tid, phase, trace_names[id], rec->arg);
+    } else {
+        len = snprintf(line, TRACE_LINE_LEN, "%"PRIu64" %"PRIu32" %c %"
+                PRIu32" %"PRIu32"\n", ns, tid, phase, id, rec->arg);
+    }
+
+    return len < TRACE_LINE_LEN ? (size_t)len : TRACE_LINE_LEN - 1;
+}
+
+static void
+_trace_write(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+size_t
+trace_dump(int fd)
+{
+    struct trace_tbuf *t;
+    struct trace_rec rec;
+    struct timespec mono;
+    char out[TRACE_DUMP_LEN];
+    uint64_t ts, mono_ns;
+    double ns_per_tick = 1.0;
+    size_t nrec = 0, len = 0;
+
+    if (!__atomic_load_n(&trace_init, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    /* one reader per buffer at a time, possibly from a signal handler */
+    if (__atomic_exchange_n(&trace_dumping, true, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    ts = trace_now();
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    mono_ns = (uint64_t)(mono.tv_sec - trace_mono0.tv_sec) * 1000000000ULL +
+        mono.tv_nsec - trace_mono0.tv_nsec;
+    if (ts > trace_ts0 && mono_ns > 0) {
+        ns_per_tick = (double)mono_ns / (ts - trace_ts0);
+    }
+
+    for (t = __atomic_load_n(&tbuf_list, __ATOMIC_ACQUIRE); t != NULL;
+            t = t->next) {
+        while (rbuf_read(&rec, t->buf, sizeof(rec)) == sizeof(rec)) {
+            if (len + TRACE_LINE_LEN > sizeof(out)) {
+                _trace_write(fd, out, len);
+                len = 0;
+            }
+            len += _trace_format(out + len, &rec, t->tid, ns_per_tick);
+            nrec++;
+        }
+    }
+    _trace_write(fd, out, len);
+
+    __atomic_store_n(&trace_dumping, false, __ATOMIC_RELEASE);
+
+    return nrec;
+}
+
+uint64_t
+trace_ndrop(void)
+{
+    struct trace_tbuf *t;
+    uint64_t ndrop = 0;
+
+    if (!__atomic_load_n(&trace_init, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    for (t = __atomic_load_n(&tbuf_list, __ATOMIC_ACQUIRE); t != NULL;
+            t = t->next) {
+        ndrop += __atomic_load_n(&t->ndrop, __ATOMIC_RELAXED);
+    }
+
+    return ndrop;
+}
@@ -0,0 +1,387 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_ktls.h>
+
+#include <cc_debug.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#ifdef OS_LINUX
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#define KTLS_MODULE_NAME "ccommon::ktls"
+
+#ifdef OS_LINUX
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+static bool ktls_init = false;
+static ktls_metrics_st *ktls_metrics = NULL;
+
+static bool tx_zerocopy = KTLS_TX_ZEROCOPY;
+static bool rx_nopad = KTLS_RX_NOPAD;
+
+void
+ktls_setup(ktls_options_st *options, ktls_metrics_st *metrics)
+{
+    log_info("set up the %s module", KTLS_MODULE_NAME);
+
+    if (ktls_init) {
+        log_warn("%s has already been setup, overwrite", KTLS_MODULE_NAME);
+    }
+
+    ktls_metrics = metrics;
+
+    if (options != NULL) {
+        tx_zerocopy = option_bool(&options->ktls_tx_zerocopy);
+        rx_nopad = option_bool(&options->ktls_rx_nopad);
+    }
+
+    ktls_init = true;
+}
+
+void
+ktls_teardown(void)
+{
+    log_info("tear down the %s module", KTLS_MODULE_NAME);
+
+    if (!ktls_init) {
+        log_warn("%s has never been setup", KTLS_MODULE_NAME);
+    }
+
+    ktls_metrics = NULL;
+    tx_zerocopy = KTLS_TX_ZEROCOPY;
+    rx_nopad = KTLS_RX_NOPAD;
+
+    ktls_init = false;
+}
+
+static bool
+_ktls_valid(const struct ktls_key *k)
+{
+    if (k->version != KTLS_V12 && k->version != KTLS_V13) {
+        return false;
+    }
+
+#if defined(OS_LINUX) && !defined(TLS_CIPHER_CHACHA20_POLY1305)
+    /* the kernel headers built against do not know it */
+    if (k->cipher == KTLS_CHACHA20_POLY1305) {
+        return false;
+    }
+#endif
+
+    return k->cipher < KTLS_SENTINEL;
+}
+
+#ifdef OS_LINUX
+
+/* fill the kernel's crypto_info for cipher _c from k, see linux/tls.h */
+#define KTLS_CRYPTO_INFO(_i, _c, _k) do {                                   \
+    (_i).info.version = (_k)->version;                                      \
+    (_i).info.cipher_type = TLS_CIPHER_##_c;                                \
+    memcpy((_i).key, (_k)->key, TLS_CIPHER_##_c##_KEY_SIZE);                \
+    memcpy((_i).salt, (_k)->iv, TLS_CIPHER_##_c##_SALT_SIZE);               \
+    memcpy((_i).iv, (_k)->iv + TLS_CIPHER_##_c##_SALT_SIZE,                 \
+            TLS_CIPHER_##_c##_IV_SIZE);                                     \
+    memcpy((_i).rec_seq, (_k)->seq, TLS_CIPHER_##_c##_REC_SEQ_SIZE);        \
+} while (0)
+
+/* unlike memset, a wipe the compiler cannot drop as a dead store */
+static void
+_ktls_wipe(void *p, size_t n)
+{
+    volatile uint8_t *b = p;
+
+    while (n-- > 0) {
+        *b++ = 0;
+    }
+}
+
+static int
+_ktls_set_key(int sd, int dir, const struct ktls_key *k)
+{
+    union {
+        struct tls12_crypto_info_aes_gcm_128        aes128;
+        struct tls12_crypto_info_aes_gcm_256        aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        struct tls12_crypto_info_chacha20_poly1305  chacha;
+#endif
+    } info;
+    socklen_t len;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    switch (k->cipher) {
+    case KTLS_AES_128_GCM:
+        KTLS_CRYPTO_INFO(info.aes128, AES_GCM_128, k);
+        len = sizeof(info.aes128);
+        break;
+
+    case KTLS_AES_256_GCM:
+        KTLS_CRYPTO_INFO(info.aes256, AES_GCM_256, k);
+        len = sizeof(info.aes256);
+        break;
+
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case KTLS_CHACHA20_POLY1305:
+        KTLS_CRYPTO_INFO(info.chacha, CHACHA20_POLY1305, k);
+        len = sizeof(info.chacha);
+        break;
+#endif
+
+    default:
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+
+    ret = setsockopt(sd, SOL_TLS, dir, &info, len);
+    /* the keys should not linger on the stack */
+    _ktls_wipe(&info, sizeof(info));
+
+    return ret;
+}
+
+#undef KTLS_CRYPTO_INFO
+
+#if defined(TLS_TX_ZEROCOPY_RO) || defined(TLS_RX_EXPECT_NO_PAD)
+static void
+_ktls_set_flag(int sd, int opt, const char *name)
+{
+    int one = 1;
+
+    if (setsockopt(sd, SOL_TLS, opt, &one, sizeof(one)) < 0) {
+        log_info("set %s on sd %d failed, ignored: %s", name, sd,
+                strerror(errno));
+    }
+}
+#endif
+
+rstatus_i
+ktls_enable(struct tcp_conn *c, const struct ktls_key *tx,
+        const struct ktls_key *rx)
+{
+    ASSERT(c != NULL);
+    ASSERT(tx != NULL || rx != NULL);
+
+    if ((tx != NULL && !_ktls_valid(tx)) || (rx != NULL && !_ktls_valid(rx))) {
+        log_warn("kernel tls on sd %d: unsupported version or cipher", c->sd);
+        INCR(ktls_metrics, ktls_enable_ex);
+        return CC_EINVAL;
+    }
+
+    if (setsockopt(c->sd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        goto error;
+    }
+
+    if (tx != NULL) {
+        if (_ktls_set_key(c->sd, TLS_TX, tx) < 0) {
+            goto error;
+        }
+        if (c->zerocopy) {
+            log_verb("zerocopy send turned off on kernel tls sd %d", c->sd);
+            c->zerocopy = false;
+        }
+#ifdef TLS_TX_ZEROCOPY_RO
+        if (tx_zerocopy) {
+            _ktls_set_flag(c->sd, TLS_TX_ZEROCOPY_RO, "TLS_TX_ZEROCOPY_RO");
+        }
+#endif
+    }
+
+    if (rx != NULL) {
+        if (_ktls_set_key(c->sd, TLS_RX, rx) < 0) {
+            goto error;
+        }
+#ifdef TLS_RX_EXPECT_NO_PAD
+        if (rx_nopad && rx->version == KTLS_V13) {
+            _ktls_set_flag(c->sd, TLS_RX_EXPECT_NO_PAD, "TLS_RX_EXPECT_NO_PAD");
+        }
+#endif
+    }
+
+    log_verb("kernel tls enabled on sd %d, tx %d rx %d", c->sd, tx != NULL,
+            rx != NULL);
+    INCR(ktls_metrics, ktls_enable);
+
+    return CC_OK;
+
+error:
+    c->err = errno;
+    log_error("enable kernel tls on sd %d failed: %s", c->sd, strerror(errno));
+    INCR(ktls_metrics, ktls_enable_ex);
+
+    return CC_ERROR;
+}
+
+ssize_t
+ktls_send_record(struct tcp_conn *c, uint8_t type, void *buf, size_t nbyte)
+{
+    char cbuf[CMSG_SPACE(sizeof(type))];
+    struct iovec iov = { .iov_base = buf, .iov_len = nbyte };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    ASSERT(c != NULL);
+
+    memset(cbuf, 0, sizeof(cbuf));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(type));
+    memcpy(CMSG_DATA(cmsg), &type, sizeof(type));
+
+    for (;;) {
+        n = sendmsg(c->sd, &msg, MSG_NOSIGNAL);
+        if (n >= 0) {
+            log_verb("%zd bytes of record type %"PRIu8" sent on sd %d", n,
+                    type, c->sd);
+            c->send_nbyte += (size_t)n;
+            INCR(ktls_metrics, ktls_record_send);
+            return n;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        INCR(ktls_metrics, ktls_record_ex);
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("send record on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        }
+        c->err = errno;
+        log_error("send record on sd %d failed: %s", c->sd, strerror(errno));
+        return CC_ERROR;
+    }
+}
+
+ssize_t
+ktls_recv_record(struct tcp_conn *c, uint8_t *type, void *buf, size_t nbyte)
+{
+    char cbuf[CMSG_SPACE(sizeof(*type))];
+    struct iovec iov = { .iov_base = buf, .iov_len = nbyte };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    ASSERT(c != NULL && type != NULL);
+    ASSERT(nbyte > 0);
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        n = recvmsg(c->sd, &msg, 0);
+        if (n > 0) {
+            *type = KTLS_RECORD_DATA;
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_TLS &&
+                        cmsg->cmsg_type == TLS_GET_RECORD_TYPE) {
+                    *type = *(uint8_t *)CMSG_DATA(cmsg);
+                }
+            }
+            log_verb("%zd bytes of record type %"PRIu8" recv'd on sd %d", n,
+                    *type, c->sd);
+            c->recv_nbyte += (size_t)n;
+            INCR(ktls_metrics, ktls_record_recv);
+            return n;
+        }
+
+        if (n == 0) {
+            c->state = CHANNEL_TERM;
+            log_debug("eof recv'd on sd %d", c->sd);
+            return n;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        INCR(ktls_metrics, ktls_record_ex);
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("recv record on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        }
+        c->err = errno;
+        log_error("recv record on sd %d failed: %s", c->sd, strerror(errno));
+        return CC_ERROR;
+    }
+}
+
+#else /* !OS_LINUX */
+
+rstatus_i
+ktls_enable(struct tcp_conn *c, const struct ktls_key *tx,
+        const struct ktls_key *rx)
+{
+    if ((tx != NULL && !_ktls_valid(tx)) || (rx != NULL && !_ktls_valid(rx))) {
+        INCR(ktls_metrics, ktls_enable_ex);
+        return CC_EINVAL;
+    }
+
+    c->err = ENOSYS;
+    INCR(ktls_metrics, ktls_enable_ex);
+
+    return CC_ERROR;
+}
+
+ssize_t
+ktls_send_record(struct tcp_conn *c, uint8_t type, void *buf, size_t nbyte)
+{
+    (void)type;
+    (void)buf;
+    (void)nbyte;
+
+    NOT_REACHED();
+    c->err = ENOSYS;
+
+    return CC_ERROR;
+}
+
+ssize_t
+ktls_recv_record(struct tcp_conn *c, uint8_t *type, void *buf, size_t nbyte)
+{
+    (void)type;
+    (void)buf;
+    (void)nbyte;
+
+    NOT_REACHED();
+    c->err = ENOSYS;
+
+    return CC_ERROR;
+}
+
+#endif /* OS_LINUX */
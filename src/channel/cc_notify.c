@@ -0,0 +1,273 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_notify.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef OS_LINUX
+#include <sys/eventfd.h>
+#endif
+
+#define NOTIFY_MODULE_NAME "ccommon::notify"
+
+static bool notify_init = false;
+static notify_metrics_st *notify_metrics = NULL;
+
+struct notify_conn *
+notify_conn_create(void)
+{
+    struct notify_conn *c = cc_alloc(sizeof(struct notify_conn));
+
+    if (c == NULL) {
+        log_info("notify conn creation failed due to OOM");
+        INCR(notify_metrics, notify_conn_create_ex);
+        return NULL;
+    }
+
+    log_verb("created notify conn %p", c);
+
+    notify_conn_reset(c);
+
+    INCR(notify_metrics, notify_conn_create);
+    INCR(notify_metrics, notify_conn_curr);
+
+    return c;
+}
+
+void
+notify_conn_destroy(struct notify_conn **c)
+{
+    if (c == NULL || *c == NULL) {
+        return;
+    }
+
+    log_verb("destroy notify conn %p", *c);
+
+    cc_free(*c);
+    *c = NULL;
+
+    INCR(notify_metrics, notify_conn_destroy);
+    DECR(notify_metrics, notify_conn_curr);
+}
+
+void
+notify_conn_reset(struct notify_conn *c)
+{
+    c->fd[0] = c->fd[1] = -1;
+    c->pending = false;
+    c->state = CHANNEL_TERM;
+    c->err = 0;
+}
+
+#ifndef OS_LINUX
+static int
+_notify_set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags < 0) {
+        return flags;
+    }
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+#endif
+
+bool
+notify_open(struct notify_conn *c)
+{
+    ASSERT(c != NULL);
+
+#ifdef OS_LINUX
+    c->fd[0] = c->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->fd[0] < 0) {
+        log_error("eventfd() for notify conn %p failed: %s", c,
+                strerror(errno));
+        goto error;
+    }
+#else
+    if (pipe(c->fd) < 0) {
+        log_error("pipe() for notify conn %p failed: %s", c, strerror(errno));
+        goto error;
+    }
+    if (_notify_set_nonblocking(c->fd[0]) < 0 ||
+            _notify_set_nonblocking(c->fd[1]) < 0) {
+        log_error("set nonblocking on notify conn %p failed: %s", c,
+                strerror(errno));
+        c->err = errno;
+        close(c->fd[0]);
+        close(c->fd[1]);
+        c->fd[0] = c->fd[1] = -1;
+        INCR(notify_metrics, notify_open_ex);
+        return false;
+    }
+#endif
+
+    __atomic_store_n(&c->pending, false, __ATOMIC_RELAXED);
+    c->state = CHANNEL_ESTABLISHED;
+    INCR(notify_metrics, notify_open);
+
+    log_verb("opened notify conn %p fd %d", c, c->fd[0]);
+
+    return true;
+
+error:
+    c->err = errno;
+    c->fd[0] = c->fd[1] = -1;
+    INCR(notify_metrics, notify_open_ex);
+
+    return false;
+}
+
+void
+notify_close(struct notify_conn *c)
+{
+    if (c == NULL) {
+        return;
+    }
+
+    log_info("closing notify conn %p fd %d and %d", c, c->fd[0], c->fd[1]);
+
+    if (c->fd[0] >= 0) {
+        close(c->fd[0]);
+    }
+    if (c->fd[1] >= 0 && c->fd[1] != c->fd[0]) {
+        close(c->fd[1]);
+    }
+    c->fd[0] = c->fd[1] = -1;
+    c->state = CHANNEL_TERM;
+
+    INCR(notify_metrics, notify_close);
+}
+
+rstatus_i
+notify_send(struct notify_conn *c)
+{
+#ifdef OS_LINUX
+    uint64_t one = 1;
+#else
+    char one = 1;
+#endif
+    ssize_t n;
+
+    ASSERT(c != NULL);
+
+    /* someone else's wakeup has not been received yet, piggyback on it */
+    if (__atomic_exchange_n(&c->pending, true, __ATOMIC_SEQ_CST)) {
+        INCR(notify_metrics, notify_send_coalesce);
+        return CC_OK;
+    }
+
+    do {
+        n = write(c->fd[1], &one, sizeof(one));
+    } while (n < 0 && errno == EINTR);
+    INCR(notify_metrics, notify_send);
+
+    /* a full pipe or counter is still readable, which is all we want */
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        c->err = errno;
+        __atomic_store_n(&c->pending, false, __ATOMIC_SEQ_CST);
+        INCR(notify_metrics, notify_send_ex);
+        log_error("send on notify conn %p fd %d failed: %s", c, c->fd[1],
+                strerror(errno));
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+notify_recv(struct notify_conn *c)
+{
+#ifdef OS_LINUX
+    uint64_t buf;
+#else
+    char buf[64];
+#endif
+    ssize_t n;
+    bool recv = false;
+
+    ASSERT(c != NULL);
+
+    /* drain before clearing pending, so no send can slip in between unseen */
+    for (;;) {
+        n = read(c->fd[0], &buf, sizeof(buf));
+        if (n > 0) {
+            recv = true;
+#ifdef OS_LINUX
+            break;
+#else
+            continue;
+#endif
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        c->err = errno;
+        INCR(notify_metrics, notify_recv_ex);
+        log_error("recv on notify conn %p fd %d failed: %s", c, c->fd[0],
+                strerror(errno));
+        return CC_ERROR;
+    }
+
+    __atomic_store_n(&c->pending, false, __ATOMIC_SEQ_CST);
+
+    if (!recv) {
+        return CC_EAGAIN;
+    }
+
+    INCR(notify_metrics, notify_recv);
+
+    return CC_OK;
+}
+
+void
+notify_setup(notify_metrics_st *metrics)
+{
+    log_info("set up the %s module", NOTIFY_MODULE_NAME);
+
+    if (notify_init) {
+        log_warn("%s has already been setup, overwrite", NOTIFY_MODULE_NAME);
+    }
+
+    notify_metrics = metrics;
+    notify_init = true;
+}
+
+void
+notify_teardown(void)
+{
+    log_info("tear down the %s module", NOTIFY_MODULE_NAME);
+
+    if (!notify_init) {
+        log_warn("%s has never been setup", NOTIFY_MODULE_NAME);
+    }
+
+    notify_metrics = NULL;
+    notify_init = false;
+}
@@ -28,6 +28,9 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef OS_LINUX
+#include <sys/uio.h>
+#endif
 
 #define PIPE_MODULE_NAME "ccommon::pipe"
 
@@ -314,6 +317,139 @@ ssize_t pipe_send(struct pipe_conn *c, void *buf, size_t nbyte)
     return CC_ERROR;
 }
 
+#ifdef OS_LINUX
+/* account for the result of a splice(2) family call made on c */
+static ssize_t
+_pipe_splice_done(struct pipe_conn *c, ssize_t n, size_t *nbyte_p,
+        const char *op, int fd)
+{
+    INCR(pipe_metrics, pipe_splice);
+
+    if (n > 0) {
+        log_verb("%zd bytes moved by %s on pipe conn %p", n, op, c);
+        *nbyte_p += (size_t)n;
+        INCR_N(pipe_metrics, pipe_splice_byte, n);
+        return n;
+    }
+
+    if (n == 0) {
+        log_debug("eof on %s with fd %d, pipe conn %p", op, fd, c);
+        return n;
+    }
+
+    /* n < 0 */
+    INCR(pipe_metrics, pipe_splice_ex);
+    if (errno == EINTR) {
+        log_debug("%s on pipe conn %p not ready - EINTR", op, c);
+        return CC_ERETRY;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        log_debug("%s on pipe conn %p not ready - EAGAIN", op, c);
+        return CC_EAGAIN;
+    } else {
+        c->err = errno;
+        log_error("%s with fd %d on pipe conn %p failed: %s", op, fd, c,
+                strerror(errno));
+        return CC_ERROR;
+    }
+}
+#endif
+
+ssize_t
+pipe_splice_in(struct pipe_conn *c, int fd, size_t nbyte)
+{
+#ifdef OS_LINUX
+    ssize_t n;
+
+    ASSERT(c != NULL);
+    ASSERT(nbyte > 0);
+
+    do {
+        n = splice(fd, NULL, c->fd[1], NULL, nbyte, SPLICE_F_MOVE);
+        n = _pipe_splice_done(c, n, &c->send_nbyte, "splice in", fd);
+    } while (n == CC_ERETRY);
+
+    return n;
+#else
+    (void)fd;
+    (void)nbyte;
+    c->err = ENOSYS;
+    return CC_ERROR;
+#endif
+}
+
+ssize_t
+pipe_splice_out(struct pipe_conn *c, int fd, size_t nbyte)
+{
+#ifdef OS_LINUX
+    ssize_t n;
+
+    ASSERT(c != NULL);
+    ASSERT(nbyte > 0);
+
+    do {
+        n = splice(c->fd[0], NULL, fd, NULL, nbyte, SPLICE_F_MOVE);
+        n = _pipe_splice_done(c, n, &c->recv_nbyte, "splice out", fd);
+    } while (n == CC_ERETRY);
+
+    return n;
+#else
+    (void)fd;
+    (void)nbyte;
+    c->err = ENOSYS;
+    return CC_ERROR;
+#endif
+}
+
+ssize_t
+pipe_vmsplice(struct pipe_conn *c, void *buf, size_t nbyte)
+{
+#ifdef OS_LINUX
+    struct iovec iov;
+    ssize_t n;
+
+    ASSERT(c != NULL);
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    iov.iov_base = buf;
+    iov.iov_len = nbyte;
+    do {
+        n = vmsplice(c->fd[1], &iov, 1, 0);
+        n = _pipe_splice_done(c, n, &c->send_nbyte, "vmsplice", c->fd[1]);
+    } while (n == CC_ERETRY);
+
+    return n;
+#else
+    (void)buf;
+    (void)nbyte;
+    c->err = ENOSYS;
+    return CC_ERROR;
+#endif
+}
+
+ssize_t
+pipe_tee(struct pipe_conn *src, struct pipe_conn *dst, size_t nbyte)
+{
+#ifdef OS_LINUX
+    ssize_t n;
+
+    ASSERT(src != NULL && dst != NULL);
+    ASSERT(nbyte > 0);
+
+    do {
+        n = tee(src->fd[0], dst->fd[1], nbyte, 0);
+        n = _pipe_splice_done(dst, n, &dst->send_nbyte, "tee", src->fd[0]);
+    } while (n == CC_ERETRY);
+
+    return n;
+#else
+    (void)src;
+    (void)nbyte;
+    dst->err = ENOSYS;
+    return CC_ERROR;
+#endif
+}
+
 static void
 _pipe_set_blocking(int fd)
 {
@@ -21,32 +21,95 @@
 #include <cc_define.h>
 #include <cc_mm.h>
 #include <cc_pool.h>
+#include <cc_probe.h>
+#include <cc_slab.h>
 #include <cc_util.h>
 #include <cc_event.h>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#ifdef OS_LINUX
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#endif
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 
 #define TCP_MODULE_NAME "ccommon::tcp"
 
+#if defined(OS_LINUX) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define TCP_HAVE_ZEROCOPY 1
+#endif
+
+/* slab slots in whole cache lines, so every conn starts on one */
+#define TCP_CONN_SLOT CC_ALIGN(sizeof(struct tcp_conn), CC_CACHELINE_SIZE)
+
+_Static_assert(offsetof(struct tcp_conn, send_nbyte) + sizeof(size_t) <=
+        CC_CACHELINE_SIZE, "tcp_conn I/O fields must fit in a cache line");
+
 FREEPOOL(tcp_conn_pool, cq, tcp_conn);
 static struct tcp_conn_pool cp;
+static struct slab *cp_slab = NULL; /* backs the pool if tcp_poolslab */
 
 static bool tcp_init = false;
 static bool cp_init = false;
 static tcp_metrics_st *tcp_metrics = NULL;
+static METRIC_SHARD_DECLARE(tcp_metrics);
 static int max_backlog = TCP_BACKLOG;
+static bool reuseport = TCP_REUSEPORT;
+static bool reuseport_cpu = TCP_REUSEPORT_CPU;
+static bool zerocopy = TCP_ZEROCOPY;
+static size_t zerocopy_min = TCP_ZEROCOPY_MIN;
+static bool stats = TCP_CONN_STATS;
+static uint32_t busy_poll = TCP_BUSY_POLL;
+static TAILQ_HEAD(tcp_conn_tqh, tcp_conn) live = TAILQ_HEAD_INITIALIZER(live);
+
+/*
+ * zerocopy sends outliving their conn: the socket stays open so completions
+ * can still be read off its error queue, and the memory they pin is released
+ * only after the last one
+ */
+struct tcp_zc_linger {
+    STAILQ_ENTRY(tcp_zc_linger) next;
+    struct tcp_conn             *conn;      /* closed conn not released yet */
+    int                         sd;         /* -1 once all sends completed */
+    uint32_t                    sent;
+    uint32_t                    done;
+    tcp_zc_release_fn           release;
+    void                        *data;
+};
+static STAILQ_HEAD(tcp_zc_lingerq, tcp_zc_linger) lingerq =
+    STAILQ_HEAD_INITIALIZER(lingerq);
+
+/* a conn going away for good no longer waits to release its memory */
+static void
+_tcp_zerocopy_orphan(struct tcp_conn *c)
+{
+    struct tcp_zc_linger *l = c->zc_linger;
+
+    if (l == NULL) {
+        return;
+    }
+
+    c->zc_linger = NULL;
+    if (l->sd < 0) {
+        cc_free(l);
+    } else {
+        l->conn = NULL;
+    }
+}
 
 void
 tcp_conn_reset(struct tcp_conn *c)
 {
+    _tcp_zerocopy_orphan(c);
+
     STAILQ_NEXT(c, next) = NULL;
     c->free = false;
 
@@ -59,24 +122,104 @@ tcp_conn_reset(struct tcp_conn *c)
     c->state = CHANNEL_UNKNOWN;
     c->flags = 0;
 
+    c->zerocopy = false;
+    c->zc_sent = 0;
+    c->zc_done = 0;
+
+    memset(&c->stats, 0, sizeof(c->stats));
+    if (stats) {
+        timeout_add_ns(&c->stats.active, 0);
+    }
+
     c->err = 0;
 }
 
+static inline void
+_tcp_stats_recv(struct tcp_conn *c, ssize_t n)
+{
+    if (!stats) {
+        return;
+    }
+
+    c->stats.nrecv++;
+    if (n > 0) {
+        timeout_add_ns(&c->stats.active, 0);
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        c->stats.nagain++;
+    }
+}
+
+static inline void
+_tcp_stats_send(struct tcp_conn *c, ssize_t n, size_t nbyte)
+{
+    if (!stats) {
+        return;
+    }
+
+    c->stats.nsend++;
+    if (n > 0) {
+        c->stats.npartial += (size_t)n < nbyte;
+        timeout_add_ns(&c->stats.active, 0);
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        c->stats.nagain++;
+    }
+}
+
+static void
+_tcp_zerocopy(struct tcp_conn *c)
+{
+    if (!zerocopy) {
+        return;
+    }
+
+    if (tcp_set_zerocopy(c->sd) < 0) {
+        log_warn("set zerocopy on sd %d failed, ignored: %s", c->sd,
+                strerror(errno));
+        return;
+    }
+
+    c->zerocopy = true;
+}
+
+static void
+_tcp_busy_poll(struct tcp_conn *c)
+{
+    if (busy_poll == 0) {
+        return;
+    }
+
+    if (tcp_set_busy_poll(c->sd, busy_poll) < 0) {
+        log_warn("set busy poll on sd %d failed, ignored: %s", c->sd,
+                strerror(errno));
+    }
+}
+
 struct tcp_conn *
 tcp_conn_create(void)
 {
-    struct tcp_conn *c = (struct tcp_conn *)cc_alloc(sizeof(struct tcp_conn));
+    struct tcp_conn *c = NULL;
 
+    if (cp_slab != NULL) {
+        c = (struct tcp_conn *)slab_alloc(cp_slab);
+    }
+    if (c == NULL) {
+        c = (struct tcp_conn *)cc_alloc(sizeof(struct tcp_conn));
+    }
     if (c == NULL) {
         log_info("connection creation failed due to OOM");
-        INCR(tcp_metrics, tcp_conn_create_ex);
+        INCR_SHARD(tcp_metrics, tcp_conn_create_ex);
 
         return NULL;
     }
 
+    c->zc_linger = NULL;
     tcp_conn_reset(c);
-    INCR(tcp_metrics, tcp_conn_create);
-    INCR(tcp_metrics, tcp_conn_curr);
+    c->tracked = stats;
+    if (stats) {
+        TAILQ_INSERT_TAIL(&live, c, live);
+    }
+    INCR_SHARD(tcp_metrics, tcp_conn_create);
+    INCR_SHARD(tcp_metrics, tcp_conn_curr);
 
     log_verb("created tcp_conn %p", c);
 
@@ -94,10 +237,18 @@ tcp_conn_destroy(struct tcp_conn **conn)
 
     log_verb("destroy tcp_conn %p", c);
 
-    cc_free(c);
+    _tcp_zerocopy_orphan(c);
+    if (c->tracked) {
+        TAILQ_REMOVE(&live, c, live);
+    }
+    if (slab_owns(cp_slab, c)) {
+        slab_free(cp_slab, c);
+    } else {
+        cc_free(c);
+    }
     *conn = NULL;
-    INCR(tcp_metrics, tcp_conn_destroy);
-    DECR(tcp_metrics, tcp_conn_curr);
+    INCR_SHARD(tcp_metrics, tcp_conn_destroy);
+    DECR_SHARD(tcp_metrics, tcp_conn_curr);
 }
 
 static void
@@ -114,11 +265,20 @@ tcp_conn_pool_destroy(void)
     log_info("destroying tcp_conn pool: free %"PRIu32, cp.nfree);
 
     FREEPOOL_DESTROY(c, tc, &cp, next, tcp_conn_destroy);
+    if (cp_slab != NULL) {
+        if (cp_slab->nused > 0) {
+            log_warn("%"PRIu32" slab tcp_conn outstanding, leaking slab",
+                    cp_slab->nused);
+            cp_slab = NULL;
+        } else {
+            slab_destroy(&cp_slab);
+        }
+    }
     cp_init = false;
 }
 
 static void
-tcp_conn_pool_create(uint32_t max)
+tcp_conn_pool_create(uint32_t max, bool poolslab, uint32_t low, uint32_t high)
 {
     struct tcp_conn *c;
 
@@ -131,8 +291,18 @@ tcp_conn_pool_create(uint32_t max)
     log_info("creating tcp_conn pool: max %"PRIu32, max);
 
     FREEPOOL_CREATE(&cp, max);
+    FREEPOOL_WATERMARK(&cp, low, high);
     cp_init = true;
 
+    if (poolslab && max > 0) {
+        cp_slab = slab_create(TCP_CONN_SLOT, slab_region_fit(TCP_CONN_SLOT,
+                max), max);
+        if (cp_slab == NULL || slab_reserve(cp_slab, max) != CC_OK) {
+            log_crit("cannot map tcp_conn pool slab due to OOM, abort");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* preallocating, see notes in buffer/cc_buf.c */
     FREEPOOL_PREALLOC(c, &cp, max, next, tcp_conn_create);
     if (cp.nfree < max) {
@@ -150,14 +320,14 @@ tcp_conn_borrow(void)
 
     if (c == NULL) {
         log_debug("borrow tcp_conn failed: OOM or over limit");
-        INCR(tcp_metrics, tcp_conn_borrow_ex);
+        INCR_SHARD(tcp_metrics, tcp_conn_borrow_ex);
 
         return NULL;
     }
 
     tcp_conn_reset(c);
-    INCR(tcp_metrics, tcp_conn_borrow);
-    INCR(tcp_metrics, tcp_conn_active);
+    INCR_SHARD(tcp_metrics, tcp_conn_borrow);
+    INCR_SHARD(tcp_metrics, tcp_conn_active);
 
     log_verb("borrow tcp_conn %p", c);
 
@@ -174,11 +344,30 @@ tcp_conn_return(struct tcp_conn **c)
     log_verb("return tcp_conn %p", *c);
 
     (*c)->free = true;
-    FREEPOOL_RETURN(*c, &cp, next);
+    FREEPOOL_RELEASE(*c, &cp, next, tcp_conn_destroy);
 
     *c = NULL;
-    INCR(tcp_metrics, tcp_conn_return);
-    DECR(tcp_metrics, tcp_conn_active);
+    INCR_SHARD(tcp_metrics, tcp_conn_return);
+    DECR_SHARD(tcp_metrics, tcp_conn_active);
+}
+
+void
+tcp_conn_trim(void *arg)
+{
+    struct tcp_conn *c;
+    uint32_t nfree = cp.nfree;
+
+    (void)arg;
+
+    if (!cp_init) {
+        return;
+    }
+
+    FREEPOOL_TRIM(c, &cp, next, tcp_conn_destroy);
+    if (nfree > cp.nfree) {
+        log_verb("trimmed %"PRIu32" free tcp_conn", nfree - cp.nfree);
+        INCR_N_SHARD(tcp_metrics, tcp_conn_trim, nfree - cp.nfree);
+    }
 }
 
 bool
@@ -189,7 +378,7 @@ tcp_connect(struct addrinfo *ai, struct tcp_conn *c)
     ASSERT(c != NULL);
 
     c->sd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-    INCR(tcp_metrics, tcp_connect);
+    INCR_SHARD(tcp_metrics, tcp_connect);
     if (c->sd < 0) {
 	log_error("socket create for tcp_conn %p failed: %s", c, strerror(errno));
 
@@ -204,6 +393,9 @@ tcp_connect(struct addrinfo *ai, struct tcp_conn *c)
         goto error;
     }
 
+    _tcp_zerocopy(c);
+    _tcp_busy_poll(c);
+
     ret = connect(c->sd, ai->ai_addr, ai->ai_addrlen);
     if (ret < 0) {
         if (errno != EINPROGRESS) {
@@ -239,13 +431,13 @@ error:
     if (c->sd > 0) {
         close(c->sd);
     }
-    INCR(tcp_metrics, tcp_connect_ex);
+    INCR_SHARD(tcp_metrics, tcp_connect_ex);
 
     return false;
 }
 
-bool
-tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
+static bool
+_tcp_listen(struct addrinfo *ai, struct tcp_conn *c, bool share)
 {
     int ret;
     int sd;
@@ -264,6 +456,14 @@ tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
         goto error;
     }
 
+    if (share) {
+        ret = tcp_set_reuseport(sd);
+        if (ret < 0) {
+            log_error("reuse port of sd %d failed: %s", sd, strerror(errno));
+            goto error;
+        }
+    }
+
     ret = bind(sd, ai->ai_addr, ai->ai_addrlen);
     if (ret < 0) {
         log_error("bind on sd %d failed: %s", sd, strerror(errno));
@@ -296,9 +496,72 @@ error:
     return false;
 }
 
+bool
+tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
+{
+    return _tcp_listen(ai, c, reuseport);
+}
+
+bool
+tcp_listen_n(struct addrinfo *ai, struct tcp_conn **c, uint32_t n)
+{
+    uint32_t i;
+
+    ASSERT(n > 0);
+
+    /* listeners join the reuseport group in order, which cpu steering uses */
+    for (i = 0; i < n; i++) {
+        if (!_tcp_listen(ai, c[i], true)) {
+            goto error;
+        }
+    }
+
+    if (reuseport_cpu && tcp_set_reuseport_cpu(c[0]->sd, n) < 0) {
+        log_error("steering by cpu on sd %d failed: %s", c[0]->sd,
+                strerror(errno));
+        i = n;
+        goto error;
+    }
+
+    log_info("server listen setup on %"PRIu32" sockets with reuseport", n);
+
+    return true;
+
+error:
+    while (i-- > 0) {
+        tcp_close(c[i]);
+    }
+
+    return false;
+}
+
+/* track the pending zerocopy sends of c on lingerq, reading them off sd */
+static struct tcp_zc_linger *
+_tcp_zerocopy_linger(struct tcp_conn *c, int sd)
+{
+    struct tcp_zc_linger *l;
+
+    l = cc_alloc(sizeof(struct tcp_zc_linger));
+    if (l == NULL) {
+        log_warn("cannot track zerocopy sends of c %d, OOM", c->sd);
+        return NULL;
+    }
+
+    l->conn = NULL;
+    l->sd = sd;
+    l->sent = c->zc_sent;
+    l->done = c->zc_done;
+    l->release = NULL;
+    l->data = NULL;
+    STAILQ_INSERT_TAIL(&lingerq, l, next);
+
+    return l;
+}
+
 void
 tcp_close(struct tcp_conn *c)
 {
+    struct tcp_zc_linger *l = NULL;
     int ret;
 
     if (c == NULL) {
@@ -307,11 +570,27 @@ tcp_close(struct tcp_conn *c)
 
     log_info("closing tcp_conn %p sd %d", c, c->sd);
 
-    INCR(tcp_metrics, tcp_close);
-    ret = close(c->sd);
-    if (ret < 0) {
-        log_warn("close c %d failed, ignored: %s", c->sd, strerror(errno));
+    INCR_SHARD(tcp_metrics, tcp_close);
+    if (c->zerocopy && c->zc_linger == NULL && tcp_zerocopy_reap(c) > 0) {
+        l = _tcp_zerocopy_linger(c, c->sd);
     }
+    if (l != NULL) {
+        /* the socket stays open, shut down, until the sends complete */
+        log_debug("closed c %d with %"PRIu32" zerocopy sends pending", c->sd,
+                tcp_zerocopy_pending(c));
+        shutdown(c->sd, SHUT_RDWR);
+        l->conn = c;
+        c->zc_linger = l;
+    } else {
+        ret = close(c->sd);
+        if (ret < 0) {
+            log_warn("close c %d failed, ignored: %s", c->sd, strerror(errno));
+        }
+    }
+
+    c->zerocopy = false;
+    c->zc_sent = 0;
+    c->zc_done = 0;
 }
 
 static inline int
@@ -323,7 +602,7 @@ _tcp_accept(struct tcp_conn *sc)
 
     for (;;) { /* we accept at most one tcp_conn with the 'break' at the end */
 #ifdef CC_ACCEPT4
-        sd = accept4(sc->sd, NULL, NULL, SOCK_NONBLOCK);
+        sd = accept4(sc->sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
 #else
         sd = accept(sc->sd, NULL, NULL);
 #endif /* CC_ACCEPT4 */
@@ -339,7 +618,7 @@ _tcp_accept(struct tcp_conn *sc)
             }
 
             log_error("accept on sd %d failed: %s", sc->sd, strerror(errno));
-            INCR(tcp_metrics, tcp_accept_ex);
+            INCR_SHARD(tcp_metrics, tcp_accept_ex);
             return -1;
         }
 
@@ -349,28 +628,27 @@ _tcp_accept(struct tcp_conn *sc)
     return sd;
 }
 
-bool
-tcp_accept(struct tcp_conn *sc, struct tcp_conn *c)
+static void
+_tcp_accepted(struct tcp_conn *sc, struct tcp_conn *c, int sd)
 {
     int ret;
-    int sd;
-
-    sd = _tcp_accept(sc);
-    INCR(tcp_metrics, tcp_accept);
-    if (sd < 0) {
-        return false;
-    }
 
     c->sd = sd;
     c->level = CHANNEL_BASE;
     c->state = CHANNEL_ESTABLISHED;
 
-#ifndef CC_ACCEPT4 /* if we have accept4, nonblock will already have been set */
+#ifndef CC_ACCEPT4 /* if we have accept4, these will already have been set */
     ret = tcp_set_nonblocking(sd);
     if (ret < 0) {
         log_warn("set nonblock on sd %d failed, ignored: %s", sd,
                 strerror(errno));
     }
+
+    ret = fcntl(sd, F_SETFD, FD_CLOEXEC);
+    if (ret < 0) {
+        log_warn("set cloexec on sd %d failed, ignored: %s", sd,
+                strerror(errno));
+    }
 #endif
 
     ret = tcp_set_tcpnodelay(sd);
@@ -379,11 +657,82 @@ tcp_accept(struct tcp_conn *sc, struct tcp_conn *c)
                  strerror(errno));
     }
 
+    _tcp_zerocopy(c);
+    _tcp_busy_poll(c);
+
+    PROBE2(tcp_accept, sc->sd, sd);
     log_info("accepted c %d on sd %d", c->sd, sc->sd);
+}
+
+bool
+tcp_accept(struct tcp_conn *sc, struct tcp_conn *c)
+{
+    int sd;
+
+    sd = _tcp_accept(sc);
+    INCR_SHARD(tcp_metrics, tcp_accept);
+    if (sd < 0) {
+        return false;
+    }
+
+    _tcp_accepted(sc, c, sd);
 
     return true;
 }
 
+uint32_t
+tcp_accept_batch(struct tcp_conn *sc, struct tcp_conn **c, uint32_t n)
+{
+    int sd[TCP_ACCEPT_NBATCH];
+    uint32_t i, nsd, naccept = 0;
+    int ret;
+
+    ASSERT(c != NULL);
+
+    while (naccept < n) {
+        /* drain pending connections first, then borrow for all of them */
+        for (nsd = 0; nsd < TCP_ACCEPT_NBATCH && naccept + nsd < n; nsd++) {
+            sd[nsd] = _tcp_accept(sc);
+            if (sd[nsd] < 0) {
+                break;
+            }
+        }
+        INCR_N_SHARD(tcp_metrics, tcp_accept, nsd);
+
+        for (i = 0; i < nsd; i++) {
+            c[naccept] = tcp_conn_borrow();
+            if (c[naccept] == NULL) {
+                break;
+            }
+            _tcp_accepted(sc, c[naccept], sd[i]);
+            naccept++;
+        }
+
+        if (i < nsd) {
+            /* out of tcp_conn, turn away what we cannot hold */
+            log_warn("reject %"PRIu32" connections on sd %d: no tcp_conn",
+                    nsd - i, sc->sd);
+            for (; i < nsd; i++) {
+                INCR_SHARD(tcp_metrics, tcp_reject);
+                ret = close(sd[i]);
+                if (ret < 0) {
+                    INCR_SHARD(tcp_metrics, tcp_reject_ex);
+                    log_warn("close c %d failed, ignored: %s", sd[i],
+                            strerror(errno));
+                }
+            }
+            break;
+        }
+
+        if (nsd < TCP_ACCEPT_NBATCH) { /* no more pending connections */
+            break;
+        }
+    }
+
+    log_verb("accepted %"PRIu32" connections on sd %d", naccept, sc->sd);
+
+    return naccept;
+}
 
 /*
  * due to lack of a direct rejection API in POSIX, tcp_reject accepts the
@@ -395,16 +744,16 @@ tcp_reject(struct tcp_conn *sc)
     int ret;
     int sd;
 
-    INCR(tcp_metrics, tcp_reject);
+    INCR_SHARD(tcp_metrics, tcp_reject);
     sd = _tcp_accept(sc);
     if (sd < 0) {
-        INCR(tcp_metrics, tcp_reject_ex);
+        INCR_SHARD(tcp_metrics, tcp_reject_ex);
         return;
     }
 
     ret = close(sd);
     if (ret < 0) {
-        INCR(tcp_metrics, tcp_reject_ex);
+        INCR_SHARD(tcp_metrics, tcp_reject_ex);
         log_warn("close c %d failed, ignored: %s", sd, strerror(errno));
     }
 }
@@ -434,17 +783,17 @@ tcp_reject_all(struct tcp_conn *sc)
             }
 
             log_error("accept on sd %d failed: %s", sc->sd, strerror(errno));
-            INCR(tcp_metrics, tcp_reject_ex);
+            INCR_SHARD(tcp_metrics, tcp_reject_ex);
             return;
         }
 
         ret = close(sd);
         if (ret < 0) {
-            INCR(tcp_metrics, tcp_reject_ex);
+            INCR_SHARD(tcp_metrics, tcp_reject_ex);
             log_warn("close c %d failed, ignored: %s", sd, strerror(errno));
         }
 
-        INCR(tcp_metrics, tcp_reject);
+        INCR_SHARD(tcp_metrics, tcp_reject);
     }
 }
 
@@ -486,6 +835,88 @@ tcp_set_reuseaddr(int sd)
     return setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, len);
 }
 
+int
+tcp_set_reuseport(int sd)
+{
+    int reuse;
+    socklen_t len;
+
+    reuse = 1;
+    len = sizeof(reuse);
+
+    return setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse, len);
+}
+
+/*
+ * Attach a classic BPF program to the reuseport group of sd, which picks the
+ * listener at index (cpu % n) for each new connection, cpu being the one that
+ * processed the incoming packet. Only available on Linux.
+ */
+int
+tcp_set_reuseport_cpu(int sd, uint32_t n)
+{
+#if defined(OS_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        /* A = raw_smp_processor_id() */
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        /* A = A % n */
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n },
+        /* return A */
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]),
+        .filter = code };
+
+    ASSERT(n > 0);
+
+    return setsockopt(sd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+            sizeof(prog));
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int
+tcp_set_zerocopy(int sd)
+{
+#ifdef TCP_HAVE_ZEROCOPY
+    int zc;
+    socklen_t len;
+
+    zc = 1;
+    len = sizeof(zc);
+
+    return setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &zc, len);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/*
+ * Busy polling has a read on an empty socket poll the device queue for up
+ * to usec instead of sleeping until the softirq delivers the packet, which
+ * lowers latency at the cost of CPU. Values above net.core.busy_read need
+ * CAP_NET_ADMIN.
+ */
+int
+tcp_set_busy_poll(int sd, uint32_t usec)
+{
+#ifdef SO_BUSY_POLL
+    int val;
+    socklen_t len;
+
+    val = (int)usec;
+    len = sizeof(val);
+
+    return setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &val, len);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
 /*
  * Disable Nagle algorithm on TCP socket.
  *
@@ -601,6 +1032,21 @@ tcp_get_rcvbuf(int sd)
     return size;
 }
 
+int
+tcp_get_nread(int sd)
+{
+    int status, size;
+
+    size = 0;
+
+    status = ioctl(sd, FIONREAD, &size);
+    if (status < 0) {
+        return status;
+    }
+
+    return size;
+}
+
 void
 tcp_maximize_sndbuf(int sd)
 {
@@ -661,14 +1107,16 @@ tcp_recv(struct tcp_conn *c, void *buf, size_t nbyte)
 
     for (;;) {
         n = read(c->sd, buf, nbyte);
-        INCR(tcp_metrics, tcp_recv);
+        INCR_SHARD(tcp_metrics, tcp_recv);
+        _tcp_stats_recv(c, n);
+        PROBE3(tcp_recv, c->sd, nbyte, n);
 
         log_verb("read on sd %d %zd of %zu", c->sd, n, nbyte);
 
         if (n > 0) {
             log_verb("%zu bytes recv'd on sd %d", n, c->sd);
             c->recv_nbyte += (size_t)n;
-            INCR_N(tcp_metrics, tcp_recv_byte, n);
+            INCR_N_SHARD(tcp_metrics, tcp_recv_byte, n);
             return n;
         }
 
@@ -680,7 +1128,7 @@ tcp_recv(struct tcp_conn *c, void *buf, size_t nbyte)
         }
 
         /* n < 0 */
-        INCR(tcp_metrics, tcp_recv_ex);
+        INCR_SHARD(tcp_metrics, tcp_recv_ex);
         if (errno == EINTR) {
             log_debug("recv on sd %d not ready - EINTR", c->sd);
             continue;
@@ -717,14 +1165,16 @@ tcp_recvv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
 
     for (;;) {
         n = readv(c->sd, (const struct iovec *)bufv->data, bufv->nelem);
-        INCR(tcp_metrics, tcp_recv);
+        INCR_SHARD(tcp_metrics, tcp_recv);
+        _tcp_stats_recv(c, n);
+        PROBE3(tcp_recv, c->sd, nbyte, n);
 
         log_verb("recvv on sd %d %zd of %zu in %"PRIu32" buffers",
                   c->sd, n, nbyte, bufv->nelem);
 
         if (n > 0) {
             c->recv_nbyte += (size_t)n;
-            INCR_N(tcp_metrics, tcp_recv, n);
+            INCR_N_SHARD(tcp_metrics, tcp_recv_byte, n);
             return n;
         }
 
@@ -735,7 +1185,7 @@ tcp_recvv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
         }
 
         /* n < 0 */
-        INCR(tcp_metrics, tcp_recv_ex);
+        INCR_SHARD(tcp_metrics, tcp_recv_ex);
         if (errno == EINTR) {
             log_verb("recvv on sd %d not ready - eintr", c->sd);
             continue;
@@ -773,12 +1223,14 @@ tcp_send(struct tcp_conn *c, void *buf, size_t nbyte)
 
     for (;;) {
         n = write(c->sd, buf, nbyte);
-        INCR(tcp_metrics, tcp_send);
+        INCR_SHARD(tcp_metrics, tcp_send);
+        _tcp_stats_send(c, n, nbyte);
+        PROBE3(tcp_send, c->sd, nbyte, n);
 
         log_verb("write on sd %d %zd of %zu", c->sd, n, nbyte);
 
         if (n > 0) {
-            INCR_N(tcp_metrics, tcp_send_byte, n);
+            INCR_N_SHARD(tcp_metrics, tcp_send_byte, n);
             c->send_nbyte += (size_t)n;
             return n;
         }
@@ -789,7 +1241,7 @@ tcp_send(struct tcp_conn *c, void *buf, size_t nbyte)
         }
 
         /* n < 0 */
-        INCR(tcp_metrics, tcp_send_ex);
+        INCR_SHARD(tcp_metrics, tcp_send_ex);
         if (errno == EINTR) {
             log_verb("write on sd %d not ready - EINTR", c->sd);
             continue;
@@ -827,14 +1279,16 @@ tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
 
     for (;;) {
         n = writev(c->sd, (const struct iovec *)bufv->data, bufv->nelem);
-        INCR(tcp_metrics, tcp_send_ex);
+        INCR_SHARD(tcp_metrics, tcp_send);
+        _tcp_stats_send(c, n, nbyte);
+        PROBE3(tcp_send, c->sd, nbyte, n);
 
         log_verb("writev on sd %d %zd of %zu in %"PRIu32" buffers",
                   c->sd, n, nbyte, bufv->nelem);
 
         if (n > 0) {
             c->send_nbyte += (size_t)n;
-            INCR_N(tcp_metrics, tcp_send_byte, n);
+            INCR_N_SHARD(tcp_metrics, tcp_send_byte, n);
             return n;
         }
 
@@ -844,7 +1298,7 @@ tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
         }
 
         /* n < 0, error */
-        INCR(tcp_metrics, tcp_send_ex);
+        INCR_SHARD(tcp_metrics, tcp_send_ex);
         if (errno == EINTR) {
             log_verb("sendv on sd %d not ready - eintr", c->sd);
             continue;
@@ -863,10 +1317,352 @@ tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
     return CC_ERROR;
 }
 
+ssize_t
+tcp_send_zc(struct tcp_conn *c, void *buf, size_t nbyte)
+{
+#ifdef TCP_HAVE_ZEROCOPY
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    if (!c->zerocopy || nbyte < zerocopy_min) {
+        return tcp_send(c, buf, nbyte);
+    }
+
+    log_verb("send zerocopy on sd %d, total %zu bytes", c->sd, nbyte);
+
+    for (;;) {
+        n = send(c->sd, buf, nbyte, MSG_ZEROCOPY);
+        INCR_SHARD(tcp_metrics, tcp_send);
+        _tcp_stats_send(c, n, nbyte);
+        PROBE3(tcp_send, c->sd, nbyte, n);
+
+        log_verb("send zerocopy on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n > 0) {
+            /* every send that queues data gets one completion */
+            c->zc_sent++;
+            INCR_SHARD(tcp_metrics, tcp_send_zc);
+            INCR_N_SHARD(tcp_metrics, tcp_send_byte, n);
+            c->send_nbyte += (size_t)n;
+            return n;
+        }
+
+        if (n == 0) {
+            log_warn("send zerocopy on sd %d returned zero", c->sd);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR_SHARD(tcp_metrics, tcp_send_ex);
+        if (errno == EINTR) {
+            log_verb("send zerocopy on sd %d not ready - EINTR", c->sd);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_verb("send zerocopy on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        } else if (errno == ENOBUFS) {
+            /* out of optmem for page pinning, copy this one instead */
+            log_debug("send zerocopy on sd %d out of optmem, copying", c->sd);
+            return tcp_send(c, buf, nbyte);
+        } else {
+            c->err = errno;
+            log_error("send zerocopy on sd %d failed: %s", c->sd,
+                    strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+#else
+    return tcp_send(c, buf, nbyte);
+#endif
+}
+
+#ifdef TCP_HAVE_ZEROCOPY
+/* read completions off the error queue of sd until none of sent is pending */
+static void
+_tcp_zerocopy_reap(int sd, uint32_t sent, uint32_t *done)
+{
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+        CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    ssize_t n;
+
+    while (sent != *done) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_warn("reap zerocopy on sd %d failed: %s", sd,
+                        strerror(errno));
+            }
+            break;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 &&
+                   cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+                    serr->ee_errno != 0) {
+                log_debug("ignore error queue msg on sd %d: origin %u, %s",
+                        sd, serr->ee_origin, strerror(serr->ee_errno));
+                continue;
+            }
+
+            /* completions of sends ee_info through ee_data, inclusive */
+            *done += serr->ee_data - serr->ee_info + 1;
+            INCR_N_SHARD(tcp_metrics, tcp_send_zc_done,
+                    serr->ee_data - serr->ee_info + 1);
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                /* e.g. loopback: the kernel copied, so it isn't worth it */
+                INCR_SHARD(tcp_metrics, tcp_send_zc_copy);
+            }
+        }
+    }
+}
+#endif
+
+/* lingering sends done: close the socket, then release what they pinned */
+static void
+_tcp_zerocopy_finish(struct tcp_zc_linger *l)
+{
+    close(l->sd);
+    l->sd = -1;
+    if (l->release != NULL) {
+        l->release(l->data);
+    }
+    if (l->conn == NULL) {
+        cc_free(l);
+    }
+}
+
+static uint32_t
+_tcp_zerocopy_reap_linger(void)
+{
+    struct tcp_zc_linger *l, *tl, *prev = NULL;
+    uint32_t pending = 0;
+
+    STAILQ_FOREACH_SAFE(l, &lingerq, next, tl) {
+#ifdef TCP_HAVE_ZEROCOPY
+        _tcp_zerocopy_reap(l->sd, l->sent, &l->done);
+#endif
+        if (l->sent != l->done) {
+            pending += l->sent - l->done;
+            prev = l;
+            continue;
+        }
+        if (prev == NULL) {
+            STAILQ_REMOVE_HEAD(&lingerq, next);
+        } else {
+            STAILQ_REMOVE_AFTER(&lingerq, prev, next);
+        }
+        _tcp_zerocopy_finish(l);
+    }
+
+    return pending;
+}
+
+uint32_t
+tcp_zerocopy_reap(struct tcp_conn *c)
+{
+    uint32_t pending;
+
+    pending = STAILQ_EMPTY(&lingerq) ? 0 : _tcp_zerocopy_reap_linger();
+    if (c == NULL) {
+        return pending;
+    }
+
+#ifdef TCP_HAVE_ZEROCOPY
+    _tcp_zerocopy_reap(c->sd, c->zc_sent, &c->zc_done);
+#endif
+
+    return tcp_zerocopy_pending(c);
+}
+
+void
+tcp_zerocopy_release(struct tcp_conn *c, tcp_zc_release_fn release,
+        void *data)
+{
+    struct tcp_zc_linger *l;
+    int sd;
+
+    ASSERT(c != NULL && release != NULL);
+
+    l = c->zc_linger;
+    if (l == NULL) {
+        if (tcp_zerocopy_reap(c) == 0) {
+            release(data);
+            return;
+        }
+
+        /* still open: the owner keeps the conn, completions go to a dup */
+        sd = dup(c->sd);
+        l = sd < 0 ? NULL : _tcp_zerocopy_linger(c, sd);
+        if (l == NULL) {
+            log_warn("cannot track zerocopy sends of c %d, leaking the memory "
+                    "they pin", c->sd);
+            if (sd >= 0) {
+                close(sd);
+            }
+            return;
+        }
+        c->zerocopy = false;
+        c->zc_sent = 0;
+        c->zc_done = 0;
+    }
+
+    c->zc_linger = NULL;
+    l->conn = NULL;
+    if (l->sd < 0) { /* completed since the conn was closed */
+        cc_free(l);
+        release(data);
+        return;
+    }
+    l->release = release;
+    l->data = data;
+}
+
+ssize_t
+tcp_recv_pipe(struct tcp_conn *c, struct pipe_conn *p, size_t nbyte)
+{
+    ssize_t n;
+
+    log_verb("recv on sd %d into pipe conn %p, capacity %zu bytes", c->sd, p,
+            nbyte);
+
+    n = pipe_splice_in(p, c->sd, nbyte);
+    INCR_SHARD(tcp_metrics, tcp_recv);
+    _tcp_stats_recv(c, n);
+    PROBE3(tcp_recv, c->sd, nbyte, n);
+
+    if (n > 0) {
+        c->recv_nbyte += (size_t)n;
+        INCR_N_SHARD(tcp_metrics, tcp_recv_byte, n);
+    } else if (n == 0) {
+        c->state = CHANNEL_TERM;
+        log_debug("eof recv'd on sd %d, total: rb %zu sb %zu", c->sd,
+                  c->recv_nbyte, c->send_nbyte);
+    } else {
+        INCR_SHARD(tcp_metrics, tcp_recv_ex);
+        if (n == CC_ERROR) {
+            c->err = p->err;
+        }
+    }
+
+    return n;
+}
+
+ssize_t
+tcp_send_pipe(struct tcp_conn *c, struct pipe_conn *p, size_t nbyte)
+{
+    ssize_t n;
+
+    log_verb("send on sd %d from pipe conn %p, total %zu bytes", c->sd, p,
+            nbyte);
+
+    n = pipe_splice_out(p, c->sd, nbyte);
+    INCR_SHARD(tcp_metrics, tcp_send);
+    _tcp_stats_send(c, n, nbyte);
+    PROBE3(tcp_send, c->sd, nbyte, n);
+
+    if (n > 0) {
+        c->send_nbyte += (size_t)n;
+        INCR_N_SHARD(tcp_metrics, tcp_send_byte, n);
+    } else if (n < 0) {
+        INCR_SHARD(tcp_metrics, tcp_send_ex);
+        if (n == CC_ERROR) {
+            c->err = p->err;
+        }
+    }
+
+    return n;
+}
+
+ssize_t
+tcp_proxy(struct tcp_conn *src, struct tcp_conn *dst, struct pipe_conn *p,
+        size_t nbyte)
+{
+    ssize_t n, sent = 0;
+    bool eof = false;
+
+    ASSERT(nbyte > 0);
+
+    if (pipe_nbuffered(p) < nbyte) {
+        n = tcp_recv_pipe(src, p, nbyte - pipe_nbuffered(p));
+        if (n == CC_ERROR) {
+            return CC_ERROR;
+        }
+        eof = (n == 0);
+    }
+
+    while (pipe_nbuffered(p) > 0) {
+        n = tcp_send_pipe(dst, p, pipe_nbuffered(p));
+        if (n == CC_EAGAIN) {
+            break;
+        }
+        if (n <= 0) {
+            return CC_ERROR;
+        }
+        sent += n;
+    }
+
+    if (sent > 0) {
+        return sent;
+    }
+
+    return (eof && pipe_nbuffered(p) == 0) ? 0 : CC_EAGAIN;
+}
+
+void
+tcp_conn_foreach(tcp_conn_each_fn fn, void *arg)
+{
+    struct tcp_conn *c, *tc;
+
+    ASSERT(fn != NULL);
+
+    TAILQ_FOREACH_SAFE(c, &live, live, tc) {
+        if (!c->free) {
+            fn(c, arg);
+        }
+    }
+}
+
+/* conns outliving the module are dropped from the list, not destroyed */
+static void
+_tcp_conn_untrack_all(void)
+{
+    struct tcp_conn *c;
+
+    while ((c = TAILQ_FIRST(&live)) != NULL) {
+        TAILQ_REMOVE(&live, c, live);
+        c->tracked = false;
+    }
+}
+
 void
 tcp_setup(tcp_options_st *options, tcp_metrics_st *metrics)
 {
     uint32_t max = TCP_POOLSIZE;
+    bool poolslab = TCP_POOLSLAB;
+    uint32_t low = TCP_POOL_LOW;
+    uint32_t high = TCP_POOL_HIGH;
 
     log_info("set up the %s module", TCP_MODULE_NAME);
 
@@ -879,13 +1675,43 @@ tcp_setup(tcp_options_st *options, tcp_metrics_st *metrics)
     if (options != NULL) {
         max_backlog = option_uint(&options->tcp_backlog);
         max = option_uint(&options->tcp_poolsize);
+        poolslab = option_bool(&options->tcp_poolslab);
+        reuseport = option_bool(&options->tcp_reuseport);
+        reuseport_cpu = option_bool(&options->tcp_reuseport_cpu);
+        zerocopy = option_bool(&options->tcp_zerocopy);
+        zerocopy_min = option_uint(&options->tcp_zerocopy_min);
+        stats = option_bool(&options->tcp_conn_stats);
+        busy_poll = option_uint(&options->tcp_busy_poll);
+        low = option_uint(&options->tcp_pool_low);
+        high = option_uint(&options->tcp_pool_high);
     }
-    tcp_conn_pool_create(max);
+    tcp_conn_pool_create(max, poolslab, low, high);
 
     channel_sigpipe_ignore(); /* does it ever fail? */
     tcp_init = true;
 }
 
+/* memory still pinned at teardown is leaked rather than handed back */
+static void
+_tcp_zerocopy_drop_all(void)
+{
+    struct tcp_zc_linger *l;
+    uint32_t n = 0;
+
+    while ((l = STAILQ_FIRST(&lingerq)) != NULL) {
+        STAILQ_REMOVE_HEAD(&lingerq, next);
+        close(l->sd);
+        l->sd = -1;
+        n += l->release != NULL;
+        if (l->conn == NULL) {
+            cc_free(l);
+        }
+    }
+    if (n > 0) {
+        log_warn("%"PRIu32" zerocopy releases still pending, leaked", n);
+    }
+}
+
 void
 tcp_teardown(void)
 {
@@ -896,7 +1722,17 @@ tcp_teardown(void)
     }
 
     tcp_conn_pool_destroy();
+    metric_shard_release((struct metric *)tcp_metrics,
+            METRIC_CARDINALITY(*tcp_metrics));
     tcp_metrics = NULL;
+    reuseport = TCP_REUSEPORT;
+    reuseport_cpu = TCP_REUSEPORT_CPU;
+    zerocopy = TCP_ZEROCOPY;
+    zerocopy_min = TCP_ZEROCOPY_MIN;
+    stats = TCP_CONN_STATS;
+    busy_poll = TCP_BUSY_POLL;
+    _tcp_conn_untrack_all();
+    _tcp_zerocopy_drop_all();
 
     tcp_init = false;
 }
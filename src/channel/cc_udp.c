@@ -0,0 +1,598 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_udp.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define UDP_MODULE_NAME "ccommon::udp"
+
+#if defined(OS_LINUX) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define UDP_HAVE_GSO 1
+#endif
+
+static bool udp_init = false;
+static udp_metrics_st *udp_metrics = NULL;
+static bool gro = UDP_GRO_DEFAULT;
+
+void
+udp_conn_reset(struct udp_conn *c)
+{
+    c->sd = -1;
+
+    c->recv_nbyte = 0;
+    c->send_nbyte = 0;
+
+    c->state = CHANNEL_UNKNOWN;
+    c->flags = 0;
+
+    c->gro = false;
+
+    c->err = 0;
+}
+
+struct udp_conn *
+udp_conn_create(void)
+{
+    struct udp_conn *c = (struct udp_conn *)cc_alloc(sizeof(struct udp_conn));
+
+    if (c == NULL) {
+        log_info("udp conn creation failed due to OOM");
+        INCR(udp_metrics, udp_conn_create_ex);
+
+        return NULL;
+    }
+
+    udp_conn_reset(c);
+    INCR(udp_metrics, udp_conn_create);
+    INCR(udp_metrics, udp_conn_curr);
+
+    log_verb("created udp_conn %p", c);
+
+    return c;
+}
+
+void
+udp_conn_destroy(struct udp_conn **conn)
+{
+    struct udp_conn *c = *conn;
+
+    if (c == NULL) {
+        return;
+    }
+
+    log_verb("destroy udp_conn %p", c);
+
+    cc_free(c);
+    *conn = NULL;
+    INCR(udp_metrics, udp_conn_destroy);
+    DECR(udp_metrics, udp_conn_curr);
+}
+
+static bool
+_udp_open(struct addrinfo *ai, struct udp_conn *c, bool server)
+{
+    int flags, one = 1, ret;
+
+    ASSERT(ai != NULL);
+    ASSERT(c != NULL);
+
+    c->sd = socket(ai->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (c->sd < 0) {
+        log_error("socket create for udp_conn %p failed: %s", c,
+                strerror(errno));
+        goto error;
+    }
+
+    flags = fcntl(c->sd, F_GETFL, 0);
+    if (flags < 0 || fcntl(c->sd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        log_error("set nonblock on sd %d failed: %s", c->sd, strerror(errno));
+        goto error;
+    }
+
+    if (server) {
+        ret = setsockopt(c->sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (ret < 0) {
+            log_warn("reuse of sd %d failed, ignored: %s", c->sd,
+                    strerror(errno));
+        }
+        ret = bind(c->sd, ai->ai_addr, ai->ai_addrlen);
+    } else {
+        ret = connect(c->sd, ai->ai_addr, ai->ai_addrlen);
+    }
+    if (ret < 0) {
+        log_error("%s on sd %d failed: %s", server ? "bind" : "connect", c->sd,
+                strerror(errno));
+        goto error;
+    }
+
+#ifdef UDP_HAVE_GSO
+    if (gro) {
+        if (setsockopt(c->sd, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+            log_warn("set udp gro on sd %d failed, ignored: %s", c->sd,
+                    strerror(errno));
+        } else {
+            c->gro = true;
+        }
+    }
+#endif
+
+    c->state = server ? CHANNEL_LISTEN : CHANNEL_ESTABLISHED;
+    INCR(udp_metrics, udp_open);
+    log_info("udp socket %s on sd %d", server ? "bound" : "connected", c->sd);
+
+    return true;
+
+error:
+    c->err = errno;
+    if (c->sd >= 0) {
+        close(c->sd);
+        c->sd = -1;
+    }
+    INCR(udp_metrics, udp_open_ex);
+
+    return false;
+}
+
+bool
+udp_bind(struct addrinfo *ai, struct udp_conn *c)
+{
+    return _udp_open(ai, c, true);
+}
+
+bool
+udp_connect(struct addrinfo *ai, struct udp_conn *c)
+{
+    return _udp_open(ai, c, false);
+}
+
+void
+udp_close(struct udp_conn *c)
+{
+    if (c == NULL || c->sd < 0) {
+        return;
+    }
+
+    log_info("closing udp_conn %p sd %d", c, c->sd);
+
+    INCR(udp_metrics, udp_close);
+    if (close(c->sd) < 0) {
+        log_warn("close c %d failed, ignored: %s", c->sd, strerror(errno));
+    }
+    c->sd = -1;
+    c->state = CHANNEL_TERM;
+}
+
+/* map a failed syscall to a return status, CC_ERETRY on EINTR */
+static int
+_udp_error(struct udp_conn *c, const char *op)
+{
+    if (errno == EINTR) {
+        log_verb("%s on sd %d not ready - EINTR", op, c->sd);
+        return CC_ERETRY;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        log_verb("%s on sd %d not ready - EAGAIN", op, c->sd);
+        return CC_EAGAIN;
+    } else {
+        c->err = errno;
+        log_error("%s on sd %d failed: %s", op, c->sd, strerror(errno));
+        return CC_ERROR;
+    }
+}
+
+ssize_t
+udp_recv(struct udp_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    for (;;) {
+        n = recv(c->sd, buf, nbyte, 0);
+        INCR(udp_metrics, udp_recv);
+        if (n >= 0) {
+            c->recv_nbyte += (size_t)n;
+            INCR(udp_metrics, udp_recv_dgram);
+            INCR_N(udp_metrics, udp_recv_byte, n);
+            return n;
+        }
+
+        INCR(udp_metrics, udp_recv_ex);
+        if ((n = _udp_error(c, "recv")) != CC_ERETRY) {
+            return n;
+        }
+    }
+}
+
+ssize_t
+udp_send(struct udp_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+
+    for (;;) {
+        n = send(c->sd, buf, nbyte, 0);
+        INCR(udp_metrics, udp_send);
+        if (n >= 0) {
+            c->send_nbyte += (size_t)n;
+            INCR(udp_metrics, udp_send_dgram);
+            INCR_N(udp_metrics, udp_send_byte, n);
+            return n;
+        }
+
+        INCR(udp_metrics, udp_send_ex);
+        if ((n = _udp_error(c, "send")) != CC_ERETRY) {
+            return n;
+        }
+    }
+}
+
+/* control buffer large enough for the GRO segment size */
+union udp_ctrl {
+    struct cmsghdr  hdr;
+    char            buf[CMSG_SPACE(sizeof(int))];
+};
+
+static void
+_udp_recv_hdr(struct msghdr *hdr, struct iovec *iov, struct udp_msg *m,
+        union udp_ctrl *ctrl)
+{
+    ASSERT(buf_wsize(m->buf) > 0);
+
+    iov->iov_base = m->buf->wpos;
+    iov->iov_len = buf_wsize(m->buf);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_name = &m->addr;
+    hdr->msg_namelen = sizeof(m->addr);
+    hdr->msg_iov = iov;
+    hdr->msg_iovlen = 1;
+    if (ctrl != NULL) {
+        hdr->msg_control = ctrl->buf;
+        hdr->msg_controllen = sizeof(ctrl->buf);
+    }
+}
+
+static void
+_udp_recv_done(struct udp_conn *c, struct udp_msg *m, struct msghdr *hdr,
+        size_t n)
+{
+#ifdef UDP_HAVE_GSO
+    struct cmsghdr *cm;
+    int segsize;
+#endif
+
+    m->buf->wpos += n;
+    m->addrlen = hdr->msg_namelen;
+    m->trunc = (hdr->msg_flags & MSG_TRUNC) != 0;
+    m->segsize = 0;
+
+#ifdef UDP_HAVE_GSO
+    for (cm = CMSG_FIRSTHDR(hdr); cm != NULL; cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            memcpy(&segsize, CMSG_DATA(cm), sizeof(segsize));
+            m->segsize = (uint16_t)segsize;
+        }
+    }
+#endif
+
+    c->recv_nbyte += n;
+    INCR(udp_metrics, udp_recv_dgram);
+    INCR_N(udp_metrics, udp_recv_byte, n);
+    if (m->trunc) {
+        log_debug("datagram of more than %zu bytes truncated on sd %d", n, c->sd);
+        INCR(udp_metrics, udp_recv_trunc);
+    }
+}
+
+static void
+_udp_send_hdr(struct msghdr *hdr, struct iovec *iov, struct udp_msg *m)
+{
+    iov->iov_base = m->buf->rpos;
+    iov->iov_len = buf_rsize(m->buf);
+
+    memset(hdr, 0, sizeof(*hdr));
+    if (m->addrlen > 0) {
+        hdr->msg_name = &m->addr;
+        hdr->msg_namelen = m->addrlen;
+    }
+    hdr->msg_iov = iov;
+    hdr->msg_iovlen = 1;
+}
+
+static void
+_udp_send_done(struct udp_conn *c, struct udp_msg *m, size_t n)
+{
+    m->buf->rpos += n;
+    c->send_nbyte += n;
+    INCR(udp_metrics, udp_send_dgram);
+    INCR_N(udp_metrics, udp_send_byte, n);
+}
+
+int
+udp_recv_batch(struct udp_conn *c, struct udp_msg *msg, uint32_t n)
+{
+    union udp_ctrl ctrl[UDP_BATCH_MAX];
+    struct iovec iov[UDP_BATCH_MAX];
+    uint32_t i;
+    int ret;
+#ifdef OS_LINUX
+    struct mmsghdr mm[UDP_BATCH_MAX];
+#else
+    struct msghdr hdr;
+    ssize_t nbyte;
+#endif
+
+    ASSERT(msg != NULL);
+    ASSERT(n > 0 && n <= UDP_BATCH_MAX);
+
+    log_verb("recv batch on sd %d, up to %"PRIu32" datagrams", c->sd, n);
+
+#ifdef OS_LINUX
+    for (i = 0; i < n; i++) {
+        _udp_recv_hdr(&mm[i].msg_hdr, &iov[i], &msg[i], c->gro ? &ctrl[i] : NULL);
+        mm[i].msg_len = 0;
+    }
+
+    for (;;) {
+        ret = recvmmsg(c->sd, mm, n, 0, NULL);
+        INCR(udp_metrics, udp_recv);
+        if (ret >= 0) {
+            break;
+        }
+        INCR(udp_metrics, udp_recv_ex);
+        if ((ret = _udp_error(c, "recvmmsg")) != CC_ERETRY) {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < (uint32_t)ret; i++) {
+        _udp_recv_done(c, &msg[i], &mm[i].msg_hdr, mm[i].msg_len);
+    }
+#else
+    for (i = 0; i < n; ) {
+        _udp_recv_hdr(&hdr, &iov[i], &msg[i], c->gro ? &ctrl[i] : NULL);
+        nbyte = recvmsg(c->sd, &hdr, 0);
+        INCR(udp_metrics, udp_recv);
+        if (nbyte >= 0) {
+            _udp_recv_done(c, &msg[i], &hdr, (size_t)nbyte);
+            i++;
+            continue;
+        }
+        INCR(udp_metrics, udp_recv_ex);
+        if ((ret = _udp_error(c, "recvmsg")) == CC_ERETRY) {
+            continue;
+        }
+        if (i == 0) {
+            return ret;
+        }
+        break;
+    }
+    ret = (int)i;
+#endif
+
+    log_verb("recv'd %d datagrams on sd %d", ret, c->sd);
+
+    return ret;
+}
+
+int
+udp_send_batch(struct udp_conn *c, struct udp_msg *msg, uint32_t n)
+{
+    struct iovec iov[UDP_BATCH_MAX];
+    uint32_t i;
+    int ret;
+#ifdef OS_LINUX
+    struct mmsghdr mm[UDP_BATCH_MAX];
+#else
+    struct msghdr hdr;
+    ssize_t nbyte;
+#endif
+
+    ASSERT(msg != NULL);
+    ASSERT(n > 0 && n <= UDP_BATCH_MAX);
+
+    log_verb("send batch on sd %d, %"PRIu32" datagrams", c->sd, n);
+
+#ifdef OS_LINUX
+    for (i = 0; i < n; i++) {
+        _udp_send_hdr(&mm[i].msg_hdr, &iov[i], &msg[i]);
+        mm[i].msg_len = 0;
+    }
+
+    for (;;) {
+        ret = sendmmsg(c->sd, mm, n, 0);
+        INCR(udp_metrics, udp_send);
+        if (ret >= 0) {
+            break;
+        }
+        INCR(udp_metrics, udp_send_ex);
+        if ((ret = _udp_error(c, "sendmmsg")) != CC_ERETRY) {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < (uint32_t)ret; i++) {
+        _udp_send_done(c, &msg[i], mm[i].msg_len);
+    }
+#else
+    for (i = 0; i < n; ) {
+        _udp_send_hdr(&hdr, &iov[i], &msg[i]);
+        nbyte = sendmsg(c->sd, &hdr, 0);
+        INCR(udp_metrics, udp_send);
+        if (nbyte >= 0) {
+            _udp_send_done(c, &msg[i], (size_t)nbyte);
+            i++;
+            continue;
+        }
+        INCR(udp_metrics, udp_send_ex);
+        if ((ret = _udp_error(c, "sendmsg")) == CC_ERETRY) {
+            continue;
+        }
+        if (i == 0) {
+            return ret;
+        }
+        break;
+    }
+    ret = (int)i;
+#endif
+
+    log_verb("sent %d datagrams on sd %d", ret, c->sd);
+
+    return ret;
+}
+
+/* send msg one segment at a time, for when the kernel cannot segment */
+static ssize_t
+_udp_send_segments(struct udp_conn *c, struct udp_msg *m, uint16_t segsize)
+{
+    struct msghdr hdr;
+    struct iovec iov;
+    size_t sent = 0;
+    ssize_t n;
+    int ret;
+
+    while (buf_rsize(m->buf) > 0) {
+        _udp_send_hdr(&hdr, &iov, m);
+        iov.iov_len = MIN(iov.iov_len, segsize);
+        n = sendmsg(c->sd, &hdr, 0);
+        INCR(udp_metrics, udp_send);
+        if (n >= 0) {
+            _udp_send_done(c, m, (size_t)n);
+            sent += (size_t)n;
+            continue;
+        }
+        INCR(udp_metrics, udp_send_ex);
+        if ((ret = _udp_error(c, "sendmsg")) == CC_ERETRY) {
+            continue;
+        }
+        return sent > 0 ? (ssize_t)sent : ret;
+    }
+
+    return (ssize_t)sent;
+}
+
+ssize_t
+udp_send_gso(struct udp_conn *c, struct udp_msg *msg, uint16_t segsize)
+{
+#ifdef UDP_HAVE_GSO
+    union {
+        struct cmsghdr  hdr;
+        char            buf[CMSG_SPACE(sizeof(uint16_t))];
+    } ctrl;
+    struct msghdr hdr;
+    struct cmsghdr *cm;
+    struct iovec iov;
+    uint32_t nbyte, nseg;
+    ssize_t n;
+    int ret;
+#endif
+
+    ASSERT(msg != NULL && msg->buf != NULL);
+    ASSERT(segsize > 0);
+    ASSERT(buf_rsize(msg->buf) > 0);
+    ASSERT((buf_rsize(msg->buf) + segsize - 1) / segsize <= UDP_GSO_MAX);
+
+#ifdef UDP_HAVE_GSO
+    nbyte = buf_rsize(msg->buf);
+    if (nbyte <= segsize) {
+        return _udp_send_segments(c, msg, segsize);
+    }
+
+    _udp_send_hdr(&hdr, &iov, msg);
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+    cm = CMSG_FIRSTHDR(&hdr);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segsize, sizeof(uint16_t));
+
+    for (;;) {
+        n = sendmsg(c->sd, &hdr, 0);
+        INCR(udp_metrics, udp_send);
+        if (n >= 0) {
+            nseg = ((uint32_t)n + segsize - 1) / segsize;
+            msg->buf->rpos += n;
+            c->send_nbyte += (size_t)n;
+            INCR_N(udp_metrics, udp_send_dgram, nseg);
+            INCR_N(udp_metrics, udp_send_byte, n);
+            log_verb("sent %zd bytes in %"PRIu32" segments on sd %d", n, nseg,
+                    c->sd);
+            return n;
+        }
+        INCR(udp_metrics, udp_send_ex);
+        if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT) {
+            /* no segmentation offload for this socket or device */
+            log_debug("udp gso on sd %d failed, sending segments: %s", c->sd,
+                    strerror(errno));
+            return _udp_send_segments(c, msg, segsize);
+        }
+        if ((ret = _udp_error(c, "sendmsg gso")) != CC_ERETRY) {
+            return ret;
+        }
+    }
+#else
+    return _udp_send_segments(c, msg, segsize);
+#endif
+}
+
+void
+udp_setup(udp_options_st *options, udp_metrics_st *metrics)
+{
+    log_info("set up the %s module", UDP_MODULE_NAME);
+
+    if (udp_init) {
+        log_warn("%s has already been setup, overwrite", UDP_MODULE_NAME);
+    }
+
+    udp_metrics = metrics;
+
+    if (options != NULL) {
+        gro = option_bool(&options->udp_gro);
+    }
+
+    udp_init = true;
+}
+
+void
+udp_teardown(void)
+{
+    log_info("tear down the %s module", UDP_MODULE_NAME);
+
+    if (!udp_init) {
+        log_warn("%s has never been setup", UDP_MODULE_NAME);
+    }
+
+    udp_metrics = NULL;
+    gro = UDP_GRO_DEFAULT;
+
+    udp_init = false;
+}
@@ -0,0 +1,744 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2015 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_uds.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_pool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define UDS_MODULE_NAME "ccommon::uds"
+
+FREEPOOL(uds_conn_pool, cq, uds_conn);
+static struct uds_conn_pool cp;
+
+static bool uds_init = false;
+static bool cp_init = false;
+static uds_metrics_st *uds_metrics = NULL;
+static int max_backlog = UDS_BACKLOG;
+
+void
+uds_conn_reset(struct uds_conn *c)
+{
+    STAILQ_NEXT(c, next) = NULL;
+    c->free = false;
+
+    c->level = CHANNEL_INVALID;
+    c->sd = -1;
+
+    c->recv_nbyte = 0;
+    c->send_nbyte = 0;
+
+    c->state = CHANNEL_UNKNOWN;
+    c->flags = 0;
+
+    c->err = 0;
+}
+
+struct uds_conn *
+uds_conn_create(void)
+{
+    struct uds_conn *c = (struct uds_conn *)cc_alloc(sizeof(struct uds_conn));
+
+    if (c == NULL) {
+        log_info("uds connection creation failed due to OOM");
+        INCR(uds_metrics, uds_conn_create_ex);
+
+        return NULL;
+    }
+
+    uds_conn_reset(c);
+    INCR(uds_metrics, uds_conn_create);
+    INCR(uds_metrics, uds_conn_curr);
+
+    log_verb("created uds_conn %p", c);
+
+    return c;
+}
+
+void
+uds_conn_destroy(struct uds_conn **conn)
+{
+    struct uds_conn *c = *conn;
+
+    if (c == NULL) {
+        return;
+    }
+
+    log_verb("destroy uds_conn %p", c);
+
+    cc_free(c);
+    *conn = NULL;
+    INCR(uds_metrics, uds_conn_destroy);
+    DECR(uds_metrics, uds_conn_curr);
+}
+
+static void
+uds_conn_pool_destroy(void)
+{
+    struct uds_conn *c, *tc;
+
+    if (!cp_init) {
+        log_warn("uds_conn pool was never created, ignore");
+
+        return;
+    }
+
+    log_info("destroying uds_conn pool: free %"PRIu32, cp.nfree);
+
+    FREEPOOL_DESTROY(c, tc, &cp, next, uds_conn_destroy);
+    cp_init = false;
+}
+
+static void
+uds_conn_pool_create(uint32_t max)
+{
+    struct uds_conn *c;
+
+    if (cp_init) {
+        log_warn("uds_conn pool has already been created, re-creating");
+
+        uds_conn_pool_destroy();
+    }
+
+    log_info("creating uds_conn pool: max %"PRIu32, max);
+
+    FREEPOOL_CREATE(&cp, max);
+    cp_init = true;
+
+    /* preallocating, see notes in buffer/cc_buf.c */
+    FREEPOOL_PREALLOC(c, &cp, max, next, uds_conn_create);
+    if (cp.nfree < max) {
+        log_crit("cannot preallocate uds_conn pool due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
+}
+
+struct uds_conn *
+uds_conn_borrow(void)
+{
+    struct uds_conn *c;
+
+    FREEPOOL_BORROW(c, &cp, next, uds_conn_create);
+
+    if (c == NULL) {
+        log_debug("borrow uds_conn failed: OOM or over limit");
+        INCR(uds_metrics, uds_conn_borrow_ex);
+
+        return NULL;
+    }
+
+    uds_conn_reset(c);
+    INCR(uds_metrics, uds_conn_borrow);
+    INCR(uds_metrics, uds_conn_active);
+
+    log_verb("borrow uds_conn %p", c);
+
+    return c;
+}
+
+void
+uds_conn_return(struct uds_conn **c)
+{
+    if (c == NULL || *c == NULL || (*c)->free) {
+        return;
+    }
+
+    log_verb("return uds_conn %p", *c);
+
+    (*c)->free = true;
+    FREEPOOL_RETURN(*c, &cp, next);
+
+    *c = NULL;
+    INCR(uds_metrics, uds_conn_return);
+    DECR(uds_metrics, uds_conn_active);
+}
+
+static int
+_uds_set_nonblocking(int sd)
+{
+    int flags;
+
+    flags = fcntl(sd, F_GETFL, 0);
+    if (flags < 0) {
+        return flags;
+    }
+
+    return fcntl(sd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static bool
+_uds_addr(struct sockaddr_un *addr, const char *path)
+{
+    size_t len = strlen(path);
+
+    if (len == 0 || len >= sizeof(addr->sun_path)) {
+        log_error("uds path of length %zu is empty or too long", len);
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, len);
+
+    return true;
+}
+
+static int
+_uds_socket(void)
+{
+    int sd;
+
+#ifdef SOCK_CLOEXEC
+    sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd >= 0) {
+        fcntl(sd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    return sd;
+}
+
+bool
+uds_connect(const char *path, struct uds_conn *c)
+{
+    struct sockaddr_un addr;
+    int ret;
+
+    ASSERT(path != NULL);
+    ASSERT(c != NULL);
+
+    INCR(uds_metrics, uds_connect);
+    if (!_uds_addr(&addr, path)) {
+        goto error;
+    }
+
+    c->sd = _uds_socket();
+    if (c->sd < 0) {
+        log_error("socket create for uds_conn %p failed: %s", c,
+                strerror(errno));
+        goto error;
+    }
+
+    do {
+        ret = connect(c->sd, (struct sockaddr *)&addr, sizeof(addr));
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        log_error("connect on c %p sd %d to %s failed: %s", c, c->sd, path,
+                strerror(errno));
+        goto error;
+    }
+
+    ret = _uds_set_nonblocking(c->sd);
+    if (ret < 0) {
+        log_error("set nonblock on c %p sd %d failed: %s", c, c->sd,
+                strerror(errno));
+        goto error;
+    }
+
+    c->level = CHANNEL_BASE;
+    c->state = CHANNEL_ESTABLISHED;
+    log_info("connected on c %p sd %d to %s", c, c->sd, path);
+
+    return true;
+
+error:
+    c->err = errno;
+    if (c->sd >= 0) {
+        close(c->sd);
+        c->sd = -1;
+    }
+    INCR(uds_metrics, uds_connect_ex);
+
+    return false;
+}
+
+/* is nobody listening on addr? only a refused connect says so for sure */
+static bool
+_uds_stale(const struct sockaddr_un *addr)
+{
+    int sd, ret, err;
+
+    sd = _uds_socket();
+    if (sd < 0 || _uds_set_nonblocking(sd) < 0) {
+        err = errno;
+        if (sd >= 0) {
+            close(sd);
+        }
+        log_warn("cannot probe uds path %s: %s", addr->sun_path, strerror(err));
+        return false;
+    }
+
+    ret = connect(sd, (const struct sockaddr *)addr, sizeof(*addr));
+    err = errno;
+    close(sd);
+
+    return ret < 0 && err == ECONNREFUSED;
+}
+
+bool
+uds_listen(const char *path, struct uds_conn *c)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int ret;
+
+    ASSERT(path != NULL);
+    ASSERT(c != NULL);
+
+    if (!_uds_addr(&addr, path)) {
+        goto error;
+    }
+
+    /* left behind by a previous server that did not clean up */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            log_error("uds path %s exists and is not a socket", path);
+            errno = EEXIST;
+            goto error;
+        }
+        if (!_uds_stale(&addr)) {
+            log_error("uds path %s is in use by another listener", path);
+            errno = EADDRINUSE;
+            goto error;
+        }
+        log_info("removing stale uds socket file %s", path);
+        unlink(path);
+    }
+
+    c->sd = _uds_socket();
+    if (c->sd < 0) {
+        log_error("socket failed: %s", strerror(errno));
+        goto error;
+    }
+
+    ret = bind(c->sd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0) {
+        log_error("bind on sd %d to %s failed: %s", c->sd, path,
+                strerror(errno));
+        goto error;
+    }
+
+    ret = listen(c->sd, max_backlog);
+    if (ret < 0) {
+        log_error("listen on sd %d failed: %s", c->sd, strerror(errno));
+        goto error;
+    }
+
+    ret = _uds_set_nonblocking(c->sd);
+    if (ret < 0) {
+        log_error("set nonblock on sd %d failed: %s", c->sd, strerror(errno));
+        goto error;
+    }
+
+    c->level = CHANNEL_META;
+    c->state = CHANNEL_LISTEN;
+    log_info("server listen setup on socket descriptor %d at %s", c->sd, path);
+
+    return true;
+
+error:
+    c->err = errno;
+    if (c->sd >= 0) {
+        close(c->sd);
+        c->sd = -1;
+    }
+
+    return false;
+}
+
+void
+uds_close(struct uds_conn *c)
+{
+    int ret;
+
+    if (c == NULL || c->sd < 0) {
+        return;
+    }
+
+    log_info("closing uds_conn %p sd %d", c, c->sd);
+
+    INCR(uds_metrics, uds_close);
+    ret = close(c->sd);
+    if (ret < 0) {
+        log_warn("close c %d failed, ignored: %s", c->sd, strerror(errno));
+    }
+    c->sd = -1;
+    c->state = CHANNEL_TERM;
+}
+
+static int
+_uds_accept(struct uds_conn *sc)
+{
+    int sd;
+
+    ASSERT(sc->sd >= 0);
+
+    for (;;) {
+#ifdef CC_ACCEPT4
+        sd = accept4(sc->sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        sd = accept(sc->sd, NULL, NULL);
+#endif
+        if (sd < 0) {
+            if (errno == EINTR) {
+                log_debug("accept on sd %d not ready: eintr", sc->sd);
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                log_debug("accept on sd %d not ready: eagain", sc->sd);
+                return -1;
+            }
+
+            log_error("accept on sd %d failed: %s", sc->sd, strerror(errno));
+            INCR(uds_metrics, uds_accept_ex);
+            return -1;
+        }
+
+        break;
+    }
+
+#ifndef CC_ACCEPT4
+    if (_uds_set_nonblocking(sd) < 0) {
+        log_warn("set nonblock on sd %d failed, ignored: %s", sd,
+                strerror(errno));
+    }
+    if (fcntl(sd, F_SETFD, FD_CLOEXEC) < 0) {
+        log_warn("set cloexec on sd %d failed, ignored: %s", sd,
+                strerror(errno));
+    }
+#endif
+
+    return sd;
+}
+
+bool
+uds_accept(struct uds_conn *sc, struct uds_conn *c)
+{
+    int sd;
+
+    sd = _uds_accept(sc);
+    INCR(uds_metrics, uds_accept);
+    if (sd < 0) {
+        return false;
+    }
+
+    c->sd = sd;
+    c->level = CHANNEL_BASE;
+    c->state = CHANNEL_ESTABLISHED;
+
+    log_info("accepted c %d on sd %d", c->sd, sc->sd);
+
+    return true;
+}
+
+void
+uds_reject(struct uds_conn *sc)
+{
+    int sd;
+
+    INCR(uds_metrics, uds_reject);
+    sd = _uds_accept(sc);
+    if (sd < 0) {
+        INCR(uds_metrics, uds_reject_ex);
+        return;
+    }
+
+    if (close(sd) < 0) {
+        INCR(uds_metrics, uds_reject_ex);
+        log_warn("close c %d failed, ignored: %s", sd, strerror(errno));
+    }
+}
+
+/* account for a recvmsg/read on c, with the same returns as uds_recv */
+static ssize_t
+_uds_recv_done(struct uds_conn *c, ssize_t n)
+{
+    INCR(uds_metrics, uds_recv);
+
+    if (n > 0) {
+        log_verb("%zd bytes recv'd on sd %d", n, c->sd);
+        c->recv_nbyte += (size_t)n;
+        INCR_N(uds_metrics, uds_recv_byte, n);
+        return n;
+    }
+
+    if (n == 0) {
+        c->state = CHANNEL_TERM;
+        log_debug("eof recv'd on sd %d, total: rb %zu sb %zu", c->sd,
+                  c->recv_nbyte, c->send_nbyte);
+        return n;
+    }
+
+    /* n < 0 */
+    INCR(uds_metrics, uds_recv_ex);
+    if (errno == EINTR) {
+        log_debug("recv on sd %d not ready - EINTR", c->sd);
+        return CC_ERETRY;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        log_debug("recv on sd %d not ready - EAGAIN", c->sd);
+        return CC_EAGAIN;
+    } else {
+        c->err = errno;
+        log_error("recv on sd %d failed: %s", c->sd, strerror(errno));
+        return CC_ERROR;
+    }
+}
+
+/* account for a sendmsg/write on c, with the same returns as uds_send */
+static ssize_t
+_uds_send_done(struct uds_conn *c, ssize_t n)
+{
+    INCR(uds_metrics, uds_send);
+
+    if (n > 0) {
+        log_verb("%zd bytes sent on sd %d", n, c->sd);
+        c->send_nbyte += (size_t)n;
+        INCR_N(uds_metrics, uds_send_byte, n);
+        return n;
+    }
+
+    if (n == 0) {
+        log_warn("send on sd %d returned zero", c->sd);
+        return 0;
+    }
+
+    /* n < 0 */
+    INCR(uds_metrics, uds_send_ex);
+    if (errno == EINTR) {
+        log_verb("send on sd %d not ready - EINTR", c->sd);
+        return CC_ERETRY;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        log_verb("send on sd %d not ready - EAGAIN", c->sd);
+        return CC_EAGAIN;
+    } else {
+        c->err = errno;
+        log_error("send on sd %d failed: %s", c->sd, strerror(errno));
+        return CC_ERROR;
+    }
+}
+
+ssize_t
+uds_recv(struct uds_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    log_verb("recv on sd %d, capacity %zu bytes", c->sd, nbyte);
+
+    do {
+        n = _uds_recv_done(c, read(c->sd, buf, nbyte));
+    } while (n == CC_ERETRY);
+
+    return n;
+}
+
+ssize_t
+uds_send(struct uds_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    log_verb("send on sd %d, total %zu bytes", c->sd, nbyte);
+
+    do {
+        n = _uds_send_done(c, write(c->sd, buf, nbyte));
+    } while (n == CC_ERETRY);
+
+    return n;
+}
+
+ssize_t
+uds_sendfd(struct uds_conn *c, void *buf, size_t nbyte, const int *fd,
+        uint32_t nfd)
+{
+    union {
+        struct cmsghdr  hdr;
+        char            buf[CMSG_SPACE(sizeof(int) * UDS_NFD_MAX)];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct iovec iov;
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+    ASSERT(nfd <= UDS_NFD_MAX);
+
+    if (nfd == 0) {
+        return uds_send(c, buf, nbyte);
+    }
+
+    log_verb("send on sd %d, total %zu bytes and %"PRIu32" fds", c->sd, nbyte,
+            nfd);
+
+    iov.iov_base = buf;
+    iov.iov_len = nbyte;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfd);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * nfd);
+    memcpy(CMSG_DATA(cm), fd, sizeof(int) * nfd);
+
+    do {
+        n = _uds_send_done(c, sendmsg(c->sd, &msg, 0));
+    } while (n == CC_ERETRY);
+
+    if (n > 0) {
+        INCR_N(uds_metrics, uds_send_fd, nfd);
+    }
+
+    return n;
+}
+
+ssize_t
+uds_recvfd(struct uds_conn *c, void *buf, size_t nbyte, int *fd,
+        uint32_t *nfd)
+{
+    union {
+        struct cmsghdr  hdr;
+        char            buf[CMSG_SPACE(sizeof(int) * UDS_NFD_MAX)];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct iovec iov;
+    uint32_t i, nrecv, cap;
+    int *rfd;
+    ssize_t n;
+    int flags = 0;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+    ASSERT(nfd != NULL);
+
+    cap = *nfd;
+    *nfd = 0;
+
+    log_verb("recv on sd %d, capacity %zu bytes and %"PRIu32" fds", c->sd,
+            nbyte, cap);
+
+    iov.iov_base = buf;
+    iov.iov_len = nbyte;
+#ifdef MSG_CMSG_CLOEXEC
+    flags = MSG_CMSG_CLOEXEC;
+#endif
+
+    do {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        n = _uds_recv_done(c, recvmsg(c->sd, &msg, flags));
+    } while (n == CC_ERETRY);
+
+    if (n <= 0) {
+        return n;
+    }
+
+    if (msg.msg_flags & MSG_CTRUNC) {
+        log_warn("fds beyond %d received on sd %d were discarded", UDS_NFD_MAX,
+                c->sd);
+    }
+
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        rfd = (int *)CMSG_DATA(cm);
+        nrecv = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        INCR_N(uds_metrics, uds_recv_fd, nrecv);
+        for (i = 0; i < nrecv; i++) {
+            if (*nfd < cap) {
+#ifndef MSG_CMSG_CLOEXEC
+                fcntl(rfd[i], F_SETFD, FD_CLOEXEC);
+#endif
+                fd[(*nfd)++] = rfd[i];
+            } else {
+                log_warn("no room for fd %d received on sd %d, closing",
+                        rfd[i], c->sd);
+                close(rfd[i]);
+            }
+        }
+    }
+
+    return n;
+}
+
+void
+uds_setup(uds_options_st *options, uds_metrics_st *metrics)
+{
+    uint32_t max = UDS_POOLSIZE;
+
+    log_info("set up the %s module", UDS_MODULE_NAME);
+
+    if (uds_init) {
+        log_warn("%s has already been setup, overwrite", UDS_MODULE_NAME);
+    }
+
+    uds_metrics = metrics;
+
+    if (options != NULL) {
+        max_backlog = option_uint(&options->uds_backlog);
+        max = option_uint(&options->uds_poolsize);
+    }
+    uds_conn_pool_create(max);
+
+    channel_sigpipe_ignore(); /* does it ever fail? */
+    uds_init = true;
+}
+
+void
+uds_teardown(void)
+{
+    log_info("tear down the %s module", UDS_MODULE_NAME);
+
+    if (!uds_init) {
+        log_warn("%s has never been setup", UDS_MODULE_NAME);
+    }
+
+    uds_conn_pool_destroy();
+    uds_metrics = NULL;
+    max_backlog = UDS_BACKLOG;
+
+    uds_init = false;
+}
@@ -22,11 +22,15 @@
 #include <cc_debug.h>
 #include <cc_define.h>
 #include <cc_mm.h>
+#include <cc_probe.h>
+#include <cc_trace.h>
+#include <time/cc_timer.h>
 
 #include <inttypes.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/errno.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
 #include "cc_shared.h"
@@ -39,6 +43,35 @@
 # define EPOLLRDHUP 0x2000
 #endif
 
+/* same for EPOLLEXCLUSIVE, added in Linux 4.5 */
+#ifndef EPOLLEXCLUSIVE
+# define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+/* and EPIOCSPARAMS, added in Linux 6.9 */
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+# define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+#define EVENT_FD_NINIT  64  /* initial size of the fd table */
+
+#define EPOLL_TYPE      (EPOLLIN | EPOLLOUT)
+
+/* per-fd interest in lazy mode */
+struct event_fd {
+    void                *data;      /* data for the callback */
+    uint32_t            cur;        /* events registered with epoll */
+    uint32_t            want;       /* events to register on flush */
+    bool                dirty;      /* in change[] */
+    bool                rearm;      /* oneshot added again, apply as is */
+};
+
 struct event_base {
     int                ep;      /* epoll descriptor */
 
@@ -46,6 +79,17 @@ struct event_base {
     int                nevent;  /* # events */
 
     event_cb_fn         cb;      /* event callback */
+    event_batch_cb_fn   batch_cb;/* see event_base_set_batch_cb */
+    struct event_ready  *batch;  /* batch[] - translated events, nevent */
+
+    bool                lazy;   /* see event_base_set_lazy */
+    struct event_fd     *fd;    /* fd[] - lazy registrations indexed by fd */
+    uint32_t            nfd;    /* # entries in fd[] */
+    int                 *change;/* change[] - fds with changes to apply */
+    uint32_t            nchange;/* # fds in change[] */
+    uint32_t            nchange_max; /* size of change[] */
+
+    uint64_t            spin_ns;/* see event_base_set_spin */
 };
 
 struct event_base *
@@ -86,6 +130,15 @@ event_base_create(int nevent, event_cb_fn cb)
     evb->event = event;
     evb->nevent = nevent;
     evb->cb = cb;
+    evb->batch_cb = NULL;
+    evb->batch = NULL;
+    evb->lazy = false;
+    evb->fd = NULL;
+    evb->nfd = 0;
+    evb->change = NULL;
+    evb->nchange = 0;
+    evb->nchange_max = 0;
+    evb->spin_ns = 0;
 
     log_info("epoll fd %d with nevent %d", evb->ep, evb->nevent);
 
@@ -105,6 +158,9 @@ event_base_destroy(struct event_base **evb)
     ASSERT(e->ep > 0);
 
     cc_free(e->event);
+    cc_free(e->fd);
+    cc_free(e->change);
+    cc_free(e->batch);
 
     status = close(e->ep);
     if (status < 0) {
@@ -131,48 +187,313 @@ _event_update(struct event_base *evb, int fd, int op, uint32_t events, void *ptr
     return epoll_ctl(evb->ep, op, fd, &event);
 }
 
-int event_add_read(struct event_base *evb, int fd, void *data)
+static struct event_fd *
+_event_fd(struct event_base *evb, int fd)
+{
+    struct event_fd *e;
+    uint32_t nfd;
+
+    ASSERT(fd >= 0);
+
+    if ((uint32_t)fd >= evb->nfd) {
+        nfd = evb->nfd * 2 > (uint32_t)fd ? evb->nfd * 2 : (uint32_t)fd + 1;
+        nfd = nfd < EVENT_FD_NINIT ? EVENT_FD_NINIT : nfd;
+        e = cc_realloc(evb->fd, nfd * sizeof(*e));
+        if (e == NULL) {
+            log_error("cannot grow fd table of epoll fd %d to %"PRIu32, evb->ep,
+                    nfd);
+            return NULL;
+        }
+        memset(e + evb->nfd, 0, (nfd - evb->nfd) * sizeof(*e));
+        evb->fd = e;
+        evb->nfd = nfd;
+    }
+
+    return &evb->fd[fd];
+}
+
+/* record a change of interest in fd, to be applied by _event_flush */
+static int
+_event_change(struct event_base *evb, int fd, uint32_t add, uint32_t del,
+        void *data)
+{
+    struct event_fd *e;
+    int *change;
+    uint32_t n;
+
+    e = _event_fd(evb, fd);
+    if (e == NULL) {
+        return -1;
+    }
+
+    if (!e->dirty) {
+        if (evb->nchange == evb->nchange_max) {
+            n = evb->nchange_max == 0 ? EVENT_FD_NINIT : evb->nchange_max * 2;
+            change = cc_realloc(evb->change, n * sizeof(*change));
+            if (change == NULL) {
+                log_error("cannot grow change list of epoll fd %d to %"PRIu32,
+                        evb->ep, n);
+                return -1;
+            }
+            evb->change = change;
+            evb->nchange_max = n;
+        }
+        evb->change[evb->nchange++] = fd;
+        e->dirty = true;
+    }
+
+    e->want = (e->want & ~del) | add;
+    if ((e->want & EPOLL_TYPE) == 0) {
+        /* flags go with the last type of interest */
+        e->want = 0;
+    }
+    if (add != 0) {
+        e->data = data;
+        e->rearm |= (add & EPOLLONESHOT) != 0;
+    }
+
+    return 0;
+}
+
+static void
+_event_flush_fd(struct event_base *evb, int fd, struct event_fd *e)
+{
+    int op, status;
+
+    e->dirty = false;
+    if (e->want == e->cur && !e->rearm) {
+        INCR_SHARD(event_metrics, event_change_skip);
+        return;
+    }
+
+    if (e->want == 0) {
+        op = EPOLL_CTL_DEL;
+    } else if (e->cur == 0) {
+        op = EPOLL_CTL_ADD;
+    } else {
+        op = EPOLL_CTL_MOD;
+    }
+
+    status = _event_update(evb, fd, op, e->want, e->data);
+    if (status < 0 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+        /* registered before lazy mode was turned on */
+        status = _event_update(evb, fd, EPOLL_CTL_MOD, e->want, e->data);
+    }
+    INCR_SHARD(event_metrics, event_change);
+    if (status < 0) {
+        log_error("ctl (lazy %d) w/ epoll fd %d on fd %d failed: %s", op,
+                evb->ep, fd, strerror(errno));
+        /* the fd is likely gone, start over on the next change */
+        e->want = 0;
+    }
+
+    e->cur = e->want;
+    e->rearm = false;
+}
+
+/* apply the changes recorded since the last flush */
+static void
+_event_flush(struct event_base *evb)
+{
+    uint32_t i;
+    int fd;
+
+    for (i = 0; i < evb->nchange; i++) {
+        fd = evb->change[i];
+        _event_flush_fd(evb, fd, &evb->fd[fd]);
+    }
+    evb->nchange = 0;
+}
+
+void
+event_base_set_lazy(struct event_base *evb, bool lazy)
+{
+    ASSERT(evb != NULL);
+
+    if (evb->lazy && !lazy) {
+        _event_flush(evb);
+    }
+    evb->lazy = lazy;
+
+    log_info("lazy interest changes %s on epoll fd %d", lazy ? "on" : "off",
+            evb->ep);
+}
+
+void
+event_base_set_spin(struct event_base *evb, uint32_t spin_us)
+{
+    ASSERT(evb != NULL);
+
+    evb->spin_ns = (uint64_t)spin_us * 1000;
+
+    log_info("spin %"PRIu32" us before waiting on epoll fd %d", spin_us,
+            evb->ep);
+}
+
+int
+event_base_set_batch_cb(struct event_base *evb, event_batch_cb_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    if (cb != NULL && evb->batch == NULL) {
+        evb->batch = (struct event_ready *)cc_calloc(evb->nevent,
+                sizeof(*evb->batch));
+        if (evb->batch == NULL) {
+            log_error("allocate batch of %d events failed", evb->nevent);
+            return -1;
+        }
+    }
+    evb->batch_cb = cb;
+
+    log_info("batch dispatch %s on epoll fd %d", cb != NULL ? "on" : "off",
+            evb->ep);
+
+    return 0;
+}
+
+int
+event_base_set_busy_poll(struct event_base *evb, uint32_t usec,
+        uint16_t budget, bool prefer)
+{
+    struct epoll_params p;
+    int status;
+
+    ASSERT(evb != NULL);
+
+    memset(&p, 0, sizeof(p));
+    p.busy_poll_usecs = usec;
+    p.busy_poll_budget = budget;
+    p.prefer_busy_poll = prefer;
+    status = ioctl(evb->ep, EPIOCSPARAMS, &p);
+    if (status < 0) {
+        log_error("busy poll %"PRIu32" us on epoll fd %d failed: %s", usec,
+                evb->ep, strerror(errno));
+        return -1;
+    }
+
+    log_info("busy poll %"PRIu32" us, budget %"PRIu16" on epoll fd %d", usec,
+            budget, evb->ep);
+
+    return 0;
+}
+
+static uint32_t
+_event_flags(uint32_t flags)
+{
+    uint32_t events = 0;
+
+    if (flags & EVENT_EDGE) {
+        events |= EPOLLET;
+    }
+    if (flags & EVENT_ONESHOT) {
+        events |= EPOLLONESHOT;
+    }
+    if (flags & EVENT_EXCLUSIVE) {
+        events |= EPOLLEXCLUSIVE;
+    }
+
+    return events;
+}
+
+static int
+_event_add(struct event_base *evb, int fd, uint32_t events, uint32_t flags,
+        void *data)
 {
     int status;
 
+    if ((flags & EVENT_EXCLUSIVE) && (flags & EVENT_ONESHOT)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    events |= _event_flags(flags);
+    if (evb->lazy) {
+        return _event_change(evb, fd, events, 0, data);
+    }
+
     /*
      * Note(yao): there have been tests showing EPOLL_CTL_ADD is cheaper than
      * EPOLL_CTL_MOD, and the only difference is we need to ignore EEXIST
      */
-    status = _event_update(evb, fd, EPOLL_CTL_ADD, EPOLLIN, data);
+    status = _event_update(evb, fd, EPOLL_CTL_ADD, events, data);
+    if (status < 0 && errno == EEXIST && (flags & EVENT_ONESHOT)) {
+        /* a oneshot fd stays registered after firing, re-arm it */
+        status = _event_update(evb, fd, EPOLL_CTL_MOD, events, data);
+    }
+
+    return status;
+}
+
+int
+event_add_read_flags(struct event_base *evb, int fd, void *data,
+        uint32_t flags)
+{
+    int status;
+
+    status = _event_add(evb, fd, EPOLLIN, flags, data);
     if (status < 0 && errno != EEXIST) {
         log_error("ctl (add read) w/ epoll fd %d on fd %d failed: %s", evb->ep,
                 fd, strerror(errno));
     }
 
-    INCR(event_metrics, event_read);
-    log_verb("add read event to epoll fd %d on fd %d", evb->ep, fd);
+    INCR_SHARD(event_metrics, event_read);
+    log_verb("add read event to epoll fd %d on fd %d, flags %"PRIx32, evb->ep,
+            fd, flags);
 
     return status;
 }
 
 int
-event_add_write(struct event_base *evb, int fd, void *data)
+event_add_write_flags(struct event_base *evb, int fd, void *data,
+        uint32_t flags)
 {
     int status;
 
-    status = _event_update(evb, fd, EPOLL_CTL_ADD, EPOLLOUT, data);
+    status = _event_add(evb, fd, EPOLLOUT, flags, data);
     if (status < 0 && errno != EEXIST) {
         log_error("ctl (add write) w/ epoll fd %d on fd %d failed: %s", evb->ep,
                  fd, strerror(errno));
     }
 
-    INCR(event_metrics, event_write);
-    log_verb("add write event to epoll fd %d on fd %d", evb->ep, fd);
+    INCR_SHARD(event_metrics, event_write);
+    log_verb("add write event to epoll fd %d on fd %d, flags %"PRIx32, evb->ep,
+            fd, flags);
 
     return status;
 }
 
+int
+event_add_read(struct event_base *evb, int fd, void *data)
+{
+    return event_add_read_flags(evb, fd, data, 0);
+}
+
+int
+event_add_write(struct event_base *evb, int fd, void *data)
+{
+    return event_add_write_flags(evb, fd, data, 0);
+}
+
 int
 event_del(struct event_base *evb, int fd)
 {
+    struct event_fd *e;
+    bool pending;
     int status;
 
+    if (evb->lazy && (uint32_t)fd < evb->nfd) {
+        e = &evb->fd[fd];
+        /* dropping what is pending is enough if nothing was applied yet */
+        pending = e->cur == 0 && e->want != 0;
+        e->cur = 0;
+        e->want = 0;
+        e->rearm = false;
+        e->data = NULL;
+        if (pending) {
+            return 0;
+        }
+    }
+
     /* event can be NULL in kernel >=2.6.9, here we keep it for compatibility */
     status = _event_update(evb, fd, EPOLL_CTL_DEL, 0, NULL);
     if (status < 0) {
@@ -185,6 +506,48 @@ event_del(struct event_base *evb, int fd)
     return status;
 }
 
+int
+event_del_read(struct event_base *evb, int fd)
+{
+    if (!evb->lazy) {
+        return event_del(evb, fd);
+    }
+
+    return _event_change(evb, fd, 0, EPOLLIN, NULL);
+}
+
+int
+event_del_write(struct event_base *evb, int fd)
+{
+    if (!evb->lazy) {
+        return event_del(evb, fd);
+    }
+
+    return _event_change(evb, fd, 0, EPOLLOUT, NULL);
+}
+
+void
+event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb)
+{
+    log_warn("I/O completion callback is ignored by epoll");
+}
+
+int
+event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, void *data)
+{
+    log_error("completion-based recv is not supported by epoll");
+
+    return -1;
+}
+
+int
+event_send(struct event_base *evb, int fd, const void *buf, size_t nbyte,
+        void *data)
+{
+    log_error("completion-based send is not supported by epoll");
+
+    return -1;
+}
 
 /*
  * create a timed event with event base function and timeout (in millisecond)
@@ -193,6 +556,8 @@ int
 event_wait(struct event_base *evb, int timeout)
 {
     struct epoll_event *ev_arr;
+    struct duration d, spin;
+    bool spinning;
     int nevent;
     int ep;
 
@@ -206,13 +571,25 @@ event_wait(struct event_base *evb, int timeout)
     ASSERT(ev_arr != NULL);
     ASSERT(nevent > 0);
 
+    _event_flush(evb);
+    spinning = event_spin_begin(&spin, evb->spin_ns, timeout);
+
     for (;;) {
         int i, nreturned;
 
-        nreturned = epoll_wait(ep, ev_arr, nevent, timeout);
-        INCR(event_metrics, event_loop);
+        PROBE2(event_wait_enter, evb, spinning ? 0 : timeout);
+        TRACE_BEGIN(TRACE_EVENT_WAIT);
+        nreturned = epoll_wait(ep, ev_arr, nevent, spinning ? 0 : timeout);
+        TRACE_END_N(TRACE_EVENT_WAIT, nreturned > 0 ? nreturned : 0);
+        PROBE2(event_wait_exit, evb, nreturned);
+        INCR_SHARD(event_metrics, event_loop);
+        timer_cache_update(); /* one clock read per wakeup */
         if (nreturned > 0) {
-            INCR_N(event_metrics, event_total, nreturned);
+            INCR_N_SHARD(event_metrics, event_total, nreturned);
+            if (spinning) {
+                INCR_SHARD(event_metrics, event_spin_hit);
+            }
+            EVENT_DISPATCH_BEGIN(&d);
             for (i = 0; i < nreturned; i++) {
                 struct epoll_event *ev = ev_arr + i;
                 uint32_t events = 0;
@@ -220,7 +597,6 @@ event_wait(struct event_base *evb, int timeout)
                 log_verb("epoll %04"PRIX32" against data %p",
                           ev->events, ev->data.ptr);
 
-
                 if (ev->events & (EPOLLERR | EPOLLHUP)) {
                     events |= EVENT_ERR;
                 }
@@ -233,10 +609,23 @@ event_wait(struct event_base *evb, int timeout)
                     events |= EVENT_WRITE;
                 }
 
+                if (evb->batch_cb != NULL) {
+                    evb->batch[i].data = ev->data.ptr;
+                    evb->batch[i].events = events;
+                    continue;
+                }
+
+                if (i + EVENT_PREFETCH < nreturned) {
+                    __builtin_prefetch(ev_arr[i + EVENT_PREFETCH].data.ptr);
+                }
                 if (evb->cb != NULL) {
                     evb->cb(ev->data.ptr, events);
                 }
             }
+            if (evb->batch_cb != NULL) {
+                event_batch_dispatch(evb->batch_cb, evb->batch, nreturned);
+            }
+            EVENT_DISPATCH_END(&d);
 
             log_verb("returned %d events from epoll fd %d",
                     nreturned, ep);
@@ -244,6 +633,11 @@ event_wait(struct event_base *evb, int timeout)
             return nreturned;
         }
 
+        if (nreturned == 0 && spinning) {
+            spinning = event_spin(&spin, evb->spin_ns, &timeout);
+            continue;
+        }
+
         if (nreturned == 0) {
             if (timeout == -1) {
                log_error("indefinite wait on epoll fd %d with %d events "
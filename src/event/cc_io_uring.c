@@ -0,0 +1,891 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * io_uring based event backend for Linux, selected with -DHAVE_IO_URING=ON.
+ *
+ * Readiness events are implemented as poll requests. A level-triggered
+ * registration uses a single-shot poll that is re-armed after every
+ * completion, which reports the fd again as long as it stays ready. An
+ * edge-triggered registration (EVENT_EDGE) uses a multishot poll, which only
+ * completes on new wakeups; it is re-armed if the kernel ends it. A oneshot
+ * registration (EVENT_ONESHOT) is not re-armed until added again.
+ * EVENT_EXCLUSIVE has no io_uring equivalent and is ignored.
+ * In addition, recv/send can be submitted directly (event_recv/event_send),
+ * with the result delivered to the I/O callback once the operation completes.
+ *
+ * Submissions are queued in the submission ring and handed to the kernel in
+ * the same io_uring_enter call that waits for completions in event_wait, so
+ * a busy loop iteration costs a single system call.
+ *
+ * The ring is driven through raw system calls, and requires Linux 5.11+
+ * (IORING_FEAT_EXT_ARG) for timed waits.
+ */
+
+#include <cc_event.h>
+
+#include <cc_debug.h>
+#include <cc_define.h>
+#include <cc_mm.h>
+#include <cc_probe.h>
+#include <cc_trace.h>
+#include <time/cc_timer.h>
+
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cc_shared.h"
+
+/*
+ * user_data layout: fd (32 bits) | generation (24 bits) | tag (8 bits)
+ * The generation of a fd is bumped whenever it is deleted, so completions
+ * that belong to a previous registration of the same fd are dropped.
+ */
+#define UD_INTERNAL     0   /* removal/cancel requests, ignored */
+#define UD_POLL_READ    1
+#define UD_POLL_WRITE   2
+#define UD_RECV         3
+#define UD_SEND         4
+
+#define UD_GEN_MASK     0xffffff
+#define UD(_fd, _gen, _tag)                                             \
+    (((uint64_t)(uint32_t)(_fd) << 32) |                                \
+     ((uint64_t)((_gen) & UD_GEN_MASK) << 8) | (_tag))
+#define UD_FD(_ud)      ((int)((_ud) >> 32))
+#define UD_GEN(_ud)     ((uint32_t)((_ud) >> 8) & UD_GEN_MASK)
+#define UD_TAG(_ud)     ((uint32_t)(_ud) & 0xff)
+
+#define EVENT_FD_NINIT  64  /* initial size of the fd table */
+
+/* per-fd registration */
+struct event_fd {
+    void                *data;      /* data for readiness callback */
+    void                *io_data[2];/* data for recv/send completion */
+    uint32_t            gen;        /* generation, see above */
+    uint32_t            poll;       /* EVENT_READ|EVENT_WRITE registered */
+    uint32_t            armed;      /* registered with a poll in flight */
+    uint32_t            flags[2];   /* registration flags for read, write */
+    uint32_t            io;         /* EVENT_READ|EVENT_WRITE in flight */
+};
+
+struct event_base {
+    int                 ring;       /* io_uring descriptor */
+
+    /* submission queue */
+    void                *sq_ptr;
+    size_t              sq_sz;
+    unsigned            *sq_khead;
+    unsigned            *sq_ktail;
+    unsigned            *sq_array;
+    unsigned            sq_mask;
+    unsigned            sq_entries;
+    unsigned            sq_tail;    /* local tail, published on enter */
+    struct io_uring_sqe *sqe;
+    size_t              sqe_sz;
+
+    /* completion queue */
+    void                *cq_ptr;
+    size_t              cq_sz;
+    unsigned            *cq_khead;
+    unsigned            *cq_ktail;
+    unsigned            cq_mask;
+    struct io_uring_cqe *cqe;
+
+    struct event_fd     *fd;        /* fd[] - registrations indexed by fd */
+    uint32_t            nfd;        /* # entries in fd[] */
+
+    int                 nevent;     /* max # events per wait */
+
+    event_cb_fn         cb;         /* event callback */
+    event_io_cb_fn      io_cb;      /* I/O completion callback */
+    event_batch_cb_fn   batch_cb;   /* see event_base_set_batch_cb */
+    struct event_ready  *batch;     /* batch[] - translated events, nevent */
+    int                 nbatch;     /* # events in batch[] */
+
+    uint64_t            spin_ns;    /* see event_base_set_spin */
+};
+
+static int
+_enter(struct event_base *evb, unsigned min_complete, unsigned flags,
+        struct io_uring_getevents_arg *arg)
+{
+    unsigned to_submit;
+    int status;
+
+    /* publish queued submissions */
+    __atomic_store_n(evb->sq_ktail, evb->sq_tail, __ATOMIC_RELEASE);
+    to_submit = evb->sq_tail - __atomic_load_n(evb->sq_khead, __ATOMIC_ACQUIRE);
+
+    status = (int)syscall(__NR_io_uring_enter, evb->ring, to_submit,
+            min_complete, flags, arg, arg == NULL ? 0 : sizeof(*arg));
+    if (status < 0 && errno != ETIME && errno != EINTR) {
+        log_error("io_uring_enter on ring %d failed: %s", evb->ring,
+                strerror(errno));
+    }
+
+    return status;
+}
+
+static struct io_uring_sqe *
+_sqe_get(struct event_base *evb)
+{
+    struct io_uring_sqe *sqe;
+    unsigned head, idx;
+
+    head = __atomic_load_n(evb->sq_khead, __ATOMIC_ACQUIRE);
+    if (evb->sq_tail - head == evb->sq_entries) {
+        /* submission queue is full, hand it to the kernel to make room */
+        _enter(evb, 0, 0, NULL);
+        head = __atomic_load_n(evb->sq_khead, __ATOMIC_ACQUIRE);
+        if (evb->sq_tail - head == evb->sq_entries) {
+            log_error("submission queue of ring %d is full", evb->ring);
+            return NULL;
+        }
+    }
+
+    idx = evb->sq_tail & evb->sq_mask;
+    sqe = &evb->sqe[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    evb->sq_array[idx] = idx;
+    evb->sq_tail++;
+
+    return sqe;
+}
+
+static struct event_fd *
+_event_fd(struct event_base *evb, int fd)
+{
+    struct event_fd *e;
+    uint32_t nfd;
+
+    ASSERT(fd >= 0);
+
+    if ((uint32_t)fd >= evb->nfd) {
+        nfd = evb->nfd * 2 > (uint32_t)fd ? evb->nfd * 2 : (uint32_t)fd + 1;
+        e = cc_realloc(evb->fd, nfd * sizeof(*e));
+        if (e == NULL) {
+            log_error("cannot grow fd table of ring %d to %"PRIu32, evb->ring,
+                    nfd);
+            return NULL;
+        }
+        memset(e + evb->nfd, 0, (nfd - evb->nfd) * sizeof(*e));
+        evb->fd = e;
+        evb->nfd = nfd;
+    }
+
+    return &evb->fd[fd];
+}
+
+static int
+_poll_add(struct event_base *evb, int fd, struct event_fd *e, uint32_t type)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = _sqe_get(evb);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (e->flags[type == EVENT_READ ? 0 : 1] & EVENT_EDGE) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    if (type == EVENT_READ) {
+        sqe->poll32_events = POLLIN | POLLRDHUP;
+        sqe->user_data = UD(fd, e->gen, UD_POLL_READ);
+    } else {
+        sqe->poll32_events = POLLOUT;
+        sqe->user_data = UD(fd, e->gen, UD_POLL_WRITE);
+    }
+
+    return 0;
+}
+
+/* submit a request that removes/cancels the one identified by target */
+static int
+_remove(struct event_base *evb, uint8_t opcode, uint64_t target)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = _sqe_get(evb);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = opcode;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = UD_INTERNAL;
+
+    return 0;
+}
+
+struct event_base *
+event_base_create(int nevent, event_cb_fn cb)
+{
+    struct event_base *evb;
+    struct io_uring_params p;
+    int ring;
+
+    ASSERT(nevent > 0);
+
+    memset(&p, 0, sizeof(p));
+    ring = (int)syscall(__NR_io_uring_setup, (unsigned)nevent, &p);
+    if (ring < 0) {
+        log_error("io_uring setup failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        log_error("io_uring on this kernel does not support timed wait");
+        close(ring);
+        return NULL;
+    }
+
+    evb = (struct event_base *)cc_zalloc(sizeof(*evb));
+    if (evb == NULL) {
+        close(ring);
+        return NULL;
+    }
+    evb->ring = ring;
+    evb->sq_ptr = MAP_FAILED;
+    evb->cq_ptr = MAP_FAILED;
+    evb->sqe = MAP_FAILED;
+
+    evb->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    evb->sq_ptr = mmap(NULL, evb->sq_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    if (evb->sq_ptr == MAP_FAILED) {
+        goto error;
+    }
+    evb->sq_khead = (unsigned *)((char *)evb->sq_ptr + p.sq_off.head);
+    evb->sq_ktail = (unsigned *)((char *)evb->sq_ptr + p.sq_off.tail);
+    evb->sq_array = (unsigned *)((char *)evb->sq_ptr + p.sq_off.array);
+    evb->sq_mask = *(unsigned *)((char *)evb->sq_ptr + p.sq_off.ring_mask);
+    evb->sq_entries = p.sq_entries;
+    evb->sq_tail = *evb->sq_ktail;
+
+    evb->sqe_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    evb->sqe = mmap(NULL, evb->sqe_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (evb->sqe == MAP_FAILED) {
+        goto error;
+    }
+
+    evb->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    evb->cq_ptr = mmap(NULL, evb->cq_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    if (evb->cq_ptr == MAP_FAILED) {
+        goto error;
+    }
+    evb->cq_khead = (unsigned *)((char *)evb->cq_ptr + p.cq_off.head);
+    evb->cq_ktail = (unsigned *)((char *)evb->cq_ptr + p.cq_off.tail);
+    evb->cq_mask = *(unsigned *)((char *)evb->cq_ptr + p.cq_off.ring_mask);
+    evb->cqe = (struct io_uring_cqe *)((char *)evb->cq_ptr + p.cq_off.cqes);
+
+    evb->fd = cc_calloc(EVENT_FD_NINIT, sizeof(struct event_fd));
+    if (evb->fd == NULL) {
+        goto error;
+    }
+    evb->nfd = EVENT_FD_NINIT;
+    evb->nevent = nevent;
+    evb->cb = cb;
+    evb->io_cb = NULL;
+    evb->batch_cb = NULL;
+    evb->batch = NULL;
+    evb->nbatch = 0;
+    evb->spin_ns = 0;
+
+    log_info("io_uring fd %d with nevent %d, sq %u cq %u", ring, nevent,
+            p.sq_entries, p.cq_entries);
+
+    return evb;
+
+error:
+    log_error("mapping io_uring fd %d failed: %s", ring, strerror(errno));
+    event_base_destroy(&evb);
+
+    return NULL;
+}
+
+void
+event_base_destroy(struct event_base **evb)
+{
+    int status;
+    struct event_base *e = *evb;
+
+    if (e == NULL) {
+        return;
+    }
+
+    ASSERT(e->ring > 0);
+
+    if (e->cq_ptr != MAP_FAILED) {
+        munmap(e->cq_ptr, e->cq_sz);
+    }
+    if (e->sqe != MAP_FAILED) {
+        munmap(e->sqe, e->sqe_sz);
+    }
+    if (e->sq_ptr != MAP_FAILED) {
+        munmap(e->sq_ptr, e->sq_sz);
+    }
+    cc_free(e->fd);
+    cc_free(e->batch);
+
+    status = close(e->ring);
+    if (status < 0) {
+        log_warn("close ring %d failed, ignored: %s", e->ring, strerror(errno));
+    }
+    e->ring = -1;
+
+    cc_free(e);
+
+    *evb = NULL;
+}
+
+void
+event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    evb->io_cb = cb;
+}
+
+static int
+_event_add(struct event_base *evb, int fd, uint32_t type, uint32_t flags,
+        void *data)
+{
+    struct event_fd *e;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd > 0);
+
+    if ((flags & EVENT_EXCLUSIVE) && (flags & EVENT_ONESHOT)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    e = _event_fd(evb, fd);
+    if (e == NULL) {
+        return -1;
+    }
+
+    /*
+     * like EEXIST on epoll, keep the existing registration; a poll still in
+     * flight after event_del_read/write is taken back
+     */
+    if (e->armed & type) {
+        e->poll |= type;
+        return 0;
+    }
+
+    e->flags[type == EVENT_READ ? 0 : 1] = flags;
+    if (_poll_add(evb, fd, e, type) < 0) {
+        return -1;
+    }
+    e->data = data;
+    e->poll |= type;
+    e->armed |= type;
+
+    return 0;
+}
+
+int
+event_add_read_flags(struct event_base *evb, int fd, void *data,
+        uint32_t flags)
+{
+    int status;
+
+    status = _event_add(evb, fd, EVENT_READ, flags, data);
+    if (status < 0) {
+        log_error("add read w/ ring %d on fd %d failed", evb->ring, fd);
+    }
+
+    INCR_SHARD(event_metrics, event_read);
+    log_verb("add read event to ring %d on fd %d, flags %"PRIx32, evb->ring,
+            fd, flags);
+
+    return status;
+}
+
+int
+event_add_write_flags(struct event_base *evb, int fd, void *data,
+        uint32_t flags)
+{
+    int status;
+
+    status = _event_add(evb, fd, EVENT_WRITE, flags, data);
+    if (status < 0) {
+        log_error("add write w/ ring %d on fd %d failed", evb->ring, fd);
+    }
+
+    INCR_SHARD(event_metrics, event_write);
+    log_verb("add write event to ring %d on fd %d, flags %"PRIx32, evb->ring,
+            fd, flags);
+
+    return status;
+}
+
+int
+event_add_read(struct event_base *evb, int fd, void *data)
+{
+    return event_add_read_flags(evb, fd, data, 0);
+}
+
+int
+event_add_write(struct event_base *evb, int fd, void *data)
+{
+    return event_add_write_flags(evb, fd, data, 0);
+}
+
+int
+event_del(struct event_base *evb, int fd)
+{
+    struct event_fd *e;
+    int status = 0;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd > 0);
+
+    if ((uint32_t)fd >= evb->nfd || (evb->fd[fd].poll | evb->fd[fd].io) == 0) {
+        log_error("del w/ ring %d on fd %d failed: not registered", evb->ring,
+                fd);
+        errno = ENOENT;
+        return -1;
+    }
+
+    e = &evb->fd[fd];
+    if (e->armed & EVENT_READ) {
+        status |= _remove(evb, IORING_OP_POLL_REMOVE,
+                UD(fd, e->gen, UD_POLL_READ));
+    }
+    if (e->armed & EVENT_WRITE) {
+        status |= _remove(evb, IORING_OP_POLL_REMOVE,
+                UD(fd, e->gen, UD_POLL_WRITE));
+    }
+    if (e->io & EVENT_READ) {
+        status |= _remove(evb, IORING_OP_ASYNC_CANCEL, UD(fd, e->gen, UD_RECV));
+    }
+    if (e->io & EVENT_WRITE) {
+        status |= _remove(evb, IORING_OP_ASYNC_CANCEL, UD(fd, e->gen, UD_SEND));
+    }
+
+    /*
+     * submit right away: the caller usually closes fd next, and in-flight
+     * requests hold a reference that keeps the socket open until removed
+     */
+    _enter(evb, 0, 0, NULL);
+
+    e->gen++;
+    e->poll = 0;
+    e->armed = 0;
+    e->io = 0;
+    e->data = NULL;
+    e->io_data[0] = e->io_data[1] = NULL;
+
+    log_verb("del fd %d from ring %d", fd, evb->ring);
+
+    return status;
+}
+
+static int
+_event_del_type(struct event_base *evb, int fd, uint32_t type)
+{
+    struct event_fd *e;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd > 0);
+
+    if ((uint32_t)fd >= evb->nfd || !(evb->fd[fd].poll & type)) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    /* the poll is dropped when it completes, see _event_complete */
+    e = &evb->fd[fd];
+    e->poll &= ~type;
+    if (e->armed & type) {
+        return _remove(evb, IORING_OP_POLL_REMOVE, UD(fd, e->gen,
+                    type == EVENT_READ ? UD_POLL_READ : UD_POLL_WRITE));
+    }
+
+    return 0;
+}
+
+int
+event_del_read(struct event_base *evb, int fd)
+{
+    return _event_del_type(evb, fd, EVENT_READ);
+}
+
+int
+event_del_write(struct event_base *evb, int fd)
+{
+    return _event_del_type(evb, fd, EVENT_WRITE);
+}
+
+void
+event_base_set_lazy(struct event_base *evb, bool lazy)
+{
+    /* submissions always wait for event_wait */
+    log_verb("lazy interest changes are always on with io_uring");
+}
+
+void
+event_base_set_spin(struct event_base *evb, uint32_t spin_us)
+{
+    ASSERT(evb != NULL);
+
+    evb->spin_ns = (uint64_t)spin_us * 1000;
+
+    log_info("spin %"PRIu32" us before waiting on ring %d", spin_us,
+            evb->ring);
+}
+
+int
+event_base_set_batch_cb(struct event_base *evb, event_batch_cb_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    if (cb != NULL && evb->batch == NULL) {
+        evb->batch = (struct event_ready *)cc_calloc(evb->nevent,
+                sizeof(*evb->batch));
+        if (evb->batch == NULL) {
+            log_error("allocate batch of %d events failed", evb->nevent);
+            return -1;
+        }
+    }
+    evb->batch_cb = cb;
+
+    log_info("batch dispatch %s on ring %d", cb != NULL ? "on" : "off",
+            evb->ring);
+
+    return 0;
+}
+
+int
+event_base_set_busy_poll(struct event_base *evb, uint32_t usec,
+        uint16_t budget, bool prefer)
+{
+    log_warn("busy poll not supported by ring %d", evb->ring);
+
+    return -1;
+}
+
+static int
+_event_io(struct event_base *evb, int fd, uint32_t type, const void *buf,
+        size_t nbyte, void *data)
+{
+    struct io_uring_sqe *sqe;
+    struct event_fd *e;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd > 0);
+    ASSERT(buf != NULL && nbyte > 0);
+
+    e = _event_fd(evb, fd);
+    if (e == NULL) {
+        return -1;
+    }
+
+    if (e->io & type) {
+        log_error("%s already in flight on fd %d", type == EVENT_READ ? "recv" :
+                "send", fd);
+        return -1;
+    }
+
+    sqe = _sqe_get(evb);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = type == EVENT_READ ? IORING_OP_RECV : IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)nbyte;
+    sqe->user_data = UD(fd, e->gen, type == EVENT_READ ? UD_RECV : UD_SEND);
+
+    e->io |= type;
+    e->io_data[type == EVENT_READ ? 0 : 1] = data;
+
+    return 0;
+}
+
+int
+event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, void *data)
+{
+    log_verb("submit recv of %zu bytes to ring %d on fd %d", nbyte, evb->ring,
+            fd);
+
+    return _event_io(evb, fd, EVENT_READ, buf, nbyte, data);
+}
+
+int
+event_send(struct event_base *evb, int fd, const void *buf, size_t nbyte,
+        void *data)
+{
+    log_verb("submit send of %zu bytes to ring %d on fd %d", nbyte, evb->ring,
+            fd);
+
+    return _event_io(evb, fd, EVENT_WRITE, buf, nbyte, data);
+}
+
+/* process one completion, return 1 if it was delivered to a callback */
+static int
+_event_complete(struct event_base *evb, uint64_t ud, int res, uint32_t flags)
+{
+    struct event_fd *e;
+    uint32_t type, events = 0;
+    int fd = UD_FD(ud);
+
+    if (UD_TAG(ud) == UD_INTERNAL || fd < 0 || (uint32_t)fd >= evb->nfd) {
+        return 0;
+    }
+
+    e = &evb->fd[fd];
+    if ((e->gen & UD_GEN_MASK) != UD_GEN(ud)) {
+        /* left over from a previous registration of fd */
+        return 0;
+    }
+
+    switch (UD_TAG(ud)) {
+    case UD_POLL_READ:
+    case UD_POLL_WRITE:
+        type = UD_TAG(ud) == UD_POLL_READ ? EVENT_READ : EVENT_WRITE;
+        if (!(e->armed & type)) {
+            return 0;
+        }
+        if (!(e->poll & type)) {
+            /* interest was dropped, this poll is done or being removed */
+            if (!(flags & IORING_CQE_F_MORE)) {
+                e->armed &= ~type;
+            }
+            return 0;
+        }
+        if (res == -ECANCELED) {
+            /* removed, then taken back before the removal completed */
+            if (_poll_add(evb, fd, e, type) < 0) {
+                e->armed &= ~type;
+            }
+            return 0;
+        }
+
+        log_verb("poll %04"PRIX32" against data %p", (uint32_t)res, e->data);
+
+        if (res < 0) {
+            /* the request is gone, and re-arming is unlikely to help */
+            log_warn("poll on fd %d failed: %s", fd, strerror(-res));
+            e->armed &= ~type;
+            events = EVENT_ERR;
+        } else {
+            if (res & (POLLERR | POLLHUP)) {
+                events |= EVENT_ERR;
+            }
+            if (res & (POLLIN | POLLRDHUP)) {
+                events |= EVENT_READ;
+            }
+            if (res & POLLOUT) {
+                events |= EVENT_WRITE;
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                if (e->flags[type == EVENT_READ ? 0 : 1] & EVENT_ONESHOT) {
+                    /* disabled until added again */
+                    e->armed &= ~type;
+                } else if (_poll_add(evb, fd, e, type) < 0) {
+                    e->armed &= ~type;
+                }
+            }
+        }
+
+        if (evb->batch_cb != NULL) {
+            /* at most nevent polls complete per wait, see event_wait */
+            ASSERT(evb->nbatch < evb->nevent);
+            evb->batch[evb->nbatch].data = e->data;
+            evb->batch[evb->nbatch].events = events;
+            evb->nbatch++;
+        } else if (evb->cb != NULL) {
+            evb->cb(e->data, events);
+        }
+
+        return 1;
+
+    case UD_RECV:
+    case UD_SEND:
+        type = UD_TAG(ud) == UD_RECV ? EVENT_READ : EVENT_WRITE;
+        if (!(e->io & type)) {
+            return 0;
+        }
+        e->io &= ~type;
+
+        log_verb("%s on fd %d completed: %d", type == EVENT_READ ? "recv" :
+                "send", fd, res);
+
+        if (evb->io_cb != NULL) {
+            evb->io_cb(e->io_data[type == EVENT_READ ? 0 : 1], type, res);
+        }
+
+        return 1;
+
+    default:
+        NOT_REACHED();
+        return 0;
+    }
+}
+
+/*
+ * set ts to what is left of a timeout (in millisecond) started at d, returns
+ * false if nothing is left
+ */
+static bool
+_wait_remaining(struct __kernel_timespec *ts, struct duration *d, int timeout)
+{
+    struct duration s;
+    double ns;
+
+    duration_snapshot(&s, d);
+    ns = (double)timeout * 1e6 - duration_ns(&s);
+    if (ns < 1) {
+        return false;
+    }
+
+    ts->tv_sec = (long long)(ns / 1e9);
+    ts->tv_nsec = (long long)ns % 1000000000;
+
+    return true;
+}
+
+/*
+ * submit queued requests and wait up to timeout (in millisecond) for events
+ */
+int
+event_wait(struct event_base *evb, int timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts, zero = { 0, 0 };
+    struct io_uring_cqe *cqe;
+    struct duration d, spin, wait;
+    bool spinning;
+    unsigned head;
+    int status, err;
+
+    ASSERT(evb != NULL);
+    ASSERT(evb->ring > 0);
+    ASSERT(evb->nevent > 0);
+
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    if (timeout > 0) {
+        duration_start(&wait);
+    }
+    spinning = event_spin_begin(&spin, evb->spin_ns, timeout);
+
+    for (;;) {
+        int nreturned = 0;
+
+        if (spinning) {
+            arg.ts = (uint64_t)(uintptr_t)&zero;
+        }
+
+        PROBE2(event_wait_enter, evb, spinning ? 0 : timeout);
+        TRACE_BEGIN(TRACE_EVENT_WAIT);
+        status = _enter(evb, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg);
+        err = errno;
+        TRACE_END(TRACE_EVENT_WAIT);
+        PROBE2(event_wait_exit, evb, status);
+        INCR_SHARD(event_metrics, event_loop);
+        timer_cache_update(); /* one clock read per wakeup */
+        if (status < 0 && err != ETIME && err != EINTR && err != EBUSY) {
+            log_error("wait on ring %d with nevent %d and timeout %d failed: "
+                    "%s", evb->ring, evb->nevent, timeout, strerror(err));
+            return -1;
+        }
+
+        EVENT_DISPATCH_BEGIN(&d);
+        head = *evb->cq_khead;
+        while (nreturned < evb->nevent &&
+                head != __atomic_load_n(evb->cq_ktail, __ATOMIC_ACQUIRE)) {
+            uint64_t ud;
+            uint32_t flags;
+            int res;
+
+            cqe = &evb->cqe[head & evb->cq_mask];
+            ud = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+            /* release the slot before callbacks queue more requests */
+            __atomic_store_n(evb->cq_khead, ++head, __ATOMIC_RELEASE);
+
+            nreturned += _event_complete(evb, ud, res, flags);
+        }
+        if (evb->nbatch > 0) {
+            event_batch_dispatch(evb->batch_cb, evb->batch, evb->nbatch);
+            evb->nbatch = 0;
+        }
+        EVENT_DISPATCH_END(&d);
+
+        if (nreturned > 0) {
+            INCR_N_SHARD(event_metrics, event_total, nreturned);
+            if (spinning) {
+                INCR_SHARD(event_metrics, event_spin_hit);
+            }
+            log_verb("returned %d events from ring %d", nreturned, evb->ring);
+
+            return nreturned;
+        }
+
+        if (spinning) {
+            int left = timeout;
+
+            spinning = event_spin(&spin, evb->spin_ns, &left);
+            if (spinning) {
+                continue;
+            }
+            arg.ts = timeout >= 0 ? (uint64_t)(uintptr_t)&ts : 0;
+        } else if (status < 0 && err == ETIME) {
+            timeout = 0; /* the kernel saw it expire */
+        }
+
+        /**
+         * Nothing for the caller yet: done spinning, woken up by internal
+         * completions only, or by a signal. Wait again with whatever is left
+         * of the timeout, as epoll_wait would not have returned for these.
+         */
+        if (timeout == -1 || (timeout > 0 &&
+                _wait_remaining(&ts, &wait, timeout))) {
+            continue;
+        }
+
+        log_vverb("wait on ring %d with nevent %d timeout %d returned no "
+                "events", evb->ring, evb->nevent, timeout);
+
+        return 0;
+    }
+
+    NOT_REACHED();
+}
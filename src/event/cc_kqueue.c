@@ -20,6 +20,9 @@
 #include <cc_debug.h>
 #include <cc_define.h>
 #include <cc_mm.h>
+#include <cc_probe.h>
+#include <cc_trace.h>
+#include <time/cc_timer.h>
 
 #include <inttypes.h>
 #include <string.h>
@@ -41,6 +44,11 @@ struct event_base {
     int           nprocessed;   /* # events processed from event[] */
 
     event_cb_fn    cb;           /* event callback */
+    event_batch_cb_fn batch_cb;  /* see event_base_set_batch_cb */
+    struct event_ready *batch;  /* batch[] - translated events, nevent */
+
+    bool          lazy;         /* see event_base_set_lazy */
+    uint64_t      spin_ns;      /* see event_base_set_spin */
 };
 
 struct event_base *
@@ -99,6 +107,10 @@ event_base_create(int nevent, event_cb_fn cb)
     evb->nreturned = 0;
     evb->nprocessed = 0;
     evb->cb = cb;
+    evb->batch_cb = NULL;
+    evb->batch = NULL;
+    evb->lazy = false;
+    evb->spin_ns = 0;
 
     log_info("kqueue fd %d with nevent %d", evb->kq, evb->nevent);
 
@@ -121,6 +133,7 @@ event_base_destroy(struct event_base **evb)
 
     cc_free(e->change);
     cc_free(e->event);
+    cc_free(e->batch);
 
     status = close(e->kq);
     if (status < 0) {
@@ -133,6 +146,27 @@ event_base_destroy(struct event_base **evb)
     *evb = NULL;
 }
 
+/* submit change[] without waiting for events */
+static void
+_event_flush(struct event_base *evb)
+{
+    if (evb->nchange == 0) {
+        return;
+    }
+
+    /* e.g. ENOENT when deleting a filter that was never added */
+    if (kevent(evb->kq, evb->change, evb->nchange, NULL, 0, NULL) < 0) {
+        log_verb("kevent changes on kqueue fd %d failed: %s", evb->kq,
+                strerror(errno));
+    }
+    INCR_N_SHARD(event_metrics, event_change, evb->nchange);
+    evb->nchange = 0;
+}
+
+/*
+ * queue a change, which is submitted right away unless the base is lazy, in
+ * which case it goes with the kevent call in event_wait
+ */
 static void
 _event_update(struct event_base *evb, int fd, uint16_t flags, uint32_t fflags,
         void *data)
@@ -141,36 +175,136 @@ _event_update(struct event_base *evb, int fd, uint16_t flags, uint32_t fflags,
 
     ASSERT(evb != NULL && evb->kq > 0);
     ASSERT(fd > 0);
-    ASSERT(evb->nchange < evb->nevent);
+
+    if (evb->nchange == evb->nevent) {
+        _event_flush(evb);
+    }
 
     event = &evb->change[evb->nchange++];
     EV_SET(event, fd, flags, fflags, 0, 0, data);
-    kevent(evb->kq, evb->change, evb->nchange, NULL, 0, NULL);
-    evb->nchange = 0;
+    if (!evb->lazy) {
+        _event_flush(evb);
+    }
+}
+
+void
+event_base_set_lazy(struct event_base *evb, bool lazy)
+{
+    ASSERT(evb != NULL);
+
+    if (evb->lazy && !lazy) {
+        _event_flush(evb);
+    }
+    evb->lazy = lazy;
+
+    log_info("lazy interest changes %s on kqueue fd %d", lazy ? "on" : "off",
+            evb->kq);
+}
+
+void
+event_base_set_spin(struct event_base *evb, uint32_t spin_us)
+{
+    ASSERT(evb != NULL);
+
+    evb->spin_ns = (uint64_t)spin_us * 1000;
+
+    log_info("spin %"PRIu32" us before waiting on kqueue fd %d", spin_us,
+            evb->kq);
 }
 
 int
-event_add_read(struct event_base *evb, int fd, void *data)
+event_base_set_batch_cb(struct event_base *evb, event_batch_cb_fn cb)
 {
-    _event_update(evb, fd, EVFILT_READ, EV_ADD, data);
-    INCR(event_metrics, event_read);
+    ASSERT(evb != NULL);
+
+    if (cb != NULL && evb->batch == NULL) {
+        evb->batch = (struct event_ready *)cc_calloc(evb->nevent,
+                sizeof(*evb->batch));
+        if (evb->batch == NULL) {
+            log_error("allocate batch of %d events failed", evb->nevent);
+            return -1;
+        }
+    }
+    evb->batch_cb = cb;
 
-    log_verb("adding read event to fd %d", fd);
+    log_info("batch dispatch %s on kqueue fd %d", cb != NULL ? "on" : "off",
+            evb->kq);
 
     return 0;
 }
 
 int
-event_add_write(struct event_base *evb, int fd, void *data)
+event_base_set_busy_poll(struct event_base *evb, uint32_t usec,
+        uint16_t budget, bool prefer)
+{
+    log_warn("busy poll not supported by kqueue fd %d", evb->kq);
+
+    return -1;
+}
+
+static uint16_t
+_event_flags(uint32_t flags)
+{
+    /* EV_ENABLE re-arms a fd registered with EV_DISPATCH */
+    uint16_t kflags = EV_ADD | EV_ENABLE;
+
+    if (flags & EVENT_EDGE) {
+        kflags |= EV_CLEAR;
+    }
+    if (flags & EVENT_ONESHOT) {
+        kflags |= EV_DISPATCH;
+    }
+    /* EVENT_EXCLUSIVE has no kqueue equivalent */
+
+    return kflags;
+}
+
+int
+event_add_read_flags(struct event_base *evb, int fd, void *data,
+        uint32_t flags)
 {
-    _event_update(evb, fd, EVFILT_WRITE, EV_ADD, data);
-    INCR(event_metrics, event_write);
+    if ((flags & EVENT_EXCLUSIVE) && (flags & EVENT_ONESHOT)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    _event_update(evb, fd, EVFILT_READ, _event_flags(flags), data);
+    INCR_SHARD(event_metrics, event_read);
 
-    log_verb("adding read event to fd %d", fd);
+    log_verb("adding read event to fd %d, flags %"PRIx32, fd, flags);
 
     return 0;
 }
 
+int
+event_add_write_flags(struct event_base *evb, int fd, void *data,
+        uint32_t flags)
+{
+    if ((flags & EVENT_EXCLUSIVE) && (flags & EVENT_ONESHOT)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    _event_update(evb, fd, EVFILT_WRITE, _event_flags(flags), data);
+    INCR_SHARD(event_metrics, event_write);
+
+    log_verb("adding write event to fd %d, flags %"PRIx32, fd, flags);
+
+    return 0;
+}
+
+int
+event_add_read(struct event_base *evb, int fd, void *data)
+{
+    return event_add_read_flags(evb, fd, data, 0);
+}
+
+int
+event_add_write(struct event_base *evb, int fd, void *data)
+{
+    return event_add_write_flags(evb, fd, data, 0);
+}
+
 int
 event_del(struct event_base *evb, int fd)
 {
@@ -180,11 +314,53 @@ event_del(struct event_base *evb, int fd)
     return 0;
 }
 
+int
+event_del_read(struct event_base *evb, int fd)
+{
+    _event_update(evb, fd, EVFILT_READ, EV_DELETE, NULL);
+
+    return 0;
+}
+
+int
+event_del_write(struct event_base *evb, int fd)
+{
+    _event_update(evb, fd, EVFILT_WRITE, EV_DELETE, NULL);
+
+    return 0;
+}
+
+void
+event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb)
+{
+    log_warn("I/O completion callback is ignored by kqueue");
+}
+
+int
+event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, void *data)
+{
+    log_error("completion-based recv is not supported by kqueue");
+
+    return -1;
+}
+
+int
+event_send(struct event_base *evb, int fd, const void *buf, size_t nbyte,
+        void *data)
+{
+    log_error("completion-based send is not supported by kqueue");
+
+    return -1;
+}
+
 int
 event_wait(struct event_base *evb, int timeout)
 {
     int kq;
-    struct timespec ts, *tsp;
+    struct timespec ts, *tsp, zero = { 0, 0 };
+    struct duration d, spin;
+    bool spinning;
+    int nbatch;
 
     ASSERT(evb != NULL);
 
@@ -201,6 +377,8 @@ event_wait(struct event_base *evb, int timeout)
         tsp->tv_nsec = (timeout % 1000LL) * 1000000LL;
     }
 
+    spinning = event_spin_begin(&spin, evb->spin_ns, timeout);
+
     for (;;) {
         /*
          * kevent() is used both to register new events with kqueue, and to
@@ -215,12 +393,23 @@ event_wait(struct event_base *evb, int timeout)
          * by a (kq, ident, filter) tuple. This means that there can be only
          * one (ident, filter) pair for a given kqueue.
          */
+        PROBE2(event_wait_enter, evb, spinning ? 0 : timeout);
+        TRACE_BEGIN(TRACE_EVENT_WAIT);
         evb->nreturned = kevent(kq, evb->change, evb->nchange, evb->event,
-                                evb->nevent, tsp);
-        INCR(event_metrics, event_loop);
+                                evb->nevent, spinning ? &zero : tsp);
+        TRACE_END_N(TRACE_EVENT_WAIT, evb->nreturned > 0 ? evb->nreturned : 0);
+        PROBE2(event_wait_exit, evb, evb->nreturned);
+        INCR_SHARD(event_metrics, event_loop);
+        INCR_N_SHARD(event_metrics, event_change, evb->nchange);
+        timer_cache_update(); /* one clock read per wakeup */
         evb->nchange = 0;
         if (evb->nreturned > 0) {
-            INCR_N(event_metrics, event_total, evb->nreturned);
+            INCR_N_SHARD(event_metrics, event_total, evb->nreturned);
+            if (spinning) {
+                INCR_SHARD(event_metrics, event_spin_hit);
+            }
+            EVENT_DISPATCH_BEGIN(&d);
+            nbatch = 0;
             for (evb->nprocessed = 0; evb->nprocessed < evb->nreturned;
                 evb->nprocessed++) {
                 struct kevent *ev = &evb->event[evb->nprocessed];
@@ -263,16 +452,44 @@ event_wait(struct event_base *evb, int timeout)
                     events |= EVENT_WRITE;
                 }
 
-                if (evb->cb != NULL && events != 0) {
+                if (events == 0) {
+                    continue;
+                }
+
+                if (evb->batch_cb != NULL) {
+                    evb->batch[nbatch].data = ev->udata;
+                    evb->batch[nbatch].events = events;
+                    nbatch++;
+                    continue;
+                }
+
+                if (evb->nprocessed + EVENT_PREFETCH < evb->nreturned) {
+                    __builtin_prefetch(
+                            evb->event[evb->nprocessed + EVENT_PREFETCH].udata);
+                }
+                if (evb->cb != NULL) {
                     evb->cb(ev->udata, events);
                 }
             }
+            if (evb->batch_cb != NULL && nbatch > 0) {
+                event_batch_dispatch(evb->batch_cb, evb->batch, nbatch);
+            }
+            EVENT_DISPATCH_END(&d);
 
             log_verb("returned %d events from kqueue fd %d", evb->nreturned, kq);
 
             return evb->nreturned;
         }
 
+        if (evb->nreturned == 0 && spinning) {
+            spinning = event_spin(&spin, evb->spin_ns, &timeout);
+            if (!spinning && tsp != NULL) {
+                tsp->tv_sec = timeout / 1000LL;
+                tsp->tv_nsec = (timeout % 1000LL) * 1000000LL;
+            }
+            continue;
+        }
+
         if (evb->nreturned == 0) {
             if (timeout == -1) {
                log_error("indefinite wait on kqueue fd %d with %d events "
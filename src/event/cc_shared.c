@@ -21,6 +21,7 @@
 
 static bool event_init = false;
 event_metrics_st *event_metrics = NULL;
+METRIC_SHARD_DECLARE(event_metrics);
 
 void
 event_setup(event_metrics_st *metrics)
@@ -43,6 +44,34 @@ event_teardown(void)
     if (!event_init) {
         log_warn("%s has never been setup", EVENT_MODULE_NAME);
     }
+    metric_shard_release((struct metric *)event_metrics,
+            METRIC_CARDINALITY(*event_metrics));
     event_metrics = NULL;
     event_init = false;
 }
+
+/*
+ * true while the spin budget lasts (and timeout has not passed), otherwise
+ * false with timeout reduced by the time already spent spinning
+ */
+bool
+event_spin(struct duration *d, uint64_t spin_ns, int *timeout)
+{
+    struct duration s;
+    double ns;
+    int ms;
+
+    duration_snapshot(&s, d);
+    ns = duration_ns(&s);
+    if (ns < spin_ns && (*timeout < 0 || ns < *timeout * 1e6)) {
+        return true;
+    }
+
+    INCR_SHARD(event_metrics, event_spin_sleep);
+    if (*timeout > 0) {
+        ms = (int)(ns / 1e6);
+        *timeout = ms < *timeout ? *timeout - ms : 0;
+    }
+
+    return false;
+}
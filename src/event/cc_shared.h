@@ -23,12 +23,59 @@ extern "C" {
 #endif
 
 #include <cc_event.h>
+#include <time/cc_timer.h>
 
 #include <stdbool.h>
 
 #define EVENT_MODULE_NAME "ccommon::event"
 
 extern event_metrics_st *event_metrics;
+extern METRIC_SHARD_DECLARE(event_metrics);
+
+/* time spent in callbacks for one wakeup, only measured with metrics on */
+#define EVENT_DISPATCH_BEGIN(_d) do {                               \
+    if (event_metrics != NULL) {                                    \
+        duration_start(_d);                                         \
+    }                                                               \
+} while (0)
+
+#define EVENT_DISPATCH_END(_d) do {                                 \
+    if (event_metrics != NULL) {                                    \
+        duration_stop(_d);                                          \
+        DURATION_RECORD(event_metrics, event_dispatch_ns, _d);      \
+    }                                                               \
+} while (0)
+
+/* batch dispatch, see event_base_set_batch_cb */
+static inline void
+event_batch_dispatch(event_batch_cb_fn cb, struct event_ready *batch, int nbatch)
+{
+    int i;
+
+    for (i = 0; i < nbatch && i < EVENT_PREFETCH; i++) {
+        event_prefetch(&batch[i]);
+    }
+    cb(batch, nbatch);
+}
+
+/*
+ * spinning before blocking, see event_base_set_spin: a wait with a non-zero
+ * timeout first polls with a zero timeout, and calls event_spin each time
+ * that found nothing to decide whether to poll again
+ */
+static inline bool
+event_spin_begin(struct duration *d, uint64_t spin_ns, int timeout)
+{
+    if (spin_ns == 0 || timeout == 0) {
+        return false;
+    }
+
+    duration_start(d);
+
+    return true;
+}
+
+bool event_spin(struct duration *d, uint64_t spin_ns, int *timeout);
 
 #ifdef __cplusplus
 }
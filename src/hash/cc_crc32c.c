@@ -0,0 +1,235 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), using the crc32
+ * instructions of SSE4.2 on x86-64 or of the ARMv8 CRC extension on aarch64
+ * when the CPU supports them, and a lookup table otherwise.
+ */
+
+#include <hash/cc_hash.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78U
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static crc32c_fn crc32c_impl;
+static bool crc32c_hw = false;
+static uint32_t crc32c_table[256];
+
+static uint32_t
+_crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    for (; len > 0; len--, p++) {
+        crc = crc32c_table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+_crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t crc64 = crc, v;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; len--, p++) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+
+    return crc;
+}
+
+/* lanes advance 8 bytes at a time in lockstep, while they all have them */
+__attribute__((target("sse4.2")))
+static void
+_crc32c_hw_lanes(uint32_t *crc, const uint8_t **p, const size_t *len)
+{
+    uint64_t c[HASH_BATCH_LANES], v;
+    size_t off, m = len[0];
+    int j;
+
+    for (j = 1; j < HASH_BATCH_LANES; j++) {
+        m = len[j] < m ? len[j] : m;
+    }
+    m &= ~(size_t)7;
+
+    for (j = 0; j < HASH_BATCH_LANES; j++) {
+        c[j] = crc[j];
+    }
+    for (off = 0; off < m; off += 8) {
+        for (j = 0; j < HASH_BATCH_LANES; j++) {
+            memcpy(&v, p[j] + off, sizeof(v));
+            c[j] = _mm_crc32_u64(c[j], v);
+        }
+    }
+    for (j = 0; j < HASH_BATCH_LANES; j++) {
+        crc[j] = _crc32c_hw((uint32_t)c[j], p[j] + m, len[j] - m);
+    }
+}
+
+static bool
+_crc32c_hw_supported(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && defined(__linux__)
+__attribute__((target("+crc")))
+static uint32_t
+_crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t v;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+    }
+    for (; len > 0; len--, p++) {
+        crc = __crc32cb(crc, *p);
+    }
+
+    return crc;
+}
+
+/* lanes advance 8 bytes at a time in lockstep, while they all have them */
+__attribute__((target("+crc")))
+static void
+_crc32c_hw_lanes(uint32_t *crc, const uint8_t **p, const size_t *len)
+{
+    uint64_t v;
+    size_t off, m = len[0];
+    int j;
+
+    for (j = 1; j < HASH_BATCH_LANES; j++) {
+        m = len[j] < m ? len[j] : m;
+    }
+    m &= ~(size_t)7;
+
+    for (off = 0; off < m; off += 8) {
+        for (j = 0; j < HASH_BATCH_LANES; j++) {
+            memcpy(&v, p[j] + off, sizeof(v));
+            crc[j] = __crc32cd(crc[j], v);
+        }
+    }
+    for (j = 0; j < HASH_BATCH_LANES; j++) {
+        crc[j] = _crc32c_hw(crc[j], p[j] + m, len[j] - m);
+    }
+}
+
+static bool
+_crc32c_hw_supported(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+#define _crc32c_hw _crc32c_sw
+
+static void
+_crc32c_hw_lanes(uint32_t *crc, const uint8_t **p, const size_t *len)
+{
+    int j;
+
+    for (j = 0; j < HASH_BATCH_LANES; j++) {
+        crc[j] = _crc32c_sw(crc[j], p[j], len[j]);
+    }
+}
+
+static bool
+_crc32c_hw_supported(void)
+{
+    return false;
+}
+#endif
+
+static void
+_crc32c_init(void)
+{
+    uint32_t i, j, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc32c_table[i] = crc;
+    }
+
+    crc32c_hw = _crc32c_hw_supported();
+    crc32c_impl = crc32c_hw ? _crc32c_hw : _crc32c_sw;
+}
+
+uint64_t
+hash_crc32c(const void *key, size_t len, uint64_t seed)
+{
+    pthread_once(&crc32c_once, _crc32c_init);
+
+    return ~crc32c_impl(~(uint32_t)seed, key, len);
+}
+
+bool
+hash_crc32c_hw(void)
+{
+    pthread_once(&crc32c_once, _crc32c_init);
+
+    return crc32c_hw;
+}
+
+void
+hash_crc32c_batch(const void *const *keys, const size_t *lens, size_t n,
+        uint64_t seed, uint64_t *out)
+{
+    uint32_t crc[HASH_BATCH_LANES];
+    size_t i;
+    int j;
+
+    pthread_once(&crc32c_once, _crc32c_init);
+
+    i = 0;
+    if (crc32c_hw) {
+        for (; i + HASH_BATCH_LANES <= n; i += HASH_BATCH_LANES) {
+            for (j = 0; j < HASH_BATCH_LANES; j++) {
+                crc[j] = ~(uint32_t)seed;
+            }
+            _crc32c_hw_lanes(crc, (const uint8_t **)(keys + i), lens + i);
+            for (j = 0; j < HASH_BATCH_LANES; j++) {
+                out[i + j] = ~crc[j];
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        out[i] = ~crc32c_impl(~(uint32_t)seed, keys[i], lens[i]);
+    }
+}
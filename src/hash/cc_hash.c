@@ -0,0 +1,105 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <hash/cc_hash.h>
+
+#include <hash/cc_murmur3.h>
+
+#include <string.h>
+
+static const hash_fn hash_fns[HASH_SENTINEL] = {
+    hash_murmur3_64,
+    hash_xxh64,
+    hash_wyhash,
+    hash_crc32c,
+};
+
+static const char *hash_names[HASH_SENTINEL] = {
+    "murmur3",
+    "xxh64",
+    "wyhash",
+    "crc32c",
+};
+
+uint64_t
+hash_murmur3_64(const void *key, size_t len, uint64_t seed)
+{
+    uint64_t out[2];
+
+    hash_murmur3_128_x64(key, (int)len, (uint32_t)seed, out);
+
+    return out[0];
+}
+
+hash_fn
+hash_get(hash_type_e type)
+{
+    if (type < 0 || type >= HASH_SENTINEL) {
+        return NULL;
+    }
+
+    return hash_fns[type];
+}
+
+hash_type_e
+hash_type(const char *name)
+{
+    int i;
+
+    for (i = 0; i < HASH_SENTINEL; i++) {
+        if (strcmp(name, hash_names[i]) == 0) {
+            return (hash_type_e)i;
+        }
+    }
+
+    return HASH_SENTINEL;
+}
+
+const char *
+hash_name(hash_type_e type)
+{
+    if (type < 0 || type >= HASH_SENTINEL) {
+        return NULL;
+    }
+
+    return hash_names[type];
+}
+
+void
+hash_batch(hash_type_e type, const void *const *keys, const size_t *lens,
+        size_t n, uint64_t seed, uint64_t *out)
+{
+    hash_fn fn;
+    size_t i;
+
+    switch (type) {
+    case HASH_WYHASH:
+        hash_wyhash_batch(keys, lens, n, seed, out);
+        return;
+
+    case HASH_CRC32C:
+        hash_crc32c_batch(keys, lens, n, seed, out);
+        return;
+
+    default:
+        fn = hash_get(type);
+        for (i = 0; fn != NULL && i < n; i++) {
+            out[i] = fn(keys[i], lens[i], seed);
+        }
+        return;
+    }
+}
@@ -23,6 +23,8 @@
 
 #include "hash/cc_murmur3.h"
 
+#include <string.h>
+
 #define	FORCE_INLINE inline __attribute__((always_inline))
 
 static inline uint32_t rotl32 ( uint32_t x, int8_t r )
@@ -326,3 +328,264 @@ void hash_murmur3_128_x64 ( const void * key, const int len,
 //-----------------------------------------------------------------------------
 
 
+// Streaming variants - keys fed in pieces through _update give the same
+// digests as the one-shot functions above given the concatenation
+
+static FORCE_INLINE uint32_t loadblock32 ( const uint8_t * p )
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static FORCE_INLINE uint64_t loadblock64 ( const uint8_t * p )
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// little-endian word from a zero-padded tail, as the tail switches read it
+
+static FORCE_INLINE uint64_t loadtail ( const uint8_t * p, int n )
+{
+  uint64_t v = 0;
+  for(int i = n - 1; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+
+//-----------------------------------------------------------------------------
+
+static FORCE_INLINE void block_32 ( uint32_t * h, const uint8_t * p )
+{
+  const uint32_t c1 = 0xcc9e2d51;
+  const uint32_t c2 = 0x1b873593;
+
+  uint32_t k1 = loadblock32(p);
+  uint32_t h1 = h[0];
+
+  k1 *= c1;
+  k1 = ROTL32(k1,15);
+  k1 *= c2;
+
+  h1 ^= k1;
+  h1 = ROTL32(h1,13);
+  h1 = h1*5+0xe6546b64;
+
+  h[0] = h1;
+}
+
+static FORCE_INLINE void block_128_x86 ( uint32_t * h, const uint8_t * p )
+{
+  const uint32_t c1 = 0x239b961b;
+  const uint32_t c2 = 0xab0e9789;
+  const uint32_t c3 = 0x38b34ae5;
+  const uint32_t c4 = 0xa1e38b93;
+
+  uint32_t h1 = h[0], h2 = h[1], h3 = h[2], h4 = h[3];
+  uint32_t k1 = loadblock32(p + 0);
+  uint32_t k2 = loadblock32(p + 4);
+  uint32_t k3 = loadblock32(p + 8);
+  uint32_t k4 = loadblock32(p + 12);
+
+  k1 *= c1; k1  = ROTL32(k1,15); k1 *= c2; h1 ^= k1;
+
+  h1 = ROTL32(h1,19); h1 += h2; h1 = h1*5+0x561ccd1b;
+
+  k2 *= c2; k2  = ROTL32(k2,16); k2 *= c3; h2 ^= k2;
+
+  h2 = ROTL32(h2,17); h2 += h3; h2 = h2*5+0x0bcaa747;
+
+  k3 *= c3; k3  = ROTL32(k3,17); k3 *= c4; h3 ^= k3;
+
+  h3 = ROTL32(h3,15); h3 += h4; h3 = h3*5+0x96cd1c35;
+
+  k4 *= c4; k4  = ROTL32(k4,18); k4 *= c1; h4 ^= k4;
+
+  h4 = ROTL32(h4,13); h4 += h1; h4 = h4*5+0x32ac3b17;
+
+  h[0] = h1; h[1] = h2; h[2] = h3; h[3] = h4;
+}
+
+static FORCE_INLINE void block_128_x64 ( uint64_t * h, const uint8_t * p )
+{
+  const uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+  const uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+  uint64_t h1 = h[0], h2 = h[1];
+  uint64_t k1 = loadblock64(p + 0);
+  uint64_t k2 = loadblock64(p + 8);
+
+  k1 *= c1; k1  = ROTL64(k1,31); k1 *= c2; h1 ^= k1;
+
+  h1 = ROTL64(h1,27); h1 += h2; h1 = h1*5+0x52dce729;
+
+  k2 *= c2; k2  = ROTL64(k2,33); k2 *= c1; h2 ^= k2;
+
+  h2 = ROTL64(h2,31); h2 += h1; h2 = h2*5+0x38495ab5;
+
+  h[0] = h1; h[1] = h2;
+}
+
+//-----------------------------------------------------------------------------
+// Buffer the partial block left from earlier updates, then run whole blocks
+// straight from the key
+
+#define MURMUR3_UPDATE(st, key, len, nblock, block) do {                  \
+  const uint8_t * p = (const uint8_t*)(key);                              \
+  size_t n = (len);                                                       \
+  (st)->len += n;                                                         \
+  if((st)->ntail > 0)                                                     \
+  {                                                                       \
+    size_t fill = nblock - (st)->ntail;                                   \
+    if(fill > n) fill = n;                                                \
+    memcpy((st)->tail + (st)->ntail, p, fill);                            \
+    (st)->ntail += fill; p += fill; n -= fill;                            \
+    if((st)->ntail < nblock) break;                                       \
+    block((st)->h, (st)->tail);                                           \
+    (st)->ntail = 0;                                                      \
+  }                                                                       \
+  for(; n >= nblock; n -= nblock, p += nblock) block((st)->h, p);         \
+  memcpy((st)->tail, p, n);                                               \
+  (st)->ntail = n;                                                        \
+} while (0)
+
+void hash_murmur3_32_init ( struct murmur3_32_state * st, uint32_t seed )
+{
+  st->h[0] = seed;
+  st->len = 0;
+  st->ntail = 0;
+}
+
+void hash_murmur3_32_update ( struct murmur3_32_state * st,
+                              const void * key, size_t len )
+{
+  MURMUR3_UPDATE(st, key, len, 4, block_32);
+}
+
+void hash_murmur3_32_final ( struct murmur3_32_state * st, void * out )
+{
+  const uint32_t c1 = 0xcc9e2d51;
+  const uint32_t c2 = 0x1b873593;
+
+  uint32_t h1 = st->h[0];
+  uint32_t k1 = (uint32_t)loadtail(st->tail, st->ntail);
+
+  if(st->ntail > 0)
+  {
+    k1 *= c1; k1 = ROTL32(k1,15); k1 *= c2; h1 ^= k1;
+  }
+
+  h1 ^= (uint32_t)st->len;
+
+  h1 = fmix32(h1);
+
+  *(uint32_t*)out = h1;
+}
+
+//-----------------------------------------------------------------------------
+
+void hash_murmur3_128_x86_init ( struct murmur3_128_x86_state * st,
+                                 uint32_t seed )
+{
+  st->h[0] = st->h[1] = st->h[2] = st->h[3] = seed;
+  st->len = 0;
+  st->ntail = 0;
+}
+
+void hash_murmur3_128_x86_update ( struct murmur3_128_x86_state * st,
+                                   const void * key, size_t len )
+{
+  MURMUR3_UPDATE(st, key, len, 16, block_128_x86);
+}
+
+void hash_murmur3_128_x86_final ( struct murmur3_128_x86_state * st,
+                                  void * out )
+{
+  const uint32_t c1 = 0x239b961b;
+  const uint32_t c2 = 0xab0e9789;
+  const uint32_t c3 = 0x38b34ae5;
+  const uint32_t c4 = 0xa1e38b93;
+
+  uint32_t h1 = st->h[0], h2 = st->h[1], h3 = st->h[2], h4 = st->h[3];
+  uint32_t len = (uint32_t)st->len;
+  int n = st->ntail;
+
+  uint32_t k1 = 0, k2 = 0, k3 = 0, k4 = 0;
+
+  if(n > 0)  k1 = (uint32_t)loadtail(st->tail + 0, n > 4 ? 4 : n);
+  if(n > 4)  k2 = (uint32_t)loadtail(st->tail + 4, n > 8 ? 4 : n - 4);
+  if(n > 8)  k3 = (uint32_t)loadtail(st->tail + 8, n > 12 ? 4 : n - 8);
+  if(n > 12) k4 = (uint32_t)loadtail(st->tail + 12, n - 12);
+
+  if(n > 12) { k4 *= c4; k4  = ROTL32(k4,18); k4 *= c1; h4 ^= k4; }
+  if(n > 8)  { k3 *= c3; k3  = ROTL32(k3,17); k3 *= c4; h3 ^= k3; }
+  if(n > 4)  { k2 *= c2; k2  = ROTL32(k2,16); k2 *= c3; h2 ^= k2; }
+  if(n > 0)  { k1 *= c1; k1  = ROTL32(k1,15); k1 *= c2; h1 ^= k1; }
+
+  h1 ^= len; h2 ^= len; h3 ^= len; h4 ^= len;
+
+  h1 += h2; h1 += h3; h1 += h4;
+  h2 += h1; h3 += h1; h4 += h1;
+
+  h1 = fmix32(h1);
+  h2 = fmix32(h2);
+  h3 = fmix32(h3);
+  h4 = fmix32(h4);
+
+  h1 += h2; h1 += h3; h1 += h4;
+  h2 += h1; h3 += h1; h4 += h1;
+
+  ((uint32_t*)out)[0] = h1;
+  ((uint32_t*)out)[1] = h2;
+  ((uint32_t*)out)[2] = h3;
+  ((uint32_t*)out)[3] = h4;
+}
+
+//-----------------------------------------------------------------------------
+
+void hash_murmur3_128_x64_init ( struct murmur3_128_x64_state * st,
+                                 uint32_t seed )
+{
+  st->h[0] = st->h[1] = seed;
+  st->len = 0;
+  st->ntail = 0;
+}
+
+void hash_murmur3_128_x64_update ( struct murmur3_128_x64_state * st,
+                                   const void * key, size_t len )
+{
+  MURMUR3_UPDATE(st, key, len, 16, block_128_x64);
+}
+
+void hash_murmur3_128_x64_final ( struct murmur3_128_x64_state * st,
+                                  void * out )
+{
+  const uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+  const uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+  uint64_t h1 = st->h[0], h2 = st->h[1];
+  int n = st->ntail;
+
+  uint64_t k1 = loadtail(st->tail + 0, n > 8 ? 8 : n);
+  uint64_t k2 = n > 8 ? loadtail(st->tail + 8, n - 8) : 0;
+
+  if(n > 8) { k2 *= c2; k2  = ROTL64(k2,33); k2 *= c1; h2 ^= k2; }
+  if(n > 0) { k1 *= c1; k1  = ROTL64(k1,31); k1 *= c2; h1 ^= k1; }
+
+  h1 ^= st->len; h2 ^= st->len;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  ((uint64_t*)out)[0] = h1;
+  ((uint64_t*)out)[1] = h2;
+}
+
+//-----------------------------------------------------------------------------
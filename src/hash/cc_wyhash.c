@@ -0,0 +1,175 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * wyhash final version 4 with the default secret, following the reference
+ * implementation by Wang Yi: https://github.com/wangyi-fudan/wyhash
+ */
+
+#include <hash/cc_hash.h>
+
+#include <string.h>
+
+static const uint64_t wyp[4] = {
+    0x2d358dccaa6c78a5ULL,
+    0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL,
+    0x4d5a2da51de1aa47ULL,
+};
+
+static inline void
+_wymum(uint64_t *a, uint64_t *b)
+{
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+_wymix(uint64_t a, uint64_t b)
+{
+    _wymum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t
+_wyr8(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t
+_wyr4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t
+_wyr3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+/* the two words a key of at most 16 bytes is mixed from */
+static inline void
+_wyshort(const uint8_t *p, size_t len, uint64_t *a, uint64_t *b)
+{
+    if (len >= 4) {
+        *a = (_wyr4(p) << 32) | _wyr4(p + ((len >> 3) << 2));
+        *b = (_wyr4(p + len - 4) << 32) |
+             _wyr4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+        *a = _wyr3(p, len);
+        *b = 0;
+    } else {
+        *a = *b = 0;
+    }
+}
+
+static inline uint64_t
+_wyfinal(uint64_t a, uint64_t b, uint64_t seed, size_t len)
+{
+    a ^= wyp[1];
+    b ^= seed;
+    _wymum(&a, &b);
+
+    return _wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+uint64_t
+hash_wyhash(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = key;
+    uint64_t a, b;
+    size_t i;
+
+    seed ^= _wymix(seed ^ wyp[0], wyp[1]);
+
+    if (len <= 16) {
+        _wyshort(p, len, &a, &b);
+    } else {
+        i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+
+            do {
+                seed = _wymix(_wyr8(p) ^ wyp[1], _wyr8(p + 8) ^ seed);
+                see1 = _wymix(_wyr8(p + 16) ^ wyp[2], _wyr8(p + 24) ^ see1);
+                see2 = _wymix(_wyr8(p + 32) ^ wyp[3], _wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = _wymix(_wyr8(p) ^ wyp[1], _wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = _wyr8(p + i - 16);
+        b = _wyr8(p + i - 8);
+    }
+
+    return _wyfinal(a, b, seed, len);
+}
+
+void
+hash_wyhash_batch(const void *const *keys, const size_t *lens, size_t n,
+        uint64_t seed, uint64_t *out)
+{
+    uint64_t a[HASH_BATCH_LANES], b[HASH_BATCH_LANES], s;
+    size_t i, j;
+
+    /* the seed is mixed the same way for every key */
+    s = seed ^ _wymix(seed ^ wyp[0], wyp[1]);
+
+    for (i = 0; i + HASH_BATCH_LANES <= n; i += HASH_BATCH_LANES) {
+        /* independent lanes, for the CPU to overlap the multiplications */
+        for (j = 0; j < HASH_BATCH_LANES; j++) {
+            if (lens[i + j] <= 16) {
+                _wyshort(keys[i + j], lens[i + j], &a[j], &b[j]);
+            } else {
+                a[j] = b[j] = 0;
+            }
+        }
+        for (j = 0; j < HASH_BATCH_LANES; j++) {
+            out[i + j] = _wyfinal(a[j], b[j], s, lens[i + j]);
+        }
+        for (j = 0; j < HASH_BATCH_LANES; j++) {
+            if (lens[i + j] > 16) {
+                out[i + j] = hash_wyhash(keys[i + j], lens[i + j], seed);
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        out[i] = hash_wyhash(keys[i], lens[i], seed);
+    }
+}
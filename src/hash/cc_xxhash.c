@@ -0,0 +1,134 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * XXH64, following the reference implementation of xxHash by Yann Collet:
+ *   https://github.com/Cyan4973/xxHash
+ */
+
+#include <hash/cc_hash.h>
+
+#include <string.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* little-endian loads, as the digests are defined */
+static inline uint64_t
+_read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t
+_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t
+_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = _rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t
+_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= _round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t
+hash_xxh64(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = key, *end = p + len;
+    uint64_t h, v1, v2, v3, v4;
+
+    if (len >= 32) {
+        const uint8_t *limit = end - 32;
+
+        v1 = seed + PRIME64_1 + PRIME64_2;
+        v2 = seed + PRIME64_2;
+        v3 = seed;
+        v4 = seed - PRIME64_1;
+        do {
+            v1 = _round(v1, _read64(p));
+            v2 = _round(v2, _read64(p + 8));
+            v3 = _round(v3, _read64(p + 16));
+            v4 = _round(v4, _read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = _rotl64(v1, 1) + _rotl64(v2, 7) + _rotl64(v3, 12) +
+            _rotl64(v4, 18);
+        h = _merge_round(h, v1);
+        h = _merge_round(h, v2);
+        h = _merge_round(h, v3);
+        h = _merge_round(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= _round(0, _read64(p));
+        h = _rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)_read32(p) * PRIME64_1;
+        h = _rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * PRIME64_5;
+        h = _rotl64(h, 11) * PRIME64_1;
+    }
+
+    /* avalanche */
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
@@ -19,14 +19,643 @@
 
 #include <cc_debug.h>
 #include <cc_log.h>
+#include <cc_mm.h>
 #include <cc_print.h>
+#include <time/cc_timer.h>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define METRIC_MODULE_NAME "ccommon::metric"
 
 #define VALUE_PRINT_LEN 30
 #define METRIC_DESCRIBE_FMT  "%-31s %-15s %s"
 
-char *metric_type_str[] = {"counter", "gauge", "floating point"};
+#define HISTOGRAM_NAME_LEN 64
+
+char *metric_type_str[] = {"counter", "gauge", "floating point", "histogram"};
+
+/* percentiles exported by metric_print, with their name suffixes */
+static const struct {
+    char    *suffix;
+    double  p;
+} histogram_export[] = {
+    {"_p50", 50.0}, {"_p90", 90.0}, {"_p99", 99.0}, {"_p999", 99.9},
+};
+
+/* a thread's private copy of a metric array, see cc_metric.h */
+struct metric_shard {
+    struct metric_shard *next;
+    struct metric       *base;
+    struct metric_shard_tl *tl;         /* handle of the owning thread */
+    unsigned int        nmetric;
+    struct metric       metrics[];
+};
+
+bool metric_sharded = METRIC_SHARD;
+/*
+ * bumped whenever shards are freed, invalidating the cached handles of all
+ * threads on all bases; one whose shard survived finds it again on acquire
+ */
+uint64_t metric_shard_gen = 0;
+
+static struct metric_shard *shards = NULL;
+static bool shard_lock = false;
+
+/* a reader's view of base, see metric_epoch_advance */
+struct metric_epoch {
+    struct metric       *base;
+    unsigned int        nmetric;
+    struct metric       *prev;      /* snapshot at the start of the interval */
+    struct metric       *delta;     /* returned for the last interval */
+    struct histogram    **prev_h;   /* histogram copies owned by prev */
+    struct histogram    **delta_h;  /* and by delta, NULL for other types */
+    struct duration     d;
+};
+
+/* metric arrays registered for bulk export */
+static struct {
+    struct metric   *base;
+    unsigned int    nmetric;
+} group[METRIC_EXPORT_NGROUP];
+static unsigned int ngroup = 0;
+static uint32_t group_gen = 0;
+static bool group_lock = false;
+
+/* shared memory segment, see metric_shm_open */
+#define METRIC_SHM_SIZE 65536       /* initial size of the segment */
+
+static struct metric_shm_hdr *shm = NULL;
+static char *shm_name = NULL;
+static int shm_fd = -1;
+static bool shm_lock = false;
+
+static inline void
+_spin_lock(bool *lock)
+{
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED));
+    }
+}
+
+static inline void
+_spin_unlock(bool *lock)
+{
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+#define _shard_lock() _spin_lock(&shard_lock)
+#define _shard_unlock() _spin_unlock(&shard_lock)
+
+/* add the value of src into dst, both of the same type */
+static inline void
+_metric_add(struct metric *dst, struct metric *src)
+{
+    switch (dst->type) {
+    case METRIC_COUNTER:
+        dst->counter += __atomic_load_n(&src->counter, __ATOMIC_RELAXED);
+        break;
+
+    case METRIC_GAUGE:
+        dst->gauge += __atomic_load_n(&src->gauge, __ATOMIC_RELAXED);
+        break;
+
+    default: /* FPN is only ever set on the base */
+        break;
+    }
+}
+
+static inline void
+_metric_load(struct metric *dst, struct metric *src)
+{
+    *dst = *src;
+    switch (src->type) {
+    case METRIC_COUNTER:
+        dst->counter = __atomic_load_n(&src->counter, __ATOMIC_RELAXED);
+        break;
+
+    case METRIC_GAUGE:
+        dst->gauge = __atomic_load_n(&src->gauge, __ATOMIC_RELAXED);
+        break;
+
+    default:
+        break;
+    }
+}
+
+struct metric *
+metric_shard_acquire(struct metric_shard_tl *tl, struct metric *base,
+        unsigned int nmetric)
+{
+    struct metric_shard *s;
+    unsigned int i;
+
+    /**
+     * the handle may only be stale because shards of another base were
+     * released, in which case the shard of this thread is still there
+     */
+    _shard_lock();
+    for (s = shards; s != NULL; s = s->next) {
+        if (s->base == base && s->tl == tl) {
+            break;
+        }
+    }
+    if (s != NULL) {
+        tl->base = base;
+        tl->shard = s->metrics;
+        tl->gen = __atomic_load_n(&metric_shard_gen, __ATOMIC_RELAXED);
+        _shard_unlock();
+
+        return s->metrics;
+    }
+    _shard_unlock();
+
+    s = cc_alloc(sizeof(struct metric_shard) + nmetric * sizeof(struct metric));
+    if (s == NULL) {
+        log_warn("failed to allocate metric shard, updating base directly");
+        return base;
+    }
+    memcpy(s->metrics, base, nmetric * sizeof(struct metric));
+    for (i = 0; i < nmetric; i++) {
+        if (s->metrics[i].type == METRIC_HISTOGRAM) {
+            s->metrics[i].histo = NULL; /* recorded on the base only */
+        }
+    }
+    metric_reset(s->metrics, nmetric);
+    s->base = base;
+    s->tl = tl;
+    s->nmetric = nmetric;
+
+    _shard_lock();
+    s->next = shards;
+    __atomic_store_n(&shards, s, __ATOMIC_RELAXED);
+    tl->base = base;
+    tl->shard = s->metrics;
+    tl->gen = __atomic_load_n(&metric_shard_gen, __ATOMIC_RELAXED);
+    _shard_unlock();
+
+    log_verb("created metric shard %p of %u metrics for %p", s->metrics,
+            nmetric, base);
+
+    return s->metrics;
+}
+
+uint32_t
+metric_shard_count(void)
+{
+    struct metric_shard *s;
+    uint32_t n = 0;
+
+    _shard_lock();
+    for (s = shards; s != NULL; s = s->next) {
+        n++;
+    }
+    _shard_unlock();
+
+    return n;
+}
+
+void
+metric_shard_release(struct metric base[], unsigned int nmetric)
+{
+    struct metric_shard **sp, *s;
+    unsigned int i;
+
+    if (base == NULL) {
+        return;
+    }
+
+    _shard_lock();
+    for (sp = &shards; *sp != NULL;) {
+        s = *sp;
+        if (s->base != base) {
+            sp = &s->next;
+            continue;
+        }
+        ASSERT(s->nmetric == nmetric);
+        for (i = 0; i < nmetric; i++) {
+            _metric_add(&base[i], &s->metrics[i]);
+        }
+        *sp = s->next;
+        cc_free(s);
+    }
+    __atomic_add_fetch(&metric_shard_gen, 1, __ATOMIC_RELEASE);
+    _shard_unlock();
+}
+
+void
+metric_snapshot(struct metric dst[], struct metric base[], unsigned int nmetric)
+{
+    struct metric_shard *s;
+    unsigned int i;
+
+    for (i = 0; i < nmetric; i++) {
+        _metric_load(&dst[i], &base[i]);
+    }
+
+    _shard_lock();
+    for (s = shards; s != NULL; s = s->next) {
+        if (s->base != base) {
+            continue;
+        }
+        for (i = 0; i < nmetric && i < s->nmetric; i++) {
+            _metric_add(&dst[i], &s->metrics[i]);
+        }
+    }
+    _shard_unlock();
+}
+
+/* value of m summed over the shards of whatever array m belongs to */
+static void
+_metric_sum(struct metric *dst, struct metric *m)
+{
+    struct metric_shard *s;
+    uintptr_t off;
+
+    _metric_load(dst, m);
+    if (__atomic_load_n(&shards, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    _shard_lock();
+    for (s = shards; s != NULL; s = s->next) {
+        off = (uintptr_t)m - (uintptr_t)s->base;
+        if ((uintptr_t)m >= (uintptr_t)s->base &&
+                off < s->nmetric * sizeof(struct metric)) {
+            _metric_add(dst, &s->metrics[off / sizeof(struct metric)]);
+        }
+    }
+    _shard_unlock();
+}
+
+rstatus_i
+metric_register(struct metric base[], unsigned int nmetric)
+{
+    rstatus_i status = CC_OK;
+    unsigned int i;
+
+    if (base == NULL) {
+        return CC_EINVAL;
+    }
+
+    _spin_lock(&group_lock);
+    for (i = 0; i < ngroup && group[i].base != base; i++);
+    if (i < ngroup) {
+        group[i].nmetric = nmetric;
+    } else if (ngroup < METRIC_EXPORT_NGROUP) {
+        group[ngroup].base = base;
+        group[ngroup].nmetric = nmetric;
+        ngroup++;
+    } else {
+        log_error("cannot register metrics %p: all %u groups are taken",
+                base, METRIC_EXPORT_NGROUP);
+        status = CC_ENOMEM;
+    }
+    if (status == CC_OK) {
+        __atomic_add_fetch(&group_gen, 1, __ATOMIC_RELAXED);
+    }
+    _spin_unlock(&group_lock);
+
+    return status;
+}
+
+void
+metric_deregister(struct metric base[])
+{
+    unsigned int i;
+
+    _spin_lock(&group_lock);
+    for (i = 0; i < ngroup && group[i].base != base; i++);
+    if (i < ngroup) {
+        /* keep the registration order so the layout stays meaningful */
+        memmove(&group[i], &group[i + 1], (ngroup - i - 1) * sizeof(group[0]));
+        ngroup--;
+        __atomic_add_fetch(&group_gen, 1, __ATOMIC_RELAXED);
+    }
+    _spin_unlock(&group_lock);
+}
+
+uint32_t
+metric_export_gen(void)
+{
+    return __atomic_load_n(&group_gen, __ATOMIC_RELAXED);
+}
+
+static inline unsigned int
+_export_nslot(struct metric *m)
+{
+    return m->type == METRIC_HISTOGRAM ? METRIC_EXPORT_HISTOGRAM : 1;
+}
+
+unsigned int
+metric_export_nslot(void)
+{
+    unsigned int i, j, nslot = 0;
+
+    _spin_lock(&group_lock);
+    for (i = 0; i < ngroup; i++) {
+        for (j = 0; j < group[i].nmetric; j++) {
+            nslot += _export_nslot(&group[i].base[j]);
+        }
+    }
+    _spin_unlock(&group_lock);
+
+    return nslot;
+}
+
+static inline size_t
+_layout_slot(uint8_t *p, uint8_t *end, metric_type_e type, const char *name)
+{
+    size_t len = strlen(name);
+
+    len = MIN(len, UINT8_MAX);
+    if (p + 2 + len <= end) {
+        p[0] = (uint8_t)type;
+        p[1] = (uint8_t)len;
+        cc_memcpy(p + 2, name, len);
+    }
+
+    return 2 + len;
+}
+
+size_t
+metric_export_layout(void *buf, size_t nbuf)
+{
+    char name_buf[HISTOGRAM_NAME_LEN];
+    uint8_t *p = buf, *end = p + nbuf;
+    size_t n = sizeof(uint32_t);
+    uint32_t nslot = 0;
+    unsigned int i, j, k;
+    struct metric *m;
+
+    _spin_lock(&group_lock);
+    for (i = 0; i < ngroup; i++) {
+        for (j = 0; j < group[i].nmetric; j++) {
+            m = &group[i].base[j];
+            if (m->type != METRIC_HISTOGRAM) {
+                n += _layout_slot(p + n, end, m->type, m->name);
+                nslot++;
+                continue;
+            }
+            cc_scnprintf(name_buf, HISTOGRAM_NAME_LEN, "%s_count", m->name);
+            n += _layout_slot(p + n, end, METRIC_COUNTER, name_buf);
+            for (k = 0; k < METRIC_EXPORT_HISTOGRAM - 2; k++) {
+                cc_scnprintf(name_buf, HISTOGRAM_NAME_LEN, "%s%s", m->name,
+                        histogram_export[k].suffix);
+                n += _layout_slot(p + n, end, METRIC_COUNTER, name_buf);
+            }
+            cc_scnprintf(name_buf, HISTOGRAM_NAME_LEN, "%s_max", m->name);
+            n += _layout_slot(p + n, end, METRIC_COUNTER, name_buf);
+            nslot += METRIC_EXPORT_HISTOGRAM;
+        }
+    }
+    _spin_unlock(&group_lock);
+
+    if (n <= nbuf) {
+        cc_memcpy(p, &nslot, sizeof(nslot));
+    }
+
+    return n;
+}
+
+static inline void
+_export_histogram(uint64_t val[], struct metric *m)
+{
+    struct histogram *h = __atomic_load_n(&m->histo, __ATOMIC_ACQUIRE);
+    unsigned int k;
+
+    val[0] = h == NULL ? 0 : __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    for (k = 0; k < METRIC_EXPORT_HISTOGRAM - 2; k++) {
+        val[k + 1] = metric_histogram_percentile(m, histogram_export[k].p);
+    }
+    val[k + 1] = h == NULL ? 0 : __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+unsigned int
+metric_export_values(uint64_t val[], unsigned int nslot)
+{
+    struct metric_shard *s;
+    struct metric v;
+    unsigned int i, j, n = 0;
+
+    _spin_lock(&group_lock);
+    for (i = 0; i < ngroup; i++) {
+        struct metric *base = group[i].base;
+        unsigned int first = n;
+
+        /* values of the base first, then fold in its shards */
+        for (j = 0; j < group[i].nmetric && n < nslot; j++) {
+            _metric_load(&v, &base[j]);
+            if (v.type == METRIC_HISTOGRAM) {
+                if (n + METRIC_EXPORT_HISTOGRAM > nslot) {
+                    break;
+                }
+                _export_histogram(&val[n], &v);
+                n += METRIC_EXPORT_HISTOGRAM;
+                continue;
+            }
+            cc_memcpy(&val[n++], &v.counter, sizeof(uint64_t));
+        }
+        if (__atomic_load_n(&shards, __ATOMIC_RELAXED) == NULL) {
+            continue;
+        }
+
+        _shard_lock();
+        for (s = shards; s != NULL; s = s->next) {
+            unsigned int slot = first;
+
+            if (s->base != base) {
+                continue;
+            }
+            for (j = 0; j < s->nmetric && slot < n; j++) {
+                if (s->metrics[j].type == METRIC_HISTOGRAM) {
+                    slot += METRIC_EXPORT_HISTOGRAM;
+                    continue;
+                }
+                v.type = s->metrics[j].type;
+                cc_memcpy(&v.counter, &val[slot], sizeof(uint64_t));
+                _metric_add(&v, &s->metrics[j]);
+                cc_memcpy(&val[slot++], &v.counter, sizeof(uint64_t));
+            }
+        }
+        _shard_unlock();
+    }
+    _spin_unlock(&group_lock);
+
+    return n;
+}
+
+static rstatus_i
+_shm_map(size_t size)
+{
+    void *p;
+
+    if (ftruncate(shm_fd, size) < 0) {
+        log_error("resize metric segment %s to %zu failed: %s", shm_name,
+                size, strerror(errno));
+        return CC_ERROR;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (p == MAP_FAILED) {
+        log_error("map metric segment %s of %zu failed: %s", shm_name, size,
+                strerror(errno));
+        return CC_ERROR;
+    }
+
+    if (shm != NULL) {
+        munmap(shm, shm->size);
+    }
+    shm = p;
+    shm->size = size;
+
+    return CC_OK;
+}
+
+rstatus_i
+metric_shm_open(const char *name)
+{
+    ASSERT(name != NULL);
+
+    if (shm != NULL) {
+        log_warn("metric segment %s is already open, re-creating", shm_name);
+        metric_shm_close();
+    }
+
+    shm_name = cc_alloc(strlen(name) + 1);
+    if (shm_name == NULL) {
+        return CC_ENOMEM;
+    }
+    strcpy(shm_name, name);
+
+    shm_fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (shm_fd < 0) {
+        log_error("open metric segment %s failed: %s", name, strerror(errno));
+        cc_free(shm_name);
+        shm_name = NULL;
+        return CC_ERROR;
+    }
+    if (_shm_map(METRIC_SHM_SIZE) != CC_OK) {
+        metric_shm_close();
+        return CC_ERROR;
+    }
+
+    shm->magic = METRIC_SHM_MAGIC;
+    shm->version = METRIC_SHM_VERSION;
+    shm->layout_off = CC_ALIGN(sizeof(*shm), sizeof(uint64_t));
+    shm->gen = metric_export_gen() - 1; /* lay out on the first update */
+    metric_shm_update(NULL);
+
+    log_info("metrics exported in shared memory segment %s", name);
+
+    return CC_OK;
+}
+
+void
+metric_shm_close(void)
+{
+    if (shm != NULL) {
+        munmap(shm, shm->size);
+        shm = NULL;
+    }
+    if (shm_fd >= 0) {
+        close(shm_fd);
+        shm_fd = -1;
+        shm_unlink(shm_name);
+    }
+    cc_free(shm_name);
+    shm_name = NULL;
+}
+
+/* write the layout for gen, growing the segment to fit it and its values */
+static rstatus_i
+_shm_layout(uint32_t gen)
+{
+    uint32_t nslot = metric_export_nslot();
+    size_t len, size;
+
+    for (;;) {
+        len = metric_export_layout((char *)shm + shm->layout_off,
+                shm->size - shm->layout_off);
+        size = CC_ALIGN(shm->layout_off + len, sizeof(uint64_t)) +
+            (size_t)nslot * sizeof(uint64_t);
+        if (size <= shm->size) {
+            break;
+        }
+        if (_shm_map(MAX(size, 2 * shm->size)) != CC_OK) {
+            return CC_ERROR;
+        }
+    }
+
+    shm->layout_len = (uint32_t)len;
+    shm->value_off = CC_ALIGN(shm->layout_off + len, sizeof(uint64_t));
+    shm->nslot = nslot;
+    shm->gen = gen;
+
+    return CC_OK;
+}
+
+void
+metric_shm_update(void *arg)
+{
+    struct timespec now;
+    uint32_t gen;
+    uint64_t seq;
+
+    (void)arg;
+
+    if (shm == NULL) {
+        return;
+    }
+
+    _spin_lock(&shm_lock);
+    seq = shm->seq;
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    gen = metric_export_gen();
+    if (gen != shm->gen && _shm_layout(gen) != CC_OK) {
+        shm->nslot = 0;
+    }
+    /* registrations racing with this are picked up by the next update */
+    shm->nslot = metric_export_values((uint64_t *)((char *)shm +
+                shm->value_off), shm->nslot);
+    clock_gettime(CLOCK_REALTIME, &now);
+    shm->update_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+    _spin_unlock(&shm_lock);
+}
+
+void
+metric_setup(metric_options_st *options)
+{
+    char *name = METRIC_SHM_NAME;
+
+    log_info("set up the %s module", METRIC_MODULE_NAME);
+
+    if (options != NULL) {
+        metric_sharded = option_bool(&options->metric_shard);
+        name = option_str(&options->metric_shm_name);
+    }
+    if (name != NULL && metric_shm_open(name) != CC_OK) {
+        log_error("metrics are not exported in shared memory");
+    }
+}
+
+void
+metric_teardown(void)
+{
+    log_info("tear down the %s module", METRIC_MODULE_NAME);
+
+    metric_sharded = METRIC_SHARD;
+    metric_shm_close();
+}
 
 void
 metric_reset(struct metric sarr[], unsigned int n)
@@ -51,6 +680,12 @@ metric_reset(struct metric sarr[], unsigned int n)
             sarr[i].fpn = 0.0;
             break;
 
+        case METRIC_HISTOGRAM:
+            if (sarr[i].histo != NULL) {
+                memset(sarr[i].histo, 0, sizeof(struct histogram));
+            }
+            break;
+
         default:
             NOT_REACHED();
             break;
@@ -58,35 +693,178 @@ metric_reset(struct metric sarr[], unsigned int n)
     }
 }
 
+void
+metric_free(struct metric sarr[], unsigned int n)
+{
+    unsigned int i;
+
+    if (sarr == NULL) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (sarr[i].type == METRIC_HISTOGRAM) {
+            cc_free(sarr[i].histo);
+            sarr[i].histo = NULL;
+        }
+    }
+}
+
+static inline unsigned int
+_histogram_bucket(uint64_t val)
+{
+    unsigned int e;
+
+    if (val < HISTOGRAM_NSUB) {
+        return (unsigned int)val;
+    }
+
+    e = 63 - __builtin_clzll(val); /* >= HISTOGRAM_SUB_BITS */
+
+    return ((e - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+        ((val >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_NSUB - 1));
+}
+
+/* highest value that falls into bucket i */
+static inline uint64_t
+_histogram_bucket_max(unsigned int i)
+{
+    unsigned int shift;
+
+    if (i < HISTOGRAM_NSUB) {
+        return i;
+    }
+
+    shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+
+    return (((uint64_t)(HISTOGRAM_NSUB + (i & (HISTOGRAM_NSUB - 1))) + 1) <<
+            shift) - 1;
+}
+
+void
+metric_histogram_record(struct metric *m, uint64_t val)
+{
+    struct histogram *h, *expected = NULL;
+    uint64_t max;
+
+    ASSERT(m->type == METRIC_HISTOGRAM);
+
+    h = __atomic_load_n(&m->histo, __ATOMIC_ACQUIRE);
+    if (h == NULL) {
+        h = cc_zalloc(sizeof(struct histogram));
+        if (h == NULL) {
+            return;
+        }
+        if (!__atomic_compare_exchange_n(&m->histo, &expected, h, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            cc_free(h);
+            h = expected;
+        }
+    }
+
+    __atomic_add_fetch(&h->bucket[_histogram_bucket(val)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, val, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (val > max && !__atomic_compare_exchange_n(&h->max, &max, val, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t
+metric_histogram_percentile(struct metric *m, double p)
+{
+    struct histogram *h;
+    uint64_t count, rank, seen = 0, max;
+    unsigned int i;
+
+    ASSERT(m->type == METRIC_HISTOGRAM);
+
+    h = __atomic_load_n(&m->histo, __ATOMIC_ACQUIRE);
+    if (h == NULL || (count = __atomic_load_n(&h->count, __ATOMIC_RELAXED))
+            == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t)(p / 100.0 * count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for (i = 0; i < HISTOGRAM_NBUCKET; i++) {
+        seen += __atomic_load_n(&h->bucket[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            return MIN(_histogram_bucket_max(i), max);
+        }
+    }
+
+    /* count ran ahead of the buckets under concurrent records */
+    return max;
+}
+
+static size_t
+_histogram_print(char *buf, size_t nbuf, char *fmt, struct metric *m)
+{
+    char name_buf[HISTOGRAM_NAME_LEN];
+    char val_buf[VALUE_PRINT_LEN];
+    struct histogram *h = __atomic_load_n(&m->histo, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    unsigned int i;
+
+    cc_scnprintf(name_buf, HISTOGRAM_NAME_LEN, "%s_count", m->name);
+    cc_scnprintf(val_buf, VALUE_PRINT_LEN, "%llu", h == NULL ? 0ULL :
+            (unsigned long long)__atomic_load_n(&h->count, __ATOMIC_RELAXED));
+    n += cc_scnprintf(buf + n, nbuf - n, fmt, name_buf, val_buf);
+
+    for (i = 0; i < sizeof(histogram_export) / sizeof(histogram_export[0]);
+            i++) {
+        cc_scnprintf(name_buf, HISTOGRAM_NAME_LEN, "%s%s", m->name,
+                histogram_export[i].suffix);
+        cc_scnprintf(val_buf, VALUE_PRINT_LEN, "%llu", (unsigned long long)
+                metric_histogram_percentile(m, histogram_export[i].p));
+        n += cc_scnprintf(buf + n, nbuf - n, fmt, name_buf, val_buf);
+    }
+
+    cc_scnprintf(name_buf, HISTOGRAM_NAME_LEN, "%s_max", m->name);
+    cc_scnprintf(val_buf, VALUE_PRINT_LEN, "%llu", h == NULL ? 0ULL :
+            (unsigned long long)__atomic_load_n(&h->max, __ATOMIC_RELAXED));
+    n += cc_scnprintf(buf + n, nbuf - n, fmt, name_buf, val_buf);
+
+    return n;
+}
+
 size_t
 metric_print(char *buf, size_t nbuf, char *fmt, struct metric *m)
 {
     char val_buf[VALUE_PRINT_LEN];
+    struct metric sum;
 
     if (m == NULL) {
         return 0;
     }
 
+    _metric_sum(&sum, m);
+    m = &sum;
+
     switch(m->type) {
+    /* values are formatted without vsnprintf, stats dumps are mostly these */
     case METRIC_COUNTER:
-        /**
-         * not using cc_print_uint64, since it would complicate implementation
-         * and negatively impact readability, and since this function should not
-         * be called often enough to make it absolutely performance critical.
-         */
-        cc_scnprintf(val_buf, VALUE_PRINT_LEN, "%llu", __atomic_load_n(
-                    &m->counter, __ATOMIC_RELAXED));
+        val_buf[cc_print_uint64(val_buf, VALUE_PRINT_LEN - 1, __atomic_load_n(
+                    &m->counter, __ATOMIC_RELAXED))] = '\0';
         break;
 
     case METRIC_GAUGE:
-        cc_scnprintf(val_buf, VALUE_PRINT_LEN, "%lld", __atomic_load_n(
-                    &m->gauge, __ATOMIC_RELAXED));
+        val_buf[cc_print_int64(val_buf, VALUE_PRINT_LEN - 1, __atomic_load_n(
+                    &m->gauge, __ATOMIC_RELAXED))] = '\0';
         break;
 
     case METRIC_FPN:
-        cc_scnprintf(val_buf, VALUE_PRINT_LEN, "%f", m->fpn);
+        val_buf[cc_print_double(val_buf, VALUE_PRINT_LEN - 1, m->fpn)] = '\0';
         break;
 
+    case METRIC_HISTOGRAM:
+        /* one line per exported quantity, each formatted with fmt */
+        return _histogram_print(buf, nbuf, fmt, m);
+
     default:
         NOT_REACHED();
     }
@@ -94,6 +872,166 @@ metric_print(char *buf, size_t nbuf, char *fmt, struct metric *m)
     return cc_scnprintf(buf, nbuf, fmt, m->name, val_buf);
 }
 
+/* snapshot base into dst, copying live histograms into those owned by dst */
+static void
+_epoch_snapshot(struct metric_epoch *e, struct metric dst[],
+        struct histogram *own[])
+{
+    struct histogram *live;
+    unsigned int i, j;
+
+    metric_snapshot(dst, e->base, e->nmetric);
+    for (i = 0; i < e->nmetric; i++) {
+        if (dst[i].type != METRIC_HISTOGRAM) {
+            continue;
+        }
+        live = dst[i].histo;
+        dst[i].histo = own[i];
+        if (live == NULL) {
+            memset(own[i], 0, sizeof(struct histogram));
+            continue;
+        }
+        own[i]->count = __atomic_load_n(&live->count, __ATOMIC_RELAXED);
+        own[i]->sum = __atomic_load_n(&live->sum, __ATOMIC_RELAXED);
+        own[i]->max = __atomic_load_n(&live->max, __ATOMIC_RELAXED);
+        for (j = 0; j < HISTOGRAM_NBUCKET; j++) {
+            own[i]->bucket[j] = __atomic_load_n(&live->bucket[j],
+                    __ATOMIC_RELAXED);
+        }
+    }
+}
+
+struct metric_epoch *
+metric_epoch_create(struct metric base[], unsigned int nmetric)
+{
+    struct metric_epoch *e;
+    unsigned int i;
+
+    e = cc_zalloc(sizeof(struct metric_epoch));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->base = base;
+    e->nmetric = nmetric;
+    e->prev = cc_zalloc(nmetric * sizeof(struct metric));
+    e->delta = cc_zalloc(nmetric * sizeof(struct metric));
+    e->prev_h = cc_zalloc(nmetric * sizeof(struct histogram *));
+    e->delta_h = cc_zalloc(nmetric * sizeof(struct histogram *));
+    if (e->prev == NULL || e->delta == NULL || e->prev_h == NULL ||
+            e->delta_h == NULL) {
+        goto error;
+    }
+    for (i = 0; i < nmetric; i++) {
+        if (base[i].type != METRIC_HISTOGRAM) {
+            continue;
+        }
+        e->prev_h[i] = cc_zalloc(sizeof(struct histogram));
+        e->delta_h[i] = cc_zalloc(sizeof(struct histogram));
+        if (e->prev_h[i] == NULL || e->delta_h[i] == NULL) {
+            goto error;
+        }
+    }
+
+    _epoch_snapshot(e, e->prev, e->prev_h);
+    duration_start(&e->d);
+
+    return e;
+
+error:
+    log_error("failed to allocate metric epoch of %u metrics", nmetric);
+    metric_epoch_destroy(&e);
+
+    return NULL;
+}
+
+void
+metric_epoch_destroy(struct metric_epoch **epoch)
+{
+    struct metric_epoch *e = *epoch;
+    unsigned int i;
+
+    if (e == NULL) {
+        return;
+    }
+
+    for (i = 0; i < e->nmetric; i++) {
+        if (e->prev_h != NULL) {
+            cc_free(e->prev_h[i]);
+        }
+        if (e->delta_h != NULL) {
+            cc_free(e->delta_h[i]);
+        }
+    }
+    cc_free(e->prev_h);
+    cc_free(e->delta_h);
+    cc_free(e->prev);
+    cc_free(e->delta);
+    cc_free(e);
+    *epoch = NULL;
+}
+
+/* turn cur (in place) into its difference from prev, and prev into cur */
+static void
+_histogram_delta(struct histogram *cur, struct histogram *prev)
+{
+    uint64_t v, max = cur->max;
+    unsigned int j, top = 0;
+
+    for (j = 0; j < HISTOGRAM_NBUCKET; j++) {
+        v = cur->bucket[j];
+        cur->bucket[j] = v - prev->bucket[j];
+        prev->bucket[j] = v;
+        if (cur->bucket[j] > 0) {
+            top = j;
+        }
+    }
+    v = cur->count;
+    cur->count = v - prev->count;
+    prev->count = v;
+    v = cur->sum;
+    cur->sum = v - prev->sum;
+    prev->sum = v;
+    prev->max = max;
+    /* the true interval max is not tracked, bound it by its top bucket */
+    cur->max = cur->count == 0 ? 0 : MIN(_histogram_bucket_max(top), max);
+}
+
+struct metric *
+metric_epoch_advance(struct metric_epoch *e, uint64_t *ns)
+{
+    struct metric *cur = e->delta, *prev = e->prev;
+    uint64_t v;
+    unsigned int i;
+
+    duration_stop(&e->d);
+    if (ns != NULL) {
+        *ns = (uint64_t)duration_ns(&e->d);
+    }
+    duration_start(&e->d);
+
+    _epoch_snapshot(e, cur, e->delta_h);
+    for (i = 0; i < e->nmetric; i++) {
+        switch (cur[i].type) {
+        case METRIC_COUNTER:
+            v = cur[i].counter;
+            cur[i].counter = v - prev[i].counter;
+            prev[i].counter = v;
+            break;
+
+        case METRIC_HISTOGRAM:
+            _histogram_delta(cur[i].histo, prev[i].histo);
+            break;
+
+        default:
+            /* levels are reported as they are */
+            prev[i] = cur[i];
+            break;
+        }
+    }
+
+    return cur;
+}
+
 void
 metric_describe_all(struct metric metrics[], unsigned int nmetric)
 {
@@ -0,0 +1,173 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stream/cc_frame.h>
+
+#include <cc_debug.h>
+#include <cc_util.h>
+
+#include <string.h>
+
+void
+frame_reader_delim(struct frame_reader *fr, const char *delim, uint8_t ndelim,
+        uint32_t max)
+{
+    ASSERT(fr != NULL && delim != NULL);
+    ASSERT(ndelim > 0 && ndelim <= FRAME_DELIM_MAX);
+
+    fr->type = FRAME_DELIM;
+    fr->ndelim = ndelim;
+    fr->nprefix = 0;
+    cc_memcpy(fr->delim, delim, ndelim);
+    fr->max = max;
+    fr->scanned = 0;
+}
+
+void
+frame_reader_length(struct frame_reader *fr, uint8_t nprefix, uint32_t max)
+{
+    ASSERT(fr != NULL);
+    ASSERT(nprefix == 1 || nprefix == 2 || nprefix == 4);
+
+    fr->type = FRAME_LENGTH;
+    fr->ndelim = 0;
+    fr->nprefix = nprefix;
+    fr->max = max;
+    fr->scanned = 0;
+}
+
+void
+frame_reader_reset(struct frame_reader *fr)
+{
+    fr->scanned = 0;
+}
+
+/* index of the first delimiter at or after off, or str->len */
+static inline uint32_t
+_frame_find(const struct frame_reader *fr, const struct bstring *str,
+        uint32_t off)
+{
+    uint32_t i;
+
+    for (i = off; (i = bstring_find(str, i, fr->delim[0])) + fr->ndelim <=
+            str->len; i++) {
+        if (cc_memcmp(str->data + i + 1, fr->delim + 1, fr->ndelim - 1) == 0) {
+            return i;
+        }
+    }
+
+    return str->len;
+}
+
+static rstatus_i
+_frame_read_delim(struct frame_reader *fr, struct buf *buf,
+        struct bstring *frame)
+{
+    struct bstring str = { buf_rsize(buf), buf->rpos };
+    uint32_t i;
+
+    i = _frame_find(fr, &str, MIN(fr->scanned, str.len));
+    if (i == str.len) {
+        /* a delimiter may still start in the last ndelim - 1 bytes */
+        fr->scanned = str.len < fr->ndelim ? 0 : str.len - fr->ndelim + 1;
+        if (fr->max > 0 && fr->scanned > fr->max) {
+            log_debug("no delimiter within %"PRIu32" bytes", fr->max);
+
+            return CC_ERROR;
+        }
+
+        return CC_UNFIN;
+    }
+    if (fr->max > 0 && i > fr->max) {
+        log_debug("frame of %"PRIu32" bytes exceeds %"PRIu32, i, fr->max);
+
+        return CC_ERROR;
+    }
+
+    frame->len = i;
+    frame->data = str.data;
+    buf->rpos += i + fr->ndelim;
+    fr->scanned = 0;
+
+    return CC_OK;
+}
+
+static rstatus_i
+_frame_read_length(struct frame_reader *fr, struct buf *buf,
+        struct bstring *frame)
+{
+    uint32_t i, len = 0;
+
+    if (buf_rsize(buf) < fr->nprefix) {
+        return CC_UNFIN;
+    }
+
+    for (i = 0; i < fr->nprefix; i++) {
+        len = (len << 8) | (uint8_t)buf->rpos[i];
+    }
+    if (fr->max > 0 && len > fr->max) {
+        log_debug("frame of %"PRIu32" bytes exceeds %"PRIu32, len, fr->max);
+
+        return CC_ERROR;
+    }
+    if (buf_rsize(buf) - fr->nprefix < len) {
+        return CC_UNFIN;
+    }
+
+    frame->len = len;
+    frame->data = buf->rpos + fr->nprefix;
+    buf->rpos += fr->nprefix + len;
+
+    return CC_OK;
+}
+
+rstatus_i
+frame_read(struct frame_reader *fr, struct buf *buf, struct bstring *frame)
+{
+    ASSERT(fr != NULL && buf != NULL && frame != NULL);
+
+    if (fr->type == FRAME_LENGTH) {
+        return _frame_read_length(fr, buf, frame);
+    }
+
+    return _frame_read_delim(fr, buf, frame);
+}
+
+rstatus_i
+frame_sock_read(struct frame_reader *fr, struct buf_sock *s,
+        struct bstring *frame)
+{
+    rstatus_i status;
+    uint32_t count;
+
+    ASSERT(s != NULL);
+
+    if (s->rbuf == NULL) {
+        return CC_UNFIN;
+    }
+
+    while ((status = frame_read(fr, s->rbuf, frame)) == CC_UNFIN &&
+            buf_chain_rsize(&s->rchain) > 0) {
+        /* the frame goes on in rchain: move its next buf over and go on */
+        count = buf_rsize(STAILQ_FIRST(&s->rchain));
+        status = buf_sock_coalesce(s, buf_rsize(s->rbuf) + MAX(count, 1));
+        if (status != CC_OK) {
+            return status;
+        }
+    }
+
+    return status;
+}
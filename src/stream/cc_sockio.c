@@ -21,45 +21,283 @@
 #include <buffer/cc_dbuf.h>
 #include <cc_debug.h>
 #include <cc_define.h>
+#include <cc_event.h>
 #include <cc_mm.h>
 #include <cc_pool.h>
+#include <cc_slab.h>
+#include <cc_trace.h>
 #include <cc_util.h>
 #include <channel/cc_tcp.h>
 
+#include <errno.h>
 #include <limits.h>
+#include <string.h>
 #include <sys/uio.h>
 
-/*
 #if (IOV_MAX > 128)
 #define CC_IOV_MAX 128
 #else
 #define CC_IOV_MAX IOV_MAX
 #endif
-*/
 
 #define SOCKIO_MODULE_NAME "ccommon::sockio"
 
+/* slab slots in whole cache lines, so every buf_sock starts on one */
+#define BUFSOCK_SLOT CC_ALIGN(sizeof(struct buf_sock), CC_CACHELINE_SIZE)
+
+_Static_assert(offsetof(struct buf_sock, dirty) < CC_CACHELINE_SIZE,
+        "buf_sock I/O fields must fit in a cache line");
+
 FREEPOOL(buf_sock_pool, buf_sockq, buf_sock);
 struct buf_sock_pool bsp;
+static struct slab *bsp_slab = NULL; /* backs the pool if poolslab */
 
 static bool sockio_init = false;
 static bool bsp_init = false;
 static sockio_metrics_st *sockio_metrics = NULL;
+static bool lazy = BUFSOCK_LAZY;
+static bool defer = BUFSOCK_DEFER;
+static TAILQ_HEAD(buf_sock_tqh, buf_sock) live = TAILQ_HEAD_INITIALIZER(live);
+static struct buf_sock_tqh dirty = TAILQ_HEAD_INITIALIZER(dirty);
+
+/* in lazy mode, borrow a buf for rbuf/wbuf when there is data to hold */
+static inline rstatus_i
+_buf_sock_attach(struct buf_sock *s, struct buf **buf)
+{
+    if (*buf != NULL) {
+        return CC_OK;
+    }
+
+    ASSERT(s->lazy);
+
+    *buf = buf_borrow();
+    if (*buf == NULL) {
+        log_debug("attach buf to buf_sock %p failed", s);
+        INCR(sockio_metrics, buf_sock_attach_ex);
+
+        return CC_ENOMEM;
+    }
+
+    INCR(sockio_metrics, buf_sock_attach);
+    INCR(sockio_metrics, buf_sock_attached);
+
+    return CC_OK;
+}
+
+/* drop s from the dirty list, whatever it was waiting to send stays put */
+static inline void
+_buf_sock_clean(struct buf_sock *s)
+{
+    if (s->dirty) {
+        TAILQ_REMOVE(&dirty, s, flush);
+        s->dirty = false;
+    }
+}
+
+static inline void
+_buf_sock_detach(struct buf_sock *s, struct buf **buf)
+{
+    if (!s->lazy || *buf == NULL) {
+        return;
+    }
+
+    buf_return(buf);
+    INCR(sockio_metrics, buf_sock_detach);
+    DECR(sockio_metrics, buf_sock_attached);
+}
+
+/* the channel being driven: the one set by buf_sock_set_channel, or ch */
+static inline channel_p
+_buf_sock_ch(const struct buf_sock *s)
+{
+    return s->chan != NULL ? s->chan : s->ch;
+}
+
+/**
+ * is I/O done by tcp, with no handler in the way? The tcp functions are then
+ * called directly, which the compiler and branch predictor both handle better
+ * than an indirect call, and tcp-only features can be used on the channel.
+ * Any other handler is called for all I/O, also on the owned conn.
+ */
+static inline bool
+_buf_sock_tcp(const struct buf_sock *s)
+{
+    return s->hdl == NULL || (s->hdl->recv == (channel_recv_fn)tcp_recv &&
+            s->hdl->send == (channel_send_fn)tcp_send);
+}
+
+static inline void
+_buf_sock_state(struct buf_sock *s, unsigned state)
+{
+    /* without a channel set, ch is driven whichever handler does the I/O */
+    if (s->chan == NULL || _buf_sock_tcp(s)) {
+        ((struct tcp_conn *)_buf_sock_ch(s))->state = state;
+    }
+}
+
+static inline ssize_t
+_buf_sock_recv(struct buf_sock *s, void *buf, size_t nbyte)
+{
+    if (_buf_sock_tcp(s)) {
+        return tcp_recv(_buf_sock_ch(s), buf, nbyte);
+    }
+
+    return s->hdl->recv(_buf_sock_ch(s), buf, nbyte);
+}
+
+static inline ssize_t
+_buf_sock_send(struct buf_sock *s, void *buf, size_t nbyte)
+{
+    if (_buf_sock_tcp(s)) {
+        return tcp_send(_buf_sock_ch(s), buf, nbyte);
+    }
+
+    return s->hdl->send(_buf_sock_ch(s), buf, nbyte);
+}
+
+/* vectored recv/send, one buf at a time on channels other than tcp */
+static ssize_t
+_buf_sock_recvv(struct buf_sock *s, struct array *iova, size_t nbyte)
+{
+    struct iovec *iov;
+    uint32_t i;
+    ssize_t n, total = 0;
+
+    if (_buf_sock_tcp(s)) {
+        return tcp_recvv(_buf_sock_ch(s), iova, nbyte);
+    }
+
+    for (i = 0; i < array_nelem(iova); i++) {
+        iov = array_get(iova, i);
+        n = _buf_sock_recv(s, iov->iov_base, iov->iov_len);
+        if (n <= 0) {
+            return total > 0 ? total : n;
+        }
+        total += n;
+        if ((size_t)n < iov->iov_len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+static ssize_t
+_buf_sock_sendv(struct buf_sock *s, struct array *iova, size_t nbyte)
+{
+    struct iovec *iov;
+    uint32_t i;
+    ssize_t n, total = 0;
+
+    if (_buf_sock_tcp(s)) {
+        return tcp_sendv(_buf_sock_ch(s), iova, nbyte);
+    }
+
+    for (i = 0; i < array_nelem(iova); i++) {
+        iov = array_get(iova, i);
+        n = _buf_sock_send(s, iov->iov_base, iov->iov_len);
+        if (n <= 0) {
+            return total > 0 ? total : n;
+        }
+        total += n;
+        if ((size_t)n < iov->iov_len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+static inline uint32_t
+_buf_sock_zerocopy_pending(const struct buf_sock *s)
+{
+    return _buf_sock_tcp(s) ? tcp_zerocopy_pending(_buf_sock_ch(s)) : 0;
+}
+
+static void
+_buf_sock_unpin_return(void *data)
+{
+    struct buf *buf = data;
+
+    buf_return(&buf);
+}
+
+static void
+_buf_sock_unpin_destroy(void *data)
+{
+    struct buf *buf = data;
+
+    buf_destroy(&buf);
+}
+
+/*
+ * before s or its wbuf is recycled: a wbuf zerocopy sends still read from is
+ * handed to the tcp module to be given back once they complete, and in eager
+ * mode replaced if s is kept (or s falls back to lazy if that fails)
+ */
+static void
+_buf_sock_unpin(struct buf_sock *s, bool replace)
+{
+    channel_p c = _buf_sock_ch(s);
+
+    if (s->wbuf == NULL || c == NULL || !_buf_sock_tcp(s) ||
+            !tcp_zerocopy_pinned(c)) {
+        return;
+    }
+
+    log_debug("wbuf of buf_sock %p pinned by zerocopy sends", s);
+    if (s->lazy) {
+        tcp_zerocopy_release(c, _buf_sock_unpin_return, s->wbuf);
+        s->wbuf = NULL;
+        INCR(sockio_metrics, buf_sock_detach);
+        DECR(sockio_metrics, buf_sock_attached);
+        return;
+    }
+
+    tcp_zerocopy_release(c, _buf_sock_unpin_destroy, s->wbuf);
+    s->wbuf = replace ? buf_create() : NULL;
+    if (replace && s->wbuf == NULL) {
+        log_warn("cannot replace pinned wbuf of buf_sock %p, going lazy", s);
+        s->lazy = true;
+    }
+}
+
+/* lazy mode: give rbuf back once everything read has been consumed */
+static inline void
+_buf_sock_rbuf_idle(struct buf_sock *s)
+{
+    if (s->lazy && s->rbuf != NULL && buf_rsize(s->rbuf) == 0 &&
+            STAILQ_EMPTY(&s->rchain)) {
+        _buf_sock_detach(s, &s->rbuf);
+    }
+}
+
+/* lazy mode: give wbuf back once everything queued has been sent */
+static inline void
+_buf_sock_wbuf_idle(struct buf_sock *s)
+{
+    if (s->lazy && s->wbuf != NULL && buf_rsize(s->wbuf) == 0 &&
+            STAILQ_EMPTY(&s->wchain) && _buf_sock_zerocopy_pending(s) == 0) {
+        _buf_sock_detach(s, &s->wbuf);
+    }
+}
 
 rstatus_i
-buf_tcp_read(struct buf_sock *s)
+buf_sock_read(struct buf_sock *s)
 {
     ASSERT(s != NULL);
 
-    struct tcp_conn *c = (struct tcp_conn *)s->ch;
-    channel_handler_st *h = s->hdl;
-    struct buf *buf = s->rbuf;
+    channel_p c = _buf_sock_ch(s);
+    struct buf *buf;
     rstatus_i status = CC_OK;
     ssize_t cap, n;
 
     ASSERT(c != NULL);
-    ASSERT(buf != NULL);
-    ASSERT(h != NULL && h->recv != NULL);
+
+    if (_buf_sock_attach(s, &s->rbuf) != CC_OK) {
+        return CC_ENOMEM;
+    }
+    buf = s->rbuf;
 
     cap = buf_wsize(buf);
 
@@ -67,18 +305,18 @@ buf_tcp_read(struct buf_sock *s)
         return CC_ENOMEM;
     }
 
-    n = h->recv(c, buf->wpos, cap);
+    n = _buf_sock_recv(s, buf->wpos, cap);
     if (n < 0) {
         if (n == CC_EAGAIN) {
             status = CC_OK;
         } else {
             log_info("recv on conn %p returns other error: %d", c, n);
             status = CC_ERROR;
-            c->state = CHANNEL_ERROR;
+            _buf_sock_state(s, CHANNEL_ERROR);
         }
     } else if (n == 0) {
         status = CC_ERDHUP;
-        c->state = CHANNEL_TERM;
+        _buf_sock_state(s, CHANNEL_TERM);
     } else if (n == cap) {
         status = CC_ERETRY;
     } else {
@@ -89,26 +327,25 @@ buf_tcp_read(struct buf_sock *s)
         buf->wpos += n;
         log_verb("recv %zd bytes on conn %p", n, c);
     }
+    _buf_sock_rbuf_idle(s);
 
     return status;
 }
 
 rstatus_i
-buf_tcp_write(struct buf_sock *s)
+buf_sock_send(struct buf_sock *s)
 {
     ASSERT(s != NULL);
 
-    struct tcp_conn *c = (struct tcp_conn *)s->ch;
-    channel_handler_st *h = s->hdl;
+    channel_p c = _buf_sock_ch(s);
     struct buf *buf = s->wbuf;
     rstatus_i status = CC_OK;
     size_t cap;
     ssize_t n;
 
-    ASSERT(c != NULL && h != NULL && buf != NULL);
-    ASSERT(h->send != NULL);
+    ASSERT(c != NULL);
 
-    cap = buf_rsize(buf);
+    cap = buf == NULL ? 0 : buf_rsize(buf);
 
     if (cap == 0) {
         log_verb("no data to send in buf at %p ", buf);
@@ -116,15 +353,21 @@ buf_tcp_write(struct buf_sock *s)
         return CC_EEMPTY;
     }
 
-    n = h->send(c, buf->rpos, cap);
+    if (_buf_sock_tcp(s) && ((struct tcp_conn *)c)->zerocopy) {
+        /* large payloads go out without a copy, pinning wbuf meanwhile */
+        n = tcp_send_zc(c, buf->rpos, cap);
+        tcp_zerocopy_reap(c);
+    } else {
+        n = _buf_sock_send(s, buf->rpos, cap);
+    }
     if (n < 0) {
         if (n == CC_EAGAIN) {
-            log_verb("send on conn returns rescuable error: EAGAIN", c);
+            log_verb("send on conn %p returns rescuable error: EAGAIN", c);
             status = CC_EAGAIN;
         } else {
             log_info("send on conn %p returns other error: %d", c, n);
             status = CC_ERROR;
-            c->state = CHANNEL_ERROR;
+            _buf_sock_state(s, CHANNEL_ERROR);
         }
     } else if ((size_t)n < cap) {
         log_debug("unwritten data remain on conn %p, should retry", c);
@@ -137,23 +380,136 @@ buf_tcp_write(struct buf_sock *s)
         buf->rpos += n;
         log_verb("send %zd bytes on conn %p", n, c);
     }
+    if (status == CC_OK) {
+        _buf_sock_wbuf_idle(s);
+    }
+
+    return status;
+}
+
+uint32_t
+buf_sock_write(struct buf_sock *s, char *src, uint32_t count)
+{
+    uint32_t len = 0;
+
+    ASSERT(s != NULL);
+
+    if (_buf_sock_attach(s, &s->wbuf) != CC_OK) {
+        return 0;
+    }
+
+    /* once data spills into wchain, wbuf is no longer the tail */
+    if (STAILQ_EMPTY(&s->wchain)) {
+        len = buf_write(s->wbuf, src, count);
+    }
+    if (len < count) {
+        len += buf_chain_write(&s->wchain, src + len, count - len);
+    }
+
+    return len;
+}
+
+rstatus_i
+buf_sock_sendv(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    channel_p c = _buf_sock_ch(s);
+    struct iovec iov[CC_IOV_MAX];
+    struct array iova = { CC_IOV_MAX, sizeof(struct iovec), 0, (uint8_t *)iov };
+    struct buf *buf;
+    rstatus_i status = CC_OK;
+    size_t nbyte = 0, total;
+    ssize_t n;
+
+    ASSERT(c != NULL);
+
+    if (s->wbuf == NULL) {
+        log_verb("no data to send in buf_sock %p", s);
+
+        return CC_EEMPTY;
+    }
+
+    if (buf_rsize(s->wbuf) > 0) {
+        iov[iova.nelem].iov_base = s->wbuf->rpos;
+        iov[iova.nelem].iov_len = buf_rsize(s->wbuf);
+        nbyte += iov[iova.nelem++].iov_len;
+    }
+    STAILQ_FOREACH(buf, &s->wchain, next) {
+        if (iova.nelem == CC_IOV_MAX) {
+            break;
+        }
+        if (buf_rsize(buf) > 0) {
+            iov[iova.nelem].iov_base = buf->rpos;
+            iov[iova.nelem].iov_len = buf_rsize(buf);
+            nbyte += iov[iova.nelem++].iov_len;
+        }
+    }
+
+    if (nbyte == 0) {
+        log_verb("no data to send in buf_sock %p", s);
+
+        return CC_EEMPTY;
+    }
+    total = buf_rsize(s->wbuf) + buf_chain_rsize(&s->wchain);
+
+    n = _buf_sock_sendv(s, &iova, nbyte);
+    if (n < 0) {
+        if (n == CC_EAGAIN) {
+            log_verb("sendv on conn %p returns rescuable error: EAGAIN", c);
+            status = CC_EAGAIN;
+        } else {
+            log_info("sendv on conn %p returns other error: %d", c, n);
+            status = CC_ERROR;
+            _buf_sock_state(s, CHANNEL_ERROR);
+        }
+    } else if ((size_t)n < total) {
+        log_debug("unwritten data remain on conn %p, should retry", c);
+        status = CC_ERETRY;
+    } else {
+        status = CC_OK;
+    }
+
+    if (n > 0) {
+        nbyte = MIN((size_t)n, buf_rsize(s->wbuf));
+        s->wbuf->rpos += nbyte;
+        buf_chain_consume(&s->wchain, (uint32_t)(n - nbyte));
+        log_verb("sendv %zd bytes on conn %p", n, c);
+    }
+    if (status == CC_OK) {
+        _buf_sock_wbuf_idle(s);
+    }
 
     return status;
 }
 
+bool
+buf_sock_wbuf_pinned(struct buf_sock *s)
+{
+    ASSERT(s != NULL && s->ch != NULL);
+
+    if (_buf_sock_zerocopy_pending(s) == 0) {
+        return false;
+    }
+
+    return tcp_zerocopy_reap(_buf_sock_ch(s)) > 0;
+}
+
 rstatus_i
-dbuf_tcp_read(struct buf_sock *s)
+dbuf_sock_read(struct buf_sock *s)
 {
     ASSERT(s != NULL);
 
-    struct tcp_conn *c = (struct tcp_conn *)s->ch;
-    channel_handler_st *h = s->hdl;
+    channel_p c = _buf_sock_ch(s);
     rstatus_i status = CC_OK;
     uint32_t cap;
     ssize_t n, total_n = 0;
 
-    ASSERT(c != NULL && h != NULL && s->rbuf != NULL);
-    ASSERT(h->recv != NULL);
+    ASSERT(c != NULL);
+
+    if (_buf_sock_attach(s, &s->rbuf) != CC_OK) {
+        return CC_ENOMEM;
+    }
 
     do {
         /*
@@ -178,7 +534,7 @@ dbuf_tcp_read(struct buf_sock *s)
             cap = buf_wsize(s->rbuf);
         }
 
-        n = h->recv(c, s->rbuf->wpos, cap);
+        n = _buf_sock_recv(s, s->rbuf->wpos, cap);
 
         if (n < 0) {
             if (n == CC_EAGAIN) {
@@ -186,12 +542,12 @@ dbuf_tcp_read(struct buf_sock *s)
             } else {
                 log_info("recv on conn %p returns other error: %d", c, n);
                 status = CC_ERROR;
-                c->state = CHANNEL_ERROR;
+                _buf_sock_state(s, CHANNEL_ERROR);
             }
             goto done;
         } else if (n == 0) {
             status = CC_ERDHUP;
-            c->state = CHANNEL_TERM;
+            _buf_sock_state(s, CHANNEL_TERM);
 
             goto done;
         } else {
@@ -204,6 +560,402 @@ done:
     if (total_n > 0) {
         log_verb("recv %zd bytes on conn %p", total_n, c);
     }
+    _buf_sock_rbuf_idle(s);
+
+    return status;
+}
+
+/**
+ * # bufs to borrow for the next readv, after one that filled all it was given.
+ * The first readv only uses the room at hand, so a small read borrows nothing.
+ * On tcp the kernel tells how much is still queued and just enough bufs for
+ * that are borrowed, on other channels the count doubles each round.
+ */
+static uint32_t
+_buf_sock_readv_nfresh(struct buf_sock *s, uint32_t nfresh)
+{
+    uint32_t cap = buf_init_size - BUF_HDR_SIZE;
+    int nread;
+
+    if (!_buf_sock_tcp(s)) {
+        return nfresh == 0 ? 1 : 2 * nfresh;
+    }
+
+    /* with nothing queued, a buf is still needed to see EAGAIN or EOF */
+    nread = tcp_get_nread(((struct tcp_conn *)_buf_sock_ch(s))->sd);
+    if (nread <= 0) {
+        return 1;
+    }
+
+    return ((uint32_t)nread + cap - 1) / cap;
+}
+
+rstatus_i
+buf_sock_readv(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    channel_p c = _buf_sock_ch(s);
+    struct iovec iov[BUFSOCK_READV_NBUF];
+    struct array iova = { BUFSOCK_READV_NBUF, sizeof(struct iovec), 0,
+        (uint8_t *)iov };
+    struct buf *tail, *buf[BUFSOCK_READV_NBUF];
+    rstatus_i status = CC_OK;
+    uint32_t i, nbuf, nfresh = 0, len;
+    size_t cap, left;
+    ssize_t n, total_n = 0;
+
+    ASSERT(c != NULL);
+
+    if (_buf_sock_attach(s, &s->rbuf) != CC_OK) {
+        return CC_ENOMEM;
+    }
+
+    do {
+        /* only the last buf holding data may take more, to keep the order */
+        tail = STAILQ_EMPTY(&s->rchain) ? s->rbuf :
+            STAILQ_LAST(&s->rchain, buf, next);
+        nbuf = 0;
+        if (buf_wsize(tail) > 0) {
+            buf[nbuf++] = tail;
+        }
+        if (nbuf == 0 && nfresh == 0) {
+            nfresh = 1;
+        }
+        nfresh = MIN(nfresh, BUFSOCK_READV_NBUF - nbuf);
+        for (i = 0; i < nfresh && (buf[nbuf] = buf_borrow()) != NULL; i++) {
+            nbuf++;
+        }
+        if (nbuf == 0) {
+            log_verb("no buf to readv into on buf_sock %p", s);
+            status = CC_ERETRY;
+
+            goto done;
+        }
+
+        cap = 0;
+        for (i = 0; i < nbuf; i++) {
+            iov[i].iov_base = buf[i]->wpos;
+            iov[i].iov_len = buf_wsize(buf[i]);
+            cap += iov[i].iov_len;
+        }
+        iova.nelem = nbuf;
+
+        n = _buf_sock_recvv(s, &iova, cap);
+
+        /* keep the bufs that received data, give back the rest */
+        left = n > 0 ? (size_t)n : 0;
+        for (i = 0; i < nbuf; i++) {
+            len = MIN(left, buf_wsize(buf[i]));
+            buf[i]->wpos += len;
+            left -= len;
+            if (buf[i] == tail) {
+                continue;
+            }
+            if (len > 0) {
+                STAILQ_INSERT_TAIL(&s->rchain, buf[i], next);
+            } else {
+                buf_return(&buf[i]);
+            }
+        }
+
+        if (n < 0) {
+            if (n == CC_EAGAIN) {
+                status = CC_OK;
+            } else {
+                log_info("readv on conn %p returns other error: %d", c, n);
+                status = CC_ERROR;
+                _buf_sock_state(s, CHANNEL_ERROR);
+            }
+            goto done;
+        } else if (n == 0) {
+            status = CC_ERDHUP;
+            _buf_sock_state(s, CHANNEL_TERM);
+
+            goto done;
+        } else {
+            total_n += n;
+            if ((size_t)n == cap) {
+                nfresh = _buf_sock_readv_nfresh(s, nfresh);
+            }
+        }
+    } while ((size_t)n == cap);
+
+done:
+    if (total_n > 0) {
+        log_verb("readv %zd bytes on conn %p", total_n, c);
+    }
+    _buf_sock_rbuf_idle(s);
+
+    return status;
+}
+
+rstatus_i
+buf_sock_coalesce(struct buf_sock *s, uint32_t count)
+{
+    ASSERT(s != NULL);
+
+    struct buf *buf;
+    uint32_t len;
+
+    /* rchain is only ever non-empty with rbuf attached */
+    if (STAILQ_EMPTY(&s->rchain) || buf_rsize(s->rbuf) >= count) {
+        return CC_OK;
+    }
+
+    count = MIN(count, buf_rsize(s->rbuf) + buf_chain_rsize(&s->rchain));
+    if (buf_capacity(s->rbuf) < count) {
+        if (dbuf_fit(&s->rbuf, count) != CC_OK) {
+            log_debug("cannot fit %"PRIu32" bytes in rbuf of buf_sock %p",
+                    count, s);
+
+            return CC_ENOMEM;
+        }
+    } else if ((uint32_t)(s->rbuf->end - s->rbuf->rpos) < count) {
+        buf_lshift(s->rbuf);
+    }
+
+    while (buf_rsize(s->rbuf) < count) {
+        buf = STAILQ_FIRST(&s->rchain);
+        len = MIN(buf_rsize(buf), count - buf_rsize(s->rbuf));
+        buf_write(s->rbuf, buf->rpos, len);
+        buf_chain_consume(&s->rchain, len);
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_tcp_read(struct buf_sock *s)
+{
+    rstatus_i status;
+
+    TRACE_BEGIN(TRACE_BUF_TCP_READ);
+    status = buf_sock_read(s);
+    TRACE_END(TRACE_BUF_TCP_READ);
+
+    return status;
+}
+
+rstatus_i
+buf_tcp_write(struct buf_sock *s)
+{
+    rstatus_i status;
+
+    if (defer) {
+        buf_sock_defer(s);
+        return CC_OK;
+    }
+
+    TRACE_BEGIN(TRACE_BUF_TCP_WRITE);
+    status = buf_sock_send(s);
+    TRACE_END(TRACE_BUF_TCP_WRITE);
+
+    return status;
+}
+
+rstatus_i
+dbuf_tcp_read(struct buf_sock *s)
+{
+    return dbuf_sock_read(s);
+}
+
+rstatus_i
+buf_tcp_readv(struct buf_sock *s)
+{
+    return buf_sock_readv(s);
+}
+
+rstatus_i
+buf_tcp_writev(struct buf_sock *s)
+{
+    if (defer) {
+        buf_sock_defer(s);
+        return CC_OK;
+    }
+
+    return buf_sock_sendv(s);
+}
+
+void
+buf_sock_defer(struct buf_sock *s)
+{
+    ASSERT(s != NULL && !s->free);
+
+    INCR(sockio_metrics, buf_sock_defer);
+    if (s->dirty) {
+        return;
+    }
+
+    TAILQ_INSERT_TAIL(&dirty, s, flush);
+    s->dirty = true;
+}
+
+uint32_t
+buf_sock_flush(buf_sock_flush_fn fn, void *arg)
+{
+    struct buf_sock *s;
+    rstatus_i status;
+    uint32_t n = 0;
+
+    while ((s = TAILQ_FIRST(&dirty)) != NULL) {
+        _buf_sock_clean(s);
+
+        TRACE_BEGIN(TRACE_BUF_TCP_WRITE);
+        status = buf_sock_sendv(s);
+        TRACE_END(TRACE_BUF_TCP_WRITE);
+        if (status == CC_EEMPTY) {
+            continue;
+        }
+        n++;
+        if (status != CC_OK && fn != NULL) {
+            fn(s, status, arg);
+        }
+    }
+    if (n > 0) {
+        log_verb("flushed %"PRIu32" buffered sockets", n);
+        INCR_N(sockio_metrics, buf_sock_flush, n);
+    }
+
+    return n;
+}
+
+void
+buf_sock_set_channel(struct buf_sock *s, channel_p ch, channel_handler_st *hdl)
+{
+    ASSERT(s != NULL);
+    ASSERT(hdl == NULL || (hdl->recv != NULL && hdl->send != NULL));
+    ASSERT(ch == NULL || hdl != NULL);
+
+    s->chan = ch;
+    s->hdl = hdl;
+}
+
+rstatus_i
+buf_tcp_read_submit(struct buf_sock *s, struct event_base *evb)
+{
+    ASSERT(s != NULL && evb != NULL);
+
+    struct tcp_conn *c = _buf_sock_ch(s);
+    struct buf *buf;
+    size_t cap;
+
+    ASSERT(c != NULL);
+    ASSERT(_buf_sock_tcp(s));
+
+    /* a posted recv holds on to rbuf until it completes, even in lazy mode */
+    if (_buf_sock_attach(s, &s->rbuf) != CC_OK) {
+        return CC_ENOMEM;
+    }
+    buf = s->rbuf;
+
+    cap = buf_wsize(buf);
+    if (cap == 0) {
+        return CC_ENOMEM;
+    }
+
+    if (event_recv(evb, c->sd, buf->wpos, cap, s) < 0) {
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_tcp_read_complete(struct buf_sock *s, int res)
+{
+    ASSERT(s != NULL);
+
+    struct tcp_conn *c = _buf_sock_ch(s);
+    struct buf *buf = s->rbuf;
+    rstatus_i status = CC_OK;
+
+    ASSERT(c != NULL && buf != NULL);
+    ASSERT(_buf_sock_tcp(s));
+
+    if (res < 0) {
+        if (res == -EAGAIN || res == -EWOULDBLOCK) {
+            status = CC_OK;
+        } else {
+            log_info("recv on conn %p failed: %s", c, strerror(-res));
+            c->err = -res;
+            c->state = CHANNEL_ERROR;
+            status = CC_ERROR;
+        }
+    } else if (res == 0) {
+        status = CC_ERDHUP;
+        c->state = CHANNEL_TERM;
+    } else {
+        /* rbuf is not touched while the recv is in flight */
+        status = ((size_t)res == buf_wsize(buf)) ? CC_ERETRY : CC_OK;
+        buf->wpos += res;
+        c->recv_nbyte += (size_t)res;
+        log_verb("recv %d bytes on conn %p", res, c);
+    }
+    _buf_sock_rbuf_idle(s);
+
+    return status;
+}
+
+rstatus_i
+buf_tcp_write_submit(struct buf_sock *s, struct event_base *evb)
+{
+    ASSERT(s != NULL && evb != NULL);
+
+    struct tcp_conn *c = _buf_sock_ch(s);
+    struct buf *buf = s->wbuf;
+    size_t cap;
+
+    ASSERT(c != NULL);
+    ASSERT(_buf_sock_tcp(s));
+
+    cap = buf == NULL ? 0 : buf_rsize(buf);
+    if (cap == 0) {
+        log_verb("no data to send in buf at %p ", buf);
+
+        return CC_EEMPTY;
+    }
+
+    if (event_send(evb, c->sd, buf->rpos, cap, s) < 0) {
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_tcp_write_complete(struct buf_sock *s, int res)
+{
+    ASSERT(s != NULL);
+
+    struct tcp_conn *c = _buf_sock_ch(s);
+    struct buf *buf = s->wbuf;
+    rstatus_i status = CC_OK;
+
+    ASSERT(c != NULL && buf != NULL);
+    ASSERT(_buf_sock_tcp(s));
+
+    if (res < 0) {
+        if (res == -EAGAIN || res == -EWOULDBLOCK) {
+            status = CC_EAGAIN;
+        } else {
+            log_info("send on conn %p failed: %s", c, strerror(-res));
+            c->err = -res;
+            c->state = CHANNEL_ERROR;
+            status = CC_ERROR;
+        }
+    } else {
+        if ((size_t)res < buf_rsize(buf)) {
+            log_debug("unwritten data remain on conn %p, should retry", c);
+            status = CC_ERETRY;
+        }
+        buf->rpos += res;
+        c->send_nbyte += (size_t)res;
+        log_verb("send %d bytes on conn %p", res, c);
+    }
+    if (status == CC_OK) {
+        _buf_sock_wbuf_idle(s);
+    }
 
     return status;
 }
@@ -213,7 +965,13 @@ buf_sock_create(void)
 {
     struct buf_sock *s;
 
-    s = (struct buf_sock *)cc_alloc(sizeof(struct buf_sock));
+    s = NULL;
+    if (bsp_slab != NULL) {
+        s = (struct buf_sock *)slab_alloc(bsp_slab);
+    }
+    if (s == NULL) {
+        s = (struct buf_sock *)cc_alloc(sizeof(struct buf_sock));
+    }
     if (s == NULL) {
         INCR(sockio_metrics, buf_sock_create_ex);
         return NULL;
@@ -221,15 +979,24 @@ buf_sock_create(void)
     STAILQ_NEXT(s, next) = NULL;
     s->owner = NULL;
     s->free = false;
+    s->tracked = false;
+    s->dirty = false;
     s->hdl = NULL;
     s->ch = NULL;
+    s->chan = NULL;
     s->rbuf = NULL;
     s->wbuf = NULL;
+    STAILQ_INIT(&s->rchain);
+    STAILQ_INIT(&s->wchain);
+    s->lazy = lazy;
 
     s->ch = tcp_conn_create();
     if (s->ch == NULL) {
         goto error;
     }
+    if (s->lazy) {
+        goto done;
+    }
     s->rbuf = buf_create();
     if (s->rbuf == NULL) {
         goto error;
@@ -239,6 +1006,9 @@ buf_sock_create(void)
         goto error;
     }
 
+done:
+    TAILQ_INSERT_TAIL(&live, s, live);
+    s->tracked = true;
     INCR(sockio_metrics, buf_sock_create);
     INCR(sockio_metrics, buf_sock_curr);
 
@@ -263,10 +1033,26 @@ buf_sock_destroy(struct buf_sock **s)
 
     log_verb("destroy buffered socket %p", *s);
 
+    if ((*s)->tracked) {
+        TAILQ_REMOVE(&live, *s, live);
+    }
+    _buf_sock_clean(*s);
+    _buf_sock_unpin(*s, false);
     tcp_conn_destroy(&(*s)->ch);
-    buf_destroy(&(*s)->rbuf);
-    buf_destroy(&(*s)->wbuf);
-    cc_free(*s);
+    buf_chain_return(&(*s)->rchain);
+    buf_chain_return(&(*s)->wchain);
+    if ((*s)->lazy) {
+        _buf_sock_detach(*s, &(*s)->rbuf);
+        _buf_sock_detach(*s, &(*s)->wbuf);
+    } else {
+        buf_destroy(&(*s)->rbuf);
+        buf_destroy(&(*s)->wbuf);
+    }
+    if (slab_owns(bsp_slab, *s)) {
+        slab_free(bsp_slab, *s);
+    } else {
+        cc_free(*s);
+    }
 
     *s = NULL;
     INCR(sockio_metrics, buf_sock_destroy);
@@ -287,11 +1073,20 @@ buf_sock_pool_destroy(void)
     log_info("destroying buffered socket pool: free %"PRIu32, bsp.nfree);
 
     FREEPOOL_DESTROY(s, ts, &bsp, next, buf_sock_destroy);
+    if (bsp_slab != NULL) {
+        if (bsp_slab->nused > 0) {
+            log_warn("%"PRIu32" slab buffered sockets outstanding, leaking "
+                    "slab", bsp_slab->nused);
+            bsp_slab = NULL;
+        } else {
+            slab_destroy(&bsp_slab);
+        }
+    }
     bsp_init = false;
 }
 
 static void
-buf_sock_pool_create(uint32_t max)
+buf_sock_pool_create(uint32_t max, bool poolslab, uint32_t low, uint32_t high)
 {
     struct buf_sock *s;
 
@@ -304,8 +1099,18 @@ buf_sock_pool_create(uint32_t max)
     log_info("creating buffered socket pool: max %"PRIu32, max);
 
     FREEPOOL_CREATE(&bsp, max);
+    FREEPOOL_WATERMARK(&bsp, low, high);
     bsp_init = true;
 
+    if (poolslab && max > 0) {
+        bsp_slab = slab_create(BUFSOCK_SLOT, slab_region_fit(BUFSOCK_SLOT,
+                max), max);
+        if (bsp_slab == NULL || slab_reserve(bsp_slab, max) != CC_OK) {
+            log_crit("cannot map buffered socket pool slab due to OOM, abort");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* preallocating, see notes in cc_buf.c */
     FREEPOOL_PREALLOC(s, &bsp, max, next, buf_sock_create);
     if (bsp.nfree < max) {
@@ -317,20 +1122,59 @@ buf_sock_pool_create(uint32_t max)
 void
 buf_sock_reset(struct buf_sock *s)
 {
-    ASSERT(s->rbuf != NULL && s->wbuf != NULL);
+    ASSERT(s->lazy || (s->rbuf != NULL && s->wbuf != NULL));
 
     log_verb("reset buffered socket %p", s);
 
+    _buf_sock_unpin(s, true);
     STAILQ_NEXT(s, next) = NULL;
     s->owner = NULL;
     s->free = false;
     s->flag = 0;
     s->data = NULL;
     s->hdl = NULL;
+    s->chan = NULL;
+    _buf_sock_clean(s);
 
     tcp_conn_reset(s->ch);
-    buf_reset(s->rbuf);
-    buf_reset(s->wbuf);
+    buf_chain_return(&s->rchain);
+    buf_chain_return(&s->wchain);
+    if (s->lazy) {
+        _buf_sock_detach(s, &s->rbuf);
+        _buf_sock_detach(s, &s->wbuf);
+    } else {
+        buf_reset(s->rbuf);
+        buf_reset(s->wbuf);
+    }
+}
+
+struct buf *
+buf_sock_rbuf(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    _buf_sock_attach(s, &s->rbuf);
+
+    return s->rbuf;
+}
+
+struct buf *
+buf_sock_wbuf(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    _buf_sock_attach(s, &s->wbuf);
+
+    return s->wbuf;
+}
+
+void
+buf_sock_release(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    _buf_sock_rbuf_idle(s);
+    _buf_sock_wbuf_idle(s);
 }
 
 struct buf_sock *
@@ -363,18 +1207,89 @@ buf_sock_return(struct buf_sock **s)
 
     log_verb("return buffered socket %p", *s);
 
+    _buf_sock_clean(*s);
+    _buf_sock_unpin(*s, true);
+    /* chained and lazy bufs go back to the buf pool rather than idling here */
+    buf_chain_return(&(*s)->rchain);
+    buf_chain_return(&(*s)->wchain);
+    if ((*s)->lazy) {
+        _buf_sock_detach(*s, &(*s)->rbuf);
+        _buf_sock_detach(*s, &(*s)->wbuf);
+    }
     (*s)->free = true;
-    FREEPOOL_RETURN(*s, &bsp, next);
+    FREEPOOL_RELEASE(*s, &bsp, next, buf_sock_destroy);
 
     *s = NULL;
     INCR(sockio_metrics, buf_sock_return);
     DECR(sockio_metrics, buf_sock_active);
 }
 
+void
+buf_sock_trim(void *arg)
+{
+    struct buf_sock *s;
+    uint32_t nfree = bsp.nfree;
+
+    (void)arg;
+
+    if (!bsp_init) {
+        return;
+    }
+
+    FREEPOOL_TRIM(s, &bsp, next, buf_sock_destroy);
+    if (nfree > bsp.nfree) {
+        log_verb("trimmed %"PRIu32" free buffered sockets", nfree - bsp.nfree);
+        INCR_N(sockio_metrics, buf_sock_trim, nfree - bsp.nfree);
+    }
+}
+
+void
+buf_sock_foreach(buf_sock_each_fn fn, void *arg)
+{
+    struct buf_sock *s, *ts;
+
+    ASSERT(fn != NULL);
+
+    TAILQ_FOREACH_SAFE(s, &live, live, ts) {
+        if (!s->free) {
+            fn(s, arg);
+        }
+    }
+}
+
+static uint32_t
+_buf_chain_size(const struct buf_sqh *chain)
+{
+    struct buf *b;
+    uint32_t size = 0;
+
+    STAILQ_FOREACH(b, chain, next) {
+        size += buf_size(b);
+    }
+
+    return size;
+}
+
+size_t
+buf_sock_memory(const struct buf_sock *s)
+{
+    size_t size = sizeof(*s) + sizeof(*s->ch);
+
+    ASSERT(s != NULL);
+
+    size += s->rbuf == NULL ? 0 : buf_size(s->rbuf);
+    size += s->wbuf == NULL ? 0 : buf_size(s->wbuf);
+
+    return size + _buf_chain_size(&s->rchain) + _buf_chain_size(&s->wchain);
+}
+
 void
 sockio_setup(sockio_options_st *options, sockio_metrics_st *metrics)
 {
     uint32_t max = BUFSOCK_POOLSIZE;
+    bool poolslab = BUFSOCK_POOLSLAB;
+    uint32_t low = BUFSOCK_POOL_LOW;
+    uint32_t high = BUFSOCK_POOL_HIGH;
 
     log_info("set up the %s module", SOCKIO_MODULE_NAME);
 
@@ -386,14 +1301,33 @@ sockio_setup(sockio_options_st *options, sockio_metrics_st *metrics)
 
     if (options != NULL) {
         max = option_uint(&options->buf_sock_poolsize);
+        poolslab = option_bool(&options->buf_sock_poolslab);
+        lazy = option_bool(&options->buf_sock_lazy);
+        defer = option_bool(&options->buf_sock_defer);
+        low = option_uint(&options->buf_sock_pool_low);
+        high = option_uint(&options->buf_sock_pool_high);
     }
 
-    buf_sock_pool_create(max);
+    buf_sock_pool_create(max, poolslab, low, high);
     sockio_init = true;
 }
 
 void
 sockio_teardown(void)
 {
+    struct buf_sock *s;
+
     buf_sock_pool_destroy();
+    lazy = BUFSOCK_LAZY;
+    defer = BUFSOCK_DEFER;
+
+    while ((s = TAILQ_FIRST(&dirty)) != NULL) {
+        _buf_sock_clean(s);
+    }
+
+    /* buf_socks outliving the module are dropped from the list */
+    while ((s = TAILQ_FIRST(&live)) != NULL) {
+        TAILQ_REMOVE(&live, s, live);
+        s->tracked = false;
+    }
 }
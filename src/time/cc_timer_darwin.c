@@ -2,6 +2,7 @@
 
 #include <cc_debug.h>
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <mach/mach_time.h>
 
@@ -15,8 +16,70 @@
  * this function, and the value should never be used directly as physical time.
  */
 
+#define TIMER_MODULE_NAME "ccommon::timer"
+
 static mach_timebase_info_data_t info;
 
+static bool timer_init = false;
+static bool cache = TIMER_CACHE;
+static __thread int64_t cached_mt = -1; /* never refreshed on this thread */
+
+/* now as seen by timeouts, which may be the cached value */
+static inline uint64_t
+_timeout_now(void)
+{
+    if (cache && cached_mt >= 0) {
+        return (uint64_t)cached_mt;
+    }
+
+    return mach_absolute_time();
+}
+
+void
+timer_cache_update(void)
+{
+    if (cache) {
+        cached_mt = (int64_t)mach_absolute_time();
+    }
+}
+
+void
+timer_setup(timer_options_st *options)
+{
+    log_info("set up the %s module", TIMER_MODULE_NAME);
+
+    if (timer_init) {
+        log_warn("%s has already been setup, overwrite", TIMER_MODULE_NAME);
+    }
+
+    /* there is only one clock to pick from, mach_absolute_time */
+    cache = TIMER_CACHE;
+    if (options != NULL) {
+        if (option_uint(&options->timer_clock) != TIMER_CLOCK) {
+            log_warn("timer clock %"PRIuMAX" not available, use default",
+                    option_uint(&options->timer_clock));
+        }
+        cache = option_bool(&options->timer_cache);
+    }
+
+    timer_init = true;
+}
+
+void
+timer_teardown(void)
+{
+    log_info("tear down the %s module", TIMER_MODULE_NAME);
+
+    if (!timer_init) {
+        log_warn("%s has never been setup", TIMER_MODULE_NAME);
+    }
+
+    cache = TIMER_CACHE;
+    cached_mt = -1;
+
+    timer_init = false;
+}
+
 /* nanosecond-to-mach-time conversion */
 static inline int64_t
 _n2m(int64_t nano)
@@ -129,7 +192,7 @@ timeout_reset(struct timeout *e)
 void
 timeout_add_ns(struct timeout *e, uint64_t ns)
 {
-    uint64_t now = mach_absolute_time();
+    uint64_t now = _timeout_now();
 
     e->tp = now + _n2m(ns);
     e->is_set = true;
@@ -220,7 +283,7 @@ timeout_ns(struct timeout *e)
     if (e->is_intvl) {
         return _m2n(e->tp);
     } else {
-        uint64_t now = mach_absolute_time();
+        uint64_t now = _timeout_now();
 
         return _m2n(e->tp - now);
     }
@@ -259,7 +322,7 @@ timeout_timespec(struct timespec *ts, struct timeout *e)
 bool
 timeout_expired(struct timeout *e)
 {
-    uint64_t now = mach_absolute_time();
+    uint64_t now = _timeout_now();
 
     ASSERT(!e->is_intvl);
 
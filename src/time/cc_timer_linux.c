@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <float.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -26,15 +27,24 @@
  * monotonic, and should be avoided if possible.
  */
 #if defined(CLOCK_MONOTONIC_RAW)
-static const clockid_t cid = CLOCK_MONOTONIC_RAW;
+#define CID_DEFAULT CLOCK_MONOTONIC_RAW
 #elif defined(CLOCK_MONOTONIC)
-static const clockid_t cid = CLOCK_MONOTONIC;
+#define CID_DEFAULT CLOCK_MONOTONIC
 #elif defined(CLOCK_REALTIME)
-static const clockid_t cid = CLOCK_REALTIME;
+#define CID_DEFAULT CLOCK_REALTIME
 #else
-static const clockid_t cid = (clockid_t)-1;
+#define CID_DEFAULT ((clockid_t)-1)
 #endif
 
+#define TIMER_MODULE_NAME "ccommon::timer"
+
+static clockid_t cid = CID_DEFAULT;
+static bool timer_init = false;
+static bool cache = TIMER_CACHE;
+static uint32_t cache_gen = 0; /* bumped by setup/teardown, for all threads */
+static __thread int64_t cached_ns = -1; /* never refreshed on this thread */
+static __thread uint32_t cached_gen;
+
 static inline void
 _gettime(struct timespec *ts)
 {
@@ -158,6 +168,85 @@ _now_ns(void)
 
 }
 
+/* now as seen by timeouts, which may be the cached value */
+static inline uint64_t
+_timeout_now_ns(void)
+{
+    if (cache && cached_ns >= 0 &&
+            cached_gen == __atomic_load_n(&cache_gen, __ATOMIC_RELAXED)) {
+        return (uint64_t)cached_ns;
+    }
+
+    return _now_ns();
+}
+
+void
+timer_cache_update(void)
+{
+    if (cache) {
+        cached_gen = __atomic_load_n(&cache_gen, __ATOMIC_RELAXED);
+        cached_ns = (int64_t)_now_ns();
+    }
+}
+
+void
+timer_setup(timer_options_st *options)
+{
+    uintmax_t clock = TIMER_CLOCK;
+
+    log_info("set up the %s module", TIMER_MODULE_NAME);
+
+    if (timer_init) {
+        log_warn("%s has already been setup, overwrite", TIMER_MODULE_NAME);
+    }
+
+    cache = TIMER_CACHE;
+    if (options != NULL) {
+        clock = option_uint(&options->timer_clock);
+        cache = option_bool(&options->timer_cache);
+    }
+
+    switch (clock) {
+    case TIMER_CLOCK_RAW:
+        cid = CID_DEFAULT;
+        break;
+#ifdef CLOCK_MONOTONIC
+    case TIMER_CLOCK_MONO:
+        cid = CLOCK_MONOTONIC;
+        break;
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+    case TIMER_CLOCK_COARSE:
+        cid = CLOCK_MONOTONIC_COARSE;
+        break;
+#endif
+    default:
+        log_warn("timer clock %"PRIuMAX" not available, use default", clock);
+        cid = CID_DEFAULT;
+    }
+    /* drop the now cached by any thread until it refreshes again */
+    __atomic_add_fetch(&cache_gen, 1, __ATOMIC_RELAXED);
+
+    timer_init = true;
+}
+
+void
+timer_teardown(void)
+{
+    log_info("tear down the %s module", TIMER_MODULE_NAME);
+
+    if (!timer_init) {
+        log_warn("%s has never been setup", TIMER_MODULE_NAME);
+    }
+
+    cid = CID_DEFAULT;
+    cache = TIMER_CACHE;
+    cached_ns = -1;
+    __atomic_add_fetch(&cache_gen, 1, __ATOMIC_RELAXED);
+
+    timer_init = false;
+}
+
 void
 timeout_reset(struct timeout *e)
 {
@@ -171,7 +260,7 @@ timeout_reset(struct timeout *e)
 void
 timeout_add_ns(struct timeout *e, uint64_t ns)
 {
-    e->tp = (int64_t)_now_ns() + ns;
+    e->tp = (int64_t)_timeout_now_ns() + ns;
     e->is_set = true;
     e->is_intvl = false;
 }
@@ -254,7 +343,7 @@ timeout_ns(struct timeout *e)
     if (e->is_intvl) {
         return e->tp;
     } else {
-        return e->tp - _now_ns();
+        return e->tp - _timeout_now_ns();
     }
 }
 
@@ -298,7 +387,7 @@ timeout_expired(struct timeout *e)
         return false;
     }
 
-    now_nano = (int64_t)_now_ns();
+    now_nano = (int64_t)_timeout_now_ns();
 
     if (now_nano >= e->tp) {
         return true;
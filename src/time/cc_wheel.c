@@ -4,8 +4,11 @@
 #include <cc_metric.h>
 #include <cc_mm.h>
 #include <cc_pool.h>
+#include <cc_probe.h>
 
+#include <limits.h>
 #include <stdlib.h>
+#include <sys/param.h>
 
 #define TIMING_WHEEL_MODULE_NAME "ccommon::timing_wheel"
 
@@ -16,8 +19,11 @@ struct timeout_event {
     bool                        recur;  /* will be reinserted upon firing */
     struct timeout              delay;  /* delay */
     /* the following is set internally */
+    uint64_t                    expire; /* absolute tick it is due */
     size_t                      offset; /* bucket offset in the timing wheel */
+    size_t                      level;  /* level of the bucket */
     bool                        free;   /* is this object free to reuse? */
+    uint32_t                    gen;    /* bumped every time it is returned */
     TAILQ_ENTRY(timeout_event)  tqe;    /* entry in the wheel TAILQ */
     STAILQ_ENTRY(timeout_event) next;   /* next timeout_event in pool */
 };
@@ -26,8 +32,17 @@ STAILQ_HEAD(tevent_sqh, timeout_event); /* corresponding header type for the STA
 TAILQ_HEAD(tevent_tqh, timeout_event);  /* head type for timeout events */
 
 FREEPOOL(tevent_pool, teventq, timeout_event);
-static struct tevent_pool teventp;
-static bool teventp_init = false;
+
+/* a request posted to a wheel by a thread other than its owner */
+struct tevent_mail {
+    struct tevent_mail          *next;
+    struct timeout_event        *tev;   /* event to remove, NULL to insert */
+    uint32_t                    gen;    /* generation of tev when posted */
+    struct timeout              delay;
+    bool                        recur;
+    timeout_cb_fn               cb;
+    void                        *data;
+};
 
 static timing_wheel_metrics_st *timing_wheel_metrics = NULL;
 static bool timing_wheel_init = false;
@@ -43,7 +58,9 @@ timeout_event_reset(struct timeout_event *t)
     t->data = NULL;
     t->recur = false;
     timeout_reset(&t->delay);
+    t->expire = 0;
     t->offset = 0;
+    t->level = 0;
     t->free = false;
     /* queue-related members are set/cleared by timing wheel ops */
 }
@@ -59,6 +76,7 @@ timeout_event_create(void)
     }
 
     timeout_event_reset(t);
+    t->gen = 0;
     INCR(timing_wheel_metrics, timeout_event_curr);
     log_verb("created timeout_event %p", t);
 
@@ -80,11 +98,11 @@ timeout_event_destroy(struct timeout_event **t)
 }
 
 static struct timeout_event *
-timeout_event_borrow(void)
+timeout_event_borrow(struct tevent_pool *pool)
 {
     struct timeout_event *t;
 
-    FREEPOOL_BORROW(t, &teventp, next, timeout_event_create);
+    FREEPOOL_BORROW(t, pool, next, timeout_event_create);
 
     if (t == NULL) {
         log_debug("borrow timeout_event failed: OOM or over limit");
@@ -103,7 +121,7 @@ timeout_event_borrow(void)
 }
 
 static void
-timeout_event_return(struct timeout_event **t)
+timeout_event_return(struct tevent_pool *pool, struct timeout_event **t)
 {
     if (t == NULL || *t == NULL || (*t)->free) {
         return;
@@ -112,52 +130,49 @@ timeout_event_return(struct timeout_event **t)
     log_verb("return timeout_event %p", *t);
 
     (*t)->free = true;
-    FREEPOOL_RETURN(*t, &teventp, next);
+    /* invalidates removals still in flight from other threads */
+    __atomic_add_fetch(&(*t)->gen, 1, __ATOMIC_RELEASE);
+    FREEPOOL_RETURN(*t, pool, next);
     *t = NULL;
 
     INCR(timing_wheel_metrics, timeout_event_return);
     DECR(timing_wheel_metrics, timeout_event_active);
 }
 
-static void
+static struct tevent_pool *
 timeout_event_pool_create(uint32_t max)
 {
+    struct tevent_pool *pool;
     struct timeout_event *t;
 
-    if (teventp_init) {
-        log_warn("timeout_event pool has already been created, ignore");
-
-        return;
+    pool = (struct tevent_pool *)cc_zalloc(sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
     }
 
     log_info("creating timeout_event pool: max %"PRIu32, max);
 
-    FREEPOOL_CREATE(&teventp, max);
-    teventp_init = true;
+    FREEPOOL_CREATE(pool, max);
 
     /* preallocating, see notes in buffer/cc_buf.c */
-    FREEPOOL_PREALLOC(t, &teventp, max, next, timeout_event_create);
-    if (teventp.nfree < max) {
+    FREEPOOL_PREALLOC(t, pool, max, next, timeout_event_create);
+    if (pool->nfree < max) {
         log_crit("cannot preallocate timeout_event pool due to OOM, abort");
         exit(EXIT_FAILURE);
     }
+
+    return pool;
 }
 
 static void
-timeout_event_pool_destroy(void)
+timeout_event_pool_destroy(struct tevent_pool **pool)
 {
     struct timeout_event *t, *tt;
 
-    if (!teventp_init) {
-        log_warn("timeout_event pool was never created, ignore");
+    log_info("destroying timeout_event pool: free %"PRIu32, (*pool)->nfree);
 
-        return;
-    }
-
-    log_info("destroying timeout_event pool: free %"PRIu32, teventp.nfree);
-
-    FREEPOOL_DESTROY(t, tt, &teventp, next, timeout_event_destroy);
-    teventp_init = false;
+    FREEPOOL_DESTROY(t, tt, *pool, next, timeout_event_destroy);
+    cc_free(*pool);
 }
 
 
@@ -175,8 +190,6 @@ timing_wheel_setup(timing_wheel_metrics_st *metrics)
 
     timing_wheel_metrics = metrics;
 
-    timeout_event_pool_create(0); /* TODO(yao): add an option to set this */
-
     timing_wheel_init = true;
 }
 
@@ -189,7 +202,6 @@ timing_wheel_teardown(void)
         log_warn("%s has never been setup", TIMING_WHEEL_MODULE_NAME);
     }
 
-    timeout_event_pool_destroy();
     timing_wheel_metrics = NULL;
 
     timing_wheel_init = false;
@@ -198,11 +210,36 @@ timing_wheel_teardown(void)
 struct timing_wheel *
 timing_wheel_create(struct timeout *tick, size_t cap, size_t ntick)
 {
-    struct timing_wheel *tw = (struct timing_wheel *)cc_alloc(sizeof(*tw));
+    return timing_wheel_create_levels(tick, cap, ntick, 1);
+}
+
+struct timing_wheel *
+timing_wheel_create_levels(struct timeout *tick, size_t cap, size_t ntick,
+        size_t nlevel)
+{
+    struct timing_wheel *tw;
+    uint64_t span = 1;
 
     ASSERT(tick != NULL);
     ASSERT(cap > 0);
 
+    if (nlevel == 0 || nlevel > TIMING_WHEEL_NLEVEL_MAX) {
+        log_error("timing_wheel creation failed: %zu levels not in [1, %d]",
+                nlevel, TIMING_WHEEL_NLEVEL_MAX);
+
+        return NULL;
+    }
+    for (size_t i = 0; i < nlevel; i++) {
+        if (span > UINT64_MAX / cap) {
+            log_error("timing_wheel creation failed: %zu levels of %zu slots "
+                    "overflow", nlevel, cap);
+
+            return NULL;
+        }
+        span *= cap;
+    }
+
+    tw = (struct timing_wheel *)cc_alloc(sizeof(*tw));
     if (tw == NULL) {
         log_error("timing_wheel creation failed due to OOM");
 
@@ -213,49 +250,167 @@ timing_wheel_create(struct timeout *tick, size_t cap, size_t ntick)
     tw->tick_ns = timeout_ns(tick);
     tw->cap = cap;
     tw->max_ntick = ntick; /* if ntick is 0, there's no limit */
+    tw->nlevel = nlevel;
+    tw->span = span;
     tw->active = false;
     timeout_reset(&tw->due);
     tw->curr = 0;
+    tw->now = 0;
     tw->nevent = 0;
 
-    tw->table = (struct tevent_tqh *)cc_alloc(cap * sizeof(struct tevent_tqh));
+    tw->table = (struct tevent_tqh *)cc_alloc(nlevel * cap *
+            sizeof(struct tevent_tqh));
     if (tw->table == NULL) {
         log_error("timing_wheel creation failed due to table allocation OOM");
         cc_free(tw);
 
         return NULL;
     }
-    for (size_t i = 0; i < cap; i++) {
+    for (size_t i = 0; i < nlevel * cap; i++) {
         TAILQ_INIT(&tw->table[i]);
     }
 
+    tw->nword = (cap + 63) / 64;
+    tw->bitmap = (uint64_t *)cc_zalloc(nlevel * tw->nword * sizeof(uint64_t));
+    if (tw->bitmap == NULL) {
+        log_error("timing_wheel creation failed due to bitmap allocation OOM");
+        cc_free(tw->table);
+        cc_free(tw);
+
+        return NULL;
+    }
+
+    /* TODO(yao): add an option to set the pool size */
+    tw->pool = timeout_event_pool_create(0);
+    if (tw->pool == NULL) {
+        log_error("timing_wheel creation failed due to event pool OOM");
+        cc_free(tw->bitmap);
+        cc_free(tw->table);
+        cc_free(tw);
+
+        return NULL;
+    }
+    tw->mailbox = NULL;
+
     tw->nprocess = 0;
     tw->ntick = 0;
     tw->nexec = 0;
 
-    log_info("created timing_wheel %p", tw);
+    log_info("created timing_wheel %p: %zu levels of %zu slots", tw, nlevel,
+            cap);
 
     return tw;
 }
 
-void
-timing_wheel_destroy(struct timing_wheel **tw)
+static inline size_t
+_offset(struct timing_wheel *tw, struct timeout *delay) {
+    uint64_t delay_ns = (uint64_t)timeout_ns(delay);
+
+    return (delay_ns == 0) ? 0 : (delay_ns - 1) / tw->tick_ns + 1;
+}
+
+/*
+ * pick the bucket for an event due at absolute tick `expire': the lowest
+ * level whose range covers the distance from the current tick
+ */
+static inline void
+_slot(struct timing_wheel *tw, struct timeout_event *tev, uint64_t expire)
 {
-    struct timing_wheel *w = *tw;
+    uint64_t delta = expire - tw->now, unit = 1, range = tw->cap;
+    size_t level = 0;
 
-    log_info("destroying timing_wheel %p", w);
+    ASSERT(expire >= tw->now && delta < tw->span);
 
-    cc_free(w->table);
-    cc_free(w);
+    while (delta >= range) {
+        level++;
+        unit = range;
+        range *= tw->cap;
+    }
 
-    *tw = NULL;
+    tev->expire = expire;
+    tev->level = level;
+    tev->offset = (expire / unit) % tw->cap;
+}
+
+static inline struct tevent_tqh *
+_bucket(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    return &tw->table[tev->level * tw->cap + tev->offset];
+}
+
+static inline uint64_t *
+_word(struct timing_wheel *tw, size_t level, size_t offset)
+{
+    return &tw->bitmap[level * tw->nword + offset / 64];
+}
+
+/* queue ops on buckets, keeping the bitmap of non-empty slots in sync */
+static inline void
+_link(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    TAILQ_INSERT_TAIL(_bucket(tw, tev), tev, tqe);
+    *_word(tw, tev->level, tev->offset) |= 1ULL << (tev->offset % 64);
+}
+
+static inline void
+_unlink(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    TAILQ_REMOVE(_bucket(tw, tev), tev, tqe);
+    if (TAILQ_EMPTY(_bucket(tw, tev))) {
+        *_word(tw, tev->level, tev->offset) &= ~(1ULL << (tev->offset % 64));
+    }
 }
 
+/* # slots from level 0 slot `from' to the next non-empty one, cap if none */
 static inline size_t
-_offset(struct timing_wheel *tw, struct timeout *delay) {
-    uint64_t delay_ns = (uint64_t)timeout_ns(delay);
+_next_slot(struct timing_wheel *tw, size_t from)
+{
+    uint64_t w;
+    size_t i, idx;
+
+    for (i = 0; i <= tw->nword; i++) {
+        idx = (from / 64 + i) % tw->nword;
+        w = tw->bitmap[idx];
+        if (i == 0) {
+            w &= ~0ULL << (from % 64);
+        } else if (i == tw->nword) { /* wrapped around, bits before from */
+            w &= (from % 64 == 0) ? 0 : ~0ULL >> (64 - from % 64);
+        }
+        if (w != 0) {
+            idx = idx * 64 + (size_t)__builtin_ctzll(w);
+            return (idx + tw->cap - from) % tw->cap;
+        }
+    }
 
-    return (delay_ns == 0) ? 0 : (delay_ns - 1) / tw->tick_ns + 1;
+    return tw->cap;
+}
+
+static inline bool
+_upper_empty(struct timing_wheel *tw)
+{
+    for (size_t i = tw->nword; i < tw->nlevel * tw->nword; i++) {
+        if (tw->bitmap[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * # ticks from the current one to the next that needs processing: one with
+ * events on level 0, or the wrap-around of level 0 that cascades upper levels
+ */
+static inline size_t
+_next_tick(struct timing_wheel *tw)
+{
+    size_t n = _next_slot(tw, tw->curr);
+
+    if (!_upper_empty(tw)) {
+        n = MIN(n, (tw->cap - tw->curr) % tw->cap);
+    }
+
+    return n;
 }
 
 /**
@@ -266,7 +421,7 @@ _offset(struct timing_wheel *tw, struct timeout *delay) {
 static void
 _timing_wheel_insert(struct timing_wheel *tw, struct timeout_event *tev)
 {
-    TAILQ_INSERT_TAIL(&tw->table[tev->offset], tev, tqe);
+    _link(tw, tev);
     tw->nevent++;
 
     INCR(timing_wheel_metrics, timing_wheel_insert);
@@ -283,7 +438,7 @@ timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
     ASSERT(tw != NULL && delay != NULL && cb != NULL);
     ASSERT(delay->is_intvl);
 
-    tev = timeout_event_borrow();
+    tev = timeout_event_borrow(tw->pool);
     if (tev == NULL) {
         log_error("cannot create allocate timeout events due to OOM");
         goto error;
@@ -294,10 +449,10 @@ timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
     tev->delay = *delay;
 
     offset = _offset(tw, delay);
-    if (offset >= tw->cap) { /* wraps around */
+    if (offset >= tw->span) { /* wraps around */
         log_error("insert timeout event into timing wheel failed: timeout "
                 "%"PRIi64"ns too long for wheel capacity %"PRIu64"ns",
-                timeout_ns(delay), tw->tick_ns * tw->cap);
+                timeout_ns(delay), tw->tick_ns * tw->span);
         goto error;
     }
     if (recur && offset == 0) {
@@ -306,15 +461,16 @@ timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
         goto error;
     }
 
-    tev->offset = (tw->curr + offset) % tw->cap; /* convert to absolute offset */
+    _slot(tw, tev, tw->now + offset); /* convert to absolute offset */
     log_verb("inserting timeout event %p into timing wheel %p: curr tick %zu, "
-            "scheduled offset %zu", tev, tw, tw->curr, tev->offset);
+            "scheduled offset %zu level %zu", tev, tw, tw->curr, tev->offset,
+            tev->level);
     _timing_wheel_insert(tw, tev);
 
     return tev;
 
 error:
-    timeout_event_return(&tev);
+    timeout_event_return(tw->pool, &tev);
 
     return NULL;
 }
@@ -324,7 +480,7 @@ _timing_wheel_remove(struct timing_wheel *tw, struct timeout_event *tev)
 {
     ASSERT(tw != NULL && tev != NULL);
 
-    TAILQ_REMOVE(&tw->table[tev->offset], tev, tqe);
+    _unlink(tw, tev);
     tw->nevent--;
 
     INCR(timing_wheel_metrics, timing_wheel_remove);
@@ -339,7 +495,165 @@ timing_wheel_remove(struct timing_wheel *tw, struct timeout_event **tev)
             "scheduled offset %zu", *tev, tw, tw->curr, (*tev)->offset);
 
     _timing_wheel_remove(tw, *tev);
-    timeout_event_return(tev);
+    timeout_event_return(tw->pool, tev);
+}
+
+void
+timing_wheel_destroy(struct timing_wheel **tw)
+{
+    struct timing_wheel *w = *tw;
+    struct timeout_event *t, *tt;
+    struct tevent_mail *m;
+
+    log_info("destroying timing_wheel %p", w);
+
+    /* requests nobody is going to act on, and events that never fired */
+    while ((m = w->mailbox) != NULL) {
+        w->mailbox = m->next;
+        cc_free(m);
+    }
+    for (size_t i = 0; i < w->nlevel * w->cap; i++) {
+        TAILQ_FOREACH_SAFE(t, &w->table[i], tqe, tt) {
+            _timing_wheel_remove(w, t);
+            timeout_event_return(w->pool, &t);
+        }
+    }
+    timeout_event_pool_destroy(&w->pool);
+
+    cc_free(w->bitmap);
+    cc_free(w->table);
+    cc_free(w);
+
+    *tw = NULL;
+}
+
+rstatus_i
+timing_wheel_reschedule(struct timing_wheel *tw, struct timeout_event *tev,
+        struct timeout *delay)
+{
+    size_t offset;
+
+    ASSERT(tw != NULL && tev != NULL && delay != NULL);
+    ASSERT(delay->is_intvl);
+
+    offset = _offset(tw, delay);
+    if (offset >= tw->span || (tev->recur && offset == 0)) {
+        log_error("reschedule timeout event %p failed: timeout %"PRIi64"ns "
+                "out of range", tev, timeout_ns(delay));
+
+        return CC_EINVAL;
+    }
+
+    _unlink(tw, tev);
+    tev->delay = *delay;
+    _slot(tw, tev, tw->now + offset);
+    _link(tw, tev);
+
+    log_verb("rescheduled timeout event %p in timing wheel %p: scheduled "
+            "offset %zu level %zu", tev, tw, tev->offset, tev->level);
+    INCR(timing_wheel_metrics, timing_wheel_reschedule);
+
+    return CC_OK;
+}
+
+void
+timing_wheel_touch(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    ASSERT(tw != NULL && tev != NULL);
+
+    /* the bucket is left alone, _process_bucket moves the event when due */
+    tev->expire = tw->now + _offset(tw, &tev->delay);
+    INCR(timing_wheel_metrics, timing_wheel_reschedule);
+}
+
+static rstatus_i
+_post(struct timing_wheel *tw, struct tevent_mail *m)
+{
+    if (m == NULL) {
+        INCR(timing_wheel_metrics, timing_wheel_post_ex);
+
+        return CC_ENOMEM;
+    }
+
+    m->next = __atomic_load_n(&tw->mailbox, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&tw->mailbox, &m->next, m, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    INCR(timing_wheel_metrics, timing_wheel_post);
+
+    return CC_OK;
+}
+
+rstatus_i
+timing_wheel_post_insert(struct timing_wheel *tw, struct timeout *delay,
+        bool recur, timeout_cb_fn cb, void *arg)
+{
+    struct tevent_mail *m;
+
+    ASSERT(tw != NULL && delay != NULL && cb != NULL);
+
+    m = (struct tevent_mail *)cc_alloc(sizeof(*m));
+    if (m != NULL) {
+        m->tev = NULL;
+        m->gen = 0;
+        m->delay = *delay;
+        m->recur = recur;
+        m->cb = cb;
+        m->data = arg;
+    }
+
+    return _post(tw, m);
+}
+
+rstatus_i
+timing_wheel_post_remove(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    struct tevent_mail *m;
+
+    ASSERT(tw != NULL && tev != NULL);
+
+    m = (struct tevent_mail *)cc_alloc(sizeof(*m));
+    if (m != NULL) {
+        m->tev = tev;
+        m->gen = __atomic_load_n(&tev->gen, __ATOMIC_ACQUIRE);
+    }
+
+    return _post(tw, m);
+}
+
+/* act on everything posted so far, in the order it was posted */
+static void
+_drain_mailbox(struct timing_wheel *tw)
+{
+    struct tevent_mail *m, *next, *fifo = NULL;
+    struct timeout_event *tev;
+
+    if (__atomic_load_n(&tw->mailbox, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    m = __atomic_exchange_n(&tw->mailbox, NULL, __ATOMIC_ACQUIRE);
+    for (; m != NULL; m = next) {
+        next = m->next;
+        m->next = fifo;
+        fifo = m;
+    }
+
+    for (m = fifo; m != NULL; m = next) {
+        next = m->next;
+        tev = m->tev;
+        if (tev == NULL) {
+            if (timing_wheel_insert(tw, &m->delay, m->recur, m->cb, m->data)
+                    == NULL) {
+                INCR(timing_wheel_metrics, timing_wheel_post_ex);
+            }
+        } else if (!tev->free && tev->gen == m->gen) {
+            timing_wheel_remove(tw, &tev);
+        } else {
+            log_verb("dropping stale removal of timeout event %p", tev);
+            INCR(timing_wheel_metrics, timing_wheel_post_ex);
+        }
+        cc_free(m);
+    }
 }
 
 void
@@ -378,18 +692,52 @@ _advance_curr(struct timing_wheel *tw)
 
     tw->curr++;
     tw->curr %= tw->cap;
+    tw->now++;
 
     tw->ntick++;
     INCR(timing_wheel_metrics, timing_wheel_tick);
 }
 
+/*
+ * level 0 wrapped around: move the events of the next slot on level 1 down,
+ * and keep going up for every level that wraps around as well
+ */
 static inline void
-_process_tick(struct timing_wheel *tw, bool endmode)
+_cascade(struct timing_wheel *tw)
 {
     struct timeout_event *t, *tt;
-    uint64_t nprocess = tw->nprocess;
+    struct tevent_tqh *head;
+    uint64_t unit = tw->cap;
+    size_t level, idx;
+
+    for (level = 1; level < tw->nlevel; level++, unit *= tw->cap) {
+        idx = (tw->now / unit) % tw->cap;
+        head = &tw->table[level * tw->cap + idx];
+        TAILQ_FOREACH_SAFE(t, head, tqe, tt) {
+            _unlink(tw, t);
+            _slot(tw, t, t->expire);
+            _link(tw, t);
+            INCR(timing_wheel_metrics, timing_wheel_cascade);
+        }
+        if (idx != 0) {
+            break;
+        }
+    }
+}
+
+static inline void
+_process_bucket(struct timing_wheel *tw, struct tevent_tqh *head, bool endmode)
+{
+    struct timeout_event *t, *tt;
+
+    TAILQ_FOREACH_SAFE(t, head, tqe, tt) {
+        if (!endmode && t->expire > tw->now) { /* touched, not due yet */
+            _unlink(tw, t);
+            _slot(tw, t, t->expire);
+            _link(tw, t);
+            continue;
+        }
 
-    TAILQ_FOREACH_SAFE(t, &tw->table[tw->curr], tqe, tt) {
         tw->nprocess++;
         INCR(timing_wheel_metrics, timing_wheel_process);
 
@@ -402,14 +750,27 @@ _process_tick(struct timing_wheel *tw, bool endmode)
         }
         if (!endmode && t->recur) {
             /* re-calculate offset & insert if recurring and not ending */
-            t->offset = (tw->curr + _offset(tw, &t->delay)) % tw->cap;
+            _slot(tw, t, tw->now + _offset(tw, &t->delay));
             log_vverb("(internal) inserting timeout event %p into timing wheel "
-                    "%p: scheduled offset %zu", t, tw, t->offset);
+                    "%p: scheduled offset %zu level %zu", t, tw, t->offset,
+                    t->level);
             _timing_wheel_insert(tw, t);
         } else {
-            timeout_event_return(&t);
+            timeout_event_return(tw->pool, &t);
         }
     }
+}
+
+static inline void
+_process_tick(struct timing_wheel *tw, bool endmode)
+{
+    uint64_t nprocess = tw->nprocess;
+
+    if (tw->curr == 0 && tw->nlevel > 1 && !endmode) {
+        _cascade(tw);
+    }
+
+    _process_bucket(tw, &tw->table[tw->curr], endmode);
 
     log_vverb("processed %"PRIu64" timeout events during tick %zu of timing "
             "wheel %p", tw->nprocess - nprocess, tw->curr, tw);
@@ -421,6 +782,41 @@ _tick_allowed(struct timing_wheel *tw, size_t ntick)
     return (tw->max_ntick == 0 || ntick < tw->max_ntick);
 }
 
+/* # of due ticks, starting with the current one, that can be skipped */
+static inline size_t
+_nskip(struct timing_wheel *tw, size_t ntick)
+{
+    uint64_t ndue = 1 + (uint64_t)(-timeout_ns(&tw->due)) / tw->tick_ns;
+    size_t n = _next_tick(tw);
+
+    if (n < tw->cap) {
+        ndue = MIN(ndue, n);
+    }
+    if (tw->max_ntick > 0) {
+        ndue = MIN(ndue, tw->max_ntick - ntick);
+    }
+
+    return (size_t)ndue;
+}
+
+/* advance over n empty ticks at once */
+static inline void
+_skip_ticks(struct timing_wheel *tw, size_t n)
+{
+    struct timeout to;
+
+    log_vverb("skipping %zu empty ticks of timing wheel %p from %zu", n, tw,
+            tw->curr);
+
+    tw->curr = (tw->curr + n) % tw->cap;
+    tw->now += n;
+    tw->ntick += n;
+    INCR_N(timing_wheel_metrics, timing_wheel_tick, n);
+
+    timeout_set_ns(&to, n * tw->tick_ns);
+    timeout_sum_intvl(&tw->due, &tw->due, &to);
+}
+
 void
 timing_wheel_execute(struct timing_wheel *tw)
 {
@@ -428,6 +824,7 @@ timing_wheel_execute(struct timing_wheel *tw)
     size_t ntick = 0;
     uint64_t elapsed = 0;
 
+    _drain_mailbox(tw);
 
     /*
      * If timing wheel's current slot is not due, it returns immediately;
@@ -445,6 +842,13 @@ timing_wheel_execute(struct timing_wheel *tw)
     while (_tick_allowed(tw, ntick) && timeout_expired(&tw->due)) {
         struct duration d;
         struct timeout to;
+        size_t nskip = _nskip(tw, ntick);
+
+        if (nskip > 0) {
+            ntick += nskip;
+            _skip_ticks(tw, nskip);
+            continue;
+        }
 
         duration_start(&d);
 
@@ -465,10 +869,40 @@ timing_wheel_execute(struct timing_wheel *tw)
     log_vverb("execution round %"PRIu64" processed %zu ticks of timing wheel %p "
             "in %"PRIu64" ns", tw->nexec, ntick, tw, elapsed);
 
+    PROBE3(wheel_execute, tw, ntick, elapsed);
     tw->nexec++;
     INCR(timing_wheel_metrics, timing_wheel_exec);
 }
 
+int64_t
+timing_wheel_next_ns(struct timing_wheel *tw)
+{
+    int64_t ns;
+
+    ASSERT(tw != NULL);
+
+    if (!tw->active || tw->nevent == 0) {
+        return -1;
+    }
+
+    ns = timeout_ns(&tw->due) + (int64_t)(_next_tick(tw) * tw->tick_ns);
+
+    return ns < 0 ? 0 : ns;
+}
+
+int
+timing_wheel_next_ms(struct timing_wheel *tw)
+{
+    int64_t ns = timing_wheel_next_ns(tw);
+
+    if (ns < 0) {
+        return -1;
+    }
+    ns = (ns + 999999) / 1000000;
+
+    return ns > INT_MAX ? INT_MAX : (int)ns;
+}
+
 void
 timing_wheel_flush(struct timing_wheel *tw)
 {
@@ -482,4 +916,9 @@ timing_wheel_flush(struct timing_wheel *tw)
         _process_tick(tw, true);
         _advance_curr(tw);
     } while (tw->curr != start);
+
+    /* events still on upper levels were not due within one rotation */
+    for (size_t i = tw->cap; i < tw->nlevel * tw->cap; i++) {
+        _process_bucket(tw, &tw->table[i], true);
+    }
 }
@@ -0,0 +1,160 @@
+#include <cc_arena.h>
+
+#include <check.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "arena"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define TEST_CHUNK_SIZE 1024
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+}
+
+static void
+test_teardown(void)
+{
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/*
+ * tests
+ */
+START_TEST(test_create_destroy)
+{
+    struct arena *arena;
+
+    test_reset();
+
+    arena = arena_create(0);
+    ck_assert_ptr_ne(arena, NULL);
+    ck_assert_int_eq(arena->chunk_size, ARENA_CHUNK_SIZE);
+    ck_assert_int_eq(arena->nchunk, 1);
+    arena_destroy(&arena);
+    ck_assert_ptr_eq(arena, NULL);
+
+    /* too small to hold anything */
+    ck_assert_ptr_eq(arena_create(sizeof(struct arena_chunk)), NULL);
+}
+END_TEST
+
+START_TEST(test_alloc_reset)
+{
+#define SIZE 100
+#define N 32
+    struct arena *arena;
+    char *p[N];
+    uint32_t i, nchunk;
+
+    test_reset();
+
+    arena = arena_create(TEST_CHUNK_SIZE);
+    ck_assert_ptr_ne(arena, NULL);
+
+    for (i = 0; i < N; i++) {
+        p[i] = arena_alloc(arena, SIZE);
+        ck_assert_ptr_ne(p[i], NULL);
+        ck_assert_int_eq((uintptr_t)p[i] % ARENA_ALIGN, 0);
+        memset(p[i], i, SIZE);
+    }
+    ck_assert_int_gt(arena->nchunk, 1);
+    ck_assert_int_eq(arena->nbyte, N * CC_ALIGN(SIZE, ARENA_ALIGN));
+    for (i = 0; i < N; i++) {
+        ck_assert_int_eq(p[i][0], i);
+        ck_assert_int_eq(p[i][SIZE - 1], i);
+    }
+
+    /* reset keeps the chunks, and the same allocations fit in them again */
+    nchunk = arena->nchunk;
+    arena_reset(arena);
+    ck_assert_int_eq(arena->nbyte, 0);
+    ck_assert_ptr_eq(arena_alloc(arena, SIZE), p[0]);
+    for (i = 1; i < N; i++) {
+        ck_assert_ptr_ne(arena_alloc(arena, SIZE), NULL);
+    }
+    ck_assert_int_eq(arena->nchunk, nchunk);
+
+    arena_destroy(&arena);
+#undef SIZE
+#undef N
+}
+END_TEST
+
+START_TEST(test_large)
+{
+    struct arena *arena;
+    char *p, *q;
+
+    test_reset();
+
+    arena = arena_create(TEST_CHUNK_SIZE);
+    ck_assert_ptr_ne(arena, NULL);
+
+    /* oversized requests do not eat into regular chunks */
+    q = arena_alloc(arena, 8);
+    p = arena_zalloc(arena, 4 * TEST_CHUNK_SIZE);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(p[4 * TEST_CHUNK_SIZE - 1], 0);
+    ck_assert_int_eq(arena->nchunk, 2);
+    ck_assert_ptr_eq(arena_alloc(arena, 8), q + ARENA_ALIGN);
+
+    /* and are freed on reset */
+    arena_reset(arena);
+    ck_assert_int_eq(arena->nchunk, 1);
+
+    arena_destroy(&arena);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+arena_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_arena = tcase_create("arena test");
+    suite_add_tcase(s, tc_arena);
+
+    tcase_add_test(tc_arena, test_create_destroy);
+    tcase_add_test(tc_arena, test_alloc_reset);
+    tcase_add_test(tc_arena, test_large);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = arena_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,14 +2,25 @@
 
 #include <check.h>
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #define SUITE_NAME "array"
 #define DEBUG_LOG  SUITE_NAME ".log"
 
 #define ARRAY_MAX_NELEM_DELTA 8
 
+static inline bool
+u64_less(const uint64_t *a, const uint64_t *b)
+{
+    return *a < *b;
+}
+
+TYPED_ARRAY(u64_array, uint64_t)
+TYPED_ARRAY_SORT(u64_array, uint64_t, u64_less)
+
 /*
  * utilities
  */
@@ -160,6 +171,123 @@ START_TEST(test_sort)
 }
 END_TEST
 
+static int
+cmp_u64(const void *e1, const void *e2)
+{
+    uint64_t a = *(const uint64_t *)e1, b = *(const uint64_t *)e2;
+
+    return (a > b) - (a < b);
+}
+
+START_TEST(test_typed)
+{
+#define NELEM 1000000
+    struct u64_array a;
+    uint64_t *el, sum = 0;
+    uint32_t i, nrealloc = 0, nalloc = 0;
+
+    test_reset();
+
+    ck_assert_int_eq(u64_array_init(&a, 0), CC_OK);
+    ck_assert_ptr_eq(a.data, NULL);
+    ck_assert_int_eq(u64_array_nelem(&a), 0);
+
+    /* capacity doubles, so a million pushes take a couple dozen reallocs */
+    for (i = 0; i < NELEM; i++) {
+        ck_assert_int_eq(u64_array_append(&a, i), CC_OK);
+        if (a.nalloc != nalloc) {
+            ck_assert(nalloc == 0 || a.nalloc == 2 * nalloc);
+            nalloc = a.nalloc;
+            nrealloc++;
+        }
+    }
+    ck_assert_int_eq(u64_array_nelem(&a), NELEM);
+    ck_assert_int_le(nrealloc, 20);
+
+    ck_assert_int_eq(*u64_array_get(&a, 12345), 12345);
+    TYPED_ARRAY_FOREACH(el, &a) {
+        sum += *el;
+    }
+    ck_assert_int_eq(sum, (uint64_t)NELEM * (NELEM - 1) / 2);
+    for (i = NELEM; i > NELEM - 10; i--) {
+        ck_assert_int_eq(*u64_array_pop(&a), i - 1);
+    }
+    ck_assert_int_eq(u64_array_nelem(&a), NELEM - 10);
+
+    /* reserve does not shrink, or grow more than asked for up front */
+    u64_array_deinit(&a);
+    ck_assert_int_eq(u64_array_init(&a, 100), CC_OK);
+    ck_assert_int_eq(a.nalloc, 128);
+    ck_assert_int_eq(u64_array_reserve(&a, 10), CC_OK);
+    ck_assert_int_eq(a.nalloc, 128);
+    u64_array_clear(&a);
+    ck_assert_int_eq(u64_array_nelem(&a), 0);
+    u64_array_deinit(&a);
+    ck_assert_ptr_eq(a.data, NULL);
+#undef NELEM
+}
+END_TEST
+
+static void
+_check_sort(struct u64_array *a)
+{
+    uint64_t *ref = malloc(a->nelem * sizeof(uint64_t) + 1);
+
+    memcpy(ref, a->data, a->nelem * sizeof(uint64_t));
+    qsort(ref, a->nelem, sizeof(uint64_t), cmp_u64);
+    u64_array_sort(a);
+    ck_assert_int_eq(memcmp(ref, a->data, a->nelem * sizeof(uint64_t)), 0);
+    free(ref);
+}
+
+START_TEST(test_typed_sort)
+{
+    struct u64_array a;
+    uint32_t i, n;
+    uint32_t sizes[] = {0, 1, 2, 3, 15, 16, 17, 100, 1000, 100000};
+
+    test_reset();
+
+    u64_array_init(&a, 0);
+    srand(42);
+    for (n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+        /* random, with and without duplicates */
+        u64_array_clear(&a);
+        for (i = 0; i < sizes[n]; i++) {
+            u64_array_append(&a, (uint64_t)rand() << 16 ^ rand());
+        }
+        _check_sort(&a);
+        u64_array_clear(&a);
+        for (i = 0; i < sizes[n]; i++) {
+            u64_array_append(&a, rand() % 8);
+        }
+        _check_sort(&a);
+        /* sorted, reversed, all equal and organ pipe */
+        u64_array_clear(&a);
+        for (i = 0; i < sizes[n]; i++) {
+            u64_array_append(&a, i);
+        }
+        _check_sort(&a);
+        u64_array_clear(&a);
+        for (i = 0; i < sizes[n]; i++) {
+            u64_array_append(&a, sizes[n] - i);
+        }
+        _check_sort(&a);
+        u64_array_clear(&a);
+        for (i = 0; i < sizes[n]; i++) {
+            u64_array_append(&a, 7);
+        }
+        _check_sort(&a);
+        u64_array_clear(&a);
+        for (i = 0; i < sizes[n]; i++) {
+            u64_array_append(&a, i < sizes[n] / 2 ? i : sizes[n] - i);
+        }
+        _check_sort(&a);
+    }
+    u64_array_deinit(&a);
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -177,6 +305,8 @@ array_suite(void)
     tcase_add_test(tc_array, test_expand_max);
     tcase_add_test(tc_array, test_each);
     tcase_add_test(tc_array, test_sort);
+    tcase_add_test(tc_array, test_typed);
+    tcase_add_test(tc_array, test_typed_sort);
 
     return s;
 }
@@ -5,6 +5,7 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #define SUITE_NAME "bstring"
 #define DEBUG_LOG  SUITE_NAME ".log"
@@ -96,6 +97,118 @@ START_TEST(test_compare)
 }
 END_TEST
 
+START_TEST(test_compare_length)
+{
+    struct bstring bstr1 = str2bstr("foo");
+    struct bstring bstr2 = str2bstr("foobar");
+
+    test_reset();
+
+    ck_assert_int_lt(bstring_compare(&bstr1, &bstr2), 0);
+    ck_assert_int_gt(bstring_compare(&bstr2, &bstr1), 0);
+}
+END_TEST
+
+#define SIMD_MAXLEN 100
+START_TEST(test_equal)
+{
+    char a[SIMD_MAXLEN], b[SIMD_MAXLEN];
+    struct bstring s1 = {0, a}, s2 = {0, b};
+    uint32_t len, i;
+
+    test_reset();
+
+    for (len = 0; len < SIMD_MAXLEN; len++) {
+        memset(a, 'x', len);
+        memset(b, 'x', len);
+        s1.len = s2.len = len;
+        ck_assert(bstring_equal(&s1, &s2));
+        /* a mismatch at any position is caught */
+        for (i = 0; i < len; i++) {
+            b[i] = 'y';
+            ck_assert(!bstring_equal(&s1, &s2));
+            b[i] = 'x';
+        }
+        s2.len = len + 1;
+        ck_assert(!bstring_equal(&s1, &s2));
+    }
+}
+END_TEST
+
+START_TEST(test_casecmp)
+{
+    char a[SIMD_MAXLEN], b[SIMD_MAXLEN];
+    struct bstring s1 = {0, a}, s2 = {0, b};
+    uint32_t len, i;
+
+    test_reset();
+
+    ck_assert_int_eq(bstring_casecmp(&str2bstr("Content-Length"),
+                &str2bstr("content-length")), 0);
+    ck_assert_int_lt(bstring_casecmp(&str2bstr("GET"), &str2bstr("gets")), 0);
+    ck_assert_int_lt(bstring_casecmp(&str2bstr("abc"), &str2bstr("ABD")), 0);
+    ck_assert_int_gt(bstring_casecmp(&str2bstr("abd"), &str2bstr("ABC")), 0);
+    /* only ASCII letters are folded */
+    ck_assert_int_ne(bstring_casecmp(&str2bstr("@["), &str2bstr("`{")), 0);
+    ck_assert_int_ne(bstring_casecmp(&str2bstr("\xc1"), &str2bstr("\xe1")), 0);
+
+    for (len = 1; len < SIMD_MAXLEN; len++) {
+        for (i = 0; i < len; i++) {
+            a[i] = 'a' + i % 26;
+            b[i] = 'A' + i % 26;
+        }
+        s1.len = s2.len = len;
+        ck_assert_int_eq(bstring_casecmp(&s1, &s2), 0);
+        for (i = 0; i < len; i++) {
+            b[i] = '0';
+            ck_assert_int_gt(bstring_casecmp(&s1, &s2), 0);
+            ck_assert_int_lt(bstring_casecmp(&s2, &s1), 0);
+            b[i] = 'A' + i % 26;
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_find)
+{
+    char buf[SIMD_MAXLEN];
+    struct bstring str = {0, buf};
+    struct bstring req = str2bstr("GET key\r\n\r\n");
+    uint32_t len, i, j;
+
+    test_reset();
+
+    ck_assert_int_eq(bstring_find(&req, 0, ' '), 3);
+    ck_assert_int_eq(bstring_find(&req, 4, ' '), req.len);
+    ck_assert_int_eq(bstring_find_any(&req, 0, "\r\n ", 3), 3);
+    ck_assert_int_eq(bstring_find_any(&req, 4, "\r\n ", 3), 7);
+    ck_assert_int_eq(bstring_find_crlf(&req, 0), 7);
+    ck_assert_int_eq(bstring_find_crlf(&req, 8), 9);
+    ck_assert_int_eq(bstring_find_crlf(&str2bstr("a\rb\r"), 0), 4);
+    ck_assert_int_eq(bstring_find_any(&req, req.len, " ", 1), req.len);
+
+    /* every length and position, to cover vector bodies and tails */
+    for (len = 0; len < SIMD_MAXLEN; len++) {
+        memset(buf, 'x', len);
+        str.len = len;
+        ck_assert_int_eq(bstring_find_any(&str, 0, "\r\n ", 3), len);
+        ck_assert_int_eq(bstring_find_crlf(&str, 0), len);
+        for (i = 0; i + 1 < len; i++) {
+            buf[i] = '\r';
+            buf[i + 1] = '\n';
+            ck_assert_int_eq(bstring_find_crlf(&str, 0), i);
+            ck_assert_int_eq(bstring_find_any(&str, 0, " \n", 2), i + 1);
+            for (j = 0; j <= i; j++) {
+                ck_assert_int_eq(bstring_find_any(&str, j, "\r\n ", 3), i);
+                ck_assert_int_eq(bstring_find(&str, j, '\n'), i + 1);
+            }
+            buf[i] = buf[i + 1] = 'x';
+        }
+    }
+}
+END_TEST
+#undef SIMD_MAXLEN
+
 START_TEST(test_strcmp)
 {
     ck_assert(str2cmp("an", 'a', 'n'));
@@ -153,6 +266,121 @@ START_TEST(test_atou64)
 }
 END_TEST
 
+/* the byte-at-a-time parser bstring_atou64 used to be, as a reference */
+static rstatus_i
+_atou64_ref(uint64_t *u64, const char *p, uint32_t len)
+{
+    uint32_t i;
+
+    *u64 = 0;
+    if (len == 0 || len >= CC_UINT64_MAXLEN) {
+        return CC_ERROR;
+    }
+    for (i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9' ||
+                *u64 > (UINT64_MAX - (p[i] - '0')) / 10) {
+            return CC_ERROR;
+        }
+        *u64 = *u64 * 10 + (p[i] - '0');
+    }
+
+    return CC_OK;
+}
+
+START_TEST(test_atou64_fast)
+{
+    const char *bad = "/:a -+\0";
+    char buf[CC_UINT64_MAXLEN + 2];
+    struct bstring bstr = {0, buf};
+    uint64_t val, ref;
+    uint32_t len, i, k;
+
+    test_reset();
+
+    /* overflow: 20 nines doesn't fit, neither does UINT64_MAX + 1 */
+    ck_assert_int_eq(bstring_atou64(&val, &str2bstr("99999999999999999999")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atou64(&val, &str2bstr("18446744073709551616")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atou64(&val, &str2bstr("18446744073709551615")),
+            CC_OK);
+    ck_assert_uint_eq(val, UINT64_MAX);
+    ck_assert_int_eq(bstring_atou64(&val, &str2bstr("00000000000000000042")),
+            CC_OK);
+    ck_assert_uint_eq(val, 42);
+    ck_assert_int_eq(bstring_atou64(&val, &str2bstr("000000000000000000042")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atou64(&val, &null_bstring), CC_ERROR);
+
+    /* every length, with each position swapped for a non-digit */
+    for (len = 1; len <= CC_UINT64_MAXLEN; len++) {
+        for (i = 0; i < len; i++) {
+            buf[i] = '1' + (i * 7) % 9;
+        }
+        bstr.len = len;
+        if (_atou64_ref(&ref, buf, len) == CC_OK) {
+            ck_assert_int_eq(bstring_atou64(&val, &bstr), CC_OK);
+            ck_assert_uint_eq(val, ref);
+        } else {
+            ck_assert_int_eq(bstring_atou64(&val, &bstr), CC_ERROR);
+        }
+        for (i = 0; i < len; i++) {
+            for (k = 0; k < strlen(bad) + 1; k++) {
+                char c = buf[i];
+
+                buf[i] = bad[k];
+                ck_assert_int_eq(bstring_atou64(&val, &bstr), CC_ERROR);
+                buf[i] = c;
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_atou64_bounded)
+{
+    uint64_t val;
+
+    test_reset();
+
+    ck_assert_int_eq(bstring_atou64_bounded(&val, &str2bstr("4294967295"),
+                UINT32_MAX), CC_OK);
+    ck_assert_uint_eq(val, UINT32_MAX);
+    ck_assert_int_eq(bstring_atou64_bounded(&val, &str2bstr("4294967296"),
+                UINT32_MAX), CC_ERROR);
+    ck_assert_int_eq(bstring_atou64_bounded(&val, &str2bstr("0"), 0), CC_OK);
+    ck_assert_int_eq(bstring_atou64_bounded(&val, &str2bstr("x"), 10),
+            CC_ERROR);
+}
+END_TEST
+
+START_TEST(test_atoi64)
+{
+    int64_t val;
+
+    test_reset();
+
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("-1")), CC_OK);
+    ck_assert_int_eq(val, -1);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("+12345678901")), CC_OK);
+    ck_assert_int_eq(val, 12345678901LL);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("9223372036854775807")),
+            CC_OK);
+    ck_assert_int_eq(val, INT64_MAX);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("-9223372036854775808")),
+            CC_OK);
+    ck_assert_int_eq(val, INT64_MIN);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("9223372036854775808")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("-9223372036854775809")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("-")), CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("--1")), CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&val, &str2bstr("1-")), CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&val, &null_bstring), CC_ERROR);
+}
+END_TEST
+
 START_TEST(test_bstring_alloc_and_free)
 {
 #define BSTRING_SIZE 9000
@@ -173,6 +401,57 @@ START_TEST(test_bstring_alloc_and_free)
 }
 END_TEST
 
+START_TEST(test_sso)
+{
+#define SHORT "six by"
+#define LONG "a key that does not fit in the struct"
+    struct bstring_sso sso;
+    struct bstring bstr, view;
+
+    test_reset();
+
+    ck_assert_int_eq(sizeof(struct bstring_sso), 32);
+
+    /* short payloads are stored inline */
+    bstring_sso_init(&sso);
+    ck_assert_int_eq(bstring_sso_copy(&sso, SHORT, sizeof(SHORT) - 1), CC_OK);
+    ck_assert(bstring_sso_inline(&sso));
+    ck_assert_ptr_eq(bstring_sso_data(&sso), sso.buf);
+    view = bstring_sso_view(&sso);
+    ck_assert(bstring_equal(&view, &str2bstr(SHORT)));
+    bstring_sso_deinit(&sso);
+    ck_assert_int_eq(sso.len, 0);
+
+    /* up to and including BSTRING_SSO_MAX */
+    ck_assert_int_eq(bstring_sso_copy(&sso, LONG, BSTRING_SSO_MAX), CC_OK);
+    ck_assert(bstring_sso_inline(&sso));
+    ck_assert_int_eq(memcmp(bstring_sso_data(&sso), LONG, BSTRING_SSO_MAX), 0);
+    bstring_sso_deinit(&sso);
+
+    /* longer ones go to the heap */
+    ck_assert_int_eq(bstring_sso_from_bstring(&sso, &str2bstr(LONG)), CC_OK);
+    ck_assert(!bstring_sso_inline(&sso));
+    view = bstring_sso_view(&sso);
+    ck_assert(bstring_equal(&view, &str2bstr(LONG)));
+
+    /* conversion back gives an owned bstring */
+    bstring_init(&bstr);
+    ck_assert_int_eq(bstring_sso_to_bstring(&bstr, &sso), CC_OK);
+    ck_assert_ptr_ne(bstr.data, sso.ptr);
+    ck_assert(bstring_equal(&bstr, &view));
+    bstring_deinit(&bstr);
+    bstring_sso_deinit(&sso);
+
+    /* empty is fine both ways */
+    ck_assert_int_eq(bstring_sso_copy(&sso, NULL, 0), CC_OK);
+    ck_assert_int_eq(bstring_sso_to_bstring(&bstr, &sso), CC_OK);
+    ck_assert(bstring_empty(&bstr));
+    bstring_sso_deinit(&sso);
+#undef SHORT
+#undef LONG
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -188,9 +467,17 @@ bstring_suite(void)
     tcase_add_test(tc_bstring, test_duplicate);
     tcase_add_test(tc_bstring, test_copy);
     tcase_add_test(tc_bstring, test_compare);
+    tcase_add_test(tc_bstring, test_compare_length);
+    tcase_add_test(tc_bstring, test_equal);
+    tcase_add_test(tc_bstring, test_casecmp);
+    tcase_add_test(tc_bstring, test_find);
     tcase_add_test(tc_bstring, test_strcmp);
     tcase_add_test(tc_bstring, test_atou64);
+    tcase_add_test(tc_bstring, test_atou64_fast);
+    tcase_add_test(tc_bstring, test_atou64_bounded);
+    tcase_add_test(tc_bstring, test_atoi64);
     tcase_add_test(tc_bstring, test_bstring_alloc_and_free);
+    tcase_add_test(tc_bstring, test_sso);
 
     return s;
 }
@@ -2,6 +2,7 @@
 #include <buffer/cc_dbuf.h>
 
 #include <cc_bstring.h>
+#include <cc_slab.h>
 
 #include <check.h>
 
@@ -151,6 +152,37 @@ START_TEST(test_create_write_read_destroy_long)
 }
 END_TEST
 
+START_TEST(test_append)
+{
+    struct buf *buf;
+
+    test_reset();
+
+    buf = buf_create();
+    ck_assert_uint_eq(buf_append(buf, "v=", 2), 2);
+    ck_assert_uint_eq(buf_append_uint64(buf, 18446744073709551615ULL), 20);
+    ck_assert_uint_eq(buf_append(buf, " ", 1), 1);
+    ck_assert_uint_eq(buf_append_int64(buf, -42), 3);
+    ck_assert_uint_eq(buf_append(buf, " ", 1), 1);
+    ck_assert_uint_eq(buf_append_double(buf, 0.25), 4);
+    ck_assert_uint_eq(buf_rsize(buf), 31);
+    ck_assert_int_eq(cc_memcmp(buf->rpos, "v=18446744073709551615 -42 0.25",
+                31), 0);
+
+    /* all or nothing once the buffer is almost full */
+    ck_assert_uint_eq(buf_wsize(buf), TEST_BUF_CAP - 31);
+    ck_assert_uint_eq(buf_append_uint64(buf, 12), 0);
+    ck_assert_uint_eq(buf_append(buf, "ab", 2), 0);
+    ck_assert_uint_eq(buf_append_double(buf, 1.5), 0);
+    ck_assert_uint_eq(buf_append_int64(buf, -1), 0);
+    ck_assert_uint_eq(buf_rsize(buf), 31);
+    ck_assert_uint_eq(buf_append_int64(buf, 7), 1);
+    ck_assert(BUF_FULL(buf));
+
+    buf_destroy(&buf);
+}
+END_TEST
+
 START_TEST(test_lshift)
 {
 #define MSG "Hello World"
@@ -245,6 +277,48 @@ START_TEST(test_rshift)
 }
 END_TEST
 
+START_TEST(test_chain)
+{
+#define LEN (3 * TEST_BUF_CAP + 5)
+    struct buf_sqh chain = STAILQ_HEAD_INITIALIZER(chain);
+    struct buf *buf;
+    char src[LEN];
+    uint32_t i, nbuf = 0;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+
+    ck_assert_int_eq(buf_chain_rsize(&chain), 0);
+    ck_assert_int_eq(buf_chain_write(&chain, src, LEN), LEN);
+    ck_assert_int_eq(buf_chain_rsize(&chain), LEN);
+    STAILQ_FOREACH(buf, &chain, next) {
+        ck_assert_int_eq(memcmp(buf->rpos, src + nbuf * TEST_BUF_CAP,
+                    buf_rsize(buf)), 0);
+        nbuf++;
+    }
+    ck_assert_int_eq(nbuf, 4);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 4);
+
+    /* appending fills the tail before borrowing */
+    ck_assert_int_eq(buf_chain_write(&chain, src, 1), 1);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 4);
+
+    /* consuming returns bufs as soon as they are drained */
+    buf_chain_consume(&chain, TEST_BUF_CAP + 1);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 3);
+    ck_assert_int_eq(buf_chain_rsize(&chain), LEN + 1 - TEST_BUF_CAP - 1);
+    ck_assert_int_eq(*STAILQ_FIRST(&chain)->rpos, src[TEST_BUF_CAP + 1]);
+
+    buf_chain_return(&chain);
+    ck_assert(STAILQ_EMPTY(&chain));
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef LEN
+}
+END_TEST
+
 START_TEST(test_dbuf_double_basic)
 {
 #define EXPECTED_BUF_SIZE                (TEST_BUF_SIZE * 2)
@@ -302,7 +376,7 @@ END_TEST
 START_TEST(test_dbuf_fit)
 {
 #define CAP_SMALL                         (TEST_BUF_CAP * 4)
-#define EXPECTED_BUF_SIZE                (TEST_BUF_SIZE * 4)
+#define EXPECTED_BUF_SIZE                (TEST_BUF_SIZE * 2)
 #define EXPECTED_BUF_CAP  (EXPECTED_BUF_SIZE - BUF_HDR_SIZE)
 #define CAP_LARGE (TEST_BUF_CAP * 16)
     struct buf *buf;
@@ -331,6 +405,32 @@ START_TEST(test_dbuf_fit)
 }
 END_TEST
 
+START_TEST(test_dbuf_fit_header)
+{
+#define EXPECTED_BUF_SIZE                (TEST_BUF_SIZE * 4)
+    struct buf *buf;
+
+    test_reset();
+
+    buf = buf_create();
+    ck_assert_ptr_ne(buf, NULL);
+
+    /* the cache line header counts, one byte over a doubling takes another */
+    ck_assert_int_eq(dbuf_fit(&buf, 2 * TEST_BUF_SIZE - BUF_HDR_SIZE), CC_OK);
+    ck_assert_uint_eq(buf_size(buf), 2 * TEST_BUF_SIZE);
+    ck_assert_int_eq(dbuf_fit(&buf, 2 * TEST_BUF_SIZE - BUF_HDR_SIZE + 1),
+            CC_OK);
+    ck_assert_uint_eq(buf_size(buf), EXPECTED_BUF_SIZE);
+    ck_assert_uint_eq(buf_capacity(buf), EXPECTED_BUF_SIZE - BUF_HDR_SIZE);
+    ck_assert_int_eq(bmetrics.buf_memory.gauge, EXPECTED_BUF_SIZE);
+    ck_assert_uint_eq((uintptr_t)buf->begin % CC_CACHELINE_SIZE, 0);
+
+    buf_destroy(&buf);
+    ck_assert_int_eq(bmetrics.buf_memory.gauge, 0);
+#undef EXPECTED_BUF_SIZE
+}
+END_TEST
+
 START_TEST(test_dbuf_shrink)
 {
 #define MSG1 "Hello World"
@@ -380,6 +480,318 @@ START_TEST(test_dbuf_shrink)
 }
 END_TEST
 
+START_TEST(test_dbuf_class)
+{
+#define MSG "Hello World"
+    struct buf *buf, *obuf;
+
+    test_teardown();
+    boptions.buf_nclass = (struct option) {
+        .set = true,
+        .type = OPTION_TYPE_UINT,
+        .val.vuint = TEST_DBUF_MAX + 1,
+    };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+    ck_assert_int_eq(buf_nclass, TEST_DBUF_MAX + 1);
+
+    buf = buf_borrow();
+    ck_assert_ptr_ne(buf, NULL);
+    obuf = buf;
+    ck_assert_uint_eq(buf_write(buf, MSG, sizeof(MSG)), sizeof(MSG));
+
+    /* doubling moves through the class pools, parking the smaller buf */
+    ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    ck_assert_uint_eq(buf_size(buf), TEST_BUF_SIZE * 4);
+    ck_assert_uint_eq(buf_rsize(buf), sizeof(MSG));
+    ck_assert_int_eq(memcmp(buf->rpos, MSG, sizeof(MSG)), 0);
+    ck_assert_int_eq(bmetrics.buf_create.counter, 3);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 3);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 1);
+
+    /* beyond the largest class */
+    ck_assert_int_eq(dbuf_double(&buf), CC_ERROR);
+
+    /* shrinking picks up the parked base buf again */
+    ck_assert_int_eq(dbuf_shrink(&buf), CC_OK);
+    ck_assert_ptr_eq(buf, obuf);
+    ck_assert_uint_eq(buf_rsize(buf), sizeof(MSG));
+    ck_assert_int_eq(memcmp(buf->rpos, MSG, sizeof(MSG)), 0);
+
+    /* bufs of a larger class are reused rather than allocated */
+    ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    ck_assert_int_eq(bmetrics.buf_create.counter, 3);
+
+    /* returned into the pool of its current size */
+    buf_return(&buf);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 3);
+    buf = buf_borrow();
+    ck_assert_uint_eq(buf_size(buf), TEST_BUF_SIZE);
+    buf_return(&buf);
+
+    test_teardown();
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 0);
+    test_setup();
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_buf_poolslab)
+{
+#define POOLSIZE 8
+#define MSG "Hello World"
+    struct buf *buf[POOLSIZE], *extra;
+    uint32_t i;
+
+    test_teardown();
+    boptions.buf_poolsize.val.vuint = POOLSIZE;
+    boptions.buf_poolslab = (struct option) {
+        .set = true,
+        .type = OPTION_TYPE_BOOL,
+        .val.vbool = true,
+    };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, POOLSIZE);
+
+    /* the whole pool is carved out of one region, back to back */
+    for (i = 0; i < POOLSIZE; i++) {
+        buf[i] = buf_borrow();
+        ck_assert_ptr_ne(buf[i], NULL);
+        ck_assert(buf_in_slab(buf[i]));
+        ck_assert_uint_eq(buf_size(buf[i]), TEST_BUF_SIZE);
+    }
+    for (i = 1; i < POOLSIZE; i++) {
+        ck_assert_uint_eq((char *)buf[i - 1] - (char *)buf[i],
+                CC_ALIGN(TEST_BUF_SIZE, CC_CACHELINE_SIZE));
+    }
+    ck_assert_ptr_eq(buf_borrow(), NULL);
+
+    /* slab bufs are moved rather than realloc'd when growing */
+    ck_assert_uint_eq(buf_write(buf[0], MSG, sizeof(MSG)), sizeof(MSG));
+    extra = buf[0];
+    ck_assert_int_eq(dbuf_double(&buf[0]), CC_OK);
+    ck_assert_ptr_ne(buf[0], extra);
+    ck_assert(!buf_in_slab(buf[0]));
+    ck_assert_int_eq(memcmp(buf[0]->rpos, MSG, sizeof(MSG)), 0);
+
+    /* and shrinking lands back in the slab buf that was parked */
+    ck_assert_int_eq(dbuf_shrink(&buf[0]), CC_OK);
+    ck_assert_ptr_eq(buf[0], extra);
+    ck_assert_int_eq(memcmp(buf[0]->rpos, MSG, sizeof(MSG)), 0);
+
+    for (i = 0; i < POOLSIZE; i++) {
+        buf_return(&buf[i]);
+    }
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    test_teardown();
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 0);
+    test_setup();
+#undef MSG
+#undef POOLSIZE
+}
+END_TEST
+
+START_TEST(test_buf_align)
+{
+#define MSG "Hello World"
+#define NBUF 8
+    struct buf *buf[NBUF];
+    uint32_t i;
+
+    test_reset();
+
+    ck_assert_uint_eq(BUF_HDR_SIZE % CC_CACHELINE_SIZE, 0);
+    for (i = 0; i < NBUF; i++) {
+        buf[i] = buf_borrow();
+        ck_assert_ptr_ne(buf[i], NULL);
+        ck_assert_uint_eq((uintptr_t)buf[i]->begin % CC_CACHELINE_SIZE, 0);
+        ck_assert_uint_eq(buf_write(buf[i], MSG, sizeof(MSG)), sizeof(MSG));
+    }
+
+    /* realloc'd bufs stay aligned and keep their content */
+    for (i = 0; i < NBUF; i++) {
+        ck_assert_int_eq(dbuf_double(&buf[i]), CC_OK);
+        ck_assert_uint_eq((uintptr_t)buf[i]->begin % CC_CACHELINE_SIZE, 0);
+        ck_assert_int_eq(memcmp(buf[i]->rpos, MSG, sizeof(MSG)), 0);
+        ck_assert_int_eq(dbuf_shrink(&buf[i]), CC_OK);
+        ck_assert_uint_eq((uintptr_t)buf[i]->begin % CC_CACHELINE_SIZE, 0);
+        ck_assert_int_eq(memcmp(buf[i]->rpos, MSG, sizeof(MSG)), 0);
+        buf_return(&buf[i]);
+    }
+
+    /* and so do slab bufs */
+    test_teardown();
+    boptions.buf_poolsize.val.vuint = NBUF;
+    boptions.buf_poolslab = (struct option) {
+        .set = true,
+        .type = OPTION_TYPE_BOOL,
+        .val.vbool = true,
+    };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+    for (i = 0; i < NBUF; i++) {
+        buf[i] = buf_borrow();
+        ck_assert(buf_in_slab(buf[i]));
+        ck_assert_uint_eq((uintptr_t)buf[i]->begin % CC_CACHELINE_SIZE, 0);
+    }
+    for (i = 0; i < NBUF; i++) {
+        buf_return(&buf[i]);
+    }
+
+    test_teardown();
+    test_setup();
+#undef NBUF
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_buf_trim)
+{
+#define NBUF 4
+    struct buf *buf[NBUF];
+    uint32_t i;
+
+    test_reset();
+
+    for (i = 0; i < NBUF; i++) {
+        buf[i] = buf_borrow();
+        ck_assert_ptr_ne(buf[i], NULL);
+    }
+    for (i = 0; i < NBUF; i++) {
+        buf_return(&buf[i]);
+    }
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, NBUF);
+
+    /* only bufs that stayed free for a whole interval go */
+    buf_trim(NULL);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, NBUF);
+    buf_trim(NULL);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, NBUF / 2);
+    ck_assert_uint_eq(bmetrics.buf_trim.counter, NBUF / 2);
+    ck_assert_int_eq(bmetrics.buf_memory.gauge, NBUF / 2 * TEST_BUF_SIZE);
+
+    /* at most one free buf kept */
+    test_teardown();
+    boptions.buf_pool_high = (struct option) {
+        .set = true,
+        .type = OPTION_TYPE_UINT,
+        .val.vuint = 1,
+    };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+    buf[0] = buf_borrow();
+    buf[1] = buf_borrow();
+    buf_return(&buf[0]);
+    buf_return(&buf[1]);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
+
+    test_teardown();
+    test_setup();
+#undef NBUF
+}
+END_TEST
+
+START_TEST(test_buf_memory_max)
+{
+#define MSG "Hello World"
+    struct buf *buf, *extra;
+
+    test_teardown();
+    boptions.buf_memory_max = (struct option) {
+        .set = true,
+        .type = OPTION_TYPE_UINT,
+        .val.vuint = 2 * TEST_BUF_SIZE,
+    };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+
+    buf = buf_borrow();
+    extra = buf_borrow();
+    ck_assert_ptr_ne(buf, NULL);
+    ck_assert_ptr_ne(extra, NULL);
+    ck_assert_ptr_eq(buf_borrow(), NULL);
+    ck_assert_uint_eq(bmetrics.buf_memory_ex.counter, 1);
+    ck_assert_uint_eq(bmetrics.buf_borrow_ex.counter, 1);
+
+    /* realloc'd growth counts too */
+    ck_assert_int_eq(dbuf_double(&buf), CC_ENOMEM);
+    ck_assert_uint_eq(bmetrics.buf_memory_ex.counter, 2);
+
+    buf_return(&extra);
+    extra = buf_borrow();
+    ck_assert_ptr_ne(extra, NULL);
+    buf_return(&extra);
+    buf_return(&buf);
+
+    /* free bufs of other classes make room for a larger one */
+    test_teardown();
+    boptions.buf_memory_max.val.vuint = 3 * TEST_BUF_SIZE;
+    boptions.buf_nclass = (struct option) {
+        .set = true,
+        .type = OPTION_TYPE_UINT,
+        .val.vuint = 2,
+    };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+    buf = buf_borrow();
+    extra = buf_borrow();
+    buf_return(&extra);
+    ck_assert_uint_eq(buf_write(buf, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    ck_assert_uint_eq(buf_size(buf), 2 * TEST_BUF_SIZE);
+    ck_assert_int_eq(memcmp(buf->rpos, MSG, sizeof(MSG)), 0);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 2);
+    ck_assert_int_eq(bmetrics.buf_memory.gauge, 3 * TEST_BUF_SIZE);
+    buf_return(&buf);
+
+    test_teardown();
+    test_setup();
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_buf_apply)
+{
+    struct buf *buf, *used;
+    option_val_u old = { .vuint = TEST_BUF_SIZE };
+
+    test_reset();
+
+    buf = buf_borrow();
+    used = buf_borrow();
+    buf_return(&buf);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 2);
+
+    /* free bufs of the old size go, one still in use goes on return */
+    boptions.buf_init_size.val.vuint = 2 * TEST_BUF_SIZE;
+    ck_assert_int_eq(buf_apply(&boptions.buf_init_size, old, &boptions),
+            CC_OK);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
+    buf = buf_borrow();
+    ck_assert_uint_eq(buf_size(buf), 2 * TEST_BUF_SIZE);
+    buf_return(&used);
+    buf_return(&buf);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
+
+    /* too small for the header, or needing new pools */
+    old.vuint = 2 * TEST_BUF_SIZE;
+    boptions.buf_init_size.val.vuint = BUF_HDR_SIZE;
+    ck_assert_int_eq(buf_apply(&boptions.buf_init_size, old, &boptions),
+            CC_ERROR);
+    ck_assert_uint_eq(buf_init_size, 2 * TEST_BUF_SIZE);
+    old.vuint = BUF_NCLASS;
+    ck_assert_int_eq(buf_apply(&boptions.buf_nclass, old, &boptions),
+            CC_ERROR);
+
+    test_teardown();
+    test_setup();
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -393,8 +805,10 @@ buf_suite(void)
 
     tcase_add_test(tc_buf, test_create_write_read_destroy_basic);
     tcase_add_test(tc_buf, test_create_write_read_destroy_long);
+    tcase_add_test(tc_buf, test_append);
     tcase_add_test(tc_buf, test_lshift);
     tcase_add_test(tc_buf, test_rshift);
+    tcase_add_test(tc_buf, test_chain);
 
     TCase *tc_dbuf = tcase_create("dbuf test");
     suite_add_tcase(s, tc_dbuf);
@@ -402,7 +816,14 @@ buf_suite(void)
     tcase_add_test(tc_dbuf, test_dbuf_double_basic);
     tcase_add_test(tc_dbuf, test_dbuf_double_over_max);
     tcase_add_test(tc_dbuf, test_dbuf_fit);
+    tcase_add_test(tc_dbuf, test_dbuf_fit_header);
     tcase_add_test(tc_dbuf, test_dbuf_shrink);
+    tcase_add_test(tc_dbuf, test_dbuf_class);
+    tcase_add_test(tc_dbuf, test_buf_poolslab);
+    tcase_add_test(tc_dbuf, test_buf_align);
+    tcase_add_test(tc_dbuf, test_buf_trim);
+    tcase_add_test(tc_dbuf, test_buf_memory_max);
+    tcase_add_test(tc_dbuf, test_buf_apply);
 
     return s;
 }
@@ -0,0 +1,216 @@
+#include <channel/cc_ktls.h>
+
+#include <check.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "ktls"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define MSG "hello, tls"
+
+static ktls_metrics_st metrics;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (ktls_metrics_st) { KTLS_METRIC(METRIC_INIT) };
+    tcp_setup(NULL, NULL);
+    ktls_setup(NULL, &metrics);
+}
+
+static void
+test_teardown(void)
+{
+    ktls_teardown();
+    tcp_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* a connected pair of tcp_conn over loopback */
+static void
+_tcp_pair(struct tcp_conn **client, struct tcp_conn **server)
+{
+    char servname[CC_UINTMAX_MAXLEN + 1];
+    struct tcp_conn *listen;
+    struct addrinfo hints, *ai;
+    uint16_t port;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_family = PF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    listen = tcp_conn_create();
+    for (port = 9101;; port++) {
+        sprintf(servname, "%"PRIu16, port);
+        ck_assert_int_eq(getaddrinfo("127.0.0.1", servname, &hints, &ai), 0);
+        if (tcp_listen(ai, listen)) {
+            break;
+        }
+        freeaddrinfo(ai);
+    }
+
+    *client = tcp_conn_create();
+    ck_assert(tcp_connect(ai, *client));
+    *server = tcp_conn_create();
+    while (!tcp_accept(listen, *server)) {}
+
+    tcp_close(listen);
+    tcp_conn_destroy(&listen);
+    freeaddrinfo(ai);
+}
+
+static void
+_key(struct ktls_key *k, ktls_cipher_e cipher, uint8_t seed)
+{
+    memset(k, 0, sizeof(*k));
+    k->version = KTLS_V13;
+    k->cipher = cipher;
+    memset(k->key, seed, sizeof(k->key));
+    memset(k->iv, seed + 1, sizeof(k->iv));
+}
+
+static ssize_t
+_recv(struct tcp_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    while ((n = tcp_recv(c, buf, nbyte)) == CC_EAGAIN) {}
+
+    return n;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_invalid)
+{
+    struct tcp_conn *client, *server;
+    struct ktls_key k;
+
+    test_reset();
+
+    _tcp_pair(&client, &server);
+
+    _key(&k, KTLS_SENTINEL, 1);
+    ck_assert_int_eq(ktls_enable(client, &k, NULL), CC_EINVAL);
+    _key(&k, KTLS_AES_128_GCM, 1);
+    k.version = 0x0302; /* TLS 1.1 */
+    ck_assert_int_eq(ktls_enable(client, NULL, &k), CC_EINVAL);
+    ck_assert_uint_eq(metrics.ktls_enable_ex.counter, 2);
+
+    /* nothing was installed, the conn works as before */
+    ck_assert_int_eq(tcp_send(client, MSG, sizeof(MSG)), sizeof(MSG));
+
+    tcp_close(client);
+    tcp_close(server);
+    tcp_conn_destroy(&client);
+    tcp_conn_destroy(&server);
+}
+END_TEST
+
+START_TEST(test_send_recv)
+{
+    ktls_cipher_e cipher[] = { KTLS_AES_128_GCM, KTLS_AES_256_GCM,
+        KTLS_CHACHA20_POLY1305 };
+    struct tcp_conn *client, *server;
+    struct ktls_key ktx, krx;
+    char buf[sizeof(MSG)];
+    uint8_t type;
+    rstatus_i status;
+    size_t i;
+
+    test_reset();
+
+    for (i = 0; i < sizeof(cipher) / sizeof(cipher[0]); i++) {
+        _tcp_pair(&client, &server);
+
+        _key(&ktx, cipher[i], 1);
+        _key(&krx, cipher[i], 2);
+        status = ktls_enable(client, &ktx, &krx);
+        if (status != CC_OK) {
+            /* tls module not available, or cipher not built into it */
+            ck_assert_int_eq(status, CC_ERROR);
+            ck_assert(client->err == ENOENT || client->err == ENOPROTOOPT ||
+                    client->err == EINVAL || client->err == EOPNOTSUPP);
+            ck_assert_uint_eq(metrics.ktls_enable_ex.counter, i + 1);
+            goto next;
+        }
+        ck_assert_int_eq(ktls_enable(server, &krx, &ktx), CC_OK);
+
+        /* both ends decrypt what the other encrypts */
+        ck_assert_int_eq(tcp_send(client, MSG, sizeof(MSG)), sizeof(MSG));
+        ck_assert_int_eq(_recv(server, buf, sizeof(buf)), sizeof(MSG));
+        ck_assert_str_eq(buf, MSG);
+        ck_assert_int_eq(tcp_send(server, MSG, sizeof(MSG)), sizeof(MSG));
+        ck_assert_int_eq(_recv(client, buf, sizeof(buf)), sizeof(MSG));
+        ck_assert_str_eq(buf, MSG);
+
+        /* a control record stops tcp_recv and is read with its type */
+        ck_assert_int_eq(ktls_send_record(client, KTLS_RECORD_ALERT, "\1\0",
+                    2), 2);
+        ck_assert_int_eq(_recv(server, buf, sizeof(buf)), CC_ERROR);
+        ck_assert_int_eq(server->err, EIO);
+        ck_assert_int_eq(ktls_recv_record(server, &type, buf, sizeof(buf)), 2);
+        ck_assert_int_eq(type, KTLS_RECORD_ALERT);
+
+next:
+        tcp_close(client);
+        tcp_close(server);
+        tcp_conn_destroy(&client);
+        tcp_conn_destroy(&server);
+    }
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+ktls_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_ktls = tcase_create("ktls test");
+    suite_add_tcase(s, tc_ktls);
+
+    tcase_add_test(tc_ktls, test_invalid);
+    tcase_add_test(tc_ktls, test_send_recv);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = ktls_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
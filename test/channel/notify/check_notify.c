@@ -0,0 +1,181 @@
+#include <channel/cc_notify.h>
+#include <cc_event.h>
+
+#include <check.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define SUITE_NAME "notify"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define NSEND 10000
+
+static notify_metrics_st metrics;
+static uint32_t nevent;
+static uint32_t nwork; /* produced by the sender thread */
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (notify_metrics_st) { NOTIFY_METRIC(METRIC_INIT) };
+    notify_setup(&metrics);
+    event_setup(NULL);
+    nevent = 0;
+    nwork = 0;
+}
+
+static void
+test_teardown(void)
+{
+    event_teardown();
+    notify_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+static void
+_event_cb(void *arg, uint32_t events)
+{
+    struct notify_conn *c = arg;
+
+    ck_assert(events & EVENT_READ);
+    ck_assert_int_eq(notify_recv(c), CC_OK);
+    nevent++;
+}
+
+static void *
+_send(void *arg)
+{
+    struct notify_conn *c = arg;
+    int i;
+
+    for (i = 0; i < NSEND; i++) {
+        __atomic_add_fetch(&nwork, 1, __ATOMIC_SEQ_CST);
+        ck_assert_int_eq(notify_send(c), CC_OK);
+    }
+
+    return NULL;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_send_recv)
+{
+    struct notify_conn *c;
+
+    test_reset();
+
+    c = notify_conn_create();
+    ck_assert_ptr_ne(c, NULL);
+    ck_assert(notify_open(c));
+    ck_assert_int_ge(notify_read_id(c), 0);
+
+    ck_assert_int_eq(notify_recv(c), CC_EAGAIN);
+
+    /* sends before the receiver gets to them make one wakeup */
+    ck_assert_int_eq(notify_send(c), CC_OK);
+    ck_assert_int_eq(notify_send(c), CC_OK);
+    ck_assert_int_eq(notify_send(c), CC_OK);
+    ck_assert_uint_eq(metrics.notify_send.counter, 1);
+    ck_assert_uint_eq(metrics.notify_send_coalesce.counter, 2);
+    ck_assert_int_eq(notify_recv(c), CC_OK);
+    ck_assert_int_eq(notify_recv(c), CC_EAGAIN);
+    ck_assert_uint_eq(metrics.notify_recv.counter, 1);
+
+    /* and the next one goes through again */
+    ck_assert_int_eq(notify_send(c), CC_OK);
+    ck_assert_uint_eq(metrics.notify_send.counter, 2);
+    ck_assert_int_eq(notify_recv(c), CC_OK);
+
+    notify_close(c);
+    ck_assert_int_eq(notify_read_id(c), -1);
+    notify_conn_destroy(&c);
+    ck_assert_ptr_eq(c, NULL);
+    ck_assert_int_eq(metrics.notify_conn_curr.gauge, 0);
+}
+END_TEST
+
+START_TEST(test_event_wakeup)
+{
+    struct notify_conn *c;
+    struct event_base *evb;
+    pthread_t thread;
+    uint32_t seen = 0;
+
+    test_reset();
+
+    c = notify_conn_create();
+    ck_assert(notify_open(c));
+    evb = event_base_create(16, _event_cb);
+    ck_assert_ptr_ne(evb, NULL);
+    ck_assert_int_eq(event_add_read(evb, notify_read_id(c), c), 0);
+
+    ck_assert_int_eq(event_wait(evb, 0), 0);
+
+    /* every piece of work is seen after some wakeup, none are lost */
+    pthread_create(&thread, NULL, _send, c);
+    while (seen < NSEND) {
+        ck_assert_int_ge(event_wait(evb, 1000), 1);
+        seen = __atomic_load_n(&nwork, __ATOMIC_SEQ_CST);
+    }
+    pthread_join(thread, NULL);
+    ck_assert_int_le(nevent, NSEND);
+    ck_assert_uint_eq(metrics.notify_send.counter +
+            metrics.notify_send_coalesce.counter, NSEND);
+
+    event_del(evb, notify_read_id(c));
+    event_base_destroy(&evb);
+    notify_close(c);
+    notify_conn_destroy(&c);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+notify_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_notify = tcase_create("notify test");
+    suite_add_tcase(s, tc_notify);
+
+    tcase_add_test(tc_notify, test_send_recv);
+    tcase_add_test(tc_notify, test_event_wakeup);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = notify_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
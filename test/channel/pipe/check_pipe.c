@@ -6,6 +6,7 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #define SUITE_NAME "pipe"
@@ -156,6 +157,67 @@ START_TEST(test_read_nonblocking)
 }
 END_TEST
 
+START_TEST(test_splice)
+{
+#define LEN 4096
+    pipe_metrics_st metrics = { PIPE_METRIC(METRIC_INIT) };
+    struct pipe_conn *p1, *p2;
+    char *send_data, recv_data[LEN];
+    FILE *f;
+    size_t i;
+
+    test_teardown();
+    pipe_setup(NULL, &metrics);
+
+    /* page aligned, so vmsplice maps rather than copies a partial page */
+    ck_assert_int_eq(posix_memalign((void **)&send_data, LEN, LEN), 0);
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+    f = tmpfile();
+    ck_assert_ptr_ne(f, NULL);
+
+    p1 = pipe_conn_create();
+    p2 = pipe_conn_create();
+    ck_assert(pipe_open(NULL, p1));
+    ck_assert(pipe_open(NULL, p2));
+    pipe_set_nonblocking(p1);
+    pipe_set_nonblocking(p2);
+
+    /* user memory into p1, duplicated into p2, neither copied */
+    ck_assert_int_eq(pipe_vmsplice(p1, send_data, LEN), LEN);
+    ck_assert_int_eq(pipe_nbuffered(p1), LEN);
+    ck_assert_int_eq(pipe_tee(p1, p2, LEN), LEN);
+    ck_assert_int_eq(pipe_nbuffered(p1), LEN);
+    ck_assert_int_eq(pipe_recv(p2, recv_data, LEN), LEN);
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+
+    /* p1 out to a file, and back in through p2 */
+    ck_assert_int_eq(pipe_splice_out(p1, fileno(f), LEN), LEN);
+    ck_assert_int_eq(pipe_nbuffered(p1), 0);
+    ck_assert_int_eq(pipe_splice_out(p1, fileno(f), LEN), CC_EAGAIN);
+    ck_assert_int_eq(lseek(fileno(f), 0, SEEK_SET), 0);
+    ck_assert_int_eq(pipe_splice_in(p2, fileno(f), LEN), LEN);
+    ck_assert_int_eq(pipe_splice_in(p2, fileno(f), LEN), 0);
+    memset(recv_data, 0, LEN);
+    ck_assert_int_eq(pipe_recv(p2, recv_data, LEN), LEN);
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+
+    ck_assert_int_eq(metrics.pipe_splice.counter, 6);
+    ck_assert_int_eq(metrics.pipe_splice_ex.counter, 1);
+    ck_assert_int_eq(metrics.pipe_splice_byte.counter, 4 * LEN);
+
+    pipe_close(p1);
+    pipe_close(p2);
+    pipe_conn_destroy(&p1);
+    pipe_conn_destroy(&p2);
+    fclose(f);
+    free(send_data);
+    test_reset();
+#undef LEN
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -168,6 +230,7 @@ pipe_suite(void)
     tcase_add_test(tc_pipe, test_send_recv);
     tcase_add_test(tc_pipe, test_read_blocking);
     tcase_add_test(tc_pipe, test_read_nonblocking);
+    tcase_add_test(tc_pipe, test_splice);
     suite_add_tcase(s, tc_pipe);
 
     return s;
@@ -3,6 +3,7 @@
 
 #include <check.h>
 
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -133,6 +134,89 @@ START_TEST(test_listen_listen)
 }
 END_TEST
 
+START_TEST(test_listen_n)
+{
+#define NLISTEN 4
+#define NCLIENT 8
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    struct tcp_conn *conn_listen[NLISTEN], *conn_client[NCLIENT];
+    struct tcp_conn *conn_server[NCLIENT];
+    struct addrinfo *ai;
+    uint32_t i, n = 0;
+
+    find_port_listen(&conn_listen[0], &ai, NULL);
+    tcp_close(conn_listen[0]);
+
+    tcp_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.tcp_reuseport_cpu.val.vbool = true;
+    tcp_setup(&options, NULL);
+
+    for (i = 1; i < NLISTEN; i++) {
+        conn_listen[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_listen[i], NULL);
+    }
+    ck_assert(tcp_listen_n(ai, conn_listen, NLISTEN));
+
+    for (i = 0; i < NCLIENT; i++) {
+        conn_client[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_client[i], NULL);
+        ck_assert_int_eq(tcp_connect(ai, conn_client[i]), true);
+    }
+    usleep(10000);
+
+    /* every connection lands on exactly one of the listeners */
+    for (i = 0; i < NLISTEN; i++) {
+        n += tcp_accept_batch(conn_listen[i], conn_server + n, NCLIENT - n);
+    }
+    ck_assert_int_eq(n, NCLIENT);
+
+    for (i = 0; i < NCLIENT; i++) {
+        tcp_close(conn_server[i]);
+        tcp_conn_return(&conn_server[i]);
+        tcp_close(conn_client[i]);
+        tcp_conn_destroy(&conn_client[i]);
+    }
+    for (i = 0; i < NLISTEN; i++) {
+        tcp_close(conn_listen[i]);
+        tcp_conn_destroy(&conn_listen[i]);
+    }
+    freeaddrinfo(ai);
+#undef NLISTEN
+#undef NCLIENT
+}
+END_TEST
+
+START_TEST(test_listen_reuseport)
+{
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    struct tcp_conn *conn_listen1, *conn_listen2;
+    struct addrinfo *ai;
+
+    find_port_listen(&conn_listen1, &ai, NULL);
+    tcp_close(conn_listen1);
+
+    tcp_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.tcp_reuseport.val.vbool = true;
+    tcp_setup(&options, NULL);
+
+    /* unlike test_listen_listen, both listeners can bind */
+    conn_listen2 = tcp_conn_create();
+    ck_assert_ptr_ne(conn_listen2, NULL);
+    ck_assert_int_eq(tcp_listen(ai, conn_listen1), true);
+    ck_assert_int_eq(tcp_listen(ai, conn_listen2), true);
+
+    tcp_close(conn_listen1);
+    tcp_close(conn_listen2);
+    tcp_conn_destroy(&conn_listen1);
+    tcp_conn_destroy(&conn_listen2);
+    freeaddrinfo(ai);
+}
+END_TEST
+
 START_TEST(test_client_send_server_recv)
 {
 #define LEN 20
@@ -175,6 +259,80 @@ START_TEST(test_client_send_server_recv)
 }
 END_TEST
 
+static void
+_count_conn(struct tcp_conn *c, void *arg)
+{
+    (void)c;
+    (*(int *)arg)++;
+}
+
+START_TEST(test_conn_stats)
+{
+#define LEN 20
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    struct tcp_conn *conn_listen, *conn_client, *conn_server, *c;
+    struct addrinfo *ai;
+    char data[LEN];
+    ssize_t recv;
+    int n;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    tcp_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.tcp_conn_stats.val.vbool = true;
+    tcp_setup(&options, NULL);
+
+    conn_client = tcp_conn_create();
+    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    conn_server = tcp_conn_create();
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    /* nothing there yet */
+    ck_assert_int_eq(tcp_recv(conn_server, data, LEN), CC_EAGAIN);
+    ck_assert_int_eq(conn_server->stats.nrecv, 1);
+    ck_assert_int_eq(conn_server->stats.nagain, 1);
+
+    memset(data, 'a', LEN);
+    ck_assert_int_eq(tcp_send(conn_client, data, LEN), LEN);
+    while ((recv = tcp_recv(conn_server, data, LEN)) == CC_EAGAIN) {}
+    ck_assert_int_eq(recv, LEN);
+    ck_assert_int_ge(conn_server->stats.nrecv, 2);
+    ck_assert_int_eq(conn_client->stats.nsend, 1);
+    ck_assert_int_eq(conn_client->stats.npartial, 0);
+    ck_assert_int_eq(conn_client->stats.nagain, 0);
+    ck_assert_int_ge(tcp_conn_idle_ms(conn_server), 0);
+    ck_assert_int_lt(tcp_conn_idle_ms(conn_server), 1000);
+
+    /* conns created since setup, borrowed ones until returned */
+    n = 0;
+    tcp_conn_foreach(_count_conn, &n);
+    ck_assert_int_eq(n, 2);
+    c = tcp_conn_borrow();
+    n = 0;
+    tcp_conn_foreach(_count_conn, &n);
+    ck_assert_int_eq(n, 3);
+    tcp_conn_return(&c);
+    n = 0;
+    tcp_conn_foreach(_count_conn, &n);
+    ck_assert_int_eq(n, 2);
+
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_close(conn_client);
+
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_client);
+    tcp_conn_destroy(&conn_server);
+    n = 0;
+    tcp_conn_foreach(_count_conn, &n);
+    ck_assert_int_eq(n, 0);
+    freeaddrinfo(ai);
+#undef LEN
+}
+END_TEST
+
 START_TEST(test_server_send_client_recv)
 {
 #define LEN 20
@@ -273,6 +431,301 @@ START_TEST(test_client_sendv_server_recvv)
 }
 END_TEST
 
+START_TEST(test_send_zerocopy)
+{
+#define LEN (64 * KiB)
+#define ZC_MIN KiB
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct addrinfo *ai;
+    char *send_data, *recv_data;
+    size_t i, nsend = 0, nrecv = 0;
+    ssize_t n;
+
+    send_data = malloc(LEN);
+    recv_data = malloc(LEN);
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    tcp_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.tcp_zerocopy.val.vbool = true;
+    options.tcp_zerocopy_min.val.vuint = ZC_MIN;
+    tcp_setup(&options, &metrics);
+
+    conn_client = tcp_conn_create();
+    ck_assert_ptr_ne(conn_client, NULL);
+    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    ck_assert(conn_client->zerocopy);
+
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    /* small sends are copied as usual */
+    ck_assert_int_eq(tcp_send_zc(conn_client, send_data, ZC_MIN - 1), ZC_MIN - 1);
+    ck_assert_int_eq(tcp_zerocopy_pending(conn_client), 0);
+    while ((n = tcp_recv(conn_server, recv_data, LEN)) == CC_EAGAIN) {}
+    ck_assert_int_eq(n, ZC_MIN - 1);
+
+    while (nrecv < LEN) {
+        if (nsend < LEN) {
+            n = tcp_send_zc(conn_client, send_data + nsend, LEN - nsend);
+            ck_assert(n > 0 || n == CC_EAGAIN);
+            nsend += n > 0 ? (size_t)n : 0;
+        }
+        n = tcp_recv(conn_server, recv_data + nrecv, LEN - nrecv);
+        ck_assert(n > 0 || n == CC_EAGAIN);
+        nrecv += n > 0 ? (size_t)n : 0;
+    }
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+    ck_assert_int_gt(conn_client->zc_sent, 0);
+    ck_assert_int_eq(metrics.tcp_send_zc.counter, conn_client->zc_sent);
+
+    /* all data was received, completions follow shortly */
+    for (i = 0; i < 100 && tcp_zerocopy_reap(conn_client) > 0; i++) {
+        usleep(1000);
+    }
+    ck_assert_int_eq(tcp_zerocopy_pending(conn_client), 0);
+    ck_assert_int_eq(metrics.tcp_send_zc_done.counter, conn_client->zc_sent);
+
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_close(conn_client);
+
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_client);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    free(send_data);
+    free(recv_data);
+#undef LEN
+#undef ZC_MIN
+}
+END_TEST
+
+static void
+_zc_release(void *data)
+{
+    (*(int *)data)++;
+}
+
+START_TEST(test_zerocopy_close)
+{
+#define LEN (256 * KiB)
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct addrinfo *ai;
+    char *send_data, *recv_data;
+    size_t i, nsend = 0, nrecv = 0;
+    int nrelease = 0;
+    bool lingering;
+    ssize_t n;
+
+    send_data = malloc(LEN);
+    recv_data = malloc(LEN + 1); /* room to read the end of the stream */
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    tcp_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.tcp_zerocopy.val.vbool = true;
+    tcp_setup(&options, &metrics);
+
+    conn_client = tcp_conn_create();
+    ck_assert_ptr_ne(conn_client, NULL);
+    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    /* close with completions not yet reaped, the memory is released later */
+    while (nsend < LEN) {
+        n = tcp_send_zc(conn_client, send_data + nsend, LEN - nsend);
+        ck_assert(n > 0 || n == CC_EAGAIN);
+        nsend += n > 0 ? (size_t)n : 0;
+        n = tcp_recv(conn_server, recv_data + nrecv, LEN + 1 - nrecv);
+        nrecv += n > 0 ? (size_t)n : 0;
+    }
+    tcp_close(conn_client);
+    lingering = conn_client->zc_linger != NULL;
+    ck_assert(tcp_zerocopy_pinned(conn_client) == lingering);
+    tcp_zerocopy_release(conn_client, _zc_release, &nrelease);
+    ck_assert_int_eq(nrelease, lingering ? 0 : 1);
+    ck_assert_ptr_eq(conn_client->zc_linger, NULL);
+    tcp_conn_destroy(&conn_client);
+
+    /* the peer still gets everything, then the end of the stream */
+    while ((n = tcp_recv(conn_server, recv_data + nrecv, LEN + 1 - nrecv)) != 0) {
+        ck_assert(n > 0 || n == CC_EAGAIN);
+        nrecv += n > 0 ? (size_t)n : 0;
+        tcp_zerocopy_reap(NULL);
+    }
+    ck_assert_int_eq(nrecv, LEN);
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+    for (i = 0; i < 100 && tcp_zerocopy_reap(NULL) > 0; i++) {
+        usleep(1000);
+    }
+    ck_assert_int_eq(tcp_zerocopy_reap(NULL), 0);
+    ck_assert_int_eq(nrelease, 1);
+
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    free(send_data);
+    free(recv_data);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_proxy)
+{
+#define LEN (256 * KiB)
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    struct tcp_conn *conn_listen, *client1, *server1, *client2, *server2;
+    struct pipe_conn *p;
+    struct addrinfo *ai;
+    char *send_data, *recv_data;
+    size_t i, nsend = 0, nrecv = 0;
+    ssize_t n;
+
+    send_data = malloc(LEN);
+    recv_data = malloc(LEN);
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+
+    find_port_listen(&conn_listen, &ai, NULL);
+    tcp_teardown();
+    tcp_setup(NULL, &metrics);
+
+    /* client1 -> server1 -proxy-> client2 -> server2 */
+    client1 = tcp_conn_create();
+    server1 = tcp_conn_create();
+    client2 = tcp_conn_create();
+    server2 = tcp_conn_create();
+    ck_assert(tcp_connect(ai, client1));
+    ck_assert(tcp_accept(conn_listen, server1));
+    ck_assert(tcp_connect(ai, client2));
+    ck_assert(tcp_accept(conn_listen, server2));
+    p = pipe_conn_create();
+    ck_assert(pipe_open(NULL, p));
+    pipe_set_nonblocking(p);
+
+    ck_assert_int_eq(tcp_proxy(server1, client2, p, LEN), CC_EAGAIN);
+    while (nrecv < LEN) {
+        if (nsend < LEN) {
+            n = tcp_send(client1, send_data + nsend, LEN - nsend);
+            ck_assert(n > 0 || n == CC_EAGAIN);
+            nsend += n > 0 ? (size_t)n : 0;
+        }
+        n = tcp_proxy(server1, client2, p, 64 * KiB);
+        ck_assert(n > 0 || n == CC_EAGAIN);
+        n = tcp_recv(server2, recv_data + nrecv, LEN - nrecv);
+        ck_assert(n > 0 || n == CC_EAGAIN);
+        nrecv += n > 0 ? (size_t)n : 0;
+    }
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+    ck_assert_int_eq(pipe_nbuffered(p), 0);
+    ck_assert_int_eq(server1->recv_nbyte, LEN);
+    ck_assert_int_eq(client2->send_nbyte, LEN);
+
+    /* eof on the source is reported once everything is forwarded */
+    tcp_close(client1);
+    while ((n = tcp_proxy(server1, client2, p, 64 * KiB)) == CC_EAGAIN) {}
+    ck_assert_int_eq(n, 0);
+    ck_assert_int_eq(server1->state, CHANNEL_TERM);
+
+    pipe_close(p);
+    pipe_conn_destroy(&p);
+    tcp_close(conn_listen);
+    tcp_close(server1);
+    tcp_close(client2);
+    tcp_close(server2);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&client1);
+    tcp_conn_destroy(&server1);
+    tcp_conn_destroy(&client2);
+    tcp_conn_destroy(&server2);
+    freeaddrinfo(ai);
+    free(send_data);
+    free(recv_data);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_accept_batch)
+{
+#define NCLIENT 5
+#define POOLSIZE 3
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    struct tcp_conn *conn_listen, *conn_client[NCLIENT], *conn_server[NCLIENT];
+    struct addrinfo *ai;
+    uint32_t i, n;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    /* nothing pending */
+    ck_assert_int_eq(tcp_accept_batch(conn_listen, conn_server, NCLIENT), 0);
+
+    /* limit the pool so part of the batch cannot be held */
+    tcp_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.tcp_poolsize.val.vuint = POOLSIZE;
+    tcp_setup(&options, &metrics);
+
+    for (i = 0; i < NCLIENT; i++) {
+        conn_client[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_client[i], NULL);
+        ck_assert_int_eq(tcp_connect(ai, conn_client[i]), true);
+    }
+    /* let the handshakes complete */
+    usleep(10000);
+
+    n = tcp_accept_batch(conn_listen, conn_server, 2);
+    ck_assert_int_eq(n, 2);
+    n += tcp_accept_batch(conn_listen, conn_server + n, NCLIENT);
+    ck_assert_int_eq(n, POOLSIZE);
+    ck_assert_int_eq(metrics.tcp_accept.counter, NCLIENT);
+    ck_assert_int_eq(metrics.tcp_reject.counter, NCLIENT - POOLSIZE);
+    ck_assert_int_eq(metrics.tcp_conn_active.gauge, POOLSIZE);
+    for (i = 0; i < n; i++) {
+        ck_assert_int_eq(conn_server[i]->state, CHANNEL_ESTABLISHED);
+        ck_assert_int_eq(conn_server[i]->level, CHANNEL_BASE);
+        ck_assert(fcntl(conn_server[i]->sd, F_GETFL) & O_NONBLOCK);
+        ck_assert(fcntl(conn_server[i]->sd, F_GETFD) & FD_CLOEXEC);
+    }
+
+    for (i = 0; i < n; i++) {
+        tcp_close(conn_server[i]);
+        tcp_conn_return(&conn_server[i]);
+    }
+    for (i = 0; i < NCLIENT; i++) {
+        tcp_close(conn_client[i]);
+        tcp_conn_destroy(&conn_client[i]);
+    }
+    tcp_close(conn_listen);
+    tcp_conn_destroy(&conn_listen);
+    freeaddrinfo(ai);
+#undef NCLIENT
+#undef POOLSIZE
+}
+END_TEST
+
 struct task {
     useconds_t usleep;
     struct tcp_conn *c;
@@ -361,9 +814,16 @@ log_suite(void)
 
     tcase_add_test(tc_log, test_listen_connect);
     tcase_add_test(tc_log, test_listen_listen);
+    tcase_add_test(tc_log, test_listen_reuseport);
+    tcase_add_test(tc_log, test_listen_n);
     tcase_add_test(tc_log, test_client_send_server_recv);
     tcase_add_test(tc_log, test_server_send_client_recv);
+    tcase_add_test(tc_log, test_conn_stats);
     tcase_add_test(tc_log, test_client_sendv_server_recvv);
+    tcase_add_test(tc_log, test_send_zerocopy);
+    tcase_add_test(tc_log, test_zerocopy_close);
+    tcase_add_test(tc_log, test_proxy);
+    tcase_add_test(tc_log, test_accept_batch);
     tcase_add_test(tc_log, test_nonblocking);
 
     return s;
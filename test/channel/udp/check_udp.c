@@ -0,0 +1,256 @@
+#include <channel/cc_udp.h>
+
+#include <check.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE_NAME "udp"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define NMSG 40
+
+static udp_metrics_st metrics;
+static struct udp_conn *server, *client;
+static struct udp_msg msg[UDP_BATCH_MAX];
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (udp_metrics_st) { UDP_METRIC(METRIC_INIT) };
+    udp_setup(NULL, &metrics);
+    buf_setup(NULL, NULL);
+}
+
+static void
+test_teardown(void)
+{
+    buf_teardown();
+    udp_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* a server on an ephemeral loopback port, and a client connected to it */
+static void
+_open(void)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    struct addrinfo ai;
+    uint32_t i;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    memset(&ai, 0, sizeof(ai));
+    ai.ai_family = AF_INET;
+    ai.ai_addr = (struct sockaddr *)&sin;
+    ai.ai_addrlen = sizeof(sin);
+
+    server = udp_conn_create();
+    client = udp_conn_create();
+    ck_assert(udp_bind(&ai, server));
+    ck_assert_int_eq(getsockname(server->sd, (struct sockaddr *)&sin, &len), 0);
+    ck_assert(udp_connect(&ai, client));
+
+    for (i = 0; i < UDP_BATCH_MAX; i++) {
+        msg[i].buf = buf_borrow();
+        ck_assert_ptr_ne(msg[i].buf, NULL);
+        msg[i].addrlen = 0;
+    }
+}
+
+static void
+_close(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < UDP_BATCH_MAX; i++) {
+        buf_return(&msg[i].buf);
+    }
+    udp_close(server);
+    udp_close(client);
+    udp_conn_destroy(&server);
+    udp_conn_destroy(&client);
+}
+
+/*
+ * tests
+ */
+START_TEST(test_send_recv)
+{
+    char data[64];
+
+    test_reset();
+    _open();
+
+    ck_assert_int_eq(udp_recv_batch(server, msg, 1), CC_EAGAIN);
+
+    /* request from the client gets a reply to where it came from */
+    ck_assert_int_eq(udp_send(client, "ping", 4), 4);
+    ck_assert_int_eq(udp_recv_batch(server, msg, UDP_BATCH_MAX), 1);
+    ck_assert_int_eq(buf_rsize(msg[0].buf), 4);
+    ck_assert_int_eq(memcmp(msg[0].buf->rpos, "ping", 4), 0);
+    ck_assert_int_eq(msg[0].addrlen, sizeof(struct sockaddr_in));
+    ck_assert(!msg[0].trunc);
+
+    buf_reset(msg[0].buf);
+    buf_write(msg[0].buf, "pong", 4);
+    ck_assert_int_eq(udp_send_batch(server, msg, 1), 1);
+    ck_assert_int_eq(buf_rsize(msg[0].buf), 0);
+    ck_assert_int_eq(udp_recv(client, data, sizeof(data)), 4);
+    ck_assert_int_eq(memcmp(data, "pong", 4), 0);
+    ck_assert_int_eq(udp_recv(client, data, sizeof(data)), CC_EAGAIN);
+
+    ck_assert_int_eq(client->send_nbyte, 4);
+    ck_assert_int_eq(server->recv_nbyte, 4);
+    ck_assert_int_eq(metrics.udp_recv_dgram.counter, 2);
+
+    _close();
+}
+END_TEST
+
+START_TEST(test_batch)
+{
+    uint32_t i;
+
+    test_reset();
+    _open();
+
+    /* many datagrams out and in, one syscall for each side */
+    for (i = 0; i < NMSG; i++) {
+        buf_reset(msg[i].buf);
+        msg[i].buf->wpos += sprintf(msg[i].buf->wpos, "datagram %"PRIu32, i);
+    }
+    ck_assert_int_eq(udp_send_batch(client, msg, NMSG), NMSG);
+    for (i = 0; i < UDP_BATCH_MAX; i++) {
+        buf_reset(msg[i].buf);
+    }
+    ck_assert_int_eq(udp_recv_batch(server, msg, UDP_BATCH_MAX), NMSG);
+#ifdef OS_LINUX
+    ck_assert_int_eq(metrics.udp_send.counter, 1);
+    ck_assert_int_eq(metrics.udp_recv.counter, 1);
+#endif
+    for (i = 0; i < NMSG; i++) {
+        char expect[32];
+        int len = sprintf(expect, "datagram %"PRIu32, i);
+
+        ck_assert_int_eq(buf_rsize(msg[i].buf), len);
+        ck_assert_int_eq(memcmp(msg[i].buf->rpos, expect, len), 0);
+    }
+    ck_assert_int_eq(metrics.udp_send_dgram.counter, NMSG);
+    ck_assert_int_eq(metrics.udp_recv_dgram.counter, NMSG);
+
+    /* what does not fit the buf is cut off and flagged */
+    ck_assert_int_eq(udp_send(client, "0123456789", 10), 10);
+    buf_reset(msg[0].buf);
+    msg[0].buf->wpos = msg[0].buf->end - 4;
+    ck_assert_int_eq(udp_recv_batch(server, msg, 1), 1);
+    ck_assert(msg[0].trunc);
+    ck_assert_int_eq(buf_rsize(msg[0].buf), msg[0].buf->end - msg[0].buf->begin);
+    ck_assert_int_eq(metrics.udp_recv_trunc.counter, 1);
+
+    _close();
+}
+END_TEST
+
+START_TEST(test_gso)
+{
+#define SEGSIZE 100
+#define LEN (9 * SEGSIZE + 50)
+    udp_options_st options = { UDP_OPTION(OPTION_INIT) };
+    uint32_t i, nrecv = 0;
+    int n;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(udp_options_st));
+    options.udp_gro.val.vbool = true;
+    test_reset();
+    udp_teardown();
+    udp_setup(&options, &metrics);
+    _open();
+
+    buf_reset(msg[0].buf);
+    for (i = 0; i < LEN; i++) {
+        *msg[0].buf->wpos++ = (char)i;
+    }
+    ck_assert_int_eq(udp_send_gso(client, &msg[0], SEGSIZE), LEN);
+    ck_assert_int_eq(buf_rsize(msg[0].buf), 0);
+    ck_assert_int_eq(metrics.udp_send_dgram.counter, 10);
+
+    /* with GRO we may get them back coalesced, either way in order */
+    while (nrecv < LEN) {
+        for (i = 0; i < UDP_BATCH_MAX; i++) {
+            buf_reset(msg[i].buf);
+        }
+        n = udp_recv_batch(server, msg, UDP_BATCH_MAX);
+        ck_assert_int_gt(n, 0);
+        for (i = 0; i < (uint32_t)n; i++) {
+            if (msg[i].segsize > 0) {
+                ck_assert_int_eq(msg[i].segsize, SEGSIZE);
+            } else {
+                ck_assert_int_le(buf_rsize(msg[i].buf), SEGSIZE);
+            }
+            for (; buf_rsize(msg[i].buf) > 0; nrecv++) {
+                ck_assert_int_eq(*msg[i].buf->rpos++, (char)nrecv);
+            }
+        }
+    }
+    ck_assert_int_eq(nrecv, LEN);
+
+    _close();
+#undef SEGSIZE
+#undef LEN
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+udp_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_udp = tcase_create("udp test");
+    suite_add_tcase(s, tc_udp);
+
+    tcase_add_test(tc_udp, test_send_recv);
+    tcase_add_test(tc_udp, test_batch);
+    tcase_add_test(tc_udp, test_gso);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = udp_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
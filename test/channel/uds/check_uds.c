@@ -0,0 +1,254 @@
+#include <channel/cc_uds.h>
+
+#include <check.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SUITE_NAME "uds"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+static uds_metrics_st metrics;
+static char path[64];
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (uds_metrics_st) { UDS_METRIC(METRIC_INIT) };
+    uds_setup(NULL, &metrics);
+    snprintf(path, sizeof(path), "/tmp/check_uds.%d.sock", (int)getpid());
+}
+
+static void
+test_teardown(void)
+{
+    unlink(path);
+    uds_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* listen on path, and connect and accept one client */
+static void
+_connect(struct uds_conn **l, struct uds_conn **client, struct uds_conn **server)
+{
+    *l = uds_conn_create();
+    *client = uds_conn_create();
+    *server = uds_conn_borrow();
+    ck_assert_ptr_ne(*l, NULL);
+    ck_assert_ptr_ne(*client, NULL);
+    ck_assert_ptr_ne(*server, NULL);
+
+    ck_assert(uds_listen(path, *l));
+    ck_assert_int_eq((*l)->state, CHANNEL_LISTEN);
+    ck_assert(!uds_accept(*l, *server));
+    ck_assert(uds_connect(path, *client));
+    ck_assert(uds_accept(*l, *server));
+    ck_assert_int_eq((*server)->state, CHANNEL_ESTABLISHED);
+}
+
+static void
+_close(struct uds_conn **l, struct uds_conn **client, struct uds_conn **server)
+{
+    uds_close(*l);
+    uds_close(*client);
+    uds_close(*server);
+    uds_conn_destroy(l);
+    uds_conn_destroy(client);
+    uds_conn_return(server);
+}
+
+/*
+ * tests
+ */
+START_TEST(test_listen_connect)
+{
+    struct uds_conn *l, *l2, *c;
+    int fd;
+
+    test_reset();
+
+    l = uds_conn_create();
+    c = uds_conn_create();
+
+    /* nobody listening */
+    ck_assert(!uds_connect(path, c));
+    ck_assert_int_eq(metrics.uds_connect_ex.counter, 1);
+
+    /* a stale socket file is replaced, anything else is left alone */
+    ck_assert(uds_listen(path, l));
+    uds_close(l);
+    ck_assert(uds_listen(path, l));
+    l2 = uds_conn_create();
+    ck_assert(!uds_listen(path, l2));
+    ck_assert_int_eq(l2->err, EADDRINUSE);
+    uds_conn_destroy(&l2);
+    ck_assert(uds_connect(path, c));
+    uds_reject(l);
+    ck_assert_int_eq(metrics.uds_reject.counter, 1);
+    ck_assert_int_eq(metrics.uds_reject_ex.counter, 0);
+    uds_close(c);
+    uds_close(l);
+    unlink(path);
+
+    fd = open(path, O_CREAT | O_WRONLY, 0600);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+    ck_assert(!uds_listen(path, l));
+    ck_assert_int_eq(access(path, F_OK), 0);
+
+    uds_conn_destroy(&l);
+    uds_conn_destroy(&c);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_send_recv)
+{
+#define LEN 1000
+    struct uds_conn *l, *client, *server;
+    channel_handler_st hdl = {
+        .accept = (channel_accept_fn)uds_accept,
+        .reject = (channel_reject_fn)uds_reject,
+        .open = (channel_open_fn)uds_connect,
+        .term = (channel_term_fn)uds_close,
+        .recv = (channel_recv_fn)uds_recv,
+        .send = (channel_send_fn)uds_send,
+        .rid = (channel_id_fn)uds_read_id,
+        .wid = (channel_id_fn)uds_write_id,
+    };
+    char send_data[LEN], recv_data[LEN];
+    size_t i;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+
+    _connect(&l, &client, &server);
+
+    ck_assert_int_eq(hdl.recv(server, recv_data, LEN), CC_EAGAIN);
+    ck_assert_int_eq(hdl.send(client, send_data, LEN), LEN);
+    ck_assert_int_eq(hdl.recv(server, recv_data, LEN), LEN);
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+    ck_assert_int_eq(hdl.rid(server), hdl.wid(server));
+    ck_assert_int_eq(server->recv_nbyte, LEN);
+    ck_assert_int_eq(client->send_nbyte, LEN);
+    ck_assert_int_eq(metrics.uds_recv_byte.counter, LEN);
+
+    hdl.term(client);
+    ck_assert_int_eq(hdl.recv(server, recv_data, LEN), 0);
+    ck_assert_int_eq(server->state, CHANNEL_TERM);
+
+    _close(&l, &client, &server);
+    ck_assert_int_eq(metrics.uds_conn_active.gauge, 0);
+    unlink(path);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_pass_fd)
+{
+    struct uds_conn *l, *client, *server;
+    int p[2], fd[UDS_NFD_MAX];
+    uint32_t nfd;
+    char c = 'x', buf[4];
+
+    test_reset();
+
+    _connect(&l, &client, &server);
+
+    /* pass both ends of a pipe, and check they work on the other side */
+    ck_assert_int_eq(pipe(p), 0);
+    ck_assert_int_eq(uds_sendfd(client, &c, 1, p, 2), 1);
+    close(p[0]);
+    close(p[1]);
+
+    nfd = UDS_NFD_MAX;
+    ck_assert_int_eq(uds_recvfd(server, buf, sizeof(buf), fd, &nfd), 1);
+    ck_assert_int_eq(buf[0], 'x');
+    ck_assert_int_eq(nfd, 2);
+    ck_assert(fcntl(fd[0], F_GETFD) & FD_CLOEXEC);
+    ck_assert_int_eq(write(fd[1], "abc", 3), 3);
+    ck_assert_int_eq(read(fd[0], buf, 3), 3);
+    ck_assert_int_eq(memcmp(buf, "abc", 3), 0);
+    close(fd[0]);
+    close(fd[1]);
+    ck_assert_int_eq(metrics.uds_send_fd.counter, 2);
+    ck_assert_int_eq(metrics.uds_recv_fd.counter, 2);
+
+    /* fds beyond the capacity given are closed, the data still arrives */
+    ck_assert_int_eq(pipe(p), 0);
+    ck_assert_int_eq(uds_sendfd(client, &c, 1, p, 2), 1);
+    close(p[1]);
+    nfd = 1;
+    ck_assert_int_eq(uds_recvfd(server, buf, sizeof(buf), fd, &nfd), 1);
+    ck_assert_int_eq(nfd, 1);
+    ck_assert_int_ne(fd[0], p[0]);
+    close(p[0]);
+    ck_assert_int_eq(read(fd[0], buf, 1), 0); /* all write ends are closed */
+    close(fd[0]);
+
+    /* and plain data comes with no fds */
+    ck_assert_int_eq(uds_sendfd(client, &c, 1, NULL, 0), 1);
+    nfd = UDS_NFD_MAX;
+    ck_assert_int_eq(uds_recvfd(server, buf, sizeof(buf), fd, &nfd), 1);
+    ck_assert_int_eq(nfd, 0);
+
+    _close(&l, &client, &server);
+    unlink(path);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+uds_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_uds = tcase_create("uds test");
+    suite_add_tcase(s, tc_uds);
+
+    tcase_add_test(tc_uds, test_listen_connect);
+    tcase_add_test(tc_uds, test_send_recv);
+    tcase_add_test(tc_uds, test_pass_fd);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = uds_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,154 @@
+#include <cc_cpu.h>
+#include <cc_mm.h>
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUITE_NAME "cpu"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    cpu_setup();
+}
+
+static void
+test_teardown(void)
+{
+    cpu_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/*
+ * tests
+ */
+START_TEST(test_topology)
+{
+    const struct cpu_info *c;
+    uint32_t i;
+    int cpu, node;
+
+    test_reset();
+
+    ck_assert_uint_gt(cpu_count(), 0);
+    ck_assert_uint_le(cpu_count(), sysconf(_SC_NPROCESSORS_ONLN));
+    ck_assert_uint_gt(cpu_nnode(), 0);
+    for (i = 0; i < cpu_count(); i++) {
+        c = cpu_get(i);
+        ck_assert_int_ge(c->cpu, 0);
+        ck_assert_int_lt(c->cpu, CPU_MAX);
+        ck_assert_int_ge(c->node, 0);
+        ck_assert_uint_lt(c->node, cpu_nnode());
+        ck_assert_int_eq(cpu_node(c->cpu), c->node);
+        if (i > 0) {
+            ck_assert_int_gt(c->cpu, cpu_get(i - 1)->cpu);
+        }
+    }
+
+    /* nodes are still looked up without setup */
+    cpu = cpu_get(0)->cpu;
+    node = cpu_get(0)->node;
+    test_teardown();
+    ck_assert_uint_eq(cpu_count(), 0);
+    ck_assert_int_eq(cpu_node(cpu), node);
+    test_setup();
+}
+END_TEST
+
+START_TEST(test_pin)
+{
+    const struct cpu_info *c;
+
+    test_reset();
+
+    c = cpu_get(cpu_count() - 1);
+    ck_assert_int_eq(cpu_pin(c->cpu), CC_OK);
+    ck_assert_int_eq(cpu_current(), c->cpu);
+    ck_assert_int_eq(cpu_unpin(), CC_OK);
+
+    ck_assert_int_eq(cpu_pin_node(c->node), CC_OK);
+    ck_assert_int_eq(cpu_node(cpu_current()), c->node);
+    ck_assert_int_eq(cpu_unpin(), CC_OK);
+
+    /* nothing left to run on */
+    ck_assert_int_eq(cpu_pin(-1), CC_EINVAL);
+    ck_assert_int_eq(cpu_pin_node(CPU_MAX), CC_EINVAL);
+}
+END_TEST
+
+START_TEST(test_mmap_local)
+{
+    mm_options_st options = { MM_OPTION(OPTION_INIT) };
+    char *p;
+
+    test_reset();
+
+    /* binding to the local node never fails the mapping */
+    p = cc_mmap_ext(MM_HUGEPAGE_SIZE, MM_HUGEPAGE_NONE, MM_NUMA_LOCAL);
+    ck_assert_ptr_ne(p, NULL);
+    memset(p, 1, MM_HUGEPAGE_SIZE);
+    ck_assert_int_eq(cc_munmap(p, MM_HUGEPAGE_SIZE), 0);
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(mm_options_st));
+    options.mm_numa_local.val.vbool = true;
+    mm_setup(&options, NULL);
+    p = cc_mmap(MM_HUGEPAGE_SIZE);
+    ck_assert_ptr_ne(p, NULL);
+    memset(p, 1, MM_HUGEPAGE_SIZE);
+    ck_assert_int_eq(cc_munmap(p, MM_HUGEPAGE_SIZE), 0);
+    mm_teardown();
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+cpu_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_cpu = tcase_create("cpu test");
+    suite_add_tcase(s, tc_cpu);
+
+    tcase_add_test(tc_cpu, test_topology);
+    tcase_add_test(tc_cpu, test_pin);
+    tcase_add_test(tc_cpu, test_mmap_local);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = cpu_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,11 +1,16 @@
 #include <cc_event.h>
+#include <buffer/cc_buf.h>
 #include <channel/cc_pipe.h>
+#include <channel/cc_tcp.h>
+#include <stream/cc_sockio.h>
 
 #include <check.h>
 
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -21,6 +26,17 @@ struct event {
 static struct event event_log[1024];
 static uint32_t event_log_count;
 
+#ifdef CC_IO_URING
+struct io {
+    void *arg;
+    uint32_t type;
+    int res;
+};
+
+static struct io io_log[1024];
+static uint32_t io_log_count;
+#endif
+
 /*
  * utilities
  */
@@ -28,6 +44,9 @@ static void
 test_setup(void)
 {
     event_log_count = 0;
+#ifdef CC_IO_URING
+    io_log_count = 0;
+#endif
     event_setup(NULL);
 }
 
@@ -112,6 +131,36 @@ START_TEST(test_cannot_read)
 }
 END_TEST
 
+START_TEST(test_wait_timeout)
+{
+    struct event_base *event_base;
+    struct duration d;
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+
+    test_reset();
+
+    event_base = event_base_create(1024, log_event);
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+
+    /* completions of the removal are not events, keep waiting past them */
+    event_add_read(event_base, pipe_read_id(pipe), random_pointer);
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+
+    duration_start(&d);
+    ck_assert_int_eq(event_wait(event_base, 50), 0);
+    duration_stop(&d);
+    ck_assert(duration_ms(&d) >= 45);
+    ck_assert_int_eq(event_log_count, 0);
+
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+}
+END_TEST
+
 START_TEST(test_write)
 {
     struct event_base *event_base;
@@ -142,6 +191,493 @@ START_TEST(test_write)
 }
 END_TEST
 
+START_TEST(test_level)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+
+    test_reset();
+
+    event_base = event_base_create(1024, log_event);
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+
+    event_add_read(event_base, pipe_read_id(pipe), random_pointer);
+    event_wait(event_base, 1000);
+    ck_assert_int_eq(event_log_count, 1);
+
+    /* data is still there, so the fd is reported again */
+    event_wait(event_base, 1000);
+    ck_assert_int_eq(event_log_count, 2);
+    ck_assert_int_eq(event_log[1].events, EVENT_READ);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_edge)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+
+    test_reset();
+
+    event_base = event_base_create(1024, log_event);
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+
+    ck_assert_int_eq(event_add_read_flags(event_base, pipe_read_id(pipe),
+                random_pointer, EVENT_EDGE), 0);
+    event_wait(event_base, 1000);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+
+    /* data has not been consumed, but there is nothing new to report */
+    ck_assert_int_eq(event_wait(event_base, 100), 0);
+    ck_assert_int_eq(event_log_count, 1);
+
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+    event_wait(event_base, 1000);
+    ck_assert_int_eq(event_log_count, 2);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_oneshot)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+
+    test_reset();
+
+    event_base = event_base_create(1024, log_event);
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+
+    ck_assert_int_eq(event_add_read_flags(event_base, pipe_read_id(pipe),
+                random_pointer, EVENT_ONESHOT), 0);
+    event_wait(event_base, 1000);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_ptr_eq(event_log[0].arg, random_pointer);
+
+    /* still readable, but disabled */
+    ck_assert_int_eq(event_wait(event_base, 100), 0);
+    ck_assert_int_eq(event_log_count, 1);
+
+    /* re-arm */
+    ck_assert_int_eq(event_add_read_flags(event_base, pipe_read_id(pipe),
+                random_pointer, EVENT_ONESHOT), 0);
+    event_wait(event_base, 1000);
+    ck_assert_int_eq(event_log_count, 2);
+    ck_assert_int_eq(event_log[1].events, EVENT_READ);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_exclusive)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base[2];
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+    int i;
+
+    test_reset();
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+
+    for (i = 0; i < 2; i++) {
+        event_base[i] = event_base_create(1024, log_event);
+        ck_assert_int_eq(event_add_read_flags(event_base[i], pipe_read_id(pipe),
+                    random_pointer, EVENT_EXCLUSIVE | EVENT_ONESHOT), -1);
+        ck_assert_int_eq(event_add_read_flags(event_base[i], pipe_read_id(pipe),
+                    random_pointer, EVENT_EXCLUSIVE), 0);
+    }
+
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+    event_wait(event_base[0], 1000);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+
+    for (i = 0; i < 2; i++) {
+        ck_assert_int_eq(event_del(event_base[i], pipe_read_id(pipe)), 0);
+        event_base_destroy(&event_base[i]);
+    }
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_lazy)
+{
+#define DATA "foo"
+    event_metrics_st metrics = { EVENT_METRIC(METRIC_INIT) };
+    struct event_base *event_base;
+    int random_pointer[1] = {1};
+    int sv[2];
+    char buf[8];
+
+    test_reset();
+    event_teardown();
+    event_setup(&metrics);
+
+    event_base = event_base_create(1024, log_event);
+    event_base_set_lazy(event_base, true);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    /* switching back and forth ends up as a single registration */
+    ck_assert_int_eq(event_add_read(event_base, sv[0], random_pointer), 0);
+    ck_assert_int_eq(event_del_read(event_base, sv[0]), 0);
+    ck_assert_int_eq(event_add_write(event_base, sv[0], random_pointer), 0);
+    ck_assert_int_eq(event_del_write(event_base, sv[0]), 0);
+    ck_assert_int_eq(event_add_read(event_base, sv[0], random_pointer), 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+#ifndef CC_IO_URING
+    ck_assert_uint_eq(metrics.event_change.counter, 1);
+#endif
+
+    ck_assert_int_eq(write(sv[1], DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_ptr_eq(event_log[0].arg, random_pointer);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+    ck_assert_int_eq(read(sv[0], buf, sizeof(buf)), sizeof(DATA));
+
+    /* a change undone before the next wait costs nothing */
+    ck_assert_int_eq(event_del_read(event_base, sv[0]), 0);
+    ck_assert_int_eq(event_add_read(event_base, sv[0], random_pointer), 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+#ifndef CC_IO_URING
+    ck_assert_uint_eq(metrics.event_change.counter, 1);
+    ck_assert_uint_eq(metrics.event_change_skip.counter, 1);
+#endif
+
+    /* the two types add up, and can be dropped one at a time */
+    ck_assert_int_eq(event_add_write(event_base, sv[0], random_pointer), 0);
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log[1].events, EVENT_WRITE);
+    ck_assert_int_eq(event_del_write(event_base, sv[0]), 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    ck_assert_int_eq(write(sv[1], DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log[2].events, EVENT_READ);
+
+    /* delete applies right away */
+    ck_assert_int_eq(event_del(event_base, sv[0]), 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    ck_assert_int_eq(event_log_count, 3);
+
+    event_base_destroy(&event_base);
+    close(sv[0]);
+    close(sv[1]);
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_spin)
+{
+#define DATA "foo"
+    event_metrics_st metrics = { EVENT_METRIC(METRIC_INIT) };
+    struct event_base *event_base;
+    struct duration d;
+    int random_pointer[1] = {1};
+    int sv[2];
+    char buf[8];
+
+    test_reset();
+    event_teardown();
+    event_setup(&metrics);
+
+    event_base = event_base_create(1024, log_event);
+    event_base_set_spin(event_base, 5000);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    ck_assert_int_eq(event_add_read(event_base, sv[0], random_pointer), 0);
+
+    /* nothing to do: spin for the budget, then block for the rest */
+    duration_start(&d);
+    ck_assert_int_eq(event_wait(event_base, 20), 0);
+    duration_stop(&d);
+    ck_assert(duration_ms(&d) >= 15);
+    ck_assert_uint_eq(metrics.event_spin_hit.counter, 0);
+    ck_assert_uint_eq(metrics.event_spin_sleep.counter, 1);
+
+    /* events found while spinning */
+    ck_assert_int_eq(write(sv[1], DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_uint_eq(metrics.event_spin_hit.counter, 1);
+    ck_assert_int_eq(read(sv[0], buf, sizeof(buf)), sizeof(DATA));
+
+    /* a zero timeout never spins */
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_uint_eq(metrics.event_spin_sleep.counter, 1);
+
+    /* and neither does a base without a budget */
+    event_base_set_spin(event_base, 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    ck_assert_uint_eq(metrics.event_spin_sleep.counter, 1);
+
+#ifdef CC_IO_URING
+    ck_assert_int_eq(event_base_set_busy_poll(event_base, 50, 8, false), -1);
+#else
+    /* older kernels do not know about epoll busy polling */
+    if (event_base_set_busy_poll(event_base, 50, 8, false) == 0) {
+        ck_assert_int_eq(write(sv[1], DATA, sizeof(DATA)), sizeof(DATA));
+        ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    }
+#endif
+    ck_assert_int_eq(tcp_set_busy_poll(sv[0], 50), 0);
+
+    event_base_destroy(&event_base);
+    close(sv[0]);
+    close(sv[1]);
+#undef DATA
+}
+END_TEST
+
+static uint32_t batch_count;
+
+static void
+log_batch(struct event_ready *batch, int nbatch)
+{
+    int i;
+
+    batch_count++;
+    for (i = 0; i < nbatch; i++) {
+        if (i + EVENT_PREFETCH < nbatch) {
+            event_prefetch(&batch[i + EVENT_PREFETCH]);
+        }
+        log_event(batch[i].data, batch[i].events);
+    }
+}
+
+START_TEST(test_batch)
+{
+#define DATA "foo"
+#define NPAIR 8
+    struct event_base *event_base;
+    int random_pointer[NPAIR];
+    int sv[NPAIR][2];
+    char buf[8];
+    uint32_t i, j;
+
+    test_reset();
+    batch_count = 0;
+
+    event_base = event_base_create(1024, log_event);
+    ck_assert_int_eq(event_base_set_batch_cb(event_base, log_batch), 0);
+    for (i = 0; i < NPAIR; i++) {
+        ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]), 0);
+        ck_assert_int_eq(event_add_read(event_base, sv[i][0],
+                    &random_pointer[i]), 0);
+        ck_assert_int_eq(write(sv[i][1], DATA, sizeof(DATA)), sizeof(DATA));
+    }
+
+    /* one call for the whole wakeup */
+    ck_assert_int_eq(event_wait(event_base, 1000), NPAIR);
+    ck_assert_uint_eq(batch_count, 1);
+    ck_assert_uint_eq(event_log_count, NPAIR);
+    for (i = 0; i < NPAIR; i++) {
+        for (j = 0; j < NPAIR; j++) {
+            if (event_log[j].arg == &random_pointer[i]) {
+                break;
+            }
+        }
+        ck_assert_uint_lt(j, NPAIR);
+        ck_assert_int_eq(event_log[j].events, EVENT_READ);
+        ck_assert_int_eq(read(sv[i][0], buf, sizeof(buf)), sizeof(DATA));
+    }
+
+    /* nothing to dispatch */
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_uint_eq(batch_count, 1);
+
+    /* back to one call per event */
+    ck_assert_int_eq(event_base_set_batch_cb(event_base, NULL), 0);
+    ck_assert_int_eq(write(sv[0][1], DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_uint_eq(batch_count, 1);
+    ck_assert_uint_eq(event_log_count, NPAIR + 1);
+    ck_assert_ptr_eq(event_log[NPAIR].arg, &random_pointer[0]);
+
+    for (i = 0; i < NPAIR; i++) {
+        ck_assert_int_eq(event_del(event_base, sv[i][0]), 0);
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+    event_base_destroy(&event_base);
+#undef NPAIR
+#undef DATA
+}
+END_TEST
+
+#ifdef CC_IO_URING
+static void
+log_io(void *arg, uint32_t type, int res)
+{
+    io_log[io_log_count].arg = arg;
+    io_log[io_log_count].type = type;
+    io_log[io_log_count++].res = res;
+}
+
+START_TEST(test_recv_send)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int rp[1] = {1}, wp[1] = {2};
+    int sv[2];
+    char buf[64];
+    uint32_t i;
+
+    test_reset();
+
+    event_base = event_base_create(1024, log_event);
+    event_base_set_io_cb(event_base, log_io);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    ck_assert_int_eq(event_recv(event_base, sv[0], buf, sizeof(buf), rp), 0);
+    /* only one recv can be in flight per fd */
+    ck_assert_int_eq(event_recv(event_base, sv[0], buf, sizeof(buf), rp), -1);
+    ck_assert_int_eq(event_send(event_base, sv[1], DATA, sizeof(DATA), wp), 0);
+
+    while (io_log_count < 2) {
+        ck_assert_int_gt(event_wait(event_base, 1000), 0);
+    }
+    ck_assert_int_eq(event_log_count, 0);
+    for (i = 0; i < 2; i++) {
+        ck_assert_int_eq(io_log[i].res, sizeof(DATA));
+        if (io_log[i].type == EVENT_READ) {
+            ck_assert_ptr_eq(io_log[i].arg, rp);
+        } else {
+            ck_assert_int_eq(io_log[i].type, EVENT_WRITE);
+            ck_assert_ptr_eq(io_log[i].arg, wp);
+        }
+    }
+    ck_assert_int_eq(memcmp(buf, DATA, sizeof(DATA)), 0);
+
+    /* deleting the fd cancels a pending recv, without a callback */
+    ck_assert_int_eq(event_recv(event_base, sv[0], buf, sizeof(buf), rp), 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    ck_assert_int_eq(event_del(event_base, sv[0]), 0);
+    ck_assert_int_eq(event_wait(event_base, 100), 0);
+    ck_assert_int_eq(io_log_count, 2);
+
+    event_base_destroy(&event_base);
+    close(sv[0]);
+    close(sv[1]);
+#undef DATA
+}
+END_TEST
+
+static void
+buf_sock_io(void *arg, uint32_t type, int res)
+{
+    struct buf_sock *s = arg;
+
+    log_io(arg, type, type == EVENT_READ ? buf_tcp_read_complete(s, res) :
+            buf_tcp_write_complete(s, res));
+}
+
+START_TEST(test_buf_sock_io)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    struct buf_sock *rs, *ws;
+    int sv[2];
+
+    test_reset();
+    buf_setup(NULL, NULL);
+
+    event_base = event_base_create(1024, log_event);
+    event_base_set_io_cb(event_base, buf_sock_io);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    rs = buf_sock_create();
+    ws = buf_sock_create();
+    ck_assert_ptr_ne(rs, NULL);
+    ck_assert_ptr_ne(ws, NULL);
+    rs->ch->sd = sv[0];
+    ws->ch->sd = sv[1];
+
+    ck_assert_int_eq(buf_tcp_write_submit(ws, event_base), CC_EEMPTY);
+    buf_write(ws->wbuf, DATA, sizeof(DATA));
+    ck_assert_int_eq(buf_tcp_write_submit(ws, event_base), CC_OK);
+    ck_assert_int_eq(buf_tcp_read_submit(rs, event_base), CC_OK);
+
+    while (io_log_count < 2) {
+        ck_assert_int_gt(event_wait(event_base, 1000), 0);
+    }
+    ck_assert_int_eq(io_log[0].res, CC_OK);
+    ck_assert_int_eq(io_log[1].res, CC_OK);
+    ck_assert_int_eq(buf_rsize(ws->wbuf), 0);
+    ck_assert_int_eq(buf_rsize(rs->rbuf), sizeof(DATA));
+    ck_assert_int_eq(memcmp(rs->rbuf->rpos, DATA, sizeof(DATA)), 0);
+    ck_assert_int_eq(rs->ch->recv_nbyte, sizeof(DATA));
+    ck_assert_int_eq(ws->ch->send_nbyte, sizeof(DATA));
+
+    /* peer closed */
+    close(sv[1]);
+    ck_assert_int_eq(buf_tcp_read_submit(rs, event_base), CC_OK);
+    while (io_log_count < 3) {
+        ck_assert_int_gt(event_wait(event_base, 1000), 0);
+    }
+    ck_assert_int_eq(io_log[2].res, CC_ERDHUP);
+    ck_assert_int_eq(rs->ch->state, CHANNEL_TERM);
+
+    close(sv[0]);
+    rs->ch->sd = ws->ch->sd = 0;
+    buf_sock_destroy(&rs);
+    buf_sock_destroy(&ws);
+    event_base_destroy(&event_base);
+    buf_teardown();
+#undef DATA
+}
+END_TEST
+#else
+START_TEST(test_recv_send)
+{
+    struct event_base *event_base;
+    char buf[1];
+
+    test_reset();
+
+    /* this backend only supports readiness events */
+    event_base = event_base_create(1024, log_event);
+    ck_assert_int_eq(event_recv(event_base, 1, buf, sizeof(buf), NULL), -1);
+    ck_assert_int_eq(event_send(event_base, 1, buf, sizeof(buf), NULL), -1);
+    event_base_destroy(&event_base);
+}
+END_TEST
+#endif
+
 /*
  * test suite
  */
@@ -156,7 +692,19 @@ event_suite(void)
 
     tcase_add_test(tc_event, test_read);
     tcase_add_test(tc_event, test_cannot_read);
+    tcase_add_test(tc_event, test_wait_timeout);
     tcase_add_test(tc_event, test_write);
+    tcase_add_test(tc_event, test_level);
+    tcase_add_test(tc_event, test_edge);
+    tcase_add_test(tc_event, test_oneshot);
+    tcase_add_test(tc_event, test_exclusive);
+    tcase_add_test(tc_event, test_lazy);
+    tcase_add_test(tc_event, test_spin);
+    tcase_add_test(tc_event, test_batch);
+    tcase_add_test(tc_event, test_recv_send);
+#ifdef CC_IO_URING
+    tcase_add_test(tc_event, test_buf_sock_io);
+#endif
 
     return s;
 }
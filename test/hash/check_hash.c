@@ -0,0 +1,277 @@
+#include <hash/cc_hash.h>
+#include <hash/cc_murmur3.h>
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "hash"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+struct vector {
+    const char *key;
+    uint64_t seed;
+    uint64_t hash;
+};
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+}
+
+static void
+test_teardown(void)
+{
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+static void
+_check_vectors(hash_fn fn, const struct vector *v, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ck_assert_uint_eq(fn(v[i].key, strlen(v[i].key), v[i].seed),
+                v[i].hash);
+    }
+}
+
+/*
+ * tests
+ */
+START_TEST(test_xxh64)
+{
+    static const struct vector v[] = {
+        {"", 0, 0xEF46DB3751D8E999ULL},
+        {"a", 0, 0xD24EC4F1A98C6E5BULL},
+        {"abc", 0, 0x44BC2CF5AD770999ULL},
+        {"Nobody inspects the spammish repetition", 0, 0xFBCEA83C8A378BF1ULL},
+    };
+
+    test_reset();
+
+    _check_vectors(hash_xxh64, v, sizeof(v) / sizeof(v[0]));
+}
+END_TEST
+
+START_TEST(test_wyhash)
+{
+    static const struct vector v[] = {
+        {"", 0, 0x93228a4de0eec5a2ULL},
+        {"a", 1, 0xc5bac3db178713c4ULL},
+        {"abc", 2, 0xa97f2f7b1d9b3314ULL},
+        {"message digest", 3, 0x786d1f1df3801df4ULL},
+        {"abcdefghijklmnopqrstuvwxyz", 4, 0xdca5a8138ad37c87ULL},
+        {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 5,
+            0xb9e734f117cfaf70ULL},
+        {"1234567890123456789012345678901234567890"
+            "1234567890123456789012345678901234567890", 6,
+            0x6cc5eab49a92d617ULL},
+    };
+
+    test_reset();
+
+    _check_vectors(hash_wyhash, v, sizeof(v) / sizeof(v[0]));
+}
+END_TEST
+
+START_TEST(test_crc32c)
+{
+    static const struct vector v[] = {
+        {"", 0, 0},
+        {"123456789", 0, 0xE3069283ULL},
+    };
+    char zeros[32] = {0};
+
+    test_reset();
+
+    _check_vectors(hash_crc32c, v, sizeof(v) / sizeof(v[0]));
+    ck_assert_uint_eq(hash_crc32c(zeros, sizeof(zeros), 0), 0x8A9136AAULL);
+    /* seeding with a previous result continues the checksum */
+    ck_assert_uint_eq(hash_crc32c("6789", 4, hash_crc32c("12345", 5, 0)),
+            0xE3069283ULL);
+}
+END_TEST
+
+START_TEST(test_murmur3_64)
+{
+    const char *key = "the quick brown fox";
+    uint64_t out[2];
+
+    test_reset();
+
+    hash_murmur3_128_x64(key, strlen(key), 42, out);
+    ck_assert_uint_eq(hash_murmur3_64(key, strlen(key), 42), out[0]);
+}
+END_TEST
+
+START_TEST(test_interface)
+{
+    char key[64];
+    hash_type_e t;
+    uint64_t h;
+    size_t len;
+
+    test_reset();
+
+    for (len = 0; len < sizeof(key); len++) {
+        key[len] = (char)len;
+    }
+
+    for (t = 0; t < HASH_SENTINEL; t++) {
+        ck_assert_ptr_ne(hash_get(t), NULL);
+        ck_assert_int_eq(hash_type(hash_name(t)), t);
+
+        /* every length, and a different seed changes the hash */
+        for (len = 1; len <= sizeof(key); len++) {
+            h = hash_get(t)(key, len, 0);
+            ck_assert_uint_eq(hash_get(t)(key, len, 0), h);
+            ck_assert_uint_ne(hash_get(t)(key, len, 1), h);
+            ck_assert_uint_ne(hash_get(t)(key, len - 1, 0), h);
+        }
+    }
+    ck_assert_ptr_eq(hash_get(HASH_SENTINEL), NULL);
+    ck_assert_ptr_eq(hash_name(HASH_SENTINEL), NULL);
+    ck_assert_int_eq(hash_type("md5"), HASH_SENTINEL);
+}
+END_TEST
+
+START_TEST(test_batch)
+{
+#define NKEY 37
+    char data[NKEY * 8];
+    const void *keys[NKEY];
+    size_t lens[NKEY], i;
+    uint64_t out[NKEY];
+    hash_type_e t;
+
+    test_reset();
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (char)(i * 7);
+    }
+    /* lengths from 0 to well past a wyhash short key, in mixed lanes */
+    for (i = 0; i < NKEY; i++) {
+        keys[i] = data + i;
+        lens[i] = (i * 13) % (sizeof(data) - NKEY);
+    }
+
+    for (t = 0; t < HASH_SENTINEL; t++) {
+        memset(out, 0, sizeof(out));
+        hash_batch(t, keys, lens, NKEY, 7, out);
+        for (i = 0; i < NKEY; i++) {
+            ck_assert_uint_eq(out[i], hash_get(t)(keys[i], lens[i], 7));
+        }
+    }
+#undef NKEY
+}
+END_TEST
+
+START_TEST(test_murmur3_stream)
+{
+#define LEN 70
+    struct murmur3_32_state s32;
+    struct murmur3_128_x86_state s86;
+    struct murmur3_128_x64_state s64;
+    uint8_t key[LEN];
+    uint32_t expect[4], got[4];
+    size_t len, split, off, step;
+
+    test_reset();
+
+    for (len = 0; len < LEN; len++) {
+        key[len] = (uint8_t)(len * 31 + 7);
+    }
+
+    /* two pieces split anywhere, then many pieces of every size */
+    for (len = 0; len <= LEN; len++) {
+        for (split = 0; split <= len; split++) {
+            hash_murmur3_32(key, len, 11, expect);
+            hash_murmur3_32_init(&s32, 11);
+            hash_murmur3_32_update(&s32, key, split);
+            hash_murmur3_32_update(&s32, key + split, len - split);
+            hash_murmur3_32_final(&s32, got);
+            ck_assert_uint_eq(got[0], expect[0]);
+
+            hash_murmur3_128_x86(key, len, 11, expect);
+            hash_murmur3_128_x86_init(&s86, 11);
+            hash_murmur3_128_x86_update(&s86, key, split);
+            hash_murmur3_128_x86_update(&s86, key + split, len - split);
+            hash_murmur3_128_x86_final(&s86, got);
+            ck_assert_int_eq(memcmp(got, expect, 16), 0);
+
+            hash_murmur3_128_x64(key, len, 11, expect);
+            hash_murmur3_128_x64_init(&s64, 11);
+            hash_murmur3_128_x64_update(&s64, key, split);
+            hash_murmur3_128_x64_update(&s64, key + split, len - split);
+            hash_murmur3_128_x64_final(&s64, got);
+            ck_assert_int_eq(memcmp(got, expect, 16), 0);
+        }
+    }
+
+    for (step = 1; step < 20; step++) {
+        hash_murmur3_128_x64(key, LEN, 3, expect);
+        hash_murmur3_128_x64_init(&s64, 3);
+        for (off = 0; off < LEN; off += step) {
+            hash_murmur3_128_x64_update(&s64, key + off,
+                    off + step > LEN ? LEN - off : step);
+        }
+        hash_murmur3_128_x64_final(&s64, got);
+        ck_assert_int_eq(memcmp(got, expect, 16), 0);
+    }
+#undef LEN
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+hash_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_hash = tcase_create("hash test");
+    suite_add_tcase(s, tc_hash);
+
+    tcase_add_test(tc_hash, test_xxh64);
+    tcase_add_test(tc_hash, test_wyhash);
+    tcase_add_test(tc_hash, test_crc32c);
+    tcase_add_test(tc_hash, test_murmur3_64);
+    tcase_add_test(tc_hash, test_murmur3_stream);
+    tcase_add_test(tc_hash, test_interface);
+    tcase_add_test(tc_hash, test_batch);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = hash_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
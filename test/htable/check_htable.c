@@ -0,0 +1,351 @@
+#include <cc_htable.h>
+
+#include <cc_bstring.h>
+
+#include <check.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "htable"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define NKEY 10000
+#define KEYLEN 16
+
+static char keybuf[NKEY][KEYLEN];
+static struct bstring key[NKEY];
+static htable_metrics_st metrics;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    int i;
+
+    for (i = 0; i < NKEY; i++) {
+        key[i].len = snprintf(keybuf[i], KEYLEN, "key-%d", i);
+        key[i].data = keybuf[i];
+    }
+
+    metrics = (htable_metrics_st) { HTABLE_METRIC(METRIC_INIT) };
+    htable_setup(NULL, &metrics);
+}
+
+static void
+test_teardown(void)
+{
+    htable_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* value stored under key i, never NULL */
+static void *
+_val(int i)
+{
+    return (void *)((uintptr_t)i + 1);
+}
+
+/* a hash that puts every key in the same group */
+static uint64_t
+_hash_const(const void *key, size_t len, uint64_t seed)
+{
+    (void)key;
+    (void)len;
+    (void)seed;
+
+    return 0x5a;
+}
+
+static void
+_count(const struct bstring *k, void *val, void *arg)
+{
+    uint64_t *sum = arg;
+
+    ck_assert_int_gt(k->len, 0);
+    *sum += (uintptr_t)val;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_create_destroy)
+{
+    struct htable *ht;
+
+    test_reset();
+
+    ht = htable_create(0, NULL);
+    ck_assert_ptr_ne(ht, NULL);
+    ck_assert_int_eq(ht->cur.ngroup, 1);
+    ck_assert_int_eq(htable_nentry(ht), 0);
+    ck_assert(!htable_migrating(ht));
+    htable_destroy(&ht);
+    ck_assert_ptr_eq(ht, NULL);
+
+    /* sized so nentry entries fit without a resize */
+    ht = htable_create(1000, hash_xxh64);
+    ck_assert_int_ge(ht->cur.growth, 1000);
+    ck_assert_int_eq(ht->cur.ngroup & (ht->cur.ngroup - 1), 0);
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_put_get_delete)
+{
+    struct htable *ht;
+    struct bstring miss = str2bstr("miss");
+    int i;
+
+    test_reset();
+
+    ht = htable_create(64, NULL);
+
+    ck_assert_ptr_eq(htable_get(ht, &key[0]), NULL);
+    for (i = 0; i < 64; i++) {
+        ck_assert_int_eq(htable_put(ht, &key[i], _val(i)), CC_OK);
+    }
+    ck_assert_int_eq(htable_nentry(ht), 64);
+    for (i = 0; i < 64; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+    }
+    ck_assert_ptr_eq(htable_get(ht, &miss), NULL);
+
+    /* replace keeps the entry count */
+    ck_assert_int_eq(htable_put(ht, &key[3], _val(100)), CC_OK);
+    ck_assert_int_eq(htable_nentry(ht), 64);
+    ck_assert_ptr_eq(htable_get(ht, &key[3]), _val(100));
+
+    ck_assert_ptr_eq(htable_delete(ht, &key[3]), _val(100));
+    ck_assert_ptr_eq(htable_delete(ht, &key[3]), NULL);
+    ck_assert_ptr_eq(htable_get(ht, &key[3]), NULL);
+    ck_assert_int_eq(htable_nentry(ht), 63);
+    ck_assert_ptr_eq(htable_delete(ht, &miss), NULL);
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_collision)
+{
+    struct htable *ht;
+    int i;
+
+    test_reset();
+
+    /* every key probes the same groups, and deletes leave tombstones */
+    ht = htable_create(256, _hash_const);
+    for (i = 0; i < 200; i++) {
+        ck_assert_int_eq(htable_put(ht, &key[i], _val(i)), CC_OK);
+    }
+    for (i = 0; i < 200; i += 2) {
+        ck_assert_ptr_eq(htable_delete(ht, &key[i]), _val(i));
+    }
+    for (i = 0; i < 200; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), (i % 2) ? _val(i) : NULL);
+    }
+    /* tombstones are reused */
+    for (i = 0; i < 200; i += 2) {
+        ck_assert_int_eq(htable_put(ht, &key[i], _val(i)), CC_OK);
+    }
+    for (i = 0; i < 200; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+    }
+    ck_assert_int_eq(htable_nentry(ht), 200);
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_incremental_resize)
+{
+    struct htable *ht;
+    uint32_t ngroup;
+    uint64_t sum = 0;
+    int i, j;
+
+    test_reset();
+
+    ht = htable_create(0, NULL);
+    ngroup = ht->cur.ngroup;
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_int_eq(htable_put(ht, &key[i], _val(i)), CC_OK);
+        if (ht->cur.ngroup != ngroup) {
+            /* a resize starts a migration instead of rehashing everything */
+            ck_assert(htable_migrating(ht) || ht->cur.ngroup <= 2);
+            ngroup = ht->cur.ngroup;
+        }
+        ck_assert_int_eq(htable_nentry(ht), i + 1);
+        /* spot-check lookups across both tables while migrating */
+        if (htable_migrating(ht)) {
+            for (j = 0; j <= i; j += 97) {
+                ck_assert_ptr_eq(htable_get(ht, &key[j]), _val(j));
+            }
+        }
+    }
+    ck_assert_int_gt(ht->cur.ngroup, 1);
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+    }
+
+    htable_foreach(ht, _count, &sum);
+    ck_assert_int_eq(sum, (uint64_t)NKEY * (NKEY + 1) / 2);
+
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_ptr_eq(htable_delete(ht, &key[i]), _val(i));
+    }
+    ck_assert_int_eq(htable_nentry(ht), 0);
+    ck_assert(!htable_migrating(ht));
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_churn)
+{
+    struct htable *ht;
+    uint32_t ngroup;
+    int i;
+
+    test_reset();
+
+    /* insert/delete churn at a steady size rehashes without growing */
+    ht = htable_create(64, NULL);
+    ngroup = ht->cur.ngroup;
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_int_eq(htable_put(ht, &key[i], _val(i)), CC_OK);
+        if (i >= 32) {
+            ck_assert_ptr_eq(htable_delete(ht, &key[i - 32]), _val(i - 32));
+        }
+    }
+    ck_assert_int_eq(htable_nentry(ht), 32);
+    ck_assert_int_eq(ht->cur.ngroup, ngroup);
+    for (i = NKEY - 32; i < NKEY; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+    }
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_migrate)
+{
+    htable_options_st options = { HTABLE_OPTION(OPTION_INIT) };
+    struct htable *ht;
+    uint32_t left, last;
+    int i, n;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(htable_options_st));
+    options.htable_migrate_step.val.vuint = 0;
+    options.htable_migrate_tick.val.vuint = 3;
+
+    test_reset();
+    htable_teardown();
+    htable_setup(&options, &metrics);
+
+    /* with no migration on the write path, writes leave it all pending */
+    ht = htable_create(100, NULL);
+    for (n = 0; !htable_migrating(ht); n++) {
+        ck_assert_int_eq(htable_put(ht, &key[n], _val(n)), CC_OK);
+    }
+    ck_assert_uint_eq(metrics.htable_resize.counter, 1);
+    ck_assert_int_eq(metrics.htable_migrating.gauge, 1);
+    ck_assert_int_eq(metrics.htable_migrate_pending.gauge, ht->old.ngroup);
+    for (i = 0; i < 10; i++, n++) {
+        ck_assert_int_eq(htable_put(ht, &key[n], _val(n)), CC_OK);
+    }
+    ck_assert_int_eq(metrics.htable_migrate_pending.gauge, ht->old.ngroup);
+    ck_assert_uint_eq(metrics.htable_migrate_group.counter, 0);
+
+    /* ticks move a bounded number of groups, lookups work throughout */
+    last = ht->old.ngroup;
+    htable_migrate_tick(ht);
+    left = ht->old.ngroup - ht->migrate;
+    ck_assert_int_eq(left, last - 3);
+    ck_assert_uint_eq(metrics.htable_migrate_group.counter, 3);
+    ck_assert_int_eq(metrics.htable_migrate_pending.gauge, left);
+    while ((left = htable_migrate(ht, 5)) > 0) {
+        ck_assert_int_eq(metrics.htable_migrate_pending.gauge, left);
+        for (i = 0; i < n; i += 7) {
+            ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+        }
+    }
+    ck_assert(!htable_migrating(ht));
+    ck_assert_int_eq(metrics.htable_migrating.gauge, 0);
+    ck_assert_int_eq(metrics.htable_migrate_pending.gauge, 0);
+    ck_assert_uint_eq(metrics.htable_migrate_entry.counter, n - 10 - 1);
+    ck_assert_uint_eq(metrics.htable_migrate_sync.counter, 0);
+    ck_assert_int_eq(htable_migrate(ht, 1), 0);
+    for (i = 0; i < n; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+    }
+
+    /* filling the new table mid-migration finishes the migration at once */
+    for (; metrics.htable_resize.counter < 3; n++) {
+        ck_assert_int_lt(n, NKEY);
+        ck_assert_int_eq(htable_put(ht, &key[n], _val(n)), CC_OK);
+    }
+    ck_assert_uint_eq(metrics.htable_migrate_sync.counter, 1);
+    for (i = 0; i < n; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), _val(i));
+    }
+
+    htable_destroy(&ht);
+    ck_assert_int_eq(metrics.htable_migrating.gauge, 0);
+    ck_assert_int_eq(metrics.htable_migrate_pending.gauge, 0);
+    ck_assert_int_eq(metrics.htable_curr.gauge, 0);
+    ck_assert_uint_eq(metrics.htable_destroy.counter, 1);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+htable_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_htable = tcase_create("htable test");
+    suite_add_tcase(s, tc_htable);
+
+    tcase_add_test(tc_htable, test_create_destroy);
+    tcase_add_test(tc_htable, test_put_get_delete);
+    tcase_add_test(tc_htable, test_collision);
+    tcase_add_test(tc_htable, test_incremental_resize);
+    tcase_add_test(tc_htable, test_churn);
+    tcase_add_test(tc_htable, test_migrate);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = htable_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
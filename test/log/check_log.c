@@ -1,3 +1,4 @@
+#include <cc_debug.h>
 #include <cc_log.h>
 
 #ifdef HAVE_RUST
@@ -7,8 +8,13 @@
 
 #include <check.h>
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <cc_mm.h>
 
 #define SUITE_NAME "log"
@@ -250,6 +256,427 @@ START_TEST(test_write_skip_metrics)
 }
 END_TEST
 
+static off_t
+file_size(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) < 0 ? -1 : st.st_size;
+}
+
+START_TEST(test_flusher)
+{
+#define LOGSTR "0123456789abcdef"
+#define NLINE 256
+    struct timespec ts = (struct timespec){0, 1000000}; /* 1ms */
+    struct logger *logger, *nobuf;
+    char *tmpname = tmpname_create();
+    uint32_t i, n = 0;
+
+    test_reset();
+
+    logger = log_create(tmpname, 1024);
+    ck_assert_ptr_ne(logger, NULL);
+    nobuf = log_create(NULL, 0);
+    ck_assert_int_eq(log_flusher_add(nobuf), CC_EINVAL);
+    log_destroy(&nobuf);
+
+    ck_assert_int_eq(log_flusher_add(logger), CC_OK);
+    ck_assert_int_eq(log_flusher_start(1, 1), CC_OK);
+    ck_assert_int_eq(log_flusher_start(1, 1), CC_ERROR);
+
+    /* never flushed on this thread, the ring is smaller than the total */
+    for (i = 0; i < NLINE; i++) {
+        while (!log_write(logger, LOGSTR, sizeof(LOGSTR) - 1)) {
+            nanosleep(&ts, NULL);
+        }
+    }
+    for (i = 0; i < 1000 && file_size(tmpname) < NLINE * (sizeof(LOGSTR) - 1);
+            i++) {
+        nanosleep(&ts, NULL);
+    }
+    ck_assert_int_eq(file_size(tmpname), NLINE * (sizeof(LOGSTR) - 1));
+
+    /* reopen and explicit flush synchronize with the flusher */
+    ck_assert_int_eq(log_reopen(logger, NULL), CC_OK);
+    ck_assert(log_write(logger, LOGSTR, sizeof(LOGSTR) - 1));
+    log_flush(logger);
+    ck_assert_int_eq(file_size(tmpname), sizeof(LOGSTR) - 1);
+
+    /* stopping drains what is left */
+    ck_assert(log_write(logger, LOGSTR, sizeof(LOGSTR) - 1));
+    log_flusher_stop();
+    ck_assert_int_eq(file_size(tmpname), 2 * (sizeof(LOGSTR) - 1));
+    n = metrics.log_flush.counter;
+    ck_assert_uint_gt(n, 0);
+
+    log_destroy(&logger);
+    ck_assert_ptr_eq(logger, NULL);
+    tmpname_destroy(tmpname);
+#undef LOGSTR
+#undef NLINE
+}
+END_TEST
+
+#define NTHREAD 4
+#define NLINE 200
+#define LINE_LEN 8
+static void *
+test_mt_writer(void *arg)
+{
+    struct logger *logger = arg;
+    static uint32_t nthread = 0;
+    uint32_t t = __atomic_fetch_add(&nthread, 1, __ATOMIC_RELAXED) % NTHREAD;
+    char line[LINE_LEN + 1];
+    uint32_t i;
+
+    for (i = 0; i < NLINE; i++) {
+        snprintf(line, sizeof(line), "%u %05u\n", t, i);
+        if (!log_write(logger, line, LINE_LEN)) {
+            return NULL;
+        }
+    }
+
+    return logger;
+}
+
+static void *
+test_mt_write_one(void *arg)
+{
+    log_write(arg, "B", 1);
+
+    return NULL;
+}
+
+static void
+_test_mt(bool ordered)
+{
+    pthread_t worker[NTHREAD];
+    struct logger *logger;
+    char *tmpname = tmpname_create();
+    uint32_t i, t, seq, next[NTHREAD] = {0};
+    uint64_t nwrite;
+    void *ret;
+    FILE *fp;
+
+    test_reset();
+
+    logger = log_create_mt(tmpname, NLINE * (LINE_LEN + 16), ordered);
+    ck_assert_ptr_ne(logger, NULL);
+    nwrite = metrics.log_write.counter; /* creation logs to stderr */
+
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_create(&worker[i], NULL, &test_mt_writer,
+                    logger), 0);
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_join(worker[i], &ret), 0);
+        ck_assert_ptr_eq(ret, logger);
+    }
+    ck_assert_uint_eq(log_flush(logger), NTHREAD * NLINE * LINE_LEN);
+    ck_assert_uint_eq(metrics.log_write.counter - nwrite, NTHREAD * NLINE);
+
+    /* every message made it, in order for each thread */
+    fp = fopen(tmpname, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    for (i = 0; i < NTHREAD * NLINE; i++) {
+        ck_assert_int_eq(fscanf(fp, "%u %u\n", &t, &seq), 2);
+        ck_assert_uint_lt(t, NTHREAD);
+        ck_assert_uint_eq(seq, next[t]++);
+    }
+    fclose(fp);
+
+    /* messages of different threads: merged by time only if ordered */
+    ck_assert_int_eq(log_reopen(logger, NULL), CC_OK);
+    log_write(logger, "A", 1);
+    ck_assert_int_eq(pthread_create(&worker[0], NULL, &test_mt_write_one,
+                logger), 0);
+    ck_assert_int_eq(pthread_join(worker[0], NULL), 0);
+    log_write(logger, "C", 1);
+    ck_assert_uint_eq(log_flush(logger), 3);
+    if (ordered) {
+        assert_file_contents(tmpname, "ABC", 3);
+    } else {
+        ck_assert_int_eq(file_size(tmpname), 3);
+    }
+
+    log_destroy(&logger);
+    tmpname_destroy(tmpname);
+}
+
+START_TEST(test_mt)
+{
+    _test_mt(false);
+}
+END_TEST
+
+START_TEST(test_mt_ordered)
+{
+    _test_mt(true);
+}
+END_TEST
+#undef NTHREAD
+#undef NLINE
+#undef LINE_LEN
+
+START_TEST(test_direct)
+{
+#define NBYTE (LOG_DIRECT_ALIGN + 100)
+    struct logger *logger;
+    char *tmpname = tmpname_create();
+    char data[NBYTE];
+    size_t i;
+
+    test_reset();
+
+    ck_assert_ptr_eq(log_create_direct(NULL, NBYTE), NULL);
+    ck_assert_ptr_eq(log_create_direct(tmpname, 0), NULL);
+
+    for (i = 0; i < NBYTE; i++) {
+        data[i] = 'a' + i % 26;
+    }
+
+    logger = log_create_direct(tmpname, 2 * NBYTE);
+    ck_assert_ptr_ne(logger, NULL);
+    ck_assert_int_eq(log_set_render(logger, NULL), CC_EINVAL);
+    ck_assert(log_write(logger, data, NBYTE));
+    log_flush(logger);
+    /* only whole blocks are written with direct I/O */
+    ck_assert_int_eq(file_size(tmpname),
+            logger->direct ? LOG_DIRECT_ALIGN : NBYTE);
+
+    log_destroy(&logger);
+    assert_file_contents(tmpname, data, NBYTE);
+
+    tmpname_destroy(tmpname);
+#undef NBYTE
+}
+END_TEST
+
+START_TEST(test_mmap)
+{
+#define NLINE 100
+#define LINE_LEN 100
+    struct logger *logger;
+    char *tmpname = tmpname_create();
+    char *target = malloc(strlen(tmpname) + 2);
+    char data[NLINE * LINE_LEN];
+    long page = sysconf(_SC_PAGESIZE);
+    char *big = calloc(page + 1, 1);
+    size_t i;
+
+    test_reset();
+
+    strcpy(target, tmpname);
+    strcat(target, "r");
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+
+    ck_assert_ptr_eq(log_create_mmap(NULL, page), NULL);
+    ck_assert_ptr_eq(log_create_mmap(tmpname, 0), NULL);
+
+    logger = log_create_mmap(tmpname, 1);
+    ck_assert_ptr_ne(logger, NULL);
+    ck_assert_int_eq(logger->map_seg, page);
+    ck_assert(!log_write(logger, big, page + 1));
+
+    /* lines straddle segments, the file grows a segment at a time */
+    for (i = 0; i < NLINE; i++) {
+        ck_assert(log_write(logger, data + i * LINE_LEN, LINE_LEN));
+    }
+    ck_assert_int_eq(log_flush(logger), 0);
+    ck_assert_int_eq(file_size(tmpname), ROUND_UP(sizeof(data), page));
+
+    /* the old file is trimmed, the fresh one mapped from its start */
+    ck_assert_int_eq(log_reopen(logger, target), CC_OK);
+    assert_file_contents(target, data, sizeof(data));
+    ck_assert(log_write(logger, data, LINE_LEN));
+    ck_assert_int_eq(file_size(tmpname), page);
+    log_destroy(&logger);
+    assert_file_contents(tmpname, data, LINE_LEN);
+
+    /* reopening appends to what is there */
+    logger = log_create_mmap(tmpname, page);
+    ck_assert_ptr_ne(logger, NULL);
+    ck_assert(log_write(logger, data + LINE_LEN, LINE_LEN));
+    log_destroy(&logger);
+    assert_file_contents(tmpname, data, 2 * LINE_LEN);
+
+    unlink(target);
+    free(target);
+    free(big);
+    tmpname_destroy(tmpname);
+#undef NLINE
+#undef LINE_LEN
+}
+END_TEST
+
+START_TEST(test_reserve_commit)
+{
+#define LOGSTR "foo bar baz"
+    struct logger *logger;
+    char *tmpname = tmpname_create();
+    uint64_t nbyte;
+    char *p;
+
+    test_reset();
+
+    logger = log_create(NULL, 0);
+    ck_assert_ptr_eq(log_reserve(logger, 1), NULL);
+    log_destroy(&logger);
+
+    logger = log_create(tmpname, 64);
+    ck_assert_ptr_ne(logger, NULL);
+    ck_assert_ptr_eq(log_reserve(logger, 65), NULL);
+    nbyte = metrics.log_write_byte.counter;
+    p = log_reserve(logger, 64);
+    ck_assert_ptr_ne(p, NULL);
+    memcpy(p, LOGSTR, sizeof(LOGSTR) - 1);
+    log_commit(logger, sizeof(LOGSTR) - 1);
+    ck_assert_int_eq(metrics.log_write_byte.counter - nbyte,
+            sizeof(LOGSTR) - 1);
+
+    log_destroy(&logger);
+    assert_file_contents(tmpname, LOGSTR, sizeof(LOGSTR) - 1);
+
+    tmpname_destroy(tmpname);
+#undef LOGSTR
+}
+END_TEST
+
+START_TEST(test_deferred)
+{
+#define FMT "%d %5ld|%-3u|%#x %c %s %.*s %5.2f %zu %5.1Lf %s %%"
+#define ARGS -42, 123L, 7u, 255u, 'z', "str", 3, "abcdef", 3.14159, \
+    (size_t)9, (long double)2.25, "end"
+    debug_options_st options = { DEBUG_OPTION(OPTION_INIT) };
+    char *tmpname = tmpname_create();
+    char expect[LOG_MAX_LEN], data[2 * LOG_MAX_LEN], *line;
+    char big[LOG_MAX_LEN + 1];
+    FILE *fp;
+    size_t n;
+
+    test_reset();
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(debug_options_st));
+    options.debug_log_file.val.vstr = tmpname;
+    options.debug_log_nbuf.val.vuint = 4 * LOG_MAX_LEN;
+    options.debug_log_defer.val.vbool = true;
+    ck_assert_int_eq(debug_setup(&options), CC_OK);
+    ck_assert_ptr_ne(dlog->logger->render, NULL);
+
+    memset(big, 'x', LOG_MAX_LEN);
+    big[LOG_MAX_LEN] = '\0';
+    snprintf(expect, sizeof(expect), FMT, ARGS);
+
+    loga(FMT, ARGS);
+    ck_assert(log_write(dlog->logger, "raw\n", 4));
+    loga("%s %d", big, 1);
+    ck_assert_int_eq(file_size(tmpname), 0);
+    /* records can only be rendered, setting it now would mangle them */
+    ck_assert_int_eq(log_set_render(dlog->logger, NULL), CC_EINVAL);
+
+    debug_log_flush(NULL);
+    fp = fopen(tmpname, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    n = fread(data, 1, sizeof(data) - 1, fp);
+    fclose(fp);
+    data[n] = '\0';
+
+    /* [time][ALWAYS] file:line message, after what debug_setup logged */
+    for (line = strtok(data, "\n"); line != NULL &&
+            strstr(line, "][ALWAYS] ") == NULL; line = strtok(NULL, "\n"));
+    ck_assert_ptr_ne(line, NULL);
+    ck_assert_str_eq(line + strlen(line) - strlen(expect), expect);
+    line = strtok(NULL, "\n");
+    ck_assert_str_eq(line, "raw");
+    /* the oversized argument is cut short, and the message with it */
+    line = strtok(NULL, "\n");
+    ck_assert_ptr_ne(line, NULL);
+    ck_assert_int_eq(strlen(line), LOG_MAX_LEN - 1);
+    ck_assert_ptr_eq(strtok(NULL, "\n"), NULL);
+
+    debug_teardown();
+    tmpname_destroy(tmpname);
+#undef FMT
+#undef ARGS
+}
+END_TEST
+
+#define NMSG    128
+#define MSG_LEN 1000 /* NMSG messages are more than a pipe takes at once */
+static size_t
+_render_copy(char *buf, size_t size, const void *rec, uint32_t len)
+{
+    size_t n = MIN(size, len);
+
+    memcpy(buf, rec, n);
+
+    return n;
+}
+
+/* output a full pipe does not take is written by later flushes, in order */
+static void
+_test_flush_partial(struct logger *logger)
+{
+    char msg[MSG_LEN], *out;
+    size_t nout = 0, nflush = 0;
+    ssize_t n;
+    uint32_t i;
+    int fd[2];
+
+    out = malloc(NMSG * MSG_LEN);
+    ck_assert_ptr_ne(out, NULL);
+    ck_assert_int_eq(pipe(fd), 0);
+    ck_assert_int_eq(fcntl(fd[0], F_SETFL, O_NONBLOCK), 0);
+    ck_assert_int_eq(fcntl(fd[1], F_SETFL, O_NONBLOCK), 0);
+    logger->fd = fd[1];
+
+    for (i = 0; i < NMSG; i++) {
+        memset(msg, 'a' + i % 26, MSG_LEN);
+        ck_assert(log_write(logger, msg, MSG_LEN));
+    }
+
+    ck_assert_uint_lt(log_flush(logger), NMSG * MSG_LEN);
+    do {
+        while (nout < NMSG * MSG_LEN &&
+                (n = read(fd[0], out + nout, NMSG * MSG_LEN - nout)) > 0) {
+            nout += n;
+        }
+        log_flush(logger);
+    } while (nout < NMSG * MSG_LEN && ++nflush < 2 * NMSG);
+    ck_assert_uint_eq(nout, NMSG * MSG_LEN);
+    for (i = 0; i < NMSG; i++) {
+        memset(msg, 'a' + i % 26, MSG_LEN);
+        ck_assert_int_eq(memcmp(out + i * MSG_LEN, msg, MSG_LEN), 0);
+    }
+
+    log_destroy(&logger);
+    close(fd[0]);
+    free(out);
+}
+
+START_TEST(test_flush_partial)
+{
+    struct logger *logger;
+
+    test_reset();
+
+    logger = log_create(NULL, NMSG * (MSG_LEN + 16));
+    ck_assert_ptr_ne(logger, NULL);
+    ck_assert_int_eq(log_set_render(logger, _render_copy), CC_OK);
+    _test_flush_partial(logger);
+
+    logger = log_create_mt(NULL, NMSG * (MSG_LEN + 16), true);
+    ck_assert_ptr_ne(logger, NULL);
+    _test_flush_partial(logger);
+}
+END_TEST
+#undef NMSG
+#undef MSG_LEN
+
 #ifdef HAVE_RUST
 START_TEST(test_most_basic_rust_logging_setup_teardown)
 {
@@ -298,6 +725,14 @@ log_suite(void)
     tcase_add_test(tc_log, test_write_metrics_file_nobuf);
     tcase_add_test(tc_log, test_write_metrics_stderr_nobuf);
     tcase_add_test(tc_log, test_write_skip_metrics);
+    tcase_add_test(tc_log, test_flusher);
+    tcase_add_test(tc_log, test_mt);
+    tcase_add_test(tc_log, test_mt_ordered);
+    tcase_add_test(tc_log, test_flush_partial);
+    tcase_add_test(tc_log, test_direct);
+    tcase_add_test(tc_log, test_mmap);
+    tcase_add_test(tc_log, test_reserve_commit);
+    tcase_add_test(tc_log, test_deferred);
 #ifdef HAVE_RUST
     tcase_add_test(tc_log, test_most_basic_rust_logging_setup_teardown);
 #endif
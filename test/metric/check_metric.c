@@ -2,8 +2,15 @@
 
 #include <check.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define SUITE_NAME "metric"
 #define DEBUG_LOG  SUITE_NAME ".log"
@@ -11,7 +18,8 @@
 #define TEST_METRIC(ACTION)                                \
     ACTION( c,       METRIC_COUNTER, "# counter"    )\
     ACTION( g,       METRIC_GAUGE,   "# gauge"      )\
-    ACTION( f,       METRIC_FPN,     "value"        )
+    ACTION( f,       METRIC_FPN,     "value"        )\
+    ACTION( h,       METRIC_HISTOGRAM, "latency"    )
 
 typedef struct {
         TEST_METRIC(METRIC_DECLARE)
@@ -19,6 +27,11 @@ typedef struct {
 
 static test_metrics_st _test_metrics;
 static test_metrics_st *test_metrics = &_test_metrics;
+static METRIC_SHARD_DECLARE(test_metrics);
+
+static test_metrics_st _other_metrics;
+static test_metrics_st *other_metrics = &_other_metrics;
+static METRIC_SHARD_DECLARE(other_metrics);
 
 #define TEST_METRIC_INIT(_metrics) do {                            \
     *(_metrics) = (test_metrics_st) { TEST_METRIC(METRIC_INIT) }; \
@@ -94,6 +107,382 @@ START_TEST(test_fpn)
 }
 END_TEST
 
+START_TEST(test_histogram)
+{
+    char buf[256];
+    uint64_t v;
+
+    test_reset();
+    ck_assert_int_eq(metric_histogram_percentile(&test_metrics->h, 50.0), 0);
+
+    for (v = 1; v <= 1000; v++) {
+        RECORD_VAL(test_metrics, h, v);
+    }
+    RECORD_VAL(test_metrics, h, UINT64_MAX);
+    ck_assert_int_eq(test_metrics->h.histo->count, 1001);
+    ck_assert_int_eq(test_metrics->h.histo->max, UINT64_MAX);
+
+    /* values within one sub-bucket, i.e. 1/16 of the true value */
+    v = metric_histogram_percentile(&test_metrics->h, 50.0);
+    ck_assert_int_ge(v, 500);
+    ck_assert_int_le(v, 500 + 500 / HISTOGRAM_NSUB);
+    v = metric_histogram_percentile(&test_metrics->h, 99.0);
+    ck_assert_int_ge(v, 990);
+    ck_assert_int_le(v, 990 + 990 / HISTOGRAM_NSUB);
+    ck_assert(metric_histogram_percentile(&test_metrics->h, 100.0) ==
+            UINT64_MAX);
+
+    /* small values are exact */
+    metric_reset((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    ck_assert_int_eq(test_metrics->h.histo->count, 0);
+    RECORD_VAL(test_metrics, h, 3);
+    RECORD_VAL(test_metrics, h, 7);
+    ck_assert_int_eq(metric_histogram_percentile(&test_metrics->h, 50.0), 3);
+    ck_assert_int_eq(metric_histogram_percentile(&test_metrics->h, 99.9), 7);
+
+    metric_print(buf, sizeof(buf), "%s %s\n", &test_metrics->h);
+    ck_assert_str_eq(buf, "h_count 2\nh_p50 3\nh_p90 7\nh_p99 7\n"
+            "h_p999 7\nh_max 7\n");
+
+    metric_free((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    ck_assert_ptr_eq(test_metrics->h.histo, NULL);
+}
+END_TEST
+
+START_TEST(test_export)
+{
+    metric_options_st options = { METRIC_OPTION(OPTION_INIT) };
+    const char *name[] = {"c", "g", "f", "h_count", "h_p50", "h_p90", "h_p99",
+        "h_p999", "h_max"};
+    uint8_t layout[256], *p;
+    uint64_t val[16];
+    uint32_t nslot, gen;
+    int64_t g;
+    double f;
+    size_t n;
+    unsigned int i;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(metric_options_st));
+    options.metric_shard.val.vbool = true;
+    metric_setup(&options);
+    test_reset();
+
+    gen = metric_export_gen();
+    ck_assert_int_eq(metric_export_nslot(), 0);
+    ck_assert_int_eq(metric_register((struct metric *)test_metrics,
+                METRIC_CARDINALITY(*test_metrics)), CC_OK);
+    ck_assert_int_ne(metric_export_gen(), gen);
+    ck_assert_int_eq(metric_export_nslot(), 3 + METRIC_EXPORT_HISTOGRAM);
+
+    /* layout is only written if it fits */
+    n = metric_export_layout(layout, 4);
+    ck_assert_int_gt(n, 4);
+    ck_assert_int_eq(metric_export_layout(layout, sizeof(layout)), n);
+    cc_memcpy(&nslot, layout, sizeof(nslot));
+    ck_assert_int_eq(nslot, 3 + METRIC_EXPORT_HISTOGRAM);
+    p = layout + sizeof(nslot);
+    for (i = 0; i < nslot; i++) {
+        ck_assert_int_eq(p[0], i == 1 ? METRIC_GAUGE : i == 2 ? METRIC_FPN :
+                METRIC_COUNTER);
+        ck_assert_int_eq(p[1], strlen(name[i]));
+        ck_assert(memcmp(p + 2, name[i], p[1]) == 0);
+        p += 2 + p[1];
+    }
+    ck_assert_int_eq(p - layout, n);
+
+    /* values, with the shard of this thread folded in */
+    INCR(test_metrics, c);
+    INCR_SHARD(test_metrics, c);
+    DECR_N_SHARD(test_metrics, g, 3);
+    UPDATE_VAL(test_metrics, f, 1.5);
+    RECORD_VAL(test_metrics, h, 5);
+    ck_assert_int_eq(metric_export_values(val, 16), nslot);
+    ck_assert_int_eq(val[0], 2);
+    cc_memcpy(&g, &val[1], sizeof(g));
+    ck_assert_int_eq(g, -3);
+    cc_memcpy(&f, &val[2], sizeof(f));
+    ck_assert(f == 1.5);
+    ck_assert_int_eq(val[3], 1);
+    ck_assert_int_eq(val[4], 5);
+    ck_assert_int_eq(val[8], 5);
+
+    /* a short array gets whole metrics only */
+    ck_assert_int_eq(metric_export_values(val, 5), 3);
+
+    metric_deregister((struct metric *)test_metrics);
+    ck_assert_int_eq(metric_export_nslot(), 0);
+    metric_shard_release((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    metric_free((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    metric_teardown();
+}
+END_TEST
+
+/* what a scraper would do: map the segment and copy its values out */
+static uint32_t
+_shm_scrape(const char *name, uint64_t val[], uint32_t nval, uint32_t *gen)
+{
+    struct metric_shm_hdr *hdr;
+    struct stat st;
+    uint64_t seq;
+    uint32_t nslot;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(fstat(fd, &st), 0);
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ck_assert_ptr_ne(hdr, MAP_FAILED);
+    close(fd);
+
+    ck_assert_uint_eq(hdr->magic, METRIC_SHM_MAGIC);
+    ck_assert_uint_eq(hdr->version, METRIC_SHM_VERSION);
+    ck_assert_uint_eq(hdr->size, st.st_size);
+    ck_assert_uint_gt(hdr->update_ns, 0);
+    do {
+        seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        nslot = hdr->nslot < nval ? hdr->nslot : nval;
+        *gen = hdr->gen;
+        memcpy(val, (char *)hdr + hdr->value_off, nslot * sizeof(uint64_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED));
+    munmap(hdr, st.st_size);
+
+    return nslot;
+}
+
+START_TEST(test_shm)
+{
+    metric_options_st options = { METRIC_OPTION(OPTION_INIT) };
+    test_metrics_st more = { TEST_METRIC(METRIC_INIT) };
+    char name[64];
+    uint64_t val[32];
+    uint32_t gen;
+    int64_t g;
+
+    test_reset();
+    snprintf(name, sizeof(name), "/check_metric.%d", (int)getpid());
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(metric_options_st));
+    options.metric_shm_name.val.vstr = name;
+    metric_setup(&options);
+
+    /* nothing is registered yet */
+    ck_assert_uint_eq(_shm_scrape(name, val, 32, &gen), 0);
+    ck_assert_int_eq(metric_register((struct metric *)test_metrics,
+                METRIC_CARDINALITY(*test_metrics)), CC_OK);
+
+    /* values only change in the segment on update */
+    INCR_N(test_metrics, c, 3);
+    DECR(test_metrics, g);
+    ck_assert_uint_eq(_shm_scrape(name, val, 32, &gen), 0);
+    metric_shm_update(NULL);
+    ck_assert_uint_eq(_shm_scrape(name, val, 32, &gen),
+            3 + METRIC_EXPORT_HISTOGRAM);
+    ck_assert_uint_eq(gen, metric_export_gen());
+    ck_assert_uint_eq(val[0], 3);
+    memcpy(&g, &val[1], sizeof(g));
+    ck_assert_int_eq(g, -1);
+
+    INCR(test_metrics, c);
+    metric_shm_update(NULL);
+    ck_assert_uint_eq(_shm_scrape(name, val, 32, &gen),
+            3 + METRIC_EXPORT_HISTOGRAM);
+    ck_assert_uint_eq(val[0], 4);
+
+    /* a new registration lays the segment out again */
+    ck_assert_int_eq(metric_register((struct metric *)&more,
+                METRIC_CARDINALITY(more)), CC_OK);
+    INCR_N(&more, c, 7);
+    metric_shm_update(NULL);
+    ck_assert_uint_eq(_shm_scrape(name, val, 32, &gen),
+            2 * (3 + METRIC_EXPORT_HISTOGRAM));
+    ck_assert_uint_eq(gen, metric_export_gen());
+    ck_assert_uint_eq(val[3 + METRIC_EXPORT_HISTOGRAM], 7);
+
+    metric_deregister((struct metric *)&more);
+    metric_deregister((struct metric *)test_metrics);
+    metric_teardown();
+
+    /* the segment is gone with the module */
+    ck_assert_int_lt(shm_open(name, O_RDONLY, 0), 0);
+}
+END_TEST
+
+static void *
+test_epoch_worker(void *arg)
+{
+    uint32_t i;
+
+    for (i = 0; i < 100000; i++) {
+        INCR(test_metrics, c);
+    }
+    __atomic_store_n((bool *)arg, true, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+START_TEST(test_epoch)
+{
+    struct metric_epoch *e;
+    struct metric *delta;
+    test_metrics_st *d;
+    pthread_t worker;
+    uint64_t ns, total = 0;
+    bool done = false;
+    char buf[256];
+
+    test_reset();
+    INCR_N(test_metrics, c, 10);
+    INCR_N(test_metrics, g, 10);
+    RECORD_VAL(test_metrics, h, 100);
+
+    /* the first interval starts at creation */
+    e = metric_epoch_create((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    ck_assert_ptr_ne(e, NULL);
+    INCR_N(test_metrics, c, 5);
+    DECR_N(test_metrics, g, 3);
+    UPDATE_VAL(test_metrics, f, 2.5);
+    RECORD_VAL(test_metrics, h, 7);
+    RECORD_VAL(test_metrics, h, 7);
+    delta = metric_epoch_advance(e, &ns);
+    d = (test_metrics_st *)delta;
+    ck_assert_int_eq(d->c.counter, 5);
+    ck_assert_int_eq(d->g.gauge, 7);
+    ck_assert(d->f.fpn == 2.5);
+    ck_assert_int_eq(d->h.histo->count, 2);
+    ck_assert_int_eq(d->h.histo->max, 7);
+    ck_assert_int_eq(metric_histogram_percentile(&d->h, 99.9), 7);
+    ck_assert_int_eq(test_metrics->c.counter, 15);
+    metric_print(buf, sizeof(buf), "%s %s\n", &d->c);
+    ck_assert_str_eq(buf, "c 5\n");
+
+    /* an idle interval */
+    delta = metric_epoch_advance(e, NULL);
+    ck_assert_int_eq(d->c.counter, 0);
+    ck_assert_int_eq(d->g.gauge, 7);
+    ck_assert_int_eq(d->h.histo->count, 0);
+
+    /* deltas of a counter updated concurrently add up to its total */
+    ck_assert_int_eq(pthread_create(&worker, NULL, &test_epoch_worker, &done),
+            0);
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        total += ((test_metrics_st *)metric_epoch_advance(e, NULL))->c.counter;
+        sched_yield();
+    }
+    ck_assert_int_eq(pthread_join(worker, NULL), 0);
+    total += ((test_metrics_st *)metric_epoch_advance(e, NULL))->c.counter;
+    ck_assert_int_eq(total, 100000);
+
+    metric_epoch_destroy(&e);
+    ck_assert_ptr_eq(e, NULL);
+    metric_free((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+}
+END_TEST
+
+#define NTHREAD 4
+#define NROUND  1000
+static void *
+test_shard_worker(void *arg)
+{
+    uint32_t i;
+
+    for (i = 0; i < NROUND; i++) {
+        INCR_SHARD(test_metrics, c);
+        INCR_N_SHARD(test_metrics, g, 2);
+        DECR_SHARD(test_metrics, g);
+    }
+
+    return arg;
+}
+
+START_TEST(test_shard)
+{
+    metric_options_st options = { METRIC_OPTION(OPTION_INIT) };
+    test_metrics_st snapshot;
+    pthread_t worker[NTHREAD];
+    char buf[64];
+    uint32_t i;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(metric_options_st));
+    options.metric_shard.val.vbool = true;
+    metric_setup(&options);
+    test_reset();
+
+    /* updates land in the shard of this thread, not the base */
+    INCR_SHARD(test_metrics, c);
+    INCR_SHARD(test_metrics, g);
+    ck_assert_int_eq(test_metrics->c.counter, 0);
+    ck_assert_int_eq(test_metrics->g.gauge, 0);
+    UPDATE_VAL(test_metrics, f, 1.5);
+
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_create(&worker[i], NULL, &test_shard_worker,
+                    NULL), 0);
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_join(worker[i], NULL), 0);
+    }
+    ck_assert_int_eq(test_metrics->c.counter, 0);
+
+    /* readers see the sum of base and shards */
+    INCR(test_metrics, c);
+    metric_snapshot((struct metric *)&snapshot, (struct metric *)test_metrics,
+            METRIC_CARDINALITY(snapshot));
+    ck_assert_int_eq(snapshot.c.counter, 2 + NTHREAD * NROUND);
+    ck_assert_int_eq(snapshot.g.gauge, 1 + NTHREAD * NROUND);
+    ck_assert(snapshot.f.fpn == 1.5);
+    ck_assert_str_eq(snapshot.c.name, "c");
+
+    metric_print(buf, sizeof(buf), "%s %s", &test_metrics->g);
+    ck_assert_int_eq(atoi(buf + 2), 1 + NTHREAD * NROUND);
+
+    /* release folds the shards into the base and invalidates handles */
+    metric_shard_release((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    ck_assert_int_eq(test_metrics->c.counter, 2 + NTHREAD * NROUND);
+    ck_assert_int_eq(test_metrics->g.gauge, 1 + NTHREAD * NROUND);
+    INCR_SHARD(test_metrics, c);
+    ck_assert_int_eq(test_metrics->c.counter, 2 + NTHREAD * NROUND);
+    metric_shard_release((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    ck_assert_int_eq(test_metrics->c.counter, 3 + NTHREAD * NROUND);
+
+    /* set up and torn down next to a live module, no shard is left behind */
+    INCR_SHARD(test_metrics, c);
+    ck_assert_uint_eq(metric_shard_count(), 1);
+    for (i = 0; i < 2; i++) {
+        TEST_METRIC_INIT(other_metrics);
+        INCR_SHARD(other_metrics, c);
+        ck_assert_uint_eq(metric_shard_count(), 2);
+        metric_shard_release((struct metric *)other_metrics,
+                METRIC_CARDINALITY(*other_metrics));
+        ck_assert_int_eq(other_metrics->c.counter, 1);
+        INCR_SHARD(test_metrics, c);
+        ck_assert_uint_eq(metric_shard_count(), 1);
+    }
+    metric_shard_release((struct metric *)test_metrics,
+            METRIC_CARDINALITY(*test_metrics));
+    ck_assert_int_eq(test_metrics->c.counter, 6 + NTHREAD * NROUND);
+    ck_assert_uint_eq(metric_shard_count(), 0);
+
+    /* with sharding off the base is updated directly */
+    metric_teardown();
+    test_reset();
+    INCR_SHARD(test_metrics, c);
+    ck_assert_int_eq(test_metrics->c.counter, 1);
+}
+END_TEST
+#undef NTHREAD
+#undef NROUND
+
 /*
  * test suite
  */
@@ -109,6 +498,11 @@ metric_suite(void)
     tcase_add_test(tc_metric, test_counter);
     tcase_add_test(tc_metric, test_gauge);
     tcase_add_test(tc_metric, test_fpn);
+    tcase_add_test(tc_metric, test_histogram);
+    tcase_add_test(tc_metric, test_shard);
+    tcase_add_test(tc_metric, test_export);
+    tcase_add_test(tc_metric, test_shm);
+    tcase_add_test(tc_metric, test_epoch);
 
     return s;
 }
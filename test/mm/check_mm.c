@@ -0,0 +1,403 @@
+#include <cc_mm.h>
+
+#include <check.h>
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SUITE_NAME "mm"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    mm_setup(NULL, NULL);
+}
+
+static void
+test_teardown(void)
+{
+    mm_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+static void
+_touch(char *p, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i += 4 * KiB) {
+        p[i] = (char)i;
+    }
+    ck_assert_int_eq(p[size / 2], (char)(size / 2));
+}
+
+/* memory policy mode of the page at addr, faulting it in if needed */
+static int
+_mempolicy(void *addr)
+{
+    int mode = -1;
+
+    *(char *)addr = 1;
+    if (syscall(SYS_get_mempolicy, &mode, NULL, 0, addr, MPOL_F_ADDR) < 0) {
+        return -1;
+    }
+
+    return mode;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_mmap_default)
+{
+    char *p;
+
+    test_reset();
+
+    p = cc_mmap(64 * KiB);
+    ck_assert_ptr_ne(p, NULL);
+    _touch(p, 64 * KiB);
+    ck_assert_int_eq(cc_munmap(p, 64 * KiB), 0);
+}
+END_TEST
+
+START_TEST(test_mmap_hugepage)
+{
+    char *p;
+
+    test_reset();
+
+    p = cc_mmap_ext(4 * MiB, MM_HUGEPAGE_THP, MM_NUMA_ANY);
+    ck_assert_ptr_ne(p, NULL);
+    _touch(p, 4 * MiB);
+    ck_assert_int_eq(cc_munmap(p, 4 * MiB), 0);
+
+    /* hugetlb falls back to regular pages if the pool is empty */
+    p = cc_mmap_ext(MM_HUGEPAGE_SIZE, MM_HUGEPAGE_TLB, MM_NUMA_ANY);
+    ck_assert_ptr_ne(p, NULL);
+    _touch(p, MM_HUGEPAGE_SIZE);
+    ck_assert_int_eq(cc_munmap(p, MM_HUGEPAGE_SIZE), 0);
+
+    /* and is not attempted for sizes that are not a hugepage multiple */
+    p = cc_mmap_ext(3 * MiB, MM_HUGEPAGE_TLB, MM_NUMA_ANY);
+    ck_assert_ptr_ne(p, NULL);
+    _touch(p, 3 * MiB);
+    ck_assert_int_eq(cc_munmap(p, 3 * MiB), 0);
+}
+END_TEST
+
+START_TEST(test_mmap_numa)
+{
+    char *p;
+
+    test_reset();
+
+    p = cc_mmap_ext(MM_HUGEPAGE_SIZE, MM_HUGEPAGE_NONE, 0);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(_mempolicy(p), MPOL_BIND);
+    ck_assert_int_eq(cc_munmap(p, MM_HUGEPAGE_SIZE), 0);
+
+    p = cc_mmap_ext(MM_HUGEPAGE_SIZE, MM_HUGEPAGE_NONE, MM_NUMA_ANY);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(_mempolicy(p), MPOL_DEFAULT);
+    ck_assert_int_eq(cc_munmap(p, MM_HUGEPAGE_SIZE), 0);
+
+    /* binding to a node that does not exist keeps the mapping */
+    p = cc_mmap_ext(MM_HUGEPAGE_SIZE, MM_HUGEPAGE_NONE, MM_NUMA_NODE_MAX - 1);
+    ck_assert_ptr_ne(p, NULL);
+    _touch(p, MM_HUGEPAGE_SIZE);
+    ck_assert_int_eq(cc_munmap(p, MM_HUGEPAGE_SIZE), 0);
+}
+END_TEST
+
+START_TEST(test_setup_options)
+{
+    mm_options_st options = { MM_OPTION(OPTION_INIT) };
+    char *p;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(mm_options_st));
+    options.mm_hugepage.val.vuint = MM_HUGEPAGE_THP;
+    options.mm_hugepage_min.val.vuint = MiB;
+    options.mm_numa_bind.val.vbool = true;
+    options.mm_numa_node.val.vuint = 0;
+
+    test_teardown();
+    mm_setup(&options, NULL);
+
+    /* policy only applies at or above mm_hugepage_min */
+    p = cc_mmap(MiB);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(_mempolicy(p), MPOL_BIND);
+    ck_assert_int_eq(cc_munmap(p, MiB), 0);
+
+    p = cc_mmap(MiB / 2);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(_mempolicy(p), MPOL_DEFAULT);
+    ck_assert_int_eq(cc_munmap(p, MiB / 2), 0);
+
+    /* teardown restores the default policy */
+    test_reset();
+    p = cc_mmap(MiB);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(_mempolicy(p), MPOL_DEFAULT);
+    ck_assert_int_eq(cc_munmap(p, MiB), 0);
+}
+END_TEST
+
+START_TEST(test_mmap_metric)
+{
+    mm_metrics_st metrics = { MM_METRIC(METRIC_INIT) };
+    char *p;
+
+    test_teardown();
+    mm_setup(NULL, &metrics);
+
+    p = cc_mmap(MiB);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(metrics.mm_mmap_byte.gauge, MiB);
+    ck_assert_int_eq(cc_munmap(p, MiB), 0);
+    ck_assert_int_eq(metrics.mm_mmap_byte.gauge, 0);
+
+    test_reset();
+}
+END_TEST
+
+#if defined CC_MM_ACCOUNT && CC_MM_ACCOUNT == 1
+static const struct mm_stat *
+_find(struct mm_stat *st, uint32_t n, const char *file, int line)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if (strcmp(st[i].file, file) == 0 && st[i].line == line) {
+            return &st[i];
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+START_TEST(test_account)
+{
+#if defined CC_MM_ACCOUNT && CC_MM_ACCOUNT == 1
+    mm_metrics_st metrics = { MM_METRIC(METRIC_INIT) };
+    struct mm_stat *st = malloc(sizeof(*st) * (MM_NSITE + 1));
+    const struct mm_stat *s;
+    char buf[4096], name[64];
+    int64_t module_byte;
+    uint32_t n;
+    int line_alloc, line_realloc;
+    char *p;
+
+    test_teardown();
+    mm_setup(NULL, &metrics);
+
+    n = mm_stat_snapshot(st, MM_NSITE + 1, true);
+    s = _find(st, n, "check_mm.c", 0);
+    module_byte = s == NULL ? 0 : s->byte;
+
+    line_alloc = __LINE__ + 1;
+    p = cc_alloc(100);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_uint_eq((uintptr_t)p % alignof(max_align_t), 0);
+    memset(p, 1, 100);
+    ck_assert_uint_eq(metrics.mm_alloc.counter, 1);
+    ck_assert_int_eq(metrics.mm_alloc_byte.gauge, 100);
+
+    n = mm_stat_snapshot(st, MM_NSITE + 1, false);
+    s = _find(st, n, "check_mm.c", line_alloc);
+    ck_assert_ptr_ne(s, NULL);
+    ck_assert_uint_eq(s->nalloc, 1);
+    ck_assert_int_eq(s->byte, 100);
+
+    /* a realloc moves the bytes to the site of the realloc */
+    line_realloc = __LINE__ + 1;
+    p = cc_realloc(p, 300);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(p[99], 1);
+    n = mm_stat_snapshot(st, MM_NSITE + 1, false);
+    s = _find(st, n, "check_mm.c", line_alloc);
+    ck_assert_uint_eq(s->nfree, 1);
+    ck_assert_int_eq(s->byte, 0);
+    ck_assert_int_eq(s->peak, 100);
+    s = _find(st, n, "check_mm.c", line_realloc);
+    ck_assert_ptr_ne(s, NULL);
+    ck_assert_int_eq(s->byte, 300);
+
+    n = mm_stat_snapshot(st, MM_NSITE + 1, true);
+    s = _find(st, n, "check_mm.c", 0);
+    ck_assert_ptr_ne(s, NULL);
+    ck_assert_int_eq(s->byte, module_byte + 300);
+
+    mm_stat_print(buf, sizeof(buf), "%s %s\n", false);
+    snprintf(name, sizeof(name), "mm::check_mm.c:%d::byte 300\n",
+            line_realloc);
+    ck_assert_ptr_ne(strstr(buf, name), NULL);
+
+    /* freed anywhere, charged to where it was allocated */
+    cc_free(p);
+    n = mm_stat_snapshot(st, MM_NSITE + 1, false);
+    s = _find(st, n, "check_mm.c", line_realloc);
+    ck_assert_uint_eq(s->nfree, 1);
+    ck_assert_int_eq(s->byte, 0);
+    ck_assert_int_eq(s->peak, 300);
+    ck_assert_uint_eq(metrics.mm_free.counter, 2);
+    ck_assert_int_eq(metrics.mm_alloc_byte.gauge, 0);
+
+    free(st);
+    test_reset();
+#else
+    struct mm_stat st;
+
+    ck_assert_uint_eq(mm_stat_snapshot(&st, 1, false), 0);
+#endif
+}
+END_TEST
+
+static struct {
+    uint32_t    nalloc;
+    uint32_t    nrealloc;
+    uint32_t    nfree;
+    uint32_t    nfree_sized;
+    size_t      size;
+} counted;
+
+static void *
+_counted_alloc(size_t size)
+{
+    counted.nalloc++;
+    return malloc(size);
+}
+
+static void *
+_counted_realloc(void *ptr, size_t size)
+{
+    counted.nrealloc++;
+    return realloc(ptr, size);
+}
+
+static void
+_counted_free(void *ptr)
+{
+    counted.nfree++;
+    free(ptr);
+}
+
+static void
+_counted_free_sized(void *ptr, size_t size)
+{
+    counted.nfree_sized++;
+    counted.size = size;
+    free(ptr);
+}
+
+START_TEST(test_allocator)
+{
+    struct mm_allocator a = {
+        _counted_alloc, _counted_realloc, _counted_free, _counted_free_sized
+    };
+#if defined CC_DEBUG_MM && CC_DEBUG_MM == 1
+    /* realloc always moves the block: one more alloc, and a free */
+    const uint32_t moved = 1;
+#else
+    const uint32_t moved = 0;
+#endif
+    char *p;
+
+    memset(&counted, 0, sizeof(counted));
+    mm_allocator_set(&a);
+
+    p = cc_alloc(64);
+    ck_assert_ptr_ne(p, NULL);
+    p = cc_realloc(p, 128);
+    ck_assert_ptr_ne(p, NULL);
+    cc_free(p);
+    ck_assert_ptr_eq(p, NULL);
+    ck_assert_uint_eq(counted.nalloc, 1 + moved);
+    ck_assert_uint_eq(counted.nrealloc, 1);
+    ck_assert_uint_eq(counted.nfree, 1 + moved);
+
+    /* sized free passes the size on, header included if any */
+    p = cc_zalloc(256);
+    cc_free_sized(p, 256);
+    ck_assert_ptr_eq(p, NULL);
+    ck_assert_uint_eq(counted.nfree_sized, 1);
+    ck_assert_uint_ge(counted.size, 256);
+    ck_assert_uint_lt(counted.size, 256 + 64);
+
+    /* without free_sized, free is used */
+    a.free_sized = NULL;
+    mm_allocator_set(&a);
+    p = cc_alloc(32);
+    cc_free_sized(p, 32);
+    ck_assert_uint_eq(counted.nfree_sized, 1);
+    ck_assert_uint_eq(counted.nfree, 2 + moved);
+
+    mm_allocator_set(NULL);
+    p = cc_alloc(32);
+    cc_free_sized(p, 32);
+    ck_assert_uint_eq(counted.nalloc, 3 + moved);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+mm_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_mm = tcase_create("mm test");
+    suite_add_tcase(s, tc_mm);
+
+    tcase_add_test(tc_mm, test_mmap_default);
+    tcase_add_test(tc_mm, test_mmap_hugepage);
+    tcase_add_test(tc_mm, test_mmap_numa);
+    tcase_add_test(tc_mm, test_setup_options);
+    tcase_add_test(tc_mm, test_mmap_metric);
+    tcase_add_test(tc_mm, test_account);
+    tcase_add_test(tc_mm, test_allocator);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = mm_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,3 +1,4 @@
+#include <cc_debug.h>
 #include <cc_option.h>
 
 #include <check.h>
@@ -236,6 +237,149 @@ START_TEST(test_load_file)
 }
 END_TEST
 
+static int napply;
+static struct option *rejected;
+
+static rstatus_i
+_apply(struct option *opt, option_val_u old, void *arg)
+{
+    (void)old;
+    (void)arg;
+
+    napply++;
+
+    return opt == rejected ? CC_ERROR : CC_OK;
+}
+
+START_TEST(test_reload_file)
+{
+#define TEST_OPTION(ACTION)                                                                 \
+    ACTION( boolean,    OPTION_TYPE_BOOL,   true,   "it may be true of false"              )\
+    ACTION( uinteger,   OPTION_TYPE_UINT,   2,      "it is a non-negative integer number"  )\
+    ACTION( fpn,        OPTION_TYPE_FPN,    1.25,   "it is a floating point number"        )\
+    ACTION( string,     OPTION_TYPE_STR,    "foo",  "it is a sequence of bytes"            )
+
+#define SETTING(ACTION) \
+    TEST_OPTION(ACTION)
+
+    struct setting {
+        SETTING(OPTION_DECLARE)
+    } setting = {
+        SETTING(OPTION_INIT)
+    };
+    const unsigned int nopt = OPTION_CARDINALITY(struct setting);
+
+    char *tmpname;
+    FILE *fp;
+
+    test_reset();
+
+    ck_assert_int_eq(option_load_default((struct option *)&setting, nopt),
+            CC_OK);
+
+    /* only changed options are applied, the rest go back to default */
+    tmpname = tmpname_create(
+        "uinteger: 3\n"
+        "string: bar\n"
+    );
+    fp = fopen(tmpname, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    setting.boolean.val.vbool = false;
+    napply = 0;
+    rejected = NULL;
+    ck_assert_int_eq(option_reload_file(fp, (struct option *)&setting, nopt,
+            _apply, NULL), CC_OK);
+    ck_assert_int_eq(napply, 3);
+    ck_assert_int_eq(setting.boolean.val.vbool, true);
+    ck_assert_int_eq(setting.uinteger.val.vuint, 3);
+    ck_assert(fabs(setting.fpn.val.vfpn - 1.25) < 1e-5);
+    ck_assert_str_eq(setting.string.val.vstr, "bar");
+
+    /* nothing changed, nothing applied */
+    rewind(fp);
+    napply = 0;
+    ck_assert_int_eq(option_reload_file(fp, (struct option *)&setting, nopt,
+            _apply, NULL), CC_OK);
+    ck_assert_int_eq(napply, 0);
+
+    /* a rejected change reverts the whole reload, applied ones included */
+    rewind(fp);
+    setting.uinteger.val.vuint = 4;
+    option_set(&setting.string, "baz");
+    rejected = &setting.string;
+    ck_assert_int_eq(option_reload_file(fp, (struct option *)&setting, nopt,
+            _apply, NULL), CC_ERROR);
+    ck_assert_int_eq(napply, 3); /* uinteger, string, uinteger rolled back */
+    ck_assert_int_eq(setting.uinteger.val.vuint, 4);
+    ck_assert_str_eq(setting.string.val.vstr, "baz");
+    fclose(fp);
+    tmpname_destroy(tmpname);
+
+    /* a file that does not parse changes nothing */
+    tmpname = tmpname_create(
+        "uinteger: 5\n"
+        "nosuchoption: 1\n"
+    );
+    fp = fopen(tmpname, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    napply = 0;
+    ck_assert_int_eq(option_reload_file(fp, (struct option *)&setting, nopt,
+            _apply, NULL), CC_ERROR);
+    ck_assert_int_eq(napply, 0);
+    ck_assert_int_eq(setting.uinteger.val.vuint, 4);
+    ck_assert_str_eq(setting.string.val.vstr, "baz");
+    fclose(fp);
+    tmpname_destroy(tmpname);
+
+    option_free((struct option *)&setting, nopt);
+#undef TEST_OPTION
+#undef SETTING
+}
+END_TEST
+
+START_TEST(test_reload_debug)
+{
+    debug_options_st options = { DEBUG_OPTION(OPTION_INIT) };
+    const unsigned int nopt = OPTION_CARDINALITY(debug_options_st);
+    char *tmpname;
+    FILE *fp;
+
+    test_reset();
+
+    ck_assert_int_eq(option_load_default((struct option *)&options, nopt),
+            CC_OK);
+    dlog->level = option_uint(&options.debug_log_level);
+
+    /* an option that needs a restart holds back the level as well */
+    tmpname = tmpname_create(
+        "debug_log_level: 6\n"
+        "debug_log_nbuf: 8192\n"
+    );
+    fp = fopen(tmpname, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    ck_assert_int_eq(option_reload_file(fp, (struct option *)&options, nopt,
+            debug_apply, &options), CC_ERROR);
+    ck_assert_int_eq(dlog->level, DEBUG_LOG_LEVEL);
+    ck_assert_int_eq(option_uint(&options.debug_log_level), DEBUG_LOG_LEVEL);
+    ck_assert_int_eq(option_uint(&options.debug_log_nbuf), DEBUG_LOG_NBUF);
+    fclose(fp);
+    tmpname_destroy(tmpname);
+
+    tmpname = tmpname_create("debug_log_level: 6\n");
+    fp = fopen(tmpname, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    ck_assert_int_eq(option_reload_file(fp, (struct option *)&options, nopt,
+            debug_apply, &options), CC_OK);
+    ck_assert_int_eq(dlog->level, 6);
+    ck_assert_int_eq(option_uint(&options.debug_log_level), 6);
+    fclose(fp);
+    tmpname_destroy(tmpname);
+
+    dlog->level = DEBUG_LOG_LEVEL;
+    option_free((struct option *)&options, nopt);
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -250,6 +394,8 @@ option_suite(void)
     tcase_add_test(tc_option, test_parse_float);
     tcase_add_test(tc_option, test_parse_string);
     tcase_add_test(tc_option, test_load_file);
+    tcase_add_test(tc_option, test_reload_file);
+    tcase_add_test(tc_option, test_reload_debug);
     suite_add_tcase(s, tc_option);
 
     return s;
@@ -3,6 +3,7 @@
 
 #include <check.h>
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -18,6 +19,10 @@ struct foo {
 FREEPOOL(foo_pool, fooq, foo);
 static struct foo_pool foop;
 
+FREEPOOL_SHARDED(foo_spool, foosq, foo);
+static struct foo_spool foosp;
+static __thread struct foo_spool_local foosp_local;
+
 static struct foo *
 foo_create(void)
 {
@@ -145,6 +150,191 @@ START_TEST(test_noprealloc_borrow_return)
 }
 END_TEST
 
+START_TEST(test_trim_release)
+{
+#define NFOO 8
+    struct foo *foo[NFOO], *bar;
+    int i;
+
+    test_reset();
+
+    FREEPOOL_CREATE(&foop, 0);
+    for (i = 0; i < NFOO; i++) {
+        FREEPOOL_BORROW(foo[i], &foop, next, foo_create);
+        ck_assert_ptr_ne(foo[i], NULL);
+    }
+    for (i = 0; i < NFOO; i++) {
+        FREEPOOL_RETURN(foo[i], &foop, next);
+    }
+    ck_assert_int_eq(foop.nfree, NFOO);
+
+    /* all were in use since the pool was created, nothing is idle yet */
+    FREEPOOL_TRIM(bar, &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, NFOO);
+
+    /* halved every trim while idle, down to the low watermark */
+    FREEPOOL_TRIM(bar, &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, NFOO / 2);
+    FREEPOOL_WATERMARK(&foop, 1, 0);
+    FREEPOOL_TRIM(bar, &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, 2);
+    FREEPOOL_TRIM(bar, &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, 1);
+    FREEPOOL_TRIM(bar, &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, 1);
+
+    /* objects borrowed in between are not idle */
+    FREEPOOL_BORROW(foo[0], &foop, next, foo_create);
+    FREEPOOL_BORROW(foo[1], &foop, next, foo_create);
+    FREEPOOL_RETURN(foo[1], &foop, next);
+    FREEPOOL_RETURN(foo[0], &foop, next);
+    FREEPOOL_WATERMARK(&foop, 0, 0);
+    FREEPOOL_TRIM(bar, &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, 2);
+
+    /* beyond the high watermark, returns destroy */
+    FREEPOOL_WATERMARK(&foop, 0, 1);
+    FREEPOOL_BORROW(foo[0], &foop, next, foo_create);
+    FREEPOOL_BORROW(foo[1], &foop, next, foo_create);
+    ck_assert_int_eq(foop.nused, 2);
+    FREEPOOL_RELEASE(foo[0], &foop, next, foo_destroy);
+    ck_assert_int_eq(foop.nfree, 1);
+    FREEPOOL_RELEASE(foo[1], &foop, next, foo_destroy);
+    ck_assert_ptr_eq(foo[1], NULL);
+    ck_assert_int_eq(foop.nfree, 1);
+    ck_assert_int_eq(foop.nused, 0);
+
+    FREEPOOL_DESTROY(foo[0], bar, &foop, next, foo_destroy);
+#undef NFOO
+}
+END_TEST
+
+START_TEST(test_sharded_borrow_return)
+{
+#define BATCH 4
+#define NFOO (3 * BATCH)
+    struct foo *foo[NFOO], *bar = NULL, *baz = NULL;
+    uint32_t i;
+
+    test_reset();
+
+    FREEPOOL_SHARDED_CREATE(&foosp, NFOO, BATCH);
+    ck_assert_int_eq(foosp.nmax, NFOO);
+    ck_assert_int_eq(foosp.batch, BATCH);
+    FREEPOOL_SHARDED_PREALLOC(bar, &foosp, BATCH, next, foo_create);
+    ck_assert_int_eq(foosp.ndepot, BATCH);
+    ck_assert_int_eq(foosp.ncreated, BATCH);
+
+    /* first borrow pulls a whole batch into the local cache */
+    FREEPOOL_SHARDED_BORROW(foo[0], &foosp, &foosp_local, next, foo_create);
+    ck_assert(foo[0] != NULL);
+    ck_assert_int_eq(foosp.ndepot, 0);
+    ck_assert_int_eq(foosp_local.nfree, BATCH - 1);
+
+    /* the rest are created on demand, up to nmax */
+    for (i = 1; i < NFOO; i++) {
+        FREEPOOL_SHARDED_BORROW(foo[i], &foosp, &foosp_local, next, foo_create);
+        ck_assert(foo[i] != NULL);
+    }
+    ck_assert_int_eq(foosp.ncreated, NFOO);
+    ck_assert_int_eq(foosp_local.nfree, 0);
+    FREEPOOL_SHARDED_BORROW(bar, &foosp, &foosp_local, next, foo_create);
+    ck_assert(bar == NULL);
+    ck_assert_int_eq(foosp.ncreated, NFOO);
+
+    /* local cache spills one batch once it reaches twice the batch size */
+    for (i = 0; i < 2 * BATCH - 1; i++) {
+        FREEPOOL_SHARDED_RETURN(foo[i], &foosp, &foosp_local, next);
+    }
+    ck_assert_int_eq(foosp.ndepot, 0);
+    FREEPOOL_SHARDED_RETURN(foo[i], &foosp, &foosp_local, next);
+    ck_assert_int_eq(foosp.ndepot, BATCH);
+    ck_assert_int_eq(foosp_local.nfree, BATCH);
+    for (i = 2 * BATCH; i < NFOO; i++) {
+        FREEPOOL_SHARDED_RETURN(foo[i], &foosp, &foosp_local, next);
+    }
+
+    FREEPOOL_SHARDED_DRAIN(&foosp, &foosp_local, next);
+    ck_assert_int_eq(foosp_local.nfree, 0);
+    ck_assert_int_eq(foosp.ndepot, NFOO);
+
+    FREEPOOL_SHARDED_DESTROY(bar, baz, &foosp, next, foo_destroy);
+    ck_assert_int_eq(foosp.ncreated, 0);
+    ck_assert(!foosp.initialized);
+#undef BATCH
+#undef NFOO
+}
+END_TEST
+
+/*
+ * Threading test
+ */
+#define NTHREAD 4
+#define NHOLD 50
+#define NROUND 1000
+#define NBATCH 8
+static void *
+test_sharded_worker(void *arg)
+{
+    struct foo *foo[NHOLD];
+    uint32_t i, j;
+    bool *ok = arg;
+
+    *ok = true;
+    for (i = 0; i < NROUND; i++) {
+        for (j = 0; j < NHOLD; j++) {
+            FREEPOOL_SHARDED_BORROW(foo[j], &foosp, &foosp_local, next,
+                    foo_create);
+            if (foo[j] == NULL) {
+                *ok = false;
+                return NULL;
+            }
+            foo[j]->d = j;
+        }
+        for (j = 0; j < NHOLD; j++) {
+            if (foo[j]->d != (int)j) {
+                *ok = false;
+            }
+            FREEPOOL_SHARDED_RETURN(foo[j], &foosp, &foosp_local, next);
+        }
+    }
+    FREEPOOL_SHARDED_DRAIN(&foosp, &foosp_local, next);
+
+    return NULL;
+}
+
+START_TEST(test_sharded_thread)
+{
+    pthread_t worker[NTHREAD];
+    bool ok[NTHREAD];
+    struct foo *foo = NULL, *bar = NULL;
+    uint32_t i;
+
+    test_reset();
+
+    /* enough for every thread to hold NHOLD plus a full local cache */
+    FREEPOOL_SHARDED_CREATE(&foosp, NTHREAD * (NHOLD + 2 * NBATCH), NBATCH);
+
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_create(&worker[i], NULL, &test_sharded_worker,
+                    &ok[i]), 0);
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_join(worker[i], NULL), 0);
+        ck_assert(ok[i]);
+    }
+
+    ck_assert_int_le(foosp.ncreated, NTHREAD * (NHOLD + 2 * NBATCH));
+    ck_assert_int_eq(foosp.ndepot, foosp.ncreated);
+
+    FREEPOOL_SHARDED_DESTROY(foo, bar, &foosp, next, foo_destroy);
+}
+END_TEST
+#undef NTHREAD
+#undef NHOLD
+#undef NROUND
+#undef NBATCH
+
 
 /*
  * test suite
@@ -158,6 +348,9 @@ pool_suite(void)
     tcase_add_test(tc_pool, test_create_prealloc_destroy);
     tcase_add_test(tc_pool, test_prealloc_borrow_return);
     tcase_add_test(tc_pool, test_noprealloc_borrow_return);
+    tcase_add_test(tc_pool, test_trim_release);
+    tcase_add_test(tc_pool, test_sharded_borrow_return);
+    tcase_add_test(tc_pool, test_sharded_thread);
 
     suite_add_tcase(s, tc_pool);
 
@@ -0,0 +1,209 @@
+#include <cc_print.h>
+
+#include <check.h>
+
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "print"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define BUFLEN 64
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+}
+
+static void
+test_teardown(void)
+{
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+static void
+_check_uint64(uint64_t n)
+{
+    char buf[BUFLEN], ref[BUFLEN];
+    size_t len = (size_t)sprintf(ref, "%"PRIu64, n);
+
+    ck_assert_int_eq(digits(n), len);
+    ck_assert_int_eq(cc_print_uint64(buf, BUFLEN, n), len);
+    ck_assert_int_eq(memcmp(buf, ref, len), 0);
+    ck_assert_int_eq(cc_print_uint64_unsafe(buf, n), len);
+    ck_assert_int_eq(memcmp(buf, ref, len), 0);
+    ck_assert_int_eq(cc_print_uint64(buf, len - 1, n), 0);
+}
+
+static void
+_check_int64(int64_t n)
+{
+    char buf[BUFLEN], ref[BUFLEN];
+    size_t len = (size_t)sprintf(ref, "%"PRId64, n);
+
+    ck_assert_int_eq(cc_print_int64(buf, BUFLEN, n), len);
+    ck_assert_int_eq(memcmp(buf, ref, len), 0);
+    ck_assert_int_eq(cc_print_int64_unsafe(buf, n), len);
+    ck_assert_int_eq(memcmp(buf, ref, len), 0);
+    ck_assert_int_eq(cc_print_int64(buf, len - 1, n), 0);
+}
+
+/* print n, check it reads back and return the string */
+static const char *
+_double(double n)
+{
+    static char buf[BUFLEN];
+    size_t len;
+
+    len = cc_print_double(buf, CC_DOUBLE_MAXLEN, n);
+    ck_assert_int_gt(len, 0);
+    ck_assert_int_lt(len, CC_DOUBLE_MAXLEN);
+    buf[len] = '\0';
+    if (!isnan(n)) {
+        ck_assert(strtod(buf, NULL) == n);
+    }
+
+    return buf;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_uint64)
+{
+    uint64_t p;
+    int i;
+
+    test_reset();
+
+    _check_uint64(0);
+    _check_uint64(UINT64_MAX);
+    for (p = 1, i = 0; i < 20; i++, p *= 10) {
+        _check_uint64(p - 1);
+        _check_uint64(p);
+        _check_uint64(p + 1);
+    }
+    for (p = 1; p < UINT64_MAX / 3; p = p * 3 + 1) {
+        _check_uint64(p);
+    }
+}
+END_TEST
+
+START_TEST(test_int64)
+{
+    int64_t p;
+    int i;
+
+    test_reset();
+
+    _check_int64(0);
+    _check_int64(INT64_MAX);
+    _check_int64(INT64_MIN);
+    for (p = 1, i = 0; i < 18; i++, p *= 10) {
+        _check_int64(p - 1);
+        _check_int64(-p);
+        _check_int64(-p + 1);
+        _check_int64(-p - 1);
+    }
+}
+END_TEST
+
+START_TEST(test_double)
+{
+    char buf[BUFLEN];
+    double n;
+    int i;
+
+    test_reset();
+
+    /* short */
+    ck_assert_str_eq(_double(0.0), "0");
+    ck_assert_str_eq(_double(-0.0), "-0");
+    ck_assert_str_eq(_double(1.0), "1");
+    ck_assert_str_eq(_double(2.5), "2.5");
+    ck_assert_str_eq(_double(-0.1), "-0.1");
+    ck_assert_str_eq(_double(1.15), "1.15");
+    ck_assert_str_eq(_double(0.0005), "0.0005");
+    ck_assert_str_eq(_double(123456.789), "123456.789");
+    ck_assert_str_eq(_double(1e20), "1e+20");
+    ck_assert_str_eq(_double(1e-20), "1e-20");
+    /* shortest, not most precise */
+    ck_assert_str_eq(_double(0.1 + 0.2), "0.30000000000000004");
+    ck_assert_str_eq(_double(1.0 / 3), "0.3333333333333333");
+    ck_assert_str_eq(_double(NAN), "nan");
+    ck_assert_str_eq(_double(INFINITY), "inf");
+    ck_assert_str_eq(_double(-INFINITY), "-inf");
+
+    /* all the extremes read back */
+    _double(DBL_MAX);
+    _double(-DBL_MIN);
+    _double(4.9e-324);
+    _double(9007199254740993.0);
+
+    /* and everything in between */
+    srand(42);
+    for (i = 0; i < 10000; i++) {
+        n = ldexp((double)rand() / RAND_MAX, rand() % 200 - 100);
+        _double(i % 2 ? n : -n);
+        _double(round(n * 1000) / 1000);
+    }
+
+    /* nothing written without enough room */
+    ck_assert_int_eq(cc_print_double(buf, 2, 2.5), 0);
+    ck_assert_int_eq(cc_print_double(buf, 3, 2.5), 3);
+    ck_assert_int_eq(cc_print_double(buf, 2, NAN), 0);
+    ck_assert_int_eq(cc_print_double(buf, 4, 1.0 / 3), 0);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+print_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_print = tcase_create("print test");
+    suite_add_tcase(s, tc_print);
+
+    tcase_add_test(tc_print, test_uint64);
+    tcase_add_test(tc_print, test_int64);
+    tcase_add_test(tc_print, test_double);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = print_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
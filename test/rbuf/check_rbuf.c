@@ -126,6 +126,98 @@ START_TEST(test_create_write_read_wrap_around_destroy)
 }
 END_TEST
 
+START_TEST(test_peek_consume_wrap_around)
+{
+#define CAP 20
+    size_t i;
+    char write_data[CAP], read_data[CAP];
+    struct iovec iov[2];
+    struct rbuf *buffer;
+
+    test_reset();
+
+    for (i = 0; i < CAP; i++) {
+        write_data[i] = i % CHAR_MAX;
+    }
+
+    buffer = rbuf_create(CAP);
+    ck_assert_ptr_ne(buffer, NULL);
+    ck_assert_int_eq(rbuf_peek(buffer, iov), 0);
+
+    /* contiguous */
+    ck_assert_int_eq(rbuf_write(buffer, write_data, CAP / 2), CAP / 2);
+    ck_assert_int_eq(rbuf_peek(buffer, iov), 1);
+    ck_assert_int_eq(iov[0].iov_len, CAP / 2);
+    ck_assert_int_eq(memcmp(iov[0].iov_base, write_data, CAP / 2), 0);
+    rbuf_consume(buffer, CAP / 2);
+    ck_assert_int_eq(rbuf_rcap(buffer), 0);
+
+    /* wrapped, advancing partially and then across the end */
+    ck_assert_int_eq(rbuf_write(buffer, write_data, CAP), CAP);
+    ck_assert_int_eq(rbuf_peek(buffer, iov), 2);
+    ck_assert_int_eq(iov[0].iov_len + iov[1].iov_len, CAP);
+    memcpy(read_data, iov[0].iov_base, iov[0].iov_len);
+    memcpy(read_data + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+    ck_assert_int_eq(memcmp(read_data, write_data, CAP), 0);
+    rbuf_consume(buffer, 1);
+    ck_assert_int_eq(rbuf_rcap(buffer), CAP - 1);
+    rbuf_consume(buffer, iov[0].iov_len);
+    ck_assert_int_eq(rbuf_peek(buffer, iov), 1);
+    ck_assert_int_eq(iov[0].iov_len, CAP - 1 - (CAP / 2 + 1));
+    ck_assert_int_eq(rbuf_read(read_data, buffer, CAP), iov[0].iov_len);
+    ck_assert_int_eq(memcmp(read_data, write_data + CAP / 2 + 2,
+                iov[0].iov_len), 0);
+
+    rbuf_destroy(&buffer);
+#undef CAP
+}
+END_TEST
+
+START_TEST(test_reserve_commit_wrap_around)
+{
+#define CAP 20
+    size_t i;
+    char write_data[CAP], read_data[CAP];
+    struct iovec iov[2];
+    struct rbuf *buffer;
+
+    test_reset();
+
+    for (i = 0; i < CAP; i++) {
+        write_data[i] = i % CHAR_MAX;
+    }
+
+    buffer = rbuf_create(CAP);
+    ck_assert_ptr_ne(buffer, NULL);
+    ck_assert_int_eq(rbuf_reserve(buffer, CAP + 1, iov), 0);
+
+    /* move the offsets towards the end */
+    ck_assert_int_eq(rbuf_write(buffer, write_data, CAP / 2), CAP / 2);
+    ck_assert_int_eq(rbuf_read(read_data, buffer, CAP / 2), CAP / 2);
+
+    /* reserving does not publish anything */
+    ck_assert_int_eq(rbuf_reserve(buffer, CAP, iov), 2);
+    ck_assert_int_eq(iov[0].iov_len + iov[1].iov_len, CAP);
+    ck_assert_int_eq(rbuf_rcap(buffer), 0);
+    memcpy(iov[0].iov_base, write_data, iov[0].iov_len);
+    memcpy(iov[1].iov_base, write_data + iov[0].iov_len, iov[1].iov_len);
+
+    /* commit less than reserved */
+    rbuf_commit(buffer, CAP - 1);
+    ck_assert_int_eq(rbuf_rcap(buffer), CAP - 1);
+    ck_assert_int_eq(rbuf_wcap(buffer), 1);
+    ck_assert_int_eq(rbuf_read(read_data, buffer, CAP), CAP - 1);
+    ck_assert_int_eq(memcmp(read_data, write_data, CAP - 1), 0);
+
+    /* contiguous */
+    ck_assert_int_eq(rbuf_reserve(buffer, 4, iov), 1);
+    ck_assert_int_eq(iov[0].iov_len, 4);
+
+    rbuf_destroy(&buffer);
+#undef CAP
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -140,6 +232,8 @@ rbuf_suite(void)
 
     tcase_add_test(tc_rbuf, test_create_write_read_destroy);
     tcase_add_test(tc_rbuf, test_create_write_read_wrap_around_destroy);
+    tcase_add_test(tc_rbuf, test_peek_consume_wrap_around);
+    tcase_add_test(tc_rbuf, test_reserve_commit_wrap_around);
 
     return s;
 }
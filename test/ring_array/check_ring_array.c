@@ -3,6 +3,7 @@
 #include <check.h>
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -156,6 +157,116 @@ START_TEST(test_flush)
 }
 END_TEST
 
+START_TEST(test_push_pop_n)
+{
+#define ELEM_SIZE sizeof(uint32_t)
+#define CAP 10
+    struct ring_array *arr;
+    uint32_t in[2 * CAP], out[2 * CAP], i;
+
+    for (i = 0; i < 2 * CAP; i++) {
+        in[i] = i;
+    }
+
+    arr = ring_array_create(ELEM_SIZE, CAP);
+    ck_assert_int_eq(ring_array_push_n(in, 2 * CAP, arr), CAP);
+    ck_assert(ring_array_full(arr));
+    ck_assert_int_eq(ring_array_pop_n(out, CAP / 2, arr), CAP / 2);
+    for (i = 0; i < CAP / 2; i++) {
+        ck_assert_int_eq(out[i], i);
+    }
+    /* wrap around the end of the array */
+    ck_assert_int_eq(ring_array_push_n(in + CAP, CAP, arr), CAP / 2);
+    ck_assert_int_eq(ring_array_pop_n(out, 2 * CAP, arr), CAP);
+    for (i = 0; i < CAP; i++) {
+        ck_assert_int_eq(out[i], CAP / 2 + i);
+    }
+    ck_assert(ring_array_empty(arr));
+    ck_assert_int_eq(ring_array_pop_n(NULL, CAP, arr), 0);
+
+    ring_array_destroy(&arr);
+#undef ELEM_SIZE
+#undef CAP
+}
+END_TEST
+
+START_TEST(test_mpmc_push_pop)
+{
+#define ELEM_SIZE sizeof(uint8_t)
+#define CAP 10
+    struct ring_array *arr;
+    uint8_t i, j;
+
+    ck_assert_ptr_eq(ring_array_create_mpmc(ELEM_SIZE, 0), NULL);
+
+    arr = ring_array_create_mpmc(ELEM_SIZE, CAP);
+    ck_assert_ptr_ne(arr, NULL);
+    ck_assert(ring_array_empty(arr));
+    ck_assert_int_eq(ring_array_pop(&j, arr), CC_ERROR);
+
+    for (i = 0; i < CAP; i++) {
+        ck_assert_int_eq(ring_array_push(&i, arr), CC_OK);
+    }
+    ck_assert(ring_array_full(arr));
+    ck_assert_int_eq(ring_array_push(&i, arr), CC_ERROR);
+
+    /* go around the array a few times */
+    for (i = CAP; i < 5 * CAP; i++) {
+        ck_assert_int_eq(ring_array_pop(&j, arr), CC_OK);
+        ck_assert_int_eq(CAP + j, i);
+        ck_assert_int_eq(ring_array_push(&i, arr), CC_OK);
+    }
+
+    ring_array_flush(arr);
+    ck_assert(ring_array_empty(arr));
+    ck_assert_int_eq(ring_array_push(&i, arr), CC_OK);
+    ck_assert_int_eq(ring_array_pop(&j, arr), CC_OK);
+    ck_assert_int_eq(j, i);
+
+    ring_array_destroy(&arr);
+#undef ELEM_SIZE
+#undef CAP
+}
+END_TEST
+
+START_TEST(test_mpmc_push_pop_n)
+{
+#define ELEM_SIZE sizeof(uint64_t)
+#define CAP 7
+#define BATCH 3
+    struct ring_array *arr;
+    uint64_t in[CAP + BATCH], out[CAP + BATCH], next_in = 0, next_out = 0;
+    uint32_t i, n, round;
+
+    arr = ring_array_create_mpmc(ELEM_SIZE, CAP);
+    ck_assert_int_eq(ring_array_push_n(in, 0, arr), 0);
+
+    for (round = 0; round < 100; round++) {
+        for (i = 0; i < CAP + BATCH; i++) {
+            in[i] = next_in + i;
+        }
+        n = ring_array_push_n(in, CAP + BATCH, arr);
+        ck_assert_int_le(n, CAP);
+        next_in += n;
+        ck_assert(ring_array_full(arr));
+
+        n = ring_array_pop_n(out, BATCH + round % BATCH, arr);
+        ck_assert_int_eq(n, BATCH + round % BATCH);
+        for (i = 0; i < n; i++) {
+            ck_assert_int_eq(out[i], next_out++);
+        }
+    }
+    n = ring_array_pop_n(out, CAP + BATCH, arr);
+    ck_assert_int_eq(next_out + n, next_in);
+    ck_assert(ring_array_empty(arr));
+
+    ring_array_destroy(&arr);
+#undef ELEM_SIZE
+#undef CAP
+#undef BATCH
+}
+END_TEST
+
 /*
  * Threading test
  */
@@ -214,6 +325,175 @@ START_TEST(test_thread)
 }
 END_TEST
 
+#define BATCH 16
+static void *
+test_produce_n(void *arg)
+{
+    uint32_t i, j, n = ((struct test_ring_array_arg *)arg)->n;
+    struct ring_array *arr = ((struct test_ring_array_arg *)arg)->arr;
+    uint32_t val[BATCH];
+
+    for (i = 0; i < n;) {
+        for (j = 0; j < BATCH; j++) {
+            val[j] = i + j;
+        }
+        j = ring_array_push_n(val, (n - i < BATCH) ? n - i : BATCH, arr);
+        if (j == 0) {
+            sched_yield();
+        }
+        i += j;
+    }
+    return NULL;
+}
+
+START_TEST(test_thread_n)
+{
+#define ELEM_SIZE sizeof(uint32_t)
+#define CAP 100
+#define NUM_REPS 50000
+    struct ring_array *arr = NULL;
+    pthread_t producer;
+    struct test_ring_array_arg arg;
+    uint32_t i, j, n, val[BATCH];
+
+    arr = ring_array_create(ELEM_SIZE, CAP);
+    ck_assert_ptr_ne(arr, NULL);
+    /* producer and consumer positions live on separate cache lines */
+    ck_assert_uint_ge(offsetof(struct ring_array, wpos) -
+            offsetof(struct ring_array, rpos), CC_CACHELINE_SIZE);
+
+    arg.n = NUM_REPS;
+    arg.arr = arr;
+    ck_assert_int_eq(pthread_create(&producer, NULL, &test_produce_n, &arg), 0);
+
+    /* parent is consumer thread, uses odd batch sizes to hit wraparound */
+    for (i = 0; i < NUM_REPS;) {
+        n = ring_array_pop_n(val, BATCH - i % 3, arr);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (j = 0; j < n; j++) {
+            ck_assert_int_eq(val[j], i++);
+        }
+    }
+    ck_assert_int_eq(pthread_join(producer, NULL), 0);
+    ck_assert(ring_array_empty(arr));
+
+    ring_array_destroy(&arr);
+#undef ELEM_SIZE
+#undef CAP
+#undef NUM_REPS
+}
+END_TEST
+#undef BATCH
+
+#define NTHREAD 4
+#define NUM_REPS 5000
+#define BATCH 8
+struct test_mpmc_arg {
+    uint32_t id;
+    struct ring_array *arr;
+    uint32_t *npop;
+    uint8_t *seen;
+};
+
+static void *
+test_mpmc_produce(void *arg)
+{
+    struct test_mpmc_arg *targ = arg;
+    uint32_t i, n, val[BATCH];
+
+    for (i = 0; i < NUM_REPS;) {
+        /* alternate between single and batched pushes */
+        if (i % 2 == 0) {
+            val[0] = targ->id * NUM_REPS + i;
+            if (ring_array_push(val, targ->arr) == CC_OK) {
+                ++i;
+            } else {
+                sched_yield();
+            }
+        } else {
+            for (n = 0; n < BATCH && i + n < NUM_REPS; n++) {
+                val[n] = targ->id * NUM_REPS + i + n;
+            }
+            n = ring_array_push_n(val, n, targ->arr);
+            if (n == 0) {
+                sched_yield();
+            }
+            i += n;
+        }
+    }
+
+    return NULL;
+}
+
+static void *
+test_mpmc_consume(void *arg)
+{
+    struct test_mpmc_arg *targ = arg;
+    uint32_t i, n, val[BATCH];
+
+    while (__atomic_load_n(targ->npop, __ATOMIC_RELAXED) < NTHREAD * NUM_REPS) {
+        n = ring_array_pop_n(val, BATCH, targ->arr);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (i = 0; i < n; i++) {
+            __atomic_add_fetch(&targ->seen[val[i]], 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(targ->npop, n, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_mpmc_thread)
+{
+#define ELEM_SIZE sizeof(uint32_t)
+#define CAP 100
+    struct ring_array *arr;
+    pthread_t producer[NTHREAD], consumer[NTHREAD];
+    struct test_mpmc_arg arg[NTHREAD];
+    uint8_t *seen;
+    uint32_t i, npop = 0;
+
+    arr = ring_array_create_mpmc(ELEM_SIZE, CAP);
+    ck_assert_ptr_ne(arr, NULL);
+    seen = calloc(NTHREAD * NUM_REPS, sizeof(uint8_t));
+    ck_assert_ptr_ne(seen, NULL);
+
+    for (i = 0; i < NTHREAD; i++) {
+        arg[i].id = i;
+        arg[i].arr = arr;
+        arg[i].npop = &npop;
+        arg[i].seen = seen;
+        ck_assert_int_eq(pthread_create(&producer[i], NULL, &test_mpmc_produce,
+                    &arg[i]), 0);
+        ck_assert_int_eq(pthread_create(&consumer[i], NULL, &test_mpmc_consume,
+                    &arg[i]), 0);
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_join(producer[i], NULL), 0);
+        ck_assert_int_eq(pthread_join(consumer[i], NULL), 0);
+    }
+
+    /* every element is delivered exactly once */
+    ck_assert_int_eq(npop, NTHREAD * NUM_REPS);
+    for (i = 0; i < NTHREAD * NUM_REPS; i++) {
+        ck_assert_int_eq(seen[i], 1);
+    }
+    ck_assert(ring_array_empty(arr));
+
+    free(seen);
+    ring_array_destroy(&arr);
+#undef ELEM_SIZE
+#undef CAP
+}
+END_TEST
+#undef NTHREAD
+#undef NUM_REPS
+#undef BATCH
+
 /*
  * test suite
  */
@@ -232,7 +512,12 @@ ring_array_suite(void)
     tcase_add_test(tc_ring_array, test_push_full);
     tcase_add_test(tc_ring_array, test_push_pop_many);
     tcase_add_test(tc_ring_array, test_flush);
+    tcase_add_test(tc_ring_array, test_push_pop_n);
+    tcase_add_test(tc_ring_array, test_mpmc_push_pop);
+    tcase_add_test(tc_ring_array, test_mpmc_push_pop_n);
     tcase_add_test(tc_ring_array, test_thread);
+    tcase_add_test(tc_ring_array, test_thread_n);
+    tcase_add_test(tc_ring_array, test_mpmc_thread);
 
     return s;
 }
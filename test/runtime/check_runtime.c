@@ -0,0 +1,339 @@
+#include <cc_runtime.h>
+
+#include <check.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SUITE_NAME "runtime"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define NWORKER 4
+#define NTASK   400
+
+static runtime_metrics_st metrics;
+static uint32_t nrun;
+static uint32_t nstart, nstop, nfire;
+static uint32_t handoff_id, event_id;
+static bool off_worker;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (runtime_metrics_st) { RUNTIME_METRIC(METRIC_INIT) };
+    runtime_setup(NULL, &metrics);
+    nrun = nstart = nstop = nfire = 0;
+    handoff_id = event_id = UINT32_MAX;
+    off_worker = false;
+}
+
+static void
+test_teardown(void)
+{
+    runtime_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* wait up to 5 seconds for *n to become val */
+static void
+_await(uint32_t *n, uint32_t val)
+{
+    int i;
+
+    for (i = 0; i < 5000 && __atomic_load_n(n, __ATOMIC_ACQUIRE) != val; i++) {
+        usleep(1000);
+    }
+    ck_assert_uint_eq(__atomic_load_n(n, __ATOMIC_ACQUIRE), val);
+}
+
+/* a CPU heavy task, about 200us */
+static void
+_task(void *arg)
+{
+    struct duration d;
+
+    (void)arg;
+
+    if (runtime_worker_self() == NULL) {
+        off_worker = true;
+    }
+    duration_start(&d);
+    do {
+        duration_stop(&d);
+    } while (duration_us(&d) < 200);
+    __atomic_add_fetch(&nrun, 1, __ATOMIC_RELEASE);
+}
+
+static void
+_fire(void *arg)
+{
+    (void)arg;
+
+    __atomic_add_fetch(&nfire, 1, __ATOMIC_RELEASE);
+}
+
+static void
+_start(struct runtime_worker *w)
+{
+    struct timeout delay;
+
+    ck_assert_ptr_eq(runtime_worker_self(), w);
+    timeout_set_ms(&delay, 1);
+    ck_assert_ptr_ne(timing_wheel_insert(w->tw, &delay, false, _fire, NULL),
+            NULL);
+    __atomic_add_fetch(&nstart, 1, __ATOMIC_RELEASE);
+}
+
+static void
+_stop(struct runtime_worker *w)
+{
+    ck_assert_ptr_eq(runtime_worker_self(), w);
+    __atomic_add_fetch(&nstop, 1, __ATOMIC_RELEASE);
+}
+
+static void
+_start_pinned(struct runtime_worker *w)
+{
+    ck_assert_int_eq(w->cpu, cpu_get(w->id % cpu_count())->cpu);
+    ck_assert_int_eq(cpu_current(), w->cpu);
+    ck_assert_int_eq(w->node, cpu_node(w->cpu));
+    __atomic_add_fetch(&nstart, 1, __ATOMIC_RELEASE);
+}
+
+static void
+_handoff(struct runtime_worker *w, void *ptr)
+{
+    int fd = (int)(intptr_t)ptr;
+
+    __atomic_store_n(&handoff_id, w->id, __ATOMIC_RELEASE);
+    ck_assert_int_eq(event_add_read(w->evb, fd, ptr), 0);
+}
+
+static void
+_event(void *data, uint32_t events)
+{
+    char buf[8];
+
+    ck_assert(events & EVENT_READ);
+    ck_assert_int_gt(read((int)(intptr_t)data, buf, sizeof(buf)), 0);
+    __atomic_store_n(&event_id, runtime_worker_self()->id, __ATOMIC_RELEASE);
+}
+
+/*
+ * tests
+ */
+START_TEST(test_create_destroy)
+{
+    struct runtime *rt;
+    uint32_t i;
+
+    test_reset();
+
+    rt = runtime_create(0, NULL, NULL);
+    ck_assert_ptr_ne(rt, NULL);
+    ck_assert_int_eq(rt->nworker, RUNTIME_NWORKER);
+    for (i = 0; i < rt->nworker; i++) {
+        ck_assert_int_eq(rt->worker[i].id, i);
+        ck_assert_ptr_ne(rt->worker[i].evb, NULL);
+        ck_assert_ptr_ne(rt->worker[i].tw, NULL);
+    }
+    ck_assert_ptr_eq(runtime_worker_self(), NULL);
+
+    /* queued before start is fine, and dropped if never run */
+    ck_assert_int_eq(runtime_submit(rt, RUNTIME_ANY, _task, NULL), CC_OK);
+    runtime_destroy(&rt);
+    ck_assert_ptr_eq(rt, NULL);
+    ck_assert_uint_eq(nrun, 0);
+}
+END_TEST
+
+START_TEST(test_hooks)
+{
+    struct runtime *rt;
+
+    test_reset();
+
+    rt = runtime_create(NWORKER, NULL, NULL);
+    runtime_set_hooks(rt, _start, _stop);
+    ck_assert_int_eq(runtime_start(rt), CC_OK);
+    _await(&nstart, NWORKER);
+    ck_assert_int_eq(metrics.runtime_worker.gauge, NWORKER);
+
+    /* each worker turns its own wheel */
+    _await(&nfire, NWORKER);
+
+    runtime_stop(rt);
+    ck_assert_uint_eq(nstop, NWORKER);
+    ck_assert_int_eq(metrics.runtime_worker.gauge, 0);
+
+    /* and can be started again */
+    ck_assert_int_eq(runtime_start(rt), CC_OK);
+    _await(&nstart, 2 * NWORKER);
+    runtime_destroy(&rt);
+    ck_assert_uint_eq(nstop, 2 * NWORKER);
+}
+END_TEST
+
+START_TEST(test_submit_steal)
+{
+    struct runtime *rt;
+    int i;
+
+    test_reset();
+
+    rt = runtime_create(NWORKER, NULL, NULL);
+    ck_assert_int_eq(runtime_start(rt), CC_OK);
+
+    /* everything goes to worker 0, the others come and take some */
+    for (i = 0; i < NTASK; i++) {
+        ck_assert_int_eq(runtime_submit(rt, 0, _task, NULL), CC_OK);
+    }
+    _await(&nrun, NTASK);
+    ck_assert(!off_worker);
+
+    runtime_destroy(&rt);
+    test_teardown();
+    ck_assert_uint_eq(metrics.runtime_task.counter, NTASK);
+    ck_assert_uint_eq(metrics.runtime_task_run.counter, NTASK);
+    ck_assert_uint_gt(metrics.runtime_task_steal.counter, 0);
+    ck_assert_uint_eq(metrics.runtime_task_ex.counter, 0);
+    test_setup();
+}
+END_TEST
+
+START_TEST(test_queue_full)
+{
+    runtime_options_st options = { RUNTIME_OPTION(OPTION_INIT) };
+    struct runtime *rt;
+    int i;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(runtime_options_st));
+    options.runtime_queue.val.vuint = 4;
+
+    test_teardown();
+    runtime_setup(&options, &metrics);
+
+    /* nobody is running, so the queues fill up */
+    rt = runtime_create(1, NULL, NULL);
+    for (i = 0; i < 4; i++) {
+        ck_assert_int_eq(runtime_submit(rt, 0, _task, NULL), CC_OK);
+        ck_assert_int_eq(runtime_handoff(rt, 0, NULL), CC_OK);
+    }
+    ck_assert_int_eq(runtime_submit(rt, 0, _task, NULL), CC_ENOMEM);
+    ck_assert_int_eq(runtime_handoff(rt, 0, NULL), CC_ENOMEM);
+    runtime_destroy(&rt);
+
+    test_teardown();
+    ck_assert_uint_eq(metrics.runtime_task_ex.counter, 1);
+    ck_assert_uint_eq(metrics.runtime_handoff_ex.counter, 1);
+    test_setup();
+}
+END_TEST
+
+START_TEST(test_pin)
+{
+    runtime_options_st options = { RUNTIME_OPTION(OPTION_INIT) };
+    struct runtime *rt;
+    uint32_t i;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(runtime_options_st));
+    options.runtime_pin.val.vbool = true;
+
+    test_teardown();
+    runtime_setup(&options, &metrics);
+    cpu_setup();
+
+    rt = runtime_create(NWORKER, NULL, NULL);
+    for (i = 0; i < NWORKER; i++) {
+        ck_assert_int_eq(rt->worker[i].cpu, CPU_UNKNOWN);
+    }
+    runtime_set_hooks(rt, _start_pinned, NULL);
+    ck_assert_int_eq(runtime_start(rt), CC_OK);
+    _await(&nstart, NWORKER);
+    runtime_destroy(&rt);
+
+    cpu_teardown();
+    test_reset();
+}
+END_TEST
+
+START_TEST(test_handoff)
+{
+#define DATA "foo"
+    struct runtime *rt;
+    int sv[2];
+
+    test_reset();
+
+    rt = runtime_create(NWORKER, _event, _handoff);
+    ck_assert_int_eq(runtime_start(rt), CC_OK);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    /* the worker that gets the fd serves its events */
+    ck_assert_int_eq(runtime_handoff(rt, 2, (void *)(intptr_t)sv[0]), CC_OK);
+    _await(&handoff_id, 2);
+    ck_assert_int_eq(write(sv[1], DATA, sizeof(DATA)), sizeof(DATA));
+    _await(&event_id, 2);
+
+    runtime_destroy(&rt);
+    close(sv[0]);
+    close(sv[1]);
+#undef DATA
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+runtime_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_runtime = tcase_create("runtime test");
+    suite_add_tcase(s, tc_runtime);
+
+    tcase_add_test(tc_runtime, test_create_destroy);
+    tcase_add_test(tc_runtime, test_hooks);
+    tcase_add_test(tc_runtime, test_submit_steal);
+    tcase_add_test(tc_runtime, test_queue_full);
+    tcase_add_test(tc_runtime, test_pin);
+    tcase_add_test(tc_runtime, test_handoff);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = runtime_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,170 @@
+#include <cc_event.h>
+#include <cc_signal.h>
+
+#include <check.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUITE_NAME "signal"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+static int nusr1;
+static int nusr2;
+static int nevent;
+static int nhandled;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    nusr1 = 0;
+    nusr2 = 0;
+    nevent = 0;
+    nhandled = 0;
+}
+
+static void
+test_teardown(void)
+{
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+static void
+_usr1(int signo)
+{
+    ck_assert_int_eq(signo, SIGUSR1);
+    nusr1++;
+}
+
+static void
+_usr2(int signo)
+{
+    ck_assert_int_eq(signo, SIGUSR2);
+    nusr2++;
+}
+
+static void
+_event(void *arg, uint32_t events)
+{
+    int fd = *(int *)arg;
+
+    ck_assert(events & EVENT_READ);
+    nevent++;
+    nhandled += signal_fd_handle(fd);
+}
+
+/*
+ * tests
+ */
+START_TEST(test_fd_event)
+{
+    struct event_base *evb;
+    uint32_t mask = (1U << SIGUSR1) | (1U << SIGUSR2);
+    int fd;
+
+    test_reset();
+
+    ck_assert_int_eq(signal_override(SIGUSR1, "test", 0, 0, _usr1), 0);
+    ck_assert_int_eq(signal_override(SIGUSR2, "test", 0, 0, _usr2), 0);
+    fd = signal_fd_open(mask);
+    ck_assert_int_ge(fd, 0);
+
+    /* nothing runs until the loop gets to it */
+    raise(SIGUSR1);
+    raise(SIGUSR2);
+    ck_assert_int_eq(nusr1, 0);
+    ck_assert_int_eq(nusr2, 0);
+
+    evb = event_base_create(8, _event);
+    ck_assert_ptr_ne(evb, NULL);
+    ck_assert_int_eq(event_add_read(evb, fd, &fd), 0);
+    ck_assert_int_eq(event_wait(evb, 1000), 1);
+    ck_assert_int_eq(nevent, 1);
+    ck_assert_int_eq(nhandled, 2);
+    ck_assert_int_eq(nusr1, 1);
+    ck_assert_int_eq(nusr2, 1);
+
+    /* drained */
+    ck_assert_int_eq(event_wait(evb, 0), 0);
+    ck_assert_int_eq(signal_fd_handle(fd), 0);
+
+    raise(SIGUSR1);
+    ck_assert_int_eq(event_wait(evb, 1000), 1);
+    ck_assert_int_eq(nusr1, 2);
+
+    event_del(evb, fd);
+    event_base_destroy(&evb);
+    signal_fd_close(fd, mask);
+
+    /* handlers run asynchronously again */
+    raise(SIGUSR1);
+    ck_assert_int_eq(nusr1, 3);
+}
+END_TEST
+
+START_TEST(test_no_handler)
+{
+    uint32_t mask = 1U << SIGUSR1;
+    int fd;
+
+    test_reset();
+
+    /* signals without a handler are consumed and ignored */
+    ck_assert_int_eq(signal_override(SIGUSR1, "test", 0, 0, SIG_IGN), 0);
+    fd = signal_fd_open(mask);
+    ck_assert_int_ge(fd, 0);
+    raise(SIGUSR1);
+    ck_assert_int_eq(signal_fd_handle(fd), 1);
+    ck_assert_int_eq(nusr1, 0);
+    signal_fd_close(fd, mask);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+signal_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_signal = tcase_create("signal test");
+    suite_add_tcase(s, tc_signal);
+
+    tcase_add_test(tc_signal, test_fd_event);
+    tcase_add_test(tc_signal, test_no_handler);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = signal_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,172 @@
+#include <cc_slab.h>
+
+#include <check.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "slab"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define TEST_OBJ_SIZE    40
+#define TEST_REGION_SIZE 4096
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+}
+
+static void
+test_teardown(void)
+{
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/*
+ * tests
+ */
+START_TEST(test_create_destroy)
+{
+    struct slab *slab;
+
+    test_reset();
+
+    slab = slab_create(TEST_OBJ_SIZE, 0, 0);
+    ck_assert_ptr_ne(slab, NULL);
+    ck_assert_int_eq(slab->obj_size, CC_ALIGN(TEST_OBJ_SIZE, SLAB_ALIGN));
+    ck_assert_int_eq(slab->region_size, SLAB_REGION_SIZE);
+    ck_assert_int_eq(slab->nregion, 0);
+    slab_destroy(&slab);
+    ck_assert_ptr_eq(slab, NULL);
+
+    /* region too small for a single object */
+    ck_assert_ptr_eq(slab_create(TEST_REGION_SIZE, TEST_REGION_SIZE, 0), NULL);
+}
+END_TEST
+
+START_TEST(test_alloc_free)
+{
+    struct slab *slab;
+    char **obj;
+    uint32_t i, n;
+
+    test_reset();
+
+    slab = slab_create(TEST_OBJ_SIZE, TEST_REGION_SIZE, 0);
+    ck_assert_ptr_ne(slab, NULL);
+    n = 3 * slab->nobj + 1;
+    obj = malloc(n * sizeof(char *));
+
+    /* objects are aligned, distinct, and the slab grows a region at a time */
+    for (i = 0; i < n; i++) {
+        obj[i] = slab_alloc(slab);
+        ck_assert_ptr_ne(obj[i], NULL);
+        ck_assert_int_eq((uintptr_t)obj[i] % SLAB_ALIGN, 0);
+        memset(obj[i], i, TEST_OBJ_SIZE);
+    }
+    ck_assert_int_eq(slab->nregion, 4);
+    ck_assert_int_eq(slab->nused, n);
+    for (i = 0; i < n; i++) {
+        ck_assert_int_eq(obj[i][TEST_OBJ_SIZE - 1], (char)i);
+    }
+
+    /* freed objects are reused before the slab grows */
+    slab_free(slab, obj[5]);
+    slab_free(slab, obj[7]);
+    ck_assert_int_eq(slab->nused, n - 2);
+    ck_assert_ptr_eq(slab_alloc(slab), obj[7]);
+    ck_assert_ptr_eq(slab_alloc(slab), obj[5]);
+    ck_assert_int_eq(slab->nregion, 4);
+    ck_assert(slab_owns(slab, obj[0]));
+    ck_assert(slab_owns(slab, obj[n - 1]));
+    ck_assert(!slab_owns(slab, obj));
+
+    for (i = 0; i < n; i++) {
+        slab_free(slab, obj[i]);
+    }
+    ck_assert_int_eq(slab->nused, 0);
+
+    free(obj);
+    slab_destroy(&slab);
+}
+END_TEST
+
+START_TEST(test_reserve_max)
+{
+    struct slab *slab;
+    void *obj[3];
+    uint32_t nobj;
+
+    test_reset();
+
+    slab = slab_create(TEST_OBJ_SIZE, TEST_REGION_SIZE, 2);
+    ck_assert_ptr_ne(slab, NULL);
+    nobj = slab->nobj;
+
+    ck_assert_int_eq(slab_reserve(slab, nobj + 1), CC_OK);
+    ck_assert_int_eq(slab->nregion, 2);
+    ck_assert_int_eq(slab_reserve(slab, nobj + 1), CC_OK);
+    ck_assert_int_eq(slab->nregion, 2);
+
+    /* nmax caps the number of objects handed out */
+    obj[0] = slab_alloc(slab);
+    obj[1] = slab_alloc(slab);
+    obj[2] = slab_alloc(slab);
+    ck_assert_ptr_ne(obj[0], NULL);
+    ck_assert_ptr_ne(obj[1], NULL);
+    ck_assert_ptr_eq(obj[2], NULL);
+    slab_free(slab, obj[0]);
+    ck_assert_ptr_eq(slab_alloc(slab), obj[0]);
+
+    slab_destroy(&slab);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+slab_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_slab = tcase_create("slab test");
+    suite_add_tcase(s, tc_slab);
+
+    tcase_add_test(tc_slab, test_create_destroy);
+    tcase_add_test(tc_slab, test_alloc_free);
+    tcase_add_test(tc_slab, test_reserve_max);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = slab_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,750 @@
+#include <stream/cc_frame.h>
+#include <stream/cc_sockio.h>
+
+#include <buffer/cc_buf.h>
+#include <buffer/cc_dbuf.h>
+#include <cc_slab.h>
+#include <channel/cc_pipe.h>
+#include <channel/cc_tcp.h>
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define SUITE_NAME "sockio"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define TEST_BUF_CAP    64
+#define TEST_BUF_SIZE   (TEST_BUF_CAP + BUF_HDR_SIZE)
+
+static buf_metrics_st bmetrics;
+static buf_options_st boptions;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    bmetrics = (buf_metrics_st) { BUF_METRIC(METRIC_INIT) };
+    boptions = (buf_options_st) { BUF_OPTION(OPTION_INIT) };
+    option_load_default((struct option *)&boptions,
+            OPTION_CARDINALITY(buf_options_st));
+    boptions.buf_init_size.val.vuint = TEST_BUF_SIZE;
+
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(NULL, NULL);
+    tcp_setup(NULL, NULL);
+    pipe_setup(NULL, NULL);
+    sockio_setup(NULL, NULL);
+}
+
+static void
+test_teardown(void)
+{
+    sockio_teardown();
+    pipe_teardown();
+    tcp_teardown();
+    dbuf_teardown();
+    buf_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* a buf_sock whose conn is one end of a socketpair, the other end in *sd */
+static struct buf_sock *
+buf_sock_pair(int *sd)
+{
+    struct buf_sock *s;
+    int sv[2];
+
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    ck_assert_int_eq(tcp_set_nonblocking(sv[0]), 0);
+
+    s = buf_sock_borrow();
+    ck_assert_ptr_ne(s, NULL);
+    s->ch->sd = sv[0];
+    s->hdl = NULL;
+    *sd = sv[1];
+
+    return s;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_write_writev)
+{
+#define LEN (4 * TEST_BUF_CAP + 7)
+    struct buf_sock *s;
+    char src[LEN], dst[LEN + 1];
+    ssize_t n, nread = 0;
+    int sd, i;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+
+    s = buf_sock_pair(&sd);
+    ck_assert_int_eq(buf_tcp_writev(s), CC_EEMPTY);
+
+    /* wbuf fills up to its capacity, the rest goes to wchain */
+    ck_assert_int_eq(buf_sock_write(s, src, LEN), LEN);
+    ck_assert_int_eq(buf_rsize(s->wbuf), TEST_BUF_CAP);
+    ck_assert_int_eq(buf_chain_rsize(&s->wchain), LEN - TEST_BUF_CAP);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 4);
+
+    ck_assert_int_eq(buf_tcp_writev(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->wbuf), 0);
+    ck_assert(STAILQ_EMPTY(&s->wchain));
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    while (nread < LEN) {
+        n = read(sd, dst + nread, LEN + 1 - nread);
+        ck_assert_int_gt(n, 0);
+        nread += n;
+    }
+    ck_assert_int_eq(nread, LEN);
+    ck_assert_int_eq(memcmp(src, dst, LEN), 0);
+
+    /* writev does not reset wbuf, so new data lands in wchain again */
+    ck_assert_int_eq(buf_sock_write(s, src, LEN), LEN);
+    ck_assert_int_eq(buf_chain_rsize(&s->wchain), LEN);
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    close(sd);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_writev_partial)
+{
+#define LEN (64 * TEST_BUF_CAP)
+    struct buf_sock *s;
+    char src[LEN], dst[LEN];
+    ssize_t n, nread = 0;
+    rstatus_i status;
+    int sd, i, sndbuf = 4096;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+
+    s = buf_sock_pair(&sd);
+    ck_assert_int_eq(setsockopt(s->ch->sd, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+                sizeof(sndbuf)), 0);
+
+    ck_assert_int_eq(buf_sock_write(s, src, LEN), LEN);
+
+    /* interleave partial writes and reads until everything is through */
+    do {
+        status = buf_tcp_writev(s);
+        ck_assert(status == CC_OK || status == CC_ERETRY ||
+                status == CC_EAGAIN);
+        n = read(sd, dst + nread, LEN - nread);
+        if (n > 0) {
+            nread += n;
+        }
+    } while (status != CC_OK);
+    while (nread < LEN) {
+        n = read(sd, dst + nread, LEN - nread);
+        ck_assert_int_gt(n, 0);
+        nread += n;
+    }
+    ck_assert_int_eq(memcmp(src, dst, LEN), 0);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    close(sd);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_readv_coalesce)
+{
+#define LEN (BUFSOCK_READV_NBUF * TEST_BUF_CAP + TEST_BUF_CAP / 2)
+    struct buf_sock *s;
+    struct buf *buf;
+    char src[LEN];
+    uint32_t nread;
+    uint64_t nborrow, nreturn;
+    int sd, i;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+
+    s = buf_sock_pair(&sd);
+    nborrow = bmetrics.buf_borrow.counter;
+    nreturn = bmetrics.buf_return.counter;
+
+    /* a read that fits in rbuf borrows nothing */
+    ck_assert_int_eq(write(sd, src, 10), 10);
+    ck_assert_int_eq(buf_tcp_readv(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), 10);
+    ck_assert_uint_eq(bmetrics.buf_borrow.counter, nborrow);
+
+    ck_assert_int_eq(write(sd, src + 10, LEN - 10), LEN - 10);
+
+    /* more than one readv worth of data, all of it ends up in the chain */
+    ck_assert_int_eq(buf_tcp_readv(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), TEST_BUF_CAP);
+    ck_assert_int_eq(buf_chain_rsize(&s->rchain), LEN - TEST_BUF_CAP);
+    /* only the bufs the data needs were borrowed */
+    ck_assert_uint_eq(bmetrics.buf_borrow.counter - nborrow,
+            (LEN - 1) / TEST_BUF_CAP);
+    ck_assert_uint_eq(bmetrics.buf_return.counter, nreturn);
+    nread = buf_rsize(s->rbuf);
+    ck_assert_int_eq(memcmp(s->rbuf->rpos, src, nread), 0);
+    STAILQ_FOREACH(buf, &s->rchain, next) {
+        ck_assert_int_eq(memcmp(buf->rpos, src + nread, buf_rsize(buf)), 0);
+        nread += buf_rsize(buf);
+    }
+    ck_assert_int_eq(nread, LEN);
+
+    /* a span that fits in rbuf after shifting out consumed bytes */
+    s->rbuf->rpos += 20;
+    ck_assert_int_eq(buf_sock_coalesce(s, TEST_BUF_CAP), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), TEST_BUF_CAP);
+    ck_assert_int_eq(memcmp(s->rbuf->rpos, src + 20, TEST_BUF_CAP), 0);
+
+    /* a larger span grows rbuf */
+    ck_assert_int_eq(buf_sock_coalesce(s, 3 * TEST_BUF_CAP), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), 3 * TEST_BUF_CAP);
+    ck_assert_int_eq(memcmp(s->rbuf->rpos, src + 20, 3 * TEST_BUF_CAP), 0);
+    ck_assert_int_eq(buf_chain_rsize(&s->rchain), LEN - 20 - 3 * TEST_BUF_CAP);
+
+    close(sd);
+    ck_assert_int_eq(buf_tcp_readv(s), CC_ERDHUP);
+
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_lazy)
+{
+#define MSG "hello"
+    sockio_options_st options = { SOCKIO_OPTION(OPTION_INIT) };
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+    channel_handler_st hdl = { .recv = (channel_recv_fn)tcp_recv,
+        .send = (channel_send_fn)tcp_send };
+    struct buf_sock *s;
+    char dst[sizeof(MSG)];
+    int sd;
+
+    test_reset();
+    sockio_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(sockio_options_st));
+    options.buf_sock_lazy.val.vbool = true;
+    sockio_setup(&options, &metrics);
+
+    s = buf_sock_pair(&sd);
+    s->hdl = &hdl;
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    ck_assert_ptr_eq(s->wbuf, NULL);
+
+    /* nothing to read or write, nothing attached */
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    ck_assert_int_eq(buf_tcp_write(s), CC_EEMPTY);
+    ck_assert_int_eq(metrics.buf_sock_attached.gauge, 0);
+
+    /* rbuf stays while it holds data, goes once it is consumed */
+    ck_assert_int_eq(write(sd, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    ck_assert_ptr_ne(s->rbuf, NULL);
+    ck_assert_int_eq(buf_rsize(s->rbuf), sizeof(MSG));
+    ck_assert_int_eq(metrics.buf_sock_attached.gauge, 1);
+    s->rbuf->rpos += sizeof(MSG);
+    buf_sock_release(s);
+    ck_assert_ptr_eq(s->rbuf, NULL);
+
+    /* wbuf is attached for the write and detached once flushed */
+    ck_assert_int_eq(buf_sock_write(s, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_ptr_ne(s->wbuf, NULL);
+    ck_assert_int_eq(buf_tcp_write(s), CC_OK);
+    ck_assert_ptr_eq(s->wbuf, NULL);
+    ck_assert_int_eq(read(sd, dst, sizeof(dst)), sizeof(MSG));
+    ck_assert_str_eq(dst, MSG);
+
+    /* including the empty read, which borrowed rbuf for the attempt */
+    ck_assert_int_eq(metrics.buf_sock_attach.counter, 3);
+    ck_assert_int_eq(metrics.buf_sock_detach.counter, 3);
+    ck_assert_int_eq(metrics.buf_sock_attached.gauge, 0);
+
+    /* bufs attached at return time go back to the pool too */
+    ck_assert_ptr_ne(buf_sock_wbuf(s), NULL);
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    ck_assert_int_eq(metrics.buf_sock_attached.gauge, 0);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    close(sd);
+#undef MSG
+}
+END_TEST
+
+static int ncounted;
+
+static ssize_t
+_counted_recv(channel_p c, void *buf, size_t nbyte)
+{
+    ncounted++;
+
+    return tcp_recv(c, buf, nbyte);
+}
+
+static ssize_t
+_counted_send(channel_p c, void *buf, size_t nbyte)
+{
+    ncounted++;
+
+    return tcp_send(c, buf, nbyte);
+}
+
+START_TEST(test_channel)
+{
+#define LEN (3 * TEST_BUF_CAP + 5)
+    channel_handler_st hdl = { .recv = (channel_recv_fn)pipe_recv,
+        .send = (channel_send_fn)pipe_send };
+    channel_handler_st counted = { .recv = _counted_recv,
+        .send = _counted_send };
+    struct buf_sock *s;
+    struct pipe_conn *c;
+    struct buf *buf;
+    char src[LEN], dst[LEN];
+    uint32_t nread = 0;
+    int i, sd;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+
+    /* the same buf_sock writes into a pipe and reads it back */
+    c = pipe_conn_create();
+    ck_assert(pipe_open(NULL, c));
+    pipe_set_nonblocking(c);
+    s = buf_sock_borrow();
+    buf_sock_set_channel(s, c, &hdl);
+
+    ck_assert_int_eq(buf_sock_read(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), 0);
+
+    ck_assert_int_eq(buf_sock_write(s, src, LEN), LEN);
+    ck_assert_int_eq(buf_sock_sendv(s), CC_OK);
+    ck_assert(STAILQ_EMPTY(&s->wchain));
+    ck_assert_int_eq(c->send_nbyte, LEN);
+
+    ck_assert_int_eq(buf_sock_readv(s), CC_OK);
+    ck_assert_int_eq(c->recv_nbyte, LEN);
+    ck_assert_int_eq(memcmp(s->rbuf->rpos, src, buf_rsize(s->rbuf)), 0);
+    nread = buf_rsize(s->rbuf);
+    STAILQ_FOREACH(buf, &s->rchain, next) {
+        ck_assert_int_eq(memcmp(buf->rpos, src + nread, buf_rsize(buf)), 0);
+        nread += buf_rsize(buf);
+    }
+    ck_assert_int_eq(nread, LEN);
+
+    /* the owned tcp_conn is not touched while another channel is driven */
+    ck_assert_int_eq(s->ch->recv_nbyte, 0);
+    ck_assert_int_eq(s->ch->send_nbyte, 0);
+
+    buf_reset(s->rbuf);
+    buf_reset(s->wbuf);
+    ck_assert_int_eq(buf_sock_write(s, src, TEST_BUF_CAP), TEST_BUF_CAP);
+    ck_assert_int_eq(buf_sock_send(s), CC_OK);
+    /* rbuf filled to capacity, more may be there */
+    ck_assert_int_eq(buf_sock_read(s), CC_ERETRY);
+    ck_assert_int_eq(buf_rsize(s->rbuf), TEST_BUF_CAP);
+
+    /* reset goes back to the owned conn */
+    buf_sock_return(&s);
+    s = buf_sock_borrow();
+    ck_assert_ptr_eq(s->chan, NULL);
+    buf_sock_return(&s);
+
+    /* a handler without a channel set does the I/O on the owned conn */
+    s = buf_sock_pair(&sd);
+    s->hdl = &counted;
+    ncounted = 0;
+    ck_assert_int_eq(buf_sock_write(s, src, 5), 5);
+    ck_assert_int_eq(buf_sock_send(s), CC_OK);
+    ck_assert_int_eq(read(sd, dst, sizeof(dst)), 5);
+    ck_assert_int_eq(write(sd, src, 5), 5);
+    ck_assert_int_eq(buf_sock_read(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), 5);
+    ck_assert_int_eq(ncounted, 2);
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    close(sd);
+
+    pipe_close(c);
+    pipe_conn_destroy(&c);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef LEN
+}
+END_TEST
+
+static void
+_count_sock(struct buf_sock *s, void *arg)
+{
+    *(size_t *)arg += buf_sock_memory(s);
+}
+
+START_TEST(test_memory)
+{
+    struct buf_sock *s1, *s2;
+    size_t total = 0, base;
+    int sd;
+
+    test_reset();
+
+    s1 = buf_sock_pair(&sd);
+    s2 = buf_sock_borrow();
+    base = buf_sock_memory(s2);
+    ck_assert_int_eq(base, sizeof(struct buf_sock) + sizeof(struct tcp_conn) +
+            2 * TEST_BUF_SIZE);
+
+    /* chained bufs count too */
+    ck_assert_int_eq(buf_sock_write(s1, "x", 1), 1);
+    s1->wbuf->wpos = s1->wbuf->end;
+    ck_assert_int_eq(buf_sock_write(s1, "x", 1), 1);
+    ck_assert_int_eq(buf_sock_memory(s1), base + TEST_BUF_SIZE);
+
+    buf_sock_foreach(_count_sock, &total);
+    ck_assert_int_eq(total, 2 * base + TEST_BUF_SIZE);
+
+    /* what sits in the pool is not listed */
+    buf_sock_return(&s2);
+    total = 0;
+    buf_sock_foreach(_count_sock, &total);
+    ck_assert_int_eq(total, base + TEST_BUF_SIZE);
+
+    close(s1->ch->sd);
+    buf_sock_return(&s1);
+    close(sd);
+    total = 0;
+    buf_sock_foreach(_count_sock, &total);
+    ck_assert_int_eq(total, 0);
+}
+END_TEST
+
+START_TEST(test_poolslab)
+{
+#define POOLSIZE 4
+    sockio_options_st options = { SOCKIO_OPTION(OPTION_INIT) };
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+    tcp_options_st toptions = { TCP_OPTION(OPTION_INIT) };
+    struct buf_sock *s[POOLSIZE];
+    struct tcp_conn *c[POOLSIZE];
+    uint32_t i;
+
+    test_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(sockio_options_st));
+    option_load_default((struct option *)&toptions,
+            OPTION_CARDINALITY(tcp_options_st));
+    options.buf_sock_poolsize.val.vuint = POOLSIZE;
+    options.buf_sock_poolslab.val.vbool = true;
+    toptions.tcp_poolsize.val.vuint = POOLSIZE;
+    toptions.tcp_poolslab.val.vbool = true;
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(NULL, NULL);
+    tcp_setup(&toptions, NULL);
+    sockio_setup(&options, &metrics);
+    ck_assert_int_eq(metrics.buf_sock_curr.gauge, POOLSIZE);
+
+    /* pooled buf_socks and tcp_conns each sit back to back in a slab */
+    for (i = 0; i < POOLSIZE; i++) {
+        s[i] = buf_sock_borrow();
+        ck_assert_ptr_ne(s[i], NULL);
+        c[i] = tcp_conn_borrow();
+        ck_assert_ptr_ne(c[i], NULL);
+    }
+    for (i = 1; i < POOLSIZE; i++) {
+        ck_assert_uint_eq((char *)s[i - 1] - (char *)s[i],
+                CC_ALIGN(sizeof(struct buf_sock), CC_CACHELINE_SIZE));
+        ck_assert_uint_eq((char *)c[i - 1] - (char *)c[i],
+                CC_ALIGN(sizeof(struct tcp_conn), CC_CACHELINE_SIZE));
+    }
+    ck_assert_ptr_eq(buf_sock_borrow(), NULL);
+    ck_assert_ptr_eq(tcp_conn_borrow(), NULL);
+
+    for (i = 0; i < POOLSIZE; i++) {
+        buf_sock_return(&s[i]);
+        tcp_conn_return(&c[i]);
+    }
+
+    test_teardown();
+    ck_assert_int_eq(metrics.buf_sock_curr.gauge, 0);
+    test_setup();
+#undef POOLSIZE
+}
+END_TEST
+
+static void
+_flush_fail(struct buf_sock *s, rstatus_i status, void *arg)
+{
+    ck_assert(status == CC_EAGAIN || status == CC_ERETRY);
+    ck_assert(!s->dirty);
+    (*(uint32_t *)arg)++;
+}
+
+START_TEST(test_defer_flush)
+{
+#define REQ "pipelined"
+#define LEN (256 * TEST_BUF_CAP) /* more than one sendv takes */
+    sockio_options_st options = { SOCKIO_OPTION(OPTION_INIT) };
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+    struct buf_sock *s1, *s2;
+    char src[LEN], dst[LEN];
+    uint32_t nfail = 0;
+    int sd1, sd2, i, sndbuf = 4096;
+
+    test_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(sockio_options_st));
+    options.buf_sock_defer.val.vbool = true;
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(NULL, NULL);
+    tcp_setup(NULL, NULL);
+    sockio_setup(&options, &metrics);
+
+    s1 = buf_sock_pair(&sd1);
+    s2 = buf_sock_pair(&sd2);
+
+    /* writes only mark the buf_socks dirty */
+    for (i = 0; i < 3; i++) {
+        ck_assert_int_eq(buf_sock_write(s1, REQ, sizeof(REQ)), sizeof(REQ));
+        ck_assert_int_eq(buf_tcp_write(s1), CC_OK);
+    }
+    ck_assert_int_eq(buf_sock_write(s2, REQ, sizeof(REQ)), sizeof(REQ));
+    ck_assert_int_eq(buf_tcp_writev(s2), CC_OK);
+    ck_assert(s1->dirty && s2->dirty);
+    ck_assert_int_eq(recv(sd1, dst, LEN, MSG_DONTWAIT), -1);
+    ck_assert_uint_eq(metrics.buf_sock_defer.counter, 4);
+
+    /* one send each, with everything written so far */
+    ck_assert_uint_eq(buf_sock_flush(_flush_fail, &nfail), 2);
+    ck_assert_uint_eq(nfail, 0);
+    ck_assert(!s1->dirty && !s2->dirty);
+    ck_assert_int_eq(read(sd1, dst, LEN), 3 * sizeof(REQ));
+    ck_assert_int_eq(read(sd2, dst, LEN), sizeof(REQ));
+    ck_assert_uint_eq(metrics.buf_sock_flush.counter, 2);
+    ck_assert_uint_eq(buf_sock_flush(NULL, NULL), 0);
+
+    /* what does not go out completely is reported */
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+    ck_assert_int_eq(setsockopt(s1->ch->sd, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+                sizeof(sndbuf)), 0);
+    ck_assert_int_eq(buf_sock_write(s1, src, LEN), LEN);
+    buf_sock_defer(s1);
+    ck_assert_uint_eq(buf_sock_flush(_flush_fail, &nfail), 1);
+    ck_assert_uint_eq(nfail, 1);
+
+    /* a dirty buf_sock returned is dropped from the flush */
+    buf_sock_defer(s2);
+    close(s2->ch->sd);
+    buf_sock_return(&s2);
+    ck_assert_uint_eq(buf_sock_flush(NULL, NULL), 0);
+
+    close(s1->ch->sd);
+    buf_sock_return(&s1);
+    close(sd1);
+    close(sd2);
+
+    test_teardown();
+    test_setup();
+#undef LEN
+#undef REQ
+}
+END_TEST
+
+START_TEST(test_frame_delim)
+{
+    struct frame_reader fr;
+    struct bstring frame;
+    struct buf *buf;
+
+    test_reset();
+
+    buf = buf_borrow();
+    ck_assert_ptr_ne(buf, NULL);
+    frame_reader_delim(&fr, "\r\n", 2, 16);
+
+    /* the delimiter arrives split over two reads */
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_UNFIN);
+    buf_write(buf, "get foo\r", 8);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_UNFIN);
+    ck_assert_uint_eq(fr.scanned, 7);
+    buf_write(buf, "\nget bar\r\nget", 13);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_OK);
+    ck_assert_int_eq(frame.len, 7);
+    ck_assert_int_eq(cc_bcmp(frame.data, "get foo", 7), 0);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_OK);
+    ck_assert_int_eq(frame.len, 7);
+    ck_assert_int_eq(cc_bcmp(frame.data, "get bar", 7), 0);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_UNFIN);
+    ck_assert_int_eq(buf_rsize(buf), 3);
+
+    /* frames point into the buf */
+    buf_write(buf, "\r\n", 2);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_OK);
+    ck_assert_ptr_eq(frame.data, buf->rpos - 5);
+    ck_assert_int_eq(frame.len, 3);
+
+    /* no delimiter within max */
+    buf_reset(buf);
+    frame_reader_reset(&fr);
+    buf_write(buf, "0123456789abcdefgh", 18);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_ERROR);
+
+    buf_return(&buf);
+}
+END_TEST
+
+START_TEST(test_frame_length)
+{
+    struct frame_reader fr;
+    struct bstring frame;
+    struct buf *buf;
+
+    test_reset();
+
+    buf = buf_borrow();
+    ck_assert_ptr_ne(buf, NULL);
+    frame_reader_length(&fr, 2, 32);
+
+    buf_write(buf, "\x00", 1);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_UNFIN);
+    buf_write(buf, "\x05hel", 4);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_UNFIN);
+    buf_write(buf, "lo\x00\x00", 4);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_OK);
+    ck_assert_int_eq(frame.len, 5);
+    ck_assert_int_eq(cc_bcmp(frame.data, "hello", 5), 0);
+
+    /* empty frames are frames */
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_OK);
+    ck_assert_int_eq(frame.len, 0);
+    ck_assert_int_eq(buf_rsize(buf), 0);
+
+    buf_write(buf, "\x01\x00", 2);
+    ck_assert_int_eq(frame_read(&fr, buf, &frame), CC_ERROR);
+
+    buf_return(&buf);
+}
+END_TEST
+
+START_TEST(test_frame_chain)
+{
+#define LEN (3 * TEST_BUF_CAP)
+    struct frame_reader fr;
+    struct bstring frame;
+    struct buf_sock *s;
+    char src[LEN + 2];
+    int sd, i;
+
+    test_reset();
+
+    for (i = 0; i < LEN; i++) {
+        src[i] = 'a' + i % 26;
+    }
+    src[10] = '\n';
+    src[LEN] = '\n';
+    src[LEN + 1] = 'x';
+
+    s = buf_sock_pair(&sd);
+    frame_reader_delim(&fr, "\n", 1, 0);
+    ck_assert_int_eq(frame_sock_read(&fr, s, &frame), CC_UNFIN);
+    ck_assert_int_eq(write(sd, src, LEN + 2), LEN + 2);
+    ck_assert_int_eq(buf_tcp_readv(s), CC_OK);
+    ck_assert(!STAILQ_EMPTY(&s->rchain));
+
+    /* the first frame is in rbuf, the second one reaches into rchain */
+    ck_assert_int_eq(frame_sock_read(&fr, s, &frame), CC_OK);
+    ck_assert_int_eq(frame.len, 10);
+    ck_assert_int_eq(frame_sock_read(&fr, s, &frame), CC_OK);
+    ck_assert_int_eq(frame.len, LEN - 11);
+    ck_assert_int_eq(cc_bcmp(frame.data, src + 11, LEN - 11), 0);
+    ck_assert_int_eq(frame_sock_read(&fr, s, &frame), CC_UNFIN);
+    ck_assert_int_eq(buf_rsize(s->rbuf), 1);
+    ck_assert(STAILQ_EMPTY(&s->rchain));
+
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    close(sd);
+#undef LEN
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+sockio_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_sockio = tcase_create("sockio test");
+    suite_add_tcase(s, tc_sockio);
+
+    tcase_add_test(tc_sockio, test_readv_coalesce);
+    tcase_add_test(tc_sockio, test_write_writev);
+    tcase_add_test(tc_sockio, test_writev_partial);
+    tcase_add_test(tc_sockio, test_lazy);
+    tcase_add_test(tc_sockio, test_channel);
+    tcase_add_test(tc_sockio, test_memory);
+    tcase_add_test(tc_sockio, test_poolslab);
+    tcase_add_test(tc_sockio, test_defer_flush);
+    tcase_add_test(tc_sockio, test_frame_delim);
+    tcase_add_test(tc_sockio, test_frame_length);
+    tcase_add_test(tc_sockio, test_frame_chain);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = sockio_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -4,6 +4,7 @@
 
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -24,6 +25,17 @@ test_teardown(void)
 {
 }
 
+static void *
+_cache_reset(void *arg)
+{
+    timer_options_st *options = arg;
+
+    timer_teardown();
+    timer_setup(options);
+
+    return NULL;
+}
+
 /*
  * tests
  */
@@ -164,6 +176,73 @@ START_TEST(test_timeout_absolute)
 }
 END_TEST
 
+START_TEST(test_timeout_cache)
+{
+    timer_options_st options = { TIMER_OPTION(OPTION_INIT) };
+    struct timespec ts = (struct timespec){0, 5000000}; /* 5ms */
+    struct timeout e;
+    pthread_t tid;
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(timer_options_st));
+    options.timer_cache.val.vbool = true;
+    timer_setup(&options);
+
+    /* a stale cached now does not advance across the sleep */
+    timer_cache_update();
+    timeout_add_ms(&e, 1);
+    nanosleep(&ts, NULL);
+    ck_assert(!timeout_expired(&e));
+    timer_cache_update();
+    ck_assert(timeout_expired(&e));
+    timer_teardown();
+
+    /* coarse clock, no cache */
+    options.timer_clock.val.vuint = TIMER_CLOCK_COARSE;
+    options.timer_cache.val.vbool = false;
+    timer_setup(&options);
+    timeout_add_ms(&e, 1);
+    ck_assert(!timeout_expired(&e));
+    nanosleep(&ts, NULL);
+    ck_assert(timeout_expired(&e));
+    timer_teardown();
+
+    /* teardown drops the cache */
+    timeout_add_ms(&e, 1);
+    nanosleep(&ts, NULL);
+    ck_assert(timeout_expired(&e));
+
+    /* of every thread, not just the one tearing down */
+    options.timer_clock.val.vuint = TIMER_CLOCK;
+    options.timer_cache.val.vbool = true;
+    timer_setup(&options);
+    timer_cache_update();
+    ck_assert_int_eq(pthread_create(&tid, NULL, _cache_reset, &options), 0);
+    ck_assert_int_eq(pthread_join(tid, NULL), 0);
+    timeout_add_ms(&e, 1);
+    nanosleep(&ts, NULL);
+    ck_assert(timeout_expired(&e));
+    timer_teardown();
+}
+END_TEST
+
+
+START_TEST(test_duration_record)
+{
+    struct metric m = {.name = "d", .type = METRIC_HISTOGRAM};
+    struct timespec ts = (struct timespec){0, 1000000}; /* 1ms */
+    struct duration d;
+
+    duration_start(&d);
+    nanosleep(&ts, NULL);
+    duration_stop(&d);
+    duration_record(&d, &m);
+
+    ck_assert_int_eq(m.histo->count, 1);
+    ck_assert_int_ge(metric_histogram_percentile(&m, 50.0), 1000000);
+    metric_free(&m, 1);
+}
+END_TEST
 
 /*
  * test suite
@@ -178,6 +257,7 @@ timer_suite(void)
     suite_add_tcase(s, tc_duration);
 
     tcase_add_test(tc_duration, test_duration);
+    tcase_add_test(tc_duration, test_duration_record);
 
     /* timeout */
     TCase *tc_timeout = tcase_create("timer/timeout test");
@@ -185,6 +265,7 @@ timer_suite(void)
 
     tcase_add_test(tc_timeout, test_timeout_intvl);
     tcase_add_test(tc_timeout, test_timeout_absolute);
+    tcase_add_test(tc_timeout, test_timeout_cache);
 
     return s;
 }
@@ -2,6 +2,8 @@
 
 #include <check.h>
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -203,6 +205,308 @@ START_TEST(test_timing_wheel_edge_case)
 }
 END_TEST
 
+struct fired {
+    struct timing_wheel *tw;
+    uint64_t            tick;   /* tick the event fired on */
+};
+
+static void
+_fired_cb(void *v)
+{
+    struct fired *f = v;
+
+    f->tick = f->tw->now;
+}
+
+START_TEST(test_timing_wheel_levels)
+{
+#define TICK_NS 1000000
+#define NSLOT 4
+#define NLEVEL 3
+#define NEVENT 6
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    struct timeout_event *tev;
+    struct timespec ts = (struct timespec){0, TICK_NS};
+    uint64_t due[NEVENT] = {0, 3, 4, 5, 17, 63};
+    struct fired f[NEVENT], g;
+    int i;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    ck_assert(timing_wheel_create_levels(&tick, NSLOT, 0, 0) == NULL);
+    tw = timing_wheel_create_levels(&tick, NSLOT, 0, NLEVEL);
+    ck_assert(tw != NULL);
+    ck_assert_int_eq(tw->span, NSLOT * NSLOT * NSLOT);
+    timing_wheel_start(tw);
+
+    /* beyond the span of all levels */
+    timeout_set_ns(&delay, TICK_NS * NSLOT * NSLOT * NSLOT);
+    ck_assert(timing_wheel_insert(tw, &delay, false, _fired_cb, &g) == NULL);
+
+    for (i = 0; i < NEVENT; i++) {
+        f[i] = (struct fired){tw, UINT64_MAX};
+        timeout_set_ns(&delay, TICK_NS * due[i]);
+        ck_assert(timing_wheel_insert(tw, &delay, false, _fired_cb, &f[i])
+                != NULL);
+    }
+    ck_assert_int_eq(tw->nevent, NEVENT);
+
+    /* every event fires on its own tick, however many levels it went down */
+    while (tw->nevent > 0) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    for (i = 0; i < NEVENT; i++) {
+        ck_assert_int_eq(f[i].tick, due[i]);
+    }
+    ck_assert_int_gt(metrics.timing_wheel_cascade.counter, 0);
+    ck_assert_int_eq(metrics.timing_wheel_process.counter, NEVENT);
+
+    /* remove from an upper level, flush fires what is left on any level */
+    timeout_set_ns(&delay, TICK_NS * NSLOT * NSLOT);
+    tev = timing_wheel_insert(tw, &delay, false, _fired_cb, &g);
+    timing_wheel_remove(tw, &tev);
+    ck_assert_int_eq(tw->nevent, 0);
+    for (i = 0; i < NEVENT; i++) {
+        f[i].tick = UINT64_MAX;
+        timeout_set_ns(&delay, TICK_NS * due[i]);
+        timing_wheel_insert(tw, &delay, due[i] > 0, _fired_cb, &f[i]);
+    }
+    timing_wheel_stop(tw);
+    timing_wheel_flush(tw);
+    ck_assert_int_eq(tw->nevent, 0);
+    for (i = 0; i < NEVENT; i++) {
+        ck_assert_int_ne(f[i].tick, UINT64_MAX);
+    }
+
+    timing_wheel_destroy(&tw);
+
+#undef NEVENT
+#undef NLEVEL
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+START_TEST(test_timing_wheel_next)
+{
+#define TICK_NS 1000000
+#define NSLOT 8
+#define NLEVEL 2
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    struct timespec ts = (struct timespec){0, TICK_NS * 6};
+    int64_t ns;
+    int i = 0;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create_levels(&tick, NSLOT, 0, NLEVEL);
+
+    /* nothing to wait for while stopped or empty */
+    timeout_set_ns(&delay, TICK_NS * 5);
+    timing_wheel_insert(tw, &delay, false, _incr_cb, &i);
+    ck_assert_int_eq(timing_wheel_next_ns(tw), -1);
+    timing_wheel_start(tw);
+
+    /* the wait covers the empty ticks before the one with the event */
+    ns = timing_wheel_next_ns(tw);
+    ck_assert_int_gt(ns, TICK_NS * 4);
+    ck_assert_int_le(ns, TICK_NS * 6);
+    ck_assert_int_ge(timing_wheel_next_ms(tw), 5);
+    ck_assert_int_le(timing_wheel_next_ms(tw), 6);
+
+    /* empty ticks are skipped in bulk and still counted */
+    nanosleep(&ts, NULL);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(i, 1);
+    ck_assert_int_ge(tw->ntick, 6);
+    ck_assert_int_eq(metrics.timing_wheel_tick.counter, tw->ntick);
+    ck_assert_int_eq(timing_wheel_next_ns(tw), -1);
+    ck_assert_int_eq(timing_wheel_next_ms(tw), -1);
+
+    /* an event on an upper level is waited for until level 0 wraps around */
+    timeout_set_ns(&delay, TICK_NS * NSLOT * 3 / 2);
+    timing_wheel_insert(tw, &delay, false, _incr_cb, &i);
+    ns = timing_wheel_next_ns(tw);
+    ck_assert_int_le(ns, TICK_NS * (NSLOT - tw->curr + 1));
+    while (i < 2) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert_int_eq(tw->nevent, 0);
+
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+
+#undef NLEVEL
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+START_TEST(test_timing_wheel_reschedule)
+{
+#define TICK_NS 1000000
+#define NSLOT 8
+#define NLEVEL 2
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    struct timeout_event *tev;
+    struct timespec ts = (struct timespec){0, TICK_NS};
+    struct fired f;
+    uint64_t touched;
+    int i;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create_levels(&tick, NSLOT, 0, NLEVEL);
+    timing_wheel_start(tw);
+
+    /* reschedule moves the event, the same event object stays in use */
+    f = (struct fired){tw, UINT64_MAX};
+    timeout_set_ns(&delay, TICK_NS * 2);
+    tev = timing_wheel_insert(tw, &delay, false, _fired_cb, &f);
+    timeout_set_ns(&delay, TICK_NS * NSLOT * NSLOT);
+    ck_assert_int_eq(timing_wheel_reschedule(tw, tev, &delay), CC_EINVAL);
+    timeout_set_ns(&delay, TICK_NS * (NSLOT + 2));
+    ck_assert_int_eq(timing_wheel_reschedule(tw, tev, &delay), CC_OK);
+    ck_assert_int_eq(tw->nevent, 1);
+    ck_assert_int_eq(metrics.timeout_event_borrow.counter, 1);
+    while (tw->nevent > 0) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert_int_eq(f.tick, NSLOT + 2);
+
+    /* a touched event keeps being pushed back, fires after the last touch */
+    f.tick = UINT64_MAX;
+    timeout_set_ns(&delay, TICK_NS * 3);
+    tev = timing_wheel_insert(tw, &delay, false, _fired_cb, &f);
+    for (i = 0; i < 8; i++) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+        ck_assert_int_eq(f.tick, UINT64_MAX);
+        timing_wheel_touch(tw, tev);
+    }
+    touched = tw->now;
+    while (tw->nevent > 0) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert_int_eq(f.tick, touched + 3);
+    ck_assert_int_eq(metrics.timeout_event_borrow.counter, 2);
+    ck_assert_int_eq(metrics.timing_wheel_reschedule.counter, 9);
+
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+
+#undef NLEVEL
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+#define NPOST 100
+struct poster {
+    struct timing_wheel     *tw;
+    struct timeout_event    *tev;   /* event to cancel from the other thread */
+    int                     *count;
+};
+
+static void *
+_post_worker(void *arg)
+{
+    struct poster *p = arg;
+    struct timeout delay;
+    int i;
+
+    timeout_set_ns(&delay, 0);
+    ck_assert_int_eq(timing_wheel_post_remove(p->tw, p->tev), CC_OK);
+    for (i = 0; i < NPOST; i++) {
+        ck_assert_int_eq(timing_wheel_post_insert(p->tw, &delay, false,
+                    _incr_cb, p->count), CC_OK);
+        if (i % 10 == 0) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+START_TEST(test_timing_wheel_mailbox)
+{
+#define TICK_NS 1000000
+#define NSLOT 8
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw, *other;
+    struct timeout_event *tev;
+    struct timespec ts = (struct timespec){0, TICK_NS};
+    struct poster p;
+    pthread_t worker;
+    int count = 0, cancelled = 0;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create(&tick, NSLOT, 0);
+    other = timing_wheel_create(&tick, NSLOT, 0);
+    timing_wheel_start(tw);
+    timing_wheel_start(other);
+
+    /* an event to be cancelled by the other thread before it is due */
+    timeout_set_ns(&delay, TICK_NS * (NSLOT - 1));
+    tev = timing_wheel_insert(tw, &delay, false, _incr_cb, &cancelled);
+    ck_assert(tev != NULL);
+    timing_wheel_insert(other, &delay, false, _incr_cb, &cancelled);
+
+    p = (struct poster){tw, tev, &count};
+    ck_assert_int_eq(pthread_create(&worker, NULL, _post_worker, &p), 0);
+    while (count < NPOST) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert_int_eq(pthread_join(worker, NULL), 0);
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_eq(metrics.timing_wheel_post.counter, NPOST + 1);
+    ck_assert_int_eq(metrics.timing_wheel_post_ex.counter, 0);
+
+    /* removing an event that has since fired is dropped */
+    timeout_set_ns(&delay, 0);
+    tev = timing_wheel_insert(tw, &delay, false, _incr_cb, &count);
+    ck_assert_int_eq(timing_wheel_post_remove(tw, tev), CC_OK);
+    nanosleep(&ts, NULL);
+    timing_wheel_execute(tw); /* remove goes first */
+    ck_assert_int_eq(count, NPOST);
+    tev = timing_wheel_insert(tw, &delay, false, _incr_cb, &count);
+    nanosleep(&ts, NULL);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(count, NPOST + 1);
+    ck_assert_int_eq(timing_wheel_post_remove(tw, tev), CC_OK);
+    nanosleep(&ts, NULL);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(metrics.timing_wheel_post_ex.counter, 1);
+
+    /* the other wheel and its own pool are untouched, and clean up */
+    ck_assert_int_eq(other->nevent, 1);
+    ck_assert_int_eq(cancelled, 0);
+    timing_wheel_destroy(&other);
+    ck_assert_int_eq(metrics.timeout_event_active.gauge, 0);
+
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+    ck_assert_int_eq(metrics.timeout_event_curr.gauge, 0);
+
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+#undef NPOST
 
 /*
  * test suite
@@ -218,6 +522,10 @@ wheel_suite(void)
     tcase_add_test(tc_wheel, test_timing_wheel_basic);
     tcase_add_test(tc_wheel, test_timing_wheel_recur);
     tcase_add_test(tc_wheel, test_timing_wheel_edge_case);
+    tcase_add_test(tc_wheel, test_timing_wheel_levels);
+    tcase_add_test(tc_wheel, test_timing_wheel_next);
+    tcase_add_test(tc_wheel, test_timing_wheel_reschedule);
+    tcase_add_test(tc_wheel, test_timing_wheel_mailbox);
 
     return s;
 }
@@ -0,0 +1,279 @@
+#include <cc_trace.h>
+
+#include <check.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUITE_NAME "trace"
+#define DEBUG_LOG  SUITE_NAME ".log"
+#define TRACE_TMP  "check_trace.out"
+
+#define NLINE      64
+#define LINE_LEN   128
+
+/*
+ * utilities
+ */
+static trace_options_st options = { TRACE_OPTION(OPTION_INIT) };
+
+static void
+test_setup(void)
+{
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(trace_options_st));
+    ck_assert_int_eq(trace_setup(&options), CC_OK);
+}
+
+static void
+test_teardown(void)
+{
+    trace_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+struct line {
+    uint64_t    ns;
+    uint32_t    tid;
+    char        phase;
+    char        event[32];
+    uint32_t    arg;
+};
+
+/* dump into a file and parse it back, returns the # lines */
+static int
+_dump(struct line *line, int nline)
+{
+    FILE *fp;
+    char buf[LINE_LEN];
+    int n = 0;
+
+    fp = fopen(TRACE_TMP, "w+");
+    ck_assert_ptr_ne(fp, NULL);
+    trace_dump(fileno(fp));
+    rewind(fp);
+    while (n < nline && fgets(buf, sizeof(buf), fp) != NULL) {
+        ck_assert_int_eq(sscanf(buf, "%"SCNu64" %"SCNu32" %c %31s %"SCNu32, &line[n].ns,
+                &line[n].tid, &line[n].phase, line[n].event, &line[n].arg), 5);
+        n++;
+    }
+    fclose(fp);
+    unlink(TRACE_TMP);
+
+    return n;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_record_dump)
+{
+    struct line line[NLINE];
+
+    test_reset();
+
+    ck_assert_int_eq(trace_name(TRACE_USER, "user"), CC_OK);
+    ck_assert_int_eq(trace_name(TRACE_DBUF_DOUBLE, "dbuf"), CC_EINVAL);
+    ck_assert_int_eq(trace_name(TRACE_NEVENT, "none"), CC_EINVAL);
+
+    trace_record(TRACE_DBUF_DOUBLE, 0);
+    trace_record(TRACE_DBUF_DOUBLE | TRACE_SPAN_END, 4096);
+    trace_record(TRACE_USER, 0);
+    trace_record(TRACE_USER + 1, 7);
+
+    ck_assert_int_eq(_dump(line, NLINE), 4);
+    ck_assert_str_eq(line[0].event, "dbuf_double");
+    ck_assert_int_eq(line[0].phase, 'B');
+    ck_assert_uint_eq(line[0].arg, 0);
+    ck_assert_str_eq(line[1].event, "dbuf_double");
+    ck_assert_int_eq(line[1].phase, 'E');
+    ck_assert_uint_eq(line[1].arg, 4096);
+    ck_assert_str_eq(line[2].event, "user");
+    ck_assert_str_eq(line[3].event, "6");
+    ck_assert_uint_eq(line[3].arg, 7);
+    ck_assert_uint_le(line[0].ns, line[1].ns);
+    ck_assert_uint_le(line[1].ns, line[3].ns);
+    ck_assert_uint_eq(line[0].tid, line[3].tid);
+
+    /* drained */
+    ck_assert_int_eq(_dump(line, NLINE), 0);
+}
+END_TEST
+
+START_TEST(test_full)
+{
+    struct line line[NLINE];
+    int i;
+
+    test_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(trace_options_st));
+    options.trace_nrec.val.vuint = 4;
+    ck_assert_int_eq(trace_setup(&options), CC_OK);
+
+    for (i = 0; i < 10; i++) {
+        trace_record(TRACE_USER, i);
+    }
+    ck_assert_uint_eq(trace_ndrop(), 6);
+    ck_assert_int_eq(_dump(line, NLINE), 4);
+    for (i = 0; i < 4; i++) {
+        ck_assert_uint_eq(line[i].arg, i);
+    }
+
+    /* room again after the dump */
+    trace_record(TRACE_USER, 10);
+    ck_assert_int_eq(_dump(line, NLINE), 1);
+    ck_assert_uint_eq(line[0].arg, 10);
+    ck_assert_uint_eq(trace_ndrop(), 6);
+
+    options.trace_nrec.val.vuint = 0;
+    test_teardown();
+    ck_assert_int_eq(trace_setup(&options), CC_EINVAL);
+
+    test_setup();
+}
+END_TEST
+
+static void *
+_writer(void *arg)
+{
+    uint32_t i;
+
+    for (i = 0; i < 8; i++) {
+        trace_record(TRACE_USER, (uint32_t)(uintptr_t)arg);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_threads)
+{
+    struct line line[NLINE];
+    pthread_t tid[2];
+    uint32_t count[2] = { 0, 0 };
+    int i, n;
+
+    test_reset();
+
+    pthread_create(&tid[0], NULL, _writer, (void *)0);
+    pthread_join(tid[0], NULL);
+    pthread_create(&tid[1], NULL, _writer, (void *)1);
+    pthread_join(tid[1], NULL);
+
+    /* buffers outlive their threads, each thread has its own */
+    n = _dump(line, NLINE);
+    ck_assert_int_eq(n, 16);
+    for (i = 0; i < n; i++) {
+        ck_assert_uint_lt(line[i].tid, 2);
+        ck_assert_uint_eq(line[i].tid, line[i].arg);
+        count[line[i].tid]++;
+    }
+    ck_assert_uint_eq(count[0], 8);
+    ck_assert_uint_eq(count[1], 8);
+}
+END_TEST
+
+START_TEST(test_signal)
+{
+    FILE *fp;
+    char buf[LINE_LEN];
+    int n = 0;
+
+    test_teardown();
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(trace_options_st));
+    options.trace_file.val.vstr = TRACE_TMP;
+    ck_assert_int_eq(trace_setup(&options), CC_OK);
+
+    trace_record(TRACE_LOG_FLUSH, 0);
+    trace_record(TRACE_LOG_FLUSH | TRACE_SPAN_END, 100);
+    raise(SIGUSR2);
+    test_teardown();
+
+    fp = fopen(TRACE_TMP, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        ck_assert_ptr_ne(strstr(buf, " log_flush "), NULL);
+        n++;
+    }
+    fclose(fp);
+    unlink(TRACE_TMP);
+    ck_assert_int_eq(n, 2);
+
+    options.trace_file.val.vstr = NULL;
+    test_setup();
+}
+END_TEST
+
+START_TEST(test_disabled)
+{
+    struct line line[NLINE];
+
+    test_teardown();
+    trace_record(TRACE_USER, 0);
+    ck_assert_uint_eq(trace_dump(STDERR_FILENO), 0);
+    ck_assert_uint_eq(trace_ndrop(), 0);
+
+    /* the macros only record if built with HAVE_TRACE */
+    test_setup();
+    TRACE_BEGIN(TRACE_USER);
+    TRACE_END_N(TRACE_USER, 1);
+#if defined CC_TRACE && CC_TRACE == 1
+    ck_assert_int_eq(_dump(line, NLINE), 2);
+#else
+    ck_assert_int_eq(_dump(line, NLINE), 0);
+#endif
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+trace_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_trace = tcase_create("trace test");
+    suite_add_tcase(s, tc_trace);
+
+    tcase_add_test(tc_trace, test_record_dump);
+    tcase_add_test(tc_trace, test_full);
+    tcase_add_test(tc_trace, test_threads);
+    tcase_add_test(tc_trace, test_signal);
+    tcase_add_test(tc_trace, test_disabled);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = trace_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}